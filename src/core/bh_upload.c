@@ -653,6 +653,8 @@ browse_host_open(
 		args.nagle = FALSE;
 		args.reduced = FALSE;
 		args.gzip = 0 != (flags & BH_F_GZIP);
+		args.async = FALSE;
+		args.bws = BSCHED_BWS_INVALID;		/* Fixed compression level */
 		args.buffer_flush = INT_MAX;		/* Flush only at the end */
 		args.buffer_size = BH_BUFSIZ;
 
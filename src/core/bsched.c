@@ -50,6 +50,8 @@
 #include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"
+#include "lib/tbucket.h"
+#include "lib/thread.h"
 #include "lib/vmm.h"
 #include "lib/walloc.h"
 
@@ -70,6 +72,7 @@ enum {
 	BS_F_NO_STEALING	= (1 << 8),		/**< Prevent b/w stealing from us */
 	BS_F_STOLEN_IGN		= (1 << 9),		/**< Ignore stolen bandwidth */
 	BS_F_UNIFORM_BW		= (1 << 10),	/**< Uniform b/w allocation */
+	BS_F_CONCURRENT		= (1 << 11),	/**< B/w granted from token bucket */
 
 	BS_F_RW				= (BS_F_READ|BS_F_WRITE)
 };
@@ -113,6 +116,12 @@ enum bsched_magic {
  * of the period, any amount of bandwidth that has been unused will be
  * given as "stolen" bandwidth to some of the schedulers stealing from us.
  * Priority is given to schedulers that used up all their bandwidth.
+ *
+ * In concurrent mode, bandwidth is granted from a lock-free token bucket,
+ * refilled at the beginning of each period, so that sources can be serviced
+ * by other threads than the main one.  The bandwidth consumed through the
+ * bucket is collected by the main thread when the period ends, hence
+ * stealing operates as usual.
  */
 
 struct bsched {
@@ -144,6 +153,7 @@ struct bsched {
 	int last_used;				/**< Nb of active sources last period */
 	int current_used;			/**< Nb of active sources this period */
 	uint io_favours;			/**< Amount of sources wanting favours */
+	tbucket_t *bucket;			/**< Token bucket, for concurrent mode */
 	unsigned looped:1;			/**< True when looped once over sources */
 };
 
@@ -172,6 +182,8 @@ static int64 bws_in_ema = 0;
 
 #define BW_UDP_OVERSIZE	1024 /**< Allow that many bytes over available b/w */
 
+#define BW_TOKEN_BATCH	4096 /**< Tokens taken at once in concurrent mode */
+
 static inline void
 bsched_check(const bsched_t * const bs)
 {
@@ -186,6 +198,30 @@ bio_check(const bio_source_t * const bio)
 	g_assert(BIO_SOURCE_MAGIC == bio->magic);
 }
 
+/**
+ * Must bandwidth be granted and accounted for through the token bucket?
+ *
+ * This is always the case outside of the main thread, since the other
+ * threads cannot use the adaptive per-slot allocation.  Only schedulers
+ * in concurrent mode grant them bandwidth.
+ */
+static inline bool
+bsched_concurrent(const bsched_t *bs)
+{
+	return (bs->flags & BS_F_CONCURRENT) || !thread_is_main();
+}
+
+/**
+ * Add the bandwidth consumed through the token bucket, if any, to the
+ * bandwidth used during the period.
+ */
+static inline void
+bsched_collect(bsched_t *bs)
+{
+	if G_UNLIKELY(bs->bucket != NULL)
+		bs->bw_actual += tbucket_consumed(bs->bucket);
+}
+
 /**
  * Create a new bandwidth scheduler.
  *
@@ -260,6 +296,7 @@ bsched_free(bsched_t *bs)
 
 	plist_free_null(&bs->sources);
 	pslist_free_null(&bs->stealers);
+	tbucket_free_null(&bs->bucket);
 	HFREE_NULL(bs->name);
 	bs->magic = 0;
 	WFREE(bs);
@@ -271,9 +308,10 @@ bsched_free(bsched_t *bs)
 bool
 bsched_saturated(bsched_bws_t bws)
 {
-	const bsched_t *bs = bsched_get(bws);
+	bsched_t *bs = bsched_get(bws);
 	if (!(bs->flags & BS_F_ENABLED))		/* Scheduler disabled */
 		return FALSE;
+	bsched_collect(bs);
 	return bs->bw_actual > bs->bw_max;
 }
 
@@ -1076,6 +1114,9 @@ bsched_begin_timeslice(bsched_t *bs)
 		 * re-establish proper scaling.
 		 */
 
+		if G_UNLIKELY(bs->bucket != NULL)
+			bio->bw_actual += tbucket_share_consumed(&bio->share);
+
 		actual = bio->bw_actual << BIO_EMA_SHIFT;
 		bio->bw_fast_ema += (actual >> 1) - (bio->bw_fast_ema >> 1);
 		bio->bw_slow_ema += (actual >> 6) - (bio->bw_slow_ema >> 6);
@@ -1165,6 +1206,14 @@ bsched_begin_timeslice(bsched_t *bs)
 	bs->current_used = 0;
 	bs->looped = FALSE;
 
+	/*
+	 * In concurrent mode, the bandwidth for the period is put in the bucket,
+	 * where its sources will get their fair share.
+	 */
+
+	if (bs->flags & BS_F_CONCURRENT)
+		tbucket_refill(bs->bucket, bs->bw_max + bs->bw_stolen);
+
 	/*
 	 * If there are passive callbacks installed, trigger them now.
 	 */
@@ -1326,6 +1375,16 @@ bsched_set_bandwidth(bsched_bws_t bws, int64 bandwidth)
 		return;
 	}
 
+	/*
+	 * In concurrent mode, the bucket is refilled with what is left for
+	 * the period given the new limit.
+	 */
+
+	bsched_collect(bs);
+
+	if (bs->flags & BS_F_CONCURRENT)
+		tbucket_refill(bs->bucket, bs->bw_max + bs->bw_stolen - bs->bw_actual);
+
 	/*
 	 * When all bandwidth has been used, disable all sources.
 	 */
@@ -1337,6 +1396,51 @@ bsched_set_bandwidth(bsched_bws_t bws, int64 bandwidth)
 }
 
 
+/**
+ * Grant bandwidth from the token bucket, in concurrent mode.
+ *
+ * @param `bs' the scheduler of the source.
+ * @param `bio' the source.
+ * @param `len' is the amount of bytes requested by the application.
+ *
+ * @returns the bandwidth available for the source.
+ */
+static size_t
+bw_available_concurrent(bsched_t *bs, bio_source_t *bio, int len)
+{
+	size_t granted;
+
+	/*
+	 * A thread may race with bws_concurrent() turning the mode off, in
+	 * which case the main thread will service the source.
+	 */
+
+	if G_UNLIKELY(!(bs->flags & BS_F_CONCURRENT))
+		return 0;
+
+	if (!(bs->flags & BS_F_ENABLED))		/* Scheduler disabled */
+		return len;							/* Use amount requested */
+
+	if (bs->flags & BS_F_NOBW)				/* No more bandwidth */
+		return 0;							/* Grant nothing */
+
+	granted = tbucket_grant(bs->bucket, &bio->share, len);
+
+	/*
+	 * Only the main thread can disable sources: all of them when the bucket
+	 * is empty, otherwise only the source which got its share.
+	 */
+
+	if (0 == granted && thread_is_main()) {
+		if (0 == tbucket_available(bs->bucket))
+			bsched_no_more_bandwidth(bs);
+		else if (bio->io_tag)
+			bio_disable(bio);
+	}
+
+	return granted;
+}
+
 /**
  * @param `bio' no brief description.
  * @param `len' is the amount of bytes requested by the application.
@@ -1359,6 +1463,9 @@ bw_available(bio_source_t *bio, int len)
 
 	bs = bsched_get(bio->bws);
 
+	if G_UNLIKELY(bsched_concurrent(bs))
+		return bw_available_concurrent(bs, bio, len);
+
 	if (!(bs->flags & BS_F_ENABLED))		/* Scheduler disabled */
 		return len;							/* Use amount requested */
 
@@ -1644,6 +1751,16 @@ bsched_bw_update(bsched_t *bs, ssize_t used, size_t requested)
 	g_assert(size_is_non_negative(used));
 	g_assert(UNSIGNED(used) <= requested);
 
+	/*
+	 * In concurrent mode, the bandwidth used is taken from the bucket and
+	 * will be collected at the end of the period.
+	 */
+
+	if (bs->flags & BS_F_CONCURRENT) {
+		tbucket_charge(bs->bucket, NULL, used);
+		return;
+	}
+
 	/*
 	 * Even when the scheduler is disabled, update the actual bandwidth used
 	 * for the statistics and the GUI display.
@@ -1683,6 +1800,50 @@ bio_bw_update(bio_source_t *bio, ssize_t used)
 		bio->bw_allocated -= MIN(bio->bw_allocated, used);
 }
 
+/**
+ * Account for the bandwidth used by an I/O on the source.
+ *
+ * In concurrent mode, unused granted bandwidth is given back to the bucket
+ * and pre-allocated bandwidth is ignored.
+ *
+ * @param `bio' the source.
+ * @param `used' is the amount of bytes used by the I/O, 0 if it failed.
+ * @param `requested' is the amount of bytes requested for the I/O.
+ * @param `granted' is the amount of bytes granted by bw_available().
+ */
+static void
+bio_bw_used(bio_source_t *bio, size_t used, size_t requested, size_t granted)
+{
+	bsched_t *bs = bsched_get(bio->bws);
+
+	if G_UNLIKELY(bsched_concurrent(bs)) {
+		g_assert(bs->bucket != NULL || 0 == granted);
+
+		if (NULL == bs->bucket)
+			return;
+
+		/*
+		 * Nothing was taken from the bucket when the scheduler is disabled.
+		 * UDP traffic can also use slightly more than what was granted.
+		 */
+
+		if (bs->flags & BS_F_ENABLED) {
+			size_t settled = MIN(used, granted);
+
+			tbucket_settle(bs->bucket, &bio->share, settled, granted);
+			used -= settled;
+		}
+
+		tbucket_charge(bs->bucket, &bio->share, used);
+		return;
+	}
+
+	if (used != 0) {
+		bsched_bw_update(bs, used, requested);
+		bio_bw_update(bio, used);
+	}
+}
+
 /**
  * Set I/O favouring for source.
  *
@@ -1771,10 +1932,7 @@ bio_write(bio_source_t *bio, const void *data, size_t len)
 		errno = VAL_EAGAIN;
 	}
 
-	if (r > 0) {
-		bsched_bw_update(bsched_get(bio->bws), r, amount);
-		bio_bw_update(bio, r);
-	}
+	bio_bw_used(bio, MAX(r, 0), amount, available);
 
 	return r;
 }
@@ -1886,11 +2044,8 @@ bio_writev(bio_source_t *bio, iovec_t *iov, int iovcnt)
 		errno = VAL_EAGAIN;
 	}
 
-	if (r > 0) {
-		g_assert((size_t) r <= available);
-		bsched_bw_update(bsched_get(bio->bws), r, MIN(len, available));
-		bio_bw_update(bio, r);
-	}
+	g_assert(r <= 0 || (size_t) r <= available);
+	bio_bw_used(bio, MAX(r, 0), MIN(len, available), available);
 
 	/*
 	 * Restore original I/O vector if we trimmed it.
@@ -1935,6 +2090,7 @@ bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	available = bw_available(bio, len);
 
 	if (available == 0 || available + BW_UDP_OVERSIZE < len) {
+		bio_bw_used(bio, 0, len, available);
 		errno = VAL_EAGAIN;
 		return -1;
 	}
@@ -1961,86 +2117,95 @@ bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 		errno = VAL_EAGAIN;
 	}
 
-	if (r > 0) {
-		bsched_bw_update(bsched_get(bio->bws),
-			r + BW_UDP_MSG, len + BW_UDP_MSG);
-		bio_bw_update(bio, r + BW_UDP_MSG);
-	}
+	bio_bw_used(bio, r > 0 ? r + BW_UDP_MSG : 0, len + BW_UDP_MSG, available);
 
 	return r;
 }
 
 /**
- * Write at most `len' bytes to source's fd, as bandwidth permits.
+ * Send several UDP datagrams at once, as bandwidth permits.
  *
- * Bytes are read from `offset' in the in_fd file descriptor, and the value
- * is updated in place by the kernel.
+ * Datagrams are sent in order and the amount sent for each datagram is
+ * filled in its "sent" field.  Only the leading datagrams that fit in the
+ * available bandwidth are considered, with the same tolerance as the one
+ * granted by bio_sendto() for large datagrams.
  *
- * @return -1 with errno set to EAGAIN, if we cannot write anything due to
- * bandwidth constraints.
+ * @return the amount of leading datagrams sent, or -1 with errno set if
+ * the first datagram could not be sent (EAGAIN signalling that there is
+ * no bandwidth available).
  */
-ssize_t
-bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio,
-	int in_fd, fileoffset_t *offset, size_t len)
+int
+bio_sendmmsg(bio_source_t *bio, wrap_dgram_t *dg, int cnt)
 {
-#if !defined(HAS_MMAP) && !defined(HAS_SENDFILE)
+	size_t available, total = 0, used = 0, requested = 0;
+	int i, n, r;
 
-	(void) ctx;
-	(void) bio;
-	(void) in_fd;
-	(void) offset;
-	(void) len;
-
-	g_assert_not_reached();
-	/* NOTREACHED */
-
-	errno = ENOSYS;
-
-	return (ssize_t) -1;
-
-#else /* USE_MMAP || HAS_SENDFILE */
-
-	/*
-	 * amount is only declared volatile to shut up the bogus warning by GCC
-	 * 2.95.x that ``amount'' *might* be clobbered by sigsetjmp - which is
-	 * actually not the case.
-	 */
-	size_t amount;
-	size_t available;
-	ssize_t r;
-	int out_fd;
-	fileoffset_t start;
-
-	g_assert(ctx);
 	bio_check(bio);
-	wrap_io_check(bio->wio);
 	g_assert(bio->flags & BIO_F_WRITE);
-	g_assert(offset);
-	g_assert(len > 0);
+	g_assert(cnt > 0);
 
-	start = *offset;
-	g_assert(start >= 0);
-	g_assert(start + (fileoffset_t) len > start);
+	for (i = 0; i < cnt; i++) {
+		total += dg[i].len;
+	}
 
-	out_fd = bio->wio->fd(bio->wio);
+	available = bw_available(bio, total);
 
 	/*
-	 * If we don't have any bandwidth, return -1 with errno set to EAGAIN
-	 * to signal that we cannot perform any I/O right now.
+	 * Determine how many leading datagrams we can afford to send.
 	 */
 
-	available = bw_available(bio, len);
+	for (n = 0, total = 0; n < cnt; n++) {
+		if (available == 0 || available + BW_UDP_OVERSIZE < total + dg[n].len)
+			break;
+		total += dg[n].len;
+	}
 
-	if (available == 0) {
+	if (0 == n) {
+		bio_bw_used(bio, 0, total, available);
 		errno = VAL_EAGAIN;
 		return -1;
 	}
 
-	amount = len > available ? available : len;
-
 	if (GNET_PROPERTY(bsched_debug) > 7)
-		g_debug("BSCHED %s(fd=%d, len=%zu) available=%zu",
-			G_STRFUNC, bio->wio->fd(bio->wio), len, available);
+		g_debug("BSCHED %s(wio=%d, cnt=%d/%d, len=%zu) available=%zu",
+			G_STRFUNC, bio->wio->fd(bio->wio), n, cnt, total, available);
+
+	g_assert(bio->wio != NULL);
+	g_assert(bio->wio->sendmmsg != NULL);
+	r = (*bio->wio->sendmmsg)(bio->wio, dg, n);
+
+	if (-1 == r && 0 == errno) {
+		g_warning("wio->sendmmsg(fd=%d, cnt=%d) returned -1 with errno = 0, "
+			"assuming EAGAIN", bio->wio->fd(bio->wio), n);
+		errno = VAL_EAGAIN;
+	}
+
+	for (i = 0; i < r; i++) {
+		used += dg[i].sent + BW_UDP_MSG;
+		requested += dg[i].len + BW_UDP_MSG;
+	}
+
+	bio_bw_used(bio, used, requested, available);
+
+	return r;
+}
+
+#if defined(HAS_MMAP) || defined(HAS_SENDFILE)
+/**
+ * Copy `amount' bytes from the in_fd file descriptor to out_fd, without any
+ * bandwidth accounting.
+ *
+ * Bytes are read from `offset' in the in_fd file descriptor, and the value
+ * is updated in place.
+ *
+ * @return amount of bytes written, -1 on error with errno set.
+ */
+static ssize_t
+bio_sendfile_fd(sendfile_ctx_t *ctx,
+	int out_fd, int in_fd, fileoffset_t *offset, size_t amount)
+{
+	fileoffset_t start = *offset;
+	ssize_t r;
 
 #if defined(HAS_MMAP) && !defined(HAS_SENDFILE)
 	{
@@ -2133,18 +2298,195 @@ bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio,
 		}
 	}
 #else /* !USE_MMAP */
+	(void) ctx;
+	(void) start;
+
 	r = compat_sendfile(out_fd, in_fd, offset, amount);
 #endif	/* USE_MMAP */
 
-	if (r > 0) {
-		bsched_bw_update(bsched_get(bio->bws), r, amount);
-		bio_bw_update(bio, r);
+	return r;
+}
+#endif	/* HAS_MMAP || HAS_SENDFILE */
+
+/**
+ * Write at most `len' bytes to source's fd, as bandwidth permits.
+ *
+ * Bytes are read from `offset' in the in_fd file descriptor, and the value
+ * is updated in place by the kernel.
+ *
+ * @return -1 with errno set to EAGAIN, if we cannot write anything due to
+ * bandwidth constraints.
+ */
+ssize_t
+bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio,
+	int in_fd, fileoffset_t *offset, size_t len)
+{
+#if !defined(HAS_MMAP) && !defined(HAS_SENDFILE)
+
+	(void) ctx;
+	(void) bio;
+	(void) in_fd;
+	(void) offset;
+	(void) len;
+
+	g_assert_not_reached();
+	/* NOTREACHED */
+
+	errno = ENOSYS;
+
+	return (ssize_t) -1;
+
+#else /* USE_MMAP || HAS_SENDFILE */
+
+	size_t amount;
+	size_t available;
+	ssize_t r;
+	fileoffset_t start;
+
+	g_assert(ctx);
+	bio_check(bio);
+	wrap_io_check(bio->wio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(offset);
+	g_assert(len > 0);
+
+	start = *offset;
+	g_assert(start >= 0);
+	g_assert(start + (fileoffset_t) len > start);
+
+	/*
+	 * If we don't have any bandwidth, return -1 with errno set to EAGAIN
+	 * to signal that we cannot perform any I/O right now.
+	 */
+
+	available = bw_available(bio, len);
+
+	if (available == 0) {
+		errno = VAL_EAGAIN;
+		return -1;
 	}
 
+	amount = len > available ? available : len;
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(fd=%d, len=%zu) available=%zu",
+			G_STRFUNC, bio->wio->fd(bio->wio), len, available);
+
+	r = bio_sendfile_fd(ctx, bio->wio->fd(bio->wio), in_fd, offset, amount);
+
+	bio_bw_used(bio, MAX(r, 0), amount, available);
+
 	return r;
 #endif /* !USE_MMAP && !HAS_SENDFILE */
 }
 
+/**
+ * Grant bandwidth to a writing source whose I/O will be performed later,
+ * possibly from another thread, through bio_sendfile_granted() or
+ * bio_write_granted().
+ *
+ * The source is accounted for exactly as if bio_write() had been called,
+ * and the amount actually written must be reported through bio_settle()
+ * once the I/O has been performed.
+ *
+ * Threads other than the main one can only be granted bandwidth when the
+ * scheduler is in concurrent mode, and must settle it themselves.
+ *
+ * @param bio		the I/O source
+ * @param len		the amount of bytes we would like to write
+ *
+ * @return the amount of bytes that can be written, 0 if none.
+ */
+size_t
+bio_grant(bio_source_t *bio, size_t len)
+{
+	size_t available;
+
+	bio_check(bio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(size_is_positive(len));
+
+	available = bw_available(bio, MIN(len, MAX_INT_VAL(int)));
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(fd=%d, len=%zu) available=%zu",
+			G_STRFUNC, bio->wio->fd(bio->wio), len, available);
+
+	return MIN(len, available);
+}
+
+/**
+ * Account for the I/O performed on bandwidth previously granted by
+ * bio_grant().
+ *
+ * @param bio		the I/O source
+ * @param used		the amount of bytes actually written
+ * @param granted	the amount of bytes that were granted
+ */
+void
+bio_settle(bio_source_t *bio, size_t used, size_t granted)
+{
+	bio_check(bio);
+	g_assert(used <= granted);
+
+	bio_bw_used(bio, used, granted, granted);
+}
+
+/**
+ * Write `amount' bytes to source's fd, on bandwidth granted by bio_grant().
+ *
+ * Bytes are read from `offset' in the in_fd file descriptor, and the value
+ * is updated in place.
+ *
+ * This routine performs no accounting and can therefore be called from any
+ * thread, provided the source is not concurrently used by another one.
+ *
+ * @return amount of bytes written, -1 on error with errno set.
+ */
+ssize_t
+bio_sendfile_granted(sendfile_ctx_t *ctx, bio_source_t *bio,
+	int in_fd, fileoffset_t *offset, size_t amount)
+{
+	bio_check(bio);
+	wrap_io_check(bio->wio);
+	g_assert(offset != NULL);
+	g_assert(*offset >= 0);
+	g_assert(amount > 0);
+
+#if !defined(HAS_MMAP) && !defined(HAS_SENDFILE)
+	(void) ctx;
+	(void) in_fd;
+
+	g_assert_not_reached();
+	/* NOTREACHED */
+
+	errno = ENOSYS;
+	return (ssize_t) -1;
+#else
+	return bio_sendfile_fd(ctx, bio->wio->fd(bio->wio), in_fd, offset, amount);
+#endif
+}
+
+/**
+ * Write `amount' bytes from `data' to source's fd, on bandwidth granted by
+ * bio_grant().
+ *
+ * This routine performs no accounting and can therefore be called from any
+ * thread, provided the source is not concurrently used by another one and
+ * its I/O layer is thread-safe (i.e. the source is not a TLS connection).
+ *
+ * @return amount of bytes written, -1 on error with errno set.
+ */
+ssize_t
+bio_write_granted(bio_source_t *bio, const void *data, size_t amount)
+{
+	bio_check(bio);
+	wrap_io_check(bio->wio);
+	g_assert(amount > 0);
+
+	return bio->wio->write(bio->wio, data, amount);
+}
+
 /**
  * Read at most `len' bytes from `buf' from source's fd, as bandwidth
  * permits.
@@ -2179,11 +2521,9 @@ bio_read(bio_source_t *bio, void *data, size_t len)
 			G_STRFUNC, bio->wio->fd(bio->wio), len, available);
 
 	r = bio->wio->read(bio->wio, data, amount);
-	if (r > 0) {
-		bsched_bw_update(bsched_get(bio->bws), r, amount);
-		bio_bw_update(bio, r);
+	bio_bw_used(bio, MAX(r, 0), amount, available);
+	if (r > 0)
 		bsched_get(bio->bws)->flags |= BS_F_DATA_READ;
-	}
 
 	return r;
 }
@@ -2297,12 +2637,10 @@ bio_readv(bio_source_t *bio, iovec_t *iov, int iovcnt)
 		errno = VAL_EAGAIN;
 	}
 
-	if (r > 0) {
-		g_assert((size_t) r <= available);
-		bsched_bw_update(bsched_get(bio->bws), r, MIN(len, available));
-		bio_bw_update(bio, r);
+	g_assert(r <= 0 || (size_t) r <= available);
+	bio_bw_used(bio, MAX(r, 0), MIN(len, available), available);
+	if (r > 0)
 		bsched_get(bio->bws)->flags |= BS_F_DATA_READ;
-	}
 
 	/*
 	 * Restore original I/O vector if we trimmed it.
@@ -2451,6 +2789,52 @@ bws_uniform_allocation(bsched_bws_t bws, bool uniform)
 	return was_uniform;
 }
 
+/**
+ * Turn concurrent mode on or off for the scheduler.
+ *
+ * In concurrent mode, bandwidth is granted from a lock-free token bucket
+ * refilled at each period, and sources can request bandwidth from any
+ * thread.  The per-slot allocation is not used: each source can get its
+ * fair share of the bandwidth, and twice that once all the sources that
+ * were active during the previous period had a chance to request some.
+ *
+ * @return previous status.
+ */
+bool
+bws_concurrent(bsched_bws_t bws, bool on)
+{
+	bsched_t *bs;
+	bool was_concurrent;
+
+	bs = bsched_get(bws);
+	was_concurrent = booleanize(bs->flags & BS_F_CONCURRENT);
+
+	if (on == was_concurrent)
+		return was_concurrent;
+
+	/*
+	 * The bucket is kept until the scheduler is freed since threads may
+	 * still be returning the bandwidth they were granted.
+	 */
+
+	if (on) {
+		if (NULL == bs->bucket)
+			bs->bucket = tbucket_make(BW_TOKEN_BATCH);
+		bsched_collect(bs);
+		tbucket_refill(bs->bucket, bs->bw_max + bs->bw_stolen - bs->bw_actual);
+		bs->flags |= BS_F_CONCURRENT;
+	} else {
+		bs->flags &= ~BS_F_CONCURRENT;
+	}
+
+	if (GNET_PROPERTY(bsched_debug)) {
+		g_debug("BSCHED %s: concurrent mode %s for \"%s\"",
+			G_STRFUNC, on ? "on" : "off", bs->name);
+	}
+
+	return was_concurrent;
+}
+
 /**
  * Returns adequate b/w shaper depending on the socket type.
  *
@@ -2627,6 +3011,8 @@ bws_can_connect(enum socket_type type)
 		if (bsout->flags & BS_F_NOBW)				/* No more bandwidth */
 			return FALSE;
 
+		bsched_collect(bsout);
+
 		/*
 		 * We need 1.5 TCP messages at least to allow the connection.
 		 */
@@ -2641,6 +3027,8 @@ bws_can_connect(enum socket_type type)
 		if (bsin->flags & BS_F_NOBW)				/* No more bandwidth */
 			return FALSE;
 
+		bsched_collect(bsin);
+
 		/*
 		 * We need 1 TCP message at least to allow the connection.
 		 */
@@ -2672,6 +3060,13 @@ bsched_heartbeat(bsched_t *bs, tm_t *tv)
 
 	bsched_check(bs);
 
+	/*
+	 * In concurrent mode, get the bandwidth consumed through the bucket
+	 * since we last looked.
+	 */
+
+	bsched_collect(bs);
+
 	/*
 	 * How much time elapsed since last call?
 	 */
@@ -77,8 +77,14 @@ ssize_t bio_write(bio_source_t *bio, const void *data, size_t len);
 ssize_t bio_writev(bio_source_t *bio, iovec_t *iov, int iovcnt);
 ssize_t bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	const void *data, size_t len);
+int bio_sendmmsg(bio_source_t *bio, wrap_dgram_t *dg, int cnt);
 ssize_t bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio, int in_fd,
 	fileoffset_t *offset, size_t len);
+size_t bio_grant(bio_source_t *bio, size_t len);
+void bio_settle(bio_source_t *bio, size_t used, size_t granted);
+ssize_t bio_sendfile_granted(sendfile_ctx_t *ctx, bio_source_t *bio,
+	int in_fd, fileoffset_t *offset, size_t amount);
+ssize_t bio_write_granted(bio_source_t *bio, const void *data, size_t amount);
 ssize_t bio_read(bio_source_t *bio, void *data, size_t len);
 ssize_t bio_readv(bio_source_t *bio, iovec_t *iov, int iovcnt);
 ssize_t bws_write(bsched_bws_t bs, wrap_io_t *wio,
@@ -98,6 +104,7 @@ void bws_udp_count_read(int len, bool dht);
 bool bws_allow_stealing(bsched_bws_t bws, bool allow);
 bool bws_ignore_stolen(bsched_bws_t bws, bool ignore);
 bool bws_uniform_allocation(bsched_bws_t bws, bool uniform);
+bool bws_concurrent(bsched_bws_t bws, bool on);
 
 bool bsched_enough_up_bandwidth(void);
 bool bsched_saturated(bsched_bws_t bws);
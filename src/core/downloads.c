@@ -58,6 +58,7 @@
 #include "ignore.h"
 #include "inet.h"		/* For INET_IP_V6READY */
 #include "ioheader.h"
+#include "iopool.h"
 #include "ipp_cache.h"
 #include "move.h"
 #include "nodes.h"
@@ -111,6 +112,7 @@
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
+#include "lib/iovec.h"
 #include "lib/iso3166.h"
 #include "lib/magnet.h"
 #include "lib/palloc.h"
@@ -200,6 +202,10 @@ static void download_queue_hold(struct download *d, uint32 hold,
 static void download_force_stop(struct download *d, const char * reason, ...);
 static void download_reparent(struct download *d, struct dl_server *new_server);
 static void download_silent_flush(struct download *d);
+static void download_write_sync(struct download *d);
+static void download_write_unpause(struct download *d);
+static bool download_flush(struct download *d, bool *trimmed, bool may_stop);
+static bool download_write_flushed(struct download *d, bool trimmed);
 static void change_server_addr(struct dl_server *server,
 	const host_addr_t new_addr, const uint16 new_port);
 static struct download *download_pick_another(const struct download *d);
@@ -1405,6 +1411,9 @@ buffers_free(struct download *d)
 	g_assert(d->buffers != NULL);
 	g_assert(d->buffers->held == 0);	/* No pending data */
 
+	download_write_sync(d);
+	download_write_unpause(d);
+
 	b = d->buffers;
 	pmsg_slist_free_all(&b->list);
 	WFREE(b);
@@ -3605,6 +3614,7 @@ download_info_change_all(fileinfo_t *old_fi, fileinfo_t *new_fi)
 			download_stop(d, GTA_DL_TIMEOUT_WAIT, no_reason);
 		}
 		g_assert(old_fi->refcount > 0);
+		download_write_sync(d);
 		file_info_remove_source(old_fi, d);
 		file_info_add_source(new_fi, d);
 
@@ -3889,6 +3899,9 @@ download_clone(struct download *d)
 
 	entropy_harvest_time();
 
+	download_write_sync(d);		/* Completions refer to `d' */
+	download_write_unpause(d);
+
 	/* The socket can be NULL if we're acting on a queued source */
 
 	if (s != NULL)
@@ -5294,6 +5307,7 @@ download_info_reget(struct download *d)
 	if (fi->flags & FI_F_TRANSIENT)
 		return;
 
+	download_write_sync(d);
 	file_info_clear_download(d, TRUE);			/* `d' might be running */
 	download_pipeline_free_null(&d->pipeline);
 	file_size_known = fi->file_size_known;		/* This should not change */
@@ -5469,6 +5483,7 @@ download_remove(struct download *d)
 	atom_str_free_null(&d->file_name);
 	atom_str_free_null(&d->uri);
 
+	download_write_sync(d);
 	file_info_remove_source(d->file_info, d);
 
 	download_check(d);
@@ -7149,6 +7164,7 @@ download_fallback_to_push(struct download *d,
 		socket_free_null(&d->socket);
 	}
 
+	download_write_sync(d);
 	file_object_release(&d->out_file);
 
 	download_set_status(d, user_request ? GTA_DL_PUSH_SENT : GTA_DL_FALLBACK);
@@ -9167,6 +9183,435 @@ out:
 	return success;
 }
 
+/*
+ * Asynchronous write-back.
+ *
+ * Buffered data can be handed to the I/O threads instead of being written
+ * from the main thread.  The download position moves forward immediately,
+ * but the range remains BUSY until the write is completed: file_info_update()
+ * is only called from the completion routine, run from the main thread in
+ * the write order.
+ *
+ * Writes for a file are serialized in a single I/O stream.  The write that
+ * completes the requested chunk or the file is submitted like the others,
+ * but reception is suspended until it is done, and the post-flush logic is
+ * run from its completion routine: by then, all the previous writes to the
+ * file have been done as well.  The main thread only synchronizes with the
+ * stream, waiting for the pending writes, before tearing down the download
+ * state or when asynchronous writes are not possible.
+ */
+
+enum dl_write_job_magic { DL_WRITE_JOB_MAGIC = 0x7a1c0e95 };
+
+/**
+ * An asynchronous write, processed by an I/O thread.
+ */
+struct dl_write_job {
+	enum dl_write_job_magic magic;
+	struct download *d;			/**< Download which received the data */
+	const file_object_t *fo;	/**< File to write to */
+	slist_t *list;				/**< The pmsg_t buffers to write */
+	iovec_t *iov;				/**< I/O vector on the buffers */
+	int iovcnt;					/**< Amount of entries in the I/O vector */
+	filesize_t offset;			/**< Offset in file of the data */
+	size_t length;				/**< Amount of data to write */
+	size_t written;				/**< Amount of data written */
+	int error;					/**< The errno of the failed write, or 0 */
+	unsigned completing:1;		/**< Completes the chunk or the file */
+	unsigned trimmed:1;			/**< Trailing data were trimmed */
+};
+
+static inline void
+dl_write_job_check(const struct dl_write_job * const wj)
+{
+	g_assert(wj != NULL);
+	g_assert(DL_WRITE_JOB_MAGIC == wj->magic);
+}
+
+static size_t download_write_inflight;	/**< Data held by write jobs */
+static pslist_t *download_write_paused;	/**< Downloads not reading */
+
+/**
+ * Free write job.
+ */
+static void
+dl_write_job_free(void *data)
+{
+	struct dl_write_job *wj = data;
+
+	dl_write_job_check(wj);
+
+	pmsg_slist_free_all(&wj->list);
+	HFREE_NULL(wj->iov);
+	wj->magic = 0;
+	WFREE(wj);
+}
+
+/**
+ * Write the data of the job, from an I/O thread.
+ *
+ * Like download_flush(), we loop until all the data have been written or
+ * an error occurs.
+ */
+static void
+dl_write_job_process(void *data)
+{
+	struct dl_write_job *wj = data;
+	iovec_t *iov;
+	int iovcnt;
+
+	dl_write_job_check(wj);
+
+	iov = wj->iov;
+	iovcnt = wj->iovcnt;
+
+	while (wj->written < wj->length) {
+		ssize_t ret;
+		size_t n;
+
+		ret = file_object_pwritev(wj->fo, iov, iovcnt,
+				wj->offset + wj->written);
+
+		if ((ssize_t) -1 == ret || 0 == ret) {
+			wj->error = 0 == ret ? EIO : errno;
+			break;
+		}
+
+		wj->written += ret;
+
+		/*
+		 * Skip over the data written.
+		 */
+
+		for (n = ret; n != 0; /* empty */) {
+			size_t len = iovec_len(iov);
+
+			g_assert(iovcnt > 0);
+
+			if (n >= len) {
+				n -= len;
+				iov++;
+				iovcnt--;
+			} else {
+				iovec_set(iov, ptr_add_offset(iovec_base(iov), n), len - n);
+				n = 0;
+			}
+		}
+	}
+}
+
+/**
+ * Resume reading on the downloads paused by the write back-pressure.
+ */
+static void
+download_write_resume(void)
+{
+	struct download *d;
+
+	if (download_write_inflight > GNET_PROPERTY(download_write_backlog) / 2)
+		return;
+
+	while (NULL != (d = pslist_shift(&download_write_paused))) {
+		download_check(d);
+		g_assert(d->write_paused);
+
+		d->write_paused = FALSE;
+		if (d->rx != NULL && !d->write_flushing)
+			rx_enable(d->rx);
+	}
+}
+
+/**
+ * Pause reading until the I/O threads have caught up.
+ */
+static void
+download_write_pause(struct download *d)
+{
+	download_check(d);
+
+	if (d->write_paused)
+		return;
+
+	if (GNET_PROPERTY(download_debug) > 1) {
+		g_debug("%s(): pausing \"%s\" from %s, %zu bytes being written",
+			G_STRFUNC, download_basename(d), download_host_info(d),
+			download_write_inflight);
+	}
+
+	d->write_paused = TRUE;
+	download_write_paused = pslist_prepend(download_write_paused, d);
+	rx_disable(d->rx);
+}
+
+/**
+ * Make sure download is no longer paused by the write back-pressure.
+ */
+static void
+download_write_unpause(struct download *d)
+{
+	download_check(d);
+
+	if (!d->write_paused)
+		return;
+
+	d->write_paused = FALSE;
+	download_write_paused = pslist_remove(download_write_paused, d);
+	if (d->rx != NULL && !d->write_flushing)
+		rx_enable(d->rx);
+}
+
+/**
+ * The write completing the requested chunk or the file is done: resume
+ * reception and go on with the download, now that all its data are on disk.
+ *
+ * @param d			the download
+ * @param trimmed	whether we had to trim the tail of the received data
+ */
+static void
+download_write_completed(struct download *d, bool trimmed)
+{
+	download_check(d);
+	g_assert(d->write_flushing);
+	g_assert(0 == d->inflight);
+	g_assert(0 == d->buffers->held);
+
+	d->write_flushing = FALSE;
+	if (d->rx != NULL && !d->write_paused)
+		rx_enable(d->rx);
+
+	/*
+	 * A failed write is reported by download_flush(), which will stop
+	 * the download.
+	 */
+
+	if G_UNLIKELY(d->write_errno != 0) {
+		download_flush(d, NULL, TRUE);
+		return;
+	}
+
+	(void) download_write_flushed(d, trimmed);
+}
+
+/**
+ * Write job completed, in the main thread.
+ */
+static void
+dl_write_job_done(void *owner, void *data)
+{
+	fileinfo_t *fi = owner;
+	struct dl_write_job *wj = data;
+	struct download *d;
+	bool completing, trimmed;
+
+	file_info_check(fi);
+	dl_write_job_check(wj);
+
+	d = wj->d;
+	download_check(d);
+	g_assert(d->file_info == fi);
+	g_assert(d->inflight >= wj->length);
+	g_assert(download_write_inflight >= wj->length);
+
+	if (wj->written != 0) {
+		file_info_update(d, wj->offset, wj->offset + wj->written,
+			DL_CHUNK_DONE);
+		gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+			GNET_PROPERTY(dl_byte_count) + wj->written);
+	}
+
+	/*
+	 * Errors are reported by the next download_flush(), which is always
+	 * called before the download moves past its requested chunk.  The
+	 * range we could not write stays BUSY and will be freed when the
+	 * download is stopped.
+	 */
+
+	if G_UNLIKELY(wj->error != 0 && 0 == d->write_errno)
+		d->write_errno = wj->error;
+
+	if (fi->buffered >= wj->length)
+		fi->buffered -= wj->length;
+	else
+		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
+
+	d->inflight -= wj->length;
+	download_write_inflight -= wj->length;
+
+	completing = wj->completing && d->write_flushing;
+	trimmed = wj->trimmed;
+
+	dl_write_job_free(wj);
+	download_write_resume();
+
+	if (completing)
+		download_write_completed(d, trimmed);
+}
+
+/**
+ * Wait until all the pending writes of the download are completed.
+ *
+ * This is only done before tearing down the download state, hence the
+ * post-flush logic of a completing write still pending is not run: the
+ * completion only accounts for the data written.
+ */
+static void
+download_write_sync(struct download *d)
+{
+	download_check(d);
+
+	if (0 == d->inflight)
+		return;
+
+	if (d->write_flushing) {
+		d->write_flushing = FALSE;
+		if (d->rx != NULL && !d->write_paused)
+			rx_enable(d->rx);
+	}
+
+	iopool_stream_sync(d->file_info->writer);
+
+	g_assert(0 == d->inflight);
+}
+
+/**
+ * Trim buffered data going past the end of the requested chunk.
+ *
+ * We can't have data going farther than what we requested from the
+ * server.  But if we do, trim and warn.
+ *
+ * @return TRUE if data were trimmed.
+ */
+static bool
+download_flush_trim(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	filesize_t extra;
+
+	if (b->held <= d->chunk.end - d->pos)
+		return FALSE;
+
+	extra = b->held - (d->chunk.end - d->pos);
+
+	if (GNET_PROPERTY(download_debug)) g_debug(
+		"server %s gave us %s more byte%s than requested for \"%s\"",
+		download_host_info(d), uint64_to_string(extra),
+		plural(extra), download_basename(d));
+
+	buffers_check_held(d);
+	buffers_strip_trailing(d, extra);
+	buffers_check_held(d);
+
+	g_assert(b->held > 0);	/* We had not reached end previously */
+
+	return TRUE;
+}
+
+/**
+ * Hand buffered data to the I/O threads, if possible.
+ *
+ * @return TRUE if the data were handled asynchronously, FALSE if they must
+ * be flushed synchronously via download_flush().
+ */
+static bool
+download_flush_async(struct download *d)
+{
+	struct dl_buffers *b;
+	fileinfo_t *fi;
+	struct dl_write_job *wj;
+	size_t held;
+	bool completing;
+
+	download_check(d);
+	g_assert(d->status == GTA_DL_RECEIVING);
+
+	b = d->buffers;
+	fi = d->file_info;
+
+	g_assert(!d->write_flushing);
+
+	/*
+	 * Once a previous asynchronous write failed, data are written
+	 * synchronously for reporting.
+	 */
+
+	if (!iopool_enabled(IOPOOL_DISK) || d->write_errno != 0)
+		return FALSE;
+
+	if (slist_length(b->list) > MAX_IOV_COUNT)
+		return FALSE;
+
+	/*
+	 * Completing the chunk or the file requires all the data to be on disk
+	 * before we go on: reception is suspended until the write is done, and
+	 * the remaining processing is deferred to its completion.
+	 */
+
+	completing = b->held >= d->chunk.end - d->pos ||
+		download_filedone(d) >= download_filesize(d);
+
+	/*
+	 * Apply back-pressure: keep the data buffered and stop reading until
+	 * enough writes have completed.  A completing write goes through, since
+	 * reception is suspended afterwards anyway.
+	 */
+
+	if (
+		!completing &&
+		download_write_inflight >= GNET_PROPERTY(download_write_backlog)
+	) {
+		download_write_pause(d);
+		return TRUE;
+	}
+
+	if G_UNLIKELY(NULL == fi->writer) {
+		fi->writer = iopool_stream_make(IOPOOL_DISK,
+			filepath_basename(fi->pathname), fi,
+			dl_write_job_process, dl_write_job_done, dl_write_job_free);
+	}
+
+	WALLOC0(wj);
+	wj->magic = DL_WRITE_JOB_MAGIC;
+	wj->completing = booleanize(completing);
+	if (completing)
+		wj->trimmed = booleanize(download_flush_trim(d));
+
+	buffers_check_held(d);
+
+	wj->d = d;
+	wj->fo = d->out_file;
+	wj->offset = d->pos;
+	wj->length = b->held;
+	wj->list = b->list;
+	wj->iov = pmsg_slist_to_iovec(wj->list, &wj->iovcnt, &held);
+
+	g_assert(held == wj->length);
+
+	if (GNET_PROPERTY(download_debug) > 10) {
+		g_debug("flushing %lu bytes (%u buffers) for \"%s\" asynchronously",
+			(ulong) b->held, slist_length(b->list), download_basename(d));
+	}
+
+	/*
+	 * The data remain accounted for in fi->buffered until written.
+	 */
+
+	b->list = slist_new();
+	b->held = 0;
+
+	d->pos += wj->length;
+	d->inflight += wj->length;
+	download_write_inflight += wj->length;
+
+	if (completing) {
+		d->write_flushing = TRUE;
+		rx_disable(d->rx);
+	}
+
+	iopool_stream_submit(fi->writer, wj);
+
+	return TRUE;
+}
+
 /**
  * Flush buffered data to disk.
  *
@@ -9181,6 +9626,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 {
 	struct dl_buffers *b;
 	ssize_t written;
+	bool cut;
 	filesize_t old_pos;		/* For assertion: original d->pos */
 	filesize_t old_held;	/* For assertion: original buffered amount */
 
@@ -9189,36 +9635,34 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	g_assert(b != NULL);
 	g_assert(d->status == GTA_DL_RECEIVING);
 
+	/*
+	 * Pending asynchronous writes come first, and they must have succeeded
+	 * for us to proceed.
+	 */
+
+	download_write_sync(d);
+
+	if G_UNLIKELY(d->write_errno != 0) {
+		errno = d->write_errno;
+		d->write_errno = 0;
+		written = -1;
+		goto failed;
+	}
+
 	if (GNET_PROPERTY(download_debug) > 10)
 		g_debug("flushing %lu bytes (%u buffers) for \"%s\"%s",
 			(ulong) b->held, slist_length(b->list),
 			download_basename(d), may_stop ? "" : " on stop");
 
 	/*
-	 * We can't have data going farther than what we requested from the
-	 * server.  But if we do, trim and warn.  And mark the server as not
-	 * being capable of handling keep-alive connections correctly!
+	 * Trim data going farther than what we requested from the server,
+	 * reporting it so that the server gets marked as not being capable
+	 * of handling keep-alive connections correctly!
 	 */
 
-	if (b->held > d->chunk.end - d->pos) {
-		filesize_t extra = b->held - (d->chunk.end - d->pos);
-
-		if (GNET_PROPERTY(download_debug)) g_debug(
-			"server %s gave us %s more byte%s than requested for \"%s\"",
-			download_host_info(d), uint64_to_string(extra),
-			plural(extra), download_basename(d));
-
-		buffers_check_held(d);
-		buffers_strip_trailing(d, extra);
-		buffers_check_held(d);
-
-		if (trimmed)
-			*trimmed = TRUE;
-
-		g_assert(b->held > 0);	/* We had not reached end previously */
-	} else if (trimmed) {
-		*trimmed = FALSE;
-	}
+	cut = download_flush_trim(d);
+	if (trimmed != NULL)
+		*trimmed = cut;
 
 	/*
 	 * writev() and others do not necessarily flush the complete buffer
@@ -9275,6 +9719,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 		}
 	} while (b->held > 0);
 
+failed:
 	if ((ssize_t) -1 == written) {
 		const char *error;
 
@@ -9513,10 +9958,10 @@ download_write_data(struct download *d)
 	struct dl_buffers *b;
 	fileinfo_t *fi;
 	bool trimmed = FALSE;
-	enum dl_chunk_status status = DL_CHUNK_BUSY;
 	bool should_flush;
 
 	download_check(d);
+	g_assert(!d->write_flushing);	/* Reception suspended meanwhile */
 
 	b = d->buffers;
 	fi = d->file_info;
@@ -9587,8 +10032,34 @@ download_write_data(struct download *d)
 	if (!should_flush)
 		return TRUE;
 
-	if (!download_flush(d, &trimmed, TRUE))
+	if (download_flush_async(d)) {
+		if (d->write_paused)
+			return TRUE;		/* Data kept buffered, nothing written */
+		if (d->write_flushing)
+			return TRUE;		/* Continued by download_write_completed() */
+	} else if (!download_flush(d, &trimmed, TRUE)) {
 		return FALSE;
+	}
+
+	return download_write_flushed(d, trimmed);
+}
+
+/**
+ * Check where the download stands once its data were flushed to disk,
+ * ending it if we have completed it.
+ *
+ * @param d			the download
+ * @param trimmed	whether we had to trim the tail of the received data
+ *
+ * @return FALSE if we must stop reading data for the download.
+ */
+static bool
+download_write_flushed(struct download *d, bool trimmed)
+{
+	fileinfo_t *fi = d->file_info;
+	enum dl_chunk_status status;
+
+	download_check(d);
 
 	/*
 	 * End download if we have completed it.
@@ -12818,6 +13289,7 @@ http_version_nofix:
 		struct rx_inflate_args args;
 
 		args.cb = &download_rx_inflate_cb;
+		args.async = FALSE;
 		d->rx = rx_make_above(d->rx, rx_inflate_get_ops(), &args);
 		d->flags |= DL_F_NO_PIPELINE;	/* Disabled for this request */
 	}
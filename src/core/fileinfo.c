@@ -52,6 +52,7 @@
 #include "guid.h"
 #include "hosts.h"
 #include "huge.h"
+#include "iopool.h"
 #include "namesize.h"
 #include "nodes.h"
 #include "publisher.h"
@@ -69,12 +70,16 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/crash.h"
 #include "lib/cstr.h"
+#include "lib/dbmw.h"
+#include "lib/dbstore.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
@@ -83,6 +88,7 @@
 #include "lib/halloc.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
@@ -90,6 +96,7 @@
 #include "lib/mempcpy.h"
 #include "lib/parse.h"
 #include "lib/path.h"
+#include "lib/pmsg.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
@@ -139,6 +146,10 @@ enum dl_file_chunk_magic { DL_FILE_CHUNK_MAGIC = 0x563b483d };
  * These are linked to form the chunklist, the list of all the chunks defined
  * for the file and which are either completed, reserved, or empty (not yet
  * downloaded).
+ *
+ * Chunks are also indexed by offset range in the fileinfo's chunktree, so
+ * that the chunk holding a given file offset is found in O(log n) without
+ * walking the whole list, which can be long for heavily swarmed files.
  */
 struct dl_file_chunk {
 	enum dl_file_chunk_magic magic;
@@ -147,6 +158,7 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in chunktree */
 };
 
 static inline void
@@ -242,6 +254,39 @@ enum dl_file_info_field {
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
 
+/*
+ * The fileinfo database is kept in a DBMW store, indexed by fileinfo GUID,
+ * where each value is a serialized fileinfo record.  Only the entries that
+ * changed since the last flush are rewritten.  The legacy ASCII "fileinfo"
+ * file is only read to migrate older settings, and can still be exported.
+ */
+
+#define FI_DB_CACHE_SIZE	0			/**< No DBMW cache, writes go through */
+#define FI_DB_VALUE_MAX		(128 * 1024)	/**< Largest serialized record */
+#define FI_DB_VERSION		1			/**< Serialization version */
+
+/*
+ * Flags in serialized fileinfo records.
+ */
+#define FI_DB_F_PAUSED		(1U << 0)	/**< Download paused */
+#define FI_DB_F_SEEDING		(1U << 1)	/**< File is being seeded */
+#define FI_DB_F_SIZE_KNOWN	(1U << 2)	/**< fi->file_size_known */
+#define FI_DB_F_SWARMING	(1U << 3)	/**< fi->use_swarming */
+
+/*
+ * Hashes present in serialized fileinfo records.
+ */
+#define FI_DB_H_SHA1		(1U << 0)
+#define FI_DB_H_TTH			(1U << 1)
+#define FI_DB_H_CHA1		(1U << 2)
+
+static const char db_fileinfo_base[] = "fileinfo";
+static const char db_fileinfo_what[] = "Fileinfo database";
+
+static dbmw_t *db_fileinfo;
+static hset_t *fi_db_dirty;		/**< Fileinfos to rewrite in the database */
+static bool fi_db_loading;		/**< Set whilst loading the database */
+
 /**
  * Update the minimum download chunksize.
  *
@@ -576,11 +621,39 @@ file_info_request_handle(fileinfo_t *fi)
 	return idtable_new_id(fi_handle_map, fi);
 }
 
+/**
+ * Record that the fileinfo must be rewritten in the fileinfo database at
+ * the next flush.
+ */
+static void
+file_info_db_dirty(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	if (NULL == fi_db_dirty || (FI_F_TRANSIENT & fi->flags))
+		return;
+
+	hset_insert(fi_db_dirty, fi);
+	fileinfo_dirty = TRUE;
+}
+
 static void
 fi_event_trigger(fileinfo_t *fi, gnet_fi_ev_t id)
 {
 	file_info_check(fi);
 	g_assert(UNSIGNED(id) < EV_FI_EVENTS);
+
+	/*
+	 * Any change that is worth notifying is also worth persisting, at least
+	 * when it is not generated by the loading of the database itself.
+	 */
+
+	if (
+		!fi_db_loading &&
+		EV_FI_REMOVED != id && EV_FI_STATUS_CHANGED_TRANSIENT != id
+	)
+		file_info_db_dirty(fi);
+
 	event_trigger(fi_events[id], T_NORMAL(fi_listener_t, (fi->fi_handle)));
 }
 
@@ -675,6 +748,131 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two file chunks so that chunks are equal only when they overlap.
+ */
+static int
+dl_file_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)		/* `to' is NOT part of the chunk */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Append chunk at the tail of the chunklist.
+ *
+ * When the chunk overlaps with an already indexed one, it is only appended
+ * to the list: the chunklist is then inconsistent, which will be caught by
+ * file_info_check_chunklist().
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	dl_file_chunk_check(fc);
+
+	eslist_append(&fi->chunklist, fc);
+	(void) erbtree_insert(&fi->chunktree, &fc->node);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the chunklist.
+ *
+ * The range of `fc' must have been shrunk already so that it no longer
+ * overlaps with `nfc'.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	void *old;
+
+	dl_file_chunk_check(fc);
+	dl_file_chunk_check(nfc);
+	g_assert(fc->to <= nfc->from);
+
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	old = erbtree_insert(&fi->chunktree, &nfc->node);
+
+	g_assert_log(NULL == old,
+		"%s(): new chunk [%s, %s[ overlaps with existing one",
+		G_STRFUNC, filesize_to_string(nfc->from), filesize_to_string2(nfc->to));
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk, which the caller must free.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *next;
+
+	next = eslist_remove_after(&fi->chunklist, fc);
+	dl_file_chunk_check(next);
+	erbtree_remove(&fi->chunktree, &next->node);
+
+	return next;
+}
+
+/**
+ * @return the chunk holding the byte at the specified offset, NULL if none.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t offset)
+{
+	struct dl_file_chunk key;
+
+	key.from = offset;
+	key.to = offset + 1;
+
+	return erbtree_lookup(&fi->chunktree, &key);
+}
+
+/**
+ * @return the chunk preceding `fc' in the file, NULL if `fc' is the first.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return erbtree_data(&fi->chunktree, erbtree_prev(&fc->node));
+}
+
+/**
+ * Find the first empty chunk ending after the specified offset.
+ *
+ * Since adjacent chunks bearing the same status are coalesced (excepted
+ * busy ones), there are only a few chunks between two holes and this is
+ * essentially O(log n) in the amount of chunks.
+ *
+ * @return the first empty chunk ending after `offset', NULL if none.
+ */
+static const struct dl_file_chunk *
+fi_next_hole(const fileinfo_t *fi, filesize_t offset)
+{
+	const struct dl_file_chunk *fc;
+
+	for (
+		fc = fi_chunk_lookup(fi, offset);
+		fc != NULL;
+		fc = eslist_next_data(&fi->chunklist, fc)
+	) {
+		dl_file_chunk_check(fc);
+
+		if (DL_CHUNK_EMPTY == fc->status)
+			return fc;
+	}
+
+	return NULL;
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -743,6 +941,9 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 
 	file_info_check(fi);
 
+	if (eslist_count(&fi->chunklist) != erbtree_count(&fi->chunktree))
+		return FALSE;		/* Some chunks were overlapping */
+
 	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 		if (last != fc->from || fc->from >= fc->to)
@@ -863,7 +1064,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	file_info_db_dirty(fi);
 
 	entropy_harvest_time();
 }
@@ -1133,6 +1334,7 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunktree);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
@@ -1160,6 +1362,7 @@ fi_downloading_free(fileinfo_t *fi)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
+	iopool_stream_free(&fi->writer);	/* No download can be writing now */
 	file_info_chunklist_free(fi);
 	file_info_available_free(fi);
 
@@ -1181,6 +1384,9 @@ fi_free(fileinfo_t *fi)
 
 	file_info_upload_stop(fi, N_("File info being freed"));
 
+	if (fi_db_dirty != NULL)
+		hset_remove(fi_db_dirty, fi);
+
 	if (fi->alias != NULL) {
 		pslist_t *sl;
 
@@ -1306,7 +1512,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1346,7 +1552,7 @@ file_info_resize(fileinfo_t *fi, filesize_t size)
 
 	if (!(fi->flags & FI_F_TRANSIENT)) {
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_db_dirty(fi);
 	}
 }
 
@@ -1382,6 +1588,9 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 
 		fi->alias = pslist_append_const(fi->alias, atom_str_get(name));
 
+		if (!fi_db_loading)
+			file_info_db_dirty(fi);
+
 		if (record) {
 			if (NULL != list) {
 				pslist_append(list, fi);
@@ -1910,6 +2119,8 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunktree, dl_file_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2171,7 +2382,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2257,18 +2468,30 @@ eof:
 }
 
 /**
- * Stores a file info record to the config_dir/fileinfo file, and
- * appends it to the output file in question if needed.
+ * Flush the trailer of the output file if it is dirty.
+ *
+ * @return TRUE if the trailer is still dirty, its flush being delayed.
  */
-static void
-file_info_store_one(FILE *f, fileinfo_t *fi)
+static bool
+file_info_flush_trailer(fileinfo_t *fi)
 {
-	slink_t *cl;
-	pslist_t *sl;
-	char *path;
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+		return FALSE;
 
-	file_info_check(fi);
+	if (fi->use_swarming && fi->dirty) {
+		file_info_store_binary(fi, FALSE);
+		return fi->dirty;
+	}
+
+	return FALSE;
+}
 
+/**
+ * Check whether the fileinfo needs to be persisted.
+ */
+static bool
+file_info_is_persistent(const fileinfo_t *fi)
+{
 	/*
 	 * We now persist seeded files in order to be able to resume seeding
 	 * after a crash and a restart, thereby ensuring continuity of the
@@ -2277,16 +2500,10 @@ file_info_store_one(FILE *f, fileinfo_t *fi)
 	 */
 
 	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
-		goto persist;		/* Skip trailer writes, of course */
+		return TRUE;
 
 	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
-
-	if (fi->use_swarming && fi->dirty) {
-		file_info_store_binary(fi, FALSE);
-	}
-
-persist:
+		return FALSE;
 
 	/*
 	 * Keep entries for incomplete or not even started downloads so that the
@@ -2297,10 +2514,28 @@ persist:
 		filestat_t st;
 
 		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
+			return FALSE; 	/* Not referenced, and file no longer exists */
 		}
 	}
 
+	return TRUE;
+}
+
+/**
+ * Writes a file info record to the config_dir/fileinfo file.
+ */
+static void
+file_info_store_one(FILE *f, fileinfo_t *fi)
+{
+	slink_t *cl;
+	pslist_t *sl;
+	char *path;
+
+	file_info_check(fi);
+
+	if (!file_info_is_persistent(fi))
+		return;
+
 	path = filepath_directory(fi->pathname);
 	fprintf(f,
 		"# refcount %u\n"
@@ -2380,7 +2615,7 @@ persist:
 }
 
 /**
- * Callback for hash table iterator. Used by file_info_store().
+ * Callback for hash table iterator. Used by file_info_export().
  */
 static void
 file_info_store_list(void *value, void *user_data)
@@ -2392,11 +2627,11 @@ file_info_store_list(void *value, void *user_data)
 }
 
 /**
- * Stores the list of output files and their metainfo to the
- * configdir/fileinfo database.
+ * Exports the list of output files and their metainfo to the legacy
+ * configdir/fileinfo ASCII database.
  */
 void
-file_info_store(void)
+file_info_export(void)
 {
 	FILE *f;
 	file_path_t fp;
@@ -2438,7 +2673,198 @@ file_info_store(void)
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
 	file_config_close(f, &fp);
-	fileinfo_dirty = FALSE;
+}
+
+/**
+ * Serialize fileinfo into a new message block, suitable for the fileinfo
+ * database.
+ *
+ * The chunks are omitted when the record would be too large: they are then
+ * recovered from the file trailer when the record is loaded back.
+ *
+ * @return the serialized record, to be freed with pmsg_free().
+ */
+static pmsg_t *
+file_info_db_serialize(const fileinfo_t *fi)
+{
+	const struct dl_file_chunk *fc;
+	const pslist_t *sl;
+	size_t size, count, aliases = 0;
+	uint8 flags = 0, hashes = 0;
+	pmsg_t *mb;
+
+	/*
+	 * Compute an upper bound of the serialized length, knowing that each
+	 * variable-length integer takes at most 10 bytes.
+	 */
+
+	size = 1 + 10 + vstrlen(fi->pathname) + 4 + 2 * 8 + 3 * 4 + 2;
+	size += 2 * SHA1_RAW_SIZE + TTH_RAW_SIZE;
+	size += 2 * 10;
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		size_t len = 10 + vstrlen(sl->data);
+
+		if (size + len > FI_DB_VALUE_MAX / 2)
+			break;			/* Keep room for the chunks */
+
+		size += len;
+		aliases++;
+	}
+
+	count = eslist_count(&fi->chunklist);
+
+	if (size + count * (10 + 1) > FI_DB_VALUE_MAX) {
+		g_warning("%s(): too many chunks (%zu) for \"%s\", "
+			"will have to rely on the file trailer",
+			G_STRFUNC, count, fi->pathname);
+		count = 0;
+	}
+
+	size += count * (10 + 1);
+	mb = pmsg_new(PMSG_P_DATA, NULL, MIN(size, FI_DB_VALUE_MAX));
+
+	if (FI_F_PAUSED & fi->flags)
+		flags |= FI_DB_F_PAUSED;
+	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
+		flags |= FI_DB_F_SEEDING;
+	if (fi->file_size_known)
+		flags |= FI_DB_F_SIZE_KNOWN;
+	if (fi->use_swarming)
+		flags |= FI_DB_F_SWARMING;
+
+	if (fi->sha1 != NULL)
+		hashes |= FI_DB_H_SHA1;
+	if (fi->tth != NULL)
+		hashes |= FI_DB_H_TTH;
+	if (fi->cha1 != NULL)
+		hashes |= FI_DB_H_CHA1;
+
+	pmsg_write_u8(mb, FI_DB_VERSION);
+	pmsg_write_string(mb, fi->pathname, (size_t) -1);
+	pmsg_write_be32(mb, fi->generation);
+	pmsg_write_be64(mb, fi->size);
+	pmsg_write_be64(mb, fi->done);
+	pmsg_write_time(mb, fi->stamp);
+	pmsg_write_time(mb, fi->created);
+	pmsg_write_time(mb, fi->ntime);
+	pmsg_write_u8(mb, flags);
+	pmsg_write_u8(mb, hashes);
+
+	if (fi->sha1 != NULL)
+		pmsg_write(mb, fi->sha1, SHA1_RAW_SIZE);
+	if (fi->tth != NULL)
+		pmsg_write(mb, fi->tth, TTH_RAW_SIZE);
+	if (fi->cha1 != NULL)
+		pmsg_write(mb, fi->cha1, SHA1_RAW_SIZE);
+
+	pmsg_write_ule64(mb, aliases);
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		if (0 == aliases--)
+			break;
+		pmsg_write_string(mb, sl->data, (size_t) -1);
+	}
+
+	/*
+	 * Chunks being contiguous, only their length needs to be recorded.
+	 */
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	pmsg_write_ule64(mb, count);
+
+	if (count != 0) {
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+			dl_file_chunk_check(fc);
+			pmsg_write_ule64(mb, fc->to - fc->from);
+			pmsg_write_u8(mb, fc->status);
+		}
+	}
+
+	return mb;
+}
+
+/**
+ * Hash set iterator to write a dirty fileinfo to the fileinfo database.
+ */
+static void
+file_info_db_store(const void *data, void *unused_udata)
+{
+	fileinfo_t *fi = deconstify_pointer(data);
+	bool pending;
+
+	(void) unused_udata;
+	file_info_check(fi);
+
+	if (!fi->hashed)
+		return;
+
+	pending = file_info_flush_trailer(fi);
+
+	if (file_info_is_persistent(fi)) {
+		pmsg_t *mb = file_info_db_serialize(fi);
+
+		dbmw_write(db_fileinfo, fi->guid,
+			deconstify_pointer(pmsg_start(mb)), pmsg_written_size(mb));
+		pmsg_free(mb);
+	} else {
+		dbmw_delete(db_fileinfo, fi->guid);
+	}
+
+	/*
+	 * Flushing the trailer above will have flagged the fileinfo as dirty
+	 * again, but the record is now up-to-date.  Unless the trailer flush
+	 * was delayed, in which case we'll come back to it at the next run.
+	 */
+
+	if (pending)
+		file_info_db_dirty(fi);
+	else
+		hset_remove(fi_db_dirty, fi);
+}
+
+/**
+ * Writes the fileinfo records that changed since the last call to the
+ * fileinfo database.
+ */
+void
+file_info_store(void)
+{
+	hset_t *dirty;
+
+	if (NULL == fi_db_dirty)
+		return;			/* Not initialized yet */
+
+	/*
+	 * Iterate on a private set since flushing can flag fileinfos again.
+	 */
+
+	dirty = fi_db_dirty;
+	fi_db_dirty = hset_create(HASH_KEY_SELF, 0);
+
+	/*
+	 * Without a database, fall back to rewriting the ASCII database.
+	 */
+
+	if G_UNLIKELY(NULL == db_fileinfo) {
+		hset_free_null(&dirty);
+		file_info_export();
+		fileinfo_dirty = FALSE;
+		return;
+	}
+
+	if (GNET_PROPERTY(fileinfo_debug) > 1) {
+		g_debug("%s(): flushing %zu dirty record%s out of %zu",
+			G_STRFUNC, hset_count(dirty), plural(hset_count(dirty)),
+			hikset_count(fi_by_outname));
+	}
+
+	hset_foreach(dirty, file_info_db_store, NULL);
+	hset_free_null(&dirty);
+
+	dbstore_sync_flush(db_fileinfo);
+	fileinfo_dirty = 0 != hset_count(fi_db_dirty);
 }
 
 /**
@@ -2615,6 +3041,14 @@ file_info_close(void)
 {
 	unsigned i;
 
+	file_info_store_if_dirty();
+
+	if (db_fileinfo != NULL && GNET_PROPERTY(fileinfo_export))
+		file_info_export();
+
+	dbstore_close(db_fileinfo, settings_gnet_db_dir(), db_fileinfo_base);
+	db_fileinfo = NULL;
+
 	/*
 	 * Freeing callbacks expect that the freeing of the `fi_by_outname'
 	 * table will free the referenced `fi' (since that table MUST contain
@@ -2649,6 +3083,7 @@ file_info_close(void)
 	htable_free_null(&fi_by_namesize);
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
+	hset_free_null(&fi_db_dirty);
 
 	HFREE_NULL(tbuf.arena);
 }
@@ -2799,6 +3234,17 @@ file_info_hash_remove(fileinfo_t *fi)
 	if (fi->file_size_known)
 		file_info_hash_remove_name_size(fi);
 
+	/*
+	 * Forget about the entry in the fileinfo database as well.  Should the
+	 * fileinfo be hashed again, it will be rewritten at the next flush.
+	 */
+
+	if (fi_db_dirty != NULL)
+		hset_remove(fi_db_dirty, fi);
+
+	if (db_fileinfo != NULL)
+		dbmw_delete(db_fileinfo, fi->guid);
+
 transient:
 	hikset_remove(fi_by_guid, fi->guid);
 
@@ -2832,7 +3278,7 @@ file_info_upload_stop(fileinfo_t *fi, const char *reason)
 		}
 
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_db_dirty(fi);
 	}
 }
 
@@ -2855,7 +3301,7 @@ file_info_pause(fileinfo_t *fi)
 	if (!(FI_F_PAUSED & fi->flags)) {
 		fi->flags |= FI_F_PAUSED;
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_db_dirty(fi);
 	}
 }
 
@@ -3138,7 +3584,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -3164,427 +3610,444 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		fi->cha1 = atom_sha1_get(trailer->cha1);
 
 	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+		struct dl_file_chunk *nfc;
+
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		nfc = dl_file_chunk_alloc();
+		nfc->from = fc->from;
+		nfc->to = fc->to;
+		nfc->status = fc->status;
+		nfc->download = fc->download;
+		fi_chunk_append(fi, nfc);
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 }
 
 /**
- * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ * Finish the loading of a fileinfo record from the fileinfo database: the
+ * record is validated against the trailer of the file and, if kept, it is
+ * inserted in the hash tables.
+ *
+ * @param fi			the fileinfo read, with its pathname filled
+ * @param old_filename	if non-NULL, the unsanitized file name to rename
+ *
+ * @return the recorded fileinfo, which can differ from the supplied one when
+ * the trailer had more recent information, or NULL if it was discarded (and
+ * freed).
  */
-void G_COLD
-file_info_retrieve(void)
+static fileinfo_t *
+file_info_retrieve_finish(fileinfo_t *fi, const char *old_filename)
 {
-	FILE *f;
-	char line[1024];
-	fileinfo_t *fi = NULL;
-	bool empty = TRUE;
-	bool last_was_truncated = FALSE;
-	file_path_t fp;
-	const char *old_filename = NULL;	/* In case we must rename the file */
-	const char *path = NULL;
-	const char *filename = NULL;
+	fileinfo_t *dfi;
+	bool upgraded;
+	bool reload_chunks = FALSE;
 
 	/*
-	 * We have a complex interaction here: each time a new entry within the
-	 * download mesh is added, file_info_try_to_swarm_with() will be
-	 * called.	Moreover, the download mesh is initialized before us.
-	 *
-	 * However, we cannot enqueue a download before the download module is
-	 * initialized. And we know it is initialized now because download_init()
-	 * calls us!
-	 *
-	 *		--RAM, 20/08/2002
+	 * There can't be duplicates!
 	 */
 
-	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
-
-	file_path_set(&fp, settings_config_dir(), file_info_file);
-	f = file_config_open_read(file_info_what, &fp, 1);
-	if (!f)
-		return;
+	dfi = hikset_lookup(fi_by_outname, fi->pathname);
+	if (NULL != dfi) {
+		g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
+			filepath_basename(fi->pathname));
+		goto discard;
+	}
 
-	while (fgets(ARYLEN(line), f)) {
-		int error;
-		bool truncated = FALSE, damaged;
-		const char *ep;
-		char *value;
-		uint64 v;
+	if (0 == fi->size) {
+		fi->file_size_known = FALSE;
+	}
 
-		/*
-		 * The following semi-complex logic attempts to determine whether
-		 * we filled the whole line buffer without reaching the end of the
-		 * physical line.
-		 *
-		 * When truncation occurs, we skip every following "line" we'd get
-		 * up to the point where we no longer need to truncate, at which time
-		 * we'll be re-synchronized on the real end of the line.
-		 */
+	/*
+	 * If we deserialized an older version, bring it up to date.
+	 */
 
-		truncated = !file_line_chomp_tail(ARYLEN(line), NULL);
+	upgraded = fi_upgrade_older_version(fi);
 
-		if (last_was_truncated) {
-			last_was_truncated = truncated;
-			g_warning("ignoring fileinfo line after truncation: '%s'", line);
-			continue;
-		} else if (truncated) {
-			last_was_truncated = TRUE;
-			g_warning("ignoring too long fileinfo line: '%s'", line);
-			continue;
-		}
+	/*
+	 * If we are processing a file being seeded, skip all the
+	 * CHNK, DONE and trailer consistency checks.
+	 *
+	 * If we are not recovering from a crash, seeded entries are
+	 * discarded.
+	 */
 
-		if (file_line_is_comment(line))
-			continue;
+	if (FI_F_SEEDING & fi->flags) {
+		if (crash_was_restarted()) {
+			filestat_t sb;
 
-		/*
-		 * Reaching an empty line means the end of the fileinfo description.
-		 */
+			if (NULL == fi->sha1) {
+				g_warning("%s(): missing SHA1 for seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* Fileinfo DB was corrupted, drop seed */
+			}
 
-		if ('\0' == *line && fi) {
-			fileinfo_t *dfi;
-			bool upgraded;
-			bool reload_chunks = FALSE;
+			if (!file_exists(fi->pathname)) {
+				g_warning("%s(): missing previously seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* User probably removed the file */
+			}
 
-			if (filename && path) {
-				char *pathname = make_pathname(path, filename);
-				fi->pathname = atom_str_get(pathname);
-				HFREE_NULL(pathname);
-			} else {
-				/* There's an incomplete fileinfo record */
-				goto reset;
+			if (-1 == stat(fi->pathname, &sb)) {
+				g_warning("%s(): cannot stat seeded file %s: %m",
+					G_STRFUNC, fi->pathname);
+				goto discard;
 			}
-			atom_str_free_null(&filename);
-			atom_str_free_null(&path);
 
 			/*
-			 * There can't be duplicates!
+			 * FIXME:
+			 * Would need to check that the file is still accurate if
+			 * the timestamp was changed since last modification.
+			 * For now just warn.
+			 * 		--RAM, 2017-10-23
 			 */
 
-			dfi = hikset_lookup(fi_by_outname, fi->pathname);
-			if (NULL != dfi) {
-				g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
-					filepath_basename(fi->pathname));
-				goto reset;
-			}
+			if (sb.st_mtime != fi->modified) {
+				bool accepted = huge_cached_is_uptodate(
+						fi->pathname, sb.st_size, sb.st_mtime);
 
-			if (0 == fi->size) {
-				fi->file_size_known = FALSE;
-			}
+				g_warning("%s(): modified seeded file %s: "
+					"last modified=%lu, file mtime=%lu; %s",
+					G_STRFUNC, fi->pathname,
+					(ulong) fi->modified, (ulong) sb.st_mtime,
+					accepted ? "resetting!" : "discarding!");
 
-			/*
-			 * If we deserialized an older version, bring it up to date.
-			 */
+				if (!accepted)
+					goto discard;
 
-			upgraded = fi_upgrade_older_version(fi);
+				/* This stamp is necessary to be able to upload! */
+				fi->modified = sb.st_mtime;
+				fi->stamp = fi->modified;	/* Persist new value */
+			}
 
-			/*
-			 * If we are processing a file being seeded, skip all the
-			 * CHNK, DONE and trailer consistency checks.
-			 *
-			 * If we are not recovering from a crash, seeded entries are
-			 * discarded.
-			 */
+			if (fi->tth != NULL)
+				file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
 
-			if (FI_F_SEEDING & fi->flags) {
-				if (crash_was_restarted()) {
-					filestat_t sb;
+			/* Seeding of file will be resumed */
+			goto ready;
+		}
 
-					if (NULL == fi->sha1) {
-						g_warning("%s(): missing SHA1 for seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* Fileinfo DB was corrupted, drop seed */
-					}
+		if (GNET_PROPERTY(share_debug)) {
+			g_info("SHARE discarding seeded file %s", fi->pathname);
+		}
 
-					if (!file_exists(fi->pathname)) {
-						g_warning("%s(): missing previously seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* User probably removed the file */
-					}
+		/* Drop the seeded file now */
+		goto discard;
+	}
 
-					if (-1 == stat(fi->pathname, &sb)) {
-						g_warning("%s(): cannot stat seeded file %s: %m",
-							G_STRFUNC, fi->pathname);
-						goto reset;
-					}
+	/*
+	 * Allow reconstruction of missing information: if no CHNK
+	 * entry was found for the file, fake one, all empty, and reset
+	 * DONE and GENR to 0.
+	 *
+	 * If for instance the partition where temporary files are held
+	 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
+	 * will be enough to restart without losing the collected
+	 * files.
+	 *
+	 *		--RAM, 31/12/2003
+	 */
 
-					/*
-					 * FIXME:
-					 * Would need to check that the file is still accurate if
-					 * the timestamp was changed since last modification.
-					 * For now just warn.
-					 * 		--RAM, 2017-10-23
-					 */
+	if (0 == eslist_count(&fi->chunklist)) {
+		if (fi->file_size_known)
+			g_warning("no CHNK info for \"%s\"", fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	} else if (!file_info_check_chunklist(fi, FALSE)) {
+		if (fi->file_size_known)
+			g_warning("invalid set of CHNK info for \"%s\"",
+				fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	}
 
-					if (sb.st_mtime != fi->modified) {
-						bool accepted = huge_cached_is_uptodate(
-								fi->pathname, sb.st_size, sb.st_mtime);
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
-						g_warning("%s(): modified seeded file %s: "
-							"last modified=%lu, file mtime=%lu; %s",
-							G_STRFUNC, fi->pathname,
-							(ulong) fi->modified, (ulong) sb.st_mtime,
-							accepted ? "resetting!" : "discarding!");
+	/*
+	 * If DONE does not match the actual size described by the CHNK
+	 * set, them perhaps the fileinfo database was corrupted?
+	 */
 
-						if (!accepted)
-							goto reset;
+	{
+		filesize_t done = fi->done;
 
-						/* This stamp is necessary to be able to upload! */
-						fi->modified = sb.st_mtime;
-						fi->stamp = fi->modified;	/* Persist new value */
-					}
+		file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 
-					if (fi->tth != NULL)
-						file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
+		/*
+		 * If DONE was missing, fi->done will still be 0.
+		 * In that case, we don't really care since we'll have
+		 * recomputed fi->done in the call above.
+		 */
 
-					/* Seeding of file will be resumed */
-					goto ready;
-				}
+		if (done != 0 && fi->done != done) {
+			g_warning("inconsistent DONE info for \"%s\": "
+				"read %s, computed %s",
+				fi->pathname, filesize_to_string(done),
+				filesize_to_string2(fi->done));
+			reload_chunks = TRUE;	/* Will try to grab from trailer */
+		}
+	}
 
-				if (GNET_PROPERTY(share_debug)) {
-					g_info("SHARE discarding seeded file %s", fi->pathname);
-				}
+	/*
+	 * If `old_filename' is not NULL, then we need to rename
+	 * the file bearing that name into the new (sanitized)
+	 * name, making sure there is no filename conflict.
+	 */
 
-				/* Drop the seeded file now */
-				goto reset;
-			}
+	if (NULL != old_filename) {
+		const char *new_pathname;
+		char *old_path;
+		bool renamed = TRUE;
 
-			/*
-			 * Allow reconstruction of missing information: if no CHNK
-			 * entry was found for the file, fake one, all empty, and reset
-			 * DONE and GENR to 0.
-			 *
-			 * If for instance the partition where temporary files are held
-			 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
-			 * will be enough to restart without losing the collected
-			 * files.
-			 *
-			 *		--RAM, 31/12/2003
-			 */
+		old_path = filepath_directory(fi->pathname);
+		new_pathname = file_info_new_outname(old_path,
+							filepath_basename(fi->pathname));
+		HFREE_NULL(old_path);
+		if (NULL == new_pathname)
+			goto discard;
 
-			if (0 == eslist_count(&fi->chunklist)) {
-				if (fi->file_size_known)
-					g_warning("no CHNK info for \"%s\"", fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			} else if (!file_info_check_chunklist(fi, FALSE)) {
-				if (fi->file_size_known)
-					g_warning("invalid set of CHNK info for \"%s\"",
-						fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			}
+		/*
+		 * If fi->done == 0, the file might not exist on disk.
+		 */
 
-			g_assert(file_info_check_chunklist(fi, TRUE));
+		if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
+			renamed = FALSE;
 
-			/*
-			 * If DONE does not match the actual size described by the CHNK
-			 * set, them perhaps the fileinfo database was corrupted?
-			 */
+		if (renamed) {
+			g_warning("renamed \"%s\" into sanitized \"%s\"",
+				fi->pathname, new_pathname);
+			atom_str_change(&fi->pathname, new_pathname);
+		} else {
+			g_warning("cannot rename \"%s\" into \"%s\": %m",
+				fi->pathname, new_pathname);
+		}
+		atom_str_free_null(&new_pathname);
+	}
 
-			{
-				filesize_t done = fi->done;
+	/*
+	 * Check file trailer information.	The main file is only written
+	 * infrequently and the file's trailer can have more up-to-date
+	 * information.
+	 */
 
-				file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+	dfi = file_info_retrieve_binary(fi->pathname);
 
-				/*
-				 * If DONE was missing, fi->done will still be 0.
-				 * In that case, we don't really care since we'll have
-				 * recomputed fi->done in the call above.
-				 */
+	/*
+	 * If we resetted the CHNK list above, grab those from the
+	 * trailer: that cannot be worse than having to download
+	 * everything again...  If there was no valid trailer, all the
+	 * data are lost and the whole file will need to be grabbed again.
+	 */
 
-				if (done != 0 && fi->done != done) {
-					g_warning("inconsistent DONE info for \"%s\": "
-						"read %s, computed %s",
-						fi->pathname, filesize_to_string(done),
-						filesize_to_string2(fi->done));
-					reload_chunks = TRUE;	/* Will try to grab from trailer */
-				}
-			}
+	if (dfi != NULL && reload_chunks) {
+		fi_copy_chunks(fi, dfi);
+		if (0 != eslist_count(&fi->chunklist)) {
+			g_message("recovered %s downloaded bytes "
+				"from trailer of \"%s\"",
+				filesize_to_string(fi->done), fi->pathname);
+		}
+	} else if (reload_chunks)
+		g_warning("lost all CHNK info for \"%s\" -- downloading again",
+			fi->pathname);
 
-			/*
-			 * If `old_filename' is not NULL, then we need to rename
-			 * the file bearing that name into the new (sanitized)
-			 * name, making sure there is no filename conflict.
-			 */
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
-			if (NULL != old_filename) {
-				const char *new_pathname;
-				char *old_path;
-				bool renamed = TRUE;
+	/*
+	 * Special treatment for the GUID: if not present, it will be
+	 * added during retrieval, but it will be different for the
+	 * one in the fileinfo DB and the one on disk.  Set `upgraded'
+	 * to signal that, so that we resync the metainfo below.
+	 */
 
-				old_path = filepath_directory(fi->pathname);
-				new_pathname = file_info_new_outname(old_path,
-									filepath_basename(fi->pathname));
-				HFREE_NULL(old_path);
-				if (NULL == new_pathname)
-					goto reset;
+	if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
+		upgraded = TRUE;
 
-				/*
-				 * If fi->done == 0, the file might not exist on disk.
-				 */
+	/*
+	 * NOTE: The tigertree data is only stored in the trailer, not
+	 * in the common "fileinfo" file. Therefore, it MUST be fetched
+	 * from "dfi".
+	 */
 
-				if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
-					renamed = FALSE;
+	if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
+		file_info_got_tigertree(fi,
+			dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
+	}
 
-				if (renamed) {
-					g_warning("renamed \"%s\" into sanitized \"%s\"",
-						fi->pathname, new_pathname);
-					atom_str_change(&fi->pathname, new_pathname);
-				} else {
-					g_warning("cannot rename \"%s\" into \"%s\": %m",
-						fi->pathname, new_pathname);
-				}
-				atom_str_free_null(&new_pathname);
+	if (dfi) {
+		fi->modified = dfi->modified;
+	}
+
+	if (NULL == dfi) {
+		if (is_regular(fi->pathname)) {
+			g_warning("got metainfo in fileinfo cache, "
+				"but none in \"%s\"", fi->pathname);
+			upgraded = FALSE;			/* No need to flush twice */
+			file_info_store_binary(fi, TRUE);	/* Create metainfo */
+		} else {
+			file_info_merge_adjacent(fi);		/* Compute fi->done */
+			if (fi->done > 0) {
+				g_warning("discarding cached metainfo for \"%s\": "
+					"file had %s bytes downloaded "
+					"but is now gone!", fi->pathname,
+					filesize_to_string(fi->done));
+				goto discard;
 			}
+		}
+	} else if (dfi->generation > fi->generation) {
+		g_warning("found more recent metainfo in \"%s\"", fi->pathname);
+		fi_free(fi);
+		fi = dfi;
+	} else if (dfi->generation < fi->generation) {
+		g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
+		fi_free(dfi);
+		dfi = NULL;
+		upgraded = FALSE;				/* No need to flush twice */
+		file_info_store_binary(fi, TRUE);/* Resync metainfo */
+	} else {
+		g_assert(dfi->generation == fi->generation);
+		fi_free(dfi);
+		dfi = NULL;
+	}
 
-			/*
-			 * Check file trailer information.	The main file is only written
-			 * infrequently and the file's trailer can have more up-to-date
-			 * information.
-			 */
+	/*
+	 * Check whether entry is not another's duplicate.
+	 */
 
-			dfi = file_info_retrieve_binary(fi->pathname);
+	dfi = file_info_lookup_dup(fi);
 
-			/*
-			 * If we resetted the CHNK list above, grab those from the
-			 * trailer: that cannot be worse than having to download
-			 * everything again...  If there was no valid trailer, all the
-			 * data are lost and the whole file will need to be grabbed again.
-			 */
+	if (NULL != dfi) {
+		g_warning("found DUPLICATE entry for \"%s\" "
+			"(%s bytes) with \"%s\" (%s bytes)",
+			fi->pathname, filesize_to_string(fi->size),
+			dfi->pathname, filesize_to_string2(dfi->size));
+		goto discard;
+	}
 
-			if (dfi != NULL && reload_chunks) {
-				fi_copy_chunks(fi, dfi);
-				if (0 != eslist_count(&fi->chunklist)) {
-					g_message("recovered %s downloaded bytes "
-						"from trailer of \"%s\"",
-						filesize_to_string(fi->done), fi->pathname);
-				}
-			} else if (reload_chunks)
-				g_warning("lost all CHNK info for \"%s\" -- downloading again",
-					fi->pathname);
+	/*
+	 * If we had to upgrade the fileinfo, make sure we resync
+	 * the metadata on disk as well.
+	 */
 
-			g_assert(file_info_check_chunklist(fi, TRUE));
+	if (upgraded) {
+		g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
+		file_info_store_binary(fi, TRUE);		/* Resync metainfo */
+	}
 
-			/*
-			 * Special treatment for the GUID: if not present, it will be
-			 * added during retrieval, but it will be different for the
-			 * one in the fileinfo DB and the one on disk.  Set `upgraded'
-			 * to signal that, so that we resync the metainfo below.
-			 */
+	file_info_merge_adjacent(fi);
 
-			if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
-				upgraded = TRUE;
+ready:
 
-			/*
-			 * NOTE: The tigertree data is only stored in the trailer, not
-			 * in the common "fileinfo" file. Therefore, it MUST be fetched
-			 * from "dfi".
-			 */
+	file_info_hash_insert(fi);
 
-			if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
-				file_info_got_tigertree(fi,
-					dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
-			}
+	if (can_publish_partial_sha1 && fi->sha1 != NULL) {
+		publisher_add(fi->sha1);
+	}
 
-			if (dfi) {
-				fi->modified = dfi->modified;
-			}
+	/*
+	 * We could not add the aliases immediately because the file
+	 * is formatted with ALIA coming before SIZE.  To let fi_alias()
+	 * detect conflicting entries, we need to have a valid fi->size.
+	 * And since the `fi' is hashed, we can detect duplicates in
+	 * the `aliases' list itself as an added bonus.
+	 */
 
-			if (NULL == dfi) {
-				if (is_regular(fi->pathname)) {
-					g_warning("got metainfo in fileinfo cache, "
-						"but none in \"%s\"", fi->pathname);
-					upgraded = FALSE;			/* No need to flush twice */
-					file_info_store_binary(fi, TRUE);	/* Create metainfo */
-				} else {
-					file_info_merge_adjacent(fi);		/* Compute fi->done */
-					if (fi->done > 0) {
-						g_warning("discarding cached metainfo for \"%s\": "
-							"file had %s bytes downloaded "
-							"but is now gone!", fi->pathname,
-							filesize_to_string(fi->done));
-						goto reset;
-					}
-				}
-			} else if (dfi->generation > fi->generation) {
-				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
-				fi_free(fi);
-				fi = dfi;
-			} else if (dfi->generation < fi->generation) {
-				g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
-				fi_free(dfi);
-				dfi = NULL;
-				upgraded = FALSE;				/* No need to flush twice */
-				file_info_store_binary(fi, TRUE);/* Resync metainfo */
-			} else {
-				g_assert(dfi->generation == fi->generation);
-				fi_free(dfi);
-				dfi = NULL;
-			}
+	if (fi->alias) {
+		pslist_t *aliases, *sl;
 
-			/*
-			 * Check whether entry is not another's duplicate.
-			 */
+		/* For efficiency each alias has been prepended to
+		 * the list. To preserve the order between sessions,
+		 * the original list order is restored here. */
+		aliases = pslist_reverse(fi->alias);
+		fi->alias = NULL;
+		PSLIST_FOREACH(aliases, sl) {
+			const char *s = sl->data;
+			fi_alias(fi, s, TRUE);
+			atom_str_free_null(&s);
+		}
+		pslist_free_null(&aliases);
+	}
 
-			dfi = file_info_lookup_dup(fi);
+	return fi;
 
-			if (NULL != dfi) {
-				g_warning("found DUPLICATE entry for \"%s\" "
-					"(%s bytes) with \"%s\" (%s bytes)",
-					fi->pathname, filesize_to_string(fi->size),
-					dfi->pathname, filesize_to_string2(dfi->size));
-				goto reset;
-			}
+discard:
+	fi_free(fi);
+	return NULL;
+}
 
-			/*
-			 * If we had to upgrade the fileinfo, make sure we resync
-			 * the metadata on disk as well.
-			 */
+/**
+ * Loads the legacy ASCII fileinfo database from disk, and saves a copy in
+ * fileinfo.orig.
+ */
+static void G_COLD
+file_info_retrieve_text(void)
+{
+	FILE *f;
+	char line[1024];
+	fileinfo_t *fi = NULL;
+	bool empty = TRUE;
+	bool last_was_truncated = FALSE;
+	file_path_t fp;
+	const char *old_filename = NULL;	/* In case we must rename the file */
+	const char *path = NULL;
+	const char *filename = NULL;
 
-			if (upgraded) {
-				g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
-				file_info_store_binary(fi, TRUE);		/* Resync metainfo */
-			}
+	file_path_set(&fp, settings_config_dir(), file_info_file);
+	f = file_config_open_read(file_info_what, &fp, 1);
+	if (!f)
+		return;
 
-			file_info_merge_adjacent(fi);
+	while (fgets(ARYLEN(line), f)) {
+		int error;
+		bool truncated = FALSE, damaged;
+		const char *ep;
+		char *value;
+		uint64 v;
 
-		ready:
+		/*
+		 * The following semi-complex logic attempts to determine whether
+		 * we filled the whole line buffer without reaching the end of the
+		 * physical line.
+		 *
+		 * When truncation occurs, we skip every following "line" we'd get
+		 * up to the point where we no longer need to truncate, at which time
+		 * we'll be re-synchronized on the real end of the line.
+		 */
 
-			file_info_hash_insert(fi);
+		truncated = !file_line_chomp_tail(ARYLEN(line), NULL);
 
-			if (can_publish_partial_sha1 && fi->sha1 != NULL) {
-				publisher_add(fi->sha1);
-			}
+		if (last_was_truncated) {
+			last_was_truncated = truncated;
+			g_warning("ignoring fileinfo line after truncation: '%s'", line);
+			continue;
+		} else if (truncated) {
+			last_was_truncated = TRUE;
+			g_warning("ignoring too long fileinfo line: '%s'", line);
+			continue;
+		}
 
-			/*
-			 * We could not add the aliases immediately because the file
-			 * is formatted with ALIA coming before SIZE.  To let fi_alias()
-			 * detect conflicting entries, we need to have a valid fi->size.
-			 * And since the `fi' is hashed, we can detect duplicates in
-			 * the `aliases' list itself as an added bonus.
-			 */
+		if (file_line_is_comment(line))
+			continue;
 
-			if (fi->alias) {
-				pslist_t *aliases, *sl;
-
-				/* For efficiency each alias has been prepended to
-				 * the list. To preserve the order between sessions,
-				 * the original list order is restored here. */
-				aliases = pslist_reverse(fi->alias);
-				fi->alias = NULL;
-				PSLIST_FOREACH(aliases, sl) {
-					const char *s = sl->data;
-					fi_alias(fi, s, TRUE);
-					atom_str_free_null(&s);
-				}
-				pslist_free_null(&aliases);
+		/*
+		 * Reaching an empty line means the end of the fileinfo description.
+		 */
+
+		if ('\0' == *line && fi) {
+			if (filename && path) {
+				char *pathname = make_pathname(path, filename);
+				fi->pathname = atom_str_get(pathname);
+				HFREE_NULL(pathname);
+			} else {
+				/* There's an incomplete fileinfo record */
+				goto reset;
 			}
+			atom_str_free_null(&filename);
+			atom_str_free_null(&path);
 
-			empty = FALSE;
+			if (NULL != file_info_retrieve_finish(fi, old_filename))
+				empty = FALSE;
 			fi = NULL;
 			continue;
 		}
@@ -3801,7 +4264,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3835,6 +4298,291 @@ file_info_retrieve(void)
 	fclose(f);
 }
 
+/**
+ * Deserialize a fileinfo record from the fileinfo database.
+ *
+ * @param guid		the fileinfo GUID (key of the record)
+ * @param data		the serialized record
+ * @param len		length of the serialized record
+ *
+ * @return the new fileinfo, NULL if the record was damaged.
+ */
+static fileinfo_t *
+file_info_db_deserialize(const struct guid *guid, const void *data, size_t len)
+{
+	fileinfo_t *fi;
+	bstr_t *bs;
+	uint8 version, flags, hashes;
+	uint64 size, done, count, i;
+	filesize_t from;
+	char *pathname = NULL;
+
+	bs = bstr_open(data, len, GNET_PROPERTY(fileinfo_debug) ? BSTR_F_ERROR : 0);
+	fi = file_info_allocate();
+
+	if (!bstr_read_u8(bs, &version))
+		goto damaged;
+
+	if (version > FI_DB_VERSION) {
+		g_warning("%s(): unknown version %u for record %s",
+			G_STRFUNC, version, guid_hex_str(guid));
+		goto failed;
+	}
+
+	if (
+		!bstr_read_string(bs, NULL, &pathname) ||
+		!bstr_read_be32(bs, &fi->generation) ||
+		!bstr_read_be64(bs, &size) ||
+		!bstr_read_be64(bs, &done) ||
+		!bstr_read_time(bs, &fi->stamp) ||
+		!bstr_read_time(bs, &fi->created) ||
+		!bstr_read_time(bs, &fi->ntime) ||
+		!bstr_read_u8(bs, &flags) ||
+		!bstr_read_u8(bs, &hashes)
+	)
+		goto damaged;
+
+	if (!is_absolute_path(pathname)) {
+		g_warning("%s(): invalid path \"%s\" for record %s",
+			G_STRFUNC, pathname, guid_hex_str(guid));
+		goto failed;
+	}
+
+	if (size >= ((uint64) 1UL << 63) || done >= ((uint64) 1UL << 63)) {
+		g_warning("%s(): invalid size or done for \"%s\"",
+			G_STRFUNC, pathname);
+		goto failed;
+	}
+
+	fi->guid = atom_guid_get(guid);
+	fi->pathname = atom_str_get(pathname);
+	fi->size = size;
+	fi->done = done;
+	fi->modified = fi->stamp;		/* Until we know better */
+	fi->file_size_known = booleanize(flags & FI_DB_F_SIZE_KNOWN);
+	fi->use_swarming = booleanize(flags & FI_DB_F_SWARMING);
+
+	if (flags & FI_DB_F_PAUSED)
+		fi->flags |= FI_F_PAUSED;
+	if (flags & FI_DB_F_SEEDING)
+		fi->flags |= FI_F_SEEDING | FI_F_STRIPPED;
+
+	if (hashes & FI_DB_H_SHA1) {
+		struct sha1 sha1;
+
+		if (!bstr_read(bs, VARLEN(sha1)))
+			goto damaged;
+		fi->sha1 = atom_sha1_get(&sha1);
+	}
+
+	if (hashes & FI_DB_H_TTH) {
+		struct tth tth;
+
+		if (!bstr_read(bs, VARLEN(tth)))
+			goto damaged;
+		fi->tth = atom_tth_get(&tth);
+	}
+
+	if (hashes & FI_DB_H_CHA1) {
+		struct sha1 cha1;
+
+		if (!bstr_read(bs, VARLEN(cha1)))
+			goto damaged;
+		fi->cha1 = atom_sha1_get(&cha1);
+	}
+
+	/*
+	 * As in the ASCII database, aliases are prepended and the list will be
+	 * reconstructed via fi_alias() once the fileinfo is hashed.
+	 */
+
+	if (!bstr_read_ule64(bs, &count))
+		goto damaged;
+
+	for (i = 0; i < count; i++) {
+		char *alias;
+
+		if (!bstr_read_string(bs, NULL, &alias))
+			goto damaged;
+
+		if (!looks_like_urn(alias))
+			fi->alias = pslist_prepend_const(fi->alias, atom_str_get(alias));
+
+		HFREE_NULL(alias);
+	}
+
+	/*
+	 * Chunks are contiguous, each one recorded by its length.
+	 *
+	 * Should the chunk list be inconsistent, we drop it and will recover
+	 * the chunks from the file trailer, if possible.
+	 */
+
+	if (!bstr_read_ule64(bs, &count))
+		goto damaged;
+
+	for (i = 0, from = 0; i < count; i++) {
+		struct dl_file_chunk *fc;
+		uint64 length;
+		uint8 status;
+
+		if (!bstr_read_ule64(bs, &length) || !bstr_read_u8(bs, &status))
+			goto damaged;
+
+		if (0 == length || length > fi->size - from || status > DL_CHUNK_DONE) {
+			g_warning("%s(): chunklist is inconsistent for \"%s\" "
+				"(fi->size=%s)",
+				G_STRFUNC, fi->pathname, filesize_to_string(fi->size));
+			file_info_chunklist_free(fi);
+			break;
+		}
+
+		fc = dl_file_chunk_alloc();
+		fc->from = from;
+		fc->to = from + length;
+		fc->status = DL_CHUNK_BUSY == status ? DL_CHUNK_EMPTY : status;
+		fi_chunk_append(fi, fc);
+		from = fc->to;
+	}
+
+	HFREE_NULL(pathname);
+	bstr_free(&bs);
+
+	return fi;
+
+damaged:
+	g_warning("%s(): damaged record %s: %s", G_STRFUNC, guid_hex_str(guid),
+		bstr_has_error(bs) ? bstr_error(bs) : "truncated");
+	/* FALL THROUGH */
+
+failed:
+	HFREE_NULL(pathname);
+	bstr_free(&bs);
+	fi_free(fi);
+	return NULL;
+}
+
+/**
+ * Context for file_info_db_load_kv().
+ */
+struct file_info_db_load {
+	pslist_t *records;			/**< Deserialized fileinfo records */
+	pslist_t *damaged;			/**< GUID atoms of damaged records */
+};
+
+/**
+ * DBMW foreach iterator to deserialize all the fileinfo records.
+ */
+static void
+file_info_db_load_kv(void *key, void *value, size_t len, void *u)
+{
+	struct file_info_db_load *ctx = u;
+	fileinfo_t *fi;
+
+	fi = file_info_db_deserialize(key, value, len);
+
+	if (NULL == fi)
+		ctx->damaged = pslist_prepend_const(ctx->damaged, atom_guid_get(key));
+	else
+		ctx->records = pslist_prepend(ctx->records, fi);
+}
+
+/**
+ * Loads the fileinfo records from the fileinfo database.
+ */
+static void G_COLD
+file_info_db_retrieve(void)
+{
+	struct file_info_db_load ctx = { NULL, NULL };
+	const struct guid *guid;
+	fileinfo_t *fi;
+
+	/*
+	 * Records are first all deserialized, since validating them can lead to
+	 * database updates, which are not possible during the traversal.
+	 */
+
+	dbmw_foreach(db_fileinfo, file_info_db_load_kv, &ctx);
+
+	while (NULL != (guid = pslist_shift(&ctx.damaged))) {
+		dbmw_delete(db_fileinfo, guid);
+		atom_guid_free_null(&guid);
+	}
+
+	/*
+	 * Loaded fileinfo are not flagged dirty, unless their persisted state
+	 * needs to be updated.
+	 */
+
+	fi_db_loading = TRUE;
+
+	while (NULL != (fi = pslist_shift(&ctx.records))) {
+		fileinfo_t *rfi;
+
+		guid = atom_guid_get(fi->guid);
+		rfi = file_info_retrieve_finish(fi, NULL);
+
+		if (NULL == rfi) {
+			dbmw_delete(db_fileinfo, guid);
+		} else if (rfi->guid != guid) {
+			dbmw_delete(db_fileinfo, guid);		/* GUID from trailer */
+			file_info_db_dirty(rfi);
+		}
+
+		atom_guid_free_null(&guid);
+	}
+
+	fi_db_loading = FALSE;
+}
+
+/**
+ * Loads the fileinfo database.
+ *
+ * When the database does not exist yet, the legacy ASCII database is
+ * imported.
+ */
+void G_COLD
+file_info_retrieve(void)
+{
+	dbstore_kv_t kv = { GUID_RAW_SIZE, NULL, FI_DB_VALUE_MAX, 0 };
+	dbstore_packing_t packing = { NULL, NULL, NULL };
+	bool existed;
+
+	g_assert(NULL == db_fileinfo);
+
+	/*
+	 * We have a complex interaction here: each time a new entry within the
+	 * download mesh is added, file_info_try_to_swarm_with() will be
+	 * called.	Moreover, the download mesh is initialized before us.
+	 *
+	 * However, we cannot enqueue a download before the download module is
+	 * initialized. And we know it is initialized now because download_init()
+	 * calls us!
+	 *
+	 *		--RAM, 20/08/2002
+	 */
+
+	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
+
+	fi_db_dirty = hset_create(HASH_KEY_SELF, 0);
+	existed = dbstore_exists(settings_gnet_db_dir(), db_fileinfo_base);
+
+	db_fileinfo = dbstore_open(db_fileinfo_what, settings_gnet_db_dir(),
+		db_fileinfo_base, kv, packing, FI_DB_CACHE_SIZE,
+		guid_hash, guid_eq, FALSE);
+
+	if (NULL == db_fileinfo) {
+		g_warning("%s(): cannot open %s, will only use the ASCII database",
+			G_STRFUNC, db_fileinfo_what);
+		file_info_retrieve_text();
+	} else if (!existed) {
+		file_info_retrieve_text();		/* All entries flagged dirty */
+		file_info_store();
+	} else {
+		file_info_db_retrieve();
+	}
+}
+
 static bool
 file_info_name_is_uniq(const char *pathname)
 {
@@ -3946,7 +4694,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4154,7 +4902,7 @@ file_info_moved(fileinfo_t *fi, const char *pathname)
 
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 	file_info_changed(fi);
-	fileinfo_dirty = TRUE;
+	file_info_db_dirty(fi);
 }
 
 /**
@@ -4429,9 +5177,9 @@ file_info_merge_adjacent(fileinfo_t *fi)
 		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
 			void *removed;
 
-			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
+			fc1->to = fc2->to;
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
 		}
@@ -4462,7 +5210,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	if (0 == (fi->flags & FI_F_TRANSIENT)) {
 		file_info_hash_remove_name_size(fi);
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_db_dirty(fi);
 	}
 
 	fi->file_size_known = FALSE;
@@ -4501,10 +5249,8 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
-			fc->to = fi->done;
-
 			/*
 			 * Remove subsequent chunks.
 			 */
@@ -4512,9 +5258,11 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
+
+			fc->to = fi->done;
 		}
 	}
 
@@ -4531,14 +5279,14 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
 	fi->use_swarming = TRUE;
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
-	fileinfo_dirty = TRUE;
+	file_info_db_dirty(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4549,6 +5297,104 @@ file_info_size_known(struct download *d, filesize_t size)
 	file_info_changed(fi);
 }
 
+/**
+ * Adjust fi->done when a range of `len' bytes changes from status `old'
+ * to status `new'.
+ */
+static inline void
+fi_done_update(fileinfo_t *fi, enum dl_chunk_status old,
+	enum dl_chunk_status new, filesize_t len)
+{
+	if (DL_CHUNK_DONE == new && DL_CHUNK_DONE != old) {
+		fi->done += len;
+	} else if (DL_CHUNK_DONE == old && DL_CHUNK_DONE != new) {
+		g_assert(fi->done >= len);
+		fi->done -= len;
+	}
+}
+
+/**
+ * Checks that fi->done is the sum of the DONE chunks.
+ *
+ * @param fi		the fileinfo struct to check.
+ * @param assertion	TRUE if used in an assertion
+ *
+ * @return TRUE if fi->done is consistent, FALSE otherwise.
+ */
+static bool
+file_info_check_done(const fileinfo_t *fi, bool assertion)
+{
+	const struct dl_file_chunk *fc;
+	filesize_t done = 0;
+
+	if (assertion && GNET_PROPERTY(fileinfo_debug) < 10)
+		return TRUE;
+
+	if (0 == eslist_count(&fi->chunklist))
+		return TRUE;
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		if (DL_CHUNK_DONE == fc->status)
+			done += fc->to - fc->from;
+	}
+
+	return done == fi->done;
+}
+
+/**
+ * Merge adjacent chunks that share the same status around the [from, to[
+ * range, which has just been updated.
+ *
+ * This is the local version of file_info_merge_adjacent(): only the chunks
+ * overlapping the range and their immediate neighbours are visited, using
+ * the chunktree to locate the first one.  Contrary to the latter, this
+ * does not recompute fi->done, which must be accurate already.
+ */
+static void
+fi_merge_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc, *next, *prev;
+
+	fc = fi_chunk_lookup(fi, from);
+	if (NULL == fc)
+		return;
+
+	prev = fi_chunk_prev(fi, fc);
+	if (prev != NULL)
+		fc = prev;
+
+	if (DL_CHUNK_DONE == fc->status)
+		fc->download = NULL;			/* Done, no longer reserved */
+
+	while (NULL != (next = eslist_next_data(&fi->chunklist, fc))) {
+		dl_file_chunk_check(next);
+		g_assert(fc->to == next->from);
+
+		if (DL_CHUNK_DONE == next->status)
+			next->download = NULL;
+
+		/*
+		 * Never merge adjacent busy chunks: they correspond to reserved
+		 * parts of the file that will be served by different HTTP requests.
+		 */
+
+		if (fc->status == next->status && DL_CHUNK_BUSY != next->status) {
+			struct dl_file_chunk *removed;
+
+			removed = fi_chunk_remove_after(fi, fc);
+			g_assert(removed == next);
+			fc->to = next->to;
+			dl_file_chunk_free(&next);
+			continue;
+		}
+
+		if (next->from >= to)
+			break;			/* Checked the chunk following the range */
+
+		fc = next;
+	}
+}
+
 /**
  * Marks a chunk of the file with given status.
  * The bytes range from `from' (included) to `to' (excluded).
@@ -4561,11 +5407,10 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 		enum dl_chunk_status status)
 {
 	struct dl_file_chunk *fc, *nfc, *prevfc;
-	slink_t *sl;
 	fileinfo_t *fi;
 	bool found = FALSE;
-	int n, againcount = 0;
-	bool need_merging;
+	int againcount = 0;
+	filesize_t start = from;
 	const struct download *newval;
 
 	download_check(d);
@@ -4576,16 +5421,13 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 
 	switch (status) {
 	case DL_CHUNK_DONE:
-		need_merging = FALSE;
 		newval = d;
 		goto status_ok;
 	case DL_CHUNK_BUSY:
-		need_merging = TRUE;
 		newval = d;
 		g_assert(fi->lifecount > 0);
 		goto status_ok;
 	case DL_CHUNK_EMPTY:
-		need_merging = TRUE;
 		newval = NULL;
 		goto status_ok;
 	}
@@ -4616,6 +5458,7 @@ status_ok:
 	if (DL_CHUNK_DONE == status) {
 		fi->modified = fi->stamp;
 		fi->dirty = TRUE;
+		file_info_db_dirty(fi);
 	}
 
 again:
@@ -4635,15 +5478,19 @@ again:
 	 * because we may be writing data to an already "done" chunk, when a
 	 * previous chunk bumps into a done one.
 	 *		--RAM, 04/11/2002
+	 *
+	 * The chunktree gives us the first chunk overlapping the range, from
+	 * which we iterate over the list.
 	 */
 
+	fc = fi_chunk_lookup(fi, from);
+	prevfc = NULL == fc ? NULL : fi_chunk_prev(fi, fc);
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
-		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
+		/* empty */;
+		fc != NULL;
+		prevfc = fc, fc = eslist_next_data(&fi->chunklist, fc)
 	) {
-		fc = eslist_data(&fi->chunklist, sl);
-
 		dl_file_chunk_check(fc);
 
 		if (fc->to <= from) continue;
@@ -4651,13 +5498,7 @@ again:
 
 		if (fc->from == from && fc->to == to) {
 
-			if (prevfc && prevfc->status == status)
-				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
+			fi_done_update(fi, fc->status, status, to - from);
 			fc->status = status;
 			fc->download = newval;
 			found = TRUE;
@@ -4666,13 +5507,7 @@ again:
 
 		} else if (fc->from == from && fc->to < to) {
 
-			if (prevfc && prevfc->status == status)
-				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += fc->to - from;
+			fi_done_update(fi, fc->status, status, fc->to - from);
 			fc->status = status;
 			fc->download = newval;
 			from = fc->to;
@@ -4681,11 +5516,7 @@ again:
 
 		} else if (fc->from == from && fc->to > to) {
 
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
+			fi_done_update(fi, fc->status, status, to - from);
 
 			if (
 				DL_CHUNK_DONE == status &&
@@ -4706,7 +5537,7 @@ again:
 				fc->to = to;
 				fc->status = status;
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4719,19 +5550,19 @@ again:
 			 * New chunk [from, to] lies within ]fc->from, fc->to].
 			 */
 
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
+			filesize_t end = fc->to;
 
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
+			fi_done_update(fi, fc->status, status, to - from);
 
-			if (fc->to > to) {
+			fc->to = from;		/* Shrink before inserting new chunks */
+
+			if (end > to) {
 				nfc = dl_file_chunk_alloc();
 				nfc->from = to;
-				nfc->to = fc->to;
+				nfc->to = end;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4750,9 +5581,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4762,21 +5591,18 @@ again:
 
 			filesize_t tmp;
 
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
+			fi_done_update(fi, fc->status, status, fc->to - from);
 
-			if (DL_CHUNK_DONE == status)
-				fi->done += fc->to - from;
+			tmp = fc->to;
+			fc->to = from;		/* Shrink before inserting new chunk */
 
 			nfc = dl_file_chunk_alloc();
 			nfc->from = from;
-			nfc->to = fc->to;
+			nfc->to = tmp;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
-			tmp = fc->to;
-			fc->to = from;
 			from = tmp;
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
@@ -4792,15 +5618,20 @@ again:
 			fi->file_size_known ? "" : "unknown size, currently ",
 			filesize_to_string3(fi->size));
 
-		ESLIST_FOREACH(&fi->chunklist, sl) {
-			fc = eslist_data(&fi->chunklist, sl);
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 			g_warning("... %s %s %u", filesize_to_string(fc->from),
 				filesize_to_string2(fc->to), fc->status);
 		}
 	}
 
-	if (need_merging)
-		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+	/*
+	 * Coalesce the updated range with its neighbours, so that the chunk
+	 * list stays short: only the chunks around [start, to[ need visiting.
+	 */
+
+	fi_merge_range(fi, start, to);
+
+	g_assert(file_info_check_done(fi, TRUE));
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
@@ -4912,7 +5743,7 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
-	fileinfo_dirty = TRUE;
+	file_info_db_dirty(fi);
 }
 
 /**
@@ -4928,10 +5759,12 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, from);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (from >= fc->from && to <= fc->to)
+		if (to <= fc->to)
 			return fc->status;
 	}
 
@@ -5331,7 +6164,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -5396,15 +6229,11 @@ fi_pick_chunk(fileinfo_t *fi)
 		 * long.  If not, return that first chunk.
 		 */
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			dl_file_chunk_check(fc);
+		fc = fi_next_hole(fi, 0);
 
-			if (fc->from >= GNET_PROPERTY(pfsp_first_chunk))
-				break;		/* Already past the first "pfsp_first_chunk" bytes */
+		if (fc != NULL && fc->from < GNET_PROPERTY(pfsp_first_chunk))
+			return fc;
 
-			if (DL_CHUNK_EMPTY == fc->status)
-				return fc;
-		}
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
@@ -5421,15 +6250,9 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			dl_file_chunk_check(fc);
-
-			if (DL_CHUNK_EMPTY != fc->status)
-				continue;
-
-			if (fc->to <= last_chunk_offset)
-				continue;
+		fc = fi_next_hole(fi, last_chunk_offset);
 
+		if (fc != NULL) {
 			offset = fc->from < last_chunk_offset
 				? last_chunk_offset
 				: fc->from;
@@ -5559,7 +6382,7 @@ selected:
 		nfc->status = DL_CHUNK_EMPTY;
 		fc->to = nfc->from;
 
-		eslist_insert_after(&fi->chunklist, fc, nfc);
+		fi_chunk_insert_after(fi, fc, nfc);
 		candidate = nfc;
 	}
 
@@ -6822,6 +7645,7 @@ void
 file_info_add_new_source(fileinfo_t *fi, struct download *d)
 {
 	fi->ntime = tm_time();
+	file_info_db_dirty(fi);
 	file_info_add_source(fi, d);
 }
 
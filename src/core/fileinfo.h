@@ -58,6 +58,7 @@ void file_info_scandir(const char *dir);
 int file_info_has_trailer(const char *path);
 void file_info_retrieve(void);
 void file_info_store(void);
+void file_info_export(void);
 void file_info_store_binary(fileinfo_t *fi, bool force);
 void file_info_store_if_dirty(void);
 void file_info_set_discard(fileinfo_t *fi, bool state);
@@ -459,6 +459,32 @@ gmsg_split_to_pmsg_extend(const void *head, const void *data,
 	return mb;
 }
 
+/**
+ * Account for a multicast routed message serialized once and queued to
+ * ``sent'' nodes.
+ *
+ * Each destination only holds a reference to the shared data block, hence
+ * only the first serialization copies bytes: the remaining ones are the
+ * copies we made when we built one message per destination.  The bytes
+ * copied per message were therefore (copied + shared) / messages, and are
+ * now copied / messages.
+ *
+ * The broadcasting routines always shared a single message, hence they are
+ * not accounted for here.
+ */
+static void
+gmsg_multicast_stats(uint32 size, uint sent)
+{
+	if (0 == sent)
+		return;
+
+	gnet_stats_inc_general(GNR_GMSG_MULTICAST_MESSAGES);
+	gnet_stats_count_general(GNR_GMSG_MULTICAST_DESTINATIONS, sent);
+	gnet_stats_count_general(GNR_GMSG_MULTICAST_COPIED_BYTES, size);
+	gnet_stats_count_general(GNR_GMSG_MULTICAST_SHARED_BYTES,
+		(sent - 1) * size);
+}
+
 /***
  *** Sending of Gnutella messages.
  ***
@@ -798,6 +824,51 @@ gmsg_split_routeto_all(
 	pmsg_free(mb);
 }
 
+/**
+ * Route message from ``from'' consisting of header and data to the nodes
+ * listed in ``sl''.
+ *
+ * The message is serialized once, the first time we find a node to which
+ * it can be sent, and each destination queue gets a shallow clone referencing
+ * the same data block.
+ */
+static void
+gmsg_split_routeto_multi(gnutella_node_t *from, const pslist_t *sl,
+	const void *head, const void *data, uint32 size)
+{
+	pmsg_t *mb = NULL;
+	uint sent = 0;
+
+	gmsg_header_check(head, size);
+
+	for (/* empty */; sl; sl = pslist_next(sl)) {
+		gnutella_node_t *dn = sl->data;
+
+		node_check(dn);
+
+		if (NODE_TALKS_G2(dn) || NODE_IS_UDP(dn))
+			continue;
+		if (from->header_flags && !NODE_CAN_SFLAG(dn))
+			continue;
+		if (!NODE_IS_WRITABLE(dn))
+			continue;
+
+		if (NULL == mb) {
+			mb = gmsg_split_to_pmsg(head, data, size);
+			if (GNET_PROPERTY(gmsg_debug) > 6)
+				gmsg_split_dump(stdout, head, data, size);
+		}
+
+		mq_tcp_putq(dn->outq, pmsg_clone(mb), from);
+		sent++;
+	}
+
+	if (mb != NULL)
+		pmsg_free(mb);
+
+	gmsg_multicast_stats(size, sent);
+}
+
 /**
  * Send Gnutella message held in current node according to route specification.
  */
@@ -805,7 +876,6 @@ void
 gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 {
 	gnutella_node_t *rt_node = rt->ur.u_node;
-	const pslist_t *sl;
 
 	/*
 	 * If during processing (e.g. in search_request_preprocess()) after
@@ -857,16 +927,8 @@ gmsg_sendto_route(gnutella_node_t *n, struct route_dest *rt)
 			&n->header, n->data, n->size + GTA_HEADER_SIZE);
 		return;
 	case ROUTE_MULTI:
-		PSLIST_FOREACH(rt->ur.u_nodes, sl) {
-			rt_node = sl->data;
-			node_check(rt_node);
-			if (NODE_TALKS_G2(rt_node))
-				continue;
-			if (n->header_flags && !NODE_CAN_SFLAG(rt_node))
-				continue;
-			gmsg_split_routeto_one(n, rt_node,
-				&n->header, n->data, n->size + GTA_HEADER_SIZE);
-		}
+		gmsg_split_routeto_multi(n, rt->ur.u_nodes,
+			&n->header, n->data, n->size + GTA_HEADER_SIZE);
 		return;
 	}
 
@@ -46,9 +46,11 @@
 #include "gmsg.h"
 #include "nodes.h"
 #include "settings.h"
+#include "sha1_store.h"
 #include "share.h"
 #include "spam.h"
-#include "verify_sha1.h"
+#include "tth_cache.h"
+#include "verify_combined.h"
 #include "verify_tth.h"
 #include "version.h"
 
@@ -61,6 +63,7 @@
 #include "lib/hashing.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hset.h"
 #include "lib/parse.h"
 #include "lib/pattern.h"
 #include "lib/sha1.h"
@@ -78,21 +81,24 @@
 
 /**
  * There's an in-core cache (the hash table ``sha1_cache''), and a
- * persistent copy (normally in ~/.gtk-gnutella/sha1_cache). The
- * in-core cache is filled with the persistent one at launch. When the
- * "shared_file" (the records describing the shared files, see
- * share.h) are created, a call is made to sha1_set_digest to fill the
- * SHA1 digest part of the shared_file. If the digest isn't found in
- * the in-core cache, it's computed, stored in the in-core cache and
- * appended at the end of the persistent cache. If the digest is found
- * in the cache, a check is made based on the file size and last
- * modification time. If they're identical to the ones in the cache,
- * the digest is considered to be accurate, and is used. If the file
- * size or last modification time don't match, the digest is computed
- * again and stored in the in-core cache, but it isn't stored in the
- * persistent one. Instead, the cache is marked as dirty, and will be
- * entirely overwritten by dump_cache, called when everything has been
- * computed.
+ * persistent copy (normally in ~/.gtk-gnutella/sha1_cache.bin), managed
+ * by the sha1_store layer. The persistent copy is a binary image which is
+ * mapped in memory at launch and probed lazily: the in-core cache is only
+ * filled with the entries that are looked up, plus the ones recorded in
+ * the journal of updates. When the "shared_file" (the records describing
+ * the shared files, see share.h) are created, a call is made to
+ * request_sha1 to fill the SHA1 digest part of the shared_file. If the
+ * digest isn't found in the cache, it's computed, stored in the in-core
+ * cache and appended to the journal. If the digest is found in the cache,
+ * a check is made based on the file size and last modification time. If
+ * they're identical to the ones in the cache, the digest is considered to
+ * be accurate, and is used. If the file size or last modification time
+ * don't match, the digest is computed again and the updated entry is
+ * appended to the journal. When the journal grows too large, a new image
+ * is written by dump_cache from the in-core and mapped entries.
+ *
+ * The legacy text cache (~/.gtk-gnutella/sha1_cache) is imported when
+ * there is no binary image yet, and can be exported at each compaction.
  */
 
 struct sha1_cache_entry {
@@ -108,11 +114,17 @@ struct sha1_cache_entry {
 static hikset_t *sha1_cache;
 
 /**
- * cache_dirty = TRUE means that in-core cache is different from the disk one.
+ * cache_dirty = TRUE means that the persistent image needs to be rewritten.
  */
 static bool cache_dirty;
 static time_t cache_dumped;
 
+/**
+ * cache_pruned = TRUE means that the in-core cache was pruned from the entries
+ * no longer shared, hence mapped entries not loaded in-core are obsolete.
+ */
+static bool cache_pruned;
+
 static cpattern_t *has_http_urls;
 
 /**
@@ -142,8 +154,10 @@ static void update_volatile_cache(
 
 /**
  * Add a new entry to the in-memory cache.
+ *
+ * @return the new entry.
  */
-static void
+static struct sha1_cache_entry *
 add_volatile_cache_entry(const char *filename, filesize_t size, time_t mtime,
 	const struct sha1 *sha1, const struct tth *tth, bool known_to_be_shared)
 {
@@ -157,8 +171,52 @@ add_volatile_cache_entry(const char *filename, filesize_t size, time_t mtime,
 	item->tth = tth ? atom_tth_get(tth) : NULL;
 	item->shared = known_to_be_shared;
 	hikset_insert_key(sha1_cache, &item->file_name);
+
+	return item;
+}
+
+/**
+ * Look up the cache entry for a file, loading it from the persistent
+ * image if it is not already held in-core.
+ *
+ * @param filename		the full path of the file (atom)
+ *
+ * @return the cache entry, NULL if the file is not in the cache.
+ */
+static struct sha1_cache_entry *
+huge_cache_lookup(const char *filename)
+{
+	struct sha1_cache_entry *cached;
+	struct sha1_store_record rec;
+
+	cached = hikset_lookup(sha1_cache, filename);
+
+	if (cached != NULL || !sha1_store_lookup(filename, &rec))
+		return cached;
+
+	return add_volatile_cache_entry(filename, rec.size, rec.mtime,
+		&rec.sha1, rec.has_tth ? &rec.tth : NULL, FALSE);
 }
 
+/**
+ * Fill persistent record from cache entry.
+ */
+static void
+huge_cache_record(struct sha1_store_record *rec,
+	filesize_t size, time_t mtime,
+	const struct sha1 *sha1, const struct tth *tth)
+{
+	rec->size = size;
+	rec->mtime = mtime;
+	rec->sha1 = *sha1;
+	rec->has_tth = tth != NULL;
+	if (tth != NULL)
+		rec->tth = *tth;
+	else
+		ZERO(&rec->tth);
+}
+
+
 /* Disk cache */
 
 static const char sha1_persistent_cache_file_header[] =
@@ -190,44 +248,39 @@ cache_entry_print(FILE *f, const char *filename,
 }
 
 /**
- * Add an entry to the persistent cache.
+ * Record an updated cache entry in the journal.
  */
 static void
-add_persistent_cache_entry(const char *filename, filesize_t size,
-	time_t mtime, const struct sha1 *sha1, const struct tth *tth)
+add_persistent_cache_entry(const struct sha1_cache_entry *e)
 {
-	char *pathname;
-	FILE *f;
+	struct sha1_store_record rec;
 
-	pathname = make_pathname(settings_config_dir(), "sha1_cache");
-	f = file_fopen(pathname, "a");
-	if (f) {
-		filestat_t sb;
-
-		/*
-		 * If we're adding the very first entry (file empty), then emit header.
-		 */
-
-		if (fstat(fileno(f), &sb)) {
-			g_warning("%s(): could not stat \"%s\": %m", G_STRFUNC, pathname);
-		} else {
-			if (0 == sb.st_size) {
-				fputs(sha1_persistent_cache_file_header, f);
-			}
-			cache_entry_print(f, filename, sha1, tth, size, mtime);
-		}
-		fclose(f);
-	} else {
-		g_warning("%s(): could not open \"%s\": %m", G_STRFUNC, pathname);
-	}
-	HFREE_NULL(pathname);
+	huge_cache_record(&rec, e->size, e->mtime, e->sha1, e->tth);
+	sha1_store_append(e->file_name, &rec);
 }
 
 struct dump_cache_context {
-	FILE *f;
-	bool forced;
+	sha1_store_builder_t *b;	/**< The snapshot being built */
+	hset_t *seen;				/**< Paths of in-core entries */
+	FILE *f;					/**< Text export, NULL if none */
+	bool forced;				/**< Keep all entries */
 };
 
+/**
+ * Add entry to the snapshot being built, and to the text export if any.
+ */
+static void
+dump_cache_add(struct dump_cache_context *ctx, const char *filename,
+	const struct sha1_store_record *rec)
+{
+	sha1_store_builder_add(ctx->b, filename, rec);
+
+	if (ctx->f != NULL) {
+		cache_entry_print(ctx->f, filename, &rec->sha1,
+			rec->has_tth ? &rec->tth : NULL, rec->size, rec->mtime);
+	}
+}
+
 /**
  * Dump one (in-memory) cache into the persistent cache. This is a callback
  * called by dump_cache to dump the whole in-memory cache onto disk.
@@ -238,43 +291,89 @@ dump_cache_one_entry(void *value, void *udata)
 	struct sha1_cache_entry *e = value;
 	struct dump_cache_context *ctx = udata;
 
-	if (ctx->forced || e->shared) {
-		cache_entry_print(ctx->f,
-			e->file_name, e->sha1, e->tth, e->size, e->mtime);
+	hset_insert(ctx->seen, e->file_name);
+
+	if (ctx->forced || e->shared || !cache_pruned) {
+		struct sha1_store_record rec;
+
+		huge_cache_record(&rec, e->size, e->mtime, e->sha1, e->tth);
+		dump_cache_add(ctx, e->file_name, &rec);
 	}
 }
 
 /**
- * Dump the whole in-memory cache onto disk.
+ * Dump one entry of the persistent image, unless it is superseded by
+ * an in-core entry.  This is a callback called by dump_cache.
+ */
+static void
+dump_cache_one_stored(const char *filename,
+	const struct sha1_store_record *rec, void *udata)
+{
+	struct dump_cache_context *ctx = udata;
+
+	if (!hset_contains(ctx->seen, filename))
+		dump_cache_add(ctx, filename, rec);
+}
+
+/**
+ * Rewrite the persistent cache image, from the in-memory cache and the
+ * current image.
+ *
+ * Entries that are not known to be shared are dropped once the cache
+ * has been pruned, unless ``force'' is set.
+ *
+ * The image is written in the background, and the journal truncated.
  */
 static void
 dump_cache(bool force)
 {
-	FILE *f;
+	struct dump_cache_context ctx;
 	file_path_t fp;
 
 	if (!force && !cache_dirty)
 		return;
 
-	file_path_set(&fp, settings_config_dir(), "sha1_cache");
-	f = file_config_open_write("SHA-1 cache", &fp);
-	if (f) {
-		struct dump_cache_context ctx;
-
-		fputs(sha1_persistent_cache_file_header, f);
-		ctx.f = f;
-		ctx.forced = force;
-		hikset_foreach(sha1_cache, dump_cache_one_entry, &ctx);
-		if (file_config_close(f, &fp)) {
-			cache_dirty = FALSE;
-		}
-	}
-
 	/*
 	 * Update the timestamp even on failure to avoid that we retry this
 	 * too frequently.
 	 */
+
 	cache_dumped = tm_time();
+
+	if (sha1_store_compacting())
+		return;				/* Will retry later, cache_dirty still set */
+
+	ctx.b = sha1_store_builder_new(
+		hikset_count(sha1_cache) + sha1_store_count());
+	ctx.seen = hset_create(HASH_KEY_STRING, 0);
+	ctx.forced = force;
+	ctx.f = NULL;
+
+	if (GNET_PROPERTY(sha1_cache_export)) {
+		file_path_set(&fp, settings_config_dir(), "sha1_cache");
+		ctx.f = file_config_open_write("SHA-1 cache", &fp);
+		if (ctx.f != NULL)
+			fputs(sha1_persistent_cache_file_header, ctx.f);
+	}
+
+	hikset_foreach(sha1_cache, dump_cache_one_entry, &ctx);
+
+	if (force || !cache_pruned)
+		sha1_store_foreach(dump_cache_one_stored, &ctx);
+
+	hset_free_null(&ctx.seen);
+
+	if (ctx.f != NULL)
+		file_config_close(ctx.f, &fp);
+
+	if (GNET_PROPERTY(share_debug)) {
+		size_t n = sha1_store_builder_count(ctx.b);
+		g_debug("%s(): compacting SHA1 cache to %zu entr%s",
+			G_STRFUNC, n, plural_y(n));
+	}
+
+	if (sha1_store_commit(&ctx.b))
+		cache_dirty = FALSE;
 }
 
 /**
@@ -376,6 +475,20 @@ parse_and_append_cache_entry(char *line)
 			return;		/* File was modified */
 	}
 
+	/*
+	 * Entries replayed from the journal are more recent.
+	 */
+
+	{
+		const char *filename = atom_str_get(p);
+		bool known = hikset_contains(sha1_cache, filename);
+
+		atom_str_free_null(&filename);
+
+		if (known)
+			return;
+	}
+
 	add_volatile_cache_entry(p, size, mtime,
 		&sha1, has_tth ? &tth : NULL, FALSE);
 	return;
@@ -385,7 +498,33 @@ failure:
 }
 
 /**
- * Read the whole persistent cache into memory.
+ * Journal replaying callback, recording the entry in the in-memory cache.
+ */
+static void G_COLD
+huge_cache_replayed(const char *path,
+	const struct sha1_store_record *rec, void *unused_data)
+{
+	const char *filename = atom_str_get(path);
+	struct sha1_cache_entry *cached = hikset_lookup(sha1_cache, filename);
+	const struct tth *tth = rec->has_tth ? &rec->tth : NULL;
+
+	(void) unused_data;
+
+	if (cached != NULL) {
+		cached->size = rec->size;
+		cached->mtime = rec->mtime;
+		atom_sha1_change(&cached->sha1, &rec->sha1);
+		atom_tth_change(&cached->tth, tth);
+	} else {
+		add_volatile_cache_entry(filename,
+			rec->size, rec->mtime, &rec->sha1, tth, FALSE);
+	}
+
+	atom_str_free_null(&filename);
+}
+
+/**
+ * Import the whole legacy text cache into memory, then write the binary image.
  */
 static void G_COLD
 sha1_read_cache(void)
@@ -451,7 +590,7 @@ cache_dump_due(cqueue_t *cq, void *unused_obj)
 }
 
 /**
- * Dump the cache at most about once per HUGE_SHA1_CACHE_FREQ secs..
+ * Rewrite the persistent cache at most about once per HUGE_SHA1_CACHE_FREQ secs.
  */
 static void
 cache_dump_schedule(void)
@@ -532,21 +671,22 @@ huge_update_hashes(shared_file_t *sf,
 
 	/* Update cache */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	cached = huge_cache_lookup(shared_file_path(sf));
 
 	if (cached) {
 		update_volatile_cache(cached, shared_file_size(sf),
 			shared_file_modification_time(sf), sha1, tth);
-
-		cache_dump_schedule(); 	/* Dump cache once per minute */
 	} else {
-		add_volatile_cache_entry(shared_file_path(sf),
+		cached = add_volatile_cache_entry(shared_file_path(sf),
 			shared_file_size(sf), shared_file_modification_time(sf),
 			sha1, tth, TRUE);
-		add_persistent_cache_entry(shared_file_path(sf),
-			shared_file_size(sf), shared_file_modification_time(sf),
-			sha1, tth);
 	}
+
+	add_persistent_cache_entry(cached);
+
+	if (sha1_store_needs_compaction())
+		cache_dump_schedule(); 	/* Compact cache at most once per minute */
+
 	return TRUE;
 }
 
@@ -577,7 +717,7 @@ huge_need_sha1(shared_file_t *sf)
 	if G_UNLIKELY(NULL == sha1_cache)
 		return FALSE;		/* Shutdown occurred (processing TEQ event?) */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	cached = huge_cache_lookup(shared_file_path(sf));
 
 	if (cached != NULL) {
 		filestat_t sb;
@@ -601,6 +741,36 @@ huge_need_sha1(shared_file_t *sf)
 	return TRUE;
 }
 
+/**
+ * Amount of library files whose SHA1 or TTH is being computed.
+ *
+ * Several files can be hashed concurrently, hence the "rebuilding"
+ * properties are only cleared when the last computation is over.
+ */
+static uint huge_sha1_computing, huge_tth_computing;
+
+static void
+huge_rebuilding_update(property_t prop, uint *count, bool start)
+{
+	if (start) {
+		if (0 == (*count)++)
+			gnet_prop_set_boolean_val(prop, TRUE);
+	} else {
+		g_assert(*count != 0);
+		if (0 == --(*count))
+			gnet_prop_set_boolean_val(prop, FALSE);
+	}
+}
+
+/**
+ * Record the start or the end of a TTH computation for a library file.
+ */
+void
+huge_tth_rebuilding(bool start)
+{
+	huge_rebuilding_update(PROP_TTH_REBUILDING, &huge_tth_computing, start);
+}
+
 /**
  ** External interface
  **/
@@ -624,17 +794,55 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	case VERIFY_START:
 		if (!huge_need_sha1(sf))
 			return FALSE;
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, TRUE);
+		huge_rebuilding_update(PROP_SHA1_REBUILDING,
+			&huge_sha1_computing, TRUE);
+
+		/*
+		 * There is no need to compute the TTH again when the one we
+		 * already know for the file lies in the cache.
+		 */
+
+		if (shared_file_tth_is_available(sf))
+			verify_combined_skip_tth(ctx);
+		else
+			huge_tth_rebuilding(TRUE);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		return shared_file_indexed(sf);
 	case VERIFY_DONE:
-		huge_update_hashes(sf, verify_sha1_digest(ctx), NULL);
-		request_tigertree(sf, TRUE);
+		{
+			const struct tth *tth = NULL;
+
+			/*
+			 * Both digests were computed in a single pass over the file,
+			 * unless the TTH was already known.
+			 *
+			 * As in request_tigertree_callback(), the TTH is persisted in
+			 * the cache first, before updating the hashes.  Only finished
+			 * files can advertise their TTH though.
+			 */
+
+			if (shared_file_is_finished(sf)) {
+				tth = verify_combined_tth(ctx);
+				if (NULL == tth) {
+					tth = shared_file_tth(sf);		/* Was not recomputed */
+				} else {
+					tth_cache_insert(tth, verify_combined_tth_leaves(ctx),
+						verify_combined_tth_leave_count(ctx));
+				}
+			}
+
+			huge_update_hashes(sf, verify_combined_sha1(ctx), tth);
+		}
 		/* FALL THROUGH */
 	case VERIFY_ERROR:
 	case VERIFY_SHUTDOWN:
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, FALSE);
+		if (verify_accepted(ctx)) {
+			huge_rebuilding_update(PROP_SHA1_REBUILDING,
+				&huge_sha1_computing, FALSE);
+			if (!verify_combined_skips_tth(ctx))
+				huge_tth_rebuilding(FALSE);
+		}
 		shared_file_unref(&sf);
 		return TRUE;
 	case VERIFY_INVALID:
@@ -647,8 +855,7 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 /**
  * Put the shared file on the stack of the things to do.
  *
- * We first begin with the computation of the SHA1, and when completed we
- * will continue with the TTH computation.
+ * The SHA1 and the TTH are computed together, reading the file only once.
  */
 static void
 queue_shared_file_for_sha1_computation(shared_file_t *sf)
@@ -657,7 +864,7 @@ queue_shared_file_for_sha1_computation(shared_file_t *sf)
 
  	shared_file_check(sf);
 
-	inserted = verify_sha1_enqueue(FALSE, shared_file_path(sf),
+	inserted = verify_combined_enqueue(FALSE, shared_file_path(sf),
 					shared_file_size(sf), huge_verify_callback,
 					shared_file_ref(sf));
 
@@ -686,7 +893,7 @@ sha1_is_cached(const shared_file_t *sf)
 {
 	const struct sha1_cache_entry *cached;
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	cached = huge_cache_lookup(shared_file_path(sf));
 	return cached && cached_entry_up_to_date(cached, sf);
 }
 
@@ -705,7 +912,7 @@ sha1_is_cached(const shared_file_t *sf)
 bool
 huge_cached_is_uptodate(const char *path, filesize_t size, time_t mtime)
 {
-	const struct sha1_cache_entry *cached = hikset_lookup(sha1_cache, path);
+	const struct sha1_cache_entry *cached = huge_cache_lookup(path);
 
 	if (NULL == cached)
 		return FALSE;
@@ -726,10 +933,9 @@ request_sha1(shared_file_t *sf)
 	if (!shared_file_indexed(sf))
 		return;		/* "stale" shared file, has been superseded or removed */
 
-	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
+	cached = huge_cache_lookup(shared_file_path(sf));
 
 	if (cached && cached_entry_up_to_date(cached, sf)) {
-		cache_dirty = TRUE;
 		cached->shared = TRUE;
 		shared_file_set_sha1(sf, cached->sha1);
 		shared_file_set_tth(sf, cached->tth);
@@ -1054,13 +1260,20 @@ huge_sha1_cache_prune(void)
 	size_t pruned;
 
 	pruned = hikset_foreach_remove(sha1_cache, cache_entry_is_shared, NULL);
+	cache_pruned = TRUE;
 
 	if (GNET_PROPERTY(share_debug)) {
 		g_info("%s(): pruned %zu entr%s from SHA1 cache",
 			G_STRFUNC, pruned, plural_y(pruned));
 	}
 
-	if (pruned != 0)
+	/*
+	 * All the shared files have been looked up during the rescan, hence
+	 * are now held in-core: if the persistent image holds more entries,
+	 * some are obsolete.
+	 */
+
+	if (pruned != 0 || sha1_store_count() > hikset_count(sha1_cache))
 		cache_dump_schedule();
 }
 
@@ -1070,9 +1283,19 @@ huge_sha1_cache_prune(void)
 void
 huge_init(void)
 {
+	bool mapped;
+
 	sha1_cache = hikset_create(		/* Keys are atoms */
 		offsetof(struct sha1_cache_entry, file_name), HASH_KEY_SELF, 0);
-	sha1_read_cache();
+	mapped = sha1_store_open(settings_config_dir());
+	sha1_store_replay(huge_cache_replayed, NULL);
+
+	/*
+	 * Import the legacy text cache when there is no binary image yet.
+	 */
+
+	if (!mapped)
+		sha1_read_cache();
 	has_http_urls = pattern_compile("http://", FALSE);
 }
 
@@ -1098,7 +1321,12 @@ cache_free_entry(void *v, void *unused_udata)
 void
 huge_close(void)
 {
-	dump_cache(FALSE);
+	cq_cancel(&cache_dump_ev);
+
+	if (sha1_store_needs_compaction())
+		dump_cache(FALSE);
+
+	sha1_store_close();		/* Waits for pending image rewrite */
 
 	hikset_foreach(sha1_cache, cache_free_entry, NULL);
 	hikset_free_null(&sha1_cache);
@@ -73,6 +73,7 @@ void huge_collect_locations(
 bool huge_cached_is_uptodate(const char *path, filesize_t size, time_t mtime);
 
 void huge_sha1_cache_prune(void);
+void huge_tth_rebuilding(bool start);
 
 #endif	/* _core_huge_h_ */
 
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * I/O worker pools.
+ *
+ * Blocking disk operations can be handed to a pool of threads, so that a
+ * slow or busy disk does not stall the main thread, which keeps serving
+ * the sockets, timers and queries in the meantime.
+ *
+ * There is one pool per type of I/O, each with its own threads sized by
+ * its own property, so that one kind of I/O cannot starve the other, and
+ * so that each can be turned off independently.
+ *
+ * Jobs are submitted to streams.  The jobs of a given stream are processed
+ * in their submission order and never concurrently, and their completion
+ * is notified to the main thread in the same order.  Contrary to the
+ * compression pool, the main thread can synchronize with a stream, waiting
+ * for all its submitted jobs to be processed and getting their completion
+ * delivered before returning: this is required before tearing down the
+ * state on which the completion routine relies.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "iopool.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/cond.h"
+#include "lib/mutex.h"
+#include "lib/slist.h"
+#include "lib/str.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+#define IOPOOL_THREAD_MAX	16		/**< Max amount of I/O threads */
+
+enum iopool_stream_magic { IOPOOL_STREAM_MAGIC = 0x1e2c70b3 };
+
+/**
+ * A stream of jobs, processed sequentially.
+ *
+ * The fields following the lock comment are protected by the pool lock.
+ */
+struct iopool_stream {
+	enum iopool_stream_magic magic;
+	const char *name;			/**< Stream name, for logging (atom) */
+	struct iopool *pool;		/**< Pool processing the jobs */
+	void *owner;				/**< Owner, given to the done() callback */
+	iopool_work_t work;			/**< Job processing, in worker threads */
+	iopool_done_t done;			/**< Job completion, in the main thread */
+	free_fn_t discard;			/**< Disposal of undelivered jobs */
+	/* Protected by the pool lock */
+	slist_t *jobs;				/**< Jobs to process */
+	slist_t *processed;			/**< Processed jobs, to be delivered */
+	uint refcnt;				/**< Owner, running job, posted delivery */
+	uint running:1;				/**< Set when a thread processes a job */
+	uint ready:1;				/**< Set when stream is in the ready list */
+	uint posted:1;				/**< Set when delivery was posted */
+	uint dead:1;				/**< Set when stream was freed by its owner */
+};
+
+static inline void
+iopool_stream_check(const struct iopool_stream * const is)
+{
+	g_assert(is != NULL);
+	g_assert(IOPOOL_STREAM_MAGIC == is->magic);
+}
+
+/**
+ * A pool of I/O threads.
+ *
+ * All the fields but the type and the name are protected by the lock.
+ */
+struct iopool {
+	enum iopool_type type;		/**< Type of I/O handled by the pool */
+	const char *name;			/**< Thread name prefix */
+	mutex_t lock;				/**< Thread-safe lock */
+	cond_t work;				/**< Signalled when work can be done */
+	cond_t processed;			/**< Signalled when a job was processed */
+	slist_t *ready;				/**< Streams with jobs and no running thread */
+	uint threads;				/**< Amount of running threads */
+	uint idle;					/**< Amount of idle threads */
+	uint8 exiting;				/**< Set when threads must exit */
+};
+
+static struct iopool iopool[IOPOOL_TYPE_COUNT] = {
+	{ IOPOOL_DISK, "I/O", MUTEX_INIT, COND_INIT, COND_INIT,
+		NULL, 0, 0, FALSE },
+	{ IOPOOL_UPLOAD, "upload I/O", MUTEX_INIT, COND_INIT, COND_INIT,
+		NULL, 0, 0, FALSE },
+};
+
+#define IOPOOL_LOCK(p)		mutex_lock(&(p)->lock)
+#define IOPOOL_UNLOCK(p)	mutex_unlock(&(p)->lock)
+
+#define assert_iopool_locked(p) \
+	assert_mutex_is_owned(&(p)->lock)
+
+/**
+ * @return the pool handling the given type of I/O.
+ */
+static inline struct iopool *
+iopool_get(enum iopool_type type)
+{
+	g_assert(UNSIGNED(type) < N_ITEMS(iopool));
+
+	return &iopool[type];
+}
+
+/**
+ * @return the targeted amount of I/O threads for the pool.
+ */
+static uint
+iopool_target(const struct iopool *p)
+{
+	uint n = 0;
+
+	switch (p->type) {
+	case IOPOOL_DISK:
+		n = GNET_PROPERTY(download_write_threads);
+		break;
+	case IOPOOL_UPLOAD:
+		n = GNET_PROPERTY(upload_pump_threads);
+		break;
+	case IOPOOL_TYPE_COUNT:
+		g_assert_not_reached();
+	}
+
+	return MIN(n, IOPOOL_THREAD_MAX);
+}
+
+/**
+ * @return whether the given type of I/O should be handed to its pool.
+ */
+bool
+iopool_enabled(enum iopool_type type)
+{
+	const struct iopool *p = iopool_get(type);
+
+	return 0 != iopool_target(p) && !p->exiting;
+}
+
+/**
+ * Make stream ready to be processed, if it has jobs and is not running.
+ *
+ * @return TRUE if stream was inserted in the ready list.
+ */
+static bool
+iopool_stream_ready(iopool_stream_t *is)
+{
+	struct iopool *p = is->pool;
+
+	assert_iopool_locked(p);
+
+	if (is->running || is->ready || is->dead || 0 == slist_length(is->jobs))
+		return FALSE;
+
+	if G_UNLIKELY(NULL == p->ready)
+		p->ready = slist_new();
+
+	slist_append(p->ready, is);
+	is->ready = TRUE;
+	return TRUE;
+}
+
+/**
+ * Remove a reference on the stream, releasing it when the last one goes.
+ *
+ * This is only called from the main thread.
+ */
+static void
+iopool_stream_unref(iopool_stream_t *is)
+{
+	bool last;
+
+	iopool_stream_check(is);
+	g_assert(thread_is_main());
+
+	IOPOOL_LOCK(is->pool);
+	g_assert(is->refcnt != 0);
+	last = 0 == --is->refcnt;
+	IOPOOL_UNLOCK(is->pool);
+
+	if (!last)
+		return;
+
+	g_assert(is->dead);
+	g_assert(!is->running);
+	g_assert(0 == slist_length(is->processed));
+
+	slist_free(&is->jobs);
+	slist_free(&is->processed);
+	atom_str_free_null(&is->name);
+	is->magic = 0;
+	WFREE(is);
+}
+
+/**
+ * Deliver the processed jobs to the owner of the stream, in the main thread.
+ */
+static void
+iopool_stream_deliver(iopool_stream_t *is)
+{
+	slist_t *processed;
+	bool dead;
+
+	iopool_stream_check(is);
+	g_assert(thread_is_main());
+
+	IOPOOL_LOCK(is->pool);
+	dead = is->dead;
+	if (0 == slist_length(is->processed)) {
+		processed = NULL;
+	} else {
+		processed = is->processed;
+		is->processed = slist_new();
+	}
+	IOPOOL_UNLOCK(is->pool);
+
+	if (NULL == processed)
+		return;
+
+	/*
+	 * Since the owner can only free the stream from the main thread, it
+	 * cannot disappear whilst we are invoking the completion routine.
+	 */
+
+	if (dead) {
+		slist_free_all(&processed, is->discard);
+	} else {
+		void *job;
+
+		while (NULL != (job = slist_shift(processed)))
+			(*is->done)(is->owner, job);
+
+		slist_free(&processed);
+	}
+}
+
+/**
+ * Main thread notification that jobs were processed.
+ */
+static void
+iopool_stream_posted(void *data)
+{
+	iopool_stream_t *is = data;
+
+	iopool_stream_check(is);
+
+	IOPOOL_LOCK(is->pool);
+	is->posted = FALSE;
+	IOPOOL_UNLOCK(is->pool);
+
+	iopool_stream_deliver(is);
+	iopool_stream_unref(is);
+}
+
+/**
+ * Record that a job of the stream was processed.
+ */
+static void
+iopool_stream_processed(iopool_stream_t *is, void *job)
+{
+	assert_iopool_locked(is->pool);
+
+	slist_append(is->processed, job);
+	is->running = FALSE;
+
+	/*
+	 * A single delivery is posted to the main thread for all the jobs
+	 * processed until it runs.  It holds a reference on the stream, so
+	 * that it can be safely invoked even when the stream was freed
+	 * meanwhile.
+	 */
+
+	if (!is->posted) {
+		is->posted = TRUE;
+		is->refcnt++;
+		teq_safe_post(THREAD_MAIN_ID, iopool_stream_posted, is);
+	}
+
+	cond_broadcast(&is->pool->processed, &is->pool->lock);
+}
+
+/**
+ * I/O thread main loop.
+ */
+static void *
+iopool_thread_main(void *arg)
+{
+	uint n = pointer_to_uint(arg);
+	uint id = n / IOPOOL_TYPE_COUNT;
+	struct iopool *p = iopool_get(n % IOPOOL_TYPE_COUNT);
+
+	thread_set_name_atom(str_smsg("%s #%u", p->name, id));
+
+	IOPOOL_LOCK(p);
+
+	for (;;) {
+		iopool_stream_t *is;
+		void *job;
+
+		/*
+		 * Wait for a stream with pending jobs.
+		 */
+
+		while (
+			NULL == p->ready ||
+			NULL == (is = slist_shift(p->ready))
+		) {
+			if (p->exiting)
+				goto exiting;
+
+			p->idle++;
+			cond_wait(&p->work, &p->lock);
+			p->idle--;
+		}
+
+		iopool_stream_check(is);
+		g_assert(is->ready);
+		g_assert(!is->running);
+
+		job = slist_shift(is->jobs);
+		is->ready = FALSE;
+		is->running = TRUE;
+
+		IOPOOL_UNLOCK(p);
+
+		(*is->work)(job);
+
+		IOPOOL_LOCK(p);
+
+		/*
+		 * The job is recorded as processed before the stream can be made
+		 * ready again, to guarantee that completions are delivered in the
+		 * job order.
+		 */
+
+		iopool_stream_processed(is, job);
+
+		if (iopool_stream_ready(is))
+			cond_signal(&p->work, &p->lock);
+	}
+
+exiting:
+	p->threads--;
+	IOPOOL_UNLOCK(p);
+
+	return NULL;
+}
+
+/**
+ * Create a new I/O thread in the pool if the queued work warrants it.
+ */
+static void
+iopool_spawn_if_needed(struct iopool *p)
+{
+	bool spawn = FALSE;
+	uint id = 0;
+	int r;
+
+	IOPOOL_LOCK(p);
+
+	if (
+		0 == p->idle &&
+		!p->exiting &&
+		p->threads < iopool_target(p) &&
+		p->ready != NULL &&
+		p->threads < slist_length(p->ready)
+	) {
+		id = p->threads++;
+		spawn = TRUE;
+	}
+
+	IOPOOL_UNLOCK(p);
+
+	if (!spawn)
+		return;
+
+	/*
+	 * The thread argument encodes both its pool and its number.
+	 */
+
+	r = thread_create(iopool_thread_main,
+			uint_to_pointer(id * IOPOOL_TYPE_COUNT + p->type),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN);
+
+	/*
+	 * Failing to create a thread is not fatal: iopool_stream_sync() will
+	 * process the jobs from the main thread if no thread is left.
+	 */
+
+	if (-1 == r) {
+		IOPOOL_LOCK(p);
+		p->threads--;
+		IOPOOL_UNLOCK(p);
+
+		g_warning("%s(): cannot create new %s thread: %m", G_STRFUNC, p->name);
+	}
+}
+
+/**
+ * Create a new stream.
+ *
+ * @param type		type of I/O, selecting the pool processing the jobs
+ * @param name		name of the stream, for logging
+ * @param owner		owner of the stream, given back to the done() routine
+ * @param work		routine processing jobs, called from worker threads
+ * @param done		routine notified of processed jobs, in the main thread
+ * @param discard	routine disposing of jobs processed after stream is freed
+ *
+ * @return new stream to which jobs can be submitted.
+ */
+iopool_stream_t *
+iopool_stream_make(enum iopool_type type, const char *name, void *owner,
+	iopool_work_t work, iopool_done_t done, free_fn_t discard)
+{
+	iopool_stream_t *is;
+
+	g_assert(work != NULL);
+	g_assert(done != NULL);
+	g_assert(discard != NULL);
+
+	WALLOC0(is);
+	is->magic = IOPOOL_STREAM_MAGIC;
+	is->name = atom_str_get(name);
+	is->pool = iopool_get(type);
+	is->owner = owner;
+	is->work = work;
+	is->done = done;
+	is->discard = discard;
+	is->jobs = slist_new();
+	is->processed = slist_new();
+	is->refcnt = 1;				/* The owner's reference */
+
+	return is;
+}
+
+/**
+ * Submit new job to the stream.
+ *
+ * The job will be processed after all the previously submitted ones.
+ */
+void
+iopool_stream_submit(iopool_stream_t *is, void *job)
+{
+	iopool_stream_check(is);
+	g_assert(thread_is_main());
+
+	IOPOOL_LOCK(is->pool);
+
+	g_assert(!is->dead);
+
+	slist_append(is->jobs, job);
+	if (iopool_stream_ready(is))
+		cond_signal(&is->pool->work, &is->pool->lock);
+
+	IOPOOL_UNLOCK(is->pool);
+
+	iopool_spawn_if_needed(is->pool);
+}
+
+/**
+ * Wait until all the jobs submitted to the stream have been processed,
+ * then deliver their completion before returning.
+ *
+ * Jobs that no thread has picked up yet are processed by the main thread
+ * itself, which avoids waiting for a thread to become available and makes
+ * sure we do not wait forever when the pool is stopped.
+ */
+void
+iopool_stream_sync(iopool_stream_t *is)
+{
+	struct iopool *p;
+
+	iopool_stream_check(is);
+	g_assert(thread_is_main());
+
+	p = is->pool;
+
+	IOPOOL_LOCK(p);
+
+	g_assert(!is->dead);
+
+	for (;;) {
+		if (is->running) {
+			cond_wait(&p->processed, &p->lock);
+		} else if (0 != slist_length(is->jobs)) {
+			void *job = slist_shift(is->jobs);
+
+			if (is->ready) {
+				slist_remove(p->ready, is);
+				is->ready = FALSE;
+			}
+			is->running = TRUE;
+
+			IOPOOL_UNLOCK(p);
+			(*is->work)(job);
+			IOPOOL_LOCK(p);
+
+			iopool_stream_processed(is, job);
+		} else {
+			break;
+		}
+	}
+
+	IOPOOL_UNLOCK(p);
+
+	iopool_stream_deliver(is);
+}
+
+/**
+ * Free stream and nullify its pointer.
+ *
+ * All the submitted jobs are processed and delivered first, so that the
+ * owner does not lose any I/O.
+ *
+ * @param is_ptr	pointer to the stream
+ */
+void
+iopool_stream_free(iopool_stream_t **is_ptr)
+{
+	iopool_stream_t *is = *is_ptr;
+
+	if (is != NULL) {
+		iopool_stream_check(is);
+
+		iopool_stream_sync(is);
+
+		IOPOOL_LOCK(is->pool);
+		is->dead = TRUE;
+		IOPOOL_UNLOCK(is->pool);
+
+		iopool_stream_unref(is);
+		*is_ptr = NULL;
+	}
+}
+
+/**
+ * Stop the I/O threads of all the pools.
+ *
+ * Streams still allocated at that time must be synchronized before being
+ * used again, and new streams should not be created afterwards.
+ */
+void
+iopool_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(iopool); i++) {
+		struct iopool *p = &iopool[i];
+
+		IOPOOL_LOCK(p);
+		p->exiting = TRUE;
+		cond_broadcast(&p->work, &p->lock);
+		IOPOOL_UNLOCK(p);
+	}
+}
+
+/* vi: set ts=4 sw=4 cindent: */
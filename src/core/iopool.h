@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * I/O worker pools.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_iopool_h_
+#define _core_iopool_h_
+
+#include "common.h"
+
+struct iopool_stream;
+typedef struct iopool_stream iopool_stream_t;
+
+/**
+ * Types of I/O, each handled by its own pool of threads.
+ */
+enum iopool_type {
+	IOPOOL_DISK = 0,		/**< Writing downloaded data to disk */
+	IOPOOL_UPLOAD,			/**< Sending upload data to the network */
+
+	IOPOOL_TYPE_COUNT
+};
+
+/**
+ * Processing of a job, invoked from a worker thread.
+ */
+typedef void (*iopool_work_t)(void *job);
+
+/**
+ * Completion of a job, invoked from the main thread.
+ */
+typedef void (*iopool_done_t)(void *owner, void *job);
+
+/*
+ * Public interface.
+ */
+
+bool iopool_enabled(enum iopool_type type);
+iopool_stream_t *iopool_stream_make(enum iopool_type type,
+	const char *name, void *owner,
+	iopool_work_t work, iopool_done_t done, free_fn_t discard);
+void iopool_stream_submit(iopool_stream_t *is, void *job);
+void iopool_stream_sync(iopool_stream_t *is);
+void iopool_stream_free(iopool_stream_t **is_ptr);
+void iopool_close(void);
+
+#endif /* _core_iopool_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
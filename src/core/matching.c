@@ -38,10 +38,13 @@
 #include "lib/atoms.h"
 #include "lib/halloc.h"
 #include "lib/hset.h"
+#include "lib/hstrfn.h"
+#include "lib/htable.h"
 #include "lib/pattern.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
 #include "lib/utf8.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
 
@@ -88,6 +91,58 @@ typedef uint64 st_mask_t;
 
 #define ST_MIN_BIN_SIZE		4
 
+/*
+ * Word index.
+ *
+ * In addition to the bins, each set can keep an inverted index of all the
+ * words appearing in the names it holds: for each word, we record the sorted
+ * list of entries (by their position in the set's all_entries bin) where it
+ * appears, which is called the posting list of the word.
+ *
+ * A word starts wherever pattern_search() would consider it is at the
+ * beginning of a word in qs_begin mode (on an is_ascii_ident() boundary)
+ * and extends up to the next space.  Therefore, any query word matching a
+ * given entry is necessarily a prefix of one of the words indexed for that
+ * entry, and the union of the posting lists of all the indexed words starting
+ * with the query word is a superset of the entries that can match.
+ *
+ * Once the set is compacted, words are sorted so that the range of words
+ * starting with a given prefix can be located by binary search.  Posting
+ * lists are delta-encoded in blocks of ST_POSTING_BLOCK entries, the first
+ * entry of each block being kept aside so that we can gallop over the blocks
+ * when intersecting lists.
+ *
+ * Queries are then answered by intersecting the posting lists of their words,
+ * cheapest first, and only the surviving entries are submitted to pattern
+ * matching.  When the query words are too short to be selective, we fall back
+ * to scanning the smallest bin.
+ */
+
+#define ST_POSTING_BLOCK	64		/**< Entries per compressed posting block */
+#define ST_WORD_RANGE_MAX	32		/**< Max indexed words per query prefix */
+
+struct st_raw_posting {
+	uint count, size;
+	uint32 *vals;					/* Sorted entry positions */
+};
+
+struct st_posting_block {
+	uint32 head;					/* First entry position in block */
+	uint32 offset;					/* Offset of next entries in data[] */
+};
+
+struct st_posting {
+	uint count;						/* Amount of entries */
+	uint nblocks;					/* Amount of blocks */
+	struct st_posting_block *block;
+	uchar *data;					/* Delta-encoded entries, NULL if none */
+};
+
+struct st_word {
+	const char *word;				/* atom */
+	struct st_posting post;
+};
+
 struct st_entry {
 	const char *string;				/* atom */
 	shared_file_t *sf;
@@ -103,6 +158,9 @@ struct st_set {
 	uint nentries, nchars, nbins;
 	struct st_bin **bins;
 	struct st_bin all_entries;
+	htable_t *words_raw;			/* word -> st_raw_posting, while building */
+	struct st_word *words;			/* Sorted word index, once compacted */
+	uint nwords;					/* Amount of indexed words */
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
 };
@@ -198,6 +256,713 @@ bin_compact(struct st_bin *bin)
 	bin->nslots = bin->nvals;
 }
 
+/**
+ * @return length of the variable-length encoding of value.
+ */
+static inline size_t
+st_varint_len(uint32 v)
+{
+	size_t n = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Encode value at p using 7 bits per byte, least significant bits first.
+ *
+ * @return pointer to the byte following the encoded value.
+ */
+static inline uchar *
+st_varint_put(uchar *p, uint32 v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+/**
+ * Decode value encoded by st_varint_put() at p.
+ *
+ * @return pointer to the byte following the decoded value.
+ */
+static inline const uchar *
+st_varint_get(const uchar *p, uint32 *v)
+{
+	uint32 r = 0;
+	uint shift = 0;
+	uchar c;
+
+	do {
+		c = *p++;
+		r |= (uint32) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*v = r;
+	return p;
+}
+
+/**
+ * Record that entry at position `idx' in the set contains the given word.
+ */
+static void
+st_word_record(struct st_set *set, const char *word, uint32 idx)
+{
+	struct st_raw_posting *rp;
+
+	rp = htable_lookup(set->words_raw, word);
+
+	if (NULL == rp) {
+		WALLOC0(rp);
+		htable_insert(set->words_raw, atom_str_get(word), rp);
+	}
+
+	/*
+	 * Entries are inserted in sequence, hence the posting list is naturally
+	 * sorted and we only need to look at its tail to avoid duplicates.
+	 */
+
+	if (rp->count != 0 && rp->vals[rp->count - 1] == idx)
+		return;
+
+	if (rp->count == rp->size) {
+		rp->size = MAX(2, rp->size * 2);
+		HREALLOC_ARRAY(rp->vals, rp->size);
+	}
+
+	g_assert(0 == rp->count || rp->vals[rp->count - 1] < idx);
+
+	rp->vals[rp->count++] = idx;
+}
+
+/**
+ * Index all the words of a string held at position `idx' in the set.
+ */
+static void
+st_word_index(struct st_set *set, const char *s, uint32 idx)
+{
+	char *copy, *p;
+	size_t i, len;
+
+	/*
+	 * Words extend up to the next space, so by turning spaces into NULs
+	 * in a copy of the string, any word starting in the copy will be
+	 * properly NUL-terminated.
+	 */
+
+	len = vstrlen(s);
+	copy = h_strdup(s);
+
+	for (p = copy; *p != '\0'; p++) {
+		if (' ' == *p)
+			*p = '\0';
+	}
+
+	for (i = 0; i < len; i++) {
+		if (' ' == s[i])
+			continue;
+		if (i != 0 && is_ascii_ident(s[i - 1]) == is_ascii_ident(s[i]))
+			continue;		/* Not at a word boundary for pattern_search() */
+
+		st_word_record(set, &copy[i], idx);
+	}
+
+	HFREE_NULL(copy);
+}
+
+/**
+ * Compress a raw posting list.
+ *
+ * @return amount of bytes used by the compressed posting list.
+ */
+static size_t
+st_posting_compress(struct st_posting *post, const struct st_raw_posting *rp)
+{
+	size_t len = 0;
+	uchar *p;
+	uint i;
+
+	g_assert(rp->count != 0);
+
+	post->count = rp->count;
+	post->nblocks = (rp->count + ST_POSTING_BLOCK - 1) / ST_POSTING_BLOCK;
+
+	for (i = 0; i < rp->count; i++) {
+		if (0 != i % ST_POSTING_BLOCK)
+			len += st_varint_len(rp->vals[i] - rp->vals[i - 1]);
+	}
+
+	HALLOC_ARRAY(post->block, post->nblocks);
+	post->data = 0 == len ? NULL : halloc(len);
+
+	for (i = 0, p = post->data; i < rp->count; i++) {
+		if (0 == i % ST_POSTING_BLOCK) {
+			struct st_posting_block *b = &post->block[i / ST_POSTING_BLOCK];
+
+			b->head = rp->vals[i];
+			b->offset = 0 == len ? 0 : p - post->data;
+		} else {
+			p = st_varint_put(p, rp->vals[i] - rp->vals[i - 1]);
+		}
+	}
+
+	g_assert(0 == len || UNSIGNED(p - post->data) == len);
+
+	return len + post->nblocks * sizeof post->block[0];
+}
+
+/**
+ * Decode block `b' of the posting list into vals[].
+ *
+ * @return amount of entries in the block.
+ */
+static uint
+st_posting_block(const struct st_posting *post, uint b, uint32 *vals)
+{
+	const struct st_posting_block *pb;
+	const uchar *p;
+	uint i, n;
+
+	g_assert(b < post->nblocks);
+
+	pb = &post->block[b];
+	n = b == post->nblocks - 1 ?
+		post->count - b * ST_POSTING_BLOCK : ST_POSTING_BLOCK;
+
+	vals[0] = pb->head;
+
+	for (i = 1, p = post->data + pb->offset; i < n; i++) {
+		uint32 delta;
+
+		p = st_varint_get(p, &delta);
+		vals[i] = vals[i - 1] + delta;
+	}
+
+	return n;
+}
+
+/**
+ * Decode whole posting list into vals[], which must be large enough.
+ *
+ * @return amount of entries decoded.
+ */
+static uint
+st_posting_decode(const struct st_posting *post, uint32 *vals)
+{
+	uint b, n = 0;
+
+	for (b = 0; b < post->nblocks; b++)
+		n += st_posting_block(post, b, &vals[n]);
+
+	g_assert(n == post->count);
+
+	return n;
+}
+
+/**
+ * Free compressed posting list.
+ */
+static void
+st_posting_free(struct st_posting *post)
+{
+	HFREE_NULL(post->block);
+	HFREE_NULL(post->data);
+	post->count = post->nblocks = 0;
+}
+
+/**
+ * A forward-only cursor on a compressed posting list.
+ */
+struct st_cursor {
+	const struct st_posting *post;
+	uint block;						/* Decoded block */
+	uint n;							/* Amount of entries in block */
+	uint pos;						/* Current position in block */
+	uint32 vals[ST_POSTING_BLOCK];	/* Decoded block entries */
+};
+
+static void
+st_cursor_init(struct st_cursor *c, const struct st_posting *post)
+{
+	c->post = post;
+	c->block = 0;
+	c->pos = 0;
+	c->n = st_posting_block(post, 0, c->vals);
+}
+
+/**
+ * Move cursor forward to the first entry greater or equal to the target.
+ *
+ * Targets must be supplied in increasing order.  Blocks that cannot hold
+ * the target are skipped by galloping over their first entries, and are
+ * never decoded.
+ *
+ * @return TRUE if the target is present in the posting list.
+ */
+static bool
+st_cursor_seek(struct st_cursor *c, uint32 target)
+{
+	const struct st_posting *post = c->post;
+	uint lo = c->block + 1;
+
+	if (lo < post->nblocks && post->block[lo].head <= target) {
+		uint hi = lo + 1, step = 1;
+
+		while (hi < post->nblocks && post->block[hi].head <= target) {
+			lo = hi;
+			step *= 2;
+			hi = lo + step;
+		}
+
+		hi = MIN(hi, post->nblocks);
+
+		/* Locate last block in [lo, hi) starting before or at the target */
+
+		while (hi - lo > 1) {
+			uint mid = lo + (hi - lo) / 2;
+
+			if (post->block[mid].head <= target)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		c->block = lo;
+		c->pos = 0;
+		c->n = st_posting_block(post, lo, c->vals);
+	}
+
+	while (c->pos < c->n && c->vals[c->pos] < target)
+		c->pos++;
+
+	return c->pos < c->n && c->vals[c->pos] == target;
+}
+
+static int
+st_word_cmp(const void *a, const void *b)
+{
+	const struct st_word *wa = a, *wb = b;
+
+	return strcmp(wa->word, wb->word);
+}
+
+static int
+st_uint32_cmp(const void *a, const void *b)
+{
+	const uint32 *ua = a, *ub = b;
+
+	return CMP(*ua, *ub);
+}
+
+/**
+ * Free the word index of a set, whatever its state.
+ */
+static void
+st_set_words_free(struct st_set *set)
+{
+	uint i;
+
+	if (set->words_raw != NULL) {
+		htable_iter_t *iter = htable_iter_new(set->words_raw);
+		const void *key;
+		void *value;
+
+		while (htable_iter_next(iter, &key, &value)) {
+			struct st_raw_posting *rp = value;
+
+			atom_str_free(key);
+			HFREE_NULL(rp->vals);
+			WFREE(rp);
+		}
+
+		htable_iter_release(&iter);
+		htable_free_null(&set->words_raw);
+	}
+
+	for (i = 0; i < set->nwords; i++) {
+		atom_str_free_null(&set->words[i].word);
+		st_posting_free(&set->words[i].post);
+	}
+
+	HFREE_NULL(set->words);
+	set->nwords = 0;
+}
+
+/**
+ * Locate an indexed word.
+ *
+ * @return the word in the compacted index, NULL if not found.
+ */
+static struct st_word *
+st_word_lookup(const struct st_set *set, const char *word)
+{
+	uint l = 0, h = set->nwords;
+
+	while (l < h) {
+		uint mid = l + (h - l) / 2;
+		int c = strcmp(set->words[mid].word, word);
+
+		if (0 == c)
+			return &set->words[mid];
+		else if (c < 0)
+			l = mid + 1;
+		else
+			h = mid;
+	}
+
+	return NULL;
+}
+
+/**
+ * Append the entries of a raw posting list to a compressed posting list.
+ *
+ * The entries in the raw list must all be greater than the ones already
+ * present in the compressed list.
+ */
+static void
+st_posting_extend(struct st_posting *post, const struct st_raw_posting *rp)
+{
+	struct st_raw_posting all;
+
+	all.count = all.size = post->count + rp->count;
+	HALLOC_ARRAY(all.vals, all.size);
+
+	st_posting_decode(post, all.vals);
+	g_assert(0 == post->count || all.vals[post->count - 1] < rp->vals[0]);
+
+	memcpy(&all.vals[post->count], rp->vals, rp->count * sizeof rp->vals[0]);
+
+	st_posting_free(post);
+	st_posting_compress(post, &all);
+	HFREE_NULL(all.vals);
+}
+
+/**
+ * Merge the words of the entries inserted after compaction into the sorted
+ * word index.
+ *
+ * New entries are appended to the set, hence their positions are greater
+ * than the ones already indexed: only the posting lists of the words found
+ * in the new entries need to be extended, the other entries of the set are
+ * not indexed again.
+ */
+static void
+st_set_words_merge(struct st_set *set)
+{
+	htable_iter_t *iter;
+	const void *key;
+	void *value;
+	struct st_word *added = NULL, *words;
+	uint i, j, k, nadded = 0, extended = 0;
+
+	g_assert(set->words != NULL);
+	g_assert(set->words_raw != NULL);
+
+	if (0 != htable_count(set->words_raw))
+		HALLOC_ARRAY(added, htable_count(set->words_raw));
+
+	iter = htable_iter_new(set->words_raw);
+
+	while (htable_iter_next(iter, &key, &value)) {
+		struct st_raw_posting *rp = value;
+		struct st_word *w = st_word_lookup(set, key);
+
+		if (w != NULL) {
+			st_posting_extend(&w->post, rp);
+			atom_str_free(key);
+			extended++;
+		} else {
+			w = &added[nadded++];
+			w->word = key;			/* Atom now owned by the word index */
+			st_posting_compress(&w->post, rp);
+		}
+
+		HFREE_NULL(rp->vals);
+		WFREE(rp);
+	}
+
+	htable_iter_release(&iter);
+	htable_free_null(&set->words_raw);
+
+	if (0 != nadded) {
+		vsort(added, nadded, sizeof added[0], st_word_cmp);
+		HALLOC_ARRAY(words, set->nwords + nadded);
+
+		for (i = j = k = 0; i < set->nwords || j < nadded; k++) {
+			if (
+				j == nadded ||
+				(i < set->nwords && st_word_cmp(&set->words[i], &added[j]) < 0)
+			)
+				words[k] = set->words[i++];
+			else
+				words[k] = added[j++];
+		}
+
+		HFREE_NULL(set->words);
+		set->words = words;
+		set->nwords = k;
+	}
+
+	HFREE_NULL(added);
+
+	if (GNET_PROPERTY(matching_debug)) {
+		g_debug("MATCH %s(): extended %u word%s, added %u, now %u word%s "
+			"for %u entr%s",
+			G_STRFUNC, extended, plural(extended), nadded,
+			set->nwords, plural(set->nwords),
+			set->all_entries.nvals, plural_y(set->all_entries.nvals));
+	}
+}
+
+/**
+ * Turn the word table built during insertions into the sorted word index.
+ */
+static void
+st_set_words_compact(struct st_set *set)
+{
+	htable_iter_t *iter;
+	const void *key;
+	void *value;
+	size_t bytes = 0;
+	uint i = 0;
+
+	if (NULL == set->words_raw)
+		return;
+
+	if (set->words != NULL) {
+		st_set_words_merge(set);
+		return;
+	}
+
+	set->nwords = htable_count(set->words_raw);
+	if (set->nwords != 0)
+		HALLOC_ARRAY(set->words, set->nwords);
+
+	iter = htable_iter_new(set->words_raw);
+
+	while (htable_iter_next(iter, &key, &value)) {
+		struct st_raw_posting *rp = value;
+		struct st_word *w = &set->words[i++];
+
+		w->word = key;			/* Atom now owned by the word index */
+		bytes += st_posting_compress(&w->post, rp);
+
+		HFREE_NULL(rp->vals);
+		WFREE(rp);
+	}
+
+	htable_iter_release(&iter);
+	htable_free_null(&set->words_raw);
+
+	g_assert(i == set->nwords);
+
+	vsort(set->words, set->nwords, sizeof set->words[0], st_word_cmp);
+
+	if (GNET_PROPERTY(matching_debug)) {
+		g_debug("MATCH indexed %u word%s from %u entr%s, "
+			"posting lists use %zu bytes",
+			set->nwords, plural(set->nwords),
+			set->all_entries.nvals, plural_y(set->all_entries.nvals), bytes);
+	}
+}
+
+/**
+ * Locate the range of indexed words starting with the given prefix.
+ *
+ * @param set		the set, with a compacted word index
+ * @param word		the prefix to look for
+ * @param len		length of the prefix
+ * @param lo		where the first matching word index is written
+ * @param hi		where the index after the last matching word is written
+ *
+ * @return TRUE if the range is not empty.
+ */
+static bool
+st_word_range(const struct st_set *set,
+	const char *word, size_t len, uint *lo, uint *hi)
+{
+	uint l = 0, h = set->nwords;
+
+	while (l < h) {
+		uint mid = l + (h - l) / 2;
+
+		if (strcmp(set->words[mid].word, word) < 0)
+			l = mid + 1;
+		else
+			h = mid;
+	}
+
+	*lo = l;
+	h = set->nwords;
+
+	/* Words bearing the prefix all sort together, right at the lower bound */
+
+	while (l < h) {
+		uint mid = l + (h - l) / 2;
+
+		if (0 == strncmp(set->words[mid].word, word, len))
+			l = mid + 1;
+		else
+			h = mid;
+	}
+
+	*hi = l;
+
+	return *lo != *hi;
+}
+
+struct st_word_range {
+	uint lo, hi;					/* Range of matching indexed words */
+	size_t cost;					/* Sum of their posting list lengths */
+	bool done;						/* Already intersected */
+};
+
+/**
+ * Only keep the candidates held in the posting lists of the word range.
+ *
+ * @return the amount of candidates kept, at the head of vals[].
+ */
+static uint
+st_word_filter(const struct st_set *set,
+	const struct st_word_range *wr, uint32 *vals, uint n)
+{
+	struct st_cursor *c;
+	uint i, j, k = wr->hi - wr->lo, m = 0;
+
+	WALLOC_ARRAY(c, k);
+
+	for (j = 0; j < k; j++)
+		st_cursor_init(&c[j], &set->words[wr->lo + j].post);
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < k; j++) {
+			if (st_cursor_seek(&c[j], vals[i])) {
+				vals[m++] = vals[i];
+				break;
+			}
+		}
+	}
+
+	WFREE_ARRAY(c, k);
+	return m;
+}
+
+/**
+ * Compute the entries that can match a query through the word index.
+ *
+ * @param set		the set, with a compacted word index
+ * @param wovec		query words
+ * @param wocnt		amount of query words
+ * @param limit		amount of entries we would have to scan otherwise
+ * @param ncand		where the amount of candidates is written
+ *
+ * @return the candidate entry positions, in increasing order, NULL if
+ * there are none or if the word index cannot reduce the amount of entries
+ * to scan, in which case ncand is set to (uint) -1.
+ */
+static uint32 *
+st_word_candidates(const struct st_set *set,
+	const word_vec_t *wovec, uint wocnt, uint limit, uint *ncand)
+{
+	struct st_word_range *wr;
+	uint32 *vals = NULL;
+	uint i, j, n = 0, driver = 0;
+
+	g_assert(wocnt != 0);
+
+	WALLOC_ARRAY(wr, wocnt);
+
+	for (i = 0; i < wocnt; i++) {
+		struct st_word_range *r = &wr[i];
+
+		r->done = FALSE;
+		r->cost = 0;
+
+		if (!st_word_range(set, wovec[i].word, wovec[i].len, &r->lo, &r->hi))
+			goto done;		/* No indexed word bears that prefix */
+
+		if (r->hi - r->lo > ST_WORD_RANGE_MAX) {
+			r->cost = (size_t) -1;	/* Not selective, do not filter on it */
+			continue;
+		}
+
+		for (j = r->lo; j < r->hi; j++)
+			r->cost += set->words[j].post.count;
+
+		if (r->cost < wr[driver].cost)
+			driver = i;
+	}
+
+	if (wr[driver].cost >= limit) {
+		n = (uint) -1;		/* Scanning the bin will be cheaper */
+		goto done;
+	}
+
+	/*
+	 * Expand the cheapest word into the initial candidate set.
+	 */
+
+	HALLOC_ARRAY(vals, wr[driver].cost);
+
+	for (j = wr[driver].lo; j < wr[driver].hi; j++)
+		n += st_posting_decode(&set->words[j].post, &vals[n]);
+
+	if (wr[driver].hi - wr[driver].lo > 1) {
+		uint m;
+
+		vsort(vals, n, sizeof vals[0], st_uint32_cmp);
+
+		for (i = 1, m = 1; i < n; i++) {
+			if (vals[i] != vals[m - 1])
+				vals[m++] = vals[i];
+		}
+		n = m;
+	}
+
+	wr[driver].done = TRUE;
+
+	/*
+	 * Intersect with the posting lists of the other selective words,
+	 * cheapest first.
+	 */
+
+	while (n != 0) {
+		struct st_word_range *next = NULL;
+
+		for (i = 0; i < wocnt; i++) {
+			struct st_word_range *r = &wr[i];
+
+			if (r->done || (size_t) -1 == r->cost)
+				continue;
+			if (NULL == next || r->cost < next->cost)
+				next = r;
+		}
+
+		if (NULL == next)
+			break;
+
+		n = st_word_filter(set, next, vals, n);
+		next->done = TRUE;
+	}
+
+	if (0 == n)
+		HFREE_NULL(vals);
+
+done:
+	WFREE_ARRAY(wr, wocnt);
+	*ncand = n;
+	return vals;
+}
+
 static uchar map[MAX_INT_VAL(uchar)];
 
 static void
@@ -262,6 +1027,9 @@ st_set_initialize(struct st_set *set)
 	set->nbins = set->nchars * set->nchars;
 	set->bins = NULL;
 	set->all_entries.vals = 0;
+	set->words_raw = NULL;
+	set->words = NULL;
+	set->nwords = 0;
 
 	if (GNET_PROPERTY(matching_debug)) {
 		static bool done;
@@ -290,9 +1058,12 @@ st_initialize(search_table_t *table)
 
 /**
  * Recreate variable parts of the searching sets.
+ *
+ * @param set			the set to recreate
+ * @param word_index	whether to build a word index for the set
  */
 static void
-st_set_recreate(struct st_set *set)
+st_set_recreate(struct st_set *set, bool word_index)
 {
 	uint i;
 
@@ -303,6 +1074,9 @@ st_set_recreate(struct st_set *set)
 		set->bins[i] = NULL;
 
     bin_initialize(&set->all_entries, ST_MIN_BIN_SIZE);
+
+	if (word_index)
+		set->words_raw = htable_create(HASH_KEY_STRING, 0);
 }
 
 /**
@@ -313,8 +1087,8 @@ st_recreate(search_table_t *table)
 {
 	search_table_check(table);
 
-	st_set_recreate(&table->plain);
-	st_set_recreate(&table->alias);
+	st_set_recreate(&table->plain, GNET_PROPERTY(search_word_index));
+	st_set_recreate(&table->alias, GNET_PROPERTY(search_word_index));
 }
 
 /**
@@ -344,6 +1118,8 @@ st_set_destroy(struct st_set *set)
 		}
 		bin_destroy(&set->all_entries);
 	}
+
+	st_set_words_free(set);
 }
 
 /**
@@ -512,6 +1288,18 @@ st_insert_item(search_table_t *table,
 	entry->sf = shared_file_ref(sf);
 	entry->mask = mask_hash(entry->string);
 
+	/*
+	 * The word index must reference all the entries in the set or it would
+	 * cause false negatives: once compacted, the words of the new entries
+	 * are collected aside, to be merged into the index by st_compact().
+	 */
+
+	if (set->words != NULL && NULL == set->words_raw)
+		set->words_raw = htable_create(HASH_KEY_STRING, 0);
+
+	if (set->words_raw != NULL)
+		st_word_index(set, entry->string, set->all_entries.nvals);
+
 	len = vstrlen(entry->string);
 	for (i = 0; i < len - 1; i++) {
 		uint key = st_key(set, &entry->string[i]);
@@ -552,6 +1340,8 @@ st_set_compact(struct st_set *set)
 		if (set->bins[i])
 			bin_compact(set->bins[i]);
 	}
+
+	st_set_words_compact(set);
 }
 
 /**
@@ -695,7 +1485,8 @@ st_run_search(
 	uint wocnt;
 	cpattern_t **pattern;
 	struct st_entry **vals;
-	uint vcnt;
+	uint32 *cand = NULL;	/* candidates from the word index */
+	uint vcnt, ncand = (uint) -1;
 	int scanned = 0;		/* measure search mask efficiency */
 	pslist_t *local;
 	st_mask_t search_mask;
@@ -840,16 +1631,27 @@ st_run_search(
 		shared_file_name_canonic_len : shared_file_name_normalized_len;
 
 	/*
-	 * Search through the smallest bin
+	 * Narrow down the entries to scan through the word index, if we have
+	 * one and it yields less entries than the smallest bin.  Otherwise,
+	 * search through the smallest bin.  Entries inserted since the index
+	 * was last compacted are not in the index yet.
 	 */
 
-	vcnt = best_bin->nvals;
-	vals = best_bin->vals;
+	if (set->words != NULL && NULL == set->words_raw)
+		cand = st_word_candidates(set, wovec, wocnt, best_bin_size, &ncand);
+
+	if ((uint) -1 != ncand) {
+		vcnt = ncand;
+		vals = set->all_entries.vals;
+	} else {
+		vcnt = best_bin->nvals;
+		vals = best_bin->vals;
+	}
 
 	nres = 0;
 	local = *result;
 	for (i = 0; i < vcnt; i++) {
-		const struct st_entry *e = vals[i];
+		const struct st_entry *e = NULL == cand ? vals[i] : vals[cand[i]];
 		const shared_file_t *sf;
 		size_t filename_len;
 
@@ -906,12 +1708,15 @@ st_run_search(
 		}
 
 		g_debug("MATCH %s(): "
-			"scanned %d/%d bin entr%s, "
+			"scanned %d/%d %s entr%s, "
 			"compiled %u/%u pattern%s, got %d match%s",
-			G_STRFUNC, scanned, best_bin_size, plural_y(scanned),
+			G_STRFUNC, scanned, vcnt,
+			(uint) -1 == ncand ? "bin" : "word index", plural_y(scanned),
 			compiled, wocnt, plural(compiled), nres, plural_es(nres));
 	}
 
+	HFREE_NULL(cand);
+
 	/*
 	 * Matching patterns are lazily compiled by entry_match(), as they are
 	 * needed, but in order.  Therefore we can stop as soon as we hit a NULL
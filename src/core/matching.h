@@ -45,6 +45,10 @@
  *  This mechanism is very flexible and could easily be adapted to match
  *  accented characters, etc.
  *
+ *    Each set can also keep an inverted index of the words appearing in
+ *  the strings, used to narrow down the entries to scan for multi-word
+ *  queries before falling back to the smallest bin.
+ *
  *    The actual search builds a regular expression to do the matching.  This
  *  might have a tiny bit higher overhead than a custom implementation of
  *  string matching, but it also allows a great deal of flexibility and ease
@@ -95,6 +95,7 @@
 #include "version.h"
 #include "vmsg.h"
 #include "whitelist.h"
+#include "zpool.h"
 
 #include "g2/frame.h"
 #include "g2/msg.h"
@@ -3901,10 +3902,21 @@ node_tx_deflate_flowc(void *o, size_t amount)
 		bio_add_allocated(mq_bio(n->outq), amount);
 }
 
+static void
+node_tx_deflate_level(void *o, int level)
+{
+	gnutella_node_t *n = o;
+
+	node_check(n);
+
+	n->tx_zlevel = level;
+}
+
 static struct tx_deflate_cb node_tx_deflate_cb = {
 	node_add_tx_deflated,		/* add_tx_deflated */
 	node_tx_shutdown,			/* shutdown */
 	node_tx_deflate_flowc,		/* flow_control */
+	node_tx_deflate_level,		/* level_changed */
 };
 
 /***
@@ -4866,6 +4878,7 @@ node_net_stack_create(gnutella_node_t *n)
 			g_debug("receiving compressed data from %s", node_infostr(n));
 
 		args.cb = &node_rx_inflate_cb;
+		args.async = zpool_enabled();
 
 		n->rx = rx_make_above(n->rx, rx_inflate_get_ops(), &args);
 
@@ -4908,7 +4921,10 @@ node_net_stack_create(gnutella_node_t *n)
 		args.cb = &node_tx_deflate_cb;
 		args.nagle = TRUE;
 		args.gzip = FALSE;
+		args.async = zpool_enabled();
 		args.reduced = settings_is_ultra() && NODE_IS_LEAF(n);
+		args.bws = n->peermode == NODE_P_LEAF
+					? BSCHED_BWS_GLOUT : BSCHED_BWS_GOUT;
 		args.buffer_size = NODE_TX_BUFSIZ;
 		args.buffer_flush = NODE_TX_FLUSH;
 
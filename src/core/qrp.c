@@ -71,6 +71,7 @@
 #include "lib/mutex.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
+#include "lib/qrt_kernel.h"
 #include "lib/random.h"
 #include "lib/sha1.h"
 #include "lib/spinlock.h"
@@ -193,6 +194,8 @@ struct routing_table {
 	unsigned compacted:1;	/**< Table was compacted */
 	unsigned cancelled:1;	/**< Must supersede with next version */
 	unsigned is_empty:1;	/**< Whether table is empty (all slots cleared) */
+	unsigned in_matrix:1;	/**< Whether table has a routing matrix column */
+	uint matrix_col;		/**< Column in routing matrix, if in_matrix */
 	/**
 	 * Whether this routing table can route the given URN query.
 	 */
@@ -497,6 +500,301 @@ qrt_patch_slot(struct routing_table *rt, uint i, uint8 v)
 	}
 }
 
+/***
+ *** Routing matrix.
+ ***/
+
+/**
+ * The routing matrix transposes the routing tables we received: for each
+ * slot, a row of bits indicates which tables have that slot set.
+ *
+ * All the tables of a given size are held in the same matrix, so that the
+ * hash vector of a query is mapped to slots only once per table size, and
+ * the set of nodes to which we can route the query is computed by combining
+ * a few machine words per hash, instead of probing each table in turn.
+ */
+struct qrt_matrix {
+	uint64 *rows;			/**< 2^bits rows of `width' words */
+	uint64 *used;			/**< Columns in use, `width' words */
+	uint64 *hits;			/**< Routing result for last query */
+	uint width;				/**< Amount of 64-bit words per row */
+	uint count;				/**< Amount of columns in use */
+	int bits;				/**< Amount of bits in table size */
+};
+
+static struct qrt_matrix *qrt_matrix[MAX_TABLE_BITS + 1];
+
+/**
+ * @return size of the matrix rows, in bytes.
+ */
+static size_t
+qrt_matrix_size(const struct qrt_matrix *m)
+{
+	return ((size_t) 1 << m->bits) * m->width * sizeof m->rows[0];
+}
+
+/**
+ * Add one word to each row of the matrix, making room for 64 more columns.
+ */
+static void
+qrt_matrix_grow(struct qrt_matrix *m)
+{
+	uint64 *rows;
+	size_t i, slots = (size_t) 1 << m->bits;
+	uint width = m->width + 1;
+
+	HALLOC0_ARRAY(rows, slots * width);
+
+	if (m->rows != NULL) {
+		for (i = 0; i < slots; i++) {
+			memcpy(&rows[i * width], &m->rows[i * m->width],
+				m->width * sizeof rows[0]);
+		}
+	}
+
+	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+		GNET_PROPERTY(qrp_memory) - qrt_matrix_size(m));
+
+	HFREE_NULL(m->rows);
+	m->rows = rows;
+	m->width = width;
+	HREALLOC_ARRAY(m->used, width);
+	HREALLOC_ARRAY(m->hits, width);
+	m->used[width - 1] = m->hits[width - 1] = 0;
+
+	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+		GNET_PROPERTY(qrp_memory) + qrt_matrix_size(m));
+
+	if (qrp_debugging(0)) {
+		g_debug("QRP routing matrix for %u-slot tables now has %u columns",
+			1U << m->bits, width * 64);
+	}
+}
+
+/**
+ * Free matrix.
+ */
+static void
+qrt_matrix_free(struct qrt_matrix *m)
+{
+	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+		GNET_PROPERTY(qrp_memory) - qrt_matrix_size(m));
+
+	HFREE_NULL(m->rows);
+	HFREE_NULL(m->used);
+	HFREE_NULL(m->hits);
+	WFREE(m);
+}
+
+/**
+ * Remove routing table from the routing matrix, if present.
+ */
+static void
+qrt_matrix_remove(struct routing_table *rt)
+{
+	struct qrt_matrix *m;
+	uint col;
+
+	if (!rt->in_matrix)
+		return;
+
+	rt->in_matrix = FALSE;
+	m = qrt_matrix[rt->bits];
+
+	if (NULL == m)
+		return;			/* Already freed by qrp_close() */
+
+	/*
+	 * There is no need to clear the column: it is only looked at for
+	 * tables present in the matrix and will be fully rewritten when reused.
+	 */
+
+	col = rt->matrix_col;
+	g_assert(m->used[col / 64] & ((uint64) 1 << (col % 64)));
+
+	m->used[col / 64] &= ~((uint64) 1 << (col % 64));
+
+	if (0 == --m->count) {
+		qrt_matrix[rt->bits] = NULL;
+		qrt_matrix_free(m);
+	}
+}
+
+/**
+ * Record routing table in the routing matrix, allocating a column for it
+ * if it does not already have one, and copy its slots into the column.
+ */
+static void
+qrt_matrix_update(struct routing_table *rt)
+{
+	struct qrt_matrix *m;
+	uint64 bit, *p;
+	uint col, i;
+
+	qrt_check(rt);
+	g_assert(rt->compacted);
+
+	/*
+	 * Empty tables cannot route anything and are handled through their
+	 * dedicated routing routine.
+	 */
+
+	if (rt->is_empty || !GNET_PROPERTY(qrp_batched_routing)) {
+		qrt_matrix_remove(rt);
+		return;
+	}
+
+	g_assert(rt->bits >= 0 && rt->bits <= MAX_TABLE_BITS);
+	g_assert((1 << rt->bits) == rt->slots);
+
+	m = qrt_matrix[rt->bits];
+
+	if (NULL == m) {
+		WALLOC0(m);
+		m->bits = rt->bits;
+		qrt_matrix[rt->bits] = m;
+	}
+
+	if (rt->in_matrix) {
+		col = rt->matrix_col;
+	} else {
+		if (m->count == m->width * 64)
+			qrt_matrix_grow(m);
+
+		for (i = 0; i < m->width; i++) {
+			if (m->used[i] != MAX_INT_VAL(uint64))
+				break;
+		}
+
+		g_assert(i < m->width);
+
+		col = i * 64 + ctz64(~m->used[i]);
+		m->used[i] |= (uint64) 1 << (col % 64);
+		m->count++;
+		rt->in_matrix = TRUE;
+		rt->matrix_col = col;
+	}
+
+	bit = (uint64) 1 << (col % 64);
+	p = &m->rows[col / 64];
+
+	for (i = 0; i < UNSIGNED(rt->slots); i++, p += m->width) {
+		if (RT_SLOT_READ(rt->arena, i))
+			*p |= bit;
+		else
+			*p &= ~bit;
+	}
+}
+
+/**
+ * Compute the set of tables in the matrix to which the query can be routed.
+ *
+ * This applies the same logic as qrp_can_route_default() to all the columns
+ * at once: when there are URNs, any of them matching is enough to route
+ * the query, otherwise all the words must match when there are less than 3,
+ * and 2/3 of them when there are more.
+ */
+static void
+qrt_matrix_route_one(struct qrt_matrix *m, const query_hashvec_t *qhv)
+{
+	const struct query_hash *qh = qhv->vec;
+	const uint64 *wrow[QRP_HVEC_MAX], *urow[QRP_HVEC_MAX];
+	uint64 atleast[QRP_HVEC_MAX + 1];
+	uint i, j, w, nw = 0, nu = 0, need;
+	uint shift = 32 - m->bits;
+
+	g_assert(qhv->count <= QRP_HVEC_MAX);
+
+	/*
+	 * Map each hash to its matrix row, once.
+	 */
+
+	for (i = 0; i < qhv->count; i++) {
+		const uint64 *row = &m->rows[(size_t) (qh[i].hashcode >> shift) * m->width];
+
+		G_PREFETCH_R(row);
+
+		if (qhv->has_urn && QUERY_H_URN == qh[i].source)
+			urow[nu++] = row;
+		else
+			wrow[nw++] = row;
+	}
+
+	/* 3 * hit / word >= 2 is equivalent to hit >= ceil(2 * word / 3) */
+
+	need = nw < 3 ? nw : (2 * nw + 2) / 3;
+
+	for (w = 0; w < m->width; w++) {
+		uint64 v;
+
+		/*
+		 * atleast[j] is the set of columns matching at least j of the words
+		 * seen so far, which is updated with each row.
+		 */
+
+		atleast[0] = MAX_INT_VAL(uint64);
+		for (j = 1; j <= need; j++)
+			atleast[j] = 0;
+
+		for (i = 0; i < nw; i++) {
+			uint64 r = wrow[i][w];
+
+			for (j = MIN(i + 1, need); j != 0; j--)
+				atleast[j] |= atleast[j - 1] & r;
+		}
+
+		v = (0 == nw && qhv->has_urn) ? 0 : atleast[need];
+
+		for (i = 0; i < nu; i++)
+			v |= urow[i][w];
+
+		m->hits[w] = v;
+	}
+}
+
+/**
+ * Compute routing results for the query in all the routing matrices.
+ */
+static void
+qrt_matrix_route(const query_hashvec_t *qhv)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(qrt_matrix); i++) {
+		if (qrt_matrix[i] != NULL)
+			qrt_matrix_route_one(qrt_matrix[i], qhv);
+	}
+}
+
+/**
+ * @return whether last query given to qrt_matrix_route() can be routed
+ * through the table.
+ */
+static inline bool
+qrt_matrix_can_route(const struct routing_table *rt)
+{
+	const struct qrt_matrix *m = qrt_matrix[rt->bits];
+	uint col = rt->matrix_col;
+
+	return 0 != (m->hits[col / 64] & ((uint64) 1 << (col % 64)));
+}
+
+/**
+ * Free all the routing matrices.
+ */
+static void
+qrt_matrix_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(qrt_matrix); i++) {
+		if (qrt_matrix[i] != NULL) {
+			qrt_matrix_free(qrt_matrix[i]);
+			qrt_matrix[i] = NULL;
+		}
+	}
+}
+
 /**
  * Compact routing table in place so that only one bit of information is used
  * per entry, reducing memory requirements by a factor of 8.
@@ -676,13 +974,8 @@ qrt_patches_clear(void)
 static struct routing_patch *
 qrt_diff_4(struct routing_table *old, struct routing_table *new)
 {
-	int bytes;
 	struct routing_patch *rp;
-	uchar *op;
-	uchar *np;
-	uchar *pp;
-	int i;
-	bool changed = FALSE;
+	bool changed;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
 	g_assert(old == NULL || old->compacted);
@@ -698,61 +991,21 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 	rp->len = rp->size / 2;			/* Each entry stored on 4 bits */
 	rp->entry_bits = 4;
 	rp->compressed = FALSE;
-	pp = rp->arena = halloc(rp->len);
-
-	op = old ? old->arena : NULL;
-	np = new->arena;
+	rp->arena = halloc(rp->len);
 
-	for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-		uint8 nbyte = *np++;
-		int j;
-		uint8 v;
-
-		/*
-		 * Optimize computation: if bytes are equal, we can immediately
-		 * generate 8 quartets of 0, i.e. 4 bytes.
-		 */
-
-		if G_LIKELY(obyte == nbyte) {
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
-			continue;
-		}
-
-		/*
-		 * In our compacted table, set bits indicate presence.
-		 * Thus, we need to build the patch quartets as:
-		 *
-		 *     old bit      new bit      patch
-		 *        0            0          0x0     (no change)
-		 *        0            1          0xf     (-1, from INFINITY=2 to 1)
-		 *        1            0          0x1     (+1, from 1 to INFINITY)
-		 *        1            1          0x0     (no change)
-		 */
-
-		for (v = 0, j = 7; j >= 0; j--) {
-			uint8 mask = 1 << j;
-
-			if ((obyte & mask) ^ (nbyte & mask)) {	/* Bit `j' changed */
-				v |= (obyte & mask) ? 0x1 : 0xf;
-				changed = TRUE;
-			}
-
-			if (j & 0x1)
-				v <<= 4;			/* We have upper half of octet (byte) */
-			else {
-				*pp++ = v;
-				v = 0;
-			}
-		}
-	}
+	/*
+	 * In our compacted table, set bits indicate presence.
+	 * Thus, we need to build the patch quartets as:
+	 *
+	 *     old bit      new bit      patch
+	 *        0            0          0x0     (no change)
+	 *        0            1          0xf     (-1, from INFINITY=2 to 1)
+	 *        1            0          0x1     (+1, from 1 to INFINITY)
+	 *        1            1          0x0     (no change)
+	 */
 
-	g_assert(np == (new->arena + new->slots / 8));
-	g_assert(op == NULL || op == (old->arena + old->slots / 8));
-	g_assert(pp == (rp->arena + rp->len));
+	changed = qrtk_diff4(rp->arena,
+		NULL == old ? NULL : old->arena, new->arena, new->slots / 8);
 
 	if (!changed && old != NULL) {
 		qrt_patch_free(rp);
@@ -778,13 +1031,8 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 static struct routing_patch *
 qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 {
-	int bytes;
 	struct routing_patch *rp;
-	uchar *op;
-	uchar *np;
-	uchar *pp;
-	int i;
-	bool changed = FALSE;
+	bool changed;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
 	g_assert(old == NULL || old->compacted);
@@ -801,10 +1049,7 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	rp->entry_bits = 1;
 	rp->compressed = FALSE;
 	rp->reversed = booleanize(reverse);
-	pp = rp->arena = halloc(rp->len);
-
-	op = old ? old->arena : NULL;
-	np = new->arena;
+	rp->arena = halloc(rp->len);
 
 	/*
 	 * A 1-bit patch is really a flip of all the bytes.
@@ -818,33 +1063,8 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	 * This is the truth table of XOR.
 	 */
 
-	if (reverse) {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
-
-			if G_LIKELY(0 == v) {
-				*pp++ = v;
-			} else {
-				*pp++ = reverse_byte(v);
-				changed = TRUE;
-			}
-		}
-	} else {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
-
-			*pp++ = v;
-
-			if G_UNLIKELY(v != 0)
-				changed = TRUE;
-		}
-	}
-
-	g_assert(np == (new->arena + new->slots / 8));
-	g_assert(op == NULL || op == (old->arena + old->slots / 8));
-	g_assert(pp == (rp->arena + rp->len));
+	changed = qrtk_diff1(rp->arena,
+		NULL == old ? NULL : old->arena, new->arena, new->slots / 8, reverse);
 
 	if (!changed && old != NULL) {
 		qrt_patch_free(rp);
@@ -1127,6 +1347,7 @@ qrt_free(struct routing_table *rt)
 {
 	g_assert(rt->refcnt == 0);
 
+	qrt_matrix_remove(rt);
 	atom_sha1_free_null(&rt->digest);
 	HFREE_NULL(rt->arena);
 	HFREE_NULL(rt->name);
@@ -1387,9 +1608,6 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 {
 	int ratio;
 	int expand;
-	int i;
-	int b;
-	int bytes;
 
 	/*
 	 * By construction, the size of the arena is the max of all the sizes
@@ -1408,92 +1626,18 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 	g_assert(ratio >= 0);
 
 	expand = 1 << ratio;
-	bytes = rt->slots / 8;
 
 	g_assert(rt->slots * expand <= slots);	/* Won't overflow */
 
 	/*
 	 * Loop over the supplied QRT, and expand each slot `expand' times into
-	 * the arena, doing an "OR" merging.
+	 * the arena, doing an "OR" merging: since 0 is less than "infinity",
+	 * clearing the arena slots indicates presence.
 	 *
-	 * Since this is going to be a tight loop, try to optimize the smallest
-	 * expansion factors by avoiding memset() calls.
-	 *
-	 * Furthermore, we avoid repeated RT_SLOT_READ() calls by accessing the
-	 * compacted table one byte at a time and then looping on each of its bits.
+	 * This is a tight loop, handled by vectorized kernels when possible.
 	 */
 
-#define RT_FOR_EACH_BIT_SET(ON_CHANGE)				\
-for (b = 0, i = 0; b < bytes; b++) {				\
-	uint8 entry = rt->arena[b];						\
-	unsigned mask = 0x80;							\
-													\
-	do {											\
-		/* "0 OR x = x", hence skip unset bits */	\
-		if (entry & mask) {							\
-			ON_CHANGE								\
-		}											\
-		i++;										\
-		mask >>= 1;									\
-	} while (mask);									\
-}
-
-	switch (expand) {
-	case 1:
-		RT_FOR_EACH_BIT_SET(
-			arena[i] = 0;		/* less than "inf" => indicates presence */
-		);
-		break;
-	case 2:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 2;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j] = 0;
-		);
-		break;
-	case 4:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 4;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 8:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 8;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 16:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 16], 0, 16);
-		);
-		break;
-	case 32:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 32], 0, 32);
-		);
-		break;
-	default:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * expand], 0, expand);
-		);
-		break;
-	}
-
-#undef RT_FOR_EACH_BIT_SET
+	qrtk_merge(arena, rt->arena, rt->slots / 8, expand);
 }
 
 /**
@@ -4167,7 +4311,6 @@ qrt_apply_patch8(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
-	int i;
 
 	g_assert(qrcv->table != NULL);
 
@@ -4184,9 +4327,8 @@ qrt_apply_patch8(struct qrt_receive *qrcv, const uchar *data, int len,
 
 	g_assert(qrcv->current_index + len <= rt->slots);
 
-	for (i = 0; i < len; i++) {
-		qrt_patch_slot(rt, qrcv->current_index++, data[i]);
-	}
+	rt->set_count += qrtk_patch8(rt->arena, qrcv->current_index, data, len);
+	qrcv->current_index += len;
 	qrcv->current_slot = qrcv->current_index - 1;
 
 	return TRUE;
@@ -4208,7 +4350,6 @@ qrt_apply_patch4(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
-	int i;
 
 	g_assert(qrcv->table != NULL);
 
@@ -4225,18 +4366,13 @@ qrt_apply_patch4(struct qrt_receive *qrcv, const uchar *data, int len,
 
 	g_assert(qrcv->current_index + len * 2 <= rt->slots);
 
-	for (i = 0; i < len; i++) {
-		uint8 v = data[i];	/* Patch byte contains 2 slots */
-
-		/*
-		 * Quartets are processed in big-endian way (highest nybble is
-		 * for the lowest table index).
-		 */
-
-		qrt_patch_slot(rt, qrcv->current_index++, v & 0xf0);
-		qrt_patch_slot(rt, qrcv->current_index++, (v << 4) & 0xf0);
+	/*
+	 * Each patch byte contains 2 slots.  Quartets are processed in
+	 * big-endian way (highest nybble is for the lowest table index).
+	 */
 
-	}
+	rt->set_count += qrtk_patch4(rt->arena, qrcv->current_index, data, len);
+	qrcv->current_index += len * 2;
 	qrcv->current_slot = qrcv->current_index - 1;
 
 	return TRUE;
@@ -4257,7 +4393,6 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
-	int i;
 
 	g_assert(qrcv->table != NULL);
 
@@ -4274,17 +4409,15 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 
 	g_assert(qrcv->current_index + len * 8 <= rt->slots);
 
-	for (i = 0; i < len; i++) {
-		/*
-		 * Bits are processed in big-endian way.
-		 *
-		 * A non-zero bit means the current entry in the QRT needs to be
-		 * flipped, a zero bit means we need to keep it as-is.
-		 */
+	/*
+	 * Bits are processed in big-endian way.
+	 *
+	 * A non-zero bit means the current entry in the QRT needs to be
+	 * flipped, a zero bit means we need to keep it as-is.
+	 */
 
-		rt->arena[i >> 3] ^= data[i];
-		rt->set_count += bits_set(rt->arena[i >> 3]);
-	}
+	rt->set_count +=
+		qrtk_patch1(rt->arena, qrcv->current_index, data, len, FALSE);
 
 	qrcv->current_index += len * 8;
 	qrcv->current_slot = qrcv->current_index;
@@ -4308,7 +4441,6 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
-	int i;
 
 	g_assert(qrcv->table != NULL);
 
@@ -4325,17 +4457,15 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 
 	g_assert(qrcv->current_index + len * 8 <= rt->slots);
 
-	for (i = 0; i < len; i++) {
-		/*
-		 * Bits are processed in little-endian way (since patch is "reversed").
-		 *
-		 * A non-zero bit means the current entry in the QRT needs to be
-		 * flipped, a zero bit means we need to keep it as-is.
-		 */
+	/*
+	 * Bits are processed in little-endian way (since patch is "reversed").
+	 *
+	 * A non-zero bit means the current entry in the QRT needs to be
+	 * flipped, a zero bit means we need to keep it as-is.
+	 */
 
-		rt->arena[i >> 3] ^= reverse_byte(data[i]);
-		rt->set_count += bits_set(rt->arena[i >> 3]);
-	}
+	rt->set_count +=
+		qrtk_patch1(rt->arena, qrcv->current_index, data, len, TRUE);
 
 	qrcv->current_index += len * 8;
 	qrcv->current_slot = qrcv->current_index;
@@ -4946,6 +5076,8 @@ qrt_handle_patch(
 			rt->is_empty = FALSE;
 		}
 
+		qrt_matrix_update(rt);
+
 		/*
 		 * Install the table in the node, if it was a new table.
 		 * Otherwise, we only finished patching it.
@@ -5111,6 +5243,7 @@ qrp_close(void)
 	if (merged_table)
 		qrt_unref(merged_table);
 
+	qrt_matrix_close();
 	HFREE_NULL(buffer.arena);
 }
 
@@ -5433,6 +5566,7 @@ qrt_build_query_target(
 	const pslist_t *sl;
 	bool sha1_query;
 	bool whats_new;
+	bool batched;
 
 	g_assert(qhvec != NULL);
 	g_assert(hops >= 0);
@@ -5457,6 +5591,17 @@ qrt_build_query_target(
 
 	sha1_query = qhvec_has_urn(qhvec);
 
+	/*
+	 * Probe all the tables present in the routing matrix at once, the
+	 * other tables being probed individually as we loop over the nodes.
+	 * "What's New?" queries are not routed through QRP.
+	 */
+
+	batched = GNET_PROPERTY(qrp_batched_routing) && !whats_new;
+
+	if (batched)
+		qrt_matrix_route(qhvec);
+
 	/*
 	 * We need to special case processing of queries with TTL=1 so that they
 	 * get set to ultra peers that support last-hop QRP only if they can
@@ -5532,10 +5677,14 @@ qrt_build_query_target(
 
 		node_inc_qrp_query(dn);			/* We have a QRT, mark we try routing */
 
-		if (!(qhvec->has_urn ?
+		if (batched && rt->in_matrix) {
+			if (!qrt_matrix_can_route(rt))
+				continue;
+		} else if (!(qhvec->has_urn ?
 			  rt->can_route_urn(qhvec, rt) :
-			  rt->can_route(qhvec, rt)))
+			  rt->can_route(qhvec, rt))) {
 			continue;
+		}
 
 		if (!is_leaf)
 			goto can_send;			/* Avoid indentation of remaining code */
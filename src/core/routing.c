@@ -49,6 +49,7 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/aging.h"
+#include "lib/array_util.h"
 #include "lib/atoms.h"
 #include "lib/endian.h"
 #include "lib/halloc.h"
@@ -56,6 +57,7 @@
 #include "lib/host_addr.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
@@ -97,25 +99,53 @@ routing_udp_node_check(const struct routing_udp_node * const un)
 
 #define ROUTE_UDP_LIFETIME	180		/**< Keep UDP routes for 3 minutes */
 
+/**
+ * A route, when the message was seen from several nodes.
+ */
+struct route_ref {
+	struct route_data *rd;		/**< Route from where the message came */
+	uint8 ttl;					/**< TTL of message seen along that route */
+};
+
+#define ROUTE_GEN_BITS	24		/**< Width of the generation in entries */
+#define ROUTE_GEN_MAX	((1U << ROUTE_GEN_BITS) - 1)
+
 /**
  * An entry in the routing table.
  *
- * Each entry is stored in the "message_array[]", to keep track of the
- * order used to create the routes, and in a hash table for quick lookup,
- * hashing being made based on the muid and the function.
+ * Entries are directly held in the slots of an open-addressed hash table,
+ * keyed on the muid and the function.  Each entry records the generation
+ * during which it was created or last used: entries belonging to a
+ * generation older than the oldest live one are expired, and are reclaimed
+ * lazily.
+ *
+ * Most messages are seen from a single node: that route is kept in the
+ * entry, along with the TTL seen along it.  Messages seen from more nodes
+ * have their routes in an array, whose capacity is the power of 2 holding
+ * them.  On 64-bit machines, an entry takes 32 bytes.
+ *
+ * The table is grown when 3/4 full and shrunk when less than 1/4 of it is
+ * live, hence a message seen from one node costs 43 to 128 bytes, and 32
+ * more bytes from two nodes: 64 and 96 bytes at half load.  The former
+ * walloc()ed entry, its chunk pointer, its hash set slot and two pslist_t
+ * cells per route cost about 112 bytes for a message seen from one node,
+ * and 144 bytes from two nodes.
  *
  * Query hit routes and push routes are precious, therefore they are
- * moved to the tail of the "message_array[]" when they get used to increase
- * their liftime.
+ * moved to the current generation when they get used to increase their
+ * lifetime.
  */
 struct message {
 	struct guid muid;			/**< Message UID */
-	struct message **slot;		/**< Place where we're referenced from */
-	pslist_t *routes;            /**< route_data from where the message came */
-	pslist_t *ttls;			/**< For broadcasted messages: TTL by route */
+	uint32 gen:ROUTE_GEN_BITS;	/**< Generation of entry, 0 if slot free */
+	uint32 route_ttl:8;			/**< TTL seen along the single route */
+	uint16 nroutes;				/**< Amount of routes recorded */
 	uint8 function;				/**< Type of the message */
 	uint8 ttl;					/**< Max TTL we saw for this message */
-	uint8 chunk_idx;			/**< Index of chunk holding the slot */
+	union {
+		struct route_data *rd;	/**< The route, when there is only one */
+		struct route_ref *refs;	/**< The routes, when there are several */
+	} route;
 };
 
 /**
@@ -145,8 +175,8 @@ static const char *debug_msg[256];
  * We're using the message table to store Query hit routes for Push requests,
  * but this is a temporary solution.  As we continuously refresh those
  * routes, we must make sure they stay alive for some time after having been
- * updated.  Given that we periodically supersede the message_array[] in a
- * round-robin fashion, it is not really appropriate.
+ * updated.  Given that we periodically expire the oldest generation of the
+ * routing table, it is not really appropriate.
  *		--RAM, 06/01/2002
  */
 #define QUERY_HIT_ROUTE_SAVE	0	/**< Function used to store QHit GUIDs */
@@ -154,34 +184,39 @@ static const char *debug_msg[256];
 /*
  * Routing table data structures.
  *
- * This is known as the "message_array[]".  It used to be a fixed-sized
- * array, but it is no more.  Instead, we use an array of chunks that
- * are dynamically allocated as needed.  The aim is to not cycle
- * back to the beginning of the table, loosing all the routing information
- * before at least TABLE_MIN_CYCLE seconds have elapsed or we have
- * allocated more than the amount of chunks we can tolerate.
+ * Messages are stored in an open-addressed hash table using linear probing,
+ * whose slots are the message entries themselves.
+ *
+ * To age the table, new entries are tagged with the current generation,
+ * which changes each time GEN_MESSAGES entries have been stored.  The aim
+ * is to not expire routing information before at least TABLE_MIN_CYCLE
+ * seconds have elapsed or we have more than MAX_GENERATIONS live generations.
  *
- * Each chunk contains pointers to dynamically allocated message entries,
- * each pointer being called a "slot" whilst the message structure is called
- * the "entry".
+ * Expiring the oldest generation is a constant-time operation: we merely
+ * move the lower bound of live generations.  The slots of expired entries
+ * are reclaimed when new entries are inserted over them, by a sweeping
+ * pass done incrementally at each insertion, or when the table is resized.
  */
 
-#define CHUNK_BITS			14 	  /**< log2 of # messages stored  in a chunk */
-#define MAX_CHUNKS			64	  /**< Max # of chunks */
-#define TABLE_MIN_CYCLE		3600  /**< 1 hour at least */
+#define GEN_MESSAGES		(1 << 14)	/**< # messages per generation */
+#define MAX_GENERATIONS		64			/**< Max # of live generations */
+#define TABLE_MIN_CYCLE		3600		/**< 1 hour at least */
+#define TABLE_MIN_SLOTS		(1 << 14)	/**< Minimum amount of slots */
+#define TABLE_SWEEP_STEP	4			/**< Slots swept per insertion */
 
-#define CHUNK_MESSAGES		(1 << CHUNK_BITS)
-#define CHUNK_INDEX(x)		(((x) & ~(CHUNK_MESSAGES - 1)) >> CHUNK_BITS)
-#define ENTRY_INDEX(x)		((x) & (CHUNK_MESSAGES - 1))
+#define GEN_INDEX(g)		((g) % MAX_GENERATIONS)
 
 static struct {
-	struct message **chunks[MAX_CHUNKS];
-	int next_idx;				 /**< Next slot to use in "message_array[]" */
-	int capacity;				 /**< Capacity in terms of messages */
-	int count;					 /**< Amount really stored */
-	unsigned nchunks;			 /**< Amount of allocated chunks */
-	hset_t *messages_hashed;	 /**< All messages (key = struct message) */
-	time_t last_rotation;		 /**< Last time we restarted from idx=0 */
+	struct message *slots;		/**< The open-addressed table */
+	size_t capacity;			/**< Amount of slots, a power of 2 */
+	size_t used;				/**< Used slots, including expired entries */
+	size_t count;				/**< Live entries */
+	size_t sweep;				/**< Index of next slot to sweep */
+	uint32 gen;					/**< Current generation */
+	uint32 oldest;				/**< Oldest live generation */
+	uint32 gen_stored;			/**< Entries stored in current generation */
+	uint32 gen_count[MAX_GENERATIONS];	/**< Live entries per generation */
+	time_t gen_start[MAX_GENERATIONS];	/**< Start time of each generation */
 } routing;
 
 /**
@@ -827,262 +862,398 @@ init_routing_data(gnutella_node_t *node)
 }
 
 /**
- * Make sure slot belongs to specified chunk index.
+ * @return the capacity of the route array holding ``n'' routes.
  */
-static void
-slot_check(struct message * const * const slot, unsigned chunk_idx)
+static inline uint
+message_route_capacity(uint n)
+{
+	g_assert(n > 1);
+
+	return next_pow2(n);
+}
+
+/**
+ * @return the route at index ``i'' in the message entry.
+ */
+static inline struct route_data *
+message_route(const struct message *m, uint i)
 {
-	const void *chunk_base;
-	const void *chunk_end;
+	g_assert(i < m->nroutes);
 
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk_idx < routing.nchunks);
+	return 1 == m->nroutes ? m->route.rd : m->route.refs[i].rd;
+}
 
-	chunk_base = routing.chunks[chunk_idx];
-	chunk_end = const_ptr_add_offset(chunk_base, CHUNK_MESSAGES * sizeof *slot);
+/**
+ * @return the TTL seen along the route at index ``i''.
+ */
+static inline uint8
+message_route_ttl(const struct message *m, uint i)
+{
+	g_assert(i < m->nroutes);
 
-	g_assert(ptr_cmp(slot, chunk_base) >= 0);
-	g_assert(ptr_cmp(slot, chunk_end) < 0);
+	return 1 == m->nroutes ? m->route_ttl : m->route.refs[i].ttl;
 }
 
 /**
- * Asserts that a message entry is consistent and belongs to the correct chunk.
+ * Set route at index ``i'' in the message entry.
  */
 static void
-message_check(const struct message * const m, unsigned chunk_idx)
+message_route_set(struct message *m, uint i, struct route_data *rd, uint8 ttl)
 {
-	g_assert(m != NULL);
-	slot_check(m->slot, chunk_idx);
-	g_assert(chunk_idx == m->chunk_idx);
+	g_assert(i < m->nroutes);
+
+	if (1 == m->nroutes) {
+		m->route.rd = rd;
+		m->route_ttl = ttl;
+	} else {
+		struct route_ref *ref = &m->route.refs[i];
+
+		ref->rd = rd;
+		ref->ttl = ttl;
+	}
 }
 
 /**
- * Asserts that a message entry is consistent and belongs to the correct chunk.
+ * Append new route to the message entry.
  *
- * The "chunk" parameter points to the old chunk address and is used to
- * properly validate the m->slot value (before our caller can update it
- * to reflect the new chunk location).
+ * @param m		the message entry
+ * @param rd	the route from which the message came
+ * @param ttl	the TTL of the message along that route
  */
 static void
-message_check_chunk(const struct message * const m, unsigned chunk_idx,
-	struct message * const *chunk)
+message_route_append(struct message *m, struct route_data *rd, uint8 ttl)
 {
-	const void *chunk_end;
+	g_assert(m->nroutes < MAX_INT_VAL(uint16));
 
-	g_assert(m != NULL);
-	g_assert(chunk_idx == m->chunk_idx);
-
-	/*
-	 * Expand a variant of slot_check() since routing.chunks[chunk_idx]
-	 * has been re-allocated and the old chunk address is given.
-	 */
+	if (1 == m->nroutes) {
+		struct route_ref *refs;
 
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk_idx < routing.nchunks);
+		WALLOC_ARRAY(refs, message_route_capacity(2));
+		refs[0].rd = m->route.rd;
+		refs[0].ttl = m->route_ttl;
+		m->route.refs = refs;
+		m->route_ttl = 0;
+	} else if (m->nroutes > 1) {
+		uint cap = message_route_capacity(m->nroutes);
+		uint ncap = message_route_capacity(m->nroutes + 1);
 
-	chunk_end = const_ptr_add_offset(chunk, CHUNK_MESSAGES * sizeof m);
+		if (ncap != cap)
+			WREALLOC_ARRAY(m->route.refs, cap, ncap);
+	}
 
-	g_assert(ptr_cmp(m->slot, chunk) >= 0);
-	g_assert(ptr_cmp(m->slot, chunk_end) < 0);
+	m->nroutes++;
+	message_route_set(m, m->nroutes - 1, rd, ttl);
 }
 
 /**
- * Clean already allocated entry.
+ * Remove route at index ``i'' from the message entry, keeping the order
+ * of the remaining routes.
  */
 static void
-clean_entry(struct message *entry)
+message_route_remove(struct message *m, uint i)
 {
-	g_assert(entry != NULL);
+	g_assert(i < m->nroutes);
 
-	hset_remove(routing.messages_hashed, entry);
+	if (1 == m->nroutes) {
+		m->route.rd = NULL;
+		m->route_ttl = 0;
+	} else {
+		struct route_ref *refs = m->route.refs;
+		uint cap = message_route_capacity(m->nroutes);
 
-	if (entry->routes != NULL)
-		free_route_list(entry);
+		ARRAY_REMOVE(refs, i, m->nroutes);
 
-	g_assert(entry->ttls == NULL);		/* Cleaned by free_route_list() */
-	g_assert(entry->routes == NULL);	/* Idem */
+		if (2 == m->nroutes) {
+			m->route.rd = refs[0].rd;
+			m->route_ttl = refs[0].ttl;
+			WFREE_ARRAY(refs, cap);
+		} else {
+			uint ncap = message_route_capacity(m->nroutes - 1);
 
-	entry->ttl = 0;
+			if (ncap != cap)
+				WREALLOC_ARRAY(m->route.refs, cap, ncap);
+		}
+	}
+
+	m->nroutes--;
+}
+
+/**
+ * Hash message key.
+ */
+static inline size_t
+message_hash(const struct guid *muid, uint8 function)
+{
+	return integer_hash_fast(function) ^ universal_hash(muid, GUID_RAW_SIZE);
+}
+
+/**
+ * @return TRUE if the slot holds a live entry.
+ */
+static inline bool
+message_is_live(const struct message *m)
+{
+	return m->gen >= routing.oldest;	/* Generations start at 1 */
 }
 
 /**
- * Prepare entry, cleaning any old value we can find at the referenced slot.
- * We try to avoid re-allocating something if we can.
+ * @return TRUE if the slot holds an expired entry.
+ */
+static inline bool
+message_is_expired(const struct message *m)
+{
+	return m->gen != 0 && m->gen < routing.oldest;
+}
+
+/**
+ * Update the routing table statistics.
+ */
+static void
+routing_update_stats(void)
+{
+	gnet_stats_set_general(GNR_ROUTING_TABLE_GENERATIONS,
+		routing.gen - routing.oldest + 1);
+	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY, routing.capacity);
+	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT, routing.count);
+}
+
+/**
+ * Store entry in the first free slot of its probing sequence.
  *
- * @return message entry to use
+ * The table must not contain any expired entry.
  */
-static struct message *
-prepare_entry(struct message **entryp, unsigned chunk_idx)
+static void
+routing_table_put(struct message *slots, size_t capacity,
+	const struct message *m)
 {
-	struct message *entry = *entryp;
+	size_t mask = capacity - 1;
+	size_t i = message_hash(&m->muid, m->function) & mask;
 
-	STATIC_ASSERT(MAX_CHUNKS <= MAX_INT_VAL(uint8));
+	while (slots[i].gen != 0)
+		i = (i + 1) & mask;
 
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	slot_check(entryp, chunk_idx);
+	slots[i] = *m;			/* Struct copy */
+}
 
-	if (entry == NULL) {
-		WALLOC0(entry);
-		*entryp = entry;
-		entry->slot = entryp;
-		entry->chunk_idx = chunk_idx;	/* 8-bit value, must fit */
-		routing.count++;
-		gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
-		goto done;
-	}
+/**
+ * Resize the routing table so that live entries fill at most half of it,
+ * dropping all the expired entries.
+ */
+static void
+routing_table_resize(void)
+{
+	struct message *slots;
+	size_t capacity = TABLE_MIN_SLOTS, i;
 
-	/*
-	 * We cycled over the table, remove the message at the slot we're
-	 * going to supersede.  We don't need to allocate anything, we'll
-	 * reuse the old structure, which will be rehashed after being updated.
-	 */
+	while (capacity < 2 * (routing.count + 1))
+		capacity *= 2;
 
-	clean_entry(entry);
+	slots = halloc0(capacity * sizeof slots[0]);
 
-	/*
-	 * Attempt to move the object around if it can help compacting.
-	 */
+	for (i = 0; i < routing.capacity; i++) {
+		struct message *m = &routing.slots[i];
 
-	{
-		struct message *nentry = WMOVE(entry);
+		if (message_is_live(m))
+			routing_table_put(slots, capacity, m);
+		else if (message_is_expired(m))
+			free_route_list(m);
+	}
 
-		if (nentry != entry)
-			entry = *entryp = nentry;
+	if (GNET_PROPERTY(routing_debug)) {
+		g_debug("RT resized table from %zu to %zu slots, "
+			"holds %zu live entries (%zu expired dropped)",
+			routing.capacity, capacity, routing.count,
+			routing.used - routing.count);
 	}
 
-done:
-	g_assert(entryp == entry->slot);
-	message_check(entry, chunk_idx);
+	HFREE_NULL(routing.slots);
+	routing.slots = slots;
+	routing.capacity = capacity;
+	routing.used = routing.count;
+	routing.sweep = 0;
 
-	return entry;
+	routing_update_stats();
 }
 
 /**
- * Attempt to reallocate an already allocated chunk to see if the VMM layer
- * can relocate a fragment.
+ * Free the slot at index ``i'', shifting back the entries that follow in
+ * the same cluster so that no probing sequence is broken.
  */
-static struct message **
-routing_chunk_move(struct message **chunk, unsigned chunk_idx)
+static void
+routing_table_delete(size_t i)
 {
-	struct message **nchunk;
-	struct message **p;
-	unsigned i;
+	size_t mask = routing.capacity - 1;
+	size_t j = i;
 
-	g_assert(chunk != NULL);
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk == routing.chunks[chunk_idx]);
+	g_assert(routing.slots[i].gen != 0);
+	g_assert(0 == routing.slots[i].nroutes);
 
-	nchunk = hrealloc(chunk, CHUNK_MESSAGES * sizeof(struct message *));
-	if (nchunk == chunk)
-		return chunk;
+	for (;;) {
+		struct message *m;
+		size_t home;
 
-	/*
-	 * VMM layer chose to relocate the chunk, update all the entries.
-	 */
+		j = (j + 1) & mask;
+		m = &routing.slots[j];
 
-	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT moving chunk #%u from %p to %p",
-			chunk_idx, (void *) chunk, (void *) nchunk);
-	}
+		if (0 == m->gen)
+			break;
+
+		/*
+		 * The entry at ``j'' can stay where it is if its home slot lies
+		 * cyclically within (i, j].
+		 */
 
-	for (p = &nchunk[0], i = 0; i < CHUNK_MESSAGES; i++, p++) {
-		struct message *m = *p;
+		home = message_hash(&m->muid, m->function) & mask;
 
-		if (m != NULL) {
-			message_check_chunk(m, chunk_idx, chunk);
-			m->slot = p;
-		}
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		routing.slots[i] = *m;		/* Struct copy */
+		i = j;
 	}
 
-	return routing.chunks[chunk_idx] = nchunk;
+	ZERO(&routing.slots[i]);
+	routing.used--;
 }
 
 /**
- * Try to move the chunks we have, since the lowest indices
- * (which are going to be the more permanent chunks) will be
- * better hosted in the early VM space, freeing up the upper
- * VM space for more volatile data and possibly defragmenting.
+ * Incrementally reclaim expired entries, looking at no more than ``n'' slots.
  */
 static void
-routing_chunk_move_attempt(void)
+routing_table_sweep(size_t n)
 {
-	size_t i;
+	while (n-- != 0 && routing.used > routing.count) {
+		size_t i = routing.sweep;
+		struct message *m = &routing.slots[i];
+
+		/*
+		 * After freeing an expired entry, the slot can hold an entry that
+		 * was shifted back, hence we do not move the sweeping index.
+		 */
 
-	for (i = 0; i < routing.nchunks; i++) {
-		routing.chunks[i] = routing_chunk_move(routing.chunks[i], i);
+		if (message_is_expired(m)) {
+			free_route_list(m);
+			routing_table_delete(i);
+		} else {
+			routing.sweep = (i + 1) & (routing.capacity - 1);
+		}
 	}
 }
 
 /**
- * Advance slot index so that a call to get_next_slot() will return the
- * next available slot.
+ * Expire the oldest live generation.
  */
 static void
-advance_slot(void)
+routing_expire_oldest(void)
 {
-	/*
-	 * It's OK to go beyond the last allocated chunk (a new chunk will
-	 * be allocated next time) unless we already reached the last chunk.
-	 */
+	uint idx = GEN_INDEX(routing.oldest);
 
-	routing.next_idx++;
+	g_assert(routing.oldest < routing.gen);
+	g_assert(routing.gen_count[idx] <= routing.count);
 
-	if (CHUNK_INDEX(routing.next_idx) >= MAX_CHUNKS)
-		routing.next_idx = 0;		/* Will force cycling over next time */
+	routing.count -= routing.gen_count[idx];
+	routing.gen_count[idx] = 0;
+	routing.oldest++;
 }
 
 /**
- * Clear routing table, starting with specified chunk index.
+ * Renumber the generations before they overflow the generation field of
+ * the entries, which only happens after 2^24 generations.
  *
- * @param idx	the index of the first chunk to clear
+ * Generations are shifted by a multiple of MAX_GENERATIONS, so that their
+ * statistics remain at the same index.
  */
 static void
-routing_clear(unsigned idx)
+routing_rebase_generations(void)
 {
+	uint32 shift;
 	size_t i;
 
-	for (i = idx; i < routing.nchunks; i++) {
-		struct message **rchunk = routing.chunks[i];
-		size_t j;
+	routing_table_resize();		/* Drops all the expired entries */
 
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT freeing chunk #%zu at %p, now holds %d / %d",
-				i, (void *) rchunk, routing.count, routing.capacity);
-		}
+	shift = (routing.oldest - 1) / MAX_GENERATIONS * MAX_GENERATIONS;
 
-		for (j = 0; j < CHUNK_MESSAGES; j++) {
-			struct message *m = rchunk[j];
+	for (i = 0; i < routing.capacity; i++) {
+		struct message *m = &routing.slots[i];
 
-			if (m != NULL) {
-				message_check(m, i);
-				g_assert(m->slot == &rchunk[j]);
-				clean_entry(m);
-				WFREE(m);
-				routing.count--;
-			}
+		if (m->gen != 0)
+			m->gen -= shift;
+	}
+
+	routing.gen -= shift;
+	routing.oldest -= shift;
+
+	if (GNET_PROPERTY(routing_debug)) {
+		g_debug("RT renumbered generations, now #%u to #%u",
+			routing.oldest, routing.gen);
+	}
+}
+
+/**
+ * Start a new generation, expiring older ones as needed.
+ */
+static void
+routing_new_generation(void)
+{
+	time_t now = tm_time();
+	uint idx;
+
+	/*
+	 * We expire generations whose entries were all stored more than
+	 * TABLE_MIN_CYCLE seconds ago, i.e. whose successor started that long
+	 * ago, and also the oldest one if we reached MAX_GENERATIONS.
+	 */
+
+	while (
+		routing.oldest < routing.gen &&
+		delta_time(now, routing.gen_start[GEN_INDEX(routing.oldest + 1)])
+			> TABLE_MIN_CYCLE
+	) {
+		if (GNET_PROPERTY(routing_debug)) {
+			g_debug("RT expiring generation #%u (%u entries), holds %zu / %zu",
+				routing.oldest, routing.gen_count[GEN_INDEX(routing.oldest)],
+				routing.count, routing.capacity);
 		}
+		routing_expire_oldest();
+	}
 
-		routing.capacity -= CHUNK_MESSAGES;
-		HFREE_NULL(routing.chunks[i]);
+	if (routing.gen - routing.oldest + 1 >= MAX_GENERATIONS) {
+		if (GNET_PROPERTY(routing_debug)) {
+			g_warning("RT expiring generation #%u FORCED, elapsed=%u, "
+				"holds %zu / %zu", routing.oldest,
+				(unsigned) delta_time(now,
+					routing.gen_start[GEN_INDEX(routing.oldest)]),
+				routing.count, routing.capacity);
+		}
+		routing_expire_oldest();
 	}
 
-	routing.nchunks = idx;
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CHUNKS, routing.nchunks);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY, routing.capacity);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT, routing.count);
+	if G_UNLIKELY(routing.gen >= ROUTE_GEN_MAX)
+		routing_rebase_generations();
+
+	routing.gen++;
+	routing.gen_stored = 0;
 
-	g_assert(uint_is_non_negative(routing.nchunks));
+	idx = GEN_INDEX(routing.gen);
+	routing.gen_count[idx] = 0;
+	routing.gen_start[idx] = now;
+
+	if (GNET_PROPERTY(routing_debug)) {
+		g_debug("RT starting generation #%u, holds %zu / %zu",
+			routing.gen, routing.count, routing.capacity);
+	}
 
 	/*
-	 * After freeing chunks, we may be able to move around some of the
-	 * remaining ones.
+	 * If we expired many entries, shrink the table.
 	 */
 
-	routing_chunk_move_attempt();
+	if (
+		routing.capacity > TABLE_MIN_SLOTS &&
+		routing.count < routing.capacity / 4
+	)
+		routing_table_resize();
+
+	routing_update_stats();
 }
 
 /**
@@ -1092,202 +1263,101 @@ void
 routing_clear_all(void)
 {
 	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT clearing whole table (holds %d / %d)",
-			routing.capacity, routing.count);
+		g_debug("RT clearing whole table (holds %zu / %zu)",
+			routing.count, routing.capacity);
 	}
 
-	routing_clear(0);
-	routing.next_idx = 0;
-	routing.last_rotation = tm_time();
-	hset_clear(routing.messages_hashed);	/* Paranoid */
+	/*
+	 * Expire all the generations by starting a fresh one: the resizing
+	 * of the table will then reclaim all the entries.
+	 */
+
+	if G_UNLIKELY(routing.gen >= ROUTE_GEN_MAX)
+		routing_rebase_generations();
+
+	routing.count = 0;
+	routing.gen++;
+	routing.oldest = routing.gen;
+	routing.gen_stored = 0;
+	ZERO(&routing.gen_count);
+	routing.gen_start[GEN_INDEX(routing.gen)] = tm_time();
+
+	routing_table_resize();		/* Back to minimal size, all slots free */
 }
 
 /**
- * Fetch next routing table slot, a pointer to a routing entry.
- *
- * When `advance' is FALSE, the slot is allocated as usual but there is
- * no increment of the slot index for next time.  This allows trial allocation
- * to see where the message will be allocated.  If the slot is kept, the
- * caller must call advance_slot().
+ * Allocate a new entry in the routing table for the message.
  *
- * When `advance' is TRUE, the slot is allocated and the slot index is
- * incremented immediately.
+ * The message must not already be present in the table, and the returned
+ * entry has no route.
  *
- * @param advance		whether to advance the slot index
- * @param cidx			if non-NULL, filled with the chunk index where slot is
- *
- * @return the address of the allocated slot.
+ * @attention
+ * Entries may be moved around in the table by this routine.
  */
-static struct message **
-get_next_slot(bool advance, unsigned *cidx)
+static struct message *
+routing_table_insert(const struct guid *muid, uint8 function)
 {
-	unsigned idx;
-	unsigned chunk_idx;
-	struct message **chunk;
-	struct message **slot = NULL;
-	time_t now = tm_time();
-	time_delta_t elapsed = delta_time(now, routing.last_rotation);
-
-	idx = routing.next_idx;
-	chunk_idx = CHUNK_INDEX(idx);
+	struct message *m;
+	size_t mask, i;
+	uint idx;
 
-	g_assert(UNSIGNED(chunk_idx) < MAX_CHUNKS);
+	if G_UNLIKELY(routing.gen_stored >= GEN_MESSAGES)
+		routing_new_generation();
 
-	chunk = routing.chunks[chunk_idx];
+	routing_table_sweep(TABLE_SWEEP_STEP);
 
-	/*
-	 * If we get back here with a next index of zero and the chunk is
-	 * allocated, it means we've naturally cycled over.  There is nothing
-	 * to free up (or we would discard the whole table).
-	 */
+	if G_UNLIKELY(4 * (routing.used + 1) > 3 * routing.capacity)
+		routing_table_resize();
 
-	if G_UNLIKELY(0 == idx && NULL != chunk) {
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT cycled naturally over table, elapsed=%u, holds %d / %d",
-				(unsigned) elapsed, routing.count, routing.capacity);
-		}
-		routing.last_rotation = now;	/* Just cycled over */
-		elapsed = 0;
-	}
+	mask = routing.capacity - 1;
+	i = message_hash(muid, function) & mask;
 
 	/*
-	 * If we've taken more than TABLE_MIN_CYCLE seconds since the last
-	 * rotation and reach the start of an allocated chunk, it means we
-	 * have more chunks than we need.  Discard all remaining chunks before
-	 * rotating.
+	 * Stop at the first free slot or at the first expired entry, which we
+	 * can reuse.
 	 */
 
-	if G_UNLIKELY(elapsed > TABLE_MIN_CYCLE) {
-		/*
-		 * 0 != ENTRY_INDEX(idx): means we're not at the start of a chunk.
-		 * chunk == NULL: means we've reached an empty chunk, nothing to free.
-		 */
-
-		if G_UNLIKELY(chunk != NULL && 0 == ENTRY_INDEX(idx)) {
-			routing_clear(chunk_idx);
-			chunk = NULL;
-		}
-	}
-
-	if (chunk == NULL) {
-
-		g_assert(idx >= UNSIGNED(routing.capacity));
-
-		/*
-		 * Chunk does not exist yet, determine whether we should create
-		 * it or recycle the table by going back to the start.
-		 */
-
-		if (idx > 0 && elapsed > TABLE_MIN_CYCLE) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT cycling over table, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
+	for (;;) {
+		m = &routing.slots[i];
 
-			chunk_idx = 0;
-			idx = routing.next_idx = 0;
-			routing.last_rotation = now;
-			slot = routing.chunks[0];
-		} else {
-			/*
-			 * Allocate new chunk, expanding the capacity of the table.
-			 */
-
-			g_assert(idx == 0 || chunk_idx > 0);
-			g_assert(chunk_idx == routing.nchunks);
-
-			routing_chunk_move_attempt();		/* Compact before allocating */
-
-			routing.nchunks++;
-			routing.capacity += CHUNK_MESSAGES;
-			routing.chunks[chunk_idx] =
-				halloc0(CHUNK_MESSAGES * sizeof(struct message *));
-
-			gnet_stats_inc_general(GNR_ROUTING_TABLE_CHUNKS);
-			gnet_stats_count_general(GNR_ROUTING_TABLE_CAPACITY,
-				CHUNK_MESSAGES);
-
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT created new chunk #%d at %p, now holds %d / %d",
-					chunk_idx, (void *) routing.chunks[chunk_idx],
-					routing.count, routing.capacity);
-			}
-
-			slot = routing.chunks[chunk_idx];	/* First slot in new chunk */
+		if (0 == m->gen) {
+			routing.used++;
+			break;
 		}
-	} else {
-		unsigned entry_idx = ENTRY_INDEX(idx);
-
-		/*
-		 * Each time we move to a new chunk, see whether we can move some
-		 * of the existing ones around to compact the VM space.
-		 */
 
-		if (0 == entry_idx) {
-			routing_chunk_move_attempt();
-			chunk = routing.chunks[chunk_idx];	/* In case it moved */
+		if (message_is_expired(m)) {
+			free_route_list(m);
+			break;
 		}
 
-		/*
-		 * If we went back to the first index without allocating a chunk,
-		 * it means we finally cycled over the table, in a forced way,
-		 * because we have already allocated the maximum amount of chunks.
-		 */
-
-		if (0 == idx && MAX_CHUNKS == routing.nchunks) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_warning("RT cycling over FORCED, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
-			routing.last_rotation = now;
-		}
+		g_assert(m->function != function || !guid_eq(&m->muid, muid));
 
-		slot = &chunk[entry_idx];
+		i = (i + 1) & mask;
 	}
 
-	g_assert(slot != NULL);
-	g_assert(idx == UNSIGNED(routing.next_idx));
-	g_assert(idx < UNSIGNED(routing.capacity));
-	g_assert(routing.nchunks <= MAX_CHUNKS);
+	ZERO(m);
+	m->muid = *muid;
+	m->function = function;
+	m->gen = routing.gen;
 
-	if (advance)
-		advance_slot();
+	idx = GEN_INDEX(routing.gen);
+	routing.gen_count[idx]++;
+	routing.gen_stored++;
+	routing.count++;
 
-	if (cidx != NULL)
-		*cidx = chunk_idx;
+	gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
 
-	slot_check(slot, chunk_idx);
-
-	return slot;
-}
-
-/**
- * Fetch next routing table entry to be able to store routing information.
- */
-static struct message *
-get_next_entry(void)
-{
-	struct message **slot;
-	unsigned chunk_idx;
-
-	slot = get_next_slot(TRUE, &chunk_idx);
-	return prepare_entry(slot, chunk_idx);
+	return m;
 }
 
 /**
  * When a precious route (for query hit or push) is used, revitalize the
- * entry by moving it to the end of the "message_array[]", thereby making
- * it unlikely that it expires soon.
- *
- * @return the new location of the revitalized entry
+ * entry by moving it to the current generation, thereby making it unlikely
+ * that it expires soon.
  */
 static void
 revitalize_entry(struct message *entry, bool force)
 {
-	struct message **relocated;
-	struct message *prev;
-	unsigned chunk_idx;
-
 	/*
 	 * Leaves don't route anything, so we usually don't revitalize their
 	 * entries.  The only exception is when it makes use of the recorded
@@ -1297,46 +1367,22 @@ revitalize_entry(struct message *entry, bool force)
 	if (!force && settings_is_leaf())
 		return;
 
-	/*
-	 * Relocate at the end of the table, preventing early expiration.
-	 */
-
-	relocated = get_next_slot(FALSE, &chunk_idx);
-
-	/*
-	 * If slot is allocated in the same chunk, there's no need to revitalize
-	 * since entries in the same chunk will roughly have the same lifetime.
-	 */
+	g_assert(message_is_live(entry));
 
-	if (chunk_idx == entry->chunk_idx)			/* Same chunk being used */
+	if (entry->gen == routing.gen)
 		return;
 
 	/*
-	 * Clean and reclaim new slot content, if present.
-	 */
-
-	advance_slot();							/* Keeping the slot */
-	prev = *relocated;
-
-	if (prev != NULL) {
-		message_check(prev, chunk_idx);
-		g_assert(prev->slot == relocated);
-		clean_entry(prev);
-		WFREE(prev);
-		routing.count--;
-		gnet_stats_dec_general(GNR_ROUTING_TABLE_COUNT);
-	}
-
-	/*
-	 * Move `entry' to this new slot.
+	 * The entry counts as stored in the current generation, so that the
+	 * amount of live entries remains bounded.
 	 */
 
-	*relocated = entry;
-	*(entry->slot) = NULL;					/* Old slot "freed" */
-	entry->slot = relocated;				/* Entry now at new slot */
-	entry->chunk_idx = chunk_idx;			/* Entry moved to new chunk */
+	g_assert(routing.gen_count[GEN_INDEX(entry->gen)] != 0);
 
-	message_check(entry, chunk_idx);
+	routing.gen_count[GEN_INDEX(entry->gen)]--;
+	entry->gen = routing.gen;
+	routing.gen_count[GEN_INDEX(entry->gen)]++;
+	routing.gen_stored++;
 }
 
 /**
@@ -1346,7 +1392,7 @@ static bool
 route_node_sent_message(gnutella_node_t *n, struct message *m)
 {
 	struct route_data *route;
-	pslist_t *sl;
+	uint i;
 
 	if (n == fake_node)
 		route = &fake_route;
@@ -1361,8 +1407,8 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
 	if (route == NULL)
 		return FALSE;
 
-	PSLIST_FOREACH(m->routes, sl) {
-		if (route == sl->data)
+	for (i = 0; i < m->nroutes; i++) {
+		if (route == message_route(m, i))
 			return TRUE;
 	}
 
@@ -1380,9 +1426,8 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
 static bool
 route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 {
-	pslist_t *l;
-	int i;
 	struct route_data *route;
+	uint i;
 
 	g_assert(n != fake_node);
 
@@ -1397,7 +1442,6 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	if (GTA_MSG_G2_SEARCH == m->function)
 		return FALSE;		/* As a G2 leaf, we do not care, it's a dup */
 
-	g_assert(m->ttls != NULL);
 	g_assert(
 		m->function == GTA_MSG_PUSH_REQUEST || m->function == GTA_MSG_SEARCH);
 
@@ -1405,17 +1449,12 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 
 	g_assert(route != NULL);
 
-	for (l = m->routes, i = 0; l; l = pslist_next(l), i++) {
-		if (route == l->data) {
-			pslist_t *t = pslist_nth(m->ttls, i);
-			uint8 old_ttl;
-
-			g_assert(t != NULL);
-			old_ttl = GPOINTER_TO_INT(t->data);
-			if (old_ttl >= ttl)
+	for (i = 0; i < m->nroutes; i++) {
+		if (route == message_route(m, i)) {
+			if (message_route_ttl(m, i) >= ttl)
 				return FALSE;
 
-			t->data = GUINT_TO_POINTER((uint) ttl);
+			message_route_set(m, i, route, ttl);
 			return TRUE;
 		}
 	}
@@ -1424,40 +1463,6 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	return FALSE;
 }
 
-/**
- * compares two message structures
- */
-static int
-message_compare_func(const void *p, const void *q)
-{
-	const struct message *a = p, *b = q;
-
-	return a->function == b->function && guid_eq(&a->muid, &b->muid);
-}
-
-/**
- * Hashes message structures for storage in a hash table.
- */
-static uint
-message_hash_func(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash_fast(msg->function) ^
-		universal_hash(&msg->muid, GUID_RAW_SIZE);
-}
-
-/**
- * Alternate hashing of message structures for storage in a hash table.
- */
-static uint
-message_hash_func2(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
-}
-
 /**
  * Reset this node's GUID.
  */
@@ -1557,9 +1562,9 @@ routing_init(void)
 	 * need to be deallocated
 	 */
 
-	routing.messages_hashed = hset_create_any(message_hash_func,
-		message_hash_func2, message_compare_func);
-	routing.last_rotation = tm_time();
+	routing.gen = routing.oldest = 1;		/* Generation 0 flags free slots */
+	routing.gen_start[GEN_INDEX(routing.gen)] = tm_time();
+	routing_table_resize();
 
 	/*
 	 * Push proxification and starving GUIDs.
@@ -1634,22 +1639,20 @@ remove_one_message_reference(struct route_data *rd)
 static void
 free_route_list(struct message *m)
 {
-	pslist_t *sl;
+	uint i;
 
 	g_assert(m);
 
-	PSLIST_FOREACH(m->routes, sl) {
-		remove_one_message_reference(sl->data);
+	for (i = 0; i < m->nroutes; i++) {
+		remove_one_message_reference(message_route(m, i));
 	}
 
-	pslist_free_null(&m->routes);
+	if (m->nroutes > 1)
+		WFREE_ARRAY(m->route.refs, message_route_capacity(m->nroutes));
 
-	/*
-	 * If the message was a broadcasted one, we kept track of the TTL of
-	 * each message along the route.  This needs to be freed as well.
-	 */
-
-	pslist_free_null(&m->ttls);	/* Data are ints, nothing to free */
+	m->nroutes = 0;
+	m->route.rd = NULL;
+	m->route_ttl = 0;
 }
 
 /**
@@ -1744,14 +1747,8 @@ message_add(const struct guid *muid, uint8 function,
 
 	if (found)			/* Dup message forwarded due to higher TTL */
 		entry = m;		/* Reuse existing entry */
-	else {
-		entry = get_next_entry();
-		g_assert(entry->routes == NULL);
-
-		/* fill in that storage space */
-		entry->muid = *muid;
-		entry->function = function;
-	}
+	else
+		entry = routing_table_insert(muid, function);
 
 	g_assert(route != NULL);
 
@@ -1765,13 +1762,10 @@ message_add(const struct guid *muid, uint8 function,
 	if (!found || !route_node_sent_message(node, m)) {
 		uint ttl;
 
-		route->saved_messages++;
-		entry->routes = pslist_append(entry->routes, route);
-
 		/*
-		 * If message is typically broadcasted, also record the TTL of
-		 * that route, since a node is allowed to resend us a message
-		 * if it comes with a higher TTL than previously seen.
+		 * Also record the TTL of that route, since for typically broadcasted
+		 * messages a node is allowed to resend us a message if it comes with
+		 * a higher TTL than previously seen.
 		 *		--RAM, 2005-10-02
 		 */
 
@@ -1779,12 +1773,8 @@ message_add(const struct guid *muid, uint8 function,
 				? GNET_PROPERTY(my_ttl)
 				: gnutella_header_get_ttl(&node->header);
 
-		switch (function) {
-		case GTA_MSG_PUSH_REQUEST:
-		case GTA_MSG_SEARCH:
-			entry->ttls = pslist_append(entry->ttls, GUINT_TO_POINTER(ttl));
-			break;
-		}
+		route->saved_messages++;
+		message_route_append(entry, route, ttl);
 	}
 
 	if (found)
@@ -1798,9 +1788,6 @@ message_add(const struct guid *muid, uint8 function,
 		entry->ttl = gnutella_header_get_ttl(&node->header);
 	else
 		entry->ttl = GNET_PROPERTY(my_ttl);
-
-	/* insert the new message into the hash table */
-	hset_insert(routing.messages_hashed, entry);
 }
 
 /**
@@ -1810,29 +1797,16 @@ message_add(const struct guid *muid, uint8 function,
 static void
 purge_dangling_references(struct message *m)
 {
-	pslist_t *sl;
-	pslist_t *t;
+	uint i;
 
-	for (sl = m->routes, t = m->ttls; sl; /* empty */) {
-		struct route_data *rd = sl->data;
+	for (i = 0; i < m->nroutes; /* empty */) {
+		struct route_data *rd = message_route(m, i);
 
 		if (rd->node == NULL) {
-			pslist_t *next = pslist_next(sl);
-			m->routes = pslist_remove_link(m->routes, sl);
+			message_route_remove(m, i);
 			remove_one_message_reference(rd);
-			pslist_free_1(sl);
-			sl = next;
-
-			if (t) {
-				next = pslist_next(t);
-				m->ttls = pslist_remove_link(m->ttls, t);
-				pslist_free_1(t);
-				t = next;
-			}
 		} else {
-			sl = pslist_next(sl);
-			if (t)
-				t = pslist_next(t);
+			i++;
 		}
 	}
 }
@@ -1849,9 +1823,8 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 {
 	bool found;
 	struct message *m;
-	pslist_t *sl;
-	pslist_t *t;
 	struct route_data *route;
+	uint i;
 
 	g_assert(muid != NULL);
 	node_check(node);
@@ -1863,17 +1836,11 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 	route = get_routing_data(node);
 	g_return_unless(route != NULL);
 
-	for (
-		sl = m->routes, t = m->ttls;
-		sl != NULL;
-		sl = pslist_next(sl), t = pslist_next(t)
-	) {
-		struct route_data *rd = sl->data;
+	for (i = 0; i < m->nroutes; i++) {
+		struct route_data *rd = message_route(m, i);
 
 		if (route == rd) {
-			m->routes = pslist_remove_link(m->routes, sl);
-			if (t != NULL)
-				m->ttls = pslist_remove_link(m->ttls, t);
+			message_route_remove(m, i);
 			remove_one_message_reference(rd);
 			break;
 		}
@@ -1884,31 +1851,43 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
  * Look for a particular message in the routing tables.
  *
  * If none of the nodes that sent us the message are still present, then
- * m->routes will be NULL.
+ * m->nroutes will be 0.
  *
  * @return TRUE if the message is found.
  */
 static bool
 find_message(const struct guid *muid, uint8 function, struct message **m)
 {
-	struct message dummy;
-	const void *orig_key;
+	size_t mask = routing.capacity - 1;
+	size_t i = message_hash(muid, function) & mask;
 
-	dummy.muid = *muid;
-	dummy.function = function;
+	/*
+	 * The table always has free slots, which end all probing sequences.
+	 * Expired entries are skipped.
+	 */
 
-	if (hset_contains_extended(routing.messages_hashed, &dummy, &orig_key)) {
-		struct message *msg = deconstify_pointer(orig_key);
+	for (;;) {
+		struct message *msg = &routing.slots[i];
 
-		/* wipe out dead references to old nodes */
-		purge_dangling_references(msg);
+		if (0 == msg->gen)
+			break;
 
-		*m = msg;
-		return TRUE;		/* Message was seen */
-	} else {
-		*m = NULL;
-		return FALSE;		/* We don't remember anything about this message */
+		if (
+			msg->function == function && guid_eq(&msg->muid, muid) &&
+			message_is_live(msg)
+		) {
+			/* wipe out dead references to old nodes */
+			purge_dangling_references(msg);
+
+			*m = msg;
+			return TRUE;		/* Message was seen */
+		}
+
+		i = (i + 1) & mask;
 	}
+
+	*m = NULL;
+	return FALSE;		/* We don't remember anything about this message */
 }
 
 /**
@@ -2007,9 +1986,9 @@ route_max_forward_ttl(const gnutella_node_t *sender)
  * The message is not physically sent yet, but the `dest' structure is filled
  * with proper routing information.
  *
- * `routes' is normally NULL unless we're forwarding a PUSH request.  In that
- * case, it must be sent to the whole list of routes we have, and `target' will
- * be NULL.
+ * `m' is normally NULL unless we're forwarding a PUSH request.  In that
+ * case, it must be sent to the whole list of routes we have in the message
+ * entry, and `target' will be NULL.
  *
  * @attention
  * NB: we're just *recording* routing information for the message into `dest',
@@ -2021,11 +2000,11 @@ static bool
 forward_message(
 	struct route_log *route_log,
 	gnutella_node_t **node,
-	gnutella_node_t *target, struct route_dest *dest, pslist_t *routes)
+	gnutella_node_t *target, struct route_dest *dest, const struct message *m)
 {
 	gnutella_node_t *sender = *node;
 
-	g_assert(routes == NULL || target == NULL);
+	g_assert(m == NULL || target == NULL);
 	g_assert(settings_is_ultra());
 
 	/* Drop messages that would travel way too many nodes --RAM */
@@ -2077,19 +2056,19 @@ forward_message(
 	} else {
 		/*
 		 * Forward message to all others nodes, or the the ones specified
-		 * by the `routes' parameter if not NULL.
+		 * by the routes of `m' if not NULL.
 		 */
 
-		if (routes != NULL) {
-			pslist_t *l;
+		if (m != NULL) {
 			pslist_t *nodes = NULL;
 			int count = 0;
+			uint i;
 
 			g_assert(gnutella_header_get_function(&sender->header)
 					== GTA_MSG_PUSH_REQUEST);
 
-			PSLIST_FOREACH(routes, l) {
-				struct route_data *rd = l->data;
+			for (i = 0; i < m->nroutes; i++) {
+				struct route_data *rd = message_route(m, i);
 				if (rd->node == sender)
 					continue;
 
@@ -2233,7 +2212,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 	 * each route.
 	 */
 
-	if (m->routes && route_node_sent_message(sender, m)) {
+	if (m->nroutes != 0 && route_node_sent_message(sender, m)) {
 		bool higher_ttl;
 
 		/*
@@ -2299,7 +2278,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 				gmsg_log_bad(sender, "dup message from same node");
 		}
 	} else {
-		if (m->routes == NULL) {
+		if (0 == m->nroutes) {
 			routing_log_extra(route_log, "all routes lost");
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
@@ -2309,13 +2288,13 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 			}
 		} else {
 			if (GNET_PROPERTY(log_gnutella_routing)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = m->nroutes;
 				routing_log_extra(route_log, "%u remaining route%s",
 					count, plural(count));
 			}
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = m->nroutes;
 				gmsg_log_duplicate(sender,
 					"from %s: %sother node, %u route%s (dups=%u)",
 					node_infostr(sender), oob ? "OOB, " : "",
@@ -2481,7 +2460,7 @@ route_push(struct route_log *route_log,
 
 		forward_message(route_log, node, neighbour, dest, NULL);
 
-	} else if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
+	} else if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->nroutes) {
 		gnet_stats_inc_general(GNR_PUSH_RELAYED_VIA_TABLE_ROUTE);
 
 		/*
@@ -2490,10 +2469,10 @@ route_push(struct route_log *route_log,
 		 */
 
 		revitalize_entry(m, FALSE);
-		forward_message(route_log, node, NULL, dest, m->routes);
+		forward_message(route_log, node, NULL, dest, m);
 
 	} else {
-		if (m && m->routes == NULL) {
+		if (m && 0 == m->nroutes) {
 			routing_log_extra(route_log, "route to target GUID %s gone",
 				guid_hex_str(guid));
 			gnet_stats_count_dropped(sender, MSG_DROP_ROUTE_LOST);
@@ -2666,7 +2645,7 @@ route_query_hit(struct route_log *route_log,
 				message_add(origin_guid, QUERY_HIT_ROUTE_SAVE, sender);
 				route_starving_check(origin_guid);
 			}
-		} else if (m->routes == NULL || !route_node_sent_message(sender, m)) {
+		} else if (0 == m->nroutes || !route_node_sent_message(sender, m)) {
 			struct route_data *route;
 
 			/*
@@ -2682,13 +2661,11 @@ route_query_hit(struct route_log *route_log,
 			g_assert(route != NULL);
 
 			/*
-			 * A query hit is not a broadcasted message, so there's
-			 * no recording of the TTLs at which we see it.
+			 * A query hit is not a broadcasted message, so the TTL at
+			 * which we see it along the route is irrelevant.
 			 */
 
-			g_assert(m->ttls == NULL);
-
-			m->routes = pslist_append(m->routes, route);
+			message_route_append(m, route, 0);
 			route->saved_messages++;
 
 			/*
@@ -2730,18 +2707,18 @@ route_query_hit(struct route_log *route_log,
 	g_assert(m);		/* Or find_message() would have returned FALSE */
 
 	/*
-	 * Since this routing data is used, relocate it at the end of
-	 * the "message_array[]" to augment its lifetime.
+	 * Since this routing data is used, move it to the current
+	 * generation to augment its lifetime.
 	 */
 
 	revitalize_entry(m, FALSE);
 
 	/*
-	 * If `m->routes' is NULL, we have seen the request, but unfortunately
+	 * If `m' has no routes, we have seen the request, but unfortunately
 	 * none of the nodes that sent us the request are connected any more.
 	 */
 
-	if (m->routes == NULL)
+	if (0 == m->nroutes)
 		goto route_lost;
 
 	if (route_node_sent_message(fake_node, m)) {
@@ -2778,12 +2755,12 @@ route_query_hit(struct route_log *route_log,
 	 * XXX route for relaying. --RAM, 2004-08-29
 	 */
 	{
-		pslist_t *sl;
 		bool skipped_transient = FALSE;
+		uint i;
 
 		found = NULL;
-		PSLIST_FOREACH(m->routes, sl) {
-			struct route_data *route = sl->data;
+		for (i = 0; i < m->nroutes; i++) {
+			struct route_data *route = message_route(m, i);
 
 			g_assert(route);
 			g_assert(route->node);
@@ -2806,7 +2783,7 @@ route_query_hit(struct route_log *route_log,
 				 * will be logged as a message targeted to a transient node.
 				 */
 
-				if (NULL != pslist_next(sl)) {
+				if (i + 1 < m->nroutes) {
 					gnutella_node_t *rn;
 
 					rn = route_node_get_gnutella(route->node);
@@ -3077,7 +3054,7 @@ route_exists_for_reply(const struct guid *muid, uint8 function)
 {
 	struct message *m;
 
-	if (!find_message(muid, function & ~0x01, &m) || m->routes == NULL)
+	if (!find_message(muid, function & ~0x01, &m) || 0 == m->nroutes)
 		return FALSE;
 
 	return TRUE;
@@ -3115,12 +3092,13 @@ route_towards_guid(const struct guid *guid)
 	if (node)
 		return pslist_prepend(NULL, node);
 
-	if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
-		pslist_t *iter, *nodes = NULL;
+	if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->nroutes) {
+		pslist_t *nodes = NULL;
+		uint i;
 
 		revitalize_entry(m, TRUE);
-		PSLIST_FOREACH(m->routes, iter) {
-			struct route_data *rd = iter->data;
+		for (i = 0; i < m->nroutes; i++) {
+			struct route_data *rd = message_route(m, i);
 			nodes = pslist_prepend(nodes, rd->node);
 		}
 		return nodes;
@@ -3191,27 +3169,19 @@ void G_COLD
 routing_close(void)
 {
 	uint cnt;
+	size_t i;
 
-	g_assert(routing.messages_hashed != NULL);
+	g_assert(routing.slots != NULL);
 
-	hset_free_null(&routing.messages_hashed);
+	for (i = 0; i < routing.capacity; i++) {
+		struct message *m = &routing.slots[i];
 
-	for (cnt = 0; cnt < MAX_CHUNKS; cnt++) {
-		struct message **chunk = routing.chunks[cnt];
-		if (chunk != NULL) {
-			int i;
-			for (i = 0; i < CHUNK_MESSAGES; i++) {
-				struct message *m = chunk[i];
-				if (m != NULL) {
-					message_check(m, cnt);
-					free_route_list(m);
-					WFREE(m);
-				}
-			}
-			HFREE_NULL(chunk);
-		}
+		if (m->gen != 0)
+			free_route_list(m);
 	}
 
+	HFREE_NULL(routing.slots);
+
 	hset_foreach(ht_banned_push, free_banned_push, NULL);
 	hset_free_null(&ht_banned_push);
 
@@ -481,6 +481,33 @@ rx_disable(rxdrv_t *rx)
 	rx_deep_disable(rx);
 }
 
+/**
+ * Enable reception on the layers underneath `rx'.
+ *
+ * This is used by layers that need to throttle the incoming data flow
+ * independently of the upper layers.
+ */
+void
+rx_lower_enable(rxdrv_t *rx)
+{
+	rx_check(rx);
+	g_assert(rx->lower != NULL);
+
+	rx_deep_enable(rx->lower);
+}
+
+/**
+ * Disable reception on the layers underneath `rx'.
+ */
+void
+rx_lower_disable(rxdrv_t *rx)
+{
+	rx_check(rx);
+	g_assert(rx->lower != NULL);
+
+	rx_deep_disable(rx->lower);
+}
+
 /**
  * @returns the driver at the bottom of the stack.
  */
@@ -125,6 +125,8 @@ bool rx_recv(rxdrv_t *rx, pmsg_t *mb);
 bool rx_recvfrom(rxdrv_t *rx, pmsg_t *mb, const struct gnutella_host *from);
 void rx_enable(rxdrv_t *rx);
 void rx_disable(rxdrv_t *rx);
+void rx_lower_enable(rxdrv_t *rx);
+void rx_lower_disable(rxdrv_t *rx);
 void rx_change_owner(rxdrv_t *rx, void *owner);
 rxdrv_t *rx_bottom(rxdrv_t *rx);
 struct bio_source *rx_bio_source(rxdrv_t *rx);
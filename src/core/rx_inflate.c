@@ -39,9 +39,13 @@
 #include "rx.h"
 #include "rx_inflate.h"
 #include "rxbuf.h"
+#include "zpool.h"
 
 #include "lib/base16.h"			/* For error messages */
+#include "lib/cq.h"
 #include "lib/pmsg.h"
+#include "lib/pslist.h"
+#include "lib/slist.h"
 #include "lib/str.h"			/* For error messages */
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/walloc.h"
@@ -57,9 +61,78 @@ struct attr {
 	z_streamp inz;					/**< Decompressing stream */
 	size_t processed;				/**< Input bytes decompressed so far */
 	int flags;
+	/* Asynchronous mode */
+	zpool_stream_t *zs;				/**< Worker stream, NULL if synchronous */
+	slist_t *pending;				/**< Inflated messages to deliver */
+	size_t a_inflight;				/**< Input bytes handed to the workers */
+	size_t a_pending;				/**< Inflated bytes awaiting delivery */
+	cevent_t *deliver_ev;			/**< Deferred delivery event */
 };
 
-#define IF_ENABLED	0x00000001		/**< Reception enabled */
+#define IF_ENABLED		0x00000001	/**< Reception enabled */
+#define IF_THROTTLED	0x00000002	/**< Lower layer disabled (async mode) */
+#define IF_ERROR		0x00000004	/**< Stream is dead (async mode) */
+
+#define INFLATE_ASYNC_BUFSIZ	4096	/**< Size of inflated blocks */
+#define INFLATE_ASYNC_MAX		65536	/**< Held data before throttling */
+
+/**
+ * A decompression job, in asynchronous mode.
+ */
+struct inflate_job {
+	z_streamp inz;					/**< Decompressing stream */
+	pmsg_t *mb;						/**< Input data */
+	const void *start;				/**< Input start, at submission */
+	size_t inlen;					/**< Input length, at submission */
+	size_t offset;					/**< Stream offset of input */
+	pslist_t *out;					/**< Inflated output (pmsg_t) */
+	size_t outlen;					/**< Total output length */
+	int ret;						/**< Z_OK, or zlib error */
+};
+
+/**
+ * Report decompression error.
+ *
+ * @param rx		the RX driver
+ * @param ret		the zlib error
+ * @param offset	stream offset of the input data
+ * @param data		start of the input data
+ * @param len		length of the input data
+ */
+static void
+inflate_error(rxdrv_t *rx, int ret, size_t offset, const void *data, int len)
+{
+	struct attr *attr = rx->opaque;
+	str_t *s;
+
+	s = str_new(128);
+	str_printf(s, "decompression failed between offsets %zu and %zu: %s",
+		offset, offset + len, zlib_strerror(ret));
+
+	/*
+	 * If error happens at the beginning of the stream, include the
+	 * first few bytes in hexadecimal so that we can detect whether
+	 * we missed a gzip encapsulation, or to make sure data are really
+	 * deflated, not plain.
+	 *		--RAM, 2014-01-06
+	 */
+
+	if (0 == offset) {
+		char hex[33];
+		size_t n = MIN(UNSIGNED(len), (sizeof hex - 1) / 2);
+		size_t m;
+
+		m = base16_encode(hex, sizeof hex - 1, data, n);
+		g_assert(m < sizeof hex);
+		hex[m] = '\0';
+
+		str_catf(s, " [first %zu hex byte%s: %s]", m/2, plural(m/2), hex);
+	}
+
+	errno = EIO;
+	attr->cb->inflate_error(rx->owner, "%s", str_2c(s));
+	str_destroy_null(&s);
+}
 
 /**
  * Decompress more data from the input buffer `mb'.
@@ -98,35 +171,7 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 	ret = inflate(inz, Z_SYNC_FLUSH);
 
 	if (ret != Z_OK && ret != Z_STREAM_END) {
-		str_t *s;
-
-		s = str_new(128);
-		str_printf(s, "decompression failed between offsets %zu and %zu: %s",
-			attr->processed, attr->processed + old_size, zlib_strerror(ret));
-
-		/*
-		 * If error happens at the beginning of the stream, include the
-		 * first few bytes in hexadecimal so that we can detect whether
-		 * we missed a gzip encapsulation, or to make sure data are really
-		 * deflated, not plain.
-		 *		--RAM, 2014-01-06
-		 */
-
-		if (0 == attr->processed) {
-			char data[33];
-			size_t n = MIN(UNSIGNED(old_size), (sizeof data - 1) / 2);
-			size_t m;
-
-			m = base16_encode(data, sizeof data - 1, pmsg_start(mb), n);
-			g_assert(m < sizeof data);
-			data[m] = '\0';
-
-			str_catf(s, " [first %zu hex byte%s: %s]", m/2, plural(m/2), data);
-		}
-
-		errno = EIO;
-		attr->cb->inflate_error(rx->owner, "%s", str_2c(s));
-		str_destroy_null(&s);
+		inflate_error(rx, ret, attr->processed, pmsg_start(mb), old_size);
 		goto cleanup;
 	}
 
@@ -164,6 +209,233 @@ cleanup:
 	return NULL;
 }
 
+/***
+ *** Asynchronous mode.
+ ***/
+
+/**
+ * Decompress job data, from a worker thread.
+ */
+static void
+inflate_job_work(void *data)
+{
+	struct inflate_job *ij = data;
+	z_streamp inz = ij->inz;
+	pmsg_t *mb = ij->mb;
+
+	ij->ret = Z_OK;
+
+	while (0 != pmsg_size(mb)) {
+		pmsg_t *imb;
+		int ret, old_size, old_avail, inflated;
+
+		imb = pmsg_new(PMSG_P_DATA, NULL, INFLATE_ASYNC_BUFSIZ);
+
+		inz->next_in = deconstify_pointer(pmsg_start(mb));
+		inz->avail_in = old_size = pmsg_size(mb);
+		inz->next_out = cast_to_pointer(imb->m_wptr);
+		inz->avail_out = old_avail = pmsg_available(imb);
+
+		ret = inflate(inz, Z_SYNC_FLUSH);
+
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			pmsg_free(imb);
+			ij->ret = ret;
+			break;
+		}
+
+		mb->m_rptr += old_size - inz->avail_in;
+		inflated = old_avail - inz->avail_out;
+
+		if (0 == inflated) {
+			pmsg_free(imb);
+			break;
+		}
+
+		imb->m_wptr += inflated;
+		ij->outlen += inflated;
+		ij->out = pslist_prepend(ij->out, imb);
+	}
+
+	ij->out = pslist_reverse(ij->out);
+}
+
+/**
+ * Dispose of decompression job.
+ */
+static void
+inflate_job_free(void *data)
+{
+	struct inflate_job *ij = data;
+
+	pmsg_free_null(&ij->mb);
+	pslist_free_full_null(&ij->out, (free_fn_t) pmsg_free);
+	WFREE(ij);
+}
+
+/**
+ * Release the decompressing stream, once no worker can use it any longer.
+ */
+static void
+inflate_async_release(void *data)
+{
+	z_streamp inz = data;
+	int ret;
+
+	ret = inflateEnd(inz);
+	if (ret != Z_OK)
+		g_warning("%s(): while freeing decompressor: %s",
+			G_STRFUNC, zlib_strerror(ret));
+
+	WFREE(inz);
+}
+
+/**
+ * Throttle the lower layer when too much data are held, and resume it
+ * once we have delivered enough.
+ */
+static void
+inflate_async_throttle(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+	size_t held = attr->a_inflight + attr->a_pending;
+
+	if (attr->flags & IF_THROTTLED) {
+		if (held <= INFLATE_ASYNC_MAX / 2 && (attr->flags & IF_ENABLED)) {
+			attr->flags &= ~IF_THROTTLED;
+			rx_lower_enable(rx);
+		}
+	} else if (held > INFLATE_ASYNC_MAX && (attr->flags & IF_ENABLED)) {
+		attr->flags |= IF_THROTTLED;
+		rx_lower_disable(rx);
+	}
+}
+
+/**
+ * Deliver inflated data to the upper layer, as long as it wants them.
+ */
+static void
+inflate_async_deliver(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+	pmsg_t *mb;
+
+	while (
+		(attr->flags & IF_ENABLED) &&
+		!(attr->flags & IF_ERROR) &&
+		!(rx->flags & RX_F_FREED) &&
+		NULL != (mb = slist_shift(attr->pending))
+	) {
+		attr->a_pending -= pmsg_size(mb);
+
+		if (!(*rx->data.ind)(rx, mb)) {
+			attr->flags |= IF_ERROR;
+			pmsg_slist_discard_all(attr->pending);
+			attr->a_pending = 0;
+			return;
+		}
+	}
+
+	if (!(rx->flags & RX_F_FREED))
+		inflate_async_throttle(rx);
+}
+
+/**
+ * Callout queue callback to deliver data held whilst reception was disabled.
+ */
+static void
+inflate_async_deliver_cb(cqueue_t *cq, void *data)
+{
+	rxdrv_t *rx = data;
+	struct attr *attr = rx->opaque;
+
+	cq_zero(cq, &attr->deliver_ev);
+	inflate_async_deliver(rx);
+}
+
+/**
+ * Decompression job completed, in the main thread.
+ */
+static void
+inflate_async_done(void *owner, void *data)
+{
+	rxdrv_t *rx = owner;
+	struct attr *attr = rx->opaque;
+	struct inflate_job *ij = data;
+	pslist_t *sl;
+
+	rx_check(rx);
+	g_assert(attr->a_inflight >= ij->inlen);
+
+	attr->a_inflight -= ij->inlen;
+
+	if (attr->flags & IF_ERROR)
+		goto done;
+
+	PSLIST_FOREACH(ij->out, sl) {
+		slist_append(attr->pending, sl->data);
+	}
+	pslist_free_null(&ij->out);
+	attr->a_pending += ij->outlen;
+
+	if (0 != ij->outlen && attr->cb->add_rx_inflated != NULL)
+		attr->cb->add_rx_inflated(rx->owner, ij->outlen);
+
+	/*
+	 * Data inflated before the error are delivered first, so that the
+	 * error is reported when the upper layer would have seen it with
+	 * synchronous processing.
+	 */
+
+	if (Z_OK != ij->ret) {
+		inflate_async_deliver(rx);
+		if (!(attr->flags & IF_ERROR) && !(rx->flags & RX_F_FREED)) {
+			attr->flags |= IF_ERROR;
+			pmsg_slist_discard_all(attr->pending);
+			attr->a_pending = 0;
+			inflate_error(rx, ij->ret, ij->offset,
+				ij->start, ij->inlen);
+		}
+		goto done;
+	}
+
+	inflate_async_deliver(rx);
+
+done:
+	inflate_job_free(ij);
+}
+
+/**
+ * Hand data from lower layer to the workers.
+ */
+static bool
+inflate_async_recv(rxdrv_t *rx, pmsg_t *mb)
+{
+	struct attr *attr = rx->opaque;
+	struct inflate_job *ij;
+	size_t len = pmsg_size(mb);
+
+	if ((attr->flags & IF_ERROR) || 0 == len) {
+		pmsg_free(mb);
+		return !(attr->flags & IF_ERROR);
+	}
+
+	WALLOC0(ij);
+	ij->inz = attr->inz;
+	ij->mb = mb;
+	ij->start = pmsg_start(mb);
+	ij->inlen = len;
+	ij->offset = attr->processed;
+
+	attr->processed += len;
+	attr->a_inflight += len;
+
+	zpool_stream_submit(attr->zs, ij);
+	inflate_async_throttle(rx);
+
+	return TRUE;
+}
+
 /***
  *** Polymorphic routines.
  ***/
@@ -200,6 +472,12 @@ rx_inflate_init(rxdrv_t *rx, const void *args)
 	attr->cb = rargs->cb;
 	attr->inz = inz;
 
+	if (rargs->async && zpool_enabled()) {
+		attr->zs = zpool_stream_make(gnet_host_to_string(&rx->host), rx,
+			inflate_job_work, inflate_async_done, inflate_job_free);
+		attr->pending = slist_new();
+	}
+
 	rx->opaque = attr;
 
 	return rx;		/* OK */
@@ -216,12 +494,25 @@ rx_inflate_destroy(rxdrv_t *rx)
 
 	g_assert(attr->inz);
 
-	ret = inflateEnd(attr->inz);
-	if (ret != Z_OK)
-		g_warning("while freeing decompressor for peer %s: %s",
-			gnet_host_to_string(&rx->host), zlib_strerror(ret));
+	/*
+	 * In asynchronous mode, a worker may still be using the decompressing
+	 * stream, which will be released when it is done.
+	 */
+
+	if (attr->zs != NULL) {
+		zpool_stream_free(&attr->zs, inflate_async_release, attr->inz);
+		pmsg_slist_free(&attr->pending);
+		cq_cancel(&attr->deliver_ev);
+		attr->inz = NULL;
+	} else {
+		ret = inflateEnd(attr->inz);
+		if (ret != Z_OK)
+			g_warning("while freeing decompressor for peer %s: %s",
+				gnet_host_to_string(&rx->host), zlib_strerror(ret));
+
+		WFREE_TYPE_NULL(attr->inz);
+	}
 
-	WFREE_TYPE_NULL(attr->inz);
 	WFREE(attr);
 	rx->opaque = NULL;
 }
@@ -239,6 +530,9 @@ rx_inflate_recv(rxdrv_t *rx, pmsg_t *mb)
 	rx_check(rx);
 	g_assert(mb);
 
+	if (attr->zs != NULL)
+		return inflate_async_recv(rx, mb);
+
 	/*
 	 * Decompress the stream, forwarding inflated data to the upper layer.
 	 * At any time, a packet we forward can cause the reception to be
@@ -264,6 +558,22 @@ rx_inflate_enable(rxdrv_t *rx)
 	struct attr *attr = rx->opaque;
 
 	attr->flags |= IF_ENABLED;
+
+	/*
+	 * The lower layers are being enabled as well.
+	 *
+	 * In asynchronous mode, the data we were holding will be delivered
+	 * shortly, from a clean context.
+	 */
+
+	attr->flags &= ~IF_THROTTLED;
+
+	if (
+		attr->zs != NULL && NULL == attr->deliver_ev &&
+		0 != slist_length(attr->pending)
+	) {
+		attr->deliver_ev = cq_main_insert(1, inflate_async_deliver_cb, rx);
+	}
 }
 
 /**
@@ -274,7 +584,7 @@ rx_inflate_disable(rxdrv_t *rx)
 {
 	struct attr *attr = rx->opaque;
 
-	attr->flags &= ~IF_ENABLED;
+	attr->flags &= ~(IF_ENABLED | IF_THROTTLED);	/* Lower layers too */
 }
 
 static const struct rxdrv_ops rx_inflate_ops = {
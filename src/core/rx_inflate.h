@@ -54,6 +54,7 @@ struct rx_inflate_cb {
  */
 struct rx_inflate_args {
 	const struct rx_inflate_cb *cb;		/**< Callbacks */
+	bool async;							/**< Inflate in worker threads */
 };
 
 #endif	/* _core_rx_inflate_h_ */
@@ -2277,6 +2277,22 @@ bw_http_out_enabled_changed(property_t prop)
 	return bw_switch(prop, BSCHED_BWS_OUT);
 }
 
+/**
+ * When uploads are pumped by the I/O threads, let these threads get
+ * bandwidth from the upload schedulers.
+ */
+static bool
+upload_threaded_pump_changed(property_t prop)
+{
+	bool val;
+
+	gnet_prop_get_boolean_val(prop, &val);
+	bws_concurrent(BSCHED_BWS_OUT, val);
+	bws_concurrent(BSCHED_BWS_LOOPBACK_OUT, val);
+	bws_concurrent(BSCHED_BWS_PRIVATE_OUT, val);
+	return FALSE;
+}
+
 static bool
 bw_gnet_in_enabled_changed(property_t prop)
 {
@@ -3160,6 +3176,11 @@ static prop_map_t property_map[] = {
         bw_http_out_enabled_changed,
         FALSE
     },
+    {
+        PROP_UPLOAD_THREADED_PUMP,
+        upload_threaded_pump_changed,
+        TRUE
+    },
     {
         PROP_BW_GNET_IN_ENABLED,
         bw_gnet_in_enabled_changed,
@@ -0,0 +1,1064 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Binary persistent storage of the SHA1 cache.
+ *
+ * The SHA1 cache is made of two files, held in the configuration directory:
+ *
+ * - "sha1_cache.bin" is a read-only image, mapped in memory, which holds
+ *   a hash index keyed by the file path.  Entries are probed lazily when
+ *   looked up, so that the cache does not need to be parsed at startup.
+ *
+ * - "sha1_cache.jnl" is an append-only journal, recording all the updates
+ *   made since the image was last written.  It is replayed at startup.
+ *
+ * When the journal grows too large, the caller builds a snapshot of the
+ * cache and commits it: the journal is then rotated and the new image is
+ * written by a background thread, which atomically renames it over the old
+ * one.  The main thread maps the new image the next time it probes it.
+ *
+ * All the multi-byte quantities are stored in little-endian order so that
+ * the image can be mapped on any architecture.
+ *
+ * The image is laid out as follows:
+ *
+ *     header  : 64 bytes (see SHA1_STORE_HDR_* offsets)
+ *     index   : bucket count * 4 bytes, the record number + 1 (0 = empty)
+ *     records : record count * SHA1_STORE_REC_SIZE bytes
+ *     strings : all the NUL-terminated paths
+ *
+ * The index is an open-addressing hash table using linear probing, with
+ * a load factor kept under 1/2.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "sha1_store.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/cond.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hstrfn.h"
+#include "lib/mutex.h"
+#include "lib/path.h"
+#include "lib/pow2.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define SHA1_STORE_FILE		"sha1_cache.bin"
+#define SHA1_STORE_JOURNAL	"sha1_cache.jnl"
+#define SHA1_STORE_ROTATED	"sha1_cache.jnl.old"
+
+#define SHA1_STORE_MAGIC	"GTKGSHA1"
+#define SHA1_STORE_VERSION	1
+
+#define SHA1_STORE_JNL_MIN	1024	/**< Min journal records for compaction */
+#define SHA1_STORE_JNL_RATIO 8		/**< Compact when image / journal < 8 */
+
+/*
+ * Image header offsets.
+ */
+#define SHA1_STORE_HDR_MAGIC	0		/**< Magic string, 8 bytes */
+#define SHA1_STORE_HDR_VERSION	8		/**< Format version */
+#define SHA1_STORE_HDR_COUNT	12		/**< Amount of records */
+#define SHA1_STORE_HDR_BUCKETS	16		/**< Amount of index buckets */
+#define SHA1_STORE_HDR_INDEX	24		/**< Offset of index */
+#define SHA1_STORE_HDR_RECORDS	32		/**< Offset of records */
+#define SHA1_STORE_HDR_STRINGS	40		/**< Offset of strings */
+#define SHA1_STORE_HDR_STRLEN	48		/**< Length of strings */
+#define SHA1_STORE_HDR_SIZE		64
+
+/*
+ * Image record offsets.
+ */
+#define SHA1_STORE_REC_HASH		0		/**< Hash of path */
+#define SHA1_STORE_REC_PLEN		4		/**< Length of path */
+#define SHA1_STORE_REC_POFF		8		/**< Offset of path in strings */
+#define SHA1_STORE_REC_FSIZE	16		/**< File size */
+#define SHA1_STORE_REC_MTIME	24		/**< File modification time */
+#define SHA1_STORE_REC_SHA1		32		/**< SHA1 digest */
+#define SHA1_STORE_REC_TTH		52		/**< TTH digest */
+#define SHA1_STORE_REC_FLAGS	76		/**< Flags */
+#define SHA1_STORE_REC_SIZE		80
+
+#define SHA1_STORE_F_TTH		(1U << 0)	/**< TTH is valid */
+
+/*
+ * Journal record offsets.
+ */
+#define SHA1_STORE_JNL_LEN		0		/**< Total record length */
+#define SHA1_STORE_JNL_CSUM		4		/**< Checksum of what follows */
+#define SHA1_STORE_JNL_FSIZE	8		/**< File size */
+#define SHA1_STORE_JNL_MTIME	16		/**< File modification time */
+#define SHA1_STORE_JNL_SHA1		24		/**< SHA1 digest */
+#define SHA1_STORE_JNL_TTH		44		/**< TTH digest */
+#define SHA1_STORE_JNL_FLAGS	68		/**< Flags */
+#define SHA1_STORE_JNL_PATH		72		/**< Path, not NUL-terminated */
+#define SHA1_STORE_JNL_MAXLEN	(SHA1_STORE_JNL_PATH + MAX_PATH_LEN)
+
+/**
+ * The mapped image, and the journal.
+ *
+ * This is only accessed from the main thread.
+ */
+static struct sha1_store {
+	const char *dir;			/**< Configuration directory (atom) */
+	const uint8 *base;			/**< Base of image */
+	size_t size;				/**< Size of image */
+	const uint8 *index;			/**< Start of index */
+	const uint8 *records;		/**< Start of records */
+	const char *strings;		/**< Start of strings */
+	uint64 strings_len;			/**< Length of strings */
+	uint32 count;				/**< Amount of records */
+	uint32 buckets;				/**< Amount of buckets (power of 2) */
+	uint generation;			/**< Generation of mapped image */
+	int jfd;					/**< Journal file descriptor */
+	size_t jrecords;			/**< Records in journal */
+} sha1_store = {
+	NULL, NULL, 0, NULL, NULL, NULL, 0, 0, 0, 0, -1, 0
+};
+
+/*
+ * Synchronization with the background writing thread.
+ */
+static mutex_t sha1_store_mtx = MUTEX_INIT;
+static cond_t sha1_store_cond = COND_INIT;
+static bool sha1_store_writing;		/**< Whether image is being written */
+static uint sha1_store_generation;	/**< Bumped when a new image is written */
+
+enum sha1_store_builder_magic { SHA1_STORE_BUILDER_MAGIC = 0x3ff47c1eU };
+
+/**
+ * A record being built.
+ */
+struct sha1_store_brec {
+	uint32 hash;				/**< Hash of path */
+	uint32 plen;				/**< Length of path */
+	uint64 poff;				/**< Offset of path in strings */
+	struct sha1_store_record rec;
+};
+
+/**
+ * A snapshot of the cache, to be committed as the new image.
+ */
+struct sha1_store_builder {
+	enum sha1_store_builder_magic magic;
+	struct sha1_store_brec *recs;	/**< Records */
+	size_t count;					/**< Amount of records */
+	size_t capacity;				/**< Allocated records */
+	char *strings;					/**< Paths */
+	size_t slen;					/**< Length of paths */
+	size_t scapacity;				/**< Allocated length */
+	const char *dir;				/**< Where image is written (atom) */
+};
+
+static inline void
+sha1_store_builder_check(const struct sha1_store_builder * const b)
+{
+	g_assert(b != NULL);
+	g_assert(SHA1_STORE_BUILDER_MAGIC == b->magic);
+}
+
+/**
+ * Hash a path, using a stable hashing function since the value is persisted.
+ */
+static inline uint32
+sha1_store_hash(const char *path, size_t len)
+{
+	return universal_hash(path, len);
+}
+
+/**
+ * Release the mapped image.
+ */
+static void
+sha1_store_unmap(void)
+{
+	if (NULL == sha1_store.base)
+		return;
+
+#ifdef HAS_MMAP
+	vmm_munmap(deconstify_pointer(sha1_store.base), sha1_store.size);
+#else
+	vmm_free(deconstify_pointer(sha1_store.base), sha1_store.size);
+#endif
+
+	sha1_store.base = NULL;
+	sha1_store.size = 0;
+	sha1_store.index = sha1_store.records = NULL;
+	sha1_store.strings = NULL;
+	sha1_store.strings_len = 0;
+	sha1_store.count = sha1_store.buckets = 0;
+}
+
+/**
+ * Validate the header of the image.
+ *
+ * @return TRUE if the image is usable.
+ */
+static bool
+sha1_store_validate(const uint8 *p, size_t size)
+{
+	uint64 index, records, strings, strings_len;
+	uint32 count, buckets;
+
+	if (size < SHA1_STORE_HDR_SIZE)
+		return FALSE;
+
+	if (0 != memcmp(p + SHA1_STORE_HDR_MAGIC, SHA1_STORE_MAGIC, 8))
+		return FALSE;
+
+	if (SHA1_STORE_VERSION != peek_le32(p + SHA1_STORE_HDR_VERSION))
+		return FALSE;
+
+	count = peek_le32(p + SHA1_STORE_HDR_COUNT);
+	buckets = peek_le32(p + SHA1_STORE_HDR_BUCKETS);
+	index = peek_le64(p + SHA1_STORE_HDR_INDEX);
+	records = peek_le64(p + SHA1_STORE_HDR_RECORDS);
+	strings = peek_le64(p + SHA1_STORE_HDR_STRINGS);
+	strings_len = peek_le64(p + SHA1_STORE_HDR_STRLEN);
+
+	if (!IS_POWER_OF_2(buckets) || count >= buckets)
+		return FALSE;
+
+	if (index < SHA1_STORE_HDR_SIZE || index + 4 * (uint64) buckets > records)
+		return FALSE;
+
+	if (records + SHA1_STORE_REC_SIZE * (uint64) count > strings)
+		return FALSE;
+
+	if (strings + strings_len > size)
+		return FALSE;
+
+	sha1_store.count = count;
+	sha1_store.buckets = buckets;
+	sha1_store.index = p + index;
+	sha1_store.records = p + records;
+	sha1_store.strings = (const char *) p + strings;
+	sha1_store.strings_len = strings_len;
+
+	return TRUE;
+}
+
+/**
+ * Map the image in memory.
+ *
+ * @return TRUE if the image exists and was successfully mapped.
+ */
+static bool
+sha1_store_map(void)
+{
+	filestat_t sb;
+	char *path;
+	void *p;
+	int fd;
+
+	g_assert(NULL == sha1_store.base);
+
+	path = make_pathname(sha1_store.dir, SHA1_STORE_FILE);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (-1 == fd)
+		goto failed;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto failed;
+	}
+
+	if (
+		sb.st_size < SHA1_STORE_HDR_SIZE ||
+		UNSIGNED(sb.st_size) >= MAX_INT_VAL(size_t)
+	) {
+		g_warning("%s(): ignoring \"%s\": bad size %s",
+			G_STRFUNC, path, fileoffset_t_to_string(sb.st_size));
+		goto failed;
+	}
+
+#ifdef HAS_MMAP
+	p = vmm_mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == p) {
+		g_warning("%s(): cannot map \"%s\": %m", G_STRFUNC, path);
+		goto failed;
+	}
+#else
+	{
+		size_t left = sb.st_size;
+		char *buf;
+
+		p = buf = vmm_alloc(sb.st_size);
+
+		while (left > 0) {
+			ssize_t n = read(fd, buf, left);
+			if ((ssize_t) -1 == n || 0 == n) {
+				g_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+				vmm_free(p, sb.st_size);
+				goto failed;
+			}
+			left -= n;
+			buf += n;
+		}
+	}
+#endif	/* HAS_MMAP */
+
+	fd_forget_and_close(&fd);
+
+	sha1_store.base = p;
+	sha1_store.size = sb.st_size;
+
+	if (!sha1_store_validate(p, sb.st_size)) {
+		g_warning("%s(): ignoring corrupted \"%s\"", G_STRFUNC, path);
+		sha1_store_unmap();
+		goto failed;
+	}
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("%s(): mapped %u entr%s from \"%s\"",
+			G_STRFUNC, sha1_store.count, plural_y(sha1_store.count), path);
+	}
+
+	HFREE_NULL(path);
+	return TRUE;
+
+failed:
+	fd_forget_and_close(&fd);
+	HFREE_NULL(path);
+	return FALSE;
+}
+
+/**
+ * Make sure we are using the latest image, remapping it if it was rewritten
+ * by the background thread.
+ */
+static void
+sha1_store_sync(void)
+{
+	uint generation;
+
+	mutex_lock(&sha1_store_mtx);
+	generation = sha1_store_generation;
+	mutex_unlock(&sha1_store_mtx);
+
+	if G_UNLIKELY(generation != sha1_store.generation) {
+		sha1_store.generation = generation;
+		sha1_store_unmap();
+		sha1_store_map();
+	}
+}
+
+/**
+ * Decode record from the image.
+ */
+static void
+sha1_store_decode(const uint8 *r, struct sha1_store_record *rec)
+{
+	uint32 flags = peek_le32(r + SHA1_STORE_REC_FLAGS);
+
+	rec->size = peek_le64(r + SHA1_STORE_REC_FSIZE);
+	rec->mtime = peek_le64(r + SHA1_STORE_REC_MTIME);
+	memcpy(rec->sha1.data, r + SHA1_STORE_REC_SHA1, SHA1_RAW_SIZE);
+	rec->has_tth = booleanize(flags & SHA1_STORE_F_TTH);
+	if (rec->has_tth)
+		memcpy(rec->tth.data, r + SHA1_STORE_REC_TTH, TTH_RAW_SIZE);
+	else
+		ZERO(&rec->tth);
+}
+
+/**
+ * Fetch the path of a record from the image.
+ *
+ * @return the NUL-terminated path, NULL if the record is corrupted.
+ */
+static const char *
+sha1_store_path(const uint8 *r, uint32 *len)
+{
+	uint64 off = peek_le64(r + SHA1_STORE_REC_POFF);
+	uint32 plen = peek_le32(r + SHA1_STORE_REC_PLEN);
+
+	if (off + plen >= sha1_store.strings_len)
+		return NULL;
+
+	if ('\0' != sha1_store.strings[off + plen])
+		return NULL;
+
+	*len = plen;
+	return &sha1_store.strings[off];
+}
+
+/**
+ * Look up the record for given path in the image.
+ *
+ * @param path		the path of the file
+ * @param rec		where the record is written, if found
+ *
+ * @return TRUE if the path was found.
+ */
+bool
+sha1_store_lookup(const char *path, struct sha1_store_record *rec)
+{
+	size_t len;
+	uint32 hash, mask, i, probes;
+
+	g_assert(path != NULL);
+	g_assert(rec != NULL);
+
+	sha1_store_sync();
+
+	if (0 == sha1_store.count)
+		return FALSE;
+
+	len = strlen(path);
+	hash = sha1_store_hash(path, len);
+	mask = sha1_store.buckets - 1;
+
+	for (
+		i = hash & mask, probes = 0;
+		probes < sha1_store.buckets;
+		i = (i + 1) & mask, probes++
+	) {
+		uint32 slot = peek_le32(sha1_store.index + 4 * (size_t) i);
+		const uint8 *r;
+		const char *rpath;
+		uint32 rlen;
+
+		if (0 == slot)
+			break;			/* Empty bucket: not found */
+
+		if G_UNLIKELY(slot > sha1_store.count)
+			break;			/* Corrupted index */
+
+		r = sha1_store.records + SHA1_STORE_REC_SIZE * (size_t) (slot - 1);
+
+		if (peek_le32(r + SHA1_STORE_REC_HASH) != hash)
+			continue;
+
+		rpath = sha1_store_path(r, &rlen);
+
+		if (rpath != NULL && rlen == len && 0 == memcmp(rpath, path, len)) {
+			sha1_store_decode(r, rec);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * Iterate over all the records held in the image.
+ */
+void
+sha1_store_foreach(sha1_store_cb_t cb, void *data)
+{
+	uint32 i;
+
+	g_assert(cb != NULL);
+
+	sha1_store_sync();
+
+	for (i = 0; i < sha1_store.count; i++) {
+		const uint8 *r = sha1_store.records + SHA1_STORE_REC_SIZE * (size_t) i;
+		struct sha1_store_record rec;
+		const char *path;
+		uint32 len;
+
+		path = sha1_store_path(r, &len);
+		if G_UNLIKELY(NULL == path)
+			continue;
+
+		sha1_store_decode(r, &rec);
+		(*cb)(path, &rec, data);
+	}
+}
+
+/**
+ * @return amount of records in the image.
+ */
+size_t
+sha1_store_count(void)
+{
+	sha1_store_sync();
+	return sha1_store.count;
+}
+
+/**
+ * Replay the journal held in file.
+ *
+ * @param name		the journal file name, in the configuration directory
+ * @param cb		the callback to invoke on each journaled record
+ * @param data		additional callback argument
+ * @param fixup		whether to truncate the journal after a corrupted record
+ *
+ * @return amount of records replayed.
+ */
+static size_t
+sha1_store_replay_file(const char *name,
+	sha1_store_cb_t cb, void *data, bool fixup)
+{
+	filestat_t sb;
+	char *path;
+	size_t bufsize = 0, size = 0, off = 0, count = 0;
+	uint8 *buf = NULL;
+	int fd;
+
+	path = make_pathname(sha1_store.dir, name);
+	fd = file_open_missing(path, fixup ? O_RDWR : O_RDONLY);
+
+	if (-1 == fd)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (sb.st_size <= 0 || UNSIGNED(sb.st_size) >= MAX_INT_VAL(size_t))
+		goto done;
+
+	bufsize = sb.st_size;
+	buf = vmm_alloc(bufsize);
+
+	while (size < bufsize) {
+		ssize_t n = read(fd, &buf[size], bufsize - size);
+
+		if ((ssize_t) -1 == n || 0 == n) {
+			g_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+			fixup = FALSE;		/* Do not truncate what we could not read */
+			break;
+		}
+		size += n;
+	}
+
+	while (off + SHA1_STORE_JNL_PATH < size) {
+		const uint8 *r = &buf[off];
+		uint32 len = peek_le32(r + SHA1_STORE_JNL_LEN);
+		struct sha1_store_record rec;
+		char *rpath;
+
+		if (
+			len <= SHA1_STORE_JNL_PATH || len > SHA1_STORE_JNL_MAXLEN ||
+			off + len > size ||
+			peek_le32(r + SHA1_STORE_JNL_CSUM) !=
+				universal_hash(r + SHA1_STORE_JNL_FSIZE,
+					len - SHA1_STORE_JNL_FSIZE)
+		)
+			break;
+
+		rec.size = peek_le64(r + SHA1_STORE_JNL_FSIZE);
+		rec.mtime = peek_le64(r + SHA1_STORE_JNL_MTIME);
+		memcpy(rec.sha1.data, r + SHA1_STORE_JNL_SHA1, SHA1_RAW_SIZE);
+		memcpy(rec.tth.data, r + SHA1_STORE_JNL_TTH, TTH_RAW_SIZE);
+		rec.has_tth =
+			booleanize(peek_le32(r + SHA1_STORE_JNL_FLAGS) & SHA1_STORE_F_TTH);
+
+		rpath = h_strndup((const char *) r + SHA1_STORE_JNL_PATH,
+					len - SHA1_STORE_JNL_PATH);
+		(*cb)(rpath, &rec, data);
+		HFREE_NULL(rpath);
+
+		off += len;
+		count++;
+	}
+
+	if (off != size) {
+		g_warning("%s(): ignoring trailing %zu byte%s in \"%s\"",
+			G_STRFUNC, size - off, plural(size - off), path);
+
+		/*
+		 * Truncate the journal after the last valid record, otherwise
+		 * any record we append later would be lost at the next replay.
+		 */
+
+		if (fixup && -1 == ftruncate(fd, off))
+			g_warning("%s(): cannot truncate \"%s\": %m", G_STRFUNC, path);
+	}
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("%s(): replayed %zu record%s from \"%s\"",
+			G_STRFUNC, count, plural(count), path);
+	}
+
+	/* FALL THROUGH */
+
+done:
+	if (buf != NULL)
+		vmm_free(buf, bufsize);
+	fd_forget_and_close(&fd);
+	HFREE_NULL(path);
+	return count;
+}
+
+/**
+ * Replay the journal, invoking the callback on each recorded update, in
+ * the order they were made.
+ */
+void
+sha1_store_replay(sha1_store_cb_t cb, void *data)
+{
+	g_assert(cb != NULL);
+	g_assert(sha1_store.dir != NULL);
+
+	/*
+	 * A rotated journal is only present when we crashed before the image
+	 * was completely written: its records are not in the image yet.
+	 */
+
+	sha1_store.jrecords +=
+		sha1_store_replay_file(SHA1_STORE_ROTATED, cb, data, FALSE);
+	sha1_store.jrecords +=
+		sha1_store_replay_file(SHA1_STORE_JOURNAL, cb, data, TRUE);
+}
+
+/**
+ * Append record to the journal.
+ */
+void
+sha1_store_append(const char *path, const struct sha1_store_record *rec)
+{
+	uint8 buf[SHA1_STORE_JNL_MAXLEN];
+	size_t plen, len;
+	ssize_t r;
+
+	g_assert(path != NULL);
+	g_assert(rec != NULL);
+	g_assert(sha1_store.dir != NULL);
+
+	plen = strlen(path);
+	len = SHA1_STORE_JNL_PATH + plen;
+
+	if G_UNLIKELY(len > sizeof buf) {
+		g_warning("%s(): path too long: \"%s\"", G_STRFUNC, path);
+		return;
+	}
+
+	if (-1 == sha1_store.jfd) {
+		char *jpath = make_pathname(sha1_store.dir, SHA1_STORE_JOURNAL);
+		sha1_store.jfd = file_create(jpath, O_WRONLY | O_APPEND,
+			S_IRUSR | S_IWUSR);
+		HFREE_NULL(jpath);
+
+		if (-1 == sha1_store.jfd)
+			return;
+	}
+
+	poke_le32(buf + SHA1_STORE_JNL_LEN, len);
+	poke_le64(buf + SHA1_STORE_JNL_FSIZE, rec->size);
+	poke_le64(buf + SHA1_STORE_JNL_MTIME, rec->mtime);
+	memcpy(buf + SHA1_STORE_JNL_SHA1, rec->sha1.data, SHA1_RAW_SIZE);
+	if (rec->has_tth)
+		memcpy(buf + SHA1_STORE_JNL_TTH, rec->tth.data, TTH_RAW_SIZE);
+	else
+		memset(buf + SHA1_STORE_JNL_TTH, 0, TTH_RAW_SIZE);
+	poke_le32(buf + SHA1_STORE_JNL_FLAGS, rec->has_tth ? SHA1_STORE_F_TTH : 0);
+	memcpy(buf + SHA1_STORE_JNL_PATH, path, plen);
+	poke_le32(buf + SHA1_STORE_JNL_CSUM,
+		universal_hash(buf + SHA1_STORE_JNL_FSIZE, len - SHA1_STORE_JNL_FSIZE));
+
+	/*
+	 * The journal is opened with O_APPEND and each record is written
+	 * with a single system call.
+	 */
+
+	r = write(sha1_store.jfd, buf, len);
+
+	if ((ssize_t) -1 == r) {
+		g_warning("%s(): cannot write to journal: %m", G_STRFUNC);
+	} else if ((size_t) r != len) {
+		g_warning("%s(): incomplete journal write", G_STRFUNC);
+	} else {
+		sha1_store.jrecords++;
+	}
+}
+
+/**
+ * @return whether the image is currently being rewritten.
+ */
+bool
+sha1_store_compacting(void)
+{
+	bool writing;
+
+	mutex_lock(&sha1_store_mtx);
+	writing = sha1_store_writing;
+	mutex_unlock(&sha1_store_mtx);
+
+	return writing;
+}
+
+/**
+ * @return whether the journal is large enough to warrant a compaction.
+ */
+bool
+sha1_store_needs_compaction(void)
+{
+	size_t threshold;
+
+	threshold = sha1_store_count() / SHA1_STORE_JNL_RATIO;
+	threshold = MAX(threshold, SHA1_STORE_JNL_MIN);
+
+	return sha1_store.jrecords >= threshold && !sha1_store_compacting();
+}
+
+/**
+ * Create a new snapshot builder.
+ *
+ * @param hint		expected amount of records
+ */
+sha1_store_builder_t *
+sha1_store_builder_new(size_t hint)
+{
+	sha1_store_builder_t *b;
+
+	WALLOC0(b);
+	b->magic = SHA1_STORE_BUILDER_MAGIC;
+	b->capacity = MAX(hint, 16);
+	HALLOC_ARRAY(b->recs, b->capacity);
+	b->scapacity = b->capacity * 64;
+	b->strings = halloc(b->scapacity);
+	b->dir = atom_str_get(sha1_store.dir);
+
+	return b;
+}
+
+/**
+ * Add record to the snapshot.
+ */
+void
+sha1_store_builder_add(sha1_store_builder_t *b,
+	const char *path, const struct sha1_store_record *rec)
+{
+	struct sha1_store_brec *br;
+	size_t len;
+
+	sha1_store_builder_check(b);
+	g_assert(path != NULL);
+	g_assert(rec != NULL);
+
+	len = strlen(path);
+
+	if G_UNLIKELY(len > MAX_INT_VAL(uint32))
+		return;
+
+	if G_UNLIKELY(b->count == b->capacity) {
+		b->capacity *= 2;
+		HREALLOC_ARRAY(b->recs, b->capacity);
+	}
+
+	while G_UNLIKELY(b->slen + len + 1 > b->scapacity) {
+		b->scapacity *= 2;
+		b->strings = hrealloc(b->strings, b->scapacity);
+	}
+
+	br = &b->recs[b->count++];
+	br->hash = sha1_store_hash(path, len);
+	br->plen = len;
+	br->poff = b->slen;
+	br->rec = *rec;
+
+	memcpy(&b->strings[b->slen], path, len + 1);	/* Includes NUL */
+	b->slen += len + 1;
+}
+
+/**
+ * @return amount of records in the snapshot.
+ */
+size_t
+sha1_store_builder_count(const sha1_store_builder_t *b)
+{
+	sha1_store_builder_check(b);
+	return b->count;
+}
+
+/**
+ * Free snapshot builder and nullify its pointer.
+ */
+void
+sha1_store_builder_free(sha1_store_builder_t **b_ptr)
+{
+	sha1_store_builder_t *b = *b_ptr;
+
+	if (b != NULL) {
+		sha1_store_builder_check(b);
+		HFREE_NULL(b->recs);
+		HFREE_NULL(b->strings);
+		atom_str_free_null(&b->dir);
+		b->magic = 0;
+		WFREE(b);
+		*b_ptr = NULL;
+	}
+}
+
+/**
+ * Write the image for the snapshot.
+ *
+ * @return TRUE on success.
+ */
+static bool
+sha1_store_write(const sha1_store_builder_t *b)
+{
+	uint8 hdr[SHA1_STORE_HDR_SIZE], rbuf[SHA1_STORE_REC_SIZE];
+	uint8 *index;
+	size_t buckets, isize, i;
+	uint32 mask;
+	file_path_t fp;
+	FILE *f;
+	bool ok;
+
+	sha1_store_builder_check(b);
+
+	/*
+	 * Build the index, keeping the load factor under 1/2.
+	 */
+
+	buckets = next_pow2(MAX(16, 2 * b->count + 1));
+	isize = 4 * buckets;
+	index = vmm_alloc0(isize);
+	mask = buckets - 1;
+
+	for (i = 0; i < b->count; i++) {
+		uint32 j = b->recs[i].hash & mask;
+
+		while (0 != peek_le32(index + 4 * (size_t) j))
+			j = (j + 1) & mask;
+
+		poke_le32(index + 4 * (size_t) j, i + 1);
+	}
+
+	ZERO(&hdr);
+	memcpy(hdr + SHA1_STORE_HDR_MAGIC, SHA1_STORE_MAGIC, 8);
+	poke_le32(hdr + SHA1_STORE_HDR_VERSION, SHA1_STORE_VERSION);
+	poke_le32(hdr + SHA1_STORE_HDR_COUNT, b->count);
+	poke_le32(hdr + SHA1_STORE_HDR_BUCKETS, buckets);
+	poke_le64(hdr + SHA1_STORE_HDR_INDEX, SHA1_STORE_HDR_SIZE);
+	poke_le64(hdr + SHA1_STORE_HDR_RECORDS, SHA1_STORE_HDR_SIZE + isize);
+	poke_le64(hdr + SHA1_STORE_HDR_STRINGS,
+		SHA1_STORE_HDR_SIZE + isize + SHA1_STORE_REC_SIZE * (uint64) b->count);
+	poke_le64(hdr + SHA1_STORE_HDR_STRLEN, b->slen);
+
+	file_path_set(&fp, b->dir, SHA1_STORE_FILE);
+	f = file_config_open_write("SHA-1 cache", &fp);
+
+	if (NULL == f) {
+		vmm_free(index, isize);
+		return FALSE;
+	}
+
+	fwrite(hdr, sizeof hdr, 1, f);
+	fwrite(index, isize, 1, f);
+	vmm_free(index, isize);
+
+	for (i = 0; i < b->count; i++) {
+		const struct sha1_store_brec *br = &b->recs[i];
+
+		ZERO(&rbuf);
+		poke_le32(rbuf + SHA1_STORE_REC_HASH, br->hash);
+		poke_le32(rbuf + SHA1_STORE_REC_PLEN, br->plen);
+		poke_le64(rbuf + SHA1_STORE_REC_POFF, br->poff);
+		poke_le64(rbuf + SHA1_STORE_REC_FSIZE, br->rec.size);
+		poke_le64(rbuf + SHA1_STORE_REC_MTIME, br->rec.mtime);
+		memcpy(rbuf + SHA1_STORE_REC_SHA1, br->rec.sha1.data, SHA1_RAW_SIZE);
+		if (br->rec.has_tth) {
+			memcpy(rbuf + SHA1_STORE_REC_TTH, br->rec.tth.data, TTH_RAW_SIZE);
+			poke_le32(rbuf + SHA1_STORE_REC_FLAGS, SHA1_STORE_F_TTH);
+		}
+		fwrite(rbuf, sizeof rbuf, 1, f);
+	}
+
+	fwrite(b->strings, b->slen, 1, f);
+
+	if (ferror(f)) {
+		g_warning("%s(): cannot write SHA-1 cache: %m", G_STRFUNC);
+		fclose(f);
+		return FALSE;
+	}
+
+	ok = file_config_close(f, &fp);
+
+	if (ok) {
+		char *path = make_pathname(b->dir, SHA1_STORE_ROTATED);
+
+		/*
+		 * The rotated journal is now part of the image.
+		 */
+
+		if (-1 == unlink(path) && ENOENT != errno)
+			g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+
+		HFREE_NULL(path);
+	}
+
+	return ok;
+}
+
+/**
+ * Write the new image and signal its availability.
+ */
+static void
+sha1_store_complete(sha1_store_builder_t *b)
+{
+	bool ok;
+
+	ok = sha1_store_write(b);
+
+	if (GNET_PROPERTY(share_debug)) {
+		size_t n = b->count;
+		g_debug("%s(): %s %zu entr%s", G_STRFUNC,
+			ok ? "wrote" : "failed to write", n, plural_y(n));
+	}
+
+	sha1_store_builder_free(&b);
+
+	mutex_lock(&sha1_store_mtx);
+	sha1_store_writing = FALSE;
+	if (ok)
+		sha1_store_generation++;
+	cond_broadcast(&sha1_store_cond, &sha1_store_mtx);
+	mutex_unlock(&sha1_store_mtx);
+}
+
+/**
+ * Background thread writing the new image.
+ */
+static void *
+sha1_store_writer(void *arg)
+{
+	thread_set_name("SHA1 cache");
+	sha1_store_complete(arg);
+	return NULL;
+}
+
+/**
+ * Commit snapshot as the new image, which will be written by a background
+ * thread.  Ownership of the builder is transferred and its pointer nullified.
+ *
+ * @return TRUE if the snapshot was committed, FALSE if the image could not
+ * be rewritten, because there is a pending rewrite already.
+ */
+bool
+sha1_store_commit(sha1_store_builder_t **b_ptr)
+{
+	sha1_store_builder_t *b = *b_ptr;
+	char *jpath, *rpath;
+
+	sha1_store_builder_check(b);
+	g_assert(sha1_store.dir != NULL);
+
+	mutex_lock(&sha1_store_mtx);
+
+	if (sha1_store_writing) {
+		mutex_unlock(&sha1_store_mtx);
+		sha1_store_builder_free(b_ptr);
+		return FALSE;
+	}
+
+	sha1_store_writing = TRUE;
+	mutex_unlock(&sha1_store_mtx);
+
+	/*
+	 * Rotate the journal: all its records are in the snapshot.
+	 *
+	 * We keep the rotated journal around until the image is written, in
+	 * case we crash before that.  Any older rotated journal can be safely
+	 * overwritten since it was replayed and its content is also part of
+	 * the snapshot.
+	 */
+
+	fd_forget_and_close(&sha1_store.jfd);
+	sha1_store.jrecords = 0;
+
+	jpath = make_pathname(sha1_store.dir, SHA1_STORE_JOURNAL);
+	rpath = make_pathname(sha1_store.dir, SHA1_STORE_ROTATED);
+
+	if (-1 == rename(jpath, rpath) && ENOENT != errno)
+		g_warning("%s(): cannot rename \"%s\": %m", G_STRFUNC, jpath);
+
+	HFREE_NULL(jpath);
+	HFREE_NULL(rpath);
+
+	if (
+		-1 == thread_create(sha1_store_writer, b,
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN)
+	) {
+		g_warning("%s(): cannot create writer thread: %m", G_STRFUNC);
+		sha1_store_complete(b);		/* Write synchronously */
+	}
+
+	*b_ptr = NULL;
+	return TRUE;
+}
+
+/**
+ * Open the SHA1 cache held in the directory.
+ *
+ * @return TRUE if the image was found and mapped.
+ */
+bool
+sha1_store_open(const char *dir)
+{
+	g_assert(dir != NULL);
+	g_assert(NULL == sha1_store.dir);
+
+	sha1_store.dir = atom_str_get(dir);
+
+	mutex_lock(&sha1_store_mtx);
+	sha1_store.generation = sha1_store_generation;
+	mutex_unlock(&sha1_store_mtx);
+
+	return sha1_store_map();
+}
+
+/**
+ * Close the SHA1 cache, waiting for any pending image rewrite.
+ */
+void
+sha1_store_close(void)
+{
+	mutex_lock(&sha1_store_mtx);
+	while (sha1_store_writing)
+		cond_wait(&sha1_store_cond, &sha1_store_mtx);
+	mutex_unlock(&sha1_store_mtx);
+
+	fd_forget_and_close(&sha1_store.jfd);
+	sha1_store_unmap();
+	atom_str_free_null(&sha1_store.dir);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
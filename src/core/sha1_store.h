@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Binary persistent storage of the SHA1 cache.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_sha1_store_h_
+#define _core_sha1_store_h_
+
+#include "common.h"
+
+#include "lib/misc.h"		/* For struct tth */
+#include "lib/sha1.h"
+
+/**
+ * A SHA1 cache record, as held in the store or in the journal.
+ */
+struct sha1_store_record {
+	filesize_t size;			/**< File size */
+	time_t mtime;				/**< Last modification time */
+	struct sha1 sha1;			/**< SHA-1 of file */
+	struct tth tth;				/**< TTH of file, if has_tth is set */
+	bool has_tth;				/**< Whether TTH is known */
+};
+
+typedef void (*sha1_store_cb_t)(const char *path,
+	const struct sha1_store_record *rec, void *data);
+
+typedef struct sha1_store_builder sha1_store_builder_t;
+
+/*
+ * Public interface.
+ */
+
+bool sha1_store_open(const char *dir);
+void sha1_store_close(void);
+
+bool sha1_store_lookup(const char *path, struct sha1_store_record *rec);
+void sha1_store_foreach(sha1_store_cb_t cb, void *data);
+size_t sha1_store_count(void);
+
+void sha1_store_replay(sha1_store_cb_t cb, void *data);
+void sha1_store_append(const char *path, const struct sha1_store_record *rec);
+bool sha1_store_needs_compaction(void);
+bool sha1_store_compacting(void);
+
+sha1_store_builder_t *sha1_store_builder_new(size_t hint);
+void sha1_store_builder_add(sha1_store_builder_t *b,
+	const char *path, const struct sha1_store_record *rec);
+size_t sha1_store_builder_count(const sha1_store_builder_t *b);
+void sha1_store_builder_free(sha1_store_builder_t **b_ptr);
+bool sha1_store_commit(sha1_store_builder_t **b_ptr);
+
+#endif /* _core_sha1_store_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -70,6 +70,7 @@
 #include "lib/atoms.h"
 #include "lib/barrier.h"
 #include "lib/bg.h"
+#include "lib/cond.h"
 #include "lib/cq.h"
 #include "lib/crash.h"
 #include "lib/endian.h"
@@ -79,9 +80,12 @@
 #include "lib/hashing.h"
 #include "lib/hikset.h"
 #include "lib/hset.h"
+#include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/listener.h"
 #include "lib/mime_type.h"
+#include "lib/mutex.h"
+#include "lib/path.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
@@ -91,6 +95,7 @@
 #include "lib/tsig.h"
 #include "lib/utf8.h"
 #include "lib/vsort.h"
+#include "lib/watcher.h"
 #include "lib/walloc.h"
 #include "lib/xmalloc.h"
 
@@ -177,6 +182,9 @@ static hset_t *extensions;	/* Shared filename extensions */
 static pslist_t *shared_dirs;
 static cevent_t *share_qrp_rebuild_ev;
 
+static void share_watch_install(htable_t *dirs);
+static void share_paths_free(void);
+
 static hset_t *partial_files;	/* Contains partial files, thread-safe */
 
 /*
@@ -1496,6 +1504,561 @@ share_tthset_free(hset_t *set)
 	hset_free_null(&set);
 }
 
+/**
+ * Classify a directory entry found whilst scanning a shared directory.
+ *
+ * Hidden entries, entries of unknown type, files with an unshared extension
+ * and symbolic links we are configured to ignore are discarded.  Otherwise
+ * the entry is stat()ed and its full path is returned, the caller then
+ * looking at the filled ``sb'' to determine whether it is a directory to
+ * recurse into or a regular file to share.
+ *
+ * @param dir		the directory being scanned
+ * @param de		the directory entry returned by readdir()
+ * @param sb		where the status of the entry is returned
+ * @param ticks		if non-NULL, incremented when stat() calls were made
+ *
+ * @return the halloc()'ed full path of the entry, NULL if it is skipped.
+ */
+static char *
+recursive_scan_entry(const char *dir, const struct dirent *de,
+	filestat_t *sb, int *ticks)
+{
+	const char *filename = dir_entry_filename(de);
+	char *fullpath;
+
+	if (GNET_PROPERTY(share_debug) > 19)
+		g_debug("SHARE considering entry \"%s\"", filename);
+
+	if ('.' == filename[0]) {
+		/* Hidden file, or "." or ".." */
+		return NULL;
+	}
+
+	sb->st_mode = dir_entry_mode(de);
+	switch (sb->st_mode) {
+	case 0:
+	case S_IFREG:
+	case S_IFDIR:
+	case S_IFLNK:
+		break;
+	default:
+		if (GNET_PROPERTY(share_debug)) {
+			g_warning("skipping file of unknown type \"%s\" in \"%s\"",
+				dir, filename);
+		}
+		return NULL;
+	}
+
+	if (
+		S_ISLNK(sb->st_mode) &&
+		GNET_PROPERTY(scan_ignore_symlink_dirs) &&
+		GNET_PROPERTY(scan_ignore_symlink_regfiles)
+	) {
+		if (GNET_PROPERTY(share_debug) > 15) {
+			g_debug("SHARE to-be-ignored symlink, discarding \"%s\"",
+				filename);
+		}
+		return NULL;
+	}
+
+	if (
+		S_ISREG(sb->st_mode) &&
+		!shared_file_valid_extension(filename)
+	) {
+		if (GNET_PROPERTY(share_debug) > 15) {
+			g_debug("SHARE unshared extension, discarding \"%s\"",
+				filename);
+		}
+		return NULL;
+	}
+
+	if (ticks != NULL)
+		*ticks += 10;	/* Heavier work */
+
+	fullpath = make_pathname(dir, filename);
+	if (S_ISREG(sb->st_mode) || S_ISDIR(sb->st_mode)) {
+		if (stat(fullpath, sb)) {
+			g_warning("stat() failed %s: %m", fullpath);
+			goto skip;
+		}
+	} else if (!S_ISLNK(sb->st_mode)) {
+		if (lstat(fullpath, sb)) {
+			g_warning("lstat() failed %s: %m", fullpath);
+			goto skip;
+		}
+
+		if (
+			S_ISLNK(sb->st_mode) &&
+			GNET_PROPERTY(scan_ignore_symlink_dirs) &&
+			GNET_PROPERTY(scan_ignore_symlink_regfiles)
+		) {
+			/*
+			 * We check this again because dir_entry_mode() does not
+			 * work everywhere.
+			 */
+			if (GNET_PROPERTY(share_debug) > 15) {
+				g_debug("SHARE to-be-ignored symlink, discarding \"%s\"",
+					filename);
+			}
+			goto skip;
+		}
+	}
+
+	/* Get info on the symlinked file */
+	if (S_ISLNK(sb->st_mode)) {
+		if (stat(fullpath, sb)) {
+			g_warning("broken symlink %s: %m", fullpath);
+			goto skip;
+		}
+
+		/*
+		 * For symlinks, we check whether we are supposed to process
+		 * symlinks for that type of entry, then either proceed or skip the
+		 * entry.
+		 */
+
+		if (
+			S_ISDIR(sb->st_mode) &&
+			GNET_PROPERTY(scan_ignore_symlink_dirs)
+		) {
+			if (GNET_PROPERTY(share_debug) > 15)
+				g_debug("SHARE discarding symlink dir \"%s\"", filename);
+			goto skip;
+		}
+		if (
+			S_ISREG(sb->st_mode) &&
+			GNET_PROPERTY(scan_ignore_symlink_regfiles)
+		) {
+			if (GNET_PROPERTY(share_debug) > 15)
+				g_debug("SHARE discarding symlink file \"%s\"", filename);
+			goto skip;
+		}
+	}
+
+	if (S_ISDIR(sb->st_mode) || S_ISREG(sb->st_mode))
+		return fullpath;
+
+	/* FALL THROUGH */
+
+skip:
+	HFREE_NULL(fullpath);
+	return NULL;
+}
+
+/*
+ * Parallel directory scanning.
+ *
+ * When the "scan_threads" property is larger than 1, directory traversal
+ * and the stat() calls on each entry are performed by a pool of worker
+ * threads, which is what dominates rescan time on network filesystems or
+ * large RAID volumes.  Each worker processes one directory at a time and
+ * produces a batch listing the regular files found there, along with their
+ * status.  Sub-directories are queued back for other workers to pick.
+ *
+ * The library task then merges these batches into its scanning context,
+ * calling share_scan_add_file() itself: this routine looks at the SHA1
+ * cache and the fileinfo structures, which must not be accessed from the
+ * workers.
+ */
+
+#define SHARE_SCAN_WAIT_MS	100	/**< Max wait for batches in library thread */
+
+/**
+ * A directory to be scanned.
+ */
+struct share_scan_dir {
+	const char *base_dir;		/**< Shared root it belongs to (atom) */
+	char *path;					/**< Directory to scan (halloc()'ed) */
+};
+
+/**
+ * A regular file found by a scanning thread.
+ */
+struct share_scan_entry {
+	char *fullpath;				/**< Full path of file (halloc()'ed) */
+	filestat_t sb;				/**< Status of the file */
+};
+
+/**
+ * The files found in a scanned directory.
+ */
+struct share_scan_batch {
+	const char *base_dir;		/**< Shared root it belongs to (atom) */
+	const char *dir;			/**< Scanned directory (atom) */
+	struct share_scan_entry *entries;	/**< Files found (halloc()'ed) */
+	size_t count;				/**< Amount of entries used */
+	size_t capacity;			/**< Allocated entries */
+};
+
+enum share_scan_pool_magic { SHARE_SCAN_POOL_MAGIC = 0x77c3a1e5 };
+
+/**
+ * The pool of scanning threads, shared with the library task.
+ *
+ * It is reference-counted because workers may outlive the scanning task when
+ * it is cancelled: each thread holds a reference, as does the task.
+ */
+struct share_scan_pool {
+	enum share_scan_pool_magic magic;
+	mutex_t lock;				/**< Protects all fields below */
+	cond_t work;				/**< Signals new directories to scan */
+	cond_t done;				/**< Signals new batches or end of scan */
+	slist_t *dirs;				/**< Queued struct share_scan_dir */
+	slist_t *batches;			/**< Completed struct share_scan_batch */
+	uint pending;				/**< Directories queued or being scanned */
+	uint threads;				/**< Running threads */
+	uint refcnt;				/**< Reference count */
+	bool cancelled;				/**< Whether scan was cancelled */
+};
+
+static inline void
+share_scan_pool_check(const struct share_scan_pool * const sp)
+{
+	g_assert(sp != NULL);
+	g_assert(SHARE_SCAN_POOL_MAGIC == sp->magic);
+}
+
+static void
+share_scan_dir_free(void *data)
+{
+	struct share_scan_dir *sd = data;
+
+	atom_str_free_null(&sd->base_dir);
+	HFREE_NULL(sd->path);
+	WFREE(sd);
+}
+
+static void
+share_scan_batch_free(void *data)
+{
+	struct share_scan_batch *sb = data;
+	size_t i;
+
+	for (i = 0; i < sb->count; i++) {
+		HFREE_NULL(sb->entries[i].fullpath);
+	}
+	HFREE_NULL(sb->entries);
+	atom_str_free_null(&sb->base_dir);
+	atom_str_free_null(&sb->dir);
+	WFREE(sb);
+}
+
+/**
+ * Remove a reference on the scanning pool, freeing it with the last one.
+ */
+static void
+share_scan_pool_unref(struct share_scan_pool *sp)
+{
+	bool last;
+
+	share_scan_pool_check(sp);
+
+	mutex_lock(&sp->lock);
+	g_assert(sp->refcnt != 0);
+	last = 0 == --sp->refcnt;
+	mutex_unlock(&sp->lock);
+
+	if (!last)
+		return;
+
+	slist_free_all(&sp->dirs, share_scan_dir_free);
+	slist_free_all(&sp->batches, share_scan_batch_free);
+	cond_destroy(&sp->work);
+	cond_destroy(&sp->done);
+	mutex_destroy(&sp->lock);
+	sp->magic = 0;
+	WFREE(sp);
+}
+
+/**
+ * Scan a directory from a worker thread.
+ *
+ * @param sp		the scanning pool
+ * @param sd		the directory to scan
+ * @param subdirs	where sub-directories to scan are appended
+ *
+ * @return the batch of files found, NULL if directory cannot be scanned.
+ */
+static struct share_scan_batch *
+share_scan_directory(struct share_scan_pool *sp,
+	const struct share_scan_dir *sd, slist_t *subdirs)
+{
+	struct share_scan_batch *sb;
+	struct dirent *de;
+	DIR *d;
+	uint n = 0;
+
+	if (directory_is_unshareable(sd->path))
+		return NULL;
+
+	if (NULL == (d = opendir(sd->path))) {
+		g_warning("can't open directory %s: %m", sd->path);
+		return NULL;
+	}
+
+	if (GNET_PROPERTY(share_debug) > 5)
+		g_debug("SHARE scanning directory \"%s\"", sd->path);
+
+	/*
+	 * We produce a batch even when the directory holds no file, so that
+	 * the library task knows about all the directories it shares.
+	 */
+
+	WALLOC0(sb);
+	sb->base_dir = atom_str_get(sd->base_dir);
+	sb->dir = atom_str_get(sd->path);
+
+	while (NULL != (de = readdir(d))) {
+		filestat_t buf;
+		char *fullpath;
+
+		/*
+		 * Periodically check whether the scan was cancelled, to avoid
+		 * uselessly stat()ing a large directory.
+		 */
+
+		if (0 == (++n & 0x3f) && atomic_bool_get(&sp->cancelled))
+			break;
+
+		fullpath = recursive_scan_entry(sd->path, de, &buf, NULL);
+		if (NULL == fullpath)
+			continue;
+
+		if (S_ISDIR(buf.st_mode)) {
+			struct share_scan_dir *sub;
+
+			WALLOC(sub);
+			sub->base_dir = atom_str_get(sd->base_dir);
+			sub->path = fullpath;
+			slist_append(subdirs, sub);
+		} else {
+			struct share_scan_entry *e;
+
+			if (sb->count == sb->capacity) {
+				sb->capacity = MAX(16, sb->capacity * 2);
+				HREALLOC_ARRAY(sb->entries, sb->capacity);
+			}
+			e = &sb->entries[sb->count++];
+			e->fullpath = fullpath;
+			e->sb = buf;
+		}
+	}
+
+	closedir(d);
+
+	if (GNET_PROPERTY(share_debug) > 6)
+		g_debug("SHARE leaving directory \"%s\"", sd->path);
+
+	return sb;
+}
+
+/**
+ * Scanning thread main loop.
+ */
+static void *
+share_scan_thread_main(void *arg)
+{
+	struct share_scan_pool *sp = arg;
+	slist_t *subdirs = slist_new();
+
+	share_scan_pool_check(sp);
+
+	thread_set_name("share scan");
+
+	mutex_lock(&sp->lock);
+
+	for (;;) {
+		struct share_scan_dir *sd;
+		struct share_scan_batch *sb;
+		uint n;
+
+		while (
+			!sp->cancelled && 0 != sp->pending &&
+			0 == slist_length(sp->dirs)
+		) {
+			cond_wait(&sp->work, &sp->lock);
+		}
+
+		if (sp->cancelled || 0 == sp->pending)
+			break;
+
+		sd = slist_shift(sp->dirs);
+		mutex_unlock(&sp->lock);
+
+		sb = share_scan_directory(sp, sd, subdirs);
+		share_scan_dir_free(sd);
+
+		mutex_lock(&sp->lock);
+
+		/*
+		 * Sub-directories are accounted for before the directory we just
+		 * scanned is removed from the pending count, so that it can only
+		 * drop to zero once the whole tree was traversed.
+		 */
+
+		n = slist_length(subdirs);
+		while (0 != slist_length(subdirs)) {
+			slist_prepend(sp->dirs, slist_shift(subdirs));
+		}
+		sp->pending += n;
+		g_assert(sp->pending != 0);
+		sp->pending--;
+
+		if (sb != NULL)
+			slist_append(sp->batches, sb);
+
+		if (n > 1 || 0 == sp->pending)
+			cond_broadcast(&sp->work, &sp->lock);
+		else if (1 == n)
+			cond_signal(&sp->work, &sp->lock);
+
+		if (sb != NULL || 0 == sp->pending)
+			cond_signal(&sp->done, &sp->lock);
+	}
+
+	g_assert(sp->threads != 0);
+	sp->threads--;
+	cond_signal(&sp->done, &sp->lock);
+	mutex_unlock(&sp->lock);
+
+	slist_free_all(&subdirs, share_scan_dir_free);
+	share_scan_pool_unref(sp);
+
+	return NULL;
+}
+
+/**
+ * Create a scanning pool and launch threads to scan the given directories.
+ *
+ * @param base_dirs		list of directories to scan (string atoms)
+ * @param count			amount of threads to launch
+ *
+ * @return the scanning pool, NULL if no thread could be created.
+ */
+static struct share_scan_pool *
+share_scan_pool_launch(const slist_t *base_dirs, uint count)
+{
+	struct share_scan_pool *sp;
+	slist_iter_t *iter;
+	uint i;
+
+	WALLOC0(sp);
+	sp->magic = SHARE_SCAN_POOL_MAGIC;
+	mutex_init(&sp->lock);
+	cond_init(&sp->work, &sp->lock);
+	cond_init(&sp->done, &sp->lock);
+	sp->dirs = slist_new();
+	sp->batches = slist_new();
+	sp->refcnt = 1;					/* Reference held by the scanning task */
+
+	iter = slist_iter_on_head(base_dirs);
+	while (slist_iter_has_item(iter)) {
+		const char *dir = slist_iter_next(iter);
+		struct share_scan_dir *sd;
+
+		WALLOC(sd);
+		sd->base_dir = atom_str_get(dir);
+		sd->path = h_strdup(dir);
+		slist_append(sp->dirs, sd);
+		sp->pending++;
+	}
+	slist_iter_free(&iter);
+
+	mutex_lock(&sp->lock);
+
+	for (i = 0; i < count; i++) {
+		int r;
+
+		/*
+		 * Threads are detached and not cancelable: they end when the whole
+		 * tree was scanned or when we flag the pool as cancelled.
+		 */
+
+		r = thread_create(share_scan_thread_main, sp,
+				THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+				THREAD_STACK_MIN);
+
+		if (-1 == r) {
+			g_warning("%s(): cannot create scanning thread #%u: %m",
+				G_STRFUNC, i + 1);
+			break;
+		}
+
+		sp->threads++;
+		sp->refcnt++;
+	}
+
+	i = sp->threads;
+	mutex_unlock(&sp->lock);
+
+	if (0 == i) {
+		share_scan_pool_unref(sp);
+		return NULL;
+	}
+
+	if (GNET_PROPERTY(share_debug))
+		g_debug("SHARE scanning library with %u thread%s", i, plural(i));
+
+	return sp;
+}
+
+/**
+ * Cancel scanning and release the reference held by the scanning task.
+ */
+static void
+share_scan_pool_cancel(struct share_scan_pool **sp_ptr)
+{
+	struct share_scan_pool *sp = *sp_ptr;
+
+	if (sp != NULL) {
+		share_scan_pool_check(sp);
+
+		mutex_lock(&sp->lock);
+		atomic_bool_set(&sp->cancelled, TRUE);
+		cond_broadcast(&sp->work, &sp->lock);
+		mutex_unlock(&sp->lock);
+
+		share_scan_pool_unref(sp);
+		*sp_ptr = NULL;
+	}
+}
+
+/**
+ * Fetch next batch of scanned files.
+ *
+ * @param sp		the scanning pool
+ * @param wait		whether we can wait for a batch to become available
+ * @param finished	set to TRUE when the whole tree was scanned
+ *
+ * @return next batch, NULL if none is available yet or scan is finished.
+ */
+static struct share_scan_batch *
+share_scan_pool_next(struct share_scan_pool *sp, bool wait, bool *finished)
+{
+	struct share_scan_batch *sb;
+
+	share_scan_pool_check(sp);
+
+	mutex_lock(&sp->lock);
+
+	sb = slist_shift(sp->batches);
+
+	if (NULL == sb && 0 != sp->pending && wait) {
+		tm_t timeout;
+
+		timeout.tv_sec = 0;
+		timeout.tv_usec = SHARE_SCAN_WAIT_MS * 1000;
+		cond_timed_wait(&sp->done, &sp->lock, &timeout);
+		sb = slist_shift(sp->batches);
+	}
+
+	*finished = NULL == sb && 0 == sp->pending;
+	mutex_unlock(&sp->lock);
+
+	return sb;
+}
+
 enum recursive_scan_magic { RECURSIVE_SCAN_MAGIC = 0x16926d87U };
 
 struct recursive_scan {
@@ -1519,6 +2082,10 @@ struct recursive_scan {
 	shared_file_t **ftable;		/* cloned file_table, contains ref-counted sf */
 	search_table_t *search_tb;	/* the new search table */
 	search_table_t *partial_tb;	/* the new partial table */
+	struct share_scan_pool *pool;	/* scanning threads, if any */
+	htable_t *dirs;				/* scanned dir -> base dir (atoms) */
+	struct share_scan_batch *batch;	/* batch being merged */
+	size_t batch_idx;			/* next entry to merge in batch */
 	size_t partial_files_count;	/* amount of partials in hset when we started */
 	uint64 files_scanned;		/* amount of files shared in the library */
 	uint64 bytes_scanned;		/* size of the library */
@@ -1560,6 +2127,32 @@ recursive_scan_new(const pslist_t *base_dirs, time_t now)
 	return ctx;
 }
 
+/**
+ * Record a directory being scanned, so that we can monitor it for changes
+ * once the new library is installed.
+ */
+static void
+recursive_scan_record_dir(struct recursive_scan *ctx,
+	const char *dir, const char *base_dir)
+{
+	if (ctx->dirs != NULL && !htable_contains(ctx->dirs, dir)) {
+		htable_insert(ctx->dirs,
+			atom_str_get(dir), deconstify_char(atom_str_get(base_dir)));
+	}
+}
+
+/**
+ * Free recorded directories -- hash table iterator callback.
+ */
+static void
+recursive_scan_dir_free_kv(const void *key, void *value, void *unused_data)
+{
+	(void) unused_data;
+
+	atom_str_free(key);
+	atom_str_free(value);
+}
+
 static void
 recursive_scan_closedir(struct recursive_scan *ctx)
 {
@@ -1619,6 +2212,12 @@ recursive_scan_context_free(void *data)
 	recursive_scan_check(ctx);
 
 	recursive_scan_closedir(ctx);
+	share_scan_pool_cancel(&ctx->pool);
+
+	if (ctx->batch != NULL) {
+		share_scan_batch_free(ctx->batch);
+		ctx->batch = NULL;
+	}
 
 	slist_iter_free(&ctx->iter);
 	slist_free_all(&ctx->base_dirs, scan_base_dir_free);
@@ -1627,6 +2226,10 @@ recursive_scan_context_free(void *data)
 	slist_free_all(&ctx->partial_files, recursive_sf_unref);
 
 	htable_free_null(&ctx->basenames);
+	if (ctx->dirs != NULL) {
+		htable_foreach(ctx->dirs, recursive_scan_dir_free_kv, NULL);
+		htable_free_null(&ctx->dirs);
+	}
 	st_free(&ctx->search_tb);
 	st_free(&ctx->partial_tb);
 	atom_str_free_null(&ctx->base_dir);
@@ -1749,6 +2352,7 @@ recursive_scan_opendir(struct recursive_scan *ctx, const char * const dir)
 		ctx->relative_path = NULL;
 	}
 	ctx->current_dir = atom_str_get(dir);
+	recursive_scan_record_dir(ctx, dir, ctx->base_dir);
 
 	if (GNET_PROPERTY(share_debug) > 5)
 		g_debug("SHARE scanning directory \"%s\"", ctx->current_dir);
@@ -1757,7 +2361,6 @@ recursive_scan_opendir(struct recursive_scan *ctx, const char * const dir)
 static void
 recursive_scan_readdir(struct recursive_scan *ctx)
 {
-	char *fullpath = NULL;
 	struct dirent *dir_entry;
 
 	recursive_scan_check(ctx);
@@ -1765,138 +2368,33 @@ recursive_scan_readdir(struct recursive_scan *ctx)
 
 	dir_entry = readdir(ctx->directory);
 	if (dir_entry) {
-		const char *filename = dir_entry_filename(dir_entry);
 		filestat_t sb;
+		char *fullpath;
 
-		if (GNET_PROPERTY(share_debug) > 19)
-			g_debug("SHARE considering entry \"%s\"", filename);
+		fullpath =
+			recursive_scan_entry(ctx->current_dir, dir_entry, &sb, &ctx->ticks);
 
-		if ('.' == filename[0]) {
-			/* Hidden file, or "." or ".." */
-			goto finish;
-		}
-
-		sb.st_mode = dir_entry_mode(dir_entry);
-		switch (sb.st_mode) {
-		case 0:
-		case S_IFREG:
-		case S_IFDIR:
-		case S_IFLNK:
-			break;
-		default:
-			if (GNET_PROPERTY(share_debug)) {
-				g_warning("skipping file of unknown type \"%s\" in \"%s\"",
-					ctx->current_dir, filename);
-			}
-			goto finish;
-		}
-
-		if (
-			S_ISLNK(sb.st_mode) &&
-			GNET_PROPERTY(scan_ignore_symlink_dirs) &&
-			GNET_PROPERTY(scan_ignore_symlink_regfiles)
-		) {
-			if (GNET_PROPERTY(share_debug) > 15) {
-				g_debug("SHARE to-be-ignored symlink, discarding \"%s\"",
-					filename);
-			}
-			goto finish;
-		}
-
-		if (
-			S_ISREG(sb.st_mode) &&
-			!shared_file_valid_extension(filename)
-		) {
-			if (GNET_PROPERTY(share_debug) > 15) {
-				g_debug("SHARE unshared extension, discarding \"%s\"",
-					filename);
-			}
-			goto finish;
-		}
-
-		ctx->ticks += 10;	/* Heavier work */
-
-		fullpath = make_pathname(ctx->current_dir, filename);
-		if (S_ISREG(sb.st_mode) || S_ISDIR(sb.st_mode)) {
-			if (stat(fullpath, &sb)) {
-				g_warning("stat() failed %s: %m", fullpath);
-				goto finish;
-			}
-		} else if (!S_ISLNK(sb.st_mode)) {
-			if (lstat(fullpath, &sb)) {
-				g_warning("lstat() failed %s: %m", fullpath);
-				goto finish;
-			}
-
-			if (
-				S_ISLNK(sb.st_mode) &&
-				GNET_PROPERTY(scan_ignore_symlink_dirs) &&
-				GNET_PROPERTY(scan_ignore_symlink_regfiles)
-			) {
-				/*
-				 * We check this again because dir_entry_mode() does not
-				 * work everywhere.
-				 */
-				if (GNET_PROPERTY(share_debug) > 15) {
-					g_debug("SHARE to-be-ignored symlink, discarding \"%s\"",
-						filename);
-				}
-				goto finish;
-			}
-		}
-
-		/* Get info on the symlinked file */
-		if (S_ISLNK(sb.st_mode)) {
-			if (stat(fullpath, &sb)) {
-				g_warning("broken symlink %s: %m", fullpath);
-				goto finish;
-			}
-
-			/*
-			 * For symlinks, we check whether we are supposed to process
-			 * symlinks for that type of entry, then either proceed or skip the
-			 * entry.
-			 */
-
-			if (
-				S_ISDIR(sb.st_mode) &&
-				GNET_PROPERTY(scan_ignore_symlink_dirs)
-			) {
-				if (GNET_PROPERTY(share_debug) > 15)
-					g_debug("SHARE discarding symlink dir \"%s\"", filename);
-				goto finish;
-			}
-			if (
-				S_ISREG(sb.st_mode) &&
-				GNET_PROPERTY(scan_ignore_symlink_regfiles)
-			) {
-				if (GNET_PROPERTY(share_debug) > 15)
-					g_debug("SHARE discarding symlink file \"%s\"", filename);
-				goto finish;
-			}
-		}
+		if (NULL == fullpath)
+			return;
 
 		if (S_ISDIR(sb.st_mode)) {
 			/* If a directory, add to list for later processing */
 			slist_prepend(ctx->sub_dirs, fullpath);
-			fullpath = NULL;
-		} else if (S_ISREG(sb.st_mode)) {
+		} else {
 			shared_file_t *sf;
 
 			if (GNET_PROPERTY(share_debug) > 10)
-				g_debug("SHARE adding file \"%s\"", filename);
+				g_debug("SHARE adding file \"%s\"", filepath_basename(fullpath));
 
 			sf = share_scan_add_file(ctx->relative_path, fullpath, &sb);
 			if (sf) {
 				slist_append(ctx->shared_files, shared_file_ref(sf));
 			}
+			HFREE_NULL(fullpath);
 		}
 	} else {
 		recursive_scan_closedir(ctx);
 	}
-
-finish:
-	HFREE_NULL(fullpath);
 }
 
 /**
@@ -2047,6 +2545,80 @@ recursive_scan_next_dir(struct recursive_scan *ctx)
 	}
 }
 
+/**
+ * Merge the files found by the scanning threads.
+ *
+ * @return TRUE if finished.
+ */
+static bool
+recursive_scan_merge(struct recursive_scan *ctx, int ticks)
+{
+	recursive_scan_check(ctx);
+
+	while (ctx->ticks < ticks) {
+		struct share_scan_batch *sb = ctx->batch;
+		struct share_scan_entry *e;
+		shared_file_t *sf;
+
+		bg_task_cancel_test(ctx->task);
+
+		if (NULL == sb) {
+			bool finished;
+
+			/*
+			 * When running in the main thread, we must not block whilst
+			 * the scanning threads are busy: just come back later.
+			 */
+
+			sb = share_scan_pool_next(ctx->pool,
+				THREAD_MAIN_ID != share_thread_id, &finished);
+
+			if (finished)
+				return TRUE;
+
+			if (NULL == sb)
+				return FALSE;
+
+			recursive_scan_record_dir(ctx, sb->dir, sb->base_dir);
+
+			if (0 == sb->count) {
+				share_scan_batch_free(sb);
+				ctx->ticks++;
+				continue;
+			}
+
+			ctx->batch = sb;
+			ctx->batch_idx = 0;
+
+			atom_str_free_null(&ctx->relative_path);
+			if (GNET_PROPERTY(search_results_expose_relative_paths))
+				ctx->relative_path = get_relative_path(sb->base_dir, sb->dir);
+		}
+
+		g_assert(ctx->batch_idx < sb->count);
+
+		e = &sb->entries[ctx->batch_idx++];
+
+		if (GNET_PROPERTY(share_debug) > 10)
+			g_debug("SHARE adding file \"%s\"", e->fullpath);
+
+		sf = share_scan_add_file(ctx->relative_path, e->fullpath, &e->sb);
+		if (sf) {
+			slist_append(ctx->shared_files, shared_file_ref(sf));
+		}
+
+		if (ctx->batch_idx == sb->count) {
+			share_scan_batch_free(sb);
+			ctx->batch = NULL;
+			atom_str_free_null(&ctx->relative_path);
+		}
+
+		ctx->ticks += 10;
+	}
+
+	return FALSE;
+}
+
 static bgret_t
 recursive_scan_step_compute(struct bgtask *bt, void *data, int ticks)
 {
@@ -2055,6 +2627,35 @@ recursive_scan_step_compute(struct bgtask *bt, void *data, int ticks)
 	recursive_scan_check(ctx);
 
 	ctx->ticks = 0;
+
+	/*
+	 * On the first invocation, launch the scanning threads if configured
+	 * to do so.  We fall back to a sequential scan from the task if no
+	 * thread can be created.
+	 */
+
+	if (
+		NULL == ctx->pool && NULL == ctx->directory && NULL == ctx->base_dir &&
+		GNET_PROPERTY(scan_threads) > 1 && slist_length(ctx->base_dirs) != 0
+	) {
+		ctx->pool = share_scan_pool_launch(ctx->base_dirs,
+			GNET_PROPERTY(scan_threads));
+		if (ctx->pool != NULL) {
+			while (0 != slist_length(ctx->base_dirs)) {
+				atom_str_free(slist_shift(ctx->base_dirs));
+			}
+		}
+	}
+
+	if (ctx->pool != NULL) {
+		if (recursive_scan_merge(ctx, ticks)) {
+			share_scan_pool_cancel(&ctx->pool);
+			bg_task_ticks_used(bt, ctx->ticks);
+			return BGR_NEXT;
+		}
+		return BGR_MORE;
+	}
+
 	do {
 		if (recursive_scan_next_dir(ctx)) {
 			bg_task_ticks_used(bt, ctx->ticks);
@@ -2422,6 +3023,13 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 
 	shared_file_slist_free_null(&files);
 
+	/*
+	 * The library path index used to apply changes refers to the former
+	 * library, it will be rebuilt by the next round of changes.
+	 */
+
+	share_paths_free();
+
 	/*
 	 * If we're not running in the main thread, we need to funnel this
 	 * back as property changes can trigger GUI updates which we can't
@@ -2845,6 +3453,16 @@ recursive_scan_finalize(void *arg)
 	qrp_finalize_computation(ctx->words);
 	ctx->words = NULL;		/* Gave pointer, QRP computation will free it */
 
+	/*
+	 * After a library rescan, monitor the directories we scanned so that
+	 * we can update the library as soon as files are added or removed.
+	 */
+
+	if (ctx->dirs != NULL) {
+		share_watch_install(ctx->dirs);
+		ctx->dirs = NULL;		/* Gave pointer, it was freed */
+	}
+
 	/*
 	 * The very first time we are scanning the library, make sure we
 	 * prune the SHA1 cache to remove entries listed there that do not
@@ -2942,6 +3560,7 @@ share_rescan_create_task(bgsched_t *bs)
 	struct recursive_scan *ctx;
 
 	ctx = recursive_scan_new(shared_dirs, tm_time());
+	ctx->dirs = htable_create(HASH_KEY_STRING, 0);
 
 	return ctx->task = bg_task_create(bs, "recursive scan",
 				steps, N_ITEMS(steps),
@@ -3080,6 +3699,964 @@ share_lib_qrp_rebuild(bool force)
 	}
 }
 
+/*
+ * Incremental library updates.
+ *
+ * Once the library has been scanned, we monitor the shared directories
+ * for changes (when the kernel lets us do that) and apply them directly
+ * to the installed library: new files get a fresh index at the end of the
+ * file table and are inserted into the search table, removed files are
+ * de-indexed, as shared_file_remove() does.  Changes are coalesced for
+ * SHARE_WATCH_DELAY_MS before being applied, and then the QRP table is
+ * recomputed from the in-core library, producing a patch covering only
+ * the slots that changed.
+ *
+ * Changes are recorded by the main thread, which receives the watcher
+ * events, and are handed over to the library thread.  The library thread
+ * checks the files and walks the new directories, then funnels back to the
+ * main thread the updates of the monitored directories and of the search
+ * table, which the main thread uses to answer queries.
+ *
+ * De-indexed files remain listed in the search bins (they are filtered out
+ * when matching) until the next full rescan reclaims them.
+ */
+
+#define SHARE_WATCH_DELAY_MS	(2 * 1000)	/**< Coalescing period */
+#define SHARE_WATCH_MAX_ENTRIES	10000		/**< Max entries in new dirs */
+
+enum share_delta {
+	SHARE_DELTA_UPDATE = 1,		/**< File added or changed */
+	SHARE_DELTA_REMOVE,			/**< File removed */
+	SHARE_DELTA_DIR_ADD,		/**< Directory added */
+	SHARE_DELTA_DIR_REMOVE		/**< Directory removed */
+};
+
+/**
+ * A recorded change.
+ */
+struct share_delta_rec {
+	enum share_delta what;		/**< The change */
+	const char *base_dir;		/**< Shared directory of the path (atom) */
+};
+
+static htable_t *share_watched;		/**< Watched dir -> base dir (atoms) */
+static htable_t *share_deltas;		/**< Path (atom) -> share_delta_rec */
+static cevent_t *share_delta_ev;	/**< Coalescing timer */
+
+/**
+ * The library indexed by path, only accessed from the library thread.
+ *
+ * It is built by the first round of changes following a rescan, then kept
+ * up-to-date as changes are applied, and discarded by the next rescan.
+ */
+static htable_t *share_paths;		/**< Path -> shared file (ref-counted) */
+
+/**
+ * Context used by the library thread whilst applying changes.
+ */
+struct share_delta_ctx {
+	pslist_t *added;			/**< New files to insert (ref-counted) */
+	pslist_t *removed;			/**< Files to de-index (ref-counted) */
+	pslist_t *unwatched;		/**< Removed directories (atoms) */
+	size_t entries;				/**< Entries seen in new directories */
+	bool changed;				/**< Whether library was changed */
+	bool rescan;				/**< Whether full rescan is needed */
+};
+
+/**
+ * Request to monitor a new directory, funneled to the main thread.
+ */
+struct share_watch_req {
+	const char *dir;			/**< Directory to monitor */
+	const char *base_dir;		/**< Shared directory it belongs to */
+	bool ok;					/**< Set to TRUE if directory is monitored */
+};
+
+/**
+ * Free watched directory -- hash table iterator callback.
+ */
+static bool
+share_watch_free_kv(const void *key, void *value, void *unused_data)
+{
+	(void) unused_data;
+
+	watcher_unregister_dir(key);
+	atom_str_free(key);
+	atom_str_free(value);
+
+	return TRUE;
+}
+
+/**
+ * Free recorded change -- hash table iterator callback.
+ */
+static bool
+share_delta_free_kv(const void *key, void *value, void *unused_data)
+{
+	struct share_delta_rec *rec = value;
+
+	(void) unused_data;
+
+	atom_str_free(key);
+	atom_str_free_null(&rec->base_dir);
+	WFREE(rec);
+	return TRUE;
+}
+
+/**
+ * Free path index entry -- hash table iterator callback.
+ */
+static bool
+share_paths_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	shared_file_t *sf = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	shared_file_unref(&sf);
+	return TRUE;
+}
+
+/**
+ * Discard the library path index.
+ */
+static void
+share_paths_free(void)
+{
+	if (share_paths != NULL) {
+		htable_foreach_remove(share_paths, share_paths_free_kv, NULL);
+		htable_free_null(&share_paths);
+	}
+}
+
+/**
+ * Build the library path index if not already done.
+ *
+ * Files are referenced by the index, so that they cannot vanish under
+ * our feet.
+ */
+static void
+share_paths_load(void)
+{
+	size_t i, n;
+
+	if (share_paths != NULL)
+		return;
+
+	share_paths = htable_create(HASH_KEY_STRING, 0);
+
+	SHARED_LIBFILE_LOCK;
+
+	n = shared_libfile.file_table != NULL ? shared_libfile.files_scanned : 0;
+
+	for (i = 0; i < n; i++) {
+		shared_file_t *sf = shared_libfile.file_table[i];
+
+		if (sf != NULL)
+			htable_insert(share_paths, sf->file_path, shared_file_ref(sf));
+	}
+
+	SHARED_LIBFILE_UNLOCK;
+
+	if (GNET_PROPERTY(share_debug) > 1) {
+		n = htable_count(share_paths);
+		g_debug("SHARE indexed %zu library path%s", n, plural(n));
+	}
+}
+
+/**
+ * Record a file in the library path index.
+ */
+static void
+share_paths_insert(shared_file_t *sf)
+{
+	const void *key;
+	void *value;
+
+	if (htable_lookup_extended(share_paths, sf->file_path, &key, &value)) {
+		shared_file_t *old = value;
+
+		htable_remove(share_paths, key);
+		shared_file_unref(&old);
+	}
+
+	htable_insert(share_paths, sf->file_path, shared_file_ref(sf));
+}
+
+static void share_delta_timer(cqueue_t *cq, void *unused_obj);
+
+/**
+ * Arm the coalescing timer, if not already done.
+ */
+static void
+share_delta_arm(void)
+{
+	if (NULL == share_delta_ev)
+		share_delta_ev = cq_main_insert(SHARE_WATCH_DELAY_MS,
+			share_delta_timer, NULL);
+}
+
+/**
+ * Find the shared directory holding a path.
+ *
+ * @return the base directory, NULL if path is not in a monitored directory.
+ */
+static const char *
+share_watch_base_dir(const char *path)
+{
+	char *dir = filepath_directory(path);
+	const char *base_dir = NULL;
+
+	if (dir != NULL && share_watched != NULL)
+		base_dir = htable_lookup(share_watched, dir);
+
+	HFREE_NULL(dir);
+	return base_dir;
+}
+
+/**
+ * Record change to apply to the library, arming the coalescing timer.
+ */
+static void
+share_delta_record(const char *path, enum share_delta what)
+{
+	struct share_delta_rec *rec;
+	const char *base_dir = NULL;
+	const void *key;
+	void *value;
+
+	g_assert(thread_is_main());
+
+	/*
+	 * The shared directory of the path is looked up now, since the table
+	 * of monitored directories is only accessed from the main thread.
+	 */
+
+	if (SHARE_DELTA_UPDATE == what || SHARE_DELTA_DIR_ADD == what) {
+		base_dir = share_watch_base_dir(path);
+		if (NULL == base_dir)
+			return;
+	}
+
+	if (NULL == share_deltas)
+		share_deltas = htable_create(HASH_KEY_STRING, 0);
+
+	/* The latest change for a path supersedes any earlier one */
+
+	if (htable_lookup_extended(share_deltas, path, &key, &value)) {
+		rec = value;
+		atom_str_free_null(&rec->base_dir);
+	} else {
+		WALLOC(rec);
+		htable_insert(share_deltas, atom_str_get(path), rec);
+	}
+
+	rec->what = what;
+	rec->base_dir = NULL == base_dir ? NULL : atom_str_get(base_dir);
+
+	share_delta_arm();
+}
+
+/**
+ * Discard all the recorded changes.
+ */
+static void
+share_delta_clear(void)
+{
+	if (share_deltas != NULL)
+		htable_foreach_remove(share_deltas, share_delta_free_kv, NULL);
+}
+
+/**
+ * Watcher callback, invoked when a shared directory changes.
+ */
+static void
+share_watch_event(enum watcher_event ev,
+	const char *path, const char *old_path, void *unused_udata)
+{
+	(void) unused_udata;
+
+	if (GNET_PROPERTY(share_debug) > 2) {
+		g_debug("SHARE %s \"%s\"%s%s%s", watcher_event_to_string(ev), path,
+			NULL == old_path ? "" : " (was \"",
+			NULL == old_path ? "" : old_path,
+			NULL == old_path ? "" : "\")");
+	}
+
+	if (!GNET_PROPERTY(library_watch_changes))
+		return;
+
+	switch (ev) {
+	case WATCHER_ADDED:
+	case WATCHER_CHANGED:
+		share_delta_record(path, SHARE_DELTA_UPDATE);
+		return;
+	case WATCHER_REMOVED:
+		share_delta_record(path, SHARE_DELTA_REMOVE);
+		return;
+	case WATCHER_RENAMED:
+		share_delta_record(old_path, SHARE_DELTA_REMOVE);
+		share_delta_record(path, SHARE_DELTA_UPDATE);
+		return;
+	case WATCHER_DIR_ADDED:
+		share_delta_record(path, SHARE_DELTA_DIR_ADD);
+		return;
+	case WATCHER_DIR_REMOVED:
+		share_delta_record(path, SHARE_DELTA_DIR_REMOVE);
+		return;
+	case WATCHER_OVERFLOW:
+		/*
+		 * Events were lost, we can only rescan everything.
+		 */
+		g_warning("lost track of changes in shared directories, rescanning");
+		share_delta_clear();
+		share_lib_rescan();
+		return;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Start monitoring a directory.
+ *
+ * @param dir		the directory to monitor
+ * @param base_dir	the shared directory it belongs to
+ *
+ * @return TRUE if directory is now monitored.
+ */
+static bool
+share_watch_dir(const char *dir, const char *base_dir)
+{
+	g_assert(thread_is_main());
+
+	if (htable_contains(share_watched, dir))
+		return TRUE;
+
+	if (!watcher_register_dir(dir, share_watch_event, NULL))
+		return FALSE;
+
+	htable_insert(share_watched,
+		atom_str_get(dir), deconstify_char(atom_str_get(base_dir)));
+
+	return TRUE;
+}
+
+/**
+ * Stop monitoring a removed directory and all the directories below it.
+ */
+static void
+share_unwatch_dir(const char *dir)
+{
+	htable_iter_t *iter;
+	const void *key;
+	void *value;
+	pslist_t *sl, *gone = NULL;
+
+	g_assert(thread_is_main());
+
+	iter = htable_iter_new(share_watched);
+
+	while (htable_iter_next(iter, &key, &value)) {
+		const char *p = is_strprefix(key, dir);
+
+		if (p != NULL && (is_dir_separator(*p) || '\0' == *p))
+			gone = pslist_prepend(gone, deconstify_char(key));
+	}
+
+	htable_iter_release(&iter);
+
+	PSLIST_FOREACH(gone, sl) {
+		const void *k;
+		void *v;
+
+		if (htable_lookup_extended(share_watched, sl->data, &k, &v)) {
+			htable_remove(share_watched, k);
+			share_watch_free_kv(k, v, NULL);
+		}
+	}
+
+	pslist_free(gone);
+}
+
+/**
+ * Install directory monitoring after a library rescan.
+ *
+ * @param dirs	scanned dir -> base dir table (atoms), taken over
+ */
+static void
+share_watch_install(htable_t *dirs)
+{
+	htable_iter_t *iter;
+	const void *key;
+	void *value;
+	size_t n = 0;
+	bool ok = TRUE;
+
+	g_assert(thread_is_main());
+
+	if (NULL == share_watched)
+		share_watched = htable_create(HASH_KEY_STRING, 0);
+	else
+		htable_foreach_remove(share_watched, share_watch_free_kv, NULL);
+
+	if (GNET_PROPERTY(library_watch_changes) && watcher_dir_available()) {
+		iter = htable_iter_new(dirs);
+
+		while (ok && htable_iter_next(iter, &key, &value)) {
+			if (share_watch_dir(key, value))
+				n++;
+			else
+				ok = FALSE;		/* Probably out of watches */
+		}
+
+		htable_iter_release(&iter);
+	}
+
+	if (!ok) {
+		g_warning("monitoring only %zu shared director%s out of %zu, "
+			"other changes will wait for next rescan",
+			n, plural_y(n), htable_count(dirs));
+	} else if (GNET_PROPERTY(share_debug) && n != 0) {
+		g_debug("SHARE monitoring %zu shared director%s", n, plural_y(n));
+	}
+
+	htable_foreach(dirs, recursive_scan_dir_free_kv, NULL);
+	htable_free_null(&dirs);
+}
+
+/**
+ * Start monitoring a new directory -- RPC target in the main thread.
+ */
+static void *
+share_delta_watch_dir(void *arg)
+{
+	struct share_watch_req *req = arg;
+
+	req->ok = share_watch_dir(req->dir, req->base_dir);
+	return NULL;
+}
+
+/**
+ * Add new file to the library.
+ *
+ * @param dctx		the delta application context
+ * @param path		the file path
+ * @param base_dir	the shared directory holding the file
+ * @param sb		the status of the file, if known already
+ */
+static void
+share_delta_add_file(struct share_delta_ctx *dctx,
+	const char *path, const char *base_dir, const filestat_t *sb)
+{
+	const char *name, *relative_path = NULL;
+	shared_file_t *sf;
+	filestat_t buf;
+
+	if (NULL == sb) {
+		name = filepath_basename(path);
+
+		if ('.' == name[0] || !shared_file_valid_extension(name))
+			return;
+
+		if (-1 == lstat(path, &buf))
+			return;		/* Already gone */
+
+		if (S_ISLNK(buf.st_mode)) {
+			if (GNET_PROPERTY(scan_ignore_symlink_regfiles))
+				return;
+			if (-1 == stat(path, &buf))
+				return;		/* Broken symlink */
+		}
+
+		if (!S_ISREG(buf.st_mode))
+			return;
+
+		sb = &buf;
+	}
+
+	if (GNET_PROPERTY(search_results_expose_relative_paths)) {
+		char *dir = filepath_directory(path);
+		relative_path = get_relative_path(base_dir, dir);
+		HFREE_NULL(dir);
+	}
+
+	sf = share_scan_add_file(relative_path, path, sb);
+	atom_str_free_null(&relative_path);
+
+	if (sf != NULL)
+		dctx->added = pslist_prepend(dctx->added, shared_file_ref(sf));
+}
+
+/**
+ * Remove file from the library.
+ */
+static void
+share_delta_remove_file(struct share_delta_ctx *dctx, const char *path)
+{
+	const void *key;
+	void *value;
+
+	if (!htable_lookup_extended(share_paths, path, &key, &value))
+		return;
+
+	htable_remove(share_paths, key);
+
+	/* The reference held by the path index is given to the removed list */
+
+	dctx->removed = pslist_prepend(dctx->removed, value);
+}
+
+/**
+ * Recursively add the files of a new directory to the library.
+ */
+static void
+share_delta_add_dir(struct share_delta_ctx *dctx,
+	const char *dir, const char *base_dir)
+{
+	struct share_watch_req req;
+	struct dirent *de;
+	DIR *d;
+
+	if (directory_is_unshareable(dir))
+		return;
+
+	/*
+	 * Monitor the directory before reading it, so that files created
+	 * whilst we are reading it are not missed.
+	 */
+
+	req.dir = dir;
+	req.base_dir = base_dir;
+	req.ok = FALSE;
+
+	teq_safe_rpc(THREAD_MAIN_ID, share_delta_watch_dir, &req);
+
+	if (!req.ok) {
+		dctx->rescan = TRUE;	/* Cannot monitor it, need a full rescan */
+		return;
+	}
+
+	if (NULL == (d = opendir(dir))) {
+		g_warning("can't open directory %s: %m", dir);
+		return;
+	}
+
+	while (NULL != (de = readdir(d))) {
+		filestat_t sb;
+		char *fullpath;
+
+		/*
+		 * A large tree was moved in, it is best handled by a full rescan,
+		 * which runs as a background task and is not limited in size.
+		 */
+
+		if (dctx->entries++ >= SHARE_WATCH_MAX_ENTRIES) {
+			dctx->rescan = TRUE;
+			break;
+		}
+
+		fullpath = recursive_scan_entry(dir, de, &sb, NULL);
+		if (NULL == fullpath)
+			continue;
+
+		if (S_ISDIR(sb.st_mode))
+			share_delta_add_dir(dctx, fullpath, base_dir);
+		else
+			share_delta_add_file(dctx, fullpath, base_dir, &sb);
+
+		HFREE_NULL(fullpath);
+	}
+
+	closedir(d);
+}
+
+struct share_delta_dir {
+	struct share_delta_ctx *dctx;
+	const char *dir;
+};
+
+/**
+ * Collect files held in a removed directory -- hash table iterator callback.
+ */
+static bool
+share_delta_remove_dir_kv(const void *key, void *value, void *data)
+{
+	struct share_delta_dir *dd = data;
+	const char *p = is_strprefix(key, dd->dir);
+
+	if (NULL == p || !is_dir_separator(*p))
+		return FALSE;
+
+	/* The reference held by the path index is given to the removed list */
+
+	dd->dctx->removed = pslist_prepend(dd->dctx->removed, value);
+	return TRUE;
+}
+
+/**
+ * Remove all the files held in a directory, recursively.
+ */
+static void
+share_delta_remove_dir(struct share_delta_ctx *dctx, const char *dir)
+{
+	struct share_delta_dir dd;
+
+	dd.dctx = dctx;
+	dd.dir = dir;
+
+	htable_foreach_remove(share_paths, share_delta_remove_dir_kv, &dd);
+
+	dctx->unwatched =
+		pslist_prepend(dctx->unwatched, deconstify_char(atom_str_get(dir)));
+}
+
+/**
+ * Apply one recorded change -- hash table iterator callback.
+ */
+static bool
+share_delta_apply_kv(const void *key, void *value, void *data)
+{
+	struct share_delta_ctx *dctx = data;
+	const char *path = key;
+	struct share_delta_rec *rec = value;
+
+	switch (rec->what) {
+	case SHARE_DELTA_UPDATE:
+		share_delta_remove_file(dctx, path);
+		share_delta_add_file(dctx, path, rec->base_dir, NULL);
+		break;
+	case SHARE_DELTA_REMOVE:
+		share_delta_remove_file(dctx, path);
+		break;
+	case SHARE_DELTA_DIR_ADD:
+		share_delta_add_dir(dctx, path, rec->base_dir);
+		break;
+	case SHARE_DELTA_DIR_REMOVE:
+		share_delta_remove_dir(dctx, path);
+		break;
+	}
+
+	return share_delta_free_kv(key, value, NULL);
+}
+
+/**
+ * Update the installed library -- RPC target in the main thread.
+ *
+ * Monitored directories and the search table are only accessed from the
+ * main thread, hence this is where the changes collected by the library
+ * thread are applied.
+ */
+static void *
+share_delta_install(void *arg)
+{
+	struct share_delta_ctx *dctx = arg;
+	search_table_t *st;
+	size_t n;
+	pslist_t *sl;
+
+	PSLIST_FOREACH(dctx->unwatched, sl) {
+		share_unwatch_dir(sl->data);
+	}
+
+	PSLIST_FOREACH(dctx->removed, sl) {
+		shared_file_t *sf = sl->data;
+
+		if (!shared_file_indexed(sf))
+			continue;
+
+		if (GNET_PROPERTY(share_debug) > 1)
+			g_debug("SHARE removing \"%s\" from library", sf->file_path);
+
+		SHARED_LIBFILE_LOCK;
+		shared_libfile.bytes_scanned -= sf->file_size;
+		SHARED_LIBFILE_UNLOCK;
+
+		shared_file_deindex(sf);
+		dctx->changed = TRUE;
+	}
+
+	n = pslist_length(dctx->added);
+
+	if (0 == n)
+		goto done;
+
+	dctx->changed = TRUE;
+
+	/*
+	 * New files are the most recent ones, so appending them to the file
+	 * table keeps it sorted by mtime.
+	 */
+
+	SHARED_LIBFILE_LOCK;
+
+	HREALLOC_ARRAY(shared_libfile.file_table, shared_libfile.files_scanned + n);
+	HREALLOC_ARRAY(shared_libfile.sorted_file_table,
+		shared_libfile.files_scanned + n);
+	if (NULL == shared_libfile.file_basenames)
+		shared_libfile.file_basenames = htable_create(HASH_KEY_STRING, 0);
+
+	PSLIST_FOREACH(dctx->added, sl) {
+		shared_file_t *sf = sl->data;
+		uint64 idx = ++shared_libfile.files_scanned;
+		uint val;
+
+		shared_file_check(sf);
+
+		sf->file_index = idx;
+		sf->sort_index = 0;
+		shared_libfile.file_table[idx - 1] = sf;
+		shared_libfile.sorted_file_table[idx - 1] = NULL;
+		shared_libfile.bytes_scanned += sf->file_size;
+		shared_libfile.shared_files =
+			pslist_prepend_const(shared_libfile.shared_files,
+				shared_file_ref(sf));
+
+		val = pointer_to_uint(
+			htable_lookup(shared_libfile.file_basenames, sf->name_nfc));
+		val = (val != 0) ? FILENAME_CLASH : sf->file_index;
+		htable_insert(shared_libfile.file_basenames,
+			sf->name_nfc, uint_to_pointer(val));
+
+		sf->flags |= SHARE_F_INDEXED | SHARE_F_BASENAME;
+	}
+
+	st = st_refcnt_inc(shared_libfile.search_table);
+
+	SHARED_LIBFILE_UNLOCK;
+
+	/*
+	 * All the new files are inserted before the search table is compacted
+	 * again, so that its word index is only extended once per round.
+	 */
+
+	PSLIST_FOREACH(dctx->added, sl) {
+		shared_file_t *sf = sl->data;
+
+		st_insert_item(st, ST_SET_PLAIN, sf->name_canonic, sf);
+		if (sf->name_normal != NULL)
+			st_insert_item(st, ST_SET_ALIAS, sf->name_normal, sf);
+
+		upload_stats_enforce_local_filename(sf);
+		request_sha1(sf);
+	}
+
+	st_compact(st);
+	st_free(&st);
+
+done:
+	if (dctx->changed)
+		gcu_gui_update_files_scanned();
+
+	return NULL;
+}
+
+/**
+ * Rebuild the table of shared files sorted by name.
+ *
+ * Removed files leave NULL entries behind, which we move to the end of
+ * the table.
+ */
+static void
+share_delta_sort(void)
+{
+	shared_file_t **sorted;
+	size_t n, i, count;
+
+	SHARED_LIBFILE_LOCK;
+	n = shared_libfile.files_scanned;
+	sorted = 0 == n ? NULL : HCOPY_ARRAY(shared_libfile.file_table, n);
+	SHARED_LIBFILE_UNLOCK;
+
+	if (NULL == sorted)
+		return;
+
+	for (i = count = 0; i < n; i++) {
+		if (sorted[i] != NULL)
+			sorted[count++] = sorted[i];
+	}
+
+	vsort(sorted, count, sizeof sorted[0], shared_file_sort_by_name);
+
+	for (i = count; i < n; i++) {
+		sorted[i] = NULL;
+	}
+
+	SHARED_LIBFILE_LOCK;
+
+	if (n == shared_libfile.files_scanned) {
+		for (i = 0; i < count; i++) {
+			shared_file_t *sf = sorted[i];
+
+			/* Skip files de-indexed concurrently */
+			if (shared_file_indexed(sf))
+				sf->sort_index = i + 1;
+			else
+				sorted[i] = NULL;
+		}
+
+		HFREE_NULL(shared_libfile.sorted_file_table);
+		shared_libfile.sorted_file_table = sorted;
+		sorted = NULL;
+	}
+
+	SHARED_LIBFILE_UNLOCK;
+
+	HFREE_NULL(sorted);
+}
+
+/**
+ * Give back changes that could not be applied yet -- TEQ event in the
+ * main thread.
+ */
+static void
+share_delta_requeue(void *arg)
+{
+	htable_t *deltas = arg;
+	htable_iter_t *iter;
+	const void *key;
+	void *value;
+
+	if (NULL == share_deltas)
+		share_deltas = htable_create(HASH_KEY_STRING, 0);
+
+	iter = htable_iter_new(deltas);
+
+	while (htable_iter_next(iter, &key, &value)) {
+		/* Changes recorded since we handed these over are more recent */
+
+		if (htable_contains(share_deltas, key))
+			share_delta_free_kv(key, value, NULL);
+		else
+			htable_insert(share_deltas, key, value);
+	}
+
+	htable_iter_release(&iter);
+	htable_free_null(&deltas);
+
+	share_delta_arm();
+}
+
+/**
+ * Apply the recorded changes to the library.
+ *
+ * This runs in the library thread, which owns the `share_paths' index.
+ */
+static void
+share_thread_lib_delta(void *arg)
+{
+	htable_t *deltas = arg;
+	struct share_delta_ctx dctx;
+	pslist_t *sl;
+
+	/*
+	 * If a rescan is in progress, the changes we apply now could be lost.
+	 * Give them back to the main thread, to retry later.
+	 */
+
+	if (atomic_bool_get(&share_rebuilding)) {
+		teq_safe_post(THREAD_MAIN_ID, share_delta_requeue, deltas);
+		return;
+	}
+
+	if (GNET_PROPERTY(share_debug)) {
+		size_t count = htable_count(deltas);
+		g_debug("SHARE applying %zu library change%s",
+			count, plural(count));
+	}
+
+	ZERO(&dctx);
+	share_paths_load();
+
+	htable_foreach_remove(deltas, share_delta_apply_kv, &dctx);
+	htable_free_null(&deltas);
+
+	teq_safe_rpc(THREAD_MAIN_ID, share_delta_install, &dctx);
+
+	if (dctx.changed)
+		share_delta_sort();
+
+	PSLIST_FOREACH(dctx.added, sl) {
+		shared_file_t *sf = sl->data;
+		share_paths_insert(sf);
+		shared_file_unref(&sf);
+	}
+	pslist_free(dctx.added);
+
+	PSLIST_FOREACH(dctx.removed, sl) {
+		shared_file_t *sf = sl->data;
+		shared_file_unref(&sf);
+	}
+	pslist_free(dctx.removed);
+
+	PSLIST_FOREACH(dctx.unwatched, sl) {
+		atom_str_free(sl->data);
+	}
+	pslist_free(dctx.unwatched);
+
+	if (dctx.rescan)
+		share_thread_lib_rescan(NULL);
+	else if (dctx.changed)
+		share_thread_lib_qrp_rebuild(NULL);
+}
+
+/**
+ * Hand over the recorded changes to the library thread.
+ */
+static void
+share_lib_delta(void)
+{
+	htable_t *deltas = share_deltas;
+
+	share_deltas = NULL;
+	teq_post(share_thread_id, share_thread_lib_delta, deltas);
+}
+
+/**
+ * Callout queue callback to apply recorded changes to the library.
+ */
+static void
+share_delta_timer(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
+
+	cq_zero(cq, &share_delta_ev);
+
+	if (NULL == share_deltas || 0 == htable_count(share_deltas))
+		return;
+
+	/*
+	 * Wait for any rescan in progress to install its library: the changes
+	 * we apply now could be lost otherwise.
+	 */
+
+	if (atomic_bool_get(&share_rebuilding)) {
+		share_delta_arm();
+		return;
+	}
+
+	share_lib_delta();
+}
+
+/**
+ * Stop monitoring shared directories and discard pending changes.
+ */
+static void
+share_watch_close(void)
+{
+	cq_cancel(&share_delta_ev);
+
+	if (share_watched != NULL) {
+		htable_foreach_remove(share_watched, share_watch_free_kv, NULL);
+		htable_free_null(&share_watched);
+	}
+
+	share_delta_clear();
+	htable_free_null(&share_deltas);
+	share_paths_free();
+}
+
 /**
  * Is there work pending for the library thread, or is thread terminated?
  */
@@ -3270,6 +4847,7 @@ share_close(void)
 	 */
 
 	share_special_close();
+	share_watch_close();
 	free_extensions();
 	pslist_foreach(shared_libfile.shared_files, shared_file_detach, NULL);
 	share_free();
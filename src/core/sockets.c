@@ -93,6 +93,7 @@
 #include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #ifdef HAS_SOCKER_GET
@@ -123,6 +124,44 @@ enum {
 	SOCK_ADNS_ASYNC		= 1 << 3	/**< Signals async resolution */
 };
 
+#ifdef HAS_RECVMMSG
+/**
+ * A reception slot for recvmmsg().
+ */
+struct udp_rxslot {
+	socket_addr_t from;				/**< Sender address */
+	iovec_t iov;					/**< Points into the batch arena */
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+	union {
+		struct cmsghdr hdr;
+		size_t align;
+		char bytes[CMSG_SPACE(512)];
+	} cmsg;							/**< Control data (destination address) */
+#endif	/* CMSG_LEN && CMSG_SPACE */
+};
+
+/**
+ * Batched UDP reception context.
+ *
+ * Datagrams are read by recvmmsg() into the arena, each slot getting a
+ * buffer as large as the socket buffer so that truncation is detected
+ * exactly as when reading one datagram at a time.  They are then handed
+ * out one by one by socket_udp_accept() until the batch is exhausted.
+ *
+ * The arena size is capped to SOCK_UDP_ARENA_MAX, which limits the amount
+ * of slots for sockets with large buffers.
+ */
+struct udp_rxbatch {
+	struct mmsghdr *msg;			/**< Message headers for recvmmsg() */
+	struct udp_rxslot *slot;		/**< Per-datagram reception slots */
+	char *arena;					/**< Datagram buffers, one per slot */
+	size_t bufsize;					/**< Size of each datagram buffer */
+	uint size;						/**< Amount of slots */
+	uint count;						/**< Datagrams read by last recvmmsg() */
+	uint next;						/**< Index of next datagram to deliver */
+};
+#endif	/* HAS_RECVMMSG */
+
 struct gnutella_socket *s_tcp_listen = NULL;
 struct gnutella_socket *s_tcp_listen6 = NULL;
 struct gnutella_socket *s_udp_listen = NULL;
@@ -1540,6 +1579,28 @@ socket_udp_qfree(void *item, void *unused_data)
 	socket_udpq_free(item);
 }
 
+#ifdef HAS_RECVMMSG
+/**
+ * Free batched UDP reception context, if any.
+ */
+static void
+socket_udp_rxbatch_free(struct udpctx *uctx)
+{
+	struct udp_rxbatch *rxb = uctx->rxb;
+
+	if (NULL == rxb)
+		return;
+
+	vmm_free(rxb->arena, rxb->size * rxb->bufsize);
+	HFREE_NULL(rxb->msg);
+	HFREE_NULL(rxb->slot);
+	WFREE(rxb);
+	uctx->rxb = NULL;
+}
+#else	/* !HAS_RECVMMSG */
+#define socket_udp_rxbatch_free(u)
+#endif	/* HAS_RECVMMSG */
+
 /**
  * Dispose of socket, closing connection, removing input callback, and
  * reclaiming attached getline buffer.
@@ -1562,6 +1623,7 @@ socket_free(struct gnutella_socket *s)
 			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
+			socket_udp_rxbatch_free(uctx);
 			WFREE(s->resource.udp);
 		}
 	} else {
@@ -2739,9 +2801,10 @@ socket_udp_extract_dst_addr(const struct msghdr *msg, host_addr_t *dst_addr)
  * Note: for the Gnutella datagram socket this is udp_received().
  */
 static inline void
-socket_udp_process(gnutella_socket_t *s, bool truncated)
+socket_udp_process(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
-	(*s->resource.udp->data_ind)(s, s->buf, s->pos, truncated);
+	(*s->resource.udp->data_ind)(s, data, len, truncated);
 }
 
 /**
@@ -2807,16 +2870,246 @@ socket_udp_is_old(const gnutella_socket_t *s)
 	return booleanize(s->flags & SOCK_F_OLD);
 }
 
+/**
+ * Record origin of the datagram we just read and check it.
+ *
+ * @param s				the socket which received a datagram
+ * @param from_addr		the address of the sender
+ * @param r				the size of the datagram
+ * @param truncated		whether datagram was truncated
+ * @param dst_addr		if non-NULL, the address to which datagram was sent
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accepted(struct gnutella_socket *s, const socket_addr_t *from_addr,
+	ssize_t r, bool truncated, const host_addr_t *dst_addr, bool *truncation)
+{
+	/*
+	 * We're too low level to account for the proper bandwidth here as we
+	 * want to distinguish between UDP Gnutella traffic and DHT traffic.
+	 *
+	 * This will be done in udp_receieved() which we're about to call.
+	 */
+
+	s->pos = r;
+
+	/*
+	 * Record remote address.
+	 */
+
+	s->addr = socket_addr_get_addr(from_addr);
+	s->port = socket_addr_get_port(from_addr);
+
+	if (!is_host_addr(s->addr)) {
+		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
+		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
+		errno = EINVAL;
+		return (ssize_t) -1;
+	}
+
+	if (dst_addr != NULL) {
+		static host_addr_t last_addr;
+
+		settings_addr_changed(*dst_addr, s->addr);
+
+		/*
+		 * Show the destination address only when it differs from
+		 * the last seen or if the debug level is higher than 1.
+		 */
+
+		if (
+			GNET_PROPERTY(socket_debug) > 1 ||
+			!host_addr_equiv(last_addr, *dst_addr)
+		) {
+			last_addr = *dst_addr;
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): dst_addr=%s",
+					G_STRFUNC, host_addr_to_string(*dst_addr));
+			}
+		}
+	}
+
+	if (truncated)
+		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+
+	*truncation = truncated;
+	return r;
+}
+
+#ifdef HAS_RECVMMSG
+/**
+ * @return whether datagrams read by the last recvmmsg() call remain to be
+ * delivered on the socket.
+ */
+static inline bool
+socket_udp_batch_pending(const struct gnutella_socket *s)
+{
+	const struct udp_rxbatch *rxb = s->resource.udp->rxb;
+
+	return rxb != NULL && rxb->next < rxb->count;
+}
+
+/**
+ * @return whether we should read datagrams on the socket via recvmmsg().
+ */
+static inline bool
+socket_udp_batching(const struct gnutella_socket *s)
+{
+	if (socket_udp_batch_pending(s))
+		return TRUE;		/* Must finish delivering current batch */
+
+	return !(s->flags & SOCK_F_SINGLE) && GNET_PROPERTY(udp_batch_size) > 1;
+}
+
+/**
+ * Make sure the batched reception context of the socket has room for the
+ * configured amount of datagrams.
+ *
+ * @return the reception context.
+ */
+static struct udp_rxbatch *
+socket_udp_rxbatch_get(struct gnutella_socket *s)
+{
+	struct udpctx *uctx = s->resource.udp;
+	struct udp_rxbatch *rxb = uctx->rxb;
+	uint size;
+
+	size = MIN(GNET_PROPERTY(udp_batch_size), SOCK_UDP_BATCH_MAX);
+	size = MIN(size, SOCK_UDP_ARENA_MAX / s->buf_size);
+	size = MAX(size, 1);
+
+	if (rxb != NULL && rxb->size == size)
+		return rxb;
+
+	g_assert(!socket_udp_batch_pending(s));
+
+	socket_udp_rxbatch_free(uctx);
+
+	WALLOC0(rxb);
+	rxb->size = size;
+	rxb->bufsize = s->buf_size;
+	rxb->arena = vmm_alloc(size * rxb->bufsize);
+	HALLOC0_ARRAY(rxb->msg, size);
+	HALLOC0_ARRAY(rxb->slot, size);
+	uctx->rxb = rxb;
+
+	return rxb;
+}
+
+/**
+ * Read as many pending datagrams as possible from the socket, up to the
+ * configured batch size, in one single recvmmsg() call.
+ *
+ * @return -1 on error, the amount of datagrams read otherwise.
+ */
+static int
+socket_udp_rxbatch_fill(struct gnutella_socket *s)
+{
+	struct udp_rxbatch *rxb = socket_udp_rxbatch_get(s);
+	int r;
+	uint i;
+
+	for (i = 0; i < rxb->size; i++) {
+		static const struct msghdr zero_msg;
+		struct msghdr *msg = &rxb->msg[i].msg_hdr;
+		struct udp_rxslot *slot = &rxb->slot[i];
+
+		iovec_set(&slot->iov, &rxb->arena[i * rxb->bufsize], rxb->bufsize);
+
+		*msg = zero_msg;
+		msg->msg_namelen = socket_addr_init(&slot->from, s->net);
+		msg->msg_name = cast_to_pointer(socket_addr_get_sockaddr(&slot->from));
+		msg->msg_iov = &slot->iov;
+		msg->msg_iovlen = 1;
+
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+		ZERO(&slot->cmsg.hdr);
+		msg->msg_control = slot->cmsg.bytes;
+		msg->msg_controllen = sizeof slot->cmsg.bytes;
+#endif /* CMSG_LEN && CMSG_SPACE */
+	}
+
+	rxb->count = rxb->next = 0;
+	r = recvmmsg(s->file_desc, rxb->msg, rxb->size, 0, NULL);
+
+	if (-1 == r)
+		return -1;
+
+	rxb->count = r;
+
+	gnet_stats_inc_general(GNR_UDP_RX_BATCH_CALLS);
+	gnet_stats_count_general(GNR_UDP_RX_BATCH_DATAGRAMS, r);
+	gnet_stats_max_general(GNR_UDP_RX_BATCH_MAX, r);
+
+	return r;
+}
+
+/**
+ * Someone is sending us datagrams.  Read them in batch, delivering them
+ * one at a time.
+ *
+ * @param s				the socket which receives a datagram
+ * @param truncation	written with whether datagram was truncated
+ * @param data			written with the start of the datagram data
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accept_batched(struct gnutella_socket *s,
+	bool *truncation, const void **data)
+{
+	struct udp_rxbatch *rxb;
+	const struct msghdr *msg;
+	const struct udp_rxslot *slot;
+	bool truncated = FALSE, has_dst_addr = FALSE;
+	host_addr_t dst_addr;
+	ssize_t r;
+
+	if (!socket_udp_batch_pending(s)) {
+		if (-1 == socket_udp_rxbatch_fill(s))
+			return (ssize_t) -1;
+	}
+
+	rxb = s->resource.udp->rxb;
+	g_assert(rxb->next < rxb->count);
+
+	msg = &rxb->msg[rxb->next].msg_hdr;
+	slot = &rxb->slot[rxb->next];
+	r = rxb->msg[rxb->next].msg_len;
+	rxb->next++;
+
+	g_assert((size_t) r <= rxb->bufsize);
+
+#if defined(HAS_MSGHDR_MSG_FLAGS)
+	truncated = 0 != (MSG_TRUNC & msg->msg_flags);
+#endif
+
+	if (!GNET_PROPERTY(force_local_ip))
+		has_dst_addr = socket_udp_extract_dst_addr(msg, &dst_addr);
+
+	*data = slot->iov.iov_base;
+
+	return socket_udp_accepted(s, &slot->from, r, truncated,
+		has_dst_addr ? &dst_addr : NULL, truncation);
+}
+#else	/* !HAS_RECVMMSG */
+#define socket_udp_batch_pending(s)	FALSE
+#endif	/* HAS_RECVMMSG */
+
 /**
  * Someone is sending us a datagram.  Read it into the socket's buffer.
  *
  * @param s				the socket which receives a datagram
  * @param truncation	written with whether datagram was truncated
+ * @param data			written with the start of the datagram data
  *
  * @return -1 on error, the size of the datagram otherwise.
  */
 static ssize_t
-socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+socket_udp_accept(struct gnutella_socket *s,
+	bool *truncation, const void **data)
 {
 	socket_addr_t *from_addr;
 	struct sockaddr *from;
@@ -2829,6 +3122,11 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 	g_assert(s->flags & SOCK_F_UDP);
 	g_assert(s->type == SOCK_TYPE_UDP);
 
+#ifdef HAS_RECVMMSG
+	if (socket_udp_batching(s))
+		return socket_udp_accept_batched(s, truncation, data);
+#endif
+
 	/*
 	 * Receive the datagram in the socket's buffer.
 	 */
@@ -2902,63 +3200,18 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 
 	g_assert((size_t) r <= s->buf_size);
 
-	/*
-	 * We're too low level to account for the proper bandwidth here as we
-	 * want to distinguish between UDP Gnutella traffic and DHT traffic.
-	 *
-	 * This will be done in udp_receieved() which we're about to call.
-	 */
-
-	s->pos = r;
-
-	/*
-	 * Record remote address.
-	 */
-
-	s->addr = socket_addr_get_addr(from_addr);
-	s->port = socket_addr_get_port(from_addr);
+	*data = s->buf;
 
-	if (!is_host_addr(s->addr)) {
-		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
-		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
-		errno = EINVAL;
-		return (ssize_t) -1;
-	}
-
-	if (has_dst_addr) {
-		static host_addr_t last_addr;
-
-		settings_addr_changed(dst_addr, s->addr);
-
-		/*
-		 * Show the destination address only when it differs from
-		 * the last seen or if the debug level is higher than 1.
-		 */
-
-		if (
-			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
-		) {
-			last_addr = dst_addr;
-			if (GNET_PROPERTY(socket_debug)) {
-				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
-			}
-		}
-	}
-
-	if (truncated)
-		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
-
-	*truncation = truncated;
-	return r;
+	return socket_udp_accepted(s, from_addr, r, truncated,
+		has_dst_addr ? &dst_addr : NULL, truncation);
 }
 
 /**
  * Enqueue UDP datagram for deferred processing.
  */
 static void
-socket_udp_queue(gnutella_socket_t *s, bool truncated)
+socket_udp_queue(gnutella_socket_t *s,
+	const void *data, size_t len, bool truncated)
 {
 	struct udpctx *uctx;
 	struct udpq *uq;
@@ -2968,8 +3221,8 @@ socket_udp_queue(gnutella_socket_t *s, bool truncated)
 	uctx = s->resource.udp;
 
 	WALLOC0(uq);
-	uq->buf = wcopy(s->buf, s->pos);
-	uq->len = s->pos;
+	uq->buf = wcopy(data, len);
+	uq->len = len;
 	uq->queued = tm_time();
 	uq->truncated = booleanize(truncated);
 	uq->addr = s->addr;
@@ -3133,9 +3386,10 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 
 	for(;;) {
 		ssize_t r;
+		const void *data;
 
 		i++;
-		r = socket_udp_accept(s, &truncated);		/* Read datagram */
+		r = socket_udp_accept(s, &truncated, &data);	/* Read datagram */
 
 		if ((ssize_t) -1 == r) {
 			/* ECONNRESET is meaningless with UDP but happens on Windows */
@@ -3162,24 +3416,30 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		 */
 
 		if (enqueue) {
-			socket_udp_queue(s, truncated);				/* Enqueue it */
+			socket_udp_queue(s, data, r, truncated);	/* Enqueue it */
 			qd += r;
 			qn++;
 		} else {
-			socket_udp_process(s, truncated);			/* Process it */
+			socket_udp_process(s, data, r, truncated);	/* Process it */
 		}
 
 		avail = size_saturate_sub(avail, r);
 
-		/* kevent() reports 32 more bytes than there are, maybe
-		 * it refers to header or control msg data. */
-		if (avail <= 32)
+		/*
+		 * kevent() reports 32 more bytes than there are, maybe
+		 * it refers to header or control msg data.
+		 *
+		 * Datagrams already read in batch must however all be delivered
+		 * since nothing would trigger their processing otherwise.
+		 */
+
+		if (avail <= 32 && !socket_udp_batch_pending(s))
 			break;
 
 	next:
 
 		/* Process one event at a time if configured as such */
-		if (s->flags & SOCK_F_SINGLE)
+		if ((s->flags & SOCK_F_SINGLE) && !socket_udp_batch_pending(s))
 			break;
 
 		if (!enqueue) {
@@ -4324,8 +4584,8 @@ socket_set_single(struct gnutella_socket *s, bool on)
 /**
  * Creates a non-blocking listening UDP socket.
  *
- * Upon datagram reception, the ``data_ind'' callback is invoked. The received
- * data will be held in s->buf, being s->pos byte-long.
+ * Upon datagram reception, the ``data_ind'' callback is invoked with the
+ * received data, which is not necessarily held in s->buf.
  */
 struct gnutella_socket *
 socket_udp_listen(host_addr_t bind_addr, uint16 port,
@@ -4720,6 +4980,110 @@ socket_plain_sendto(
 	return ret;
 }
 
+/**
+ * Send several datagrams at once.
+ *
+ * Datagrams are sent in order, stopping at the first error.  The amount
+ * of bytes sent for each datagram is filled in the "sent" field.
+ *
+ * @return the amount of leading datagrams sent, -1 with errno set if the
+ * first datagram could not be sent.
+ */
+static int
+socket_plain_sendmmsg(struct wrap_io *wio, wrap_dgram_t *dg, int cnt)
+#ifdef HAS_SENDMMSG
+{
+	struct gnutella_socket *s = wio->ctx;
+	struct mmsghdr msg[SOCK_UDP_BATCH_MAX];
+	socket_addr_t addr[SOCK_UDP_BATCH_MAX];
+	iovec_t iov[SOCK_UDP_BATCH_MAX];
+	int i, n, r;
+
+	socket_check(s);
+	g_assert(!socket_uses_tls(s));
+	g_assert(cnt > 0);
+
+	n = MIN(cnt, SOCK_UDP_BATCH_MAX);
+
+	for (i = 0; i < n; i++) {
+		static const struct mmsghdr zero_msg;
+		host_addr_t ha;
+
+		if (!host_addr_convert(gnet_host_get_addr(dg[i].to), &ha, s->net)) {
+			if (GNET_PROPERTY(udp_debug)) {
+				g_carp("%s(): cannot convert %s to %s",
+					G_STRFUNC,
+					host_addr_to_string(gnet_host_get_addr(dg[i].to)),
+					net_type_to_string(s->net));
+			}
+			if (0 == i) {
+				errno = EINVAL;
+				return -1;
+			}
+			break;		/* Send what we have so far */
+		}
+
+		msg[i] = zero_msg;
+		msg[i].msg_hdr.msg_namelen =
+			socket_addr_set(&addr[i], ha, gnet_host_get_port(dg[i].to));
+		msg[i].msg_hdr.msg_name =
+			deconstify_pointer(socket_addr_get_const_sockaddr(&addr[i]));
+		iovec_set(&iov[i], deconstify_pointer(dg[i].data), dg[i].len);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	r = sendmmsg(s->file_desc, msg, i, 0);
+
+	if (-1 == r) {
+		if (GNET_PROPERTY(udp_debug)) {
+			int e = errno;
+			g_warning("sendmmsg() failed: %m");
+			errno = e;
+		}
+		return -1;
+	}
+
+	for (i = 0; i < r; i++) {
+		dg[i].sent = msg[i].msg_len;
+	}
+
+	gnet_stats_inc_general(GNR_UDP_TX_BATCH_CALLS);
+	gnet_stats_count_general(GNR_UDP_TX_BATCH_DATAGRAMS, r);
+	gnet_stats_max_general(GNR_UDP_TX_BATCH_MAX, r);
+
+	return r;
+}
+#else	/* !HAS_SENDMMSG */
+{
+	int i;
+
+	g_assert(cnt > 0);
+
+	for (i = 0; i < cnt; i++) {
+		ssize_t r = socket_plain_sendto(wio, dg[i].to, dg[i].data, dg[i].len);
+
+		if ((ssize_t) -1 == r)
+			return 0 == i ? -1 : i;
+
+		dg[i].sent = r;
+	}
+
+	return cnt;
+}
+#endif	/* HAS_SENDMMSG */
+
+static int
+socket_no_sendmmsg(struct wrap_io *unused_wio,
+	wrap_dgram_t *unused_dg, int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 static ssize_t
 socket_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	const void *unused_buf, size_t unused_size)
@@ -4800,12 +5164,14 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_plain_sendto;
+		s->wio.sendmmsg = socket_plain_sendmmsg;
 	} else if (SOCK_CONN_LISTENING == s->direction) {
 		s->wio.write = socket_no_write;
 		s->wio.read = socket_no_read;
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_no_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	} else if (socket_uses_tls(s)) {
 		tls_wio_link(s);
 	} else {
@@ -4815,6 +5181,7 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_plain_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_no_sendto;
+		s->wio.sendmmsg = socket_no_sendmmsg;
 	}
 }
 
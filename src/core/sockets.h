@@ -131,7 +131,8 @@ typedef struct gnutella_socket {
  * @param len			length of received data (not necessarily s->pos)
  * @param truncated		whether received datagram was truncated
  *
- * Data is held in s->buf and is s->pos byte-long.
+ * Data is not necessarily held in s->buf: it may have been read-ahead or
+ * received in batch along with other datagrams.
  */
 typedef void (*socket_udp_data_ind_t)(const gnutella_socket_t *s,
 	const void *data, size_t len, bool truncated);
@@ -153,6 +154,9 @@ struct tcpctx {
 	struct socket_ops *ops;		/**< Operational callbacks */
 };
 
+#define SOCK_UDP_BATCH_MAX	64		/**< Max datagrams per batched syscall */
+#define SOCK_UDP_ARENA_MAX	(512 * 1024)	/**< Max batched reception arena */
+
 /**
  * UDP socket queued datagrams.
  */
@@ -175,6 +179,7 @@ struct udpctx {
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct udp_rxbatch *rxb;			/**< Batched reception context */
 };
 
 static inline void
@@ -29,6 +29,10 @@
  *
  * This driver compresses its data stream before sending it to the link layer.
  *
+ * When requested at creation time and if the compression worker pool is
+ * enabled, compression is performed asynchronously by the pool threads and
+ * the compressed data are sent when the main thread is notified.
+ *
  * @author Raphael Manfredi
  * @date 2002-2003
  */
@@ -39,14 +43,22 @@
 
 #include "tx.h"
 #include "tx_deflate.h"
+#include "bsched.h"
 #include "hosts.h"
 #include "sockets.h"
+#include "zpool.h"
 
 #include "if/gnet_property_priv.h"
 
 #include "lib/cq.h"
 #include "lib/endian.h"
+#include "lib/halloc.h"
+#include "lib/iovec.h"
 #include "lib/mempcpy.h"
+#include "lib/pmsg.h"
+#include "lib/pslist.h"
+#include "lib/slist.h"
+#include "lib/stringify.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/zlib_util.h"
@@ -68,6 +80,12 @@
 #define BUFFER_COUNT	2
 #define BUFFER_NAGLE	500		/**< 500 ms */
 #define BUFFER_DELAY	2		/**< 2 secs -- max Nagle delay */
+#define ASYNC_INPUT		16384	/**< Max input held by workers (async mode) */
+
+#define DEFLATE_LEVEL			6		/**< Z_DEFAULT_COMPRESSION level */
+#define DEFLATE_ADAPT_PERIOD	10		/**< Secs between level adjustments */
+#define DEFLATE_ADAPT_MIN		16384	/**< Min input to adjust level */
+#define DEFLATE_ADAPT_GAIN		1.0		/**< Min bytes saved per CPU usec */
 
 struct buffer {
 	char *arena;				/**< Buffer arena */
@@ -106,6 +124,42 @@ struct attr {
 		uLong		crc;		/**< CRC-32 accumlator for gzip */
 	} gzip;
 	unsigned nagle:1;			/**< Whether to use Nagle or not */
+	/* Asynchronous mode */
+	zpool_stream_t *zs;			/**< Worker stream, NULL if synchronous */
+	slist_t *aout;				/**< Compressed messages awaiting sending */
+	size_t a_inflight;			/**< Input bytes handed to the workers */
+	size_t a_unflushed;			/**< Input bytes handed since last flush */
+	size_t a_queued;			/**< Compressed bytes awaiting sending */
+	uint a_jobs;				/**< Jobs not completed yet */
+	/* Adaptive compression level */
+	bsched_bws_t bws;			/**< Output scheduler, INVALID if fixed level */
+	int level;					/**< Current compression level */
+	int base_level;				/**< Initial compression level */
+	int want_level;				/**< Level to switch to at next flush */
+	uint64 adapt_input;			/**< Input bytes since last adjustment */
+	uint64 adapt_output;		/**< Output bytes since last adjustment */
+	uint64 adapt_ns;			/**< Nanoseconds spent compressing them */
+	time_t adapt_last;			/**< Time of last adjustment */
+};
+
+/**
+ * A compression job, in asynchronous mode.
+ *
+ * The input data are copied so that the upper layer sees them as consumed
+ * immediately.  Output is made of message blocks filled by the worker.
+ */
+struct deflate_job {
+	z_streamp outz;				/**< Compressing stream (owned by layer) */
+	char *in;					/**< Input data (halloc-ed), may be NULL */
+	size_t inlen;				/**< Input length */
+	size_t bufsize;				/**< Size of output message blocks */
+	pslist_t *out;				/**< Compressed output (pmsg_t) */
+	size_t outlen;				/**< Total output length */
+	int flush;					/**< Flushing mode for deflate() */
+	int ret;					/**< Z_OK, or zlib error */
+	int level;					/**< Level to switch to first, -1 if none */
+	int level_ret;				/**< Status of the level switch */
+	uint64 ns;					/**< Nanoseconds spent compressing */
 };
 
 /*
@@ -116,9 +170,12 @@ struct attr {
 #define DF_NAGLE		0x00000002	/**< Nagle timer started */
 #define DF_FLUSH		0x00000004	/**< Flushing started */
 #define DF_SHUTDOWN		0x00000008	/**< Stack has shut down */
+#define DF_FINISH		0x00000010	/**< Final flush requested (async mode) */
+#define DF_LEVEL		0x00000020	/**< Level switch in flight (async mode) */
 
 static void deflate_nagle_timeout(cqueue_t *cq, void *arg);
 static size_t tx_deflate_pending(txdrv_t *tx);
+static void deflate_async_flush(txdrv_t *tx);
 
 #define tx_deflate_debugging(lvl) \
 	G_UNLIKELY(GNET_PROPERTY(tx_deflate_debug) > (lvl) && \
@@ -306,6 +363,8 @@ deflate_buffered(const txdrv_t *tx)
 		buffered += b->wptr - b->rptr;
 	}
 
+	buffered += attr->a_inflight + attr->a_queued;	/* Async mode */
+
 	return buffered;
 }
 
@@ -335,6 +394,116 @@ deflate_set_flowc(txdrv_t *tx, bool on)
 		attr->cb->flow_control(tx->owner, on ? deflate_buffered(tx) : 0);
 }
 
+/**
+ * Account for time spent in zlib since ``start'', for adaptive streams.
+ */
+static void
+deflate_timed(struct attr *attr, const tm_nano_t *start)
+{
+	tm_nano_t end, elapsed;
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, start);
+	attr->adapt_ns += tmn2ns(&elapsed);
+}
+
+/**
+ * Record outcome of a compression level switch.
+ *
+ * @param tx	the driver
+ * @param level	the level we attempted to switch to
+ * @param ret	status returned by deflateParams()
+ */
+static void
+deflate_level_switched(txdrv_t *tx, int level, int ret)
+{
+	struct attr *attr = tx->opaque;
+
+	if (Z_OK != ret) {
+		if (tx_deflate_debugging(0)) {
+			g_debug("TX %s: (%s) cannot switch from level %d to %d: %s",
+				G_STRFUNC, gnet_host_to_string(&tx->host),
+				attr->level, level, zlib_strerror(ret));
+		}
+		if (level == attr->want_level)
+			attr->want_level = attr->level;	/* Retry at next adjustment */
+		return;
+	}
+
+	attr->level = level;
+
+	if (NULL != attr->cb->level_changed)
+		attr->cb->level_changed(tx->owner, attr->level);
+}
+
+/**
+ * Adjust the compression level of adaptive streams.
+ *
+ * Every DEFLATE_ADAPT_PERIOD seconds, we look at what the compression
+ * achieved during the period: the bytes saved per microsecond spent in zlib
+ * tell us whether compressing harder is still worth it.
+ *
+ * When the CPU is overloaded, we lower the level to save cycles.  When the
+ * outgoing bandwidth scheduler is saturated, bandwidth is what we lack so
+ * we raise the level, provided compression remains efficient.  Otherwise
+ * we move back towards the initial level.
+ *
+ * The new level is only applied at the next flush boundary, where zlib has
+ * no pending data to emit.
+ *
+ * @param tx		the driver
+ * @param input		input bytes compressed since last flush
+ * @param output	output bytes generated since last flush
+ */
+static void
+deflate_adapt(txdrv_t *tx, size_t input, size_t output)
+{
+	struct attr *attr = tx->opaque;
+	time_t now = tm_time();
+	double saved, efficiency;
+	int level;
+
+	attr->adapt_input += input;
+	attr->adapt_output += output;
+
+	if (delta_time(now, attr->adapt_last) < DEFLATE_ADAPT_PERIOD)
+		return;
+
+	if (attr->adapt_input < DEFLATE_ADAPT_MIN)
+		return;
+
+	saved = attr->adapt_input > attr->adapt_output ?
+		(double) (attr->adapt_input - attr->adapt_output) : 0.0;
+	efficiency = saved / MAX(attr->adapt_ns / 1000.0, 1.0);
+
+	level = attr->level;
+
+	if (GNET_PROPERTY(overloaded_cpu)) {
+		if (level > Z_BEST_SPEED)
+			level--;
+	} else if (bsched_saturated(attr->bws)) {
+		if (level < Z_BEST_COMPRESSION && efficiency >= DEFLATE_ADAPT_GAIN)
+			level++;
+	} else if (level < attr->base_level) {
+		level++;
+	} else if (level > attr->base_level) {
+		level--;
+	}
+
+	if (tx_deflate_debugging(1)) {
+		g_debug("TX %s: (%s) deflated %s bytes into %s in %'lu usecs "
+			"(%.2f saved bytes/usec), level %d -> %d",
+			G_STRFUNC, gnet_host_to_string(&tx->host),
+			uint64_to_string(attr->adapt_input),
+			uint64_to_string2(attr->adapt_output),
+			(ulong) (attr->adapt_ns / 1000), efficiency, attr->level, level);
+	}
+
+	attr->want_level = level;
+	attr->adapt_input = attr->adapt_output = attr->adapt_ns = 0;
+	attr->adapt_last = now;
+}
+
 /**
  * Pending data were all flushed.
  */
@@ -364,6 +533,9 @@ deflate_flushed(txdrv_t *tx)
 		attr->ratio_ema += (flush / 2.0) - (attr->ratio_ema / 2.0);
 	}
 
+	if (attr->bws != BSCHED_BWS_INVALID && !(tx->flags & TX_CLOSING))
+		deflate_adapt(tx, attr->unflushed, attr->flushed);
+
 	if (tx_deflate_debugging(4)) {
 		g_debug("TX %s: (%s) deflated %zu bytes into %zu "
 			"(%.2f%%, EMA=%.2f%%, overall %.2f%%)",
@@ -390,6 +562,7 @@ deflate_flush(txdrv_t *tx)
 	struct buffer *b;
 	int ret;
 	int old_avail;
+	tm_nano_t start;
 
 retry:
 	b = &attr->buf[attr->fill_idx];	/* Buffer we fill */
@@ -418,8 +591,14 @@ retry:
 
 	g_assert(outz->avail_out > 0);
 
+	if (attr->bws != BSCHED_BWS_INVALID)
+		tm_precise_time(&start);
+
 	ret = deflate(outz, (tx->flags & TX_CLOSING) ? Z_FINISH : Z_SYNC_FLUSH);
 
+	if (attr->bws != BSCHED_BWS_INVALID)
+		deflate_timed(attr, &start);
+
 	switch (ret) {
 	case Z_BUF_ERROR:				/* Nothing to flush */
 		goto done;
@@ -483,6 +662,11 @@ deflate_flush_send(txdrv_t *tx)
 {
 	struct attr *attr = tx->opaque;
 
+	if (attr->zs != NULL) {
+		deflate_async_flush(tx);
+		return;
+	}
+
 	/*
 	 * During deflate_flush(), we can fill the current buffer, then call
 	 * deflate_rotate_and_send() and finish the flush.  But it is possible
@@ -541,6 +725,43 @@ deflate_nagle_timeout(cqueue_t *cq, void *arg)
 	deflate_flush_send(tx);
 }
 
+/**
+ * Switch the compressing stream to attr->want_level.
+ *
+ * This must be called right after a flush, when zlib has nothing pending,
+ * so that deflateParams() does not need to emit anything.
+ */
+static void
+deflate_set_level(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+	z_streamp outz = attr->outz;
+	struct buffer *b = &attr->buf[attr->fill_idx];
+	int old_avail, ret;
+	size_t written;
+
+	g_assert(0 == attr->unflushed);
+	g_assert(!(attr->flags & DF_FLUSH));
+
+	if (b->wptr == b->end)
+		return;				/* No room, will retry later */
+
+	outz->next_out = cast_to_pointer(b->wptr);
+	outz->avail_out = old_avail = b->end - b->wptr;
+	outz->avail_in = 0;
+
+	ret = deflateParams(outz, attr->want_level, Z_DEFAULT_STRATEGY);
+
+	written = old_avail - outz->avail_out;
+	b->wptr += written;
+	attr->flushed += written;
+
+	if (0 != written && NULL != attr->cb->add_tx_deflated)
+		attr->cb->add_tx_deflated(tx->owner, written);
+
+	deflate_level_switched(tx, attr->want_level, ret);
+}
+
 /**
  * Compress as much data as possible to the output buffer, sending data
  * as we go along.
@@ -572,6 +793,17 @@ deflate_add(txdrv_t *tx, const void *data, int len)
 	if G_UNLIKELY(tx->flags & TX_ERROR)
 		return -1;
 
+	/*
+	 * Apply any pending compression level change if we are at a flush
+	 * boundary.
+	 */
+
+	if G_UNLIKELY(
+		attr->want_level != attr->level &&
+		0 == attr->unflushed && !(attr->flags & DF_FLUSH)
+	)
+		deflate_set_level(tx);
+
 	while (added < len) {
 		struct buffer *b = &attr->buf[attr->fill_idx];	/* Buffer we fill */
 		int ret;
@@ -579,6 +811,7 @@ deflate_add(txdrv_t *tx, const void *data, int len)
 		bool flush_started = (attr->flags & DF_FLUSH) ? TRUE : FALSE;
 		int old_avail;
 		const char *in, *old_in;
+		tm_nano_t start;
 
 		/*
 		 * Prepare call to deflate().
@@ -602,8 +835,14 @@ deflate_add(txdrv_t *tx, const void *data, int len)
 		 * that we have more room available for the output.
 		 */
 
+		if (attr->bws != BSCHED_BWS_INVALID)
+			tm_precise_time(&start);
+
 		ret = deflate(outz, flush_started ? Z_SYNC_FLUSH : 0);
 
+		if (attr->bws != BSCHED_BWS_INVALID)
+			deflate_timed(attr, &start);
+
 		if (Z_OK != ret) {
 			attr->flags |= DF_SHUTDOWN;
 			(*attr->cb->shutdown)(tx->owner, "Compression failed: %s",
@@ -811,6 +1050,461 @@ deflate_service(void *data)
 	}
 }
 
+/***
+ *** Asynchronous mode.
+ ***/
+
+/**
+ * Compress job data, from a worker thread.
+ */
+static void
+deflate_job_work(void *data)
+{
+	struct deflate_job *dj = data;
+	z_streamp outz = dj->outz;
+	pmsg_t *mb = NULL;
+	tm_nano_t start, end, elapsed;
+	int ret;
+
+	tm_precise_time(&start);
+
+	/*
+	 * A level switch is only requested when the job starts right after
+	 * a flush, so deflateParams() should not emit anything.
+	 */
+
+	if (dj->level >= 0) {
+		int written;
+
+		mb = pmsg_new(PMSG_P_DATA, NULL, dj->bufsize);
+		dj->out = pslist_prepend(dj->out, mb);
+
+		outz->next_out = cast_to_pointer(mb->m_wptr);
+		outz->avail_out = pmsg_available(mb);
+		outz->avail_in = 0;
+
+		dj->level_ret = deflateParams(outz, dj->level, Z_DEFAULT_STRATEGY);
+
+		written = pmsg_available(mb) - outz->avail_out;
+		mb->m_wptr += written;
+		dj->outlen += written;
+	}
+
+	outz->next_in = cast_to_pointer(dj->in);
+	outz->avail_in = dj->inlen;
+
+	for (;;) {
+		int old_avail, written;
+
+		if (NULL == mb || 0 == pmsg_available(mb)) {
+			mb = pmsg_new(PMSG_P_DATA, NULL, dj->bufsize);
+			dj->out = pslist_prepend(dj->out, mb);
+		}
+
+		outz->next_out = cast_to_pointer(mb->m_wptr);
+		outz->avail_out = old_avail = pmsg_available(mb);
+
+		ret = deflate(outz, dj->flush);
+
+		written = old_avail - outz->avail_out;
+		mb->m_wptr += written;
+		dj->outlen += written;
+
+		/*
+		 * Z_BUF_ERROR is returned when no progress is possible, which only
+		 * happens when flushing without any input and nothing pending.
+		 */
+
+		if (Z_BUF_ERROR == ret || Z_STREAM_END == ret) {
+			ret = Z_OK;
+			break;
+		}
+
+		if (Z_OK != ret)
+			break;
+
+		if (0 == outz->avail_in && 0 != outz->avail_out)
+			break;				/* All consumed, flushing done if requested */
+	}
+
+	dj->ret = ret;
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, &start);
+	dj->ns = tmn2ns(&elapsed);
+
+	/*
+	 * Drop the last message block if nothing was written there.
+	 */
+
+	if (mb != NULL && 0 == pmsg_size(mb)) {
+		dj->out = pslist_remove(dj->out, mb);
+		pmsg_free(mb);
+	}
+
+	dj->out = pslist_reverse(dj->out);
+}
+
+/**
+ * Dispose of compression job.
+ */
+static void
+deflate_job_free(void *data)
+{
+	struct deflate_job *dj = data;
+
+	HFREE_NULL(dj->in);
+	pslist_free_full_null(&dj->out, (free_fn_t) pmsg_free);
+	WFREE(dj);
+}
+
+/**
+ * Release the compressing stream, once no worker can use it any longer.
+ */
+static void
+deflate_async_release(void *data)
+{
+	z_streamp outz = data;
+	int ret;
+
+	/*
+	 * We ignore Z_DATA_ERROR errors (discarded data, probably).
+	 */
+
+	ret = deflateEnd(outz);
+
+	if (Z_OK != ret && Z_DATA_ERROR != ret)
+		g_warning("%s(): while freeing compressor: %s",
+			G_STRFUNC, zlib_strerror(ret));
+
+	WFREE(outz);
+}
+
+/**
+ * @return maximum amount of data held in asynchronous mode.
+ */
+static size_t
+deflate_async_limit(const struct attr *attr)
+{
+	return attr->buffer_size * BUFFER_COUNT +
+		MIN(attr->buffer_flush, ASYNC_INPUT);
+}
+
+/**
+ * @return amount of input we can accept without flow-controlling.
+ */
+static size_t
+deflate_async_room(const txdrv_t *tx)
+{
+	const struct attr *attr = tx->opaque;
+	size_t limit, used;
+
+	limit = deflate_async_limit(attr);
+	used = attr->a_inflight + attr->a_queued;
+
+	return limit > used ? limit - used : 0;
+}
+
+/**
+ * Submit new compression job, taking ownership of the supplied input.
+ *
+ * @param tx		the driver
+ * @param in		the input data (halloc-ed), NULL when flushing only
+ * @param len		length of input data
+ * @param flush		flushing mode for deflate()
+ * @param boundary	whether job starts right after a flush
+ */
+static void
+deflate_async_submit(txdrv_t *tx, char *in, size_t len, int flush,
+	bool boundary)
+{
+	struct attr *attr = tx->opaque;
+	struct deflate_job *dj;
+
+	WALLOC0(dj);
+	dj->outz = attr->outz;
+	dj->in = in;
+	dj->inlen = len;
+	dj->bufsize = attr->buffer_size;
+	dj->flush = flush;
+	dj->level = -1;
+
+	/*
+	 * Request any pending compression level change if we are at a flush
+	 * boundary, the worker applying it before compressing the input.
+	 */
+
+	if G_UNLIKELY(
+		boundary && attr->want_level != attr->level &&
+		!(attr->flags & DF_LEVEL)
+	) {
+		dj->level = attr->want_level;
+		attr->flags |= DF_LEVEL;
+	}
+
+	attr->a_inflight += len;
+	attr->a_jobs++;
+
+	if (tx_deflate_debugging(9)) {
+		g_debug("TX %s: (%s) submitting %zu bytes, flush=%d "
+			"(%u job%s, %zu in flight, %zu queued) [%c%c]",
+			G_STRFUNC, gnet_host_to_string(&tx->host), len, flush,
+			attr->a_jobs, plural(attr->a_jobs),
+			attr->a_inflight, attr->a_queued,
+			(attr->flags & DF_FLOWC) ? 'C' : '-',
+			(attr->flags & DF_FINISH) ? 'F' : '-');
+	}
+
+	zpool_stream_submit(attr->zs, dj);
+}
+
+/**
+ * Request a flush of the compressed stream, or its termination when the
+ * layer is closing.
+ */
+static void
+deflate_async_flush(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
+	if (attr->flags & DF_SHUTDOWN)
+		return;
+
+	if (tx->flags & TX_CLOSING) {
+		if (!(attr->flags & DF_FINISH)) {
+			attr->flags |= DF_FINISH;
+			attr->a_unflushed = 0;
+			deflate_async_submit(tx, NULL, 0, Z_FINISH, FALSE);
+		}
+		return;
+	}
+
+	if (0 == attr->a_unflushed)
+		return;					/* Last job already requested a flush */
+
+	attr->a_unflushed = 0;
+	deflate_async_submit(tx, NULL, 0, Z_SYNC_FLUSH, FALSE);
+}
+
+/**
+ * Write I/O vector, handing the data to the workers.
+ *
+ * @return amount of bytes accepted, or -1 on error.
+ */
+static ssize_t
+deflate_async_writev(txdrv_t *tx, const iovec_t *iov, int iovcnt)
+{
+	struct attr *attr = tx->opaque;
+	size_t total, len, room;
+	char *in, *p;
+	int flush = Z_NO_FLUSH;
+	bool boundary;
+	int i;
+
+	if G_UNLIKELY(tx->flags & TX_ERROR)
+		return -1;
+
+	total = iov_calculate_size(iov, iovcnt);
+	room = deflate_async_room(tx);
+	len = MIN(total, room);
+
+	if (len != 0) {
+		size_t n = len;
+
+		p = in = halloc(len);
+
+		for (i = 0; i < iovcnt && n != 0; i++) {
+			size_t m = MIN(n, iovec_len(&iov[i]));
+
+			p = mempcpy(p, iovec_base(&iov[i]), m);
+			n -= m;
+		}
+
+		/*
+		 * Ask for a flush if the amount of bytes we have handed since the
+		 * last flush is greater than attr->buffer_flush.
+		 */
+
+		boundary = 0 == attr->a_unflushed;
+		attr->a_unflushed += len;
+
+		if (attr->a_unflushed > attr->buffer_flush) {
+			attr->a_unflushed = 0;
+			flush = Z_SYNC_FLUSH;
+		}
+
+		deflate_async_submit(tx, in, len, flush, boundary);
+
+		if (attr->flags & DF_NAGLE)
+			deflate_nagle_delay(tx);
+		else
+			deflate_nagle_start(tx);
+	}
+
+	if (len < total)
+		deflate_set_flowc(tx, TRUE);	/* Enter flow control */
+
+	return len;
+}
+
+/**
+ * Send as much of the compressed data as possible to the lower layer.
+ *
+ * @return FALSE on error.
+ */
+static bool
+deflate_async_send(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
+	while (0 != attr->a_queued) {
+		iovec_t *iov;
+		int iovcnt;
+		size_t held;
+		ssize_t r;
+
+		iov = pmsg_slist_to_iovec(attr->aout, &iovcnt, &held);
+		r = tx_writev(tx->lower, iov, iovcnt);
+		HFREE_NULL(iov);
+
+		if (tx_deflate_debugging(9)) {
+			g_debug("TX %s: (%s) wrote %zd/%zu bytes (%zu queued)",
+				G_STRFUNC, gnet_host_to_string(&tx->host), r, held,
+				attr->a_queued);
+		}
+
+		if ((ssize_t) -1 == r) {
+			tx_error(tx);
+			return FALSE;
+		}
+
+		pmsg_slist_discard(attr->aout, r);
+		attr->a_queued -= r;
+
+		if ((size_t) r < held) {
+			tx_srv_enable(tx->lower);
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Service routine for the compressing stage, in asynchronous mode.
+ *
+ * Called by lower layer when it is ready to process more data, and when
+ * compressed data are received from the workers.
+ */
+static void
+deflate_async_service(void *data)
+{
+	txdrv_t *tx = data;
+	struct attr *attr = tx->opaque;
+
+	if (!deflate_async_send(tx))
+		return;
+
+	if (0 != attr->a_queued)
+		return;						/* Servicing still enabled */
+
+	if (tx->lower->flags & TX_SERVICE)
+		tx_srv_disable(tx->lower);
+
+	/*
+	 * Leave flow control once workers have caught up with at least half
+	 * the input we can hold.
+	 */
+
+	if (
+		(attr->flags & DF_FLOWC) &&
+		attr->a_inflight <= deflate_async_limit(attr) / 2
+	)
+		deflate_set_flowc(tx, FALSE);	/* Leave flow control state */
+
+	if (tx->flags & TX_CLOSING) {
+		deflate_async_flush(tx);
+
+		if (attr->closed != NULL && 0 == tx_deflate_pending(tx)) {
+			tx_closed_t closed = attr->closed;
+
+			attr->closed = NULL;
+			(*closed)(tx, attr->closed_arg);
+			return;
+		}
+	}
+
+	/*
+	 * If upper layer wants servicing, do it now.
+	 */
+
+	if ((tx->flags & TX_SERVICE) && !(attr->flags & DF_FLOWC)) {
+		g_assert(tx->srv_routine);
+		tx->srv_routine(tx->srv_arg);
+	}
+}
+
+/**
+ * Compression job completed, in the main thread.
+ */
+static void
+deflate_async_done(void *owner, void *data)
+{
+	txdrv_t *tx = owner;
+	struct attr *attr = tx->opaque;
+	struct deflate_job *dj = data;
+	pslist_t *sl;
+
+	g_assert(attr->a_jobs != 0);
+	g_assert(attr->a_inflight >= dj->inlen);
+
+	attr->a_inflight -= dj->inlen;
+	attr->a_jobs--;
+	attr->adapt_ns += dj->ns;
+
+	if (dj->level >= 0) {
+		g_assert(attr->flags & DF_LEVEL);
+
+		attr->flags &= ~DF_LEVEL;
+		deflate_level_switched(tx, dj->level, dj->level_ret);
+	}
+
+	if (Z_OK != dj->ret) {
+		int ret = dj->ret;
+
+		deflate_job_free(dj);
+		if (attr->flags & DF_SHUTDOWN)
+			return;
+		attr->flags |= DF_SHUTDOWN;
+		tx_error(tx);
+
+		/* XXX: The callback must not destroy the tx! */
+		(*attr->cb->shutdown)(tx->owner, "Compression failed: %s",
+			zlib_strerror(ret));
+		return;
+	}
+
+	PSLIST_FOREACH(dj->out, sl) {
+		slist_append(attr->aout, sl->data);
+	}
+	pslist_free_null(&dj->out);
+
+	attr->a_queued += dj->outlen;
+	attr->unflushed += dj->inlen;
+	attr->flushed += dj->outlen;
+
+	if (0 != dj->outlen && NULL != attr->cb->add_tx_deflated)
+		attr->cb->add_tx_deflated(tx->owner, dj->outlen);
+
+	if (Z_NO_FLUSH != dj->flush)
+		deflate_flushed(tx);
+
+	deflate_job_free(dj);
+
+	if (!(tx->flags & TX_ERROR))
+		deflate_async_service(tx);
+}
+
 /***
  *** Polymorphic routines.
  ***/
@@ -826,6 +1520,7 @@ tx_deflate_init(txdrv_t *tx, void *args)
 	struct attr *attr;
 	struct tx_deflate_args *targs = args;
 	z_streamp outz;
+	int initial_level;
 	int ret;
 	int i;
 
@@ -890,6 +1585,8 @@ tx_deflate_init(txdrv_t *tx, void *args)
 		ret = deflateInit2(outz, level, Z_DEFLATED,
 				targs->gzip ? (-window_bits) : window_bits, mem_level,
 				Z_DEFAULT_STRATEGY);
+
+		initial_level = Z_DEFAULT_COMPRESSION == level ? DEFLATE_LEVEL : level;
 	}
 
 	if (Z_OK != ret) {
@@ -910,6 +1607,15 @@ tx_deflate_init(txdrv_t *tx, void *args)
 	attr->outz = outz;
 	attr->tm_ev = NULL;
 
+	/*
+	 * The compression level is adjusted at runtime when we know which
+	 * bandwidth scheduler is used for output.
+	 */
+
+	attr->bws = targs->bws;
+	attr->level = attr->base_level = attr->want_level = initial_level;
+	attr->adapt_last = tm_time();
+
 	for (i = 0; i < BUFFER_COUNT; i++) {
 		struct buffer *b = &attr->buf[i];
 
@@ -920,6 +1626,17 @@ tx_deflate_init(txdrv_t *tx, void *args)
 	attr->fill_idx = 0;
 	attr->send_idx = -1;		/* Signals: none ready */
 
+	/*
+	 * The gzip encapsulation is only used for browse-host replies, which
+	 * are not worth the asynchronous processing.
+	 */
+
+	if (targs->async && !targs->gzip && zpool_enabled()) {
+		attr->zs = zpool_stream_make(gnet_host_to_string(&tx->host), tx,
+			deflate_job_work, deflate_async_done, deflate_job_free);
+		attr->aout = slist_new();
+	}
+
 	if (attr->gzip.enabled) {
 		/* See RFC 1952 - GZIP file format specification version 4.3 */
 		static const unsigned char header[] = {
@@ -942,11 +1659,15 @@ tx_deflate_init(txdrv_t *tx, void *args)
 
 	tx->opaque = attr;
 
+	if (NULL != attr->cb->level_changed)
+		attr->cb->level_changed(tx->owner, attr->level);
+
 	/*
 	 * Register our service routine to the lower layer.
 	 */
 
-	tx_srv_register(tx->lower, deflate_service, tx);
+	tx_srv_register(tx->lower,
+		NULL == attr->zs ? deflate_service : deflate_async_service, tx);
 
 	return tx;		/* OK */
 }
@@ -969,16 +1690,28 @@ tx_deflate_destroy(txdrv_t *tx)
 	}
 
 	/*
-	 * We ignore Z_DATA_ERROR errors (discarded data, probably).
+	 * In asynchronous mode, a worker may still be using the compressing
+	 * stream, which will be released when it is done.
 	 */
 
-	ret = deflateEnd(attr->outz);
+	if (attr->zs != NULL) {
+		zpool_stream_free(&attr->zs, deflate_async_release, attr->outz);
+		pmsg_slist_free(&attr->aout);
+		attr->outz = NULL;
+	} else {
+		/*
+		 * We ignore Z_DATA_ERROR errors (discarded data, probably).
+		 */
 
-	if (Z_OK != ret && Z_DATA_ERROR != ret)
-		g_warning("while freeing compressor for peer %s: %s",
-			gnet_host_to_string(&tx->host), zlib_strerror(ret));
+		ret = deflateEnd(attr->outz);
+
+		if (Z_OK != ret && Z_DATA_ERROR != ret)
+			g_warning("while freeing compressor for peer %s: %s",
+				gnet_host_to_string(&tx->host), zlib_strerror(ret));
+
+		WFREE(attr->outz);
+	}
 
-	WFREE(attr->outz);
 	cq_cancel(&attr->tm_ev);
 	WFREE(attr);
 }
@@ -1007,6 +1740,13 @@ tx_deflate_write(txdrv_t *tx, const void *data, size_t len)
 	if (attr->flags & (DF_FLOWC|DF_SHUTDOWN))
 		return 0;
 
+	if (attr->zs != NULL) {
+		iovec_t iov;
+
+		iovec_set(&iov, deconstify_pointer(data), len);
+		return deflate_async_writev(tx, &iov, 1);
+	}
+
 	return deflate_add(tx, data, len);
 }
 
@@ -1029,6 +1769,13 @@ tx_deflate_writev(txdrv_t *tx, iovec_t *iov, int iovcnt)
 			(attr->flags & DF_FLUSH) ? 'f' : '-');
 	}
 
+	if (attr->zs != NULL) {
+		if (attr->flags & (DF_FLOWC|DF_SHUTDOWN))
+			return 0;
+
+		return deflate_async_writev(tx, iov, iovcnt);
+	}
+
 	while (iovcnt-- > 0) {
 		int ret;
 
@@ -1092,6 +1839,21 @@ tx_deflate_pending(txdrv_t *tx)
 	const struct attr *attr = tx->opaque;
 	size_t pending;
 
+	/*
+	 * In asynchronous mode, estimate what the workers will emit for the
+	 * input they hold, and make sure we report something as long as there
+	 * are jobs running, since even flushing can generate output.
+	 */
+
+	if (attr->zs != NULL) {
+		pending = attr->a_queued;
+		if (attr->a_inflight != 0)
+			pending += MAX(1, attr->a_inflight * (1.0 - attr->ratio_ema));
+		if (0 != attr->a_jobs)
+			pending = MAX(pending, 1);
+		return pending;
+	}
+
 	pending = deflate_buffered(tx);
 
 	/*
@@ -37,6 +37,7 @@
 #include "common.h"
 
 #include "tx.h"
+#include "if/core/bsched.h"
 #include "lib/cq.h"
 
 const struct txdrv_ops *tx_deflate_get_ops(void);
@@ -48,6 +49,7 @@ struct tx_deflate_cb {
 	void (*add_tx_deflated)(void *owner, int amount);
 	void (*shutdown)(void *owner, const char *reason, ...);
 	void (*flow_control)(void *owner, size_t amount);
+	void (*level_changed)(void *owner, int level);
 };
 
 /**
@@ -61,6 +63,8 @@ struct tx_deflate_args {
 	bool nagle;					/**< Whether to use Nagle or not */
 	bool gzip;					/**< Whether to use gzip encapsulation */
 	bool reduced;				/**< Whether to use reduced compression */
+	bool async;					/**< Whether to compress in worker threads */
+	bsched_bws_t bws;			/**< Output scheduler, INVALID for fixed level */
 };
 
 #endif	/* _core_tx_deflate_h_ */
@@ -79,6 +79,7 @@
 #include "lib/log.h"
 #include "lib/palloc.h"
 #include "lib/pmsg.h"
+#include "lib/stringify.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/walloc.h"
@@ -136,8 +137,13 @@ struct udp_sched {
 	hset_t *seen;					/**< Remembers destinations processed */
 	hash_list_t *stacks;			/**< TX stacks using us */
 	size_t buffered;				/**< Amount buffered (regular + urgent) */
+	struct udp_tx_desc *batch[SOCK_UDP_BATCH_MAX];	/**< Batched datagrams */
+	bio_source_t *batch_bio;		/**< I/O source for batched datagrams */
+	uint batch_cnt;					/**< Amount of batched datagrams */
+	uint batch_max;					/**< Max amount of datagrams per batch */
 	unsigned used_all:1;			/**< Set when all b/w was used */
 	unsigned flow_controlled:1;		/**< Whether we flow-controlled */
+	unsigned batch_other:1;			/**< Skipped messages for other socket */
 };
 
 static inline void
@@ -433,7 +439,7 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
 }
 
 /**
- * Send message block to IP:port.
+ * Determine the I/O source to use to send message block to IP:port.
  *
  * @param us		the UDP scheduler
  * @param mb		the message to send
@@ -441,20 +447,17 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
  * @param tx		the TX stack sending the message
  * @param cb		callback actions on the datagram
  *
- * @return TRUE if message was sent or dropped, FALSE if there is no more
- * bandwidth to send anything.
+ * @return the I/O source to use, NULL if the message was dropped.
  */
-static bool
-udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+static bio_source_t *
+udp_sched_mb_bio(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	const txdrv_t *tx, const struct tx_dgram_cb *cb)
 {
-	ssize_t r;
-	int len = pmsg_size(mb);
 	bio_source_t *bio = NULL;
 
 	if (0 == gnet_host_get_port(to)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_ZERO_PORT);
-		return TRUE;
+		return NULL;
 	}
 
 	/*
@@ -463,7 +466,7 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 	if (!pmsg_can_transmit(mb)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_LONGER_NEEDED);
-		return TRUE;			/* Dropped */
+		return NULL;			/* Dropped */
 	}
 
 	/*
@@ -491,27 +494,56 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 		udp_sched_log(4, "%p: discarding mb=%p (%d bytes) to %s",
 			us, mb, pmsg_written_size(mb), gnet_host_to_string(to));
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_SOCKET);
-		return udp_tx_drop(tx, cb);		/* TRUE, for "sent" */
+		udp_tx_drop(tx, cb);
+		return NULL;
 	}
 
-	/*
-	 * OK, proceed if we have bandwidth.
-	 */
-
-	r = bio_sendto(bio, to, pmsg_phys_base(mb), len);
+	return bio;
+}
 
-	if (r < 0) {		/* Error, or no bandwidth */
-		if (udp_sched_write_error(us, to, mb, G_STRFUNC)) {
-			udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
-				us, mb, pmsg_written_size(mb));
-			gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
-			return udp_tx_drop(tx, cb);	/* TRUE, for "sent" */
-		}
-		udp_sched_log(3, "%p: no bandwidth for mb=%p (%d bytes)",
+/**
+ * Handle failure to send message block to IP:port, errno being set.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message we could not send
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ *
+ * @return TRUE if message was dropped, FALSE if there is no more
+ * bandwidth to send anything.
+ */
+static bool
+udp_sched_mb_failed(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	if (udp_sched_write_error(us, to, mb, G_STRFUNC)) {
+		udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
 			us, mb, pmsg_written_size(mb));
-		us->used_all = TRUE;
-		return FALSE;
+		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
+		return udp_tx_drop(tx, cb);	/* TRUE, for "sent" */
 	}
+	udp_sched_log(3, "%p: no bandwidth for mb=%p (%d bytes)",
+		us, mb, pmsg_written_size(mb));
+	us->used_all = TRUE;
+	return FALSE;
+}
+
+/**
+ * Account for message block sent to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message we sent
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ * @param r			amount of bytes sent
+ */
+static void
+udp_sched_mb_sent(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb, ssize_t r)
+{
+	int len = pmsg_size(mb);
 
 	if (r != len) {
 		/* This should never happen with UDP/IP since datagrams are atomic */
@@ -543,10 +575,180 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 		inet_udp_record_sent(gnet_host_get_addr(to));
 	}
+}
 
+/**
+ * Send message block to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message to send
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ *
+ * @return TRUE if message was sent or dropped, FALSE if there is no more
+ * bandwidth to send anything.
+ */
+static bool
+udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	ssize_t r;
+	bio_source_t *bio;
+
+	bio = udp_sched_mb_bio(us, mb, to, tx, cb);
+
+	if (NULL == bio)
+		return TRUE;		/* Dropped */
+
+	/*
+	 * OK, proceed if we have bandwidth.
+	 */
+
+	r = bio_sendto(bio, to, pmsg_phys_base(mb), pmsg_size(mb));
+
+	if (r < 0)		/* Error, or no bandwidth */
+		return udp_sched_mb_failed(us, mb, to, tx, cb);
+
+	udp_sched_mb_sent(us, mb, to, tx, cb, r);
 	return TRUE;		/* Message sent */
 }
 
+/**
+ * Forget that we processed the destination of a message.
+ */
+static void
+udp_sched_seen_remove(udp_sched_t *us, const gnet_host_t *to)
+{
+	const void *atom = hset_lookup(us->seen, to);
+
+	if (atom != NULL) {
+		hset_remove(us->seen, atom);
+		atom_host_free(atom);
+	}
+}
+
+/**
+ * Add TX descriptor to the current batch of datagrams to send.
+ *
+ * @return TRUE if message was batched or dropped, FALSE if it cannot be
+ * part of the current batch.
+ */
+static bool
+udp_tx_desc_batch(udp_sched_t *us, struct udp_tx_desc *txd)
+{
+	bio_source_t *bio;
+
+	if (us->batch_cnt >= us->batch_max)
+		return FALSE;		/* Batch full, will come back later */
+
+	bio = udp_sched_mb_bio(us, txd->mb, txd->to, txd->tx, txd->cb);
+
+	if (NULL == bio) {
+		us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+		udp_tx_desc_flag_release(txd, us);
+		return TRUE;		/* Dropped */
+	}
+
+	/*
+	 * A batch is sent through one single socket, so messages going to
+	 * another network will be processed with the next batch.
+	 */
+
+	if (us->batch_cnt != 0 && bio != us->batch_bio) {
+		us->batch_other = TRUE;
+		return FALSE;
+	}
+
+	if (PMSG_P_DATA == pmsg_prio(txd->mb))
+		hset_insert(us->seen, atom_host_get(txd->to));
+
+	eslist_mark_removed(&us->tx_released, txd);		/* For assertions */
+	us->batch_bio = bio;
+	us->batch[us->batch_cnt++] = txd;
+
+	return TRUE;		/* Now owned by the batch */
+}
+
+/**
+ * Send the current batch of datagrams.
+ *
+ * Messages that could not be sent are put back at the head of the list
+ * from which they were taken.
+ *
+ * @param us		the UDP scheduler
+ * @param list		the list from which batched datagrams come
+ *
+ * @return the amount of messages sent or dropped.
+ */
+static uint
+udp_sched_batch_flush(udp_sched_t *us, eslist_t *list)
+{
+	wrap_dgram_t dg[SOCK_UDP_BATCH_MAX];
+	uint i, done = 0, n = us->batch_cnt;
+	int r;
+
+	if (0 == n)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		const struct udp_tx_desc *txd = us->batch[i];
+
+		dg[i].to = txd->to;
+		dg[i].data = pmsg_phys_base(txd->mb);
+		dg[i].len = pmsg_size(txd->mb);
+		dg[i].sent = 0;
+	}
+
+	r = bio_sendmmsg(us->batch_bio, dg, n);
+
+	if (r < 0) {
+		struct udp_tx_desc *txd = us->batch[0];
+
+		if (udp_sched_mb_failed(us, txd->mb, txd->to, txd->tx, txd->cb))
+			done = 1;		/* Dropped first message on error */
+	} else {
+		for (i = 0; i < UNSIGNED(r); i++) {
+			struct udp_tx_desc *txd = us->batch[i];
+
+			udp_sched_mb_sent(us, txd->mb, txd->to, txd->tx, txd->cb,
+				dg[i].sent);
+		}
+		done = r;
+	}
+
+	udp_sched_log(4, "%p: batch of %u datagram%s, %u sent or dropped",
+		us, n, plural(n), done);
+
+	for (i = 0; i < done; i++) {
+		struct udp_tx_desc *txd = us->batch[i];
+
+		if (PMSG_P_DATA == pmsg_prio(txd->mb) && !pmsg_was_sent(txd->mb))
+			udp_sched_seen_remove(us, txd->to);
+
+		us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+		udp_tx_desc_flag_release(txd, us);
+	}
+
+	/*
+	 * Put back unsent messages, in their original order.
+	 */
+
+	for (i = n; i > done; i--) {
+		struct udp_tx_desc *txd = us->batch[i - 1];
+
+		if (PMSG_P_DATA == pmsg_prio(txd->mb))
+			udp_sched_seen_remove(us, txd->to);
+
+		eslist_prepend(list, txd);
+	}
+
+	us->batch_cnt = 0;
+	us->batch_bio = NULL;
+
+	return done;
+}
+
 /**
  * Send message (eslist iterator callback).
  *
@@ -586,6 +788,9 @@ udp_tx_desc_send(void *data, void *udata)
 		return FALSE;
 	}
 
+	if (us->batch_max > 1)
+		return udp_tx_desc_batch(us, txd);
+
 	if (udp_sched_mb_sendto(us, txd->mb, txd->to, txd->tx, txd->cb)) {
 		if (PMSG_P_DATA == prio && pmsg_was_sent(txd->mb))
 			hset_insert(us->seen, atom_host_get(txd->to));
@@ -744,15 +949,83 @@ udp_sched_send(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	return len;		/* Message queued, but tell upper layers it's sent */
 }
 
+/**
+ * Process LIFO queue in batches, until we have no more bandwidth.
+ *
+ * Messages are collected from the list until the batch is full, and then
+ * sent in one single system call.  Scanning resumes where it stopped, the
+ * messages before that point having been either batched or skipped for a
+ * reason that still holds.  The exception is messages skipped because they
+ * go through another socket than the batch: once the end of the list is
+ * reached, they are collected by a new scan from the head of the list.
+ */
+static void
+udp_sched_process_batched(udp_sched_t *us, eslist_t *list)
+{
+	void *prev = NULL;		/* Item before scanning point, NULL for head */
+
+	us->batch_other = FALSE;
+
+	while (!us->used_all) {
+		struct udp_tx_desc *txd;
+		uint n, done;
+
+		for (
+			txd = eslist_next_data(list, prev);
+			txd != NULL && us->batch_cnt < us->batch_max && !us->used_all;
+			txd = eslist_next_data(list, prev)
+		) {
+			/*
+			 * The link of the descriptor is reused when it is batched or
+			 * released, so it must be removed from the list beforehand.
+			 */
+
+			eslist_remove_after(list, prev);
+
+			if (!udp_tx_desc_send(txd, us)) {
+				eslist_insert_after(list, prev, txd);
+				prev = txd;
+			}
+		}
+
+		n = us->batch_cnt;
+		done = udp_sched_batch_flush(us, list);
+
+		if (0 == done)
+			break;
+
+		if (done != n) {
+			/* Unsent messages were put back at the head */
+		} else if (NULL == txd) {
+			if (!us->batch_other)
+				break;			/* Nothing left that we can send */
+		} else {
+			continue;			/* Resume scanning after the batch */
+		}
+
+		us->batch_other = FALSE;
+		prev = NULL;
+	}
+}
+
 /**
  * Process LIFO queue, sending out messages until we have no more bandwidth.
+ *
+ * When batching is possible, messages are collected from the list and sent
+ * in one single system call, repeating the process as long as we can make
+ * progress.
  */
 static void
 udp_sched_process(udp_sched_t *us, eslist_t *list)
 {
 	udp_sched_check(us);
 
-	eslist_foreach_remove(list, udp_tx_desc_send, us);
+	us->batch_max = MIN(GNET_PROPERTY(udp_batch_size), SOCK_UDP_BATCH_MAX);
+
+	if (us->batch_max > 1)
+		udp_sched_process_batched(us, list);
+	else
+		eslist_foreach_remove(list, udp_tx_desc_send, us);
 }
 
 /**
@@ -53,6 +53,7 @@
 #include "ignore.h"
 #include "inet.h"		/* For INET_IP_V6READY */
 #include "ioheader.h"
+#include "iopool.h"
 #include "nodes.h"
 #include "parq.h"
 #include "settings.h"
@@ -219,6 +220,7 @@ static void upload_error_remove_ext(struct upload *u,
 		const char *extended, int code,
 		const char *msg, ...) G_PRINTF(4, 5);
 static void upload_writable(void *up, int source, inputevt_cond_t cond);
+static void upload_pump_stop(struct upload *u);
 static void upload_special_writable(void *up);
 static bool send_upload_error(struct upload *u, int code,
 			const char *msg, ...) G_PRINTF(3, 4);
@@ -1389,6 +1391,8 @@ upload_free_resources(struct upload *u)
 {
 	upload_check(u);
 
+	g_assert(NULL == u->pump);
+
 	parq_upload_upload_got_freed(u);
 
 	atom_str_free_null(&u->name);
@@ -1473,6 +1477,7 @@ upload_clone(struct upload *u)
 
     cu->upload_handle = upload_new_handle(cu); /* fetch new handle */
 	cu->bio = NULL;						/* Recreated on each transfer */
+	cu->pump = NULL;					/* Recreated on each transfer */
 	cu->sf = NULL;						/* File re-opened each time */
 	cu->file = NULL;					/* File re-opened each time */
 	cu->sendfile_ctx.map = NULL;		/* File re-opened each time */
@@ -2502,6 +2507,7 @@ upload_remove_v(struct upload *u, const char *reason, va_list ap)
 
 	upload_check(u);
 
+	upload_pump_stop(u);		/* Get final counters, release the socket */
 	was_sending = UPLOAD_IS_SENDING(u);
 	VA_COPY(apcopy, ap);
 
@@ -3811,6 +3817,7 @@ static const struct tx_deflate_cb upload_tx_deflate_cb = {
 	NULL,				/* add_tx_deflated */
 	upload_tx_error,	/* shutdown */
 	NULL,				/* flow_control */
+	NULL,				/* level_changed */
 };
 
 static void
@@ -6051,6 +6058,388 @@ upload_handle_exception(struct upload *u, inputevt_cond_t cond)
 	return FALSE;
 }
 
+/**
+ * Handle an error whilst writing file data to the remote host.
+ *
+ * @param u					the upload
+ * @param e					the errno of the failed write
+ * @param using_sendfile	whether the data were written via sendfile()
+ */
+static void
+upload_write_error(struct upload *u, int e, bool using_sendfile)
+{
+	if (
+		using_sendfile &&
+		!is_temporary_error(e) &&
+		e != EPIPE &&
+		e != ECONNRESET &&
+		e != ENOTCONN &&
+		e != ENOBUFS
+	) {
+		g_warning("sendfile() failed: \"%s\" -- "
+			"disabling sendfile() for this session", english_strerror(e));
+		sendfile_failed = TRUE;
+	}
+	if (!is_temporary_error(e)) {
+		socket_eof(u->socket);
+		upload_remove(u, N_("Data write error: %s"), g_strerror(e));
+	}
+}
+
+/**
+ * Account for file data written to the remote host.
+ */
+static void
+upload_account_written(struct upload *u, size_t written)
+{
+	gnet_prop_set_guint64_val(PROP_UL_BYTE_COUNT,
+		GNET_PROPERTY(ul_byte_count) + written);
+
+	u->last_update = tm_time();
+	u->sent += written;
+	if (u->file_info) {
+		fi_increase_uploaded(u->file_info, written);
+	}
+}
+
+/**
+ * Account for file data written to the remote host, completing the upload
+ * when all the requested data were sent.
+ */
+static void
+upload_data_written(struct upload *u, size_t written)
+{
+	upload_account_written(u, written);
+
+	/* This upload is complete */
+	if (u->pos > u->end) {
+
+		if (u->sf) {
+			upload_stats_file_complete(u->sf, u->end - u->skip + 1);
+			u->accounted = TRUE;	/* Called upload_stats_file_complete() */
+		}
+		upload_completed(u);
+	}
+}
+
+/***
+ *** Threaded data pump.
+ ***
+ *** Once the HTTP headers were sent, the file data can be written to the
+ *** remote host by an I/O thread.  The main thread still runs the bandwidth
+ *** scheduler: each time the source triggers, it is granted bandwidth and
+ *** removed from the event loop whilst an I/O thread writes the granted
+ *** amount with sendfile() or by reading and writing through the buffer.
+ *** The amount written is reported back with the job completion, in the
+ *** main thread, where it is accounted for and where the source is
+ *** re-armed.
+ ***
+ *** When the scheduler runs in concurrent mode, the I/O thread can also be
+ *** granted more bandwidth by itself, and keep on sending for a while.
+ ***
+ *** The I/O threads come from their own pool, sized by the property
+ *** "upload_pump_threads", so that they do not compete with the threads
+ *** writing downloaded data to disk.
+ ***
+ *** TLS connections are not pumped.  Writing to a TLS socket can re-arm the
+ *** socket's event callbacks on the main event loop and post fake readable
+ *** events there, neither of which may be done from another thread.
+ ***/
+
+#define UPLOAD_PUMP_MAX	(4 * READ_BUF_SIZE)	/**< Max bytes per grant */
+#define UPLOAD_PUMP_LOOP (4 * UPLOAD_PUMP_MAX)	/**< Max bytes per pump job */
+
+/**
+ * A pump job, processed by an I/O thread.
+ *
+ * Whilst the job is processed, the upload leaves its socket, its buffer and
+ * its sendfile() context alone: they are only used by the I/O thread.
+ */
+struct upload_pump_job {
+	bio_source_t *bio;			/**< Bandwidth-limited source */
+	sendfile_ctx_t *ctx;		/**< sendfile() context, NULL if not used */
+	file_object_t *file;		/**< File being uploaded */
+	int in_fd;					/**< File descriptor, if using sendfile() */
+	char *buffer;				/**< Data buffer, if not using sendfile() */
+	int buf_size;				/**< Buffer size */
+	int bpos;					/**< Position of unsent data in buffer */
+	int bsize;					/**< Amount of data held in buffer */
+	filesize_t pos;				/**< Position in file */
+	filesize_t end;				/**< Last byte to send */
+	size_t granted;				/**< Bandwidth granted by main thread */
+	size_t written;				/**< Amount of bytes written */
+	int error;					/**< Write error, 0 if none */
+	int read_error;				/**< Read error, 0 if none */
+	uint eof:1;					/**< Set if we reached EOF on the file */
+	uint zero:1;				/**< Set if write() returned 0 */
+};
+
+/**
+ * Can file data of the upload be sent by the I/O threads?
+ */
+static inline bool
+upload_pump_enabled(const struct upload *u)
+{
+	return GNET_PROPERTY(upload_threaded_pump) &&
+		iopool_enabled(IOPOOL_UPLOAD) && !socket_uses_tls(u->socket);
+}
+
+/**
+ * Write `len' bytes of data, from an I/O thread.
+ *
+ * @return the amount of bytes written.
+ */
+static size_t
+upload_pump_write(struct upload_pump_job *j, size_t len)
+{
+	size_t written = 0;
+
+	while (written < len) {
+		size_t amount = len - written;
+		ssize_t r;
+
+		if (j->ctx != NULL) {
+			fileoffset_t pos = j->pos, before = pos;
+
+			r = bio_sendfile_granted(j->ctx, j->bio, j->in_fd, &pos, amount);
+
+			g_assert((ssize_t) -1 == r || (fileoffset_t) r == pos - before);
+		} else {
+			if (j->bpos == j->bsize) {
+				ssize_t ret;
+
+				ret = file_object_pread(j->file,
+						j->buffer, j->buf_size, j->pos);
+				if ((ssize_t) -1 == ret) {
+					j->read_error = errno;
+					break;
+				}
+				if (0 == ret) {
+					j->eof = TRUE;
+					break;
+				}
+				j->bsize = (int) ret;
+				j->bpos = 0;
+			}
+
+			amount = MIN(amount, UNSIGNED(j->bsize - j->bpos));
+			r = bio_write_granted(j->bio, &j->buffer[j->bpos], amount);
+		}
+
+		if ((ssize_t) -1 == r) {
+			j->error = errno;
+			break;
+		} else if (0 == r) {
+			j->zero = TRUE;
+			break;
+		}
+
+		written += r;
+		j->pos += r;
+		if (NULL == j->ctx)
+			j->bpos += r;
+	}
+
+	j->written += written;
+	return written;
+}
+
+/**
+ * Write the granted amount of data, from an I/O thread.
+ */
+static void
+upload_pump_work(void *data)
+{
+	struct upload_pump_job *j = data;
+
+	if (upload_pump_write(j, j->granted) != j->granted)
+		return;
+
+	/*
+	 * When the bandwidth scheduler runs in concurrent mode, we can get more
+	 * bandwidth from this thread: keep sending whilst some is granted, but
+	 * not for too long to let the other uploads be pumped.
+	 */
+
+	while (j->written < UPLOAD_PUMP_LOOP && j->pos <= j->end) {
+		size_t granted, written;
+
+		granted = bio_grant(j->bio, MIN(j->end - j->pos + 1, UPLOAD_PUMP_MAX));
+		if (0 == granted)
+			break;
+
+		written = upload_pump_write(j, granted);
+		bio_settle(j->bio, written, granted);
+
+		if (written != granted)
+			break;
+	}
+}
+
+/**
+ * Dispose of a pump job.
+ */
+static void
+upload_pump_job_free(void *data)
+{
+	struct upload_pump_job *j = data;
+
+	WFREE(j);
+}
+
+/**
+ * Completion of a pump job, in the main thread.
+ */
+static void
+upload_pump_done(void *owner, void *data)
+{
+	struct upload *u = cast_to_upload(owner);
+	struct upload_pump_job *j = data;
+	size_t written = j->written;
+
+	g_assert(u->pumping);
+	g_assert(j->bio == u->bio);
+
+	u->pumping = FALSE;
+
+	bio_settle(u->bio, MIN(written, j->granted), j->granted);
+	u->pos = j->pos;
+	if (NULL == j->ctx) {
+		u->bpos = j->bpos;
+		u->bsize = j->bsize;
+	}
+
+	/*
+	 * When the upload is being removed, we only account for the data sent.
+	 */
+
+	if (u->pump_stopping) {
+		if (written != 0)
+			upload_account_written(u, written);
+		goto done;
+	}
+
+	/*
+	 * A read failure can happen after some data were already sent: account
+	 * for them before removing the upload.  The upload cannot be complete
+	 * since there was still data to read.
+	 */
+
+	if (0 != j->read_error || j->eof) {
+		if (written != 0)
+			upload_account_written(u, written);
+		if (0 != j->read_error) {
+			upload_remove(u, N_("File read error: %s"),
+				g_strerror(j->read_error));
+		} else {
+			upload_remove(u, N_("File EOF?"));
+		}
+		goto done;
+	} else if (0 == written) {
+		if (j->zero) {
+			upload_remove(u, N_("No bytes written, source may be gone"));
+			goto done;
+		}
+		g_assert(j->error != 0);
+		upload_write_error(u, j->error, j->ctx != NULL);
+		if (!is_temporary_error(j->error))
+			goto done;
+	}
+
+	/*
+	 * If some data were written before an error occurred, the error will
+	 * be reported again on the next write, unless it was transient.
+	 */
+
+	/*
+	 * Re-arm the source before accounting, since completing the upload will
+	 * remove it.
+	 */
+
+	bio_add_callback(u->bio, upload_writable, u);
+
+	if (written != 0)
+		upload_data_written(u, written);
+
+done:
+	WFREE(j);
+}
+
+/**
+ * Hand the next chunk of file data to the I/O threads.
+ */
+static void
+upload_pump_submit(struct upload *u)
+{
+	struct upload_pump_job *j;
+	filesize_t amount;
+	size_t granted;
+
+	g_assert(!u->pumping);
+	g_assert(u->pos <= u->end);
+
+	amount = u->end - u->pos + 1;
+	granted = bio_grant(u->bio, MIN(amount, UPLOAD_PUMP_MAX));
+
+	if (0 == granted)
+		return;			/* Source will trigger again when bandwidth allows */
+
+	WALLOC0(j);
+	j->bio = u->bio;
+	j->file = u->file;
+	j->pos = u->pos;
+	j->end = u->end;
+	j->granted = granted;
+
+	if (use_sendfile(u)) {
+		j->ctx = &u->sendfile_ctx;
+		j->in_fd = file_object_fd(u->file);
+	} else {
+		/*
+		 * If sendfile() failed on a different connection meanwhile
+		 * u->buffer is still NULL for this connection.
+		 */
+
+		if (NULL == u->buffer) {
+			u->buf_size = READ_BUF_SIZE;
+			u->buffer = halloc(u->buf_size);
+		}
+		j->buffer = u->buffer;
+		j->buf_size = u->buf_size;
+		j->bpos = u->bpos;
+		j->bsize = u->bsize;
+	}
+
+	if (NULL == u->pump) {
+		u->pump = iopool_stream_make(IOPOOL_UPLOAD,
+			str_smsg("upload to %s", host_addr_to_string(u->addr)), u,
+			upload_pump_work, upload_pump_done, upload_pump_job_free);
+	}
+
+	/*
+	 * The source must not trigger whilst the I/O thread owns the socket.
+	 */
+
+	bio_remove_callback(u->bio);
+	u->pumping = TRUE;
+	iopool_stream_submit(u->pump, j);
+}
+
+/**
+ * Wait for the pending pump job, if any, and release the pump.
+ */
+static void
+upload_pump_stop(struct upload *u)
+{
+	if (NULL == u->pump)
+		return;
+
+	u->pump_stopping = TRUE;
+	iopool_stream_free(&u->pump);
+
+	g_assert(!u->pumping);
+}
+
 /**
  * Called when output source can accept more data.
  */
@@ -6073,6 +6462,11 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		return;
 	}
 
+	if (upload_pump_enabled(u)) {
+		upload_pump_submit(u);
+		return;
+	}
+
    /*
  	* Compute the amount of bytes to send.
  	*/
@@ -6142,24 +6536,7 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 	}
 
 	if ((ssize_t) -1 == written) {
-		int e = errno;
-
-		if (
-			using_sendfile &&
-			!is_temporary_error(e) &&
-			e != EPIPE &&
-			e != ECONNRESET &&
-			e != ENOTCONN &&
-			e != ENOBUFS
-		) {
-			g_warning("sendfile() failed: \"%s\" -- "
-				"disabling sendfile() for this session", english_strerror(e));
-			sendfile_failed = TRUE;
-		}
-		if (!is_temporary_error(e)) {
-			socket_eof(u->socket);
-			upload_remove(u, N_("Data write error: %s"), g_strerror(e));
-		}
+		upload_write_error(u, errno, using_sendfile);
 		return;
 	} else if (written == 0) {
 		upload_remove(u, N_("No bytes written, source may be gone"));
@@ -6177,24 +6554,7 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		u->bpos += written;
 	}
 
-	gnet_prop_set_guint64_val(PROP_UL_BYTE_COUNT,
-		GNET_PROPERTY(ul_byte_count) + written);
-
-	u->last_update = tm_time();
-	u->sent += written;
-	if (u->file_info) {
-		fi_increase_uploaded(u->file_info, written);
-	}
-
-	/* This upload is complete */
-	if (u->pos > u->end) {
-
-		if (u->sf) {
-			upload_stats_file_complete(u->sf, u->end - u->skip + 1);
-			u->accounted = TRUE;	/* Called upload_stats_file_complete() */
-		}
-		upload_completed(u);
-	}
+	upload_data_written(u, written);
 }
 
 static inline ssize_t
@@ -6447,6 +6807,7 @@ upload_close(void)
 	while (list_uploads) {
 		struct upload *u = cast_to_upload(list_uploads->data);
 
+		upload_pump_stop(u);
 		upload_aborted_file_stats(u);
 		upload_free_resources(u);
 	}
@@ -48,6 +48,7 @@
 
 struct dl_file_info;
 struct gnutella_node;
+struct iopool_stream;
 struct parq_ul_queued;
 struct special_upload;
 
@@ -80,6 +81,7 @@ struct upload {
 	struct shared_file *thex;		/**< THEX owner we're uploading */
 	struct bio_source *bio;			/**< Bandwidth-limited source */
 	struct sendfile_ctx sendfile_ctx;
+	struct iopool_stream *pump;		/**< Threaded data pump, if used */
 
 	char *request;
 	pmsg_t *reply;					/**< HTTP reply, when partially sent */
@@ -143,6 +145,8 @@ struct upload {
 	unsigned fwalt:1;			/**< Downloader accepts firewalled locations */
 	unsigned g2:1;				/**< Initiated via G2 /PUSH */
 	unsigned tls_upgraded:1;	/**< Was upgraded to TLS */
+	unsigned pumping:1;			/**< Data pump job in progress */
+	unsigned pump_stopping:1;	/**< Data pump being stopped */
 };
 
 static inline void
@@ -27,25 +27,20 @@
  *
  * Asynchronous hash computation.
  *
- * Computation is done in a separate thread, but this is invisible to the
- * calling thread as callbacks happen in the calling thread context.
+ * Computation is done by a pool of verification threads, but this is
+ * invisible to the calling thread as callbacks happen in the context of
+ * the main thread.
  *
- * Each verification thread is given a thread event queue (TEQ), and the
- * calling thread needs to also create its own TEQ so that we can properly
- * dispatch callbacks.
+ * Each hash type is handled by a "verifier", created by verify_new(), to
+ * which work is submitted through verify_enqueue().  All the verifiers
+ * share the same pool of threads, which pull the work from a common queue.
  *
- * As work is concurrently inserted into the verification lists, a notification
- * event is sent to the computing thread to wake it up.
- *
- * On systems with 2 CPUs only, all the verifications are handled by one single
- * thread, so we continue to use the legacy code, relying on the background
- * task scheduler to properly arbitrate processing between the various hash
- * verifications.
- *
- * As soon as there are 3 CPUs or more, all the verifications are handled in
- * separate threads, but there are distinct background task schedulers created,
- * so each thread can use almost all its processing ticks to actually compute
- * the hash value.
+ * The amount of threads is configured by the "verify_threads" property,
+ * one thread per CPU being used by default.  Since hashing is mostly I/O
+ * bound when files are not cached, the queue is partitioned by device
+ * and the amount of threads that can concurrently hash files held on the
+ * same device is limited by the "verify_device_threads" property, to avoid
+ * thrashing rotating disks with concurrent sequential reads.
  *
  * @author Raphael Manfredi
  * @date 2002-2003, 2013
@@ -58,12 +53,9 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
-#include "lib/atomic.h"
 #include "lib/atoms.h"
-#include "lib/barrier.h"
-#include "lib/bg.h"
 #include "lib/compat_misc.h"
-#include "lib/constants.h"
+#include "lib/cond.h"
 #include "lib/cq.h"
 #include "lib/entropy.h"
 #include "lib/file.h"
@@ -72,8 +64,9 @@
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hashlist.h"
+#include "lib/mutex.h"
 #include "lib/str.h"
-#include "lib/stringify.h"		/* For short_time_ascii() */
+#include "lib/stringify.h"
 #include "lib/teq.h"
 #include "lib/thread.h"
 #include "lib/tm.h"
@@ -83,24 +76,40 @@
 
 #define HASH_BUF_SIZE		(128 * 1024)	/**< Size of the reading buffer */
 
-#define HASH_THREAD_MAX			2			/**< At most 2 hashing threads */
+#define VERIFY_THREAD_MAX		64			/**< Max hashing threads */
 #define VERIFY_DEFERRED			10			/**< ms: deferred free timeout */
 #define VERIFY_PROGRESS_NOTIFY	1			/**< s: progress notification */
 
-#define VERIFY_INVALID_LOCAL_ID -1U
+#define VERIFY_DEV_UNRESOLVED	((uint64) -1)	/**< Device not known yet */
+
+enum verifier_magic { VERIFIER_MAGIC = 0x3a8d1e5bU };
+
+/**
+ * A verifier, handling all the computations for a given hash.
+ */
+struct verifier {
+	enum verifier_magic magic;		/**< Magic number */
+	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
+	uint running;					/**< Files being hashed (pool-locked) */
+	uint8 shutdowned;				/**< Flag indicating verifier was shutdown */
+};
+
+static inline void
+verifier_check(const struct verifier * const vf)
+{
+	g_assert(vf != NULL);
+	g_assert(VERIFIER_MAGIC == vf->magic);
+}
 
 enum verify_magic { VERIFY_MAGIC = 0x2dc84379U };
 
 /**
- * Verification task context.
+ * Verification context, for the file being hashed.
  */
 struct verify {
 	enum verify_magic magic;	/**< Magic number. */
-	hash_list_t *files_to_hash;	/**< Work queue */
-	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
-	struct bgtask *task;		/**< Background task handling the processing */
-	bgsched_t *sched;			/**< Task scheduler for this thread */
-	unsigned verify_stid;		/**< Verification thread ID */
+	const struct verifier *vf;	/**< Verifier for which we compute a hash */
+	void *hctx;					/**< Hash computation context */
 
 	file_object_t *file;		/**< The file object to access the file. */
 	filesize_t offset;			/**< Current offset into the file. */
@@ -112,7 +121,7 @@ struct verify {
 	size_t buffer_size;			/**< Size of buffer in bytes. */
 
 	enum verify_status status;	/**< Used for callback multiplexing. */
-	uint8 shutdowned;			/**< Flag indicating context was shutdown */
+	uint8 accepted;				/**< Callback accepted VERIFY_START */
 
 	/* Fields copied from currently processed verify_file entry */
 	verify_callback	callback;	/**< User-specified callback function. */
@@ -129,36 +138,38 @@ verify_check(const struct verify * const ctx)
 static inline void
 verify_hash_init(const struct verify * const ctx)
 {
-	ctx->hash.init(ctx->end - ctx->start);
+	ctx->vf->hash.init(ctx->hctx, ctx->end - ctx->start);
 }
 
 static inline int
 verify_hash_update(const struct verify * const ctx, const void *data, size_t n)
 {
-	return ctx->hash.update(data, n);
+	return ctx->vf->hash.update(ctx->hctx, data, n);
 }
 
 static inline int
 verify_hash_final(const struct verify * const ctx)
 {
-	return ctx->hash.final();
+	return ctx->vf->hash.final(ctx->hctx);
 }
 
 static inline const char *
 verify_hash_name(const struct verify * const ctx)
 {
-	return ctx->hash.name();
+	return ctx->vf->hash.name();
 }
 
 enum verify_file_magic { VERIFY_FILE_MAGIC = 0x063ac7adU };
 
 struct verify_file {
 	enum verify_file_magic magic;	/**< Magic number */
+	struct verifier *vf;			/**< Verifier to use */
 	const char *pathname;			/**< Absolute path of the file */
 	filesize_t offset;				/**< Offset to start at */
 	filesize_t amount;				/**< Amount of bytes to hash */
 	verify_callback	callback;		/**< User-specified callback function */
 	void *user_data;				/**< Callback argument */
+	uint8 high_priority;			/**< Whether item was flagged urgent */
 };
 
 static inline void
@@ -169,7 +180,8 @@ verify_file_check(const struct verify_file * const item)
 }
 
 static struct verify_file *
-verify_file_new(const char *pathname, filesize_t offset, filesize_t amount,
+verify_file_new(struct verifier *vf,
+	const char *pathname, filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
 {
 	struct verify_file *item;
@@ -179,6 +191,7 @@ verify_file_new(const char *pathname, filesize_t offset, filesize_t amount,
 
 	WALLOC0(item);
 	item->magic = VERIFY_FILE_MAGIC;
+	item->vf = vf;
 	item->pathname = atom_str_get(pathname);
 	item->offset = offset;
 	item->amount = amount;
@@ -197,9 +210,45 @@ verify_file_free(struct verify_file **ptr)
 		atom_str_free_null(&item->pathname);
 		item->magic = 0;
 		WFREE(item);
+		*ptr = NULL;
 	}
 }
 
+/**
+ * Queued files to hash, for a given device.
+ */
+struct verify_device {
+	uint64 dev;					/**< Device number (MUST be first) */
+	hash_list_t *queue;			/**< Files to hash on this device */
+	uint active;				/**< Threads hashing files on this device */
+};
+
+/**
+ * The pool of verification threads.
+ *
+ * All the fields are protected by the lock.
+ */
+static struct verify_pool {
+	mutex_t lock;				/**< Thread-safe lock */
+	cond_t work;				/**< Signalled when work can be done */
+	hash_list_t *devices;		/**< Devices with queued or active work */
+	size_t queued;				/**< Total amount of queued files */
+	uint threads;				/**< Amount of running threads */
+	uint idle;					/**< Amount of idle threads */
+	uint verifiers;				/**< Amount of live verifiers */
+	uint8 exiting;				/**< Set when threads must exit */
+} verify_pool = {
+	MUTEX_INIT,
+	COND_INIT,
+	NULL, 0, 0, 0, 0, FALSE
+};
+
+#define VERIFY_POOL_LOCK	mutex_lock(&verify_pool.lock)
+#define VERIFY_POOL_UNLOCK	mutex_unlock(&verify_pool.lock)
+
+#define assert_verify_pool_locked() \
+	assert_mutex_is_owned(&verify_pool.lock)
+
 /*
  * NOTA BENE:
  *
@@ -220,8 +269,11 @@ verify_file_free(struct verify_file **ptr)
  *		--RAM, 2013-10-13
  *
  * The teq_safe_rpc() routine is a cancellation point, but the verification
- * thread is created as non-cancellable, so we do not have to worry about
+ * threads are created as non-cancellable, so we do not have to worry about
  * possible cancellation.
+ *
+ * Since all the callbacks are funnelled to the main thread, they are
+ * naturally serialized even though several files are hashed concurrently.
  */
 
 /**
@@ -239,15 +291,18 @@ verify_cb(void *arg)
 }
 
 /**
- * If the callback returns FALSE, hashing of the current file will be
- * aborted and verify_failure() will be called afterwards.
+ * Invoke user callback in the main thread.
  */
 static bool
-verify_start(struct verify *ctx)
+verify_notify(struct verify *ctx, enum verify_status status)
 {
 	verify_check(ctx);
 
-	ctx->status = VERIFY_START;
+	ctx->status = status;
+
+	if (thread_is_main())
+		return pointer_to_bool(verify_cb(ctx));
+
 	return pointer_to_bool(teq_safe_rpc(THREAD_MAIN_ID, verify_cb, ctx));
 }
 
@@ -256,41 +311,39 @@ verify_start(struct verify *ctx)
  * aborted and verify_failure() will be called afterwards.
  */
 static bool
-verify_progress(struct verify *ctx)
+verify_start(struct verify *ctx)
 {
-	verify_check(ctx);
+	return verify_notify(ctx, VERIFY_START);
+}
 
-	ctx->status = VERIFY_PROGRESS;
-	return pointer_to_bool(teq_safe_rpc(THREAD_MAIN_ID, verify_cb, ctx));
+/**
+ * If the callback returns FALSE, hashing of the current file will be
+ * aborted and verify_failure() will be called afterwards.
+ */
+static bool
+verify_progress(struct verify *ctx)
+{
+	return verify_notify(ctx, VERIFY_PROGRESS);
 }
 
 static void
 verify_failure(struct verify *ctx)
 {
-	verify_check(ctx);
-
-	ctx->status = VERIFY_ERROR;
-	(void) teq_safe_rpc(THREAD_MAIN_ID, verify_cb, ctx);
+	(void) verify_notify(ctx, VERIFY_ERROR);
 	ctx->status = VERIFY_INVALID;
 }
 
 static void
 verify_shutdown(struct verify *ctx)
 {
-	verify_check(ctx);
-
-	ctx->status = VERIFY_SHUTDOWN;
-	(void) teq_safe_rpc(THREAD_MAIN_ID, verify_cb, ctx);
+	(void) verify_notify(ctx, VERIFY_SHUTDOWN);
 	ctx->status = VERIFY_INVALID;
 }
 
 static void
 verify_done(struct verify *ctx)
 {
-	verify_check(ctx);
-
-	ctx->status = VERIFY_DONE;
-	(void) teq_safe_rpc(THREAD_MAIN_ID, verify_cb, ctx);
+	(void) verify_notify(ctx, VERIFY_DONE);
 	ctx->status = VERIFY_INVALID;
 }
 
@@ -304,6 +357,21 @@ verify_status(const struct verify *ctx)
 	return ctx->status;
 }
 
+/**
+ * The callback function may call this to know whether it accepted to hash
+ * the file when notified with VERIFY_START.
+ *
+ * This lets it determine, when notified with VERIFY_ERROR or VERIFY_SHUTDOWN,
+ * whether it has to undo what it did when the computation started.
+ */
+bool
+verify_accepted(const struct verify *ctx)
+{
+	verify_check(ctx);
+
+	return ctx->accepted;
+}
+
 /**
  * The callback function may call this to obtain the amount of bytes
  * that have been hashed of the current file so far.
@@ -335,6 +403,65 @@ verify_elapsed(const struct verify *ctx)
 	return d;
 }
 
+/**
+ * The callback function may call this to get at the hash computation context
+ * of the current file, as created by the make() hash operation, in order to
+ * fetch the computed digest.
+ */
+void *
+verify_hash_context(const struct verify *ctx)
+{
+	verify_check(ctx);
+
+	return ctx->hctx;
+}
+
+/**
+ * Create a verification context for given item.
+ *
+ * @param item		the file to hash
+ * @param buffer	the reading buffer to use, NULL if no hashing will occur
+ */
+static struct verify *
+verify_context_new(const struct verify_file *item, char *buffer)
+{
+	struct verify *ctx;
+
+	verify_file_check(item);
+
+	WALLOC0(ctx);
+	ctx->magic = VERIFY_MAGIC;
+	ctx->vf = item->vf;
+	ctx->buffer = buffer;
+	ctx->buffer_size = HASH_BUF_SIZE;
+	ctx->user_data = item->user_data;
+	ctx->callback = item->callback;
+	ctx->start = item->offset;
+	ctx->end = item->offset + item->amount;
+	ctx->offset = ctx->start;
+
+	if (buffer != NULL)
+		ctx->hctx = item->vf->hash.make();
+
+	return ctx;
+}
+
+/**
+ * Free verification context.
+ */
+static void
+verify_context_free(struct verify *ctx)
+{
+	verify_check(ctx);
+	g_assert(NULL == ctx->file);
+
+	if (ctx->hctx != NULL)
+		ctx->vf->hash.free(ctx->hctx);
+
+	ctx->magic = 0;
+	WFREE(ctx);
+}
+
 static uint
 verify_item_hash(const void *key)
 {
@@ -344,6 +471,7 @@ verify_item_hash(const void *key)
 
 	return hashing_mix32(
 		string_mix_hash(ctx->pathname)
+		^ pointer_hash(ctx->vf)
 		^ uint64_hash(&ctx->offset)
 		^ uint64_hash(&ctx->amount)
 		^ pointer_hash(func_to_pointer(ctx->callback))
@@ -359,6 +487,7 @@ verify_item_equal(const void *p, const void *q)
 	verify_file_check(b);
 
 	return 0 == strcmp(a->pathname, b->pathname) &&
+			a->vf == b->vf &&
 			a->offset == b->offset &&
 			a->amount == b->amount &&
 			a->callback == b->callback &&
@@ -366,460 +495,252 @@ verify_item_equal(const void *p, const void *q)
 }
 
 /**
- * Variables controlling asynchronous "cancellation" of verification threads.
- *
- * The verify_exit[] array is index by a small number (the "local thread ID")
- * and tells the thread whether it has received a TSIG_TERM signal.
- *
- * The verify_threads[] array contains the ID of threads, and a linear lookup
- * is used to find the proper "local thread ID", the index at which we find
- * a matching thread ID.
+ * Get the device queue for given device number, creating it if needed.
  */
-static bool verify_exit[HASH_THREAD_MAX];
-static unsigned verify_threads[HASH_THREAD_MAX];
-static int verify_thread_count;
-
-/**
- * Structure passed to verify_thread_has_work().
- */
-struct verify_work {
-	bgsched_t *bs;		/**< Background task scheduler */
-	int id;				/**< Local thread ID */
-};
-
-/**
- * Is there work pending in the scheduler, or is thread terminated?
- */
-static bool
-verify_thread_has_work(void *arg)
+static struct verify_device *
+verify_device_get(uint64 dev)
 {
-	struct verify_work *w = arg;
+	struct verify_device *vd;
+	const void *key;
 
-	/*
-	 * When the thread should exit, as indicated by verify_exit[] being set,
-	 * we return TRUE to make sure we exit from the teq_wait() call.
-	 */
-
-	return verify_exit[w->id] || 0 != bg_sched_runcount(w->bs);
-}
+	assert_verify_pool_locked();
 
-/**
- * Compute local thread ID of verification thread.
- */
-static unsigned
-verify_thread_local_id(unsigned stid, bool panic)
-{
-	unsigned i;
-
-	for (i = 0; i < N_ITEMS(verify_threads); i++) {
-		if (verify_threads[i] == stid)
-			return i;
+	if G_UNLIKELY(NULL == verify_pool.devices) {
+		verify_pool.devices = hash_list_new(uint64_hash, uint64_eq);
 	}
 
-	if (panic)
-		s_error("%s(): cannot find %s", G_STRFUNC, thread_id_name(stid));
+	if (hash_list_find(verify_pool.devices, &dev, &key))
+		return deconstify_pointer(key);
+
+	WALLOC0(vd);
+	vd->dev = dev;
+	vd->queue = hash_list_new(verify_item_hash, verify_item_equal);
+	hash_list_append(verify_pool.devices, vd);
 
-	return VERIFY_INVALID_LOCAL_ID;		/* Invalid ID, meaning not found */
+	return vd;
 }
 
 /**
- * Signal handler to terminate the thread.
+ * Dispose of device queue if it is no longer needed.
  */
 static void
-verify_thread_terminate(int sig)
+verify_device_release(struct verify_device *vd)
 {
-	unsigned i;
+	assert_verify_pool_locked();
 
-	g_assert(TSIG_TERM == sig);
+	if (0 != vd->active || 0 != hash_list_length(vd->queue))
+		return;
 
-	i = verify_thread_local_id(thread_small_id(), TRUE);
-	verify_exit[i] = TRUE;
+	hash_list_remove(verify_pool.devices, vd);
+	hash_list_free(&vd->queue);
+	WFREE(vd);
 }
 
 /**
- * Arguments passed to the verification thread.
+ * Can we start hashing another file on the device?
  */
-struct verify_thread_arg {
-	const char *name;			/* Thread name */
-	barrier_t *b;				/* Setup barrier */
-	bgsched_t *sched;			/* Background task scheduler to run */
-};
-
-/**
- * Verfication thread main loop.
- */
-static void *
-verify_thread_main(void *p)
+static inline bool
+verify_device_has_room(const struct verify_device *vd)
 {
-	struct verify_thread_arg *args = p;
-	struct verify_work winfo;
-	int i;
-
-	thread_set_name(args->name);
-	teq_create();				/* Queue to receive incoming work */
-	barrier_wait(args->b);		/* Thread has initialized */
-	barrier_free_null(&args->b);
-	winfo.bs = args->sched;
-	WFREE_TYPE_NULL(args);
-
-	if (GNET_PROPERTY(verify_debug))
-		g_debug("verification %s started", thread_name());
-
-	/*
-	 * Prepare for termination when receiveing a TSIG_TERM.
-	 */
-
-	winfo.id = i = atomic_int_inc(&verify_thread_count);
-
-	g_assert(i < HASH_THREAD_MAX);		/* Not creating too many threads */
-
-	verify_threads[i] = thread_small_id();
-	thread_signal(TSIG_TERM, verify_thread_terminate);
-
-	g_assert(verify_threads[i] != 0);	/* Not the main thread */
-
-	/*
-	 * Process incoming work, until thread is terminated.
-	 */
-
-	while (!verify_exit[i]) {
-		if (GNET_PROPERTY(verify_debug))
-			g_debug("verification %s sleeping", thread_name());
-
-		teq_wait(verify_thread_has_work, &winfo);
-
-		if (GNET_PROPERTY(verify_debug))
-			g_debug("verification %s awoken", thread_name());
-
-		while (0 != bg_sched_run(winfo.bs))
-			thread_check_suspended();
-	}
-
-	g_debug("verification %s exiting", thread_name());
-
-	bg_sched_destroy_null(&winfo.bs);
-	verify_threads[i] = 0;			/* Signals: can destroy verify context */
-
-	return NULL;
+	return vd->active < MAX(1, GNET_PROPERTY(verify_device_threads));
 }
 
 /**
- * Create a new verification thread with given name.
- *
- * This routine does not return until the verification thread has been
- * correctly initialized, so that the caller can immediately start to
- * enqueue work to the thread.
+ * Can we pick another file from the device queue?
  *
- * @param v			the verification context for which we create a thread
- * @param name		the background task scheduler to use in that thread
- * @param name		the created thread name
- *
- * @return thread ID, -1 on error.
+ * Files whose device is not resolved yet can always be picked, since we
+ * are not going to hash them before knowing where they lie.
  */
-static int
-verify_thread_create(struct verify *v, bgsched_t *bs, const char *name)
+static inline bool
+verify_device_available(const struct verify_device *vd)
 {
-	barrier_t *b;
-	struct verify_thread_arg *args;
-	int r;
-
-	b = barrier_new(2);
-
-	WALLOC(args);
-	args->name = name;
-	args->b = barrier_refcnt_inc(b);
-	args->sched = bs;
-
-	/*
-	 * The verification thread is created as a detached thread because we
-	 * do not expect any result from it.
-	 *
-	 * It is created as non-cancelable: to end it, we send it a TSIG_TERM.
-	 */
-
-	r = thread_create(verify_thread_main, args,
-			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
-				THREAD_F_NO_POOL | THREAD_F_PANIC,
-			THREAD_STACK_MIN);
-
-	v->verify_stid = r;
-	v->sched = bs;
-
-	barrier_wait(b);		/* Wait for thread to initialize */
-	barrier_free_null(&b);
-
-	return r;
+	return 0 != hash_list_length(vd->queue) &&
+		(VERIFY_DEV_UNRESOLVED == vd->dev || verify_device_has_room(vd));
 }
 
 /**
- * Create a new verification thread if necessary.
+ * Find the device queue holding an item equivalent to the given one.
+ *
+ * @return the device queue, NULL if the item is not queued.
  */
-static void
-verify_thread_create_if_needed(struct verify *v)
+static struct verify_device *
+verify_device_holding(const struct verify_file *item)
 {
-	static unsigned verify_id;
-	static bgsched_t *verify_bs;
-	long cpus = getcpucount();
+	struct verify_device *vd;
+	hash_list_iter_t *iter;
 
-	g_assert(thread_is_main());		/* Always called from main thread */
+	assert_verify_pool_locked();
 
-	/*
-	 * When there are more than 2 CPUs, we are on a multi-core system and we
-	 * create one thread per verification.  If they have only 2 CPUs, then we
-	 * just create a single thread to handle all the verifications.
-	 */
+	if G_UNLIKELY(NULL == verify_pool.devices)
+		return NULL;
 
-	if (cpus <= 2) {
-		if G_UNLIKELY(NULL == verify_bs) {
-			static const char name[] = "verify";
+	iter = hash_list_iterator(verify_pool.devices);
 
-			verify_bs = bg_sched_create(name, 500000);		/* 500 ms */
-			verify_id = verify_thread_create(v, verify_bs, name);
-		} else {
-			v->sched = verify_bs;
-			v->verify_stid = verify_id;
-		}
-	} else {
-		const char *tname = str_smsg("verify %s", verify_hash_name(v));
-		const char *name = constant_str(tname);
-
-		bgsched_t *bs = bg_sched_create(name, 1000000);		/* 1 sec */
-		(void) verify_thread_create(v, bs, name);
+	while (NULL != (vd = hash_list_iter_next(iter))) {
+		if (hash_list_contains(vd->queue, item))
+			break;
 	}
+
+	hash_list_iter_release(&iter);
+
+	return vd;
 }
 
 /**
- * Create a new verification context.
- *
- * @param hash		Hash-specific callbacks for this hash verification
- *
- * @return verification context to which work can be requested via
- * verify_enqueue()
+ * Put item in the device queue, at the head if it was flagged urgent.
  */
-struct verify *
-verify_new(const struct verify_hash *hash)
+static void
+verify_device_queue(struct verify_device *vd, struct verify_file *item)
 {
-	struct verify *ctx;
-
-	g_assert(hash);
+	assert_verify_pool_locked();
 
-	WALLOC0(ctx);
-	ctx->magic = VERIFY_MAGIC;
-	ctx->buffer_size = HASH_BUF_SIZE;
-	ctx->buffer = halloc(ctx->buffer_size);
-	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
-	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
-	ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
-	hash_list_thread_safe(ctx->files_to_hash);
-
-	verify_thread_create_if_needed(ctx);
+	if (item->high_priority)
+		hash_list_prepend(vd->queue, item);
+	else
+		hash_list_append(vd->queue, item);
 
-	return ctx;
+	verify_pool.queued++;
 }
 
 /**
- * Callout queue callback to check whether we can free the verify context.
+ * Flag queued item as urgent, moving it to the head of its device queue.
  */
 static void
-verify_deferred_free(cqueue_t *cq, void *data)
+verify_device_promote(struct verify_device *vd, const struct verify_file *item)
 {
-	struct verify *ctx = data;
-	unsigned i;
+	const void *key;
 
-	verify_check(ctx);
-
-	/*
-	 * We do not free the verification context until the thread that uses it
-	 * has not marked it was about to exit by clearing its corresponding
-	 * entry in verify_threads[].
-	 */
-
-	i = verify_thread_local_id(ctx->verify_stid, FALSE);
-
-	if (i != VERIFY_INVALID_LOCAL_ID) {
-		/*
-		 * Thread has not terminated yet, could have pending RPCs...
-		 */
-
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("verification %s for %s not terminated yet",
-				thread_id_name(ctx->verify_stid), verify_hash_name(ctx));
-		}
+	assert_verify_pool_locked();
 
-		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, ctx);
-	} else {
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("freeing %s verification context", verify_hash_name(ctx));
-		}
-
-		hash_list_free(&ctx->files_to_hash);
-		ctx->magic = 0;
-		WFREE(ctx);
+	if (hash_list_find(vd->queue, item, &key)) {
+		struct verify_file *queued = deconstify_pointer(key);
+		queued->high_priority = TRUE;
+		hash_list_moveto_head(vd->queue, queued);
 	}
 }
 
 /**
- * Free verification context and nullify its pointer.
+ * Pick the next file to hash, honouring the per-device concurrency limits.
+ *
+ * Devices whose next file was flagged urgent are served first, then devices
+ * are served in a round-robin fashion.
  *
- * The actual physical disposal of the verification context is deferred until
- * the thread responsible for handling the work has terminated.
+ * @param vd_ptr	written with the device on which the file lies
+ *
+ * @return the file to hash, NULL if there is nothing we can do now.
  */
-void
-verify_free(struct verify **ptr)
+static struct verify_file *
+verify_pool_pick(struct verify_device **vd_ptr)
 {
-	struct verify *ctx = *ptr;
-
-	if (ctx != NULL) {
-		verify_check(ctx);
-		g_assert(!ctx->shutdowned);
+	struct verify_device *vd, *chosen = NULL;
+	struct verify_file *item;
+	hash_list_iter_t *iter;
 
-		if (ctx->task != NULL) {
-			bg_task_cancel(ctx->task);
-			ctx->task = NULL;
-		}
+	assert_verify_pool_locked();
 
-		ctx->shutdowned = TRUE;
-		thread_kill(ctx->verify_stid, TSIG_TERM);
-		*ptr = NULL;
+	if (0 == verify_pool.queued)
+		return NULL;
 
-		/*
-		 * Defer freeing of the context until the thread is dead
-		 *
-		 * We leave the ctx->files_to_hash list around as well because
-		 * it could still be accessed by other threads.
-		 */
+	iter = hash_list_iterator(verify_pool.devices);
 
-		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, ctx);
+	while (NULL != (vd = hash_list_iter_next(iter))) {
+		if (!verify_device_available(vd))
+			continue;
+		if (NULL == chosen)
+			chosen = vd;
+		item = hash_list_head(vd->queue);
+		if (item->high_priority) {
+			chosen = vd;
+			break;
+		}
 	}
-}
 
-static void
-verify_context_free(void *data)
-{
-	struct verify *ctx = data;
+	hash_list_iter_release(&iter);
 
-	verify_check(ctx);
-	/* If we're called, the task is being terminated */
+	if (NULL == chosen)
+		return NULL;
 
-	/*
-	 * There's nothing to free here.  We're managing the overall context
-	 * ourselves, and this overall context is given as the task's context.
-	 * We just need to record the fact that the task has been terminated
-	 * here so verify_free() does not try to cancel it.
-	 */
+	item = hash_list_shift(chosen->queue);
+	verify_file_check(item);
+	verify_pool.queued--;
 
-	ctx->task = NULL;
+	hash_list_moveto_tail(verify_pool.devices, chosen);	/* Round-robin */
+	*vd_ptr = chosen;
 
-	if (GNET_PROPERTY(verify_debug) > 1) {
-		g_debug("destroying task for %s verification", verify_hash_name(ctx));
-	}
+	return item;
 }
 
+/**
+ * Hash the file described by the item.
+ *
+ * @param item		the file to hash
+ * @param buffer	the reading buffer to use
+ */
 static void
-verify_next_file(struct verify *ctx)
+verify_process(const struct verify_file *item, char *buffer)
 {
-	struct verify_file *item;
-	bool skipped = FALSE;
-
-	verify_check(ctx);
-	g_assert(NULL == ctx->file);
-
-	item = hash_list_shift(ctx->files_to_hash);
-	if (item != NULL) {
-		verify_file_check(item);
-
-		ctx->user_data = item->user_data;
-		ctx->callback = item->callback;
-		ctx->start = item->offset;
-		ctx->end = item->offset + item->amount;
-		ctx->offset = ctx->start;
-
-		if (verify_start(ctx)) {
-			ctx->file = file_object_open(item->pathname, O_RDONLY);
-			if (NULL == ctx->file) {
-				g_warning("failed to open \"%s\" for %s hashing: %m",
-					item->pathname, verify_hash_name(ctx));
-			}
-		} else {
-			if (GNET_PROPERTY(verify_debug)) {
-				g_debug("discarding request of %s digest for %s",
-					verify_hash_name(ctx), item->pathname);
-			}
-			skipped = TRUE;
-		}
+	struct verify *ctx;
+	const struct verifier *vf = item->vf;
 
-		verify_file_free(&item);
+	ctx = verify_context_new(item, buffer);
 
-		if (NULL == ctx->file)
-			goto done;
-	}
-
-	if (ctx->file) {
+	if (!verify_start(ctx)) {
 		if (GNET_PROPERTY(verify_debug)) {
-			g_debug("verifying %s digest for %s",
-				verify_hash_name(ctx), file_object_pathname(ctx->file));
+			g_debug("discarding request of %s digest for %s",
+				verify_hash_name(ctx), item->pathname);
 		}
-		verify_hash_init(ctx);
-		file_object_fadvise_sequential(ctx->file);
-		ctx->last_progress = ctx->started = tm_time_exact();
-	}
-	return;
-
-done:
-	if (skipped)
 		verify_shutdown(ctx);
-	else
-		verify_failure(ctx);
+		goto done;
+	}
 
-	file_object_release(&ctx->file);
-}
+	ctx->accepted = TRUE;
 
-static void
-verify_final(struct verify *ctx)
-{
-	verify_check(ctx);
+	ctx->file = file_object_open(item->pathname, O_RDONLY);
 
-	if (ctx->offset != ctx->end) {
-		g_warning("file shrunk? \"%s\"", file_object_pathname(ctx->file));
-		verify_failure(ctx);
-	} else if (verify_hash_final(ctx)) {
-		g_warning("verify_hash_final() failed for \"%s\"",
-			file_object_pathname(ctx->file));
+	if (NULL == ctx->file) {
+		g_warning("failed to open \"%s\" for %s hashing: %m",
+			item->pathname, verify_hash_name(ctx));
 		verify_failure(ctx);
-	} else {
-		verify_done(ctx);
+		goto done;
 	}
-	file_object_release(&ctx->file);
-}
 
-static void
-verify_update(struct verify *ctx)
-{
-	ssize_t r;
+	if (GNET_PROPERTY(verify_debug)) {
+		g_debug("%s verifying %s digest for %s", thread_name(),
+			verify_hash_name(ctx), file_object_pathname(ctx->file));
+	}
 
-	verify_check(ctx);
+	verify_hash_init(ctx);
+	file_object_fadvise_sequential(ctx->file);
+	ctx->last_progress = ctx->started = tm_time_exact();
 
-	if (ctx->offset < ctx->end) {
+	while (ctx->offset < ctx->end) {
 		filesize_t amount;
 		size_t n;
+		ssize_t r;
+		time_t now;
+
+		if G_UNLIKELY(vf->shutdowned || verify_pool.exiting) {
+			if (GNET_PROPERTY(verify_debug)) {
+				g_debug("%s aborting %s digest for %s", thread_name(),
+					verify_hash_name(ctx), file_object_pathname(ctx->file));
+			}
+			verify_shutdown(ctx);
+			goto done;
+		}
 
 		amount = ctx->end - ctx->offset;
 		n = MIN(amount, ctx->buffer_size);
 		r = file_object_pread(ctx->file, ctx->buffer, n, ctx->offset);
-	} else {
-		r = 0;
-	}
 
-	if ((ssize_t) -1 == r) {
-		if (!is_temporary_error(errno)) {
+		if ((ssize_t) -1 == r) {
+			if (is_temporary_error(errno))
+				continue;
 			g_warning("error while reading \"%s\": %m",
 				file_object_pathname(ctx->file));
 			goto error;
+		} else if (0 == r) {
+			break;		/* File shrunk */
 		}
-	} else if (0 == r) {
-		verify_final(ctx);
-	} else {
-		time_t now;
 
 		ctx->offset += (size_t) r;
 
@@ -830,10 +751,9 @@ verify_update(struct verify *ctx)
 		}
 
 		/*
-		 * Don't inform about progress too frequently: if we're running in
-		 * a dedicated thread, the notification will issue a cross-thread RPC
-		 * which is slowing down the computation since we need to wait for
-		 * the reply before resuming.
+		 * Don't inform about progress too frequently: the notification will
+		 * issue a cross-thread RPC which is slowing down the computation
+		 * since we need to wait for the reply before resuming.
 		 */
 
 		now = tm_time();
@@ -846,215 +766,433 @@ verify_update(struct verify *ctx)
 				goto error;
 			}
 		}
+
+		thread_check_suspended();
 	}
-	return;
+
+	if (ctx->offset != ctx->end) {
+		g_warning("file shrunk? \"%s\"", file_object_pathname(ctx->file));
+		verify_failure(ctx);
+	} else if (verify_hash_final(ctx)) {
+		g_warning("verify_hash_final() failed for \"%s\"",
+			file_object_pathname(ctx->file));
+		verify_failure(ctx);
+	} else {
+		verify_done(ctx);
+	}
+	goto done;
 
 error:
 	verify_failure(ctx);
+	/* FALL THROUGH */
+
+done:
 	file_object_release(&ctx->file);
+	verify_context_free(ctx);
 }
 
 /**
- * Drop all the queued items for the verification thread.
+ * Discard item, notifying its owner with VERIFY_SHUTDOWN.
  *
- * This is dispatched to the main thread.
+ * The pool lock is released whilst the owner is notified.
  */
 static void
-verify_queue_flush(void *data)
+verify_pool_discard(struct verify_file *item)
 {
-	struct verify *ctx = data;
-	struct verify_file *item;
+	struct verify *ctx;
 
-	verify_check(ctx);
-	g_assert(thread_is_main());
+	assert_verify_pool_locked();
 
-	while (NULL != (item = hash_list_shift(ctx->files_to_hash))) {
-		/* Setup minimal context to call verify_shutdown() */
-		ctx->user_data = item->user_data;
-		ctx->callback = item->callback;
+	VERIFY_POOL_UNLOCK;
 
-		verify_shutdown(ctx);
-		verify_file_free(&item);
-	}
+	ctx = verify_context_new(item, NULL);
+	verify_shutdown(ctx);
+	verify_context_free(ctx);
+	verify_file_free(&item);
+
+	VERIFY_POOL_LOCK;
 }
 
 /**
- * Signal handler for task termination.
+ * Determine the device on which the file lies.
+ *
+ * This is done by the verification threads and not when the file is
+ * enqueued, because stat() can block for a long time on network filesystems
+ * and files are enqueued by the main thread.
+ *
+ * The pool lock is released during the stat() call.
  *
- * This handler is invoked from the background task scheduler and is therefore
- * run in the thread that is handling verification.
+ * @param item		a file taken from the queue of unresolved devices
+ * @param vd_ptr	the unresolved device, written with the file's device
+ *
+ * @return the file if it can be hashed now, NULL if it was put in the queue
+ * of its device or discarded.
  */
-static void
-verify_bg_sighandler(struct bgtask *bt, void *data, bgsig_t sig)
+static struct verify_file *
+verify_pool_resolve(struct verify_file *item, struct verify_device **vd_ptr)
 {
-	struct verify *ctx = data;
+	struct verify_device *vd = *vd_ptr;
+	struct verifier *vf = item->vf;
+	filestat_t buf;
+	uint64 dev = 0;
 
-	verify_check(ctx);
-	g_assert(BG_SIG_TERM == sig);
-
-	if (GNET_PROPERTY(verify_debug)) {
-		g_debug("cancelling background task \"%s\" in %s",
-			bg_task_name(bt), thread_name());
-	}
+	assert_verify_pool_locked();
+	g_assert(VERIFY_DEV_UNRESOLVED == vd->dev);
 
 	/*
-	 * Abort current file hashing.
+	 * Prevent disposal of the device queue and of the verifier whilst
+	 * we are not holding the lock.
 	 */
 
-	if (ctx->file != NULL) {
-		verify_shutdown(ctx);
-		file_object_release(&ctx->file);
-	}
-	HFREE_NULL(ctx->buffer);
+	vd->active++;
+	vf->running++;
+
+	VERIFY_POOL_UNLOCK;
 
 	/*
-	 * Flush the queue.
-	 *
-	 * To speed things up, we'll redirect this work to the main thread: since
-	 * we're shutdowning, there's no real processing done in the main thread,
-	 * and it will be more efficient if we're currently in the library thread
-	 * since we will avoid all these TEQ RPCs between the two threads.
+	 * Files that cannot be stat()'ed are put in the queue of device 0: the
+	 * error will be reported when attempting to open them for hashing.
 	 */
 
-	teq_post(THREAD_MAIN_ID, verify_queue_flush, ctx);
+	if (0 == stat(item->pathname, &buf))
+		dev = buf.st_dev;
+
+	VERIFY_POOL_LOCK;
+
+	vd->active--;
+	verify_device_release(vd);
+
+	if G_UNLIKELY(VERIFY_DEV_UNRESOLVED == dev)
+		dev = 0;
+
+	vd = verify_device_get(dev);
+
+	if G_UNLIKELY(vf->shutdowned || hash_list_contains(vd->queue, item)) {
+		/*
+		 * An equivalent item could have been enqueued whilst we were
+		 * resolving this one, in which case this one is superseded.
+		 */
+
+		if (item->high_priority && !vf->shutdowned)
+			verify_device_promote(vd, item);
+
+		verify_device_release(vd);
+		verify_pool_discard(item);
+		item = NULL;
+	} else if (!verify_device_has_room(vd)) {
+		verify_device_queue(vd, item);
+		item = NULL;
+	}
+
+	vf->running--;
+
+	if (item != NULL)
+		*vd_ptr = vd;
+
+	return item;
 }
 
 /**
- * First verification step, intalling signal handler to trap termination.
+ * Verification thread main loop.
  */
-static bgret_t
-verify_step_setup(struct bgtask *bt, void *unused_data, int unused_ticks)
+static void *
+verify_thread_main(void *arg)
 {
-	(void) unused_data;
-	(void) unused_ticks;
+	uint id = pointer_to_uint(arg);
+	char *buffer;
+
+	thread_set_name_atom(str_smsg("verify #%u", id));
+	buffer = halloc(HASH_BUF_SIZE);
+
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("verification %s started", thread_name());
+
+	VERIFY_POOL_LOCK;
+
+	for (;;) {
+		struct verify_file *item;
+		struct verify_device *vd;
+
+		/*
+		 * Wait for work we can do.
+		 */
+
+		while (NULL == (item = verify_pool_pick(&vd))) {
+			if (verify_pool.exiting)
+				goto exiting;
+
+			if (GNET_PROPERTY(verify_debug) > 1)
+				g_debug("verification %s sleeping", thread_name());
 
-	bg_task_signal(bt, BG_SIG_TERM, verify_bg_sighandler);
-	bg_task_ticks_used(bt, 0);
-	return BGR_NEXT;
+			verify_pool.idle++;
+			cond_wait(&verify_pool.work, &verify_pool.lock);
+			verify_pool.idle--;
+		}
+
+		if G_UNLIKELY(VERIFY_DEV_UNRESOLVED == vd->dev) {
+			item = verify_pool_resolve(item, &vd);
+			if (NULL == item)
+				continue;		/* Queued on its device, or discarded */
+		}
+
+		vd->active++;
+		item->vf->running++;
+
+		VERIFY_POOL_UNLOCK;
+
+		verify_process(item, buffer);
+
+		VERIFY_POOL_LOCK;
+
+		item->vf->running--;
+		vd->active--;
+		verify_file_free(&item);
+		verify_device_release(vd);
+
+		/*
+		 * A slot was released on the device, other threads that could not
+		 * process files held on that device may now be able to do so.
+		 */
+
+		cond_broadcast(&verify_pool.work, &verify_pool.lock);
+	}
+
+exiting:
+	verify_pool.threads--;
+	VERIFY_POOL_UNLOCK;
+
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("verification %s exiting", thread_name());
+
+	HFREE_NULL(buffer);
+	return NULL;
 }
 
 /**
- * Incremental verification step, invoked through the background task scheduler.
+ * @return the targeted amount of verification threads.
  */
-static bgret_t
-verify_step_compute(struct bgtask *bt, void *data, int ticks)
+static uint
+verify_pool_target(void)
 {
-	struct verify *ctx = data;
-	int i = ticks;
-	int used = 0;		/* Amount used for CPU-intensive tasks */
-	int light = 0;		/* Amount used for system-intensive tasks */
+	uint n = GNET_PROPERTY(verify_threads);
 
-	verify_check(ctx);
-	(void) bt;
+	if (0 == n)
+		n = getcpucount();
 
-	while (i-- > 0) {
-		bg_task_cancel_test(bt);
-		if (NULL == ctx->file) {
-			verify_next_file(ctx);
-		}
-		if (ctx->file) {
-			verify_update(ctx);
-			used++;
-		} else {
-			light++;	/* Did not open file, still processed something */
-		}
-		if (NULL == ctx->file && 0 == hash_list_length(ctx->files_to_hash))
-			break;
+	n = MAX(n, 1);
+	return MIN(n, VERIFY_THREAD_MAX);
+}
+
+/**
+ * Create a new verification thread if the queued work warrants it.
+ */
+static void
+verify_pool_spawn_if_needed(void)
+{
+	bool spawn = FALSE;
+	uint id = 0;
+	int r;
+
+	VERIFY_POOL_LOCK;
+
+	if (
+		0 == verify_pool.idle &&
+		verify_pool.threads < verify_pool.queued &&
+		verify_pool.threads < verify_pool_target()
+	) {
+		id = verify_pool.threads++;
+		spawn = TRUE;
 	}
 
+	VERIFY_POOL_UNLOCK;
+
+	if (!spawn)
+		return;
+
 	/*
-	 * If we don't use all our ticks, we need to tell the scheduler
-	 * otherwise the average tick cost will be wrong and when we start
-	 * using all our ticks, the whole process could "freeze" during several
-	 * seconds, if not minutes!
+	 * The verification thread is created as a detached thread because we
+	 * do not expect any result from it.
+	 *
+	 * It is created as non-cancelable: to end it, we flag the pool as exiting.
 	 */
 
-	used += light / 10;			/* Arbitrary decimation factor */
+	r = thread_create(verify_thread_main, uint_to_pointer(id),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN);
 
-	if (used < ticks)
-		bg_task_ticks_used(bt, used);
+	if (-1 == r) {
+		uint running;
 
-	if (ctx->file || hash_list_length(ctx->files_to_hash) > 0) {
-		return BGR_MORE;
-	} else {
-		return BGR_DONE;
+		VERIFY_POOL_LOCK;
+		running = --verify_pool.threads;
+		VERIFY_POOL_UNLOCK;
+
+		if (0 == running)
+			s_error("%s(): cannot create verification thread: %m", G_STRFUNC);
+
+		g_warning("%s(): cannot create new verification thread: %m",
+			G_STRFUNC);
 	}
 }
 
 /**
- * Termination callback for verification task.
+ * Create a new verifier.
  *
- * This handler is invoked from the background task scheduler and is therefore
- * run in the thread that is handling verification.
+ * @param hash		Hash-specific callbacks for this hash verification
+ *
+ * @return verifier to which work can be requested via verify_enqueue()
  */
-static void
-verify_bg_done(struct bgtask *bt, void *data, bgstatus_t status, void *uarg)
+struct verifier *
+verify_new(const struct verify_hash *hash)
 {
-	struct verify *ctx = data;
+	struct verifier *vf;
 
-	verify_check(ctx);
+	g_assert(hash);
 
-	(void) uarg;
+	WALLOC0(vf);
+	vf->magic = VERIFIER_MAGIC;
+	STATIC_ASSERT(sizeof vf->hash == sizeof(struct verify_hash));
+	*(struct verify_hash *) &vf->hash = *hash;		/* Assignment to "const" */
 
-	/*
-	 * Sole purpose here is to trace task termination and print execution
-	 * statistics, for debugging.
-	 */
+	VERIFY_POOL_LOCK;
+	verify_pool.verifiers++;
+	verify_pool.exiting = FALSE;
+	VERIFY_POOL_UNLOCK;
 
-	if (GNET_PROPERTY(verify_debug)) {
-		g_debug("terminating background task \"%s\" in %s, status=%s, "
-			"ran %'lu ms (%s)",
-			bg_task_name(bt), thread_name(), bgstatus_to_string(status),
-			bg_task_wtime(bt), short_time_ascii(bg_task_wtime(bt) / 1000));
-	}
+	return vf;
 }
 
 /**
- * Create background task to perform the verification if not already there.
+ * Callout queue callback to check whether we can free the verifier.
  */
 static void
-verify_create_task(struct verify *ctx)
+verify_deferred_free(cqueue_t *cq, void *data)
 {
-	verify_check(ctx);
+	struct verifier *vf = data;
+	uint running;
+
+	verifier_check(vf);
 
-	if (NULL == ctx->task) {
-		static const bgstep_cb_t step[] = {
-			verify_step_setup,
-			verify_step_compute
-		};
+	/*
+	 * We do not free the verifier until all the threads that are hashing
+	 * files on its behalf have noticed it was shutdown.
+	 */
+
+	VERIFY_POOL_LOCK;
+	running = vf->running;
+	VERIFY_POOL_UNLOCK;
+
+	if (running != 0) {
+		/*
+		 * Threads have not noticed yet, could have pending RPCs...
+		 */
+
+		if (GNET_PROPERTY(verify_debug) > 1) {
+			g_debug("%s verification still running in %u thread%s",
+				vf->hash.name(), running, plural(running));
+		}
 
+		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, vf);
+	} else {
 		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("creating new task for %s verification",
-				verify_hash_name(ctx));
+			g_debug("freeing %s verifier", vf->hash.name());
 		}
 
-		ctx->task = bg_task_create(ctx->sched, verify_hash_name(ctx),
-							step, N_ITEMS(step),
-			  				ctx, verify_context_free,
-							verify_bg_done, NULL);
+		vf->magic = 0;
+		WFREE(vf);
 	}
 }
 
 /**
- * Notified that work was enqueued and should be processed by the
- * verification thread attached to the context.
+ * Free verifier and nullify its pointer.
+ *
+ * Queued files are discarded, their callback being notified with
+ * VERIFY_SHUTDOWN, and computations in progress are aborted.
  *
- * This is called in the thread that is running the verification task.
+ * The actual physical disposal of the verifier is deferred until the
+ * threads hashing files on its behalf have noticed the shutdown.
  */
-static void
-verify_enqueued(void *arg)
+void
+verify_free(struct verifier **ptr)
 {
-	verify_create_task(arg);
+	struct verifier *vf = *ptr;
+
+	if (vf != NULL) {
+		pslist_t *flushed = NULL, *sl;
+
+		verifier_check(vf);
+		g_assert(!vf->shutdowned);
+		g_assert(thread_is_main());
+
+		/*
+		 * Remove all the files queued for this verifier.
+		 */
+
+		VERIFY_POOL_LOCK;
+
+		vf->shutdowned = TRUE;
+
+		if (verify_pool.devices != NULL) {
+			hash_list_iter_t *iter;
+			struct verify_device *vd;
+
+			iter = hash_list_iterator(verify_pool.devices);
+
+			while (NULL != (vd = hash_list_iter_next(iter))) {
+				hash_list_iter_t *qiter = hash_list_iterator(vd->queue);
+				struct verify_file *item;
+
+				while (NULL != (item = hash_list_iter_next(qiter))) {
+					if (item->vf == vf) {
+						hash_list_iter_remove(qiter);
+						flushed = pslist_prepend(flushed, item);
+						verify_pool.queued--;
+					}
+				}
+				hash_list_iter_release(&qiter);
+			}
+			hash_list_iter_release(&iter);
+		}
+
+		g_assert(verify_pool.verifiers != 0);
+
+		if (0 == --verify_pool.verifiers) {
+			verify_pool.exiting = TRUE;
+			cond_broadcast(&verify_pool.work, &verify_pool.lock);
+		}
+
+		VERIFY_POOL_UNLOCK;
+
+		/*
+		 * Notify the owners of the flushed items, in their queuing order.
+		 */
+
+		flushed = pslist_reverse(flushed);
+
+		PSLIST_FOREACH(flushed, sl) {
+			struct verify_file *item = sl->data;
+			struct verify *ctx = verify_context_new(item, NULL);
+
+			verify_shutdown(ctx);
+			verify_context_free(ctx);
+			verify_file_free(&item);
+		}
+
+		pslist_free(flushed);
+
+		*ptr = NULL;
+		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, vf);
+	}
 }
 
 /**
  * Enqueue file to be verified.
  *
- * The supplied callback will be invoked in the context of the calling thread,
+ * The supplied callback will be invoked in the context of the main thread,
  * not from the verification thread, so that multi-threading be transparent
  * for the calling thread.
  *
- * @param ctx			the verification context
+ * @param vf			the verifier
  * @param high_priority	whether item should be treated quickly
  * @param pathname		file to be verified
  * @param offset		starting offset where verification should start
@@ -1070,59 +1208,65 @@ verify_enqueued(void *arg)
  * already enqueued.
  */
 bool
-verify_enqueue(struct verify *ctx, int high_priority,
+verify_enqueue(struct verifier *vf, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
 {
 	struct verify_file *item;
+	struct verify_device *vd;
 	int inserted;
 
-	verify_check(ctx);
+	verifier_check(vf);
 	g_return_val_if_fail(pathname, FALSE);
 	g_return_val_if_fail(callback, FALSE);
-	g_return_val_if_fail(!ctx->shutdowned, FALSE);
+	g_return_val_if_fail(!vf->shutdowned, FALSE);
 
 	entropy_harvest_many(
-		PTRLEN(ctx), VARLEN(high_priority),
+		PTRLEN(vf), VARLEN(high_priority),
 		pathname, strsize(pathname),
 		VARLEN(amount), NULL);
 
-	item = verify_file_new(pathname, offset, amount, callback, user_data);
+	item = verify_file_new(vf, pathname, offset, amount, callback, user_data);
+	item->high_priority = booleanize(high_priority);
 
-	hash_list_lock(ctx->files_to_hash);
+	VERIFY_POOL_LOCK;
 
-	if (hash_list_contains(ctx->files_to_hash, item)) {
+	/*
+	 * The device on which the file lies is determined by the thread that
+	 * will pick the file from the queue of unresolved devices, so that
+	 * we never stat() files here.
+	 */
+
+	vd = verify_device_holding(item);
+
+	if (vd != NULL) {
 		if (high_priority)
-			hash_list_moveto_head(ctx->files_to_hash, item);
+			verify_device_promote(vd, item);
 		inserted = FALSE;
 	} else {
-		if (high_priority) {
-			hash_list_prepend(ctx->files_to_hash, item);
-		} else {
-			hash_list_append(ctx->files_to_hash, item);
-		}
+		vd = verify_device_get(VERIFY_DEV_UNRESOLVED);
+		verify_device_queue(vd, item);
 		inserted = TRUE;
 	}
 
-	hash_list_unlock(ctx->files_to_hash);
+	/*
+	 * When work was inserted into the queue, we signal one thread so that
+	 * it can be awoken if it was sleeping.
+	 */
+
+	if (inserted)
+		cond_signal(&verify_pool.work, &verify_pool.lock);
+
+	VERIFY_POOL_UNLOCK;
 
 	if (GNET_PROPERTY(verify_debug)) {
 		g_debug("%s %s digest verification for %s",
 			inserted ? "enqueued" : "already had queued",
-			verify_hash_name(ctx), pathname);
+			vf->hash.name(), pathname);
 	}
 
-	/*
-	 * When work was inserted into the queue (represented by the hash list
-	 * here), we signal the thread handling the verification so that it can
-	 * be awoken if it was sleeping: the TSIG_TEQ signal will let the thread
-	 * out of the teq_wait() call in its main processing loop, and the
-	 * verify_enqueued() event callback will make sure we have a background
-	 * task to actually process the work.
-	 */
-
 	if (inserted)
-		teq_post(ctx->verify_stid, verify_enqueued, ctx);
+		verify_pool_spawn_if_needed();
 	else
 		verify_file_free(&item);
 
@@ -50,27 +50,38 @@ enum verify_status {
 };
 
 struct verify;
+struct verifier;
 
 typedef bool (*verify_callback)(const struct verify *,
 										enum verify_status, void *user_data);
 
+/**
+ * Hash-specific operations.
+ *
+ * Since several files can be hashed concurrently, each computation is
+ * given its own hash context, created by make() and released by free().
+ */
 struct verify_hash {
 	const char *	(*name)(void);
-	void 			(*init)(filesize_t amount);
-	int  			(*update)(const void *data, size_t size);
-	int 			(*final)(void);
+	void *			(*make)(void);
+	void			(*free)(void *hctx);
+	void 			(*init)(void *hctx, filesize_t amount);
+	int  			(*update)(void *hctx, const void *data, size_t size);
+	int 			(*final)(void *hctx);
 };
 
-struct verify *verify_new(const struct verify_hash *);
-void verify_free(struct verify **ptr);
+struct verifier *verify_new(const struct verify_hash *);
+void verify_free(struct verifier **ptr);
 
-bool verify_enqueue(struct verify *, int high_priority,
+bool verify_enqueue(struct verifier *, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t filesize,
 	verify_callback callback, void *user_data);
 
 enum verify_status verify_status(const struct verify *);
 filesize_t verify_hashed(const struct verify *);
+bool verify_accepted(const struct verify *);
 uint verify_elapsed(const struct verify *);
+void *verify_hash_context(const struct verify *);
 
 #endif	/* _core_verify_h_ */
 
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA1 and TTH hash verification.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "verify_combined.h"
+
+#include "lib/halloc.h"
+#include "lib/once.h"
+#include "lib/sha1.h"
+#include "lib/tigertree.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+/**
+ * Combined computation context, one per file being hashed.
+ */
+struct verify_combined_ctx {
+	SHA1_context	sha1_context;
+	TTH_CONTEXT		*tth_context;
+	struct sha1		sha1;
+	struct tth		tth;
+	bool			skip_tth;	/**< TTH already known, only compute SHA1 */
+};
+
+static struct {
+	struct verifier	*verify;
+} verify_combined;
+
+static const char *
+verify_combined_name(void)
+{
+	return "SHA-1+TTH";
+}
+
+static void *
+verify_combined_make(void)
+{
+	struct verify_combined_ctx *cctx;
+
+	WALLOC0(cctx);
+	cctx->tth_context = halloc(tt_size());
+	return cctx;
+}
+
+static void
+verify_combined_free(void *hctx)
+{
+	struct verify_combined_ctx *cctx = hctx;
+
+	HFREE_NULL(cctx->tth_context);
+	WFREE(cctx);
+}
+
+static void
+verify_combined_reset(void *hctx, filesize_t amount)
+{
+	struct verify_combined_ctx *cctx = hctx;
+	int ret;
+
+	ret = SHA1_reset(&cctx->sha1_context);
+	g_assert(SHA_SUCCESS == ret);
+
+	if (!cctx->skip_tth)
+		tt_init(cctx->tth_context, amount);
+}
+
+static int
+verify_combined_update(void *hctx, const void *data, size_t size)
+{
+	struct verify_combined_ctx *cctx = hctx;
+	int ret;
+
+	ret = SHA1_input(&cctx->sha1_context, data, size);
+	if (SHA_SUCCESS != ret)
+		return -1;
+
+	if (!cctx->skip_tth)
+		tt_update(cctx->tth_context, data, size);
+	return 0;
+}
+
+static int
+verify_combined_final(void *hctx)
+{
+	struct verify_combined_ctx *cctx = hctx;
+	int ret;
+
+	ret = SHA1_result(&cctx->sha1_context, &cctx->sha1);
+	if (SHA_SUCCESS != ret)
+		return -1;
+
+	if (!cctx->skip_tth)
+		tt_digest(cctx->tth_context, &cctx->tth);
+	return 0;
+}
+
+static const struct verify_hash verify_hash_combined = {
+	verify_combined_name,
+	verify_combined_make,
+	verify_combined_free,
+	verify_combined_reset,
+	verify_combined_update,
+	verify_combined_final,
+};
+
+/**
+ * Enqueue file for combined SHA1 and TTH computation.
+ *
+ * The callback will receive a single VERIFY_DONE notification once both
+ * digests are available, which can then be fetched with
+ * verify_combined_sha1() and verify_combined_tth().
+ *
+ * @return TRUE if the file was enqueued, FALSE if it was already queued.
+ */
+bool
+verify_combined_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize,
+	verify_callback callback, void *user_data)
+{
+	if G_UNLIKELY(NULL == verify_combined.verify)
+		return FALSE;
+
+	return verify_enqueue(verify_combined.verify, high_priority,
+		pathname, 0, filesize, callback, user_data);
+}
+
+/**
+ * Only compute the SHA1 of the file being hashed, its TTH being known.
+ *
+ * This must be called from the callback when it is notified with
+ * VERIFY_START, before any data is hashed.  The TTH accessors will then
+ * return NULL on VERIFY_DONE.
+ */
+void
+verify_combined_skip_tth(const struct verify *ctx)
+{
+	struct verify_combined_ctx *cctx;
+
+	g_return_unless(verify_status(ctx) == VERIFY_START);
+
+	cctx = verify_hash_context(ctx);
+	cctx->skip_tth = TRUE;
+}
+
+/**
+ * @return whether the TTH computation was skipped for the file.
+ */
+bool
+verify_combined_skips_tth(const struct verify *ctx)
+{
+	const struct verify_combined_ctx *cctx = verify_hash_context(ctx);
+
+	return NULL != cctx && cctx->skip_tth;
+}
+
+static const struct verify_combined_ctx *
+verify_combined_context(const struct verify *ctx)
+{
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+	return verify_hash_context(ctx);
+}
+
+const struct sha1 *
+verify_combined_sha1(const struct verify *ctx)
+{
+	const struct verify_combined_ctx *cctx = verify_combined_context(ctx);
+
+	return NULL == cctx ? NULL : &cctx->sha1;
+}
+
+const struct tth *
+verify_combined_tth(const struct verify *ctx)
+{
+	const struct verify_combined_ctx *cctx = verify_combined_context(ctx);
+
+	return NULL == cctx || cctx->skip_tth ? NULL : &cctx->tth;
+}
+
+const struct tth *
+verify_combined_tth_leaves(const struct verify *ctx)
+{
+	const struct verify_combined_ctx *cctx = verify_combined_context(ctx);
+
+	return NULL == cctx || cctx->skip_tth ?
+		NULL : tt_leaves(cctx->tth_context);
+}
+
+size_t
+verify_combined_tth_leave_count(const struct verify *ctx)
+{
+	const struct verify_combined_ctx *cctx = verify_combined_context(ctx);
+
+	return NULL == cctx || cctx->skip_tth ?
+		0 : tt_leave_count(cctx->tth_context);
+}
+
+static void G_COLD
+verify_combined_init_once(void)
+{
+	verify_combined.verify = verify_new(&verify_hash_combined);
+}
+
+void G_COLD
+verify_combined_init(void)
+{
+	static once_flag_t initialized;
+
+	/*
+	 * See verify_sha1_init() for why we use once_flag_runwait().
+	 */
+
+	once_flag_runwait(&initialized, verify_combined_init_once);
+}
+
+void G_COLD
+verify_combined_close(void)
+{
+	verify_free(&verify_combined.verify);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -48,13 +48,20 @@
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
-static struct {
-	struct verify	*verify;
+/**
+ * TTH computation context, one per file being hashed.
+ */
+struct verify_tth_ctx {
 	TTH_CONTEXT		*context;
 	struct tth		digest;
+};
+
+static struct {
+	struct verifier	*verify;
 } verify_tth;
 
 static const char *
@@ -63,35 +70,55 @@ verify_tth_name(void)
 	return "TTH";
 }
 
+static void *
+verify_tth_make(void)
+{
+	struct verify_tth_ctx *tctx;
+
+	WALLOC0(tctx);
+	tctx->context = halloc(tt_size());
+	return tctx;
+}
+
+static void
+verify_tth_free(void *hctx)
+{
+	struct verify_tth_ctx *tctx = hctx;
+
+	HFREE_NULL(tctx->context);
+	WFREE(tctx);
+}
+
 static void
-verify_tth_reset(filesize_t size)
+verify_tth_reset(void *hctx, filesize_t size)
 {
-	if G_LIKELY(verify_tth.context != NULL)
-		tt_init(verify_tth.context, size);
+	struct verify_tth_ctx *tctx = hctx;
+
+	tt_init(tctx->context, size);
 }
 
 static int
-verify_tth_update(const void *data, size_t size)
+verify_tth_update(void *hctx, const void *data, size_t size)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_ctx *tctx = hctx;
 
-	tt_update(verify_tth.context, data, size);
+	tt_update(tctx->context, data, size);
 	return 0;
 }
 
 static int
-verify_tth_final(void)
+verify_tth_final(void *hctx)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_ctx *tctx = hctx;
 
-	tt_digest(verify_tth.context, &verify_tth.digest);
+	tt_digest(tctx->context, &tctx->digest);
 	return 0;
 }
 
 static const struct verify_hash verify_hash_tth = {
 	verify_tth_name,
+	verify_tth_make,
+	verify_tth_free,
 	verify_tth_reset,
 	verify_tth_update,
 	verify_tth_final,
@@ -100,28 +127,39 @@ static const struct verify_hash verify_hash_tth = {
 const struct tth *
 verify_tth_digest(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *tctx;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_tth.digest;
+
+	tctx = verify_hash_context(ctx);
+	return &tctx->digest;
 }
 
 const struct tth *
 verify_tth_leaves(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *tctx;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return tt_leaves(verify_tth.context);
+
+	tctx = verify_hash_context(ctx);
+	return tt_leaves(tctx->context);
 }
 
 size_t
 verify_tth_leave_count(const struct verify *ctx)
 {
+	const struct verify_tth_ctx *tctx;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
-	return tt_leave_count(verify_tth.context);
+
+	tctx = verify_hash_context(ctx);
+	return tt_leave_count(tctx->context);
 }
 
 static void G_COLD
 verify_tth_init_once(void)
 {
-	verify_tth.context = halloc(tt_size());
 	verify_tth.verify = verify_new(&verify_hash_tth);
 }
 
@@ -152,15 +190,6 @@ verify_tth_shutdown(void)
 	verify_free(&verify_tth.verify);
 }
 
-/**
- * Release memory resources used by tigertree verification.
- */
-void G_COLD
-verify_tth_close(void)
-{
-	HFREE_NULL(verify_tth.context);
-}
-
 static bool
 request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 	void *user_data)
@@ -192,7 +221,7 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 			}
 			return FALSE;
 		}
-		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, TRUE);
+		huge_tth_rebuilding(TRUE);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		/*
@@ -246,7 +275,8 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 
 done:
 	shared_file_unref(&sf);
-	gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, FALSE);
+	if (verify_accepted(ctx))
+		huge_tth_rebuilding(FALSE);
 	return TRUE;
 }
 
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Compression worker pool.
+ *
+ * Compressing and decompressing layers of the TX and RX stacks can hand
+ * their zlib work to a pool of threads, so that connections are processed
+ * concurrently whilst all the protocol handling remains in the main thread.
+ *
+ * Each layer owns a stream, to which it submits jobs.  The jobs of a given
+ * stream are processed in their submission order and never concurrently,
+ * since they all work on the same zlib state.  Completion is notified to
+ * the main thread via its event queue, again in the submission order.
+ *
+ * When the stream is freed, pending jobs are discarded and the release
+ * routine is invoked once no thread can touch the stream any longer.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "zpool.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/cond.h"
+#include "lib/mutex.h"
+#include "lib/slist.h"
+#include "lib/str.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+#define ZPOOL_THREAD_MAX	32		/**< Max amount of compression threads */
+
+enum zpool_stream_magic { ZPOOL_STREAM_MAGIC = 0x60d3a1c5 };
+
+/**
+ * A stream of jobs, processed sequentially.
+ *
+ * The fields following the lock comment are protected by the pool lock.
+ */
+struct zpool_stream {
+	enum zpool_stream_magic magic;
+	const char *name;			/**< Stream name, for logging (atom) */
+	void *owner;				/**< Owner, given to the done() callback */
+	zpool_work_t work;			/**< Job processing, in worker threads */
+	zpool_done_t done;			/**< Job completion, in the main thread */
+	free_fn_t discard;			/**< Disposal of unprocessed jobs */
+	free_fn_t release;			/**< Final release routine */
+	void *release_arg;			/**< Argument for release routine */
+	/* Protected by the pool lock */
+	slist_t *jobs;				/**< Jobs to process */
+	uint refcnt;				/**< Owner, running job, pending completions */
+	uint running:1;				/**< Set when a thread processes a job */
+	uint ready:1;				/**< Set when stream is in the ready list */
+	uint dead:1;				/**< Set when stream was freed by its owner */
+};
+
+static inline void
+zpool_stream_check(const struct zpool_stream * const zs)
+{
+	g_assert(zs != NULL);
+	g_assert(ZPOOL_STREAM_MAGIC == zs->magic);
+}
+
+/**
+ * A job completion, sent to the main thread.
+ */
+struct zpool_completion {
+	zpool_stream_t *zs;			/**< Stream to which job belongs */
+	void *job;					/**< The processed job */
+};
+
+/**
+ * The pool of compression threads.
+ *
+ * All the fields are protected by the lock.
+ */
+static struct zpool {
+	mutex_t lock;				/**< Thread-safe lock */
+	cond_t work;				/**< Signalled when work can be done */
+	slist_t *ready;				/**< Streams with jobs and no running thread */
+	uint threads;				/**< Amount of running threads */
+	uint idle;					/**< Amount of idle threads */
+	uint8 exiting;				/**< Set when threads must exit */
+} zpool = {
+	MUTEX_INIT,
+	COND_INIT,
+	NULL, 0, 0, FALSE
+};
+
+#define ZPOOL_LOCK		mutex_lock(&zpool.lock)
+#define ZPOOL_UNLOCK	mutex_unlock(&zpool.lock)
+
+#define assert_zpool_locked() \
+	assert_mutex_is_owned(&zpool.lock)
+
+/**
+ * @return whether new streams should be handled by the pool.
+ */
+bool
+zpool_enabled(void)
+{
+	return 0 != GNET_PROPERTY(compress_threads) && !zpool.exiting;
+}
+
+/**
+ * Make stream ready to be processed, if it has jobs and is not running.
+ *
+ * @return TRUE if stream was inserted in the ready list.
+ */
+static bool
+zpool_stream_ready(zpool_stream_t *zs)
+{
+	assert_zpool_locked();
+
+	if (zs->running || zs->ready || zs->dead || 0 == slist_length(zs->jobs))
+		return FALSE;
+
+	if G_UNLIKELY(NULL == zpool.ready)
+		zpool.ready = slist_new();
+
+	slist_append(zpool.ready, zs);
+	zs->ready = TRUE;
+	return TRUE;
+}
+
+/**
+ * Remove a reference on the stream, releasing it when the last one goes.
+ *
+ * This is only called from the main thread.
+ */
+static void
+zpool_stream_unref(zpool_stream_t *zs)
+{
+	bool last;
+
+	zpool_stream_check(zs);
+	g_assert(thread_is_main());
+
+	ZPOOL_LOCK;
+	g_assert(zs->refcnt != 0);
+	last = 0 == --zs->refcnt;
+	ZPOOL_UNLOCK;
+
+	if (!last)
+		return;
+
+	g_assert(zs->dead);
+	g_assert(!zs->running);
+
+	if (zs->release != NULL)
+		(*zs->release)(zs->release_arg);
+
+	slist_free(&zs->jobs);
+	atom_str_free_null(&zs->name);
+	zs->magic = 0;
+	WFREE(zs);
+}
+
+/**
+ * Main thread notification that a job was processed.
+ */
+static void
+zpool_stream_done(void *data)
+{
+	struct zpool_completion *zc = data;
+	zpool_stream_t *zs = zc->zs;
+	bool dead;
+
+	zpool_stream_check(zs);
+
+	ZPOOL_LOCK;
+	dead = zs->dead;
+	ZPOOL_UNLOCK;
+
+	/*
+	 * Since the owner can only free the stream from the main thread, it
+	 * cannot disappear whilst we are invoking the completion routine.
+	 */
+
+	if (dead)
+		(*zs->discard)(zc->job);
+	else
+		(*zs->done)(zs->owner, zc->job);
+
+	WFREE(zc);
+	zpool_stream_unref(zs);
+}
+
+/**
+ * Compression thread main loop.
+ */
+static void *
+zpool_thread_main(void *arg)
+{
+	uint id = pointer_to_uint(arg);
+
+	thread_set_name_atom(str_smsg("zlib #%u", id));
+
+	ZPOOL_LOCK;
+
+	for (;;) {
+		zpool_stream_t *zs;
+		struct zpool_completion *zc;
+		void *job;
+
+		/*
+		 * Wait for a stream with pending jobs.
+		 */
+
+		while (
+			NULL == zpool.ready ||
+			NULL == (zs = slist_shift(zpool.ready))
+		) {
+			if (zpool.exiting)
+				goto exiting;
+
+			zpool.idle++;
+			cond_wait(&zpool.work, &zpool.lock);
+			zpool.idle--;
+		}
+
+		zpool_stream_check(zs);
+		g_assert(zs->ready);
+		g_assert(!zs->running);
+
+		job = slist_shift(zs->jobs);
+		zs->ready = FALSE;
+		zs->running = TRUE;
+		zs->refcnt++;			/* Prevents release whilst running */
+
+		ZPOOL_UNLOCK;
+
+		(*zs->work)(job);
+
+		WALLOC(zc);
+		zc->zs = zs;
+		zc->job = job;
+
+		ZPOOL_LOCK;
+
+		/*
+		 * The completion takes over the reference we took for running
+		 * the job, and is always delivered to the main thread, even
+		 * when the stream was freed meanwhile, so that the job can be
+		 * disposed of there.
+		 *
+		 * It is posted before the stream can be made ready again, to
+		 * guarantee that completions are delivered in the job order.
+		 */
+
+		zs->running = FALSE;
+		teq_safe_post(THREAD_MAIN_ID, zpool_stream_done, zc);
+
+		if (zpool_stream_ready(zs))
+			cond_signal(&zpool.work, &zpool.lock);
+	}
+
+exiting:
+	zpool.threads--;
+	ZPOOL_UNLOCK;
+
+	return NULL;
+}
+
+/**
+ * @return the targeted amount of compression threads.
+ */
+static uint
+zpool_target(void)
+{
+	uint n = GNET_PROPERTY(compress_threads);
+
+	return MIN(n, ZPOOL_THREAD_MAX);
+}
+
+/**
+ * Create a new compression thread if the queued work warrants it.
+ */
+static void
+zpool_spawn_if_needed(void)
+{
+	bool spawn = FALSE;
+	uint id = 0;
+	int r;
+
+	ZPOOL_LOCK;
+
+	if (
+		0 == zpool.idle &&
+		!zpool.exiting &&
+		zpool.threads < zpool_target() &&
+		zpool.ready != NULL &&
+		zpool.threads < slist_length(zpool.ready)
+	) {
+		id = zpool.threads++;
+		spawn = TRUE;
+	}
+
+	ZPOOL_UNLOCK;
+
+	if (!spawn)
+		return;
+
+	r = thread_create(zpool_thread_main, uint_to_pointer(id),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_NO_POOL,
+			THREAD_STACK_MIN);
+
+	if (-1 == r) {
+		uint running;
+
+		ZPOOL_LOCK;
+		running = --zpool.threads;
+		ZPOOL_UNLOCK;
+
+		if (0 == running)
+			s_error("%s(): cannot create compression thread: %m", G_STRFUNC);
+
+		g_warning("%s(): cannot create new compression thread: %m", G_STRFUNC);
+	}
+}
+
+/**
+ * Create a new stream.
+ *
+ * @param name		name of the stream, for logging
+ * @param owner		owner of the stream, given back to the done() routine
+ * @param work		routine processing jobs, called from worker threads
+ * @param done		routine notified of processed jobs, in the main thread
+ * @param discard	routine disposing of unprocessed or discarded jobs
+ *
+ * @return new stream to which jobs can be submitted.
+ */
+zpool_stream_t *
+zpool_stream_make(const char *name, void *owner,
+	zpool_work_t work, zpool_done_t done, free_fn_t discard)
+{
+	zpool_stream_t *zs;
+
+	g_assert(work != NULL);
+	g_assert(done != NULL);
+	g_assert(discard != NULL);
+
+	WALLOC0(zs);
+	zs->magic = ZPOOL_STREAM_MAGIC;
+	zs->name = atom_str_get(name);
+	zs->owner = owner;
+	zs->work = work;
+	zs->done = done;
+	zs->discard = discard;
+	zs->jobs = slist_new();
+	zs->refcnt = 1;				/* The owner's reference */
+
+	return zs;
+}
+
+/**
+ * Submit new job to the stream.
+ *
+ * The job will be processed after all the previously submitted ones.
+ */
+void
+zpool_stream_submit(zpool_stream_t *zs, void *job)
+{
+	zpool_stream_check(zs);
+	g_assert(thread_is_main());
+
+	ZPOOL_LOCK;
+
+	g_assert(!zs->dead);
+
+	slist_append(zs->jobs, job);
+	if (zpool_stream_ready(zs))
+		cond_signal(&zpool.work, &zpool.lock);
+
+	ZPOOL_UNLOCK;
+
+	zpool_spawn_if_needed();
+}
+
+/**
+ * Free stream and nullify its pointer.
+ *
+ * Jobs not yet processed are discarded, and so will be the jobs whose
+ * processing is running or whose completion has not been delivered yet.
+ *
+ * @param zs_ptr	pointer to the stream
+ * @param release	if non-NULL, invoked when no thread uses the stream
+ * @param arg		argument for the release routine
+ */
+void
+zpool_stream_free(zpool_stream_t **zs_ptr, free_fn_t release, void *arg)
+{
+	zpool_stream_t *zs = *zs_ptr;
+
+	if (zs != NULL) {
+		slist_t *flushed;
+
+		zpool_stream_check(zs);
+		g_assert(thread_is_main());
+		g_assert(!zs->dead);
+
+		ZPOOL_LOCK;
+
+		zs->dead = TRUE;
+		zs->release = release;
+		zs->release_arg = arg;
+
+		if (zs->ready) {
+			slist_remove(zpool.ready, zs);
+			zs->ready = FALSE;
+		}
+
+		flushed = zs->jobs;
+		zs->jobs = slist_new();
+
+		ZPOOL_UNLOCK;
+
+		slist_free_all(&flushed, zs->discard);
+		zpool_stream_unref(zs);
+		*zs_ptr = NULL;
+	}
+}
+
+/**
+ * Stop the compression threads.
+ *
+ * Jobs submitted to streams still allocated at that time are no longer
+ * processed, and new streams must not be created afterwards.
+ */
+void
+zpool_close(void)
+{
+	ZPOOL_LOCK;
+	zpool.exiting = TRUE;
+	cond_broadcast(&zpool.work, &zpool.lock);
+	ZPOOL_UNLOCK;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
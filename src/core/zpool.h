@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Compression worker pool.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_zpool_h_
+#define _core_zpool_h_
+
+#include "common.h"
+
+struct zpool_stream;
+typedef struct zpool_stream zpool_stream_t;
+
+/**
+ * Processing of a job, invoked from a worker thread.
+ */
+typedef void (*zpool_work_t)(void *job);
+
+/**
+ * Completion of a job, invoked from the main thread.
+ */
+typedef void (*zpool_done_t)(void *owner, void *job);
+
+/*
+ * Public interface.
+ */
+
+bool zpool_enabled(void);
+zpool_stream_t *zpool_stream_make(const char *name, void *owner,
+	zpool_work_t work, zpool_done_t done, free_fn_t discard);
+void zpool_stream_submit(zpool_stream_t *zs, void *job);
+void zpool_stream_free(zpool_stream_t **zs_ptr, free_fn_t release, void *arg);
+void zpool_close(void);
+
+#endif /* _core_zpool_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
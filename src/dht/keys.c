@@ -115,6 +115,7 @@
 
 #define KEYS_DB_CACHE_SIZE	512	/**< Amount of keys to keep cached in RAM */
 #define KEYS_SYNC_PERIOD	(60*1000)	/**< Sync DB every minute */
+#define KEYS_DB_PAGESIZE	4096	/**< SDBM page size for the keys database */
 
 /**
  * Information about our neighbourhood (k-ball), updated periodically.
@@ -1619,7 +1620,8 @@ void G_COLD
 keys_init(void)
 {
 	size_t i;
-	dbstore_kv_t kv = { KUID_RAW_SIZE, NULL, sizeof(struct keydata), 0 };
+	dbstore_kv_t kv =
+		{ KUID_RAW_SIZE, NULL, sizeof(struct keydata), 0, KEYS_DB_PAGESIZE };
 	dbstore_packing_t packing =
 		{ serialize_keydata, deserialize_keydata, NULL };
 
@@ -107,6 +107,8 @@
 #include "lib/tokenizer.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
+#include "lib/xsort_data.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -844,6 +846,124 @@ allocate_node_lists(struct kbucket *kb)
 	kb->nodes->refresh = NULL;
 }
 
+/***
+ *** Contiguous index of the nodes held in the routing table.
+ ***
+ *** All the nodes in the routing table are also referenced from an array
+ *** sorted by KUID, updated as nodes enter and leave the table.  Since the
+ *** nodes sharing a KUID prefix are contiguous in the array, looking for the
+ *** closest nodes to a KUID, which we do for each FIND_NODE or FIND_VALUE
+ *** request we get, amounts to a few binary searches in a compact array
+ *** instead of walking the k-bucket tree and the node lists of each bucket.
+ ***/
+
+#define KINDEX_MIN		64		/**< Minimum amount of allocated entries */
+
+/**
+ * An index entry.
+ *
+ * The KUID is copied in the entry so that searching the index does not
+ * require accessing the nodes.
+ */
+struct kindex_entry {
+	kuid_t id;					/**< KUID of the node */
+	knode_t *kn;				/**< The node */
+};
+
+static struct kindex {
+	struct kindex_entry *entries;	/**< Sorted by increasing KUID */
+	size_t count;					/**< Amount of entries used */
+	size_t capacity;				/**< Amount of entries allocated */
+} kindex;
+
+/**
+ * Locate KUID in the index.
+ *
+ * @param id		the KUID to look for
+ * @param found		set to whether the KUID is present in the index
+ *
+ * @return the index of the entry holding the KUID if found, the index where
+ * it should be inserted otherwise.
+ */
+static size_t
+kindex_lookup(const kuid_t *id, bool *found)
+{
+	size_t lo = 0, hi = kindex.count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = kuid_cmp(&kindex.entries[mid].id, id);
+
+		if (0 == c) {
+			*found = TRUE;
+			return mid;
+		} else if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*found = FALSE;
+	return lo;
+}
+
+/**
+ * Index node entering the routing table.
+ */
+static void
+kindex_insert(knode_t *kn)
+{
+	struct kindex_entry *e;
+	size_t i;
+	bool found;
+
+	i = kindex_lookup(kn->id, &found);
+
+	g_assert(!found);		/* KUIDs are unique in the routing table */
+
+	if (kindex.count == kindex.capacity) {
+		kindex.capacity = MAX(KINDEX_MIN, 2 * kindex.capacity);
+		XREALLOC_ARRAY(kindex.entries, kindex.capacity);
+	}
+
+	e = &kindex.entries[i];
+	memmove(e + 1, e, (kindex.count - i) * sizeof *e);
+	kuid_copy(&e->id, kn->id);
+	e->kn = kn;
+	kindex.count++;
+}
+
+/**
+ * Remove node leaving the routing table from the index.
+ */
+static void
+kindex_remove(const knode_t *kn)
+{
+	struct kindex_entry *e;
+	size_t i;
+	bool found;
+
+	i = kindex_lookup(kn->id, &found);
+
+	g_assert(found);
+	g_assert(kindex.entries[i].kn == kn);
+
+	e = &kindex.entries[i];
+	kindex.count--;
+	memmove(e, e + 1, (kindex.count - i) * sizeof *e);
+}
+
+/**
+ * Discard the index.
+ */
+static void
+kindex_free(void)
+{
+	XFREE_NULL(kindex.entries);
+	ZERO(&kindex);
+}
+
 /**
  * Forget node previously held in the routing table.
  *
@@ -857,6 +977,7 @@ forget_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
+	kindex_remove(kn);
 	list_update_stats(kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 	kn->status = KNODE_UNKNOWN;
@@ -879,6 +1000,7 @@ forget_merged_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
+	kindex_remove(kn);
 	list_update_stats(kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 
@@ -2104,6 +2226,7 @@ add_node(struct kbucket *kb, knode_t *kn, knode_status_t status)
 	kn->status = status;
 	add_node_internal(kb, kn, status, TRUE);
 	list_update_stats(status, +1);
+	kindex_insert(kn);
 }
 
 /**
@@ -4413,25 +4536,28 @@ dht_size(void)
 }
 
 /**
- * GList sort callback.
+ * xsort_with_data() callback, to sort nodes by increasing distance to a KUID.
  */
 static int
 distance_to(const void *a, const void *b, void *user_data)
 {
-	const knode_t *ka = a;
-	const knode_t *kb = b;
+	const knode_t * const *ka = a;
+	const knode_t * const *kb = b;
 	const kuid_t *id = user_data;
 
-	return kuid_cmp3(id, ka->id, kb->id);
+	return kuid_cmp3(id, (*ka)->id, (*kb)->id);
 }
 
+#define KINDEX_LEAF		KDA_K	/**< Max entries handled like a k-bucket */
+
 /**
  * Fill the supplied vector `kvec' whose size is `kcnt' with the good
- * nodes from the current bucket, inserting them by increasing distance
- * to the supplied ID.
+ * nodes from the index entries in [lo, hi), inserting them by increasing
+ * distance to the supplied ID.
  *
  * @param id		the KUID for which we're finding the closest neighbours
- * @param kb		the bucket used
+ * @param lo		first index entry
+ * @param hi		index entry after the last one
  * @param kvec		base of the "knode_t *" vector
  * @param kcnt		size of the "knode_t *" vector
  * @param exclude	the KUID to exclude (NULL if no exclusion)
@@ -4440,42 +4566,24 @@ distance_to(const void *a, const void *b, void *user_data)
  * @return the amount of entries filled in the vector.
  */
 static int
-fill_closest_in_bucket(
-	const kuid_t *id, struct kbucket *kb,
+kindex_fill_leaf(const kuid_t *id, size_t lo, size_t hi,
 	knode_t **kvec, int kcnt, const kuid_t *exclude, bool alive)
 {
-	plist_t *nodes = NULL, *good, *l;
-	int added;
+	knode_t *nodes[KINDEX_LEAF];
+	const struct kindex_entry *e, *end;
 	int available = 0;
 
-	g_assert(id);
-	g_assert(is_leaf(kb));
-	g_assert(kvec);
+	g_assert(hi - lo <= KINDEX_LEAF);
 
 	/*
-	 * If we can determine that we do not have enough good nodes in the bucket
-	 * to fill the vector, consider "stale" nodes and then "pending" nodes
-	 * (excluding shutdowning ones), provided we got traffic from them
-	 * recently (defined by the aliveness period).
+	 * The nodes are scattered in memory whereas the entries are contiguous:
+	 * start loading the nodes before we need to look at them.
 	 */
 
-	good = hash_list_list(kb->nodes->good);
-
-	while (good != NULL) {
-		knode_t *kn = good->data;
-
-		knode_check(kn);
-		g_assert(KNODE_GOOD == kn->status);
-
-		if (
-			(!exclude || !kuid_eq(kn->id, exclude)) &&
-			(!alive || (kn->flags & KNODE_F_ALIVE))
-		) {
-			nodes = plist_prepend(nodes, kn);
-			available++;
-		}
+	end = &kindex.entries[hi];
 
-		good = plist_remove(good, kn);
+	for (e = &kindex.entries[lo]; e < end; e++) {
+		G_PREFETCH_R(e->kn);
 	}
 
 	/*
@@ -4489,44 +4597,49 @@ fill_closest_in_bucket(
 	 * without having to ping them explicitly.
 	 */
 
-	if (!alive) {
-		plist_t *stale = hash_list_list(kb->nodes->stale);
+	for (e = &kindex.entries[lo]; e < end; e++) {
+		knode_t *kn = e->kn;
 
-		while (stale != NULL) {
-			knode_t *kn = stale->data;
+		if (exclude != NULL && kuid_eq(&e->id, exclude))
+			continue;
 
-			knode_check(kn);
-			g_assert(KNODE_STALE == kn->status);
+		knode_check(kn);
 
+		switch (kn->status) {
+		case KNODE_GOOD:
+			if (!alive || (kn->flags & KNODE_F_ALIVE))
+				nodes[available++] = kn;
+			break;
+		case KNODE_STALE:
 			if (
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
+				!alive &&
 				knode_still_alive_probability(kn) >= ALIVE_PROBA_LOW_THRESH
-			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
-			}
-
-			stale = plist_remove(stale, kn);
+			)
+				nodes[available++] = kn;
+			break;
+		case KNODE_PENDING:
+			break;
+		case KNODE_UNKNOWN:
+			g_assert_not_reached();
 		}
 	}
 
 	/*
-	 * Pending nodes come last, if we miss nodes.
+	 * Pending nodes (excluding shutdowning ones) come last, if we miss nodes,
+	 * provided we got traffic from them recently (defined by the aliveness
+	 * period).
 	 */
 
 	if (available < kcnt) {
-		plist_t *pending = hash_list_list(kb->nodes->pending);
 		time_t now = tm_time();
 
-		while (pending != NULL) {
-			knode_t *kn = pending->data;
-
-			knode_check(kn);
-			g_assert(KNODE_PENDING == kn->status);
+		for (e = &kindex.entries[lo]; e < end; e++) {
+			knode_t *kn = e->kn;
 
 			if (
+				KNODE_PENDING == kn->status &&
 				!(kn->flags & KNODE_F_SHUTDOWNING) &&
-				(!exclude || !kuid_eq(kn->id, exclude)) &&
+				(!exclude || !kuid_eq(&e->id, exclude)) &&
 				(!alive ||
 					(
 						(kn->flags & KNODE_F_ALIVE) &&
@@ -4534,11 +4647,8 @@ fill_closest_in_bucket(
 					)
 				)
 			) {
-				nodes = plist_prepend(nodes, kn);
-				available++;
+				nodes[available++] = kn;
 			}
-
-			pending = plist_remove(pending, kn);
 		}
 	}
 
@@ -4547,26 +4657,53 @@ fill_closest_in_bucket(
 	 * insert them in the vector.
 	 */
 
-	nodes = plist_sort_with_data(nodes, distance_to, deconstify_pointer(id));
+	xsort_with_data(nodes, available, sizeof nodes[0],
+		distance_to, deconstify_pointer(id));
 
-	for (added = 0, l = nodes; l && kcnt; l = plist_next(l)) {
-		*kvec++ = l->data;
-		kcnt--;
-		added++;
-	}
+	available = MIN(available, kcnt);
+	memcpy(kvec, nodes, available * sizeof nodes[0]);
 
-	plist_free(nodes);
+	return available;
+}
 
-	return added;
+/**
+ * Locate the first index entry in [lo, hi) whose KUID has the given bit set,
+ * all the KUIDs in the range sharing the bits before that one.
+ *
+ * @return the index of that entry, `hi' if there is none.
+ */
+static size_t
+kindex_split(size_t lo, size_t hi, uint bit)
+{
+	uint byt = bit >> 3;
+	uchar mask = 0x80 >> (bit & 0x7);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (kindex.entries[mid].id.v[byt] & mask)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
 }
 
 /**
  * Recursively fill the supplied vector `kvec' whose size is `kcnt' with the
- * good nodes held in the leaves under the current bucket,
- * inserting them by increasing distance to the supplied ID.
+ * good nodes from the index entries in [lo, hi), inserting them by
+ * increasing distance to the supplied ID.
+ *
+ * This mimics the walk down the k-bucket tree: all the KUIDs in the range
+ * share the bits before `bit', and the range is split in two according to
+ * that bit, the entries having the same bit as the target ID being closer.
+ * Ranges small enough are handled like k-buckets.
  *
  * @param id		the KUID for which we're finding the closest neighbours
- * @param kb		the bucket from which we recurse
+ * @param lo		first index entry
+ * @param hi		index entry after the last one
+ * @param bit		the bit on which we split the range
  * @param kvec		base of the "knode_t *" vector
  * @param kcnt		size of the "knode_t *" vector
  * @param exclude	the KUID to exclude (NULL if no exclusion)
@@ -4575,37 +4712,39 @@ fill_closest_in_bucket(
  * @return the amount of entries filled in the vector.
  */
 static int
-recursively_fill_closest_from(
-	const kuid_t *id,
-	struct kbucket *kb,
+kindex_fill_range(const kuid_t *id, size_t lo, size_t hi, uint bit,
 	knode_t **kvec, int kcnt, const kuid_t *exclude, bool alive)
 {
-	int byt;
-	uchar mask;
-	struct kbucket *closest;
+	size_t mid, near_lo, near_hi, far_lo, far_hi;
 	int added;
 
-	g_assert(id);
-	g_assert(kb);
+	if (lo == hi)
+		return 0;
 
-	if (is_leaf(kb))
-		return fill_closest_in_bucket(id, kb, kvec, kcnt, exclude, alive);
+	if (hi - lo <= KINDEX_LEAF)
+		return kindex_fill_leaf(id, lo, hi, kvec, kcnt, exclude, alive);
 
-	kuid_position(kb->depth, &byt, &mask);
+	g_assert(bit < KUID_RAW_BITSIZE);	/* KUIDs are unique */
+
+	mid = kindex_split(lo, hi, bit);
 
-	if ((kb->one->prefix.v[byt] & mask) == (id->v[byt] & mask)) {
-		g_assert((kb->zero->prefix.v[byt] & mask) != (id->v[byt] & mask));
-		closest = kb->one;
+	if (id->v[bit >> 3] & (0x80 >> (bit & 0x7))) {
+		near_lo = mid;
+		near_hi = hi;
+		far_lo = lo;
+		far_hi = mid;
 	} else {
-		g_assert((kb->zero->prefix.v[byt] & mask) == (id->v[byt] & mask));
-		closest = kb->zero;
+		near_lo = lo;
+		near_hi = mid;
+		far_lo = mid;
+		far_hi = hi;
 	}
 
-	added = recursively_fill_closest_from(
-		id, closest, kvec, kcnt, exclude, alive);
+	added = kindex_fill_range(id, near_lo, near_hi, bit + 1,
+		kvec, kcnt, exclude, alive);
 
 	if (added < kcnt)
-		added += recursively_fill_closest_from(id, sibling_of(closest),
+		added += kindex_fill_range(id, far_lo, far_hi, bit + 1,
 			kvec + added, kcnt - added, exclude, alive);
 
 	return added;
@@ -4628,51 +4767,20 @@ dht_fill_closest(
 	const kuid_t *id,
 	knode_t **kvec, int kcnt, const kuid_t *exclude, bool alive)
 {
-	struct kbucket *kb;
 	int added;
-	int wanted = kcnt;			/* Remember for tracing only */
-	knode_t **base = kvec;		/* Idem */
 
 	g_assert(id);
 	g_assert(kcnt > 0);
 	g_assert(kvec);
 
-	/*
-	 * Start by filling from hosts in the k-bucket of the ID.
-	 */
+	added = kindex_fill_range(id, 0, kindex.count, 0,
+		kvec, kcnt, exclude, alive);
 
-	kb = dht_find_bucket(id);
-	added = fill_closest_in_bucket(id, kb, kvec, kcnt, exclude, alive);
-	kvec += added;
-	kcnt -= added;
-
-	g_assert(kcnt >= 0);
-
-	/*
-	 * Now iteratively move up to the root bucket, trying to fill more
-	 * closest nodes from these buckets which are farther and farther away
-	 * from the target ID.
-	 */
-
-	for (/* empty */; kb->depth && kcnt; kb = kb->parent) {
-		struct kbucket *sibling = sibling_of(kb);
-		int more;
-
-		g_assert(sibling->parent == kb->parent);
-		g_assert(sibling != kb);
-
-		more = recursively_fill_closest_from(
-			id, sibling, kvec, kcnt, exclude, alive);
-		kvec += more;
-		kcnt -= more;
-		added += more;
-
-		g_assert(kcnt >= 0);
-	}
+	g_assert(added <= kcnt);
 
 	if (GNET_PROPERTY(dht_debug) > 15) {
 		g_debug("DHT found %d/%d %s nodes (excluding %s) closest to %s",
-			added, wanted, alive ? "alive" : "known",
+			added, kcnt, alive ? "alive" : "known",
 			exclude ? kuid_to_hex_string(exclude) : "nothing",
 			kuid_to_hex_string2(id));
 
@@ -4680,7 +4788,7 @@ dht_fill_closest(
 			int i;
 
 			for (i = 0; i < added; i++) {
-				g_debug("DHT closest[%d]: %s", i, knode_to_string(base[i]));
+				g_debug("DHT closest[%d]: %s", i, knode_to_string(kvec[i]));
 			}
 		}
 	}
@@ -4931,6 +5039,7 @@ dht_close(bool exiting)
 
 	recursively_apply(root, dht_free_bucket, NULL);
 	root = NULL;
+	kindex_free();
 	kuid_atom_free_null(&our_kuid);
 
 	for (i = 0; i < K_REGIONS; i++) {
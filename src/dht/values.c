@@ -127,6 +127,7 @@
 
 #define VALUES_DB_CACHE_SIZE 1024	/**< Amount of values to keep cached */
 #define RAW_DB_CACHE_SIZE	 512	/**< Amount of raw data to keep cached */
+#define VALUES_DB_PAGESIZE	4096	/**< SDBM page size for value databases */
 
 /**
  * Information about a value that is stored to disk and not kept in memory.
@@ -2091,9 +2092,10 @@ values_sync(void)
 void G_COLD
 values_init(void)
 {
-	dbstore_kv_t value_kv =
-		{ sizeof(uint64), NULL, sizeof(struct valuedata), 0 };
-	dbstore_kv_t raw_kv		= { sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0 };
+	dbstore_kv_t value_kv = { sizeof(uint64), NULL, sizeof(struct valuedata),
+		0, VALUES_DB_PAGESIZE };
+	dbstore_kv_t raw_kv =
+		{ sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0, VALUES_DB_PAGESIZE };
 	dbstore_kv_t expired_kv	= { 2 * KUID_RAW_SIZE, NULL, 0, 0 };
 	dbstore_packing_t value_packing =
 		{ serialize_valuedata, deserialize_valuedata, NULL };
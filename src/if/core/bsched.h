@@ -26,6 +26,7 @@
 
 #include "if/core/wrap.h"	/* For wrap_io_t */
 #include "lib/inputevt.h"	/* For inputevt_handler_t */
+#include "lib/tbucket.h"	/* For tbucket_share_t */
 
 typedef struct bsched bsched_t;
 
@@ -69,6 +70,7 @@ typedef struct bio_source {
 	int64 bw_last_bps;				/**< B/w used last period (bps) */
 	int64 bw_fast_ema;				/**< Fast EMA of actual bandwidth used */
 	int64  bw_slow_ema;				/**< Slow EMA of actual bandwidth used */
+	tbucket_share_t share;			/**< Token bucket share, concurrent mode */
 } bio_source_t;
 
 /*
@@ -243,6 +243,8 @@ struct download {
 	uint32 overlap_size;		/**< Size of the overlapping window on resume */
 	pmsg_t *req;				/**< HTTP request, when partially sent */
 	struct dl_buffers *buffers;	/**< Buffers for reading, only when active */
+	size_t inflight;			/**< Data being written by I/O threads */
+	int write_errno;			/**< Error of an asynchronous write, or 0 */
 
 	time_t start_date;			/**< Download start date */
 	time_t last_update;			/**< Last status update or I/O */
@@ -279,6 +281,8 @@ struct download {
 	unsigned got_giv:1;			/**< Whether initiated from GIV reception */
 	unsigned unavailable:1;		/**< Set on Timout, Push route lost */
 	unsigned tls_upgraded:1;	/**< Was successfully upgraded to TLS */
+	unsigned write_paused:1;	/**< Reading paused until disk catches up */
+	unsigned write_flushing:1;	/**< Reading paused until chunk is on disk */
 
 	struct cproxy *cproxy;		/**< Push proxy being used currently */
 	struct parq_dl_queued *parq_dl;	/**< Queuing status */
@@ -26,6 +26,7 @@
 
 #include "common.h"
 
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -172,10 +173,12 @@ typedef struct dl_file_info {
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
+	erbtree_t chunktree;	/**< Same ranges, indexed by offset */
 	eslist_t available;		/**< List of ranges available, with source count */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
 	struct shared_file *sf;	/**< When PFSP-server is enabled, share this file */
+	struct iopool_stream *writer;	/**< Asynchronous write-back, if any */
 	uint32 active_queued;	/**< Actively queued sources */
 	uint32 passive_queued;	/**< Passively queued sources */
 	unsigned dht_lookups;	/**< Amount of completed DHT lookups */
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sat Oct 17 06:33:55 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -16,10 +16,14 @@
  */
 static const char *stats_symbols[] = {
 	"routing_errors",
-	"routing_table_chunks",
+	"routing_table_generations",
 	"routing_table_capacity",
 	"routing_table_count",
 	"routing_transient_avoided",
+	"gmsg_multicast_messages",
+	"gmsg_multicast_destinations",
+	"gmsg_multicast_copied_bytes",
+	"gmsg_multicast_shared_bytes",
 	"dups_with_higher_ttl",
 	"spam_sha1_hits",
 	"spam_name_hits",
@@ -121,6 +125,12 @@ static const char *stats_symbols[] = {
 	"udp_read_ahead_count_max",
 	"udp_read_ahead_bytes_max",
 	"udp_read_ahead_delay_max",
+	"udp_rx_batch_calls",
+	"udp_rx_batch_datagrams",
+	"udp_rx_batch_max",
+	"udp_tx_batch_calls",
+	"udp_tx_batch_datagrams",
+	"udp_tx_batch_max",
 	"udp_fw2fw_pushes",
 	"udp_fw2fw_pushes_to_self",
 	"udp_fw2fw_pushes_patched",
@@ -452,10 +462,14 @@ gnet_stats_general_to_string(gnr_stats_t x)
  */
 static const char *stats_text[] = {
 	N_("Routing errors"),
-	N_("Routing table chunks"),
+	N_("Routing table live generations"),
 	N_("Routing table message capacity"),
 	N_("Routing table message count"),
 	N_("Routing through transient node avoided"),
+	N_("Multicast routed messages serialized once"),
+	N_("Destinations sharing a routed message"),
+	N_("Bytes copied to serialize shared messages"),
+	N_("Bytes shared instead of copied per destination"),
 	N_("Duplicates with higher TTL"),
 	N_("SPAM SHA1 database hits"),
 	N_("SPAM filename and size hits"),
@@ -557,6 +571,12 @@ static const char *stats_text[] = {
 	N_("UDP read-ahead datagram max count"),
 	N_("UDP read-ahead datagram max bytes"),
 	N_("UDP read-ahead datagram max delay"),
+	N_("UDP batched receive system calls"),
+	N_("UDP datagrams received by batched calls"),
+	N_("UDP max datagrams received in one call"),
+	N_("UDP batched send system calls"),
+	N_("UDP datagrams sent by batched calls"),
+	N_("UDP max datagrams sent in one call"),
 	N_("UDP push messages received for FW<->FW connections"),
 	N_("UDP push messages requesting FW<->FW connection with ourselves"),
 	N_("UDP push messages patched for FW<->FW connections"),
@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Sat Oct 17 06:33:55 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,14 +8,18 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 415
+ * Enum count: 425
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
-	GNR_ROUTING_TABLE_CHUNKS,
+	GNR_ROUTING_TABLE_GENERATIONS,
 	GNR_ROUTING_TABLE_CAPACITY,
 	GNR_ROUTING_TABLE_COUNT,
 	GNR_ROUTING_TRANSIENT_AVOIDED,
+	GNR_GMSG_MULTICAST_MESSAGES,
+	GNR_GMSG_MULTICAST_DESTINATIONS,
+	GNR_GMSG_MULTICAST_COPIED_BYTES,
+	GNR_GMSG_MULTICAST_SHARED_BYTES,
 	GNR_DUPS_WITH_HIGHER_TTL,
 	GNR_SPAM_SHA1_HITS,
 	GNR_SPAM_NAME_HITS,
@@ -117,6 +121,12 @@ typedef enum {
 	GNR_UDP_READ_AHEAD_COUNT_MAX,
 	GNR_UDP_READ_AHEAD_BYTES_MAX,
 	GNR_UDP_READ_AHEAD_DELAY_MAX,
+	GNR_UDP_RX_BATCH_CALLS,
+	GNR_UDP_RX_BATCH_DATAGRAMS,
+	GNR_UDP_RX_BATCH_MAX,
+	GNR_UDP_TX_BATCH_CALLS,
+	GNR_UDP_TX_BATCH_DATAGRAMS,
+	GNR_UDP_TX_BATCH_MAX,
 	GNR_UDP_FW2FW_PUSHES,
 	GNR_UDP_FW2FW_PUSHES_TO_SELF,
 	GNR_UDP_FW2FW_PUSHES_PATCHED,
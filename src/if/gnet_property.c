@@ -1134,6 +1134,34 @@ gboolean gnet_property_variable_running_topless     = FALSE;
 static const gboolean gnet_property_variable_running_topless_default = FALSE;
 gboolean gnet_property_variable_send_oob_ind_reliably     = TRUE;
 static const gboolean gnet_property_variable_send_oob_ind_reliably_default = TRUE;
+gboolean gnet_property_variable_search_word_index     = TRUE;
+static const gboolean gnet_property_variable_search_word_index_default = TRUE;
+gboolean gnet_property_variable_qrp_batched_routing     = TRUE;
+static const gboolean gnet_property_variable_qrp_batched_routing_default = TRUE;
+guint32  gnet_property_variable_udp_batch_size     = 16;
+static const guint32  gnet_property_variable_udp_batch_size_default = 16;
+guint32  gnet_property_variable_verify_threads     = 0;
+static const guint32  gnet_property_variable_verify_threads_default = 0;
+guint32  gnet_property_variable_verify_device_threads     = 1;
+static const guint32  gnet_property_variable_verify_device_threads_default = 1;
+gboolean gnet_property_variable_sha1_cache_export     = FALSE;
+static const gboolean gnet_property_variable_sha1_cache_export_default = FALSE;
+guint32  gnet_property_variable_scan_threads     = 4;
+static const guint32  gnet_property_variable_scan_threads_default = 4;
+gboolean gnet_property_variable_library_watch_changes     = TRUE;
+static const gboolean gnet_property_variable_library_watch_changes_default = TRUE;
+guint32  gnet_property_variable_compress_threads     = 0;
+static const guint32  gnet_property_variable_compress_threads_default = 0;
+guint32  gnet_property_variable_download_write_threads     = 2;
+static const guint32  gnet_property_variable_download_write_threads_default = 2;
+guint32  gnet_property_variable_download_write_backlog     = 8388608;
+static const guint32  gnet_property_variable_download_write_backlog_default = 8388608;
+gboolean gnet_property_variable_fileinfo_export     = FALSE;
+static const gboolean gnet_property_variable_fileinfo_export_default = FALSE;
+gboolean gnet_property_variable_upload_threaded_pump     = TRUE;
+static const gboolean gnet_property_variable_upload_threaded_pump_default = TRUE;
+guint32  gnet_property_variable_upload_pump_threads     = 2;
+static const guint32  gnet_property_variable_upload_pump_threads_default = 2;
 
 static prop_set_t *gnet_property;
 
@@ -11418,6 +11446,296 @@ gnet_prop_init(void) {
     gnet_property->props[488].data.boolean.def   = (void *) &gnet_property_variable_send_oob_ind_reliably_default;
     gnet_property->props[488].data.boolean.value = (void *) &gnet_property_variable_send_oob_ind_reliably;
 
+
+    /*
+     * PROP_SEARCH_WORD_INDEX:
+     *
+     * General data:
+     */
+    gnet_property->props[489].name = "search_word_index";
+    gnet_property->props[489].desc = _("Whether the library search tables should also keep an inverted index of whole words, allowing multi-word queries to be answered by intersecting the word posting lists instead of scanning the smallest two-letter bin.  The bigram bins remain used for partial words.  Changes take effect at the next library rescan.");
+    gnet_property->props[489].ev_changed = event_new("search_word_index_changed");
+    gnet_property->props[489].save = TRUE;
+    gnet_property->props[489].internal = FALSE;
+    gnet_property->props[489].vector_size = 1;
+	mutex_init(&gnet_property->props[489].lock);
+
+    /* Type specific data: */
+    gnet_property->props[489].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[489].data.boolean.def   = (void *) &gnet_property_variable_search_word_index_default;
+    gnet_property->props[489].data.boolean.value = (void *) &gnet_property_variable_search_word_index;
+
+
+    /*
+     * PROP_QRP_BATCHED_ROUTING:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "qrp_batched_routing";
+    gnet_property->props[490].desc = _("Whether queries should be routed by probing a single bit matrix built from all the QRP tables received from neighbours, instead of probing each table separately.  This is faster when there are many leaves, at the cost of some extra memory.");
+    gnet_property->props[490].ev_changed = event_new("qrp_batched_routing_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_qrp_batched_routing_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_qrp_batched_routing;
+
+
+    /*
+     * PROP_UDP_BATCH_SIZE:
+     *
+     * General data:
+     */
+    gnet_property->props[491].name = "udp_batch_size";
+    gnet_property->props[491].desc = _("Maximum amount of UDP datagrams to read or write in one single system call, on systems supporting it.  Batching saves system calls under heavy UDP traffic.  Setting this to 1 disables batching.");
+    gnet_property->props[491].ev_changed = event_new("udp_batch_size_changed");
+    gnet_property->props[491].save = TRUE;
+    gnet_property->props[491].internal = FALSE;
+    gnet_property->props[491].vector_size = 1;
+	mutex_init(&gnet_property->props[491].lock);
+
+    /* Type specific data: */
+    gnet_property->props[491].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[491].data.guint32.def   = (void *) &gnet_property_variable_udp_batch_size_default;
+    gnet_property->props[491].data.guint32.value = (void *) &gnet_property_variable_udp_batch_size;
+    gnet_property->props[491].data.guint32.choices = NULL;
+    gnet_property->props[491].data.guint32.max   = 64;
+    gnet_property->props[491].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_VERIFY_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[492].name = "verify_threads";
+    gnet_property->props[492].desc = _("Amount of threads used to compute file hashes.  When set to 0, one thread per CPU is used.");
+    gnet_property->props[492].ev_changed = event_new("verify_threads_changed");
+    gnet_property->props[492].save = TRUE;
+    gnet_property->props[492].internal = FALSE;
+    gnet_property->props[492].vector_size = 1;
+	mutex_init(&gnet_property->props[492].lock);
+
+    /* Type specific data: */
+    gnet_property->props[492].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[492].data.guint32.def   = (void *) &gnet_property_variable_verify_threads_default;
+    gnet_property->props[492].data.guint32.value = (void *) &gnet_property_variable_verify_threads;
+    gnet_property->props[492].data.guint32.choices = NULL;
+    gnet_property->props[492].data.guint32.max   = 64;
+    gnet_property->props[492].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_VERIFY_DEVICE_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[493].name = "verify_device_threads";
+    gnet_property->props[493].desc = _("Maximum amount of files that can be hashed concurrently on the same device.  Keep it to 1 for rotating disks to avoid seeking back and forth, raise it for solid-state drives.");
+    gnet_property->props[493].ev_changed = event_new("verify_device_threads_changed");
+    gnet_property->props[493].save = TRUE;
+    gnet_property->props[493].internal = FALSE;
+    gnet_property->props[493].vector_size = 1;
+	mutex_init(&gnet_property->props[493].lock);
+
+    /* Type specific data: */
+    gnet_property->props[493].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[493].data.guint32.def   = (void *) &gnet_property_variable_verify_device_threads_default;
+    gnet_property->props[493].data.guint32.value = (void *) &gnet_property_variable_verify_device_threads;
+    gnet_property->props[493].data.guint32.choices = NULL;
+    gnet_property->props[493].data.guint32.max   = 64;
+    gnet_property->props[493].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_SHA1_CACHE_EXPORT:
+     *
+     * General data:
+     */
+    gnet_property->props[494].name = "sha1_cache_export";
+    gnet_property->props[494].desc = _("Whether the SHA1 cache should also be exported in the legacy text format, in the \"sha1_cache\" file, each time the binary cache is compacted.");
+    gnet_property->props[494].ev_changed = event_new("sha1_cache_export_changed");
+    gnet_property->props[494].save = TRUE;
+    gnet_property->props[494].internal = FALSE;
+    gnet_property->props[494].vector_size = 1;
+	mutex_init(&gnet_property->props[494].lock);
+
+    /* Type specific data: */
+    gnet_property->props[494].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[494].data.boolean.def   = (void *) &gnet_property_variable_sha1_cache_export_default;
+    gnet_property->props[494].data.boolean.value = (void *) &gnet_property_variable_sha1_cache_export;
+
+
+    /*
+     * PROP_SCAN_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[495].name = "scan_threads";
+    gnet_property->props[495].desc = _("Amount of threads used to traverse shared directories and gather file information when rescanning the library. Several threads help hiding the latency of network or large RAID filesystems. When set to 1, directories are scanned sequentially by the library task.");
+    gnet_property->props[495].ev_changed = event_new("scan_threads_changed");
+    gnet_property->props[495].save = TRUE;
+    gnet_property->props[495].internal = FALSE;
+    gnet_property->props[495].vector_size = 1;
+	mutex_init(&gnet_property->props[495].lock);
+
+    /* Type specific data: */
+    gnet_property->props[495].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[495].data.guint32.def   = (void *) &gnet_property_variable_scan_threads_default;
+    gnet_property->props[495].data.guint32.value = (void *) &gnet_property_variable_scan_threads;
+    gnet_property->props[495].data.guint32.choices = NULL;
+    gnet_property->props[495].data.guint32.max   = 32;
+    gnet_property->props[495].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_LIBRARY_WATCH_CHANGES:
+     *
+     * General data:
+     */
+    gnet_property->props[496].name = "library_watch_changes";
+    gnet_property->props[496].desc = _("Monitor shared directories and update the library as soon as files are added, removed or renamed, instead of waiting for the next rescan. This requires kernel support and is limited by the amount of directories the kernel allows to monitor.");
+    gnet_property->props[496].ev_changed = event_new("library_watch_changes_changed");
+    gnet_property->props[496].save = TRUE;
+    gnet_property->props[496].internal = FALSE;
+    gnet_property->props[496].vector_size = 1;
+	mutex_init(&gnet_property->props[496].lock);
+
+    /* Type specific data: */
+    gnet_property->props[496].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[496].data.boolean.def   = (void *) &gnet_property_variable_library_watch_changes_default;
+    gnet_property->props[496].data.boolean.value = (void *) &gnet_property_variable_library_watch_changes;
+
+
+    /*
+     * PROP_COMPRESS_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[497].name = "compress_threads";
+    gnet_property->props[497].desc = _("Amount of threads used to compress and decompress the traffic of new Gnutella connections.  When set to 0, compression runs in the main thread.");
+    gnet_property->props[497].ev_changed = event_new("compress_threads_changed");
+    gnet_property->props[497].save = TRUE;
+    gnet_property->props[497].internal = FALSE;
+    gnet_property->props[497].vector_size = 1;
+	mutex_init(&gnet_property->props[497].lock);
+
+    /* Type specific data: */
+    gnet_property->props[497].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[497].data.guint32.def   = (void *) &gnet_property_variable_compress_threads_default;
+    gnet_property->props[497].data.guint32.value = (void *) &gnet_property_variable_compress_threads;
+    gnet_property->props[497].data.guint32.choices = NULL;
+    gnet_property->props[497].data.guint32.max   = 32;
+    gnet_property->props[497].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_DOWNLOAD_WRITE_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[498].name = "download_write_threads";
+    gnet_property->props[498].desc = _("Amount of threads used to write downloaded data to disk, so that a slow disk does not stall the whole process.  When set to 0, data are written from the main thread.");
+    gnet_property->props[498].ev_changed = event_new("download_write_threads_changed");
+    gnet_property->props[498].save = TRUE;
+    gnet_property->props[498].internal = FALSE;
+    gnet_property->props[498].vector_size = 1;
+	mutex_init(&gnet_property->props[498].lock);
+
+    /* Type specific data: */
+    gnet_property->props[498].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[498].data.guint32.def   = (void *) &gnet_property_variable_download_write_threads_default;
+    gnet_property->props[498].data.guint32.value = (void *) &gnet_property_variable_download_write_threads;
+    gnet_property->props[498].data.guint32.choices = NULL;
+    gnet_property->props[498].data.guint32.max   = 16;
+    gnet_property->props[498].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_DOWNLOAD_WRITE_BACKLOG:
+     *
+     * General data:
+     */
+    gnet_property->props[499].name = "download_write_backlog";
+    gnet_property->props[499].desc = _("Maximum amount of downloaded data being written to disk by the I/O threads.  When reached, downloads stop reading from the network until the disk catches up.");
+    gnet_property->props[499].ev_changed = event_new("download_write_backlog_changed");
+    gnet_property->props[499].save = TRUE;
+    gnet_property->props[499].internal = FALSE;
+    gnet_property->props[499].vector_size = 1;
+	mutex_init(&gnet_property->props[499].lock);
+
+    /* Type specific data: */
+    gnet_property->props[499].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[499].data.guint32.def   = (void *) &gnet_property_variable_download_write_backlog_default;
+    gnet_property->props[499].data.guint32.value = (void *) &gnet_property_variable_download_write_backlog;
+    gnet_property->props[499].data.guint32.choices = NULL;
+    gnet_property->props[499].data.guint32.max   = 268435456;
+    gnet_property->props[499].data.guint32.min   = 131072;
+
+
+    /*
+     * PROP_FILEINFO_EXPORT:
+     *
+     * General data:
+     */
+    gnet_property->props[500].name = "fileinfo_export";
+    gnet_property->props[500].desc = _("Whether the fileinfo database should also be exported in the legacy text format, in the \"fileinfo\" file, when shutting down.");
+    gnet_property->props[500].ev_changed = event_new("fileinfo_export_changed");
+    gnet_property->props[500].save = TRUE;
+    gnet_property->props[500].internal = FALSE;
+    gnet_property->props[500].vector_size = 1;
+	mutex_init(&gnet_property->props[500].lock);
+
+    /* Type specific data: */
+    gnet_property->props[500].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[500].data.boolean.def   = (void *) &gnet_property_variable_fileinfo_export_default;
+    gnet_property->props[500].data.boolean.value = (void *) &gnet_property_variable_fileinfo_export;
+
+
+    /*
+     * PROP_UPLOAD_THREADED_PUMP:
+     *
+     * General data:
+     */
+    gnet_property->props[501].name = "upload_threaded_pump";
+    gnet_property->props[501].desc = _("Whether file data served by uploads should be sent from the I/O threads, once the HTTP headers have been sent, instead of from the main thread.  The bandwidth used remains accounted for by the upload bandwidth schedulers.  TLS connections are always served from the main thread.");
+    gnet_property->props[501].ev_changed = event_new("upload_threaded_pump_changed");
+    gnet_property->props[501].save = TRUE;
+    gnet_property->props[501].internal = FALSE;
+    gnet_property->props[501].vector_size = 1;
+	mutex_init(&gnet_property->props[501].lock);
+
+    /* Type specific data: */
+    gnet_property->props[501].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[501].data.boolean.def   = (void *) &gnet_property_variable_upload_threaded_pump_default;
+    gnet_property->props[501].data.boolean.value = (void *) &gnet_property_variable_upload_threaded_pump;
+
+
+    /*
+     * PROP_UPLOAD_PUMP_THREADS:
+     *
+     * General data:
+     */
+    gnet_property->props[502].name = "upload_pump_threads";
+    gnet_property->props[502].desc = _("Amount of I/O threads sending the file data of uploads, when the upload_threaded_pump property is set.");
+    gnet_property->props[502].ev_changed = event_new("upload_pump_threads_changed");
+    gnet_property->props[502].save = TRUE;
+    gnet_property->props[502].internal = FALSE;
+    gnet_property->props[502].vector_size = 1;
+	mutex_init(&gnet_property->props[502].lock);
+
+    /* Type specific data: */
+    gnet_property->props[502].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[502].data.guint32.def   = (void *) &gnet_property_variable_upload_pump_threads_default;
+    gnet_property->props[502].data.guint32.value = (void *) &gnet_property_variable_upload_pump_threads;
+    gnet_property->props[502].data.guint32.choices = NULL;
+    gnet_property->props[502].data.guint32.max   = 16;
+    gnet_property->props[502].data.guint32.min   = 1;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
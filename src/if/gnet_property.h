@@ -525,6 +525,20 @@ typedef enum {
     PROP_LOCK_SLEEP_TRACE,
     PROP_RUNNING_TOPLESS,
     PROP_SEND_OOB_IND_RELIABLY,
+    PROP_SEARCH_WORD_INDEX,
+    PROP_QRP_BATCHED_ROUTING,
+    PROP_UDP_BATCH_SIZE,
+    PROP_VERIFY_THREADS,
+    PROP_VERIFY_DEVICE_THREADS,
+    PROP_SHA1_CACHE_EXPORT,
+    PROP_SCAN_THREADS,
+    PROP_LIBRARY_WATCH_CHANGES,
+    PROP_COMPRESS_THREADS,
+    PROP_DOWNLOAD_WRITE_THREADS,
+    PROP_DOWNLOAD_WRITE_BACKLOG,
+    PROP_FILEINFO_EXPORT,
+    PROP_UPLOAD_THREADED_PUMP,
+    PROP_UPLOAD_PUMP_THREADS,
     GNET_PROPERTY_END
 } gnet_property_t;
 
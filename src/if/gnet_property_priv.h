@@ -539,6 +539,20 @@ extern const gboolean gnet_property_variable_lock_contention_trace;
 extern const gboolean gnet_property_variable_lock_sleep_trace;
 extern const gboolean gnet_property_variable_running_topless;
 extern const gboolean gnet_property_variable_send_oob_ind_reliably;
+extern const gboolean gnet_property_variable_search_word_index;
+extern const gboolean gnet_property_variable_qrp_batched_routing;
+extern const guint32  gnet_property_variable_udp_batch_size;
+extern const guint32  gnet_property_variable_verify_threads;
+extern const guint32  gnet_property_variable_verify_device_threads;
+extern const gboolean gnet_property_variable_sha1_cache_export;
+extern const guint32  gnet_property_variable_scan_threads;
+extern const gboolean gnet_property_variable_library_watch_changes;
+extern const guint32  gnet_property_variable_compress_threads;
+extern const guint32  gnet_property_variable_download_write_threads;
+extern const guint32  gnet_property_variable_download_write_backlog;
+extern const gboolean gnet_property_variable_fileinfo_export;
+extern const gboolean gnet_property_variable_upload_threaded_pump;
+extern const guint32  gnet_property_variable_upload_pump_threads;
 
 
 prop_set_t *gnet_prop_init(void);
@@ -0,0 +1,387 @@
+/*
+ * cq-test -- callout queue tests and backend benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/cq.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_TIMERS		10000	/* Timers for the correctness tests */
+#define TEST_SPAN		300000	/* Maximum delay for tests, in ms */
+#define TEST_STEP		250		/* Maximum clock step for tests, in ms */
+
+#define BENCH_SPAN		600000	/* Maximum delay for benchmarks, in ms */
+#define BENCH_STEP		100		/* Clock step for benchmarks, in ms */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-n timers] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of timers for benchmarks\n"
+		"  -t : benchmark the callout queue backends\n"
+		"  -R : seed for repeatable random tests\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s - FAILED\n", what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+#define test_assert(what, cond) G_STMT_START {	\
+	if G_UNLIKELY(!(cond))						\
+		test_abort(what);						\
+} G_STMT_END
+
+static const char *backend_name[] = { "wheel", "hash" };
+
+/***
+ *** Correctness tests.
+ ***/
+
+struct timer {
+	cevent_t *ev;				/* Pending event, NULL if fired or cancelled */
+	cq_time_t trigger;			/* Expected trigger time */
+	size_t fired;				/* Amount of times the timer fired */
+};
+
+static struct {
+	struct timer *timers;		/* All the timers */
+	size_t count;				/* Amount of timers used */
+	size_t capacity;			/* Amount of allocated timers */
+	cq_time_t now;				/* Current virtual time */
+	cq_time_t last;				/* Virtual time at previous step */
+	const char *what;			/* Test being run */
+} tq;
+
+static void timer_fire(cqueue_t *cq, void *arg);
+
+static void
+timer_start(cqueue_t *cq, struct timer *t, int delay)
+{
+	t->trigger = tq.now + delay;
+	t->ev = cq_insert(cq, delay, timer_fire, t);
+}
+
+static void
+timer_fire(cqueue_t *cq, void *arg)
+{
+	struct timer *t = arg;
+
+	cq_zero(cq, &t->ev);
+
+	/*
+	 * The timer must fire during the clock step where it became due, never
+	 * before it is due.
+	 */
+
+	test_assert(tq.what, 0 == t->fired);
+	test_assert(tq.what, t->trigger <= tq.now);
+	test_assert(tq.what, t->trigger > tq.last);
+	t->fired++;
+
+	/*
+	 * Exercise insertion and rescheduling from within a callback, including
+	 * events that are due immediately.
+	 */
+
+	if (tq.count < tq.capacity && 0 == rand31_value(7)) {
+		struct timer *n = &tq.timers[tq.count++];
+		timer_start(cq, n, rand31_value(2 * TEST_STEP));
+	}
+
+	if (0 == rand31_value(11)) {
+		struct timer *o = &tq.timers[rand31_value(tq.count - 1)];
+		if (o->ev != NULL) {
+			int delay = rand31_value(TEST_STEP);
+			test_assert(tq.what, cq_resched(o->ev, delay));
+			o->trigger = tq.now + delay;
+		}
+	}
+}
+
+/**
+ * @return expected delay until next timer, MAX_INT_VAL(int) if none.
+ */
+static int
+timer_next_delay(void)
+{
+	int delay = MAX_INT_VAL(int);
+	size_t i;
+
+	for (i = 0; i < tq.count; i++) {
+		const struct timer *t = &tq.timers[i];
+
+		if (NULL == t->ev)
+			continue;
+		if (t->trigger <= tq.now)
+			return 0;
+		delay = MIN(delay, (int) (t->trigger - tq.now));
+	}
+
+	return delay;
+}
+
+static void
+test_backend(enum cq_backend backend)
+{
+	cqueue_t *cq;
+	size_t i, pending;
+	int step;
+
+	tq.what = backend_name[backend];
+	tq.capacity = 2 * TEST_TIMERS;
+	tq.count = TEST_TIMERS;
+	tq.now = tq.last = 0;
+	XMALLOC0_ARRAY(tq.timers, tq.capacity);
+
+	cq = cq_make_full(tq.what, 0, TEST_STEP, backend);
+	cq_advance(cq, 0);		/* Run the queue from this thread */
+
+	for (i = 0; i < tq.count; i++)
+		timer_start(cq, &tq.timers[i], 1 + rand31_value(TEST_SPAN));
+
+	/*
+	 * Cancel and reschedule some timers before running the clock.
+	 */
+
+	for (i = 0; i < tq.count; i++) {
+		struct timer *t = &tq.timers[i];
+
+		switch (rand31_value(4)) {
+		case 0:
+			test_assert(tq.what, !cq_cancel(&t->ev));
+			test_assert(tq.what, NULL == t->ev);
+			break;
+		case 1:
+			step = 1 + rand31_value(TEST_SPAN);
+			test_assert(tq.what, cq_resched(t->ev, step));
+			t->trigger = tq.now + step;
+			break;
+		default:
+			break;
+		}
+	}
+
+	/*
+	 * Advance the clock by random steps, checking the delay until the next
+	 * event, until all timers have fired.
+	 */
+
+	do {
+		int delay = timer_next_delay();
+
+		test_assert(tq.what, cq_delay(cq) == delay);
+
+		step = (0 == rand31_value(100)) ?
+			rand31_value(100 * TEST_STEP) : rand31_value(TEST_STEP);
+		tq.last = tq.now;
+		tq.now += step;
+		cq_advance(cq, step);
+
+		for (i = 0, pending = 0; i < tq.count; i++) {
+			if (tq.timers[i].ev != NULL) {
+				test_assert(tq.what, tq.timers[i].trigger > tq.now);
+				pending++;
+			}
+		}
+		test_assert(tq.what, cq_count(cq) == (int) pending);
+	} while (pending != 0);
+
+	cq_free_null(&cq);
+	XFREE_NULL(tq.timers);
+
+	if (verbose_mode)
+		printf("%s - OK\n", tq.what);
+}
+
+static void
+test_queues(void)
+{
+	test_backend(CQ_BACKEND_WHEEL);
+	test_backend(CQ_BACKEND_HASH);
+}
+
+/***
+ *** Benchmarking.
+ ***/
+
+static size_t bench_fired;
+
+static void
+bench_fire(cqueue_t *cq, void *arg)
+{
+	cevent_t **ev = arg;
+
+	cq_zero(cq, ev);
+	bench_fired++;
+}
+
+static double
+bench_ns(const tm_t *end, const tm_t *start, size_t n)
+{
+	return tm_elapsed_f(end, start) * 1e9 / n;
+}
+
+static void
+bench_backend(enum cq_backend backend, size_t n, unsigned seed)
+{
+	cqueue_t *cq;
+	cevent_t **ev;
+	tm_t start, end;
+	double insert, resched, cancel, fire;
+	size_t i, cancelled = 0;
+
+	XMALLOC0_ARRAY(ev, n);
+	rand31_set_seed(seed);
+
+	cq = cq_make_full(backend_name[backend], 0, BENCH_STEP, backend);
+	cq_advance(cq, 0);		/* Run the queue from this thread */
+
+	tm_now_exact(&start);
+	for (i = 0; i < n; i++)
+		ev[i] = cq_insert(cq, 1 + rand31_value(BENCH_SPAN), bench_fire, &ev[i]);
+	tm_now_exact(&end);
+	insert = bench_ns(&end, &start, n);
+
+	tm_now_exact(&start);
+	for (i = 0; i < n; i++)
+		cq_resched(ev[i], 1 + rand31_value(BENCH_SPAN));
+	tm_now_exact(&end);
+	resched = bench_ns(&end, &start, n);
+
+	tm_now_exact(&start);
+	for (i = 0; i < n; i += 2) {
+		cq_cancel(&ev[i]);
+		cancelled++;
+	}
+	tm_now_exact(&end);
+	cancel = bench_ns(&end, &start, cancelled);
+
+	bench_fired = 0;
+	tm_now_exact(&start);
+	while (cq_count(cq) != 0)
+		cq_advance(cq, BENCH_STEP);
+	tm_now_exact(&end);
+	fire = bench_ns(&end, &start, n - cancelled);
+
+	test_assert("benchmark", bench_fired == n - cancelled);
+
+	printf("%5s - %7zu timers - insert %7.1f ns, resched %7.1f ns, "
+		"cancel %7.1f ns, fire %7.1f ns\n",
+		backend_name[backend], n, insert, resched, cancel, fire);
+
+	cq_free_null(&cq);
+	XFREE_NULL(ev);
+}
+
+static void
+bench_queues(size_t n)
+{
+	unsigned seed = rand31_u32();
+
+	bench_backend(CQ_BACKEND_HASH, n, seed);
+	bench_backend(CQ_BACKEND_WHEEL, n, seed);
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t timers = 0;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hn:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of timers */
+			timers = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	test_queues();
+
+	if (tflag) {
+		if (timers != 0) {
+			bench_queues(timers);
+		} else {
+			bench_queues(10000);
+			bench_queues(100000);
+			bench_queues(1000000);
+		}
+	}
+
+	printf("All OK!\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
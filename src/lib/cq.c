@@ -82,6 +82,7 @@ struct cevent {
 	cq_time_t ce_time;			/**< Absolute trigger time (virtual cq time) */
 	struct cevent *ce_bnext;	/**< Next item in hash bucket */
 	struct cevent *ce_bprev;	/**< Prev item in hash bucket */
+	struct chash *ce_bucket;	/**< Bucket where event is linked */
 	cqueue_t *ce_cq;			/**< Callout queue where event is registered */
 	cq_service_t ce_fn;			/**< Callback routine */
 	void *ce_arg;				/**< Argument to pass to said callback */
@@ -154,6 +155,10 @@ cevent_is_extended(const cevent_t *ce)
  * yet-to-come messages, or whatever. We don't care, and we don't want to care.
  * The notion of "current time" is simply given by calling cq_clock() at
  * regular intervals and giving it the "elasped time" since the last call.
+ *
+ * The hashed buckets are only one of the two possible backends.  By default,
+ * a queue uses a hierarchical timing wheel, where buckets are not sorted
+ * (see the description of the CQ_WHEEL constants below).
  */
 
 struct chash {
@@ -171,8 +176,11 @@ struct cqueue {
 	tm_t cq_last_heartbeat;		/**< Real time of last heartbeat */
 	cq_time_t cq_time;			/**< "current time" */
 	const char *cq_name;		/**< Queue name, for logging */
-	struct chash *cq_hash;		/**< Array of buckets for hash list */
+	struct chash *cq_hash;		/**< Array of buckets for hash list / wheel */
 	struct chash *cq_current;	/**< Current bucket scanned in cq_clock() */
+	cq_time_t cq_wtick;			/**< Current wheel tick */
+	enum cq_backend cq_backend;	/**< Backend used for event storage */
+	size_t cq_buckets;			/**< Amount of buckets in cq_hash[] */
 	elist_t cq_periodic;		/**< Periodic events registered */
 	hset_t *cq_idle;			/**< Idle events registered */
 	const cevent_t *cq_call;	/**< Event being called out, for cq_zero() */
@@ -210,6 +218,30 @@ cqueue_check(const struct cqueue * const cq)
 #define EV_HASH(x) (((x) >> 5) & HASH_MASK)
 #define EV_OVER(x) (((x) >> 5) & ~HASH_MASK)
 
+/*
+ * The hierarchical timing wheel divides time in ticks of 2^5 = 32 units,
+ * the same resolution as the hashed buckets.  Level 0 has one slot per tick
+ * for the next CQ_WHEEL_SIZE ticks, and each slot of an upper level spans
+ * CQ_WHEEL_SIZE times more ticks than a slot of the level below.
+ *
+ * Slots are unsorted lists, so insertion, cancellation and rescheduling are
+ * constant-time operations.  When a level wraps around, the next slot of
+ * the level above is cascaded down: its events are redistributed in the
+ * lower levels.  Each event is therefore moved at most once per level
+ * before it fires.
+ *
+ * With 4 levels of 256 slots, the wheel covers 2^32 ticks, more than the
+ * largest delay that can be given to cq_insert().
+ */
+#define CQ_WHEEL_SHIFT	5
+#define CQ_WHEEL_BITS	8
+#define CQ_WHEEL_SIZE	(1 << CQ_WHEEL_BITS)
+#define CQ_WHEEL_MASK	(CQ_WHEEL_SIZE - 1)
+#define CQ_WHEEL_LEVELS	4
+
+#define WHEEL_TICK(x)	((x) >> CQ_WHEEL_SHIFT)
+#define WHEEL_SLOT(q,l,i)	(&(q)->cq_hash[(l) * CQ_WHEEL_SIZE + (i)])
+
 /**
  * Locking of the callout queue for short period of time, in sections that
  * do not encompass memory allocation or do not call other routines that may
@@ -291,20 +323,36 @@ cq_main_thread_id(void)
  * @param name		queue name, for logging
  * @param now		virtual current time -- use 0 if not important
  * @param period	period between heartbeats, in ms
+ * @param backend	the backend to use to store events
  *
  * @return the initialized object
  */
 static cqueue_t *
-cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
+cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period,
+	enum cq_backend backend)
 {
 	/*
 	 * The cq_hash hash list is used to speed up insert/delete operations.
+	 * With the timing wheel, it holds the slots of all the levels.
 	 */
 
+	switch (backend) {
+	case CQ_BACKEND_WHEEL:
+		cq->cq_buckets = CQ_WHEEL_LEVELS * CQ_WHEEL_SIZE;
+		goto done;
+	case CQ_BACKEND_HASH:
+		cq->cq_buckets = HASH_SIZE;
+		goto done;
+	}
+	g_assert_not_reached();
+
+done:
 	cq->cq_magic = CQUEUE_MAGIC;
 	cq->cq_name = atom_str_get(name);
-	XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+	cq->cq_backend = backend;
+	XMALLOC0_ARRAY(cq->cq_hash, cq->cq_buckets);
 	cq->cq_time = now;
+	cq->cq_wtick = WHEEL_TICK(now);
 	cq->cq_last_bucket = EV_HASH(now);
 	cq->cq_period = period;
 	cq->cq_stid = THREAD_INVALID_ID;
@@ -318,26 +366,43 @@ cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
 }
 
 /**
- * Create a new callout queue object.
+ * Create a new callout queue object, using specified backend.
  *
  * @param name		queue name, for logging
  * @param now		virtual current time -- use 0 if not important
  * @param period	period between heartbeats, in ms
+ * @param backend	the backend to use to store events
  *
  * @return a new callout queue
  */
 cqueue_t *
-cq_make(const char *name, cq_time_t now, int period)
+cq_make_full(const char *name, cq_time_t now, int period,
+	enum cq_backend backend)
 {
 	cqueue_t *cq;
 
 	WALLOC0(cq);
-	cq_initialize(cq, name, now, period);
+	cq_initialize(cq, name, now, period, backend);
 	cq_vars_add(cq);
 
 	return cq;
 }
 
+/**
+ * Create a new callout queue object.
+ *
+ * @param name		queue name, for logging
+ * @param now		virtual current time -- use 0 if not important
+ * @param period	period between heartbeats, in ms
+ *
+ * @return a new callout queue
+ */
+cqueue_t *
+cq_make(const char *name, cq_time_t now, int period)
+{
+	return cq_make_full(name, now, period, CQ_BACKEND_WHEEL);
+}
+
 /**
  * @return the amount of items held in the callout queue.
  */
@@ -451,6 +516,62 @@ ev_free(cevent_t *ev)
 	}
 }
 
+/**
+ * Compute the timing wheel slot where an event triggering at the specified
+ * time must be linked.
+ */
+static struct chash *
+ev_wheel_slot(const cqueue_t *cq, cq_time_t trigger)
+{
+	cq_time_t tick = WHEEL_TICK(trigger);
+	cq_time_t delta;
+	int level;
+
+	/*
+	 * Events that are due at or before the tick being processed go to the
+	 * current level-0 slot, so that they get fired during the current
+	 * cq_clock() run, or at the next one.
+	 */
+
+	if (tick <= cq->cq_wtick)
+		return WHEEL_SLOT(cq, 0, cq->cq_wtick & CQ_WHEEL_MASK);
+
+	delta = tick - cq->cq_wtick;
+
+	for (level = 0; level < CQ_WHEEL_LEVELS - 1; level++) {
+		if (delta < (cq_time_t) 1 << (CQ_WHEEL_BITS * (level + 1)))
+			break;
+	}
+
+	g_assert(delta >> (CQ_WHEEL_BITS * CQ_WHEEL_LEVELS) == 0);
+
+	return WHEEL_SLOT(cq, level,
+		(tick >> (CQ_WHEEL_BITS * level)) & CQ_WHEEL_MASK);
+}
+
+/**
+ * Link event into the timing wheel.
+ *
+ * Slots are not sorted, hence the event is simply appended.
+ */
+static void
+ev_link_wheel(cqueue_t *cq, cevent_t *ev)
+{
+	struct chash *ch = ev_wheel_slot(cq, ev->ce_time);
+
+	ev->ce_bucket = ch;
+	ev->ce_bnext = NULL;
+	ev->ce_bprev = ch->ch_tail;
+
+	if (NULL == ch->ch_tail) {
+		g_assert(NULL == ch->ch_head);
+		ch->ch_head = ev;
+	} else {
+		ch->ch_tail->ce_bnext = ev;
+	}
+	ch->ch_tail = ev;
+}
+
 /**
  * Link event into the callout queue.
  */
@@ -466,12 +587,19 @@ ev_link(cevent_t *ev)
 
 	cq = ev->ce_cq;
 	cqueue_check(cq);
-	g_assert(ev->ce_time > cq->cq_time || cq->cq_current);
 	assert_mutex_is_owned(&cq->cq_lock);
 
-	trigger = ev->ce_time;
 	cq->cq_items++;
 
+	if (CQ_BACKEND_WHEEL == cq->cq_backend) {
+		ev_link_wheel(cq, ev);
+		return;
+	}
+
+	g_assert(ev->ce_time > cq->cq_time || cq->cq_current);
+
+	trigger = ev->ce_time;
+
 	/*
 	 * Important corner case: we may be rescheduling an event BEFORE
 	 * the current clock time, in which case we must insert the event
@@ -486,6 +614,8 @@ ev_link(cevent_t *ev)
 
 	g_assert(ch);
 
+	ev->ce_bucket = ch;
+
 	/*
 	 * If bucket is empty, the event is the new head.
 	 */
@@ -562,7 +692,7 @@ ev_unlink(cevent_t *ev)
 	cqueue_check(cq);
 	assert_mutex_is_owned(&cq->cq_lock);
 
-	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
+	ch = ev->ce_bucket;
 	cq->cq_items--;
 
 	/*
@@ -932,9 +1062,13 @@ cq_resched(cevent_t *ev, int delay)
 	 * If is perfectly possible that whilst running cq_clock() and
 	 * expiring an event, some other event gets rescheduled BEFORE the
 	 * current clock time. Hence the assertion below.
+	 *
+	 * With the timing wheel, an event due within the current tick can
+	 * still be pending outside of cq_clock().
 	 */
 
-	g_assert(ev->ce_time > cq->cq_time || cq->cq_current);
+	g_assert(ev->ce_time > cq->cq_time || cq->cq_current ||
+		CQ_BACKEND_WHEEL == cq->cq_backend);
 
 	/*
 	 * Events are sorted into the callout queue by trigger time, and are also
@@ -1129,57 +1263,23 @@ cq_replace(cevent_t *ev, cq_service_t fn, void *arg)
 }
 
 /**
- * The heartbeat of our callout queue.
- *
- * Called to notify us about the elapsed "time" so that we can expire timeouts
- * and maintain our notion of "current time".
- *
- * NB: The time maintained by the callout queue is "virtual".
+ * Expire the due events of the hashed buckets, up to the current time.
  *
  * @param cq		the callout queue
- * @param elapsed	the elapsed time, in milliseconds
+ * @param elapsed	the elapsed time since last call, in milliseconds
  *
- * @return the amount of events triggered (excluding "idle" events).
+ * @return the amount of events triggered.
  */
 static size_t
-cq_clock(cqueue_t *cq, int elapsed)
+cq_clock_hash(cqueue_t *cq, int elapsed)
 {
 	int bucket;
-	int last_bucket, old_last_bucket;
-	struct chash *ch, *old_current;
+	int last_bucket;
+	struct chash *ch;
 	cevent_t *ev;
-	const cevent_t *old_call;
-	bool old_call_extended, force_idle = FALSE;
-	cq_time_t now;
+	cq_time_t now = cq->cq_time;
 	size_t processed = 0;
 
-	cqueue_check(cq);
-	g_assert(elapsed >= 0);
-	assert_mutex_is_owned(&cq->cq_lock);
-
-	/*
-	 * Recursive calls are possible: in the middle of an event, we could
-	 * trigger something that will call cq_dispatch() manually for instance.
-	 *
-	 * Therefore, we save the cq_current and cq_last_bucket fields upon
-	 * entry and restore them at the end as appropriate. If cq_current is
-	 * NULL initially, it means we were not in the middle of any recursion
-	 * so we won't have to restore cq_last_bucket.
-	 *
-	 * Note that we enforce recursive calls to cq_clock() to be on the
-	 * same thread due to the use of a mutex. However, each initial run of
-	 * cq_clock() could happen on a different thread each time.
-	 */
-
-	old_current = cq->cq_current;
-	old_call = cq->cq_call;
-	old_call_extended = cq->cq_call_extended;
-	old_last_bucket = cq->cq_last_bucket;
-
-	cq->cq_ticks++;
-	cq->cq_time += elapsed;
-	now = cq->cq_time;
-
 	bucket = cq->cq_last_bucket;		/* Bucket we traversed last time */
 	ch = &cq->cq_hash[bucket];
 	last_bucket = EV_HASH(now);			/* Last bucket to traverse now */
@@ -1210,7 +1310,7 @@ cq_clock(cqueue_t *cq, int elapsed)
 	 */
 
 	if (cq->cq_last_bucket == last_bucket && !EV_OVER(elapsed))
-		goto done;
+		return processed;
 
 	cq->cq_last_bucket = last_bucket;
 
@@ -1235,7 +1335,209 @@ cq_clock(cqueue_t *cq, int elapsed)
 
 	} while (bucket != last_bucket);
 
-done:
+	return processed;
+}
+
+/**
+ * Cascade the timing wheel when the current tick wraps around a level.
+ *
+ * The events held in the next slot of the upper level are relinked, which
+ * moves them to a lower level (or to level 0).  This is repeated for each
+ * level that wraps around.
+ */
+static void
+cq_wheel_cascade(cqueue_t *cq)
+{
+	int level;
+
+	for (level = 1; level < CQ_WHEEL_LEVELS; level++) {
+		cq_time_t idx = cq->cq_wtick >> (CQ_WHEEL_BITS * (level - 1));
+		struct chash *ch;
+		cevent_t *ev, *next;
+
+		if (0 != (idx & CQ_WHEEL_MASK))
+			break;			/* Lower level did not wrap around */
+
+		ch = WHEEL_SLOT(cq, level, (idx >> CQ_WHEEL_BITS) & CQ_WHEEL_MASK);
+		ev = ch->ch_head;
+		ch->ch_head = ch->ch_tail = NULL;
+
+		for (/* empty */; ev != NULL; ev = next) {
+			next = ev->ce_bnext;
+			ev_link_wheel(cq, ev);
+		}
+	}
+}
+
+/**
+ * Expire the due events held in the level-0 slot of the current tick.
+ *
+ * For the last tick, the slot is first moved to a local list, so that
+ * events scheduled after the current time can be put back in the slot as
+ * we go, and so that callbacks can freely cancel or reschedule any event.
+ *
+ * @return the amount of events triggered.
+ */
+static size_t
+cq_wheel_expire(cqueue_t *cq)
+{
+	size_t processed = 0;
+	size_t fired;
+
+	/*
+	 * When the current tick is entirely in the past, all the events of the
+	 * slot are due and can be fired in sequence.  The slot is re-fetched
+	 * each time since callbacks can recursively move the wheel forward.
+	 */
+
+	while (cq->cq_wtick < WHEEL_TICK(cq->cq_time)) {
+		struct chash *ch = WHEEL_SLOT(cq, 0, cq->cq_wtick & CQ_WHEEL_MASK);
+		cevent_t *ev = ch->ch_head;
+
+		cq->cq_current = ch;
+
+		if (NULL == ev)
+			return processed;
+
+		cq_expire_internal(cq, ev);
+		processed++;
+	}
+
+	do {
+		struct chash pending;
+		struct chash *ch;
+		cevent_t *ev;
+
+		ch = WHEEL_SLOT(cq, 0, cq->cq_wtick & CQ_WHEEL_MASK);
+		cq->cq_current = ch;
+
+		if (NULL == ch->ch_head)
+			break;
+
+		pending = *ch;			/* struct copy */
+		ch->ch_head = ch->ch_tail = NULL;
+
+		for (ev = pending.ch_head; ev != NULL; ev = ev->ce_bnext)
+			ev->ce_bucket = &pending;
+
+		fired = 0;
+
+		while (NULL != (ev = pending.ch_head)) {
+			if (ev->ce_time <= cq->cq_time) {
+				cq_expire_internal(cq, ev);
+				fired++;
+			} else {
+				ev_unlink(ev);
+				ev_link(ev);
+			}
+		}
+
+		/*
+		 * Loop if events were fired: callbacks may have inserted new events
+		 * that are already due in the current slot.
+		 */
+
+		processed += fired;
+	} while (fired != 0);
+
+	return processed;
+}
+
+/**
+ * Expire the due events of the timing wheel, up to the current time.
+ *
+ * @param cq		the callout queue
+ *
+ * @return the amount of events triggered.
+ */
+static size_t
+cq_clock_wheel(cqueue_t *cq)
+{
+	size_t processed;
+
+	/*
+	 * An empty wheel can jump right to the current time: no cascading
+	 * is needed when there are no events.
+	 */
+
+	if (0 == cq->cq_items) {
+		cq->cq_wtick = WHEEL_TICK(cq->cq_time);
+		return 0;
+	}
+
+	/*
+	 * Rescan the current tick first, in case some of its events were not
+	 * due at the last run.
+	 *
+	 * The target tick is re-read at each step, since a recursive call to
+	 * cq_clock() from a callback can move time forward.
+	 */
+
+	processed = cq_wheel_expire(cq);
+
+	while (cq->cq_wtick < WHEEL_TICK(cq->cq_time)) {
+		cq->cq_wtick++;
+		if (0 == (cq->cq_wtick & CQ_WHEEL_MASK))
+			cq_wheel_cascade(cq);
+		processed += cq_wheel_expire(cq);
+	}
+
+	return processed;
+}
+
+/**
+ * The heartbeat of our callout queue.
+ *
+ * Called to notify us about the elapsed "time" so that we can expire timeouts
+ * and maintain our notion of "current time".
+ *
+ * NB: The time maintained by the callout queue is "virtual".
+ *
+ * @param cq		the callout queue
+ * @param elapsed	the elapsed time, in milliseconds
+ *
+ * @return the amount of events triggered (excluding "idle" events).
+ */
+static size_t
+cq_clock(cqueue_t *cq, int elapsed)
+{
+	int old_last_bucket;
+	struct chash *old_current;
+	const cevent_t *old_call;
+	bool old_call_extended, force_idle = FALSE;
+	size_t processed;
+
+	cqueue_check(cq);
+	g_assert(elapsed >= 0);
+	assert_mutex_is_owned(&cq->cq_lock);
+
+	/*
+	 * Recursive calls are possible: in the middle of an event, we could
+	 * trigger something that will call cq_dispatch() manually for instance.
+	 *
+	 * Therefore, we save the cq_current and cq_last_bucket fields upon
+	 * entry and restore them at the end as appropriate. If cq_current is
+	 * NULL initially, it means we were not in the middle of any recursion
+	 * so we won't have to restore cq_last_bucket.
+	 *
+	 * Note that we enforce recursive calls to cq_clock() to be on the
+	 * same thread due to the use of a mutex. However, each initial run of
+	 * cq_clock() could happen on a different thread each time.
+	 */
+
+	old_current = cq->cq_current;
+	old_call = cq->cq_call;
+	old_call_extended = cq->cq_call_extended;
+	old_last_bucket = cq->cq_last_bucket;
+
+	cq->cq_ticks++;
+	cq->cq_time += elapsed;
+
+	if (CQ_BACKEND_WHEEL == cq->cq_backend)
+		processed = cq_clock_wheel(cq);
+	else
+		processed = cq_clock_hash(cq, elapsed);
+
 	cq->cq_current = old_current;
 	cq->cq_call = old_call;
 	cq->cq_call_extended = old_call_extended;
@@ -1284,6 +1586,63 @@ done:
 	return processed;		/* Do not count idle events */
 }
 
+/**
+ * Compute delay until the next event registered in the timing wheel.
+ *
+ * At each level, the first non-empty slot following the current position
+ * holds the earliest events of that level, so we only need to look at one
+ * slot per level.
+ *
+ * @param cq		the callout queue (locked)
+ * @param scanned	where the amount of scanned slots is written
+ *
+ * @return the "virtual time" delay until the next registered event.
+ */
+static int
+cq_delay_wheel(const cqueue_t *cq, int *scanned)
+{
+	int delay = MAX_INT_VAL(int);
+	int level, n = 0;
+
+	for (level = 0; level < CQ_WHEEL_LEVELS; level++) {
+		cq_time_t idx = cq->cq_wtick >> (CQ_WHEEL_BITS * level);
+		int d;
+
+		/*
+		 * The current level-0 slot holds events due within the current tick
+		 * and is therefore scanned.  At upper levels, the current slot was
+		 * already cascaded and can only hold events that are a whole wheel
+		 * turn away.
+		 */
+
+		for (d = (0 == level) ? 0 : 1; d <= CQ_WHEEL_SIZE; d++) {
+			const struct chash *ch;
+			const cevent_t *ev;
+
+			ch = WHEEL_SLOT(cq, level, (idx + d) & CQ_WHEEL_MASK);
+			n++;
+
+			if (NULL == ch->ch_head)
+				continue;
+
+			for (ev = ch->ch_head; ev != NULL; ev = ev->ce_bnext) {
+				int edelay;
+
+				if G_UNLIKELY(ev->ce_time <= cq->cq_time) {
+					*scanned = n;
+					return 0;
+				}
+				edelay = MIN(ev->ce_time - cq->cq_time, MAX_INT_VAL(int));
+				delay = MIN(delay, edelay);
+			}
+			break;
+		}
+	}
+
+	*scanned = n;
+	return delay;
+}
+
 /**
  * Compute delay until the next registered event, expressed in units of the
  * callout queue "virtual time".
@@ -1315,6 +1674,11 @@ cq_delay(const cqueue_t *cq)
 	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
 	now = cq->cq_time;
 
+	if (CQ_BACKEND_WHEEL == cq->cq_backend) {
+		delay = cq_delay_wheel(cq, &i);
+		goto idle;
+	}
+
 	for (i = 0; i < HASH_SIZE; i++) {
 		int b = (last_bucket + i) & HASH_MASK;
 		struct chash *ch = &cq->cq_hash[b];
@@ -1344,6 +1708,7 @@ cq_delay(const cqueue_t *cq)
 		delay = MIN(delay, edelay);
 	}
 
+idle:
 	/*
 	 * If there are idle events registered in the queue, then we need to make
 	 * sure they are scheduled at least once every CQ_IDLE_FORCE seconds.
@@ -1484,6 +1849,43 @@ cq_heartbeat(cqueue_t *cq)
 	return triggered;
 }
 
+/**
+ * Manually advance the virtual time of a callout queue, firing all the
+ * events that become due.
+ *
+ * This is meant for queues that are not driven by cq_heartbeat(), such as
+ * queues running on a virtual clock.  As with cq_heartbeat(), it must always
+ * be called from the same thread.
+ *
+ * @param cq		the callout queue
+ * @param elapsed	the amount of virtual time elapsed
+ *
+ * @return the amount of triggered events.
+ */
+size_t
+cq_advance(cqueue_t *cq, int elapsed)
+{
+	uint stid = thread_small_id();
+
+	cqueue_check(cq);
+	g_assert(elapsed >= 0);
+
+	CQ_LOCK(cq);
+
+	if G_UNLIKELY(THREAD_INVALID_ID == cq->cq_stid)
+		cq->cq_stid = stid;
+
+	g_assert_log(stid == cq->cq_stid,
+		"%s(): callout queue \"%s\" driven from %s, called from %s",
+		G_STRFUNC, cq->cq_name, thread_id_name(cq->cq_stid), thread_name());
+
+	/*
+	 * We hold the mutex when calling cq_clock(), and it will be released there.
+	 */
+
+	return cq_clock(cq, elapsed);
+}
+
 /**
  * Convenience routine: insert event in the main callout queue.
  *
@@ -1816,7 +2218,8 @@ cq_submake(const char *name, cqueue_t *parent, int period)
 	struct csubqueue *csq;
 
 	WALLOC0(csq);
-	cq_initialize(&csq->sub_cq, name, parent->cq_time, period);
+	cq_initialize(&csq->sub_cq, name, parent->cq_time, period,
+		parent->cq_backend);
 	csq->sub_cq.cq_magic = CSUBQUEUE_MAGIC;
 	csq->sub_cq.cq_stid = parent->cq_stid;	/* Runs out of same thread */
 
@@ -2260,7 +2663,7 @@ cq_free(cqueue_t *cq)
 {
 	cevent_t *ev;
 	cevent_t *ev_next;
-	int i;
+	size_t i;
 	struct chash *ch;
 
 	cqueue_check(cq);
@@ -2274,7 +2677,7 @@ cq_free(cqueue_t *cq)
 
 	mutex_lock(&cq->cq_lock);
 
-	for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
+	for (ch = cq->cq_hash, i = 0; i < cq->cq_buckets; i++, ch++) {
 		for (ev = ch->ch_head; ev; ev = ev_next) {
 			ev_next = ev->ce_bnext;
 			ev_free(ev);
@@ -60,6 +60,14 @@ typedef bool (*cq_invoke_t)(void *udata);
 
 typedef uint64 cq_time_t;		/**< Virtual time for callout queue */
 
+/**
+ * Backend used by a callout queue to store its events.
+ */
+enum cq_backend {
+	CQ_BACKEND_WHEEL = 0,		/**< Hierarchical timing wheel (default) */
+	CQ_BACKEND_HASH				/**< Hashed buckets of sorted events */
+};
+
 enum cq_info_magic { CQ_INFO_MAGIC = 0x12c867d4 };
 
 /**
@@ -99,6 +107,8 @@ void cq_close(void);
 
 cqueue_t *cq_main(void);
 cqueue_t *cq_make(const char *name, cq_time_t now, int period);
+cqueue_t *cq_make_full(const char *name, cq_time_t now, int period,
+	enum cq_backend backend);
 cqueue_t *cq_submake(const char *name, cqueue_t *parent, int period);
 cqueue_t *cq_main_submake(const char *name, int period);
 void cq_free_null(cqueue_t **cq_ptr);
@@ -106,6 +116,7 @@ cevent_t *cq_insert(cqueue_t *cq, int delay, cq_service_t fn, void *arg);
 cevent_t *cq_main_insert(int delay, cq_service_t fn, void *arg);
 cq_time_t cq_remaining(const cevent_t *ev);
 size_t cq_heartbeat(cqueue_t *cq);
+size_t cq_advance(cqueue_t *cq, int elapsed);
 bool cq_expire(cevent_t *ev);
 void cq_zero(cqueue_t *cq, cevent_t **ev_ptr);
 void cq_acknowledge(cqueue_t *cq, cevent_t *ev);
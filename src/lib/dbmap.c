@@ -52,6 +52,7 @@
 #include "map.h"
 #include "misc.h"				/* For english_strerror() */
 #include "pmsg.h"
+#include "pow2.h"				/* For reverse_byte() */
 #include "pslist.h"
 #include "stringify.h"			/* For compact_time() */
 #include "unsigned.h"			/* For size_is_non_negative() */
@@ -501,6 +502,27 @@ dbmap_create_hash(size_t key_size, dbmap_keylen_t key_len,
 dbmap_t *
 dbmap_create_sdbm(size_t ksize, dbmap_keylen_t klen,
 	const char *name, const char *path, int flags, int mode)
+{
+	return dbmap_create_sdbm_paged(ksize, klen, name, path, flags, mode, 0);
+}
+
+/**
+ * Create a DB map implemented as a SDBM database, using the specified
+ * page size if the database is created.
+ *
+ * @param ksize		expected constant key length
+ * @param klen		optional, computes serialized key length
+ * @param name		name of the SDBM database, for logging (may be NULL)
+ * @param path		path of the SDBM database
+ * @param flags		opening flags
+ * @param mode		file permissions
+ * @param pagesize	SDBM page size for new databases (0 = default)
+ *
+ * @return the opened database, or NULL if an error occurred during opening.
+ */
+dbmap_t *
+dbmap_create_sdbm_paged(size_t ksize, dbmap_keylen_t klen,
+	const char *name, const char *path, int flags, int mode, size_t pagesize)
 {
 	dbmap_t *dm;
 
@@ -511,7 +533,7 @@ dbmap_create_sdbm(size_t ksize, dbmap_keylen_t klen,
 	dm->type = DBMAP_SDBM;
 	dm->key_size = ksize;
 	dm->key_len = klen;
-	dm->u.s.sdbm = sdbm_open(path, flags, mode);
+	dm->u.s.sdbm = sdbm_open_paged(path, flags, mode, pagesize);
 
 	if (!dm->u.s.sdbm) {
 		WFREE(dm);
@@ -1151,7 +1173,8 @@ dbmap_foreach(const dbmap_t *dm, dbmap_cb_t cb, void *arg)
 			ctx.dm = dm;
 
 			count = sdbm_foreach(
-				dm->u.s.sdbm, DBM_F_SKIP, dbmap_foreach_sdbm, &ctx);
+				dm->u.s.sdbm, DBM_F_SKIP | DBM_F_NOCACHE,
+				dbmap_foreach_sdbm, &ctx);
 
 			if (!dbmap_sdbm_error_check(dm))
 				dbmap_reset_count(dm, count);
@@ -1198,7 +1221,8 @@ dbmap_foreach_remove(const dbmap_t *dm, dbmap_cbr_t cbr, void *arg)
 			ctx.deleted = 0;
 
 			count = sdbm_foreach_remove(
-				dm->u.s.sdbm, DBM_F_SKIP, dbmap_foreach_remove_sdbm, &ctx);
+				dm->u.s.sdbm, DBM_F_SKIP | DBM_F_NOCACHE,
+				dbmap_foreach_remove_sdbm, &ctx);
 
 			dbmap_sdbm_error_check(dm);
 			dbmap_reset_count(dm, count);
@@ -1256,8 +1280,9 @@ dbmap_store(dbmap_t *dm, const char *base, bool inplace)
 	if (NULL == base)
 		return FALSE;
 
-	ndm = dbmap_create_sdbm(dm->key_size, dm->key_len, NULL, base,
-		O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+	ndm = dbmap_create_sdbm_paged(dm->key_size, dm->key_len, NULL, base,
+		O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR,
+		DBMAP_SDBM == dm->type ? sdbm_pagesize(dm->u.s.sdbm) : 0);
 
 	if (!ndm) {
 		s_warning("SDBM \"%s\": cannot store to %s: %m",
@@ -1439,6 +1464,126 @@ dbmap_set_cachesize(dbmap_t *dm, long pages)
 	return 0;
 }
 
+/**
+ * Set SDBM page cache replacement policy.
+ * @return 0 if OK, -1 on errors with errno set.
+ */
+int
+dbmap_set_cache_policy(dbmap_t *dm, enum sdbm_cache_policy policy)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_set_cache_policy(dm->u.s.sdbm, policy);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
+/**
+ * Fetch SDBM page cache statistics.
+ * @return TRUE if filled, FALSE if the map has no page cache.
+ */
+bool
+dbmap_cache_stats(const dbmap_t *dm, struct sdbm_cache_stats *stats)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return FALSE;
+	case DBMAP_SDBM:
+		return sdbm_cache_stats(dm->u.s.sdbm, stats);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return FALSE;
+}
+
+/**
+ * @return whether SDBM deferred writes are enabled.
+ */
+bool
+dbmap_get_deferred_writes(const dbmap_t *dm)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return FALSE;
+	case DBMAP_SDBM:
+		return sdbm_get_wdelay(dm->u.s.sdbm);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return FALSE;
+}
+
+/**
+ * @return the size of the pages written by the map, 0 if not disk-based.
+ */
+size_t
+dbmap_page_size(const dbmap_t *dm)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_pagesize(dm->u.s.sdbm);
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
+/**
+ * Compute the ordering value of a key for updates batched by page.
+ *
+ * SDBM stores a key in the page given by the low-order bits of its hash,
+ * the amount of bits used depending on how much that page was split.
+ * Reversing the bits of the hash yields values where keys stored in the same
+ * page are adjacent whatever the split depth, so applying updates sorted by
+ * this value touches each page in a single run.
+ *
+ * @return the ordering value, 0 for in-core maps where order is irrelevant.
+ */
+ulong
+dbmap_page_order(const dbmap_t *dm, const void *key)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		{
+			ulong h = sdbm_hash(key, dbmap_keylen(dm, key));
+			ulong r = 0;
+			size_t i;
+
+			for (i = 0; i < sizeof h; i++) {
+				r = (r << 8) | reverse_byte(h & 0xff);
+				h >>= 8;
+			}
+			return r;
+		}
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
 /**
  * Turn SDBM deferred writes on or off.
  * @return 0 if OK, -1 on errors with errno set.
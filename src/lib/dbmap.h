@@ -79,6 +79,8 @@ dbmap_t *dbmap_create_hash(size_t ks, dbmap_keylen_t kl,
 	hash_fn_t hashf, eq_fn_t key_eqf);
 dbmap_t * dbmap_create_sdbm(size_t ks, dbmap_keylen_t kl, const char *name,
 	const char *path, int flags, int mode);
+dbmap_t *dbmap_create_sdbm_paged(size_t ks, dbmap_keylen_t kl,
+	const char *name, const char *path, int flags, int mode, size_t pagesize);
 dbmap_t *dbmap_create_from_map(size_t ks, dbmap_keylen_t kl, map_t *map);
 dbmap_t *dbmap_create_from_sdbm(const char *name,
 	size_t ks, dbmap_keylen_t kl, DBM *sdbm);
@@ -122,7 +124,12 @@ bool dbmap_rebuild(dbmap_t *dm);
 bool dbmap_clear(dbmap_t *dm);
 ssize_t dbmap_sync(dbmap_t *dm);
 int dbmap_set_cachesize(dbmap_t *dm, long pages);
+int dbmap_set_cache_policy(dbmap_t *dm, enum sdbm_cache_policy policy);
+bool dbmap_cache_stats(const dbmap_t *dm, struct sdbm_cache_stats *stats);
 int dbmap_set_deferred_writes(dbmap_t *dm, bool on);
+bool dbmap_get_deferred_writes(const dbmap_t *dm);
+size_t dbmap_page_size(const dbmap_t *dm);
+ulong dbmap_page_order(const dbmap_t *dm, const void *key);
 int dbmap_set_volatile(dbmap_t *dm, bool is_volatile);
 void dbmap_set_debugging(dbmap_t *dm, const struct dbg_config *dbg);
 
@@ -39,6 +39,7 @@
 #include "bstr.h"
 #include "dbmap.h"
 #include "debug.h"
+#include "elist.h"
 #include "hashlist.h"
 #include "map.h"
 #include "misc.h"				/* For english_strerror() */
@@ -46,7 +47,10 @@
 #include "pslist.h"
 #include "stacktrace.h"
 #include "stringify.h"
+#include "tm.h"
+#include "vsort.h"
 #include "walloc.h"
+#include "xmalloc.h"
 #include "zalloc.h"
 
 #include "override.h"			/* Must be the last header included */
@@ -85,8 +89,15 @@ struct dbmw {
 	unsigned ioerr:1;			/**< Had I/O error */
 	unsigned count_needs_sync:1;/**< Whether we need to sync to get count */
 	unsigned is_volatile:1;		/**< Whether database dies when map dies */
+	struct dbmw_sync_stats sync;	/**< Synchronization statistics */
+	link_t lnk;					/**< Links all the DBMW instances */
 };
 
+/**
+ * All the DBMW instances, for monitoring.
+ */
+static elist_t dbmw_instances = ELIST_INIT(offsetof(struct dbmw, lnk));
+
 static inline void
 dbmw_check(const dbmw_t *dw)
 {
@@ -281,6 +292,8 @@ dbmw_create(dbmap_t *dm, const char *name,
 	else
 		dw->max_cached = cache_size;
 
+	elist_append(&dbmw_instances, dw);
+
 	if (common_dbg)
 		s_debug("DBMW created \"%s\" with %s back-end "
 			"(max cached = %zu, key=%zu bytes, value=%zu bytes, "
@@ -688,33 +701,142 @@ cache_free_removable(void *key, void *value, void *data)
 	return TRUE;
 }
 
+/**
+ * A dirty cached entry to flush, tagged with its page ordering value.
+ */
+struct flush_item {
+	ulong order;				/**< Page ordering value of key */
+	const void *key;			/**< The key of the dirty entry */
+	struct cached *entry;		/**< The dirty cached entry */
+};
+
 /**
  * Context for flushes.
  */
 struct flush_context {
 	dbmw_t *dw;
-	ssize_t amount;
-	unsigned error:1;
+	struct flush_item *items;
+	size_t count;
+	size_t capacity;
 	unsigned deleted_only:1;
 };
 
 /**
- * Map iterator to flush dirty cached entries.
+ * Map iterator to collect dirty cached entries.
  */
 static void
-flush_dirty(void *key, void *value, void *data)
+flush_collect(void *key, void *value, void *data)
 {
 	struct flush_context *ctx = data;
 	struct cached *entry = value;
 
 	if (entry->dirty) {
+		struct flush_item *item;
+
 		if (!entry->absent && ctx->deleted_only)
 			return;
-		if (write_back(ctx->dw, key, entry))
-			ctx->amount++;
+
+		g_assert(ctx->count < ctx->capacity);
+
+		item = &ctx->items[ctx->count++];
+		item->order = dbmap_page_order(ctx->dw->dm, key);
+		item->key = key;
+		item->entry = entry;
+	}
+}
+
+/**
+ * vsort() callback to sort flush items by increasing page order.
+ */
+static int
+flush_item_cmp(const void *a, const void *b)
+{
+	const struct flush_item *fa = a, *fb = b;
+
+	return CMP(fa->order, fb->order);
+}
+
+/**
+ * Flush all the dirty cached entries to the DB map layer.
+ *
+ * Entries are written back in page order, with deferred writes enabled on
+ * the underlying map for the duration of the batch, so that each page
+ * touched by the batch is written to disk only once, at the end.
+ *
+ * @param dw			the DBMW wrapper
+ * @param deleted_only	whether to flush only entries pending deletion
+ * @param pages			written with the amount of pages flushed to disk
+ *
+ * @return the amount of values flushed, -1 on error.
+ */
+static ssize_t
+dbmw_flush_batch(dbmw_t *dw, bool deleted_only, size_t *pages)
+{
+	struct flush_context ctx;
+	bool deferred;
+	bool error = FALSE;
+	ssize_t amount = 0;
+	size_t i;
+
+	*pages = 0;
+
+	ctx.capacity = map_count(dw->values);
+	if (0 == ctx.capacity)
+		return 0;
+
+	ctx.dw = dw;
+	ctx.items = xmalloc(ctx.capacity * sizeof ctx.items[0]);
+	ctx.count = 0;
+	ctx.deleted_only = booleanize(deleted_only);
+
+	map_foreach(dw->values, flush_collect, &ctx);
+
+	if (0 == ctx.count)
+		goto done;
+
+	vsort(ctx.items, ctx.count, sizeof ctx.items[0], flush_item_cmp);
+
+	/*
+	 * When the map does not already defer its writes, turn deferred writes
+	 * on whilst we apply the batch, then flush the map to commit all the
+	 * pages we modified: they are each written exactly once.
+	 */
+
+	deferred = dbmap_get_deferred_writes(dw->dm);
+	if (!deferred)
+		dbmap_set_deferred_writes(dw->dm, TRUE);
+
+	for (i = 0; i < ctx.count; i++) {
+		struct flush_item *item = &ctx.items[i];
+
+		if (write_back(dw, item->key, item->entry))
+			amount++;
+		else
+			error = TRUE;
+	}
+
+	if (!deferred) {
+		ssize_t ret = dbmap_sync(dw->dm);
+
+		if (-1 == ret)
+			error = TRUE;
 		else
-			ctx->error = TRUE;
+			*pages = ret;
+
+		dbmap_set_deferred_writes(dw->dm, FALSE);
 	}
+
+	if (dbg_ds_debugging(dw->dbg, 6, DBG_DSF_CACHING)) {
+		dbg_ds_log(dw->dbg, dw, "%s: flushed %zu value%s in page order, "
+			"%zu page%s written",
+			G_STRFUNC, ctx.count, plural(ctx.count), *pages, plural(*pages));
+	}
+
+	/* FALL THROUGH */
+
+done:
+	xfree(ctx.items);
+	return error ? -1 : amount;
 }
 
 /**
@@ -741,26 +863,32 @@ dbmw_sync(dbmw_t *dw, int which)
 	ssize_t amount = 0;
 	size_t pages = 0, values = 0;
 	bool error = FALSE;
+	tm_t start, end;
 
 	dbmw_check(dw);
 
-	if (which & DBMW_SYNC_CACHE) {
-		struct flush_context ctx;
+	tm_now_exact(&start);
 
-		ctx.dw = dw;
-		ctx.error = FALSE;
-		ctx.deleted_only = booleanize(which & DBMW_DELETED_ONLY);
-		ctx.amount = 0;
+	if (which & DBMW_SYNC_CACHE) {
+		bool deleted_only = booleanize(which & DBMW_DELETED_ONLY);
+		size_t written;
+		ssize_t ret;
 
 		if (dbg_ds_debugging(dw->dbg, 6, DBG_DSF_CACHING)) {
 			dbg_ds_log(dw->dbg, dw, "%s: syncing cache%s",
-				G_STRFUNC, ctx.deleted_only ? " (deleted only)" : "");
+				G_STRFUNC, deleted_only ? " (deleted only)" : "");
 		}
 
-		map_foreach(dw->values, flush_dirty, &ctx);
+		ret = dbmw_flush_batch(dw, deleted_only, &written);
 
-		if (!ctx.error && !ctx.deleted_only)
-			dw->count_needs_sync = FALSE;
+		if (-1 == ret) {
+			error = TRUE;
+		} else {
+			if (!deleted_only)
+				dw->count_needs_sync = FALSE;
+			amount += ret;
+			values = ret;
+		}
 
 		/*
 		 * We can safely reset the amount of cached entries to 0, regardless
@@ -770,10 +898,7 @@ dbmw_sync(dbmw_t *dw, int which)
 		 */
 
 		dw->cached = 0;		/* No more dirty values */
-
-		amount += ctx.amount;
-		values = ctx.amount;
-		error = ctx.error;
+		pages += written;
 	}
 	if (which & DBMW_SYNC_MAP) {
 		ssize_t ret;
@@ -786,10 +911,22 @@ dbmw_sync(dbmw_t *dw, int which)
 			error = TRUE;
 		} else {
 			amount += ret;
-			pages = ret;
+			pages += ret;
 		}
 	}
 
+	{
+		struct dbmw_sync_stats *st = &dw->sync;
+
+		tm_now_exact(&end);
+		st->last_us = tm_elapsed_us(&end, &start);
+		st->syncs++;
+		st->values += values;
+		st->pages += pages;
+		st->bytes += (uint64) pages * dbmap_page_size(dw->dm);
+		st->time_us += st->last_us;
+	}
+
 	if (dbg_ds_debugging(dw->dbg, 5, DBG_DSF_CACHING)) {
 		dbg_ds_log(dw->dbg, dw, "%s: %s (flushed %zu value%s, %zu page%s)",
 			G_STRFUNC, error ? "FAILED" : "OK",
@@ -1355,6 +1492,7 @@ dbmw_destroy(dbmw_t *dw, bool close_map)
 	if (close_map)
 		dbmap_destroy(dw->dm);
 
+	elist_remove(&dbmw_instances, dw);
 	WFREE_TYPE_NULL(dw->dbmap_dbg);
 	dw->magic = 0;
 	WFREE(dw);
@@ -1703,6 +1841,46 @@ dbmw_set_map_cache(dbmw_t *dw, long pages)
 	return 0 == dbmap_set_cachesize(dw->dm, pages);
 }
 
+/**
+ * Fetch the page cache statistics of the underlying map.
+ * @return TRUE if filled, FALSE if the map has no page cache.
+ */
+bool
+dbmw_map_cache_stats(const dbmw_t *dw, struct sdbm_cache_stats *stats)
+{
+	dbmw_check(dw);
+
+	return dbmap_cache_stats(dw->dm, stats);
+}
+
+/**
+ * Fill supplied structure with the synchronization statistics of the DBMW.
+ *
+ * @return TRUE if statistics were filled, FALSE if nothing was ever synced.
+ */
+bool
+dbmw_sync_stats(const dbmw_t *dw, struct dbmw_sync_stats *stats)
+{
+	dbmw_check(dw);
+	g_assert(stats != NULL);
+
+	*stats = dw->sync;		/* Struct copy */
+
+	return 0 != dw->sync.syncs;
+}
+
+/**
+ * Iterate over all the existing DBMW instances, in creation order.
+ *
+ * Since DBMW objects are not thread-safe, this must be called from the
+ * thread that manages them, usually the main thread.
+ */
+void
+dbmw_foreach_instance(data_fn_t cb, void *data)
+{
+	elist_foreach(&dbmw_instances, cb, data);
+}
+
 /**
  * Flag whether database is volatile (never outlives a close).
  *
@@ -91,6 +91,18 @@ typedef bool (*dbmw_cbr_t)(void *key, void *value, size_t len, void *u);
 #define DBMW_SYNC_MAP		(1 << 1)	/**< Sync DBMW underlying map */
 #define DBMW_DELETED_ONLY	(1 << 2)	/**< Only sync deleted keys */
 
+/**
+ * Synchronization statistics, as returned by dbmw_sync_stats().
+ */
+struct dbmw_sync_stats {
+	uint64 syncs;				/**< Amount of dbmw_sync() calls */
+	uint64 values;				/**< Amount of dirty values flushed */
+	uint64 pages;				/**< Amount of pages written to disk */
+	uint64 bytes;				/**< Amount of bytes written to disk */
+	uint64 time_us;				/**< Total time spent syncing (usecs) */
+	uint64 last_us;				/**< Duration of last sync (usecs) */
+};
+
 struct dbg_config;
 
 dbmw_t *dbmw_create(dbmap_t *dm, const char *name,
@@ -110,6 +122,8 @@ size_t dbmw_count(dbmw_t *dw);
 bool dbmw_has_ioerr(const dbmw_t *dw);
 const char *dbmw_name(const dbmw_t *dw);
 bool dbmw_set_map_cache(dbmw_t *dw, long pages);
+bool dbmw_map_cache_stats(const dbmw_t *dw, struct sdbm_cache_stats *stats);
+bool dbmw_sync_stats(const dbmw_t *dw, struct dbmw_sync_stats *stats);
 bool dbmw_set_volatile(dbmw_t *dw, bool is_volatile);
 void dbmw_set_debugging(dbmw_t *dw, const struct dbg_config *dbg);
 bool dbmw_shrink(dbmw_t *dw);
@@ -126,6 +140,8 @@ size_t dbmw_foreach_remove(dbmw_t *dw, dbmw_cbr_t cbr, void *arg);
 bool dbmw_store(dbmw_t *dw, const char *base, bool inplace);
 bool dbmw_copy(dbmw_t *from, dbmw_t *to);
 
+void dbmw_foreach_instance(data_fn_t cb, void *data);
+
 #endif /* _dbmw_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
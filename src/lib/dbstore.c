@@ -100,17 +100,21 @@ dbstore_create_internal(const char *name, const char *dir, const char *base,
 		g_assert(base != NULL);
 
 		path = make_pathname(dir, base);
-		dm = dbmap_create_sdbm(kv.key_size, kv.key_len,
-				name, path, flags, STORAGE_FILE_MODE);
+		dm = dbmap_create_sdbm_paged(kv.key_size, kv.key_len,
+				name, path, flags, STORAGE_FILE_MODE, kv.page_size);
 
 		/*
 		 * For performance reasons, always use deferred writes.  Maps which
 		 * are going to persist from session to session are synchronized on
 		 * a regular basis.
+		 *
+		 * The page cache uses the scan-resistant 2Q policy, so that periodic
+		 * traversals of the whole database do not evict the hot pages.
 		 */
 
 		if (dm != NULL) {
 			dbmap_set_deferred_writes(dm, TRUE);
+			dbmap_set_cache_policy(dm, SDBM_CACHE_2Q);
 		} else {
 			s_warning("DBSTORE cannot open SDBM at %s for %s: %m", path, name);
 		}
@@ -443,4 +447,28 @@ dbstore_unlink(const char *dir, const char *base)
 	HFREE_NULL(path);
 }
 
+/**
+ * Check whether SDBM files exist in "dir".
+ *
+ * @param dir				the directory where SDBM files are stored
+ * @param base				the base name of SDBM files
+ *
+ * @return TRUE if the ".pag" file of the database exists.
+ */
+bool
+dbstore_exists(const char *dir, const char *base)
+{
+	char *path, *file;
+	bool exists;
+
+	path = make_pathname(dir, base);
+	file = h_strconcat(path, DBM_PAGFEXT, NULL_PTR);
+	exists = file_exists(file);
+
+	HFREE_NULL(file);
+	HFREE_NULL(path);
+
+	return exists;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
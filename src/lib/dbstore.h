@@ -52,6 +52,7 @@ typedef struct dbstore_kv {
 	dbmap_keylen_t key_len;		/**< Optional, computes serialized key length */
 	size_t value_size;			/**< Maximum value size, (bytes, structure) */
 	size_t value_data_size;		/**< Maximum value size, (bytes, serialized) */
+	size_t page_size;			/**< SDBM page size for new DBs (0 = default) */
 } dbstore_kv_t;
 
 /**
@@ -87,6 +88,7 @@ void dbstore_delete(dbmw_t *dw);
 void dbstore_compact(dbmw_t *dw);
 void dbstore_move(const char *src, const char *dst, const char *base);
 void dbstore_unlink(const char *dir, const char *base);
+bool dbstore_exists(const char *dir, const char *base);
 
 #endif /* _dbstore_h_ */
 
@@ -0,0 +1,461 @@
+/*
+ * qrt_kernel-test -- QRP table kernels tests and benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/pow2.h"
+#include "lib/progname.h"
+#include "lib/qrt_kernel.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_SLOTS_SMALL	(64 * 1024)
+#define TEST_SLOTS_MEDIUM	(128 * 1024)
+#define TEST_SLOTS_LARGE	(1024 * 1024)
+
+#define TEST_EXPAND_MAX		8		/* Largest merge expansion tested */
+#define TEST_CHANGES		64		/* 1 out of that many bytes changes */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-n loops] [-s slots] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of loops for benchmarks\n"
+		"  -s : only test tables with that many slots\n"
+		"  -t : time each kernel, reporting slots/sec\n"
+		"  -R : seed for repeatable random tables\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *impl, const char *what, size_t slots)
+{
+	printf("%6s - %s on %zu slots - FAILED\n", impl, what, slots);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * The tables we work on, all kernels using the same input data.
+ */
+struct tables {
+	size_t slots;			/* Amount of slots in tables */
+	size_t nbytes;			/* Size of compacted tables */
+	uint8 *old;				/* Old compacted table */
+	uint8 *new;				/* New compacted table, close to old one */
+	uint8 *patch;			/* Patch buffer */
+	uint8 *arena;			/* Non-compacted arena, or patched table */
+	uint8 *expected;		/* Expected results */
+};
+
+static void
+tables_fill(struct tables *t, size_t slots)
+{
+	size_t i;
+
+	t->slots = slots;
+	t->nbytes = slots / 8;
+	t->old = xmalloc(t->nbytes);
+	t->new = xmalloc(t->nbytes);
+	t->patch = xmalloc(slots);
+	t->arena = xmalloc(slots * TEST_EXPAND_MAX);
+	t->expected = xmalloc(slots * TEST_EXPAND_MAX);
+
+	/*
+	 * Real tables are sparse: have about 1/4 of slots set, with the
+	 * new table changing a few bytes here and there.
+	 */
+
+	for (i = 0; i < t->nbytes; i++) {
+		t->old[i] = rand31_u32() & rand31_u32();
+		t->new[i] = 0 == rand31_value(TEST_CHANGES) ?
+			rand31_u32() & rand31_u32() : t->old[i];
+	}
+}
+
+static void
+tables_free(struct tables *t)
+{
+	xfree(t->old);
+	xfree(t->new);
+	xfree(t->patch);
+	xfree(t->arena);
+	xfree(t->expected);
+}
+
+/**
+ * Fill patch buffer with random patch values.
+ */
+static void
+patch_fill(struct tables *t, size_t len, bool sparse)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		t->patch[i] = sparse && 0 != rand31_value(TEST_CHANGES) ?
+			0 : rand31_u32();
+	}
+}
+
+/**
+ * Run all the kernels on the tables with the current implementation and
+ * compare the results with the ones computed by the scalar implementation.
+ */
+static void
+check_impl(struct tables *t, enum qrtk_impl which)
+{
+	const char *name = qrtk_impl_name(which);
+	size_t expand, cnt, ecnt, off;
+	bool changed, echanged;
+	uint8 *ebuf = t->expected;
+	int k;
+
+	for (expand = 1; expand <= TEST_EXPAND_MAX; expand *= 2) {
+		size_t len = t->slots * expand;
+
+		memset(ebuf, 2, len);
+		qrtk_use(QRTK_SCALAR);
+		qrtk_merge(ebuf, t->new, t->nbytes, expand);
+
+		memset(t->arena, 2, len);
+		qrtk_use(which);
+		qrtk_merge(t->arena, t->new, t->nbytes, expand);
+
+		if (0 != memcmp(ebuf, t->arena, len))
+			test_abort(name, "merge", t->slots);
+	}
+
+	for (k = 0; k < 4; k++) {
+		const uint8 *old = (k & 0x1) ? t->old : NULL;
+		bool reverse = booleanize(k & 0x2);
+
+		/* Odd sizes and offsets exercise the tail processing */
+		off = rand31_value(31);
+
+		qrtk_use(QRTK_SCALAR);
+		echanged = qrtk_diff1(ebuf, NULL == old ? NULL : old + off,
+			t->new + off, t->nbytes - off, reverse);
+		qrtk_use(which);
+		changed = qrtk_diff1(t->arena, NULL == old ? NULL : old + off,
+			t->new + off, t->nbytes - off, reverse);
+
+		if (changed != echanged || 0 != memcmp(ebuf, t->arena, t->nbytes - off))
+			test_abort(name, reverse ? "reversed diff1" : "diff1", t->slots);
+	}
+
+	for (k = 0; k < 2; k++) {
+		const uint8 *old = k ? t->old : NULL;
+
+		off = rand31_value(31);
+
+		qrtk_use(QRTK_SCALAR);
+		echanged = qrtk_diff4(ebuf, NULL == old ? NULL : old + off,
+			t->new + off, t->nbytes - off);
+		qrtk_use(which);
+		changed = qrtk_diff4(t->arena, NULL == old ? NULL : old + off,
+			t->new + off, t->nbytes - off);
+
+		if (changed != echanged ||
+			0 != memcmp(ebuf, t->arena, (t->nbytes - off) * 4))
+			test_abort(name, "diff4", t->slots);
+	}
+
+	/* Identical tables must not yield any change */
+
+	qrtk_use(which);
+	if (qrtk_diff1(t->arena, t->old, t->old, t->nbytes, FALSE))
+		test_abort(name, "unchanged diff1", t->slots);
+	if (qrtk_diff4(t->arena, t->old, t->old, t->nbytes))
+		test_abort(name, "unchanged diff4", t->slots);
+
+	for (k = 0; k < 2; k++) {
+		size_t len = t->slots - 64;
+
+		patch_fill(t, len, booleanize(k));
+		off = rand31_value(63);
+
+		memcpy(ebuf, t->old, t->nbytes);
+		qrtk_use(QRTK_SCALAR);
+		ecnt = qrtk_patch8(ebuf, off, t->patch, len);
+
+		memcpy(t->arena, t->old, t->nbytes);
+		qrtk_use(which);
+		cnt = qrtk_patch8(t->arena, off, t->patch, len);
+
+		if (cnt != ecnt || 0 != memcmp(ebuf, t->arena, t->nbytes))
+			test_abort(name, "patch8", t->slots);
+
+		len = t->slots / 2 - 64;
+		off = 2 * rand31_value(31);
+
+		memcpy(ebuf, t->old, t->nbytes);
+		qrtk_use(QRTK_SCALAR);
+		ecnt = qrtk_patch4(ebuf, off, t->patch, len);
+
+		memcpy(t->arena, t->old, t->nbytes);
+		qrtk_use(which);
+		cnt = qrtk_patch4(t->arena, off, t->patch, len);
+
+		if (cnt != ecnt || 0 != memcmp(ebuf, t->arena, t->nbytes))
+			test_abort(name, "patch4", t->slots);
+	}
+
+	for (k = 0; k < 2; k++) {
+		bool reverse = booleanize(k);
+		size_t len;
+
+		off = 8 * rand31_value(31);
+		len = t->nbytes - off / 8 - rand31_value(31);
+		patch_fill(t, len, TRUE);
+
+		memcpy(ebuf, t->old, t->nbytes);
+		qrtk_use(QRTK_SCALAR);
+		ecnt = qrtk_patch1(ebuf, off, t->patch, len, reverse);
+
+		memcpy(t->arena, t->old, t->nbytes);
+		qrtk_use(which);
+		cnt = qrtk_patch1(t->arena, off, t->patch, len, reverse);
+
+		if (cnt != ecnt || 0 != memcmp(ebuf, t->arena, t->nbytes))
+			test_abort(name, reverse ? "reversed patch1" : "patch1", t->slots);
+	}
+
+	if (verbose_mode)
+		printf("%6s - %zu slots - OK\n", name, t->slots);
+}
+
+enum bench_kernel {
+	BENCH_MERGE_1,
+	BENCH_MERGE_4,
+	BENCH_DIFF1,
+	BENCH_DIFF1_REVERSED,
+	BENCH_DIFF4,
+	BENCH_PATCH8,
+	BENCH_PATCH4,
+	BENCH_PATCH1,
+
+	BENCH_KERNEL_COUNT
+};
+
+static const char *bench_name[] = {
+	"merge x1",
+	"merge x4",
+	"diff1",
+	"diff1 reversed",
+	"diff4",
+	"patch8",
+	"patch4",
+	"patch1",
+};
+
+/**
+ * Run a kernel ``loops'' times over the tables.
+ */
+static void
+bench_run(struct tables *t, enum bench_kernel what, size_t loops)
+{
+	size_t i;
+
+	for (i = 0; i < loops; i++) {
+		switch (what) {
+		case BENCH_MERGE_1:
+			qrtk_merge(t->arena, t->new, t->nbytes, 1);
+			break;
+		case BENCH_MERGE_4:
+			qrtk_merge(t->arena, t->new, t->nbytes, 4);
+			break;
+		case BENCH_DIFF1:
+			qrtk_diff1(t->arena, t->old, t->new, t->nbytes, FALSE);
+			break;
+		case BENCH_DIFF1_REVERSED:
+			qrtk_diff1(t->arena, t->old, t->new, t->nbytes, TRUE);
+			break;
+		case BENCH_DIFF4:
+			qrtk_diff4(t->arena, t->old, t->new, t->nbytes);
+			break;
+		case BENCH_PATCH8:
+			qrtk_patch8(t->arena, 0, t->patch, t->slots);
+			break;
+		case BENCH_PATCH4:
+			qrtk_patch4(t->arena, 0, t->patch, t->slots / 2);
+			break;
+		case BENCH_PATCH1:
+			qrtk_patch1(t->arena, 0, t->patch, t->nbytes, FALSE);
+			break;
+		case BENCH_KERNEL_COUNT:
+			g_assert_not_reached();
+		}
+	}
+}
+
+/**
+ * Time all the kernels of all the supported implementations.
+ */
+static void
+bench(struct tables *t, size_t loops)
+{
+	enum bench_kernel what;
+	int i;
+
+	patch_fill(t, t->slots, TRUE);
+	memcpy(t->arena, t->old, t->nbytes);
+
+	printf("Timing kernels on %zu slots (%zu loop%s):\n",
+		t->slots, loops, plural(loops));
+
+	for (what = 0; what < BENCH_KERNEL_COUNT; what++) {
+		double scalar = 0.0;
+
+		for (i = 0; i < QRTK_IMPL_COUNT; i++) {
+			tm_t start, end;
+			double elapsed, rate;
+
+			if (!qrtk_use(i))
+				continue;
+
+			bench_run(t, what, 1);		/* Warm up caches */
+
+			tm_now_exact(&start);
+			bench_run(t, what, loops);
+			tm_now_exact(&end);
+
+			elapsed = tm_elapsed_f(&end, &start);
+			rate = elapsed > 0.0 ? t->slots * loops / elapsed : 0.0;
+
+			if (QRTK_SCALAR == i)
+				scalar = rate;
+
+			printf("%14s - %6s - %8.1f Mslots/s", bench_name[what],
+				qrtk_impl_name(i), rate / 1e6);
+			if (QRTK_SCALAR != i && scalar > 0.0)
+				printf(" (x%.2f)", rate / scalar);
+			printf("\n");
+		}
+	}
+	fflush(stdout);
+}
+
+static void
+test(size_t slots, bool chrono, size_t loops)
+{
+	struct tables t;
+	int i;
+
+	tables_fill(&t, slots);
+
+	for (i = 0; i < QRTK_IMPL_COUNT; i++) {
+		if (qrtk_supported(i))
+			check_impl(&t, i);
+		else if (verbose_mode)
+			printf("%6s - not supported by this CPU\n", qrtk_impl_name(i));
+	}
+
+	if (chrono)
+		bench(&t, loops);
+
+	tables_free(&t);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t slots = 0;
+	size_t loops = 100;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hn:s:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 's':			/* table size */
+			slots = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (slots != 0 && (slots < 1024 || !is_pow2(slots))) {
+		fprintf(stderr, "%s: slots must be a power of 2, at least 1024\n",
+			getprogname());
+		exit(EXIT_FAILURE);
+	}
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	if (slots != 0) {
+		test(slots, tflag, loops);
+	} else {
+		test(TEST_SLOTS_SMALL, tflag, loops);
+		test(TEST_SLOTS_MEDIUM, tflag, loops);
+		test(TEST_SLOTS_LARGE, tflag, loops);
+	}
+
+	qrtk_init(TRUE);
+	printf("All OK!\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,1170 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Vectorized kernels for Query Routing Table processing.
+ *
+ * Routing tables are large bit-arrays (up to 2^21 slots) that are repeatedly
+ * merged into the aggregated table sent to ultrapeers, diffed to produce
+ * patches and patched when received from neighbours.  All these operations
+ * are embarrassingly parallel byte-wise, so we provide SIMD versions of them
+ * on the platforms that can run them.
+ *
+ * Bits in a compacted table are numbered in big-endian order within a byte:
+ * slot i is bit (0x80 >> (i & 7)) of byte (i >> 3).
+ *
+ * The implementation is selected once at startup by qrtk_init() depending on
+ * the CPU features detected at runtime, the portable scalar code being used
+ * until then or when no vector unit is available.  All implementations must
+ * produce exactly the same results.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "qrt_kernel.h"
+
+#include "log.h"
+#include "pow2.h"
+
+#include "override.h"			/* Must be the last header included */
+
+/*
+ * We only emit vector code when the compiler is able to target specific
+ * instruction sets on a per-routine basis, so that the whole program does
+ * not need to be compiled with -mavx2 and can still run on older CPUs.
+ *
+ * SSE2 is part of the x86_64 baseline, hence routines without a target
+ * attribute can use it and be inlined in both SSE2 and AVX2 code, the latter
+ * getting VEX-encoded instructions and therefore no transition penalty.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && HAS_GCC(4, 9) && \
+	defined(__x86_64__)
+#define QRTK_X86
+#endif
+
+#ifdef QRTK_X86
+#include <immintrin.h>
+
+#define QRTK_SSE2_FN	__attribute__((target("sse2")))
+#define QRTK_AVX2_FN	__attribute__((target("avx2")))
+#endif	/* QRTK_X86 */
+
+/**
+ * Kernel dispatch table.
+ */
+struct qrtk_ops {
+	const char *name;
+	void (*merge)(uint8 *, const uint8 *, size_t, size_t);
+	bool (*diff1)(uint8 *, const uint8 *, const uint8 *, size_t, bool);
+	bool (*diff4)(uint8 *, const uint8 *, const uint8 *, size_t);
+	size_t (*patch8)(uint8 *, size_t, const uint8 *, size_t);
+	size_t (*patch4)(uint8 *, size_t, const uint8 *, size_t);
+	size_t (*patch1)(uint8 *, size_t, const uint8 *, size_t, bool);
+};
+
+/***
+ *** Portable implementation.
+ ***/
+
+/**
+ * Merge compacted table into a non-compacted arena.
+ *
+ * Each set bit in the compacted table expands into ``expand'' consecutive
+ * arena slots that are cleared (less than "infinity" indicates presence).
+ */
+static void
+qrtk_scalar_merge(uint8 *arena, const uint8 *bits, size_t n, size_t expand)
+{
+	size_t b;
+
+	for (b = 0; b < n; b++) {
+		uint8 entry = bits[b];
+		uint8 *p = &arena[b * 8 * expand];
+		unsigned mask;
+
+		if G_LIKELY(0 == entry)
+			continue;		/* "0 OR x = x", nothing to merge */
+
+		if (1 == expand) {
+			for (mask = 0x80; mask != 0; mask >>= 1, p++) {
+				if (entry & mask)
+					*p = 0;
+			}
+		} else {
+			for (mask = 0x80; mask != 0; mask >>= 1, p += expand) {
+				if (entry & mask)
+					memset(p, 0, expand);
+			}
+		}
+	}
+}
+
+/**
+ * Compute 1-bit patch: the XOR of the two tables, optionally bit-reversed.
+ *
+ * @return TRUE if the two tables differ.
+ */
+static bool
+qrtk_scalar_diff1(uint8 *patch,
+	const uint8 *old, const uint8 *new, size_t n, bool reverse)
+{
+	uint8 acc = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint8 v = (NULL == old ? 0 : old[i]) ^ new[i];
+
+		acc |= v;
+		patch[i] = (reverse && v != 0) ? reverse_byte(v) : v;
+	}
+
+	return 0 != acc;
+}
+
+/**
+ * Compute 4-bit patch between two compacted tables.
+ *
+ *     old bit      new bit      patch
+ *        0            0          0x0     (no change)
+ *        0            1          0xf     (-1, from INFINITY=2 to 1)
+ *        1            0          0x1     (+1, from 1 to INFINITY)
+ *        1            1          0x0     (no change)
+ *
+ * The highest quartet of each patch byte is for the lowest slot.
+ *
+ * @return TRUE if the two tables differ.
+ */
+static bool
+qrtk_scalar_diff4(uint8 *patch, const uint8 *old, const uint8 *new, size_t n)
+{
+	bool changed = FALSE;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint8 obyte = NULL == old ? 0 : old[i];
+		uint8 nbyte = new[i];
+		uint8 *pp = &patch[i * 4];
+		int j;
+
+		if G_LIKELY(obyte == nbyte) {
+			pp[0] = pp[1] = pp[2] = pp[3] = 0;
+			continue;
+		}
+
+		changed = TRUE;
+
+		for (j = 0; j < 4; j++) {
+			uint8 hi = 0x80 >> (2 * j), lo = hi >> 1;
+			uint8 v = 0;
+
+			if ((obyte ^ nbyte) & hi)
+				v |= (obyte & hi) ? 0x10 : 0xf0;
+			if ((obyte ^ nbyte) & lo)
+				v |= (obyte & lo) ? 0x01 : 0x0f;
+
+			pp[j] = v;
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * Patch one slot of a compacted table with a signed 8-bit value.
+ *
+ * A negative value sets the slot, a positive one clears it, zero keeps it.
+ *
+ * @return 1 if slot is set after patching, 0 otherwise.
+ */
+static inline ALWAYS_INLINE size_t
+qrtk_patch_slot(uint8 *arena, size_t i, uint8 v)
+{
+	uint8 b = 0x80U >> (i & 0x7);
+
+	if G_UNLIKELY(v) {
+		if G_LIKELY(v & 0x80) {
+			arena[i >> 3] |= b;
+			return 1;
+		}
+		arena[i >> 3] &= ~b;
+		return 0;
+	}
+
+	return (arena[i >> 3] & b) ? 1 : 0;
+}
+
+/**
+ * Apply 8-bit patch data to a compacted table, starting at ``slot''.
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+static size_t
+qrtk_scalar_patch8(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < len; i++)
+		count += qrtk_patch_slot(arena, slot + i, data[i]);
+
+	return count;
+}
+
+/**
+ * Apply 4-bit patch data to a compacted table, starting at ``slot''.
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+static size_t
+qrtk_scalar_patch4(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < len; i++) {
+		uint8 v = data[i];	/* Highest quartet is for the lowest slot */
+
+		count += qrtk_patch_slot(arena, slot++, v & 0xf0);
+		count += qrtk_patch_slot(arena, slot++, (v << 4) & 0xf0);
+	}
+
+	return count;
+}
+
+/**
+ * Apply 1-bit patch data to a compacted table, starting at ``slot'' which
+ * must be a multiple of 8.  Each set bit flips the corresponding slot.
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+static size_t
+qrtk_scalar_patch1(uint8 *arena, size_t slot,
+	const uint8 *data, size_t len, bool reverse)
+{
+	uint8 *p = &arena[slot >> 3];
+	size_t i, count = 0;
+
+	for (i = 0; i < len; i++) {
+		uint8 v = data[i];
+
+		if (reverse && v != 0)
+			v = reverse_byte(v);
+
+		p[i] ^= v;
+		count += bits_set(p[i]);
+	}
+
+	return count;
+}
+
+static const struct qrtk_ops qrtk_scalar_ops = {
+	"scalar",
+	qrtk_scalar_merge,
+	qrtk_scalar_diff1,
+	qrtk_scalar_diff4,
+	qrtk_scalar_patch8,
+	qrtk_scalar_patch4,
+	qrtk_scalar_patch1,
+};
+
+#ifdef QRTK_X86
+
+/*
+ * Bit selectors, to expand bits into byte masks: byte k of a broadcast value
+ * is compared against the bit for slot (k & 7) in big-endian order.
+ */
+static const uint8 qrtk_bitsel[32] G_ALIGNED(32) = {
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+};
+
+/***
+ *** SSE2 implementation.
+ ***/
+
+/**
+ * Expand 2 bytes (16 slots) into a mask of 16 bytes, 0xff for set slots.
+ */
+static inline ALWAYS_INLINE __m128i
+qrtk_sse2_expand16(uint8 b0, uint8 b1)
+{
+	const __m128i sel = _mm_load_si128((const __m128i *) qrtk_bitsel);
+	__m128i x = _mm_cvtsi32_si128(b0 | (b1 << 8));
+
+	x = _mm_unpacklo_epi8(x, x);		/* b0 b0 b1 b1 */
+	x = _mm_unpacklo_epi16(x, x);		/* b0 x4, b1 x4 */
+	x = _mm_unpacklo_epi32(x, x);		/* b0 x8, b1 x8 */
+
+	return _mm_cmpeq_epi8(_mm_and_si128(x, sel), sel);
+}
+
+/**
+ * Reverse the bits of each byte.
+ */
+static inline QRTK_SSE2_FN __m128i
+qrtk_sse2_reverse(__m128i v)
+{
+	const __m128i m1 = _mm_set1_epi8(0x55);
+	const __m128i m2 = _mm_set1_epi8(0x33);
+	const __m128i m4 = _mm_set1_epi8(0x0f);
+
+	/*
+	 * There is no 8-bit shift, but the masks discard the bits that leak
+	 * across byte boundaries when using 16-bit shifts.
+	 */
+
+	v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m1),
+		_mm_slli_epi16(_mm_and_si128(v, m1), 1));
+	v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m2),
+		_mm_slli_epi16(_mm_and_si128(v, m2), 2));
+	v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m4),
+		_mm_slli_epi16(_mm_and_si128(v, m4), 4));
+
+	return v;
+}
+
+/**
+ * Clear the arena slots corresponding to the 16 set bytes in the mask,
+ * each slot being ``expand'' bytes wide.
+ */
+static QRTK_SSE2_FN void
+qrtk_sse2_clear(uint8 *dst, __m128i m, size_t expand)
+{
+	if (0 == _mm_movemask_epi8(m))
+		return;
+
+	if (1 == expand) {
+		__m128i *p = (__m128i *) dst;
+		_mm_storeu_si128(p, _mm_andnot_si128(m, _mm_loadu_si128(p)));
+	} else {
+		expand /= 2;
+		qrtk_sse2_clear(dst, _mm_unpacklo_epi8(m, m), expand);
+		qrtk_sse2_clear(dst + 16 * expand, _mm_unpackhi_epi8(m, m), expand);
+	}
+}
+
+static QRTK_SSE2_FN void
+qrtk_sse2_merge(uint8 *arena, const uint8 *bits, size_t n, size_t expand)
+{
+	size_t b;
+
+	for (b = 0; b + 2 <= n; b += 2) {
+		if G_LIKELY(0 == (bits[b] | bits[b + 1]))
+			continue;
+
+		qrtk_sse2_clear(&arena[b * 8 * expand],
+			qrtk_sse2_expand16(bits[b], bits[b + 1]), expand);
+	}
+
+	if (b < n)
+		qrtk_scalar_merge(&arena[b * 8 * expand], &bits[b], n - b, expand);
+}
+
+static QRTK_SSE2_FN bool
+qrtk_sse2_diff1(uint8 *patch,
+	const uint8 *old, const uint8 *new, size_t n, bool reverse)
+{
+	__m128i acc = _mm_setzero_si128();
+	bool changed;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &new[i]);
+
+		if (old != NULL)
+			v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *) &old[i]));
+
+		acc = _mm_or_si128(acc, v);
+
+		if (reverse)
+			v = qrtk_sse2_reverse(v);
+
+		_mm_storeu_si128((__m128i *) &patch[i], v);
+	}
+
+	changed =
+		0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()));
+
+	if (i < n) {
+		changed |= qrtk_scalar_diff1(&patch[i],
+			NULL == old ? NULL : &old[i], &new[i], n - i, reverse);
+	}
+
+	return changed;
+}
+
+/**
+ * Compute the 4-bit patch for 2 bytes (16 slots) of the tables, given
+ * the changed bits ``c'' and the new bits ``nb'', emitting 8 patch bytes.
+ *
+ * @return the 8 patch bytes, in the lower half of the vector.
+ */
+static inline ALWAYS_INLINE __m128i
+qrtk_sse2_quartets(uint8 c0, uint8 c1, uint8 n0, uint8 n1)
+{
+	__m128i cm = qrtk_sse2_expand16(c0, c1);
+	__m128i nm = qrtk_sse2_expand16(n0, n1);
+	__m128i s, q;
+
+	/* Slot value is 0x1 when cleared, 0xf when set, 0 when unchanged */
+	s = _mm_and_si128(cm,
+		_mm_or_si128(_mm_set1_epi8(0x01), _mm_and_si128(nm, _mm_set1_epi8(0x0e))));
+
+	/* Pack pairs of slots into bytes, even slot in the highest quartet */
+	q = _mm_or_si128(
+		_mm_and_si128(_mm_slli_epi16(s, 4), _mm_set1_epi16(0x00f0)),
+		_mm_srli_epi16(s, 8));
+
+	return _mm_packus_epi16(q, q);
+}
+
+/**
+ * Compute the 64 patch bytes for 16 changed table bytes.
+ *
+ * @param pp	where the patch bytes are written
+ * @param c		the changed bits (XOR of old and new tables)
+ * @param new	the new table bytes
+ */
+static inline ALWAYS_INLINE void
+qrtk_sse2_diff4_block(uint8 *pp, const uint8 *c, const uint8 *new)
+{
+	size_t k;
+
+	for (k = 0; k < 16; k += 4) {
+		__m128i lo, hi;
+		uint32 w;
+
+		memcpy(&w, &c[k], sizeof w);
+
+		if (0 == w) {
+			_mm_storeu_si128((__m128i *) &pp[k * 4], _mm_setzero_si128());
+			continue;
+		}
+
+		lo = qrtk_sse2_quartets(c[k], c[k + 1], new[k], new[k + 1]);
+		hi = qrtk_sse2_quartets(c[k + 2], c[k + 3], new[k + 2], new[k + 3]);
+
+		_mm_storeu_si128((__m128i *) &pp[k * 4], _mm_unpacklo_epi64(lo, hi));
+	}
+}
+
+static QRTK_SSE2_FN bool
+qrtk_sse2_diff4(uint8 *patch, const uint8 *old, const uint8 *new, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	bool changed = FALSE;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i nv = _mm_loadu_si128((const __m128i *) &new[i]);
+		__m128i ov = NULL == old ?
+			zero : _mm_loadu_si128((const __m128i *) &old[i]);
+		__m128i cv = _mm_xor_si128(nv, ov);
+		uint8 c[16] G_ALIGNED(16);
+
+		if G_LIKELY(0xffff == _mm_movemask_epi8(_mm_cmpeq_epi8(cv, zero))) {
+			__m128i *pp = (__m128i *) &patch[i * 4];
+
+			_mm_storeu_si128(&pp[0], zero);
+			_mm_storeu_si128(&pp[1], zero);
+			_mm_storeu_si128(&pp[2], zero);
+			_mm_storeu_si128(&pp[3], zero);
+			continue;
+		}
+
+		changed = TRUE;
+		_mm_store_si128((__m128i *) c, cv);
+		qrtk_sse2_diff4_block(&patch[i * 4], c, &new[i]);
+	}
+
+	if (i < n) {
+		changed |= qrtk_scalar_diff4(&patch[i * 4],
+			NULL == old ? NULL : &old[i], &new[i], n - i);
+	}
+
+	return changed;
+}
+
+/**
+ * Apply 16 signed 8-bit patch values to the 16 slots starting at arena
+ * byte ``p''.
+ *
+ * @return amount of slots set after patching.
+ */
+static inline QRTK_SSE2_FN size_t
+qrtk_sse2_patch16(uint8 *p, __m128i v)
+{
+	uint neg = _mm_movemask_epi8(v);
+	uint nil = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+	uint clr = ~(neg | nil) & 0xffff;
+
+	/* Bit k of the masks is slot k, which is bit (0x80 >> k) in the arena */
+
+	if G_UNLIKELY(neg | clr) {
+		p[0] = (p[0] | reverse_byte(neg & 0xff)) & ~reverse_byte(clr & 0xff);
+		p[1] = (p[1] | reverse_byte(neg >> 8)) & ~reverse_byte(clr >> 8);
+	}
+
+	return bits_set(p[0]) + bits_set(p[1]);
+}
+
+static QRTK_SSE2_FN size_t
+qrtk_sse2_patch8(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < len && 0 != ((slot + i) & 0x7); i++)
+		count += qrtk_patch_slot(arena, slot + i, data[i]);
+
+	for (/* empty */; i + 16 <= len; i += 16) {
+		count += qrtk_sse2_patch16(&arena[(slot + i) >> 3],
+			_mm_loadu_si128((const __m128i *) &data[i]));
+	}
+
+	for (/* empty */; i < len; i++)
+		count += qrtk_patch_slot(arena, slot + i, data[i]);
+
+	return count;
+}
+
+static QRTK_SSE2_FN size_t
+qrtk_sse2_patch4(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	const __m128i hmask = _mm_set1_epi8(0xf0);
+	size_t i, count = 0;
+
+	for (i = 0; i < len && 0 != (slot & 0x7); i++) {
+		count += qrtk_scalar_patch4(arena, slot, &data[i], 1);
+		slot += 2;
+	}
+
+	for (/* empty */; i + 16 <= len; i += 16, slot += 32) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &data[i]);
+		__m128i h = _mm_and_si128(v, hmask);
+		__m128i l = _mm_and_si128(_mm_slli_epi16(v, 4), hmask);
+		uint8 *p = &arena[slot >> 3];
+
+		/* Interleave quartets: highest one is for the lowest slot */
+
+		count += qrtk_sse2_patch16(&p[0], _mm_unpacklo_epi8(h, l));
+		count += qrtk_sse2_patch16(&p[2], _mm_unpackhi_epi8(h, l));
+	}
+
+	if (i < len)
+		count += qrtk_scalar_patch4(arena, slot, &data[i], len - i);
+
+	return count;
+}
+
+/**
+ * Count the bits set in a 16-byte vector.
+ */
+static inline QRTK_SSE2_FN size_t
+qrtk_sse2_popcount(__m128i v)
+{
+	const __m128i m1 = _mm_set1_epi8(0x55);
+	const __m128i m2 = _mm_set1_epi8(0x33);
+	const __m128i m4 = _mm_set1_epi8(0x0f);
+	__m128i s;
+
+	v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+	v = _mm_add_epi8(_mm_and_si128(v, m2),
+		_mm_and_si128(_mm_srli_epi16(v, 2), m2));
+	v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+	s = _mm_sad_epu8(v, _mm_setzero_si128());
+
+	return _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+}
+
+static QRTK_SSE2_FN size_t
+qrtk_sse2_patch1(uint8 *arena, size_t slot,
+	const uint8 *data, size_t len, bool reverse)
+{
+	uint8 *p = &arena[slot >> 3];
+	size_t i, count = 0;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i *a = (__m128i *) &p[i];
+		__m128i v = _mm_loadu_si128((const __m128i *) &data[i]);
+
+		if (reverse)
+			v = qrtk_sse2_reverse(v);
+
+		v = _mm_xor_si128(v, _mm_loadu_si128(a));
+		_mm_storeu_si128(a, v);
+		count += qrtk_sse2_popcount(v);
+	}
+
+	if (i < len)
+		count += qrtk_scalar_patch1(arena, slot + i * 8, &data[i], len - i, reverse);
+
+	return count;
+}
+
+static const struct qrtk_ops qrtk_sse2_ops = {
+	"SSE2",
+	qrtk_sse2_merge,
+	qrtk_sse2_diff1,
+	qrtk_sse2_diff4,
+	qrtk_sse2_patch8,
+	qrtk_sse2_patch4,
+	qrtk_sse2_patch1,
+};
+
+/***
+ *** AVX2 implementation.
+ ***/
+
+/**
+ * Expand 4 bytes (32 slots) into a mask of 32 bytes, 0xff for set slots.
+ */
+static inline QRTK_AVX2_FN __m256i
+qrtk_avx2_expand32(uint32 w)
+{
+	const __m256i sel = _mm256_load_si256((const __m256i *) qrtk_bitsel);
+	const __m256i shuf = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+		2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	__m256i x = _mm256_shuffle_epi8(_mm256_set1_epi32(w), shuf);
+
+	return _mm256_cmpeq_epi8(_mm256_and_si256(x, sel), sel);
+}
+
+/**
+ * Reverse the bits of each byte, using nibble lookups.
+ */
+static inline QRTK_AVX2_FN __m256i
+qrtk_avx2_reverse(__m256i v)
+{
+	const __m256i rev = _mm256_setr_epi8(
+		0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+		0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+		0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+		0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+	const __m256i m4 = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(rev, _mm256_and_si256(v, m4));
+	__m256i hi = _mm256_shuffle_epi8(rev,
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), m4));
+
+	return _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+}
+
+/**
+ * Count the bits set in a 32-byte vector, using nibble lookups.
+ *
+ * @return vector of four 64-bit partial sums.
+ */
+static inline QRTK_AVX2_FN __m256i
+qrtk_avx2_popcount(__m256i v)
+{
+	const __m256i cnt = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i m4 = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(cnt, _mm256_and_si256(v, m4));
+	__m256i hi = _mm256_shuffle_epi8(cnt,
+		_mm256_and_si256(_mm256_srli_epi16(v, 4), m4));
+
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+static inline QRTK_AVX2_FN size_t
+qrtk_avx2_sum64(__m256i s)
+{
+	__m128i x = _mm_add_epi64(_mm256_castsi256_si128(s),
+		_mm256_extracti128_si256(s, 1));
+
+	return _mm_cvtsi128_si32(x) + _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+}
+
+/**
+ * Clear the arena slots corresponding to the 32 set bytes in the mask,
+ * each slot being ``expand'' bytes wide.
+ */
+static QRTK_AVX2_FN void
+qrtk_avx2_clear(uint8 *dst, __m256i m, size_t expand)
+{
+	if (0 == _mm256_movemask_epi8(m))
+		return;
+
+	if (1 == expand) {
+		__m256i *p = (__m256i *) dst;
+		_mm256_storeu_si256(p, _mm256_andnot_si256(m, _mm256_loadu_si256(p)));
+	} else {
+		/* Unpacking works within each 128-bit lane, hence the permutation */
+		__m256i lo = _mm256_unpacklo_epi8(m, m);
+		__m256i hi = _mm256_unpackhi_epi8(m, m);
+
+		expand /= 2;
+		qrtk_avx2_clear(dst, _mm256_permute2x128_si256(lo, hi, 0x20), expand);
+		qrtk_avx2_clear(dst + 32 * expand,
+			_mm256_permute2x128_si256(lo, hi, 0x31), expand);
+	}
+}
+
+static QRTK_AVX2_FN void
+qrtk_avx2_merge(uint8 *arena, const uint8 *bits, size_t n, size_t expand)
+{
+	size_t b;
+
+	for (b = 0; b + 4 <= n; b += 4) {
+		uint32 w;
+
+		memcpy(&w, &bits[b], sizeof w);		/* Keeps byte order */
+
+		if G_LIKELY(0 == w)
+			continue;
+
+		qrtk_avx2_clear(&arena[b * 8 * expand], qrtk_avx2_expand32(w), expand);
+	}
+
+	if (b < n)
+		qrtk_scalar_merge(&arena[b * 8 * expand], &bits[b], n - b, expand);
+}
+
+static QRTK_AVX2_FN bool
+qrtk_avx2_diff1(uint8 *patch,
+	const uint8 *old, const uint8 *new, size_t n, bool reverse)
+{
+	__m256i acc = _mm256_setzero_si256();
+	bool changed;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &new[i]);
+
+		if (old != NULL) {
+			v = _mm256_xor_si256(v,
+				_mm256_loadu_si256((const __m256i *) &old[i]));
+		}
+
+		acc = _mm256_or_si256(acc, v);
+
+		if (reverse)
+			v = qrtk_avx2_reverse(v);
+
+		_mm256_storeu_si256((__m256i *) &patch[i], v);
+	}
+
+	changed = !_mm256_testz_si256(acc, acc);
+
+	if (i < n) {
+		changed |= qrtk_scalar_diff1(&patch[i],
+			NULL == old ? NULL : &old[i], &new[i], n - i, reverse);
+	}
+
+	return changed;
+}
+
+static QRTK_AVX2_FN bool
+qrtk_avx2_diff4(uint8 *patch, const uint8 *old, const uint8 *new, size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	bool changed = FALSE;
+	size_t i;
+
+	/*
+	 * Tables are mostly identical between two updates, so we quickly
+	 * skip over 32 unchanged bytes at a time, using 128-bit operations
+	 * to generate the quartets for the areas that changed.
+	 */
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i nv = _mm256_loadu_si256((const __m256i *) &new[i]);
+		__m256i cv = NULL == old ? nv :
+			_mm256_xor_si256(nv, _mm256_loadu_si256((const __m256i *) &old[i]));
+		uint8 c[32] G_ALIGNED(32);
+
+		if G_LIKELY(_mm256_testz_si256(cv, cv)) {
+			__m256i *pp = (__m256i *) &patch[i * 4];
+
+			_mm256_storeu_si256(&pp[0], zero);
+			_mm256_storeu_si256(&pp[1], zero);
+			_mm256_storeu_si256(&pp[2], zero);
+			_mm256_storeu_si256(&pp[3], zero);
+			continue;
+		}
+
+		changed = TRUE;
+		_mm256_store_si256((__m256i *) c, cv);
+		qrtk_sse2_diff4_block(&patch[i * 4], &c[0], &new[i]);
+		qrtk_sse2_diff4_block(&patch[i * 4 + 64], &c[16], &new[i + 16]);
+	}
+
+	if (i < n) {
+		changed |= qrtk_scalar_diff4(&patch[i * 4],
+			NULL == old ? NULL : &old[i], &new[i], n - i);
+	}
+
+	return changed;
+}
+
+/**
+ * Apply 32 signed 8-bit patch values to the 32 slots starting at arena
+ * byte ``p''.
+ *
+ * @return amount of slots set after patching.
+ */
+static inline QRTK_AVX2_FN size_t
+qrtk_avx2_patch32(uint8 *p, __m256i v)
+{
+	uint32 neg = _mm256_movemask_epi8(v);
+	uint32 nil = _mm256_movemask_epi8(
+		_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+	uint32 clr = ~(neg | nil);
+	uint32 w;
+	int k;
+
+	if G_UNLIKELY(neg | clr) {
+		for (k = 0; k < 4; k++, neg >>= 8, clr >>= 8) {
+			p[k] = (p[k] | reverse_byte(neg & 0xff)) &
+				~reverse_byte(clr & 0xff);
+		}
+	}
+
+	memcpy(&w, p, sizeof w);
+	return popcount(w);
+}
+
+static QRTK_AVX2_FN size_t
+qrtk_avx2_patch8(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < len && 0 != ((slot + i) & 0x7); i++)
+		count += qrtk_patch_slot(arena, slot + i, data[i]);
+
+	for (/* empty */; i + 32 <= len; i += 32) {
+		count += qrtk_avx2_patch32(&arena[(slot + i) >> 3],
+			_mm256_loadu_si256((const __m256i *) &data[i]));
+	}
+
+	for (/* empty */; i < len; i++)
+		count += qrtk_patch_slot(arena, slot + i, data[i]);
+
+	return count;
+}
+
+static QRTK_AVX2_FN size_t
+qrtk_avx2_patch4(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	const __m256i hmask = _mm256_set1_epi8(0xf0);
+	size_t i, count = 0;
+
+	for (i = 0; i < len && 0 != (slot & 0x7); i++) {
+		count += qrtk_scalar_patch4(arena, slot, &data[i], 1);
+		slot += 2;
+	}
+
+	for (/* empty */; i + 32 <= len; i += 32, slot += 64) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &data[i]);
+		__m256i h = _mm256_and_si256(v, hmask);
+		__m256i l = _mm256_and_si256(_mm256_slli_epi16(v, 4), hmask);
+		__m256i lo = _mm256_unpacklo_epi8(h, l);
+		__m256i hi = _mm256_unpackhi_epi8(h, l);
+		uint8 *p = &arena[slot >> 3];
+
+		count += qrtk_avx2_patch32(&p[0],
+			_mm256_permute2x128_si256(lo, hi, 0x20));
+		count += qrtk_avx2_patch32(&p[4],
+			_mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	if (i < len)
+		count += qrtk_scalar_patch4(arena, slot, &data[i], len - i);
+
+	return count;
+}
+
+static QRTK_AVX2_FN size_t
+qrtk_avx2_patch1(uint8 *arena, size_t slot,
+	const uint8 *data, size_t len, bool reverse)
+{
+	uint8 *p = &arena[slot >> 3];
+	__m256i sum = _mm256_setzero_si256();
+	size_t i, count;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i *a = (__m256i *) &p[i];
+		__m256i v = _mm256_loadu_si256((const __m256i *) &data[i]);
+
+		if (reverse)
+			v = qrtk_avx2_reverse(v);
+
+		v = _mm256_xor_si256(v, _mm256_loadu_si256(a));
+		_mm256_storeu_si256(a, v);
+		sum = _mm256_add_epi64(sum, qrtk_avx2_popcount(v));
+	}
+
+	count = qrtk_avx2_sum64(sum);
+
+	if (i < len)
+		count += qrtk_scalar_patch1(arena, slot + i * 8, &data[i], len - i, reverse);
+
+	return count;
+}
+
+static const struct qrtk_ops qrtk_avx2_ops = {
+	"AVX2",
+	qrtk_avx2_merge,
+	qrtk_avx2_diff1,
+	qrtk_avx2_diff4,
+	qrtk_avx2_patch8,
+	qrtk_avx2_patch4,
+	qrtk_avx2_patch1,
+};
+
+#endif	/* QRTK_X86 */
+
+/***
+ *** Dispatching.
+ ***/
+
+static const struct qrtk_ops *qrtk_impl[QRTK_IMPL_COUNT] = {
+	&qrtk_scalar_ops,
+#ifdef QRTK_X86
+	&qrtk_sse2_ops,
+	&qrtk_avx2_ops,
+#endif
+};
+
+static const struct qrtk_ops *qrtk_ops = &qrtk_scalar_ops;
+
+/**
+ * @return TRUE if the CPU we are running on supports the implementation.
+ */
+bool
+qrtk_supported(enum qrtk_impl which)
+{
+	g_assert(UNSIGNED(which) < QRTK_IMPL_COUNT);
+
+	if (NULL == qrtk_impl[which])
+		return FALSE;
+
+#ifdef QRTK_X86
+	{
+		static bool inited;
+
+		if G_UNLIKELY(!inited) {
+			__builtin_cpu_init();
+			inited = TRUE;
+		}
+	}
+
+	switch (which) {
+	case QRTK_SCALAR:		return TRUE;
+	case QRTK_SSE2:			return __builtin_cpu_supports("sse2");
+	case QRTK_AVX2:			return __builtin_cpu_supports("avx2");
+	case QRTK_IMPL_COUNT:	break;
+	}
+
+	g_assert_not_reached();
+#else
+	return QRTK_SCALAR == which;
+#endif	/* QRTK_X86 */
+}
+
+/**
+ * @return the name of the implementation.
+ */
+const char *
+qrtk_impl_name(enum qrtk_impl which)
+{
+	g_assert(UNSIGNED(which) < QRTK_IMPL_COUNT);
+
+	switch (which) {
+	case QRTK_SCALAR:		return "scalar";
+	case QRTK_SSE2:			return "SSE2";
+	case QRTK_AVX2:			return "AVX2";
+	case QRTK_IMPL_COUNT:	break;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Force usage of specified implementation.
+ *
+ * @return TRUE if OK, FALSE if the implementation is not supported, in which
+ * case the current implementation is left unchanged.
+ */
+bool
+qrtk_use(enum qrtk_impl which)
+{
+	if (!qrtk_supported(which))
+		return FALSE;
+
+	qrtk_ops = qrtk_impl[which];
+	return TRUE;
+}
+
+/**
+ * @return the implementation currently in use.
+ */
+enum qrtk_impl
+qrtk_current(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(qrtk_impl); i++) {
+		if (qrtk_impl[i] == qrtk_ops)
+			return i;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Select the fastest implementation supported by the running CPU.
+ *
+ * This should be called once at startup, before threads are created.
+ */
+void
+qrtk_init(int verbose)
+{
+	int i;
+
+	for (i = QRTK_IMPL_COUNT - 1; i >= 0; i--) {
+		if (qrtk_use(i))
+			break;
+	}
+
+	if (verbose)
+		s_info("using %s kernels for QRP tables", qrtk_ops->name);
+}
+
+/**
+ * Merge compacted table bits into a non-compacted arena.
+ *
+ * Each set bit expands into ``expand'' consecutive arena bytes that are
+ * cleared, a value less than "infinity" indicating presence.
+ *
+ * @param arena		the non-compacted arena (nbytes * 8 * expand bytes)
+ * @param bits		the compacted table
+ * @param nbytes	size of the compacted table, in bytes
+ * @param expand	amount of arena slots per table slot, a power of 2
+ */
+void
+qrtk_merge(uint8 *arena, const uint8 *bits, size_t nbytes, size_t expand)
+{
+	g_assert(is_pow2(expand));
+
+	(*qrtk_ops->merge)(arena, bits, nbytes, expand);
+}
+
+/**
+ * Compute 1-bit patch between two compacted tables: each set bit indicates
+ * a slot that needs to be flipped.
+ *
+ * @param patch		where patch is written (nbytes bytes)
+ * @param old		the old table, NULL meaning an empty table
+ * @param new		the new table
+ * @param nbytes	size of the tables, in bytes
+ * @param reverse	whether bits must be reversed within each patch byte
+ *
+ * @return TRUE if the tables differ.
+ */
+bool
+qrtk_diff1(uint8 *patch,
+	const uint8 *old, const uint8 *new, size_t nbytes, bool reverse)
+{
+	return (*qrtk_ops->diff1)(patch, old, new, nbytes, reverse);
+}
+
+/**
+ * Compute 4-bit patch between two compacted tables, made of signed quartets.
+ *
+ * @param patch		where patch is written (nbytes * 4 bytes)
+ * @param old		the old table, NULL meaning an empty table
+ * @param new		the new table
+ * @param nbytes	size of the tables, in bytes
+ *
+ * @return TRUE if the tables differ.
+ */
+bool
+qrtk_diff4(uint8 *patch, const uint8 *old, const uint8 *new, size_t nbytes)
+{
+	return (*qrtk_ops->diff4)(patch, old, new, nbytes);
+}
+
+/**
+ * Apply 8-bit patch to compacted table.
+ *
+ * @param arena		the compacted table
+ * @param slot		first slot to patch
+ * @param data		patch data, one signed byte per slot
+ * @param len		amount of patch bytes
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+size_t
+qrtk_patch8(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	return (*qrtk_ops->patch8)(arena, slot, data, len);
+}
+
+/**
+ * Apply 4-bit patch to compacted table.
+ *
+ * @param arena		the compacted table
+ * @param slot		first slot to patch, which must be even
+ * @param data		patch data, two signed quartets per byte
+ * @param len		amount of patch bytes
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+size_t
+qrtk_patch4(uint8 *arena, size_t slot, const uint8 *data, size_t len)
+{
+	g_assert(0 == (slot & 0x1));
+
+	return (*qrtk_ops->patch4)(arena, slot, data, len);
+}
+
+/**
+ * Apply 1-bit patch to compacted table.
+ *
+ * @param arena		the compacted table
+ * @param slot		first slot to patch, which must be a multiple of 8
+ * @param data		patch data, one flip bit per slot
+ * @param len		amount of patch bytes
+ * @param reverse	whether bits are numbered in little-endian order
+ *
+ * @return amount of patched slots that are set after patching.
+ */
+size_t
+qrtk_patch1(uint8 *arena, size_t slot,
+	const uint8 *data, size_t len, bool reverse)
+{
+	g_assert(0 == (slot & 0x7));
+
+	return (*qrtk_ops->patch1)(arena, slot, data, len, reverse);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
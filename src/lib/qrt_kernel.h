@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Vectorized kernels for Query Routing Table processing.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _qrt_kernel_h_
+#define _qrt_kernel_h_
+
+/**
+ * Available kernel implementations, from the slowest to the fastest.
+ */
+enum qrtk_impl {
+	QRTK_SCALAR = 0,		/**< Portable C code, always available */
+	QRTK_SSE2,				/**< x86 SSE2 instructions */
+	QRTK_AVX2,				/**< x86 AVX2 instructions */
+
+	QRTK_IMPL_COUNT
+};
+
+/*
+ * Public interface.
+ */
+
+void qrtk_init(int verbose);
+bool qrtk_supported(enum qrtk_impl which);
+bool qrtk_use(enum qrtk_impl which);
+enum qrtk_impl qrtk_current(void);
+const char *qrtk_impl_name(enum qrtk_impl which);
+
+void qrtk_merge(uint8 *arena, const uint8 *bits, size_t nbytes, size_t expand);
+bool qrtk_diff1(uint8 *patch,
+	const uint8 *old, const uint8 *new, size_t nbytes, bool reverse);
+bool qrtk_diff4(uint8 *patch, const uint8 *old, const uint8 *new, size_t nbytes);
+size_t qrtk_patch8(uint8 *arena, size_t slot, const uint8 *data, size_t len);
+size_t qrtk_patch4(uint8 *arena, size_t slot, const uint8 *data, size_t len);
+size_t qrtk_patch1(uint8 *arena, size_t slot,
+	const uint8 *data, size_t len, bool reverse);
+
+#endif /* _qrt_kernel_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
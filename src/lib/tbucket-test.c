@@ -0,0 +1,412 @@
+/*
+ * tbucket-test -- token bucket stress test.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/barrier.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tbucket.h"
+#include "lib/thread.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_SOURCES	256			/* Default amount of competing sources */
+#define TEST_THREADS	4			/* Default amount of draining threads */
+#define TEST_PERIODS	100			/* Default amount of periods */
+#define TEST_TOKENS		(1 << 20)	/* Tokens per period */
+#define TEST_BATCH		4096		/* Batch size */
+#define TEST_REQUEST	16384		/* Maximum request size */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-b batch] [-n sources] [-p periods] [-R seed]\n"
+		"       [-T threads]\n"
+		"  -b : amount of tokens taken at once by each thread\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of competing sources\n"
+		"  -p : amount of periods to run\n"
+		"  -R : seed for repeatable random tests\n"
+		"  -T : amount of threads draining the bucket (0 = main thread)\n"
+		"  -V : verbose mode -- print statistics for each period\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what)
+{
+	printf("%s - FAILED\n", what);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+#define test_assert(what, cond) G_STMT_START {	\
+	if G_UNLIKELY(!(cond))						\
+		test_abort(what);						\
+} G_STMT_END
+
+/**
+ * A source competing for the bucket, like a bandwidth-limited I/O source.
+ */
+struct source {
+	tbucket_share_t share;		/* The share of the source */
+	uint64 total;				/* Total tokens consumed */
+};
+
+/**
+ * A thread draining the bucket on behalf of a set of sources.
+ */
+struct worker {
+	uint id;					/* Worker number */
+	uint32 seed;				/* Private random state */
+	int thread;					/* Thread ID, -1 if main thread */
+};
+
+static struct {
+	tbucket_t *tb;
+	struct source *sources;
+	struct worker *workers;
+	barrier_t *start;			/* Beginning of period */
+	barrier_t *end;				/* End of period */
+	uint nsources;
+	uint nworkers;				/* Amount of workers, 1 if no threads */
+	size_t batch;				/* Batch size */
+	bool threaded;				/* Whether workers run in threads */
+	bool exiting;				/* Workers must exit */
+} tt;
+
+/**
+ * Thread-private random number in [0, max].
+ */
+static uint32
+worker_random(struct worker *w, uint32 max)
+{
+	/* Marsaglia's xorshift32 */
+	w->seed ^= w->seed << 13;
+	w->seed ^= w->seed >> 17;
+	w->seed ^= w->seed << 5;
+
+	return w->seed % (max + 1);
+}
+
+/**
+ * Drain the bucket on behalf of the sources handled by the worker, until
+ * no more tokens are granted to any of them.
+ *
+ * Sources are handled in turn, each one requesting a random amount of
+ * tokens and sometimes using less than what was granted, as when the
+ * kernel does not accept all the data we write.
+ */
+static void
+worker_drain(struct worker *w)
+{
+	bool granted;
+	uint n, first;
+
+	/*
+	 * Like the bandwidth scheduler, which does not always service its
+	 * sources in the same order, start each pass at a random source.
+	 */
+
+	n = (tt.nsources - w->id + tt.nworkers - 1) / tt.nworkers;
+
+	do {
+		uint i;
+
+		granted = FALSE;
+		first = worker_random(w, n - 1);
+
+		for (i = 0; i < n; i++) {
+			uint j = w->id + ((first + i) % n) * tt.nworkers;
+			struct source *s = &tt.sources[j];
+			size_t len = 1 + worker_random(w, TEST_REQUEST - 1);
+			size_t got, used;
+
+			got = tbucket_grant(tt.tb, &s->share, len);
+
+			if (0 == got)
+				continue;
+
+			test_assert("grant size", got <= len);
+
+			used = (0 == worker_random(w, 7)) ?
+				got - worker_random(w, got) : got;
+
+			tbucket_settle(tt.tb, &s->share, used, got);
+			granted = TRUE;
+		}
+	} while (granted);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+
+	for (;;) {
+		barrier_wait(tt.start);
+		if (tt.exiting)
+			break;
+		worker_drain(w);
+		barrier_wait(tt.end);
+	}
+
+	return NULL;
+}
+
+/**
+ * Run one period, checking the consumed tokens against the refill.
+ *
+ * @param n			period number
+ * @param share_max	maximum amount of tokens per source, 0 if unlimited
+ */
+static void
+test_period(uint n, int64 share_max)
+{
+	int64 consumed, shares = 0, min = MAX_INT_VAL(int64), max = 0;
+	int64 slack;
+	uint i;
+
+	tbucket_refill(tt.tb, TEST_TOKENS);
+
+	if (tt.threaded) {
+		barrier_wait(tt.start);
+		barrier_wait(tt.end);
+	} else {
+		worker_drain(&tt.workers[0]);
+	}
+
+	/*
+	 * Since the periods do not overlap, there cannot be any overshooting:
+	 * we cannot consume more than what was put in the bucket.
+	 *
+	 * Tokens left in each thread cache are lost at the end of the period,
+	 * so we may consume less, but no more than the batch size plus the
+	 * largest request for each thread.
+	 */
+
+	consumed = tbucket_consumed(tt.tb);
+	slack = (int64) tt.nworkers * (tt.batch + TEST_REQUEST);
+
+	test_assert("overshoot", consumed <= TEST_TOKENS);
+	test_assert("undershoot", consumed + slack >= TEST_TOKENS);
+
+	for (i = 0; i < tt.nsources; i++) {
+		struct source *s = &tt.sources[i];
+		int64 used = tbucket_share_consumed(&s->share);
+
+		s->total += used;
+		shares += used;
+		min = MIN(min, used);
+		max = MAX(max, used);
+
+		if (share_max != 0)
+			test_assert("fair share", used <= share_max);
+	}
+
+	test_assert("accounting", shares == consumed);
+
+	if (verbose_mode) {
+		printf("period #%u: consumed %s/%u, per source min=%s, max=%s\n",
+			n, int64_to_string(consumed), TEST_TOKENS,
+			int64_to_string2(min), int64_to_string3(max));
+	}
+}
+
+/**
+ * Compute Jain's fairness index of the total tokens consumed by the sources.
+ *
+ * It is 1 when all the sources got the same amount, and 1/n when a single
+ * source got all the tokens.
+ */
+static double
+test_fairness(void)
+{
+	double sum = 0.0, sum2 = 0.0;
+	uint i;
+
+	for (i = 0; i < tt.nsources; i++) {
+		double x = tt.sources[i].total;
+
+		sum += x;
+		sum2 += x * x;
+	}
+
+	return 0.0 == sum2 ? 1.0 : (sum * sum) / (tt.nsources * sum2);
+}
+
+static void
+test_bucket(uint nsources, uint nthreads, uint periods, size_t batch)
+{
+	uint i;
+	int64 share_max;
+	double fairness;
+	tm_t start, end;
+
+	ZERO(&tt);
+	tt.nsources = nsources;
+	tt.threaded = nthreads != 0;
+	tt.nworkers = MAX(nthreads, 1);
+	tt.batch = batch;
+	tt.tb = tbucket_make(batch);
+
+	XMALLOC0_ARRAY(tt.sources, tt.nsources);
+	XMALLOC0_ARRAY(tt.workers, tt.nworkers);
+
+	for (i = 0; i < tt.nworkers; i++) {
+		struct worker *w = &tt.workers[i];
+
+		w->id = i;
+		w->seed = rand31_u32() | 1;
+		w->thread = -1;
+	}
+
+	if (tt.threaded) {
+		tt.start = barrier_new(tt.nworkers + 1);
+		tt.end = barrier_new(tt.nworkers + 1);
+
+		for (i = 0; i < tt.nworkers; i++) {
+			struct worker *w = &tt.workers[i];
+
+			w->thread = thread_create(worker_main, w, 0, THREAD_STACK_MIN);
+			if (-1 == w->thread)
+				s_error("cannot create thread #%u: %m", i);
+		}
+	}
+
+	/*
+	 * The first period has no fairness limit since no source was active
+	 * during the previous one.  Afterwards, each source can get at most
+	 * twice its fair share.
+	 */
+
+	tm_now_exact(&start);
+
+	for (i = 0; i < periods; i++) {
+		share_max = 0 == i ? 0 :
+			2 * MAX(TEST_TOKENS / tt.nsources, (int64) batch);
+		test_period(i, share_max);
+	}
+
+	tm_now_exact(&end);
+
+	fairness = test_fairness();
+
+	printf("%u source%s, %u thread%s, %u period%s: fairness index %.4f, "
+		"%.1f ns/token\n",
+		PLURAL(tt.nsources), PLURAL(nthreads), PLURAL(periods), fairness,
+		tm_elapsed_f(&end, &start) * 1e9 / ((double) periods * TEST_TOKENS));
+
+	test_assert("fairness", fairness >= 0.9);
+
+	if (tt.threaded) {
+		tt.exiting = TRUE;
+		barrier_wait(tt.start);
+
+		for (i = 0; i < tt.nworkers; i++)
+			thread_join(tt.workers[i].thread, NULL);
+
+		barrier_free_null(&tt.start);
+		barrier_free_null(&tt.end);
+	}
+
+	tbucket_free_null(&tt.tb);
+	XFREE_NULL(tt.sources);
+	XFREE_NULL(tt.workers);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	uint sources = TEST_SOURCES;
+	uint threads = TEST_THREADS;
+	uint periods = TEST_PERIODS;
+	size_t batch = TEST_BATCH;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "b:hn:p:R:T:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* batch size */
+			batch = atol(optarg);
+			break;
+		case 'n':			/* amount of sources */
+			sources = atoi(optarg);
+			break;
+		case 'p':			/* amount of periods */
+			periods = atoi(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'T':			/* amount of threads */
+			threads = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == sources || 0 == periods || threads > THREAD_MAX - 1)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	test_bucket(sources, threads, periods, batch);
+
+	printf("All OK!\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
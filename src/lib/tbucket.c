@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock-free token bucket.
+ *
+ * A token bucket is refilled at the beginning of each period by its owner,
+ * and concurrently drained by consumers running in any thread.  Tokens are
+ * taken from the shared bucket with atomic operations only, by batches,
+ * and cached locally by each thread: most grants are therefore served from
+ * the thread's cache without touching the shared counter.
+ *
+ * The tokens left in the bucket or in the thread caches at the end of the
+ * period are lost: nothing is carried over to the next period, and the
+ * amount actually consumed is collected separately by the owner.
+ *
+ * To prevent a few fast consumers from draining the bucket before the
+ * others had a chance to run, each consumer cannot be granted more than
+ * its fair share during a period, the share being computed from the amount
+ * of consumers that were active during the previous period.  Once all these
+ * consumers have requested tokens, the ones coming back can get up to twice
+ * their fair share, so that tokens unused by the others are not lost.
+ *
+ * Overshooting is bounded: a grant never exceeds the tokens taken from the
+ * bucket, but tokens given back to the bucket by a thread racing with the
+ * refill are credited to the new period, which is at most one batch per
+ * thread.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "tbucket.h"
+
+#include "atomic.h"
+#include "thread.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define TBUCKET_BATCH_MIN	512		/**< Minimum batch size */
+
+enum tbucket_magic { TBUCKET_MAGIC = 0x52f1a6d9 };
+
+/**
+ * Tokens cached by a thread.
+ */
+struct tbucket_cache {
+	uint gen;				/**< Period of the cached tokens */
+	long tokens;			/**< Amount of cached tokens */
+};
+
+/**
+ * The token bucket.
+ *
+ * The shared counters are only updated with atomic operations.  Each cache
+ * is only accessed by the thread whose small ID indexes it.
+ */
+struct tbucket {
+	enum tbucket_magic magic;
+	uint gen;				/**< Current period, bumped at each refill */
+	uint active;			/**< Consumers having requested tokens */
+	uint last_active;		/**< Active consumers during last period */
+	long tokens;			/**< Tokens left, transiently negative */
+	long consumed;			/**< Tokens consumed since last collected */
+	long share_max;			/**< Fair share per consumer and period */
+	long batch;				/**< Amount of tokens taken at once */
+	struct tbucket_cache cache[THREAD_MAX];
+};
+
+static inline void
+tbucket_check(const struct tbucket * const tb)
+{
+	g_assert(tb != NULL);
+	g_assert(TBUCKET_MAGIC == tb->magic);
+}
+
+/**
+ * Allocate a new token bucket, initially empty.
+ *
+ * @param batch		amount of tokens moved at once to the thread caches
+ *
+ * @return a new token bucket.
+ */
+tbucket_t *
+tbucket_make(size_t batch)
+{
+	tbucket_t *tb;
+
+	WALLOC0(tb);
+	tb->magic = TBUCKET_MAGIC;
+	tb->batch = MAX(batch, TBUCKET_BATCH_MIN);
+	tb->batch = MIN(UNSIGNED(tb->batch), MAX_INT_VAL(long) / 4);
+
+	return tb;
+}
+
+/**
+ * Free token bucket and nullify its pointer.
+ *
+ * The bucket must no longer be accessed by any thread.
+ */
+void
+tbucket_free_null(tbucket_t **tb_ptr)
+{
+	tbucket_t *tb = *tb_ptr;
+
+	if (tb != NULL) {
+		tbucket_check(tb);
+		tb->magic = 0;
+		WFREE(tb);
+		*tb_ptr = NULL;
+	}
+}
+
+/**
+ * Start a new period with the specified amount of tokens.
+ *
+ * Tokens left from the previous period are discarded.  This must only be
+ * called by the owner of the bucket, one thread at a time.
+ */
+void
+tbucket_refill(tbucket_t *tb, int64 tokens)
+{
+	uint active;
+	long amount;
+
+	tbucket_check(tb);
+
+	amount = MIN(MAX(tokens, 0), MAX_INT_VAL(long) / 4);
+
+	/*
+	 * Grab the amount of active consumers during the period that ends,
+	 * without losing the ones racing with us: they will be accounted for
+	 * in the new period.
+	 */
+
+	active = atomic_uint_get(&tb->active);
+	ATOMIC_SUB(&tb->active, active);
+
+	/*
+	 * A single active consumer, or none, can use all the tokens.
+	 */
+
+	if (active <= 1) {
+		ATOMIC_SET(&tb->share_max, 0);
+	} else {
+		ATOMIC_SET(&tb->share_max, MAX(amount / active, tb->batch));
+	}
+
+	atomic_uint_set(&tb->last_active, active);
+
+	ATOMIC_SET(&tb->tokens, amount);
+	atomic_uint_inc(&tb->gen);
+}
+
+/**
+ * Atomically substract `n' tokens from the shared bucket.
+ *
+ * @return the amount of tokens before the substraction.
+ */
+static inline long
+tbucket_fetch_sub(tbucket_t *tb, long n)
+{
+#ifdef HAS_SYNC_ATOMIC
+	return ATOMIC_SUB(&tb->tokens, n);
+#else
+	long before = tb->tokens;
+	tb->tokens -= n;
+	return before;
+#endif
+}
+
+/**
+ * Take tokens from the shared bucket.
+ *
+ * @return the amount of tokens taken, at most `n'.
+ */
+static long
+tbucket_take(tbucket_t *tb, long n)
+{
+	long before, got;
+
+	before = tbucket_fetch_sub(tb, n);
+
+	if G_LIKELY(before >= n)
+		return n;
+
+	/*
+	 * Not enough tokens: give back what we could not take.
+	 */
+
+	got = MAX(before, 0);
+	ATOMIC_ADD(&tb->tokens, n - got);
+
+	return got;
+}
+
+/**
+ * @return the cache of the current thread, reset if it held tokens of a
+ * previous period.
+ */
+static inline struct tbucket_cache *
+tbucket_cache(tbucket_t *tb, uint gen)
+{
+	struct tbucket_cache *c = &tb->cache[thread_small_id()];
+
+	if G_UNLIKELY(c->gen != gen) {
+		c->gen = gen;
+		c->tokens = 0;
+	}
+
+	return c;
+}
+
+/**
+ * Request tokens for a consumer.
+ *
+ * This can be called concurrently from any thread, provided the share is
+ * not concurrently used by another thread.
+ *
+ * @param tb		the token bucket
+ * @param share		the consumer's share
+ * @param len		amount of tokens wanted
+ *
+ * @return amount of tokens granted, 0 if none are available.
+ */
+size_t
+tbucket_grant(tbucket_t *tb, tbucket_share_t *share, size_t len)
+{
+	struct tbucket_cache *c;
+	long want, max;
+	uint gen;
+
+	tbucket_check(tb);
+	g_assert(share != NULL);
+
+	gen = atomic_uint_get(&tb->gen);
+
+	if (share->gen != gen) {
+		share->gen = gen;
+		share->granted = 0;
+		atomic_uint_inc(&tb->active);
+	}
+
+	want = MIN(len, MAX_INT_VAL(long) / 4);
+	max = tb->share_max;
+
+	/*
+	 * Once all the consumers active during the previous period came by,
+	 * we can distribute what they left to the ones coming back.
+	 */
+
+	if (max != 0) {
+		if (atomic_uint_get(&tb->active) >= tb->last_active)
+			max *= 2;
+		if (share->granted >= max)
+			return 0;
+		want = MIN(want, max - share->granted);
+	}
+
+	c = tbucket_cache(tb, gen);
+
+	if (c->tokens < want)
+		c->tokens += tbucket_take(tb, MAX(tb->batch, want - c->tokens));
+
+	want = MIN(want, c->tokens);
+	c->tokens -= want;
+	share->granted += want;
+
+	return want;
+}
+
+/**
+ * Report the amount of tokens consumed out of a previous grant.
+ *
+ * Unused tokens are given back to the thread's cache, unless the period
+ * changed since they were granted.
+ *
+ * @param tb		the token bucket
+ * @param share		the consumer's share
+ * @param used		amount of tokens actually consumed
+ * @param granted	amount of tokens granted by tbucket_grant()
+ */
+void
+tbucket_settle(tbucket_t *tb, tbucket_share_t *share,
+	size_t used, size_t granted)
+{
+	uint gen;
+
+	tbucket_check(tb);
+	g_assert(share != NULL);
+	g_assert(used <= granted);
+
+	if (used != 0) {
+		ATOMIC_ADD(&tb->consumed, used);
+		ATOMIC_ADD(&share->consumed, used);
+	}
+
+	gen = atomic_uint_get(&tb->gen);
+
+	if (used != granted && share->gen == gen) {
+		struct tbucket_cache *c = tbucket_cache(tb, gen);
+		long unused = granted - used;
+
+		c->tokens += unused;
+		share->granted -= MIN(share->granted, unused);
+	}
+}
+
+/**
+ * Consume tokens that were not granted beforehand.
+ *
+ * This is used to account for traffic we cannot control.  The bucket can
+ * become negative, in which case no more tokens are granted until the end
+ * of the period.
+ *
+ * @param tb		the token bucket
+ * @param share		the consumer's share (may be NULL)
+ * @param used		amount of tokens consumed
+ */
+void
+tbucket_charge(tbucket_t *tb, tbucket_share_t *share, size_t used)
+{
+	tbucket_check(tb);
+
+	if (0 == used)
+		return;
+
+	ATOMIC_SUB(&tb->tokens, used);
+	ATOMIC_ADD(&tb->consumed, used);
+
+	if (share != NULL)
+		ATOMIC_ADD(&share->consumed, used);
+}
+
+/**
+ * @return amount of tokens left in the shared bucket, not counting the
+ * ones cached by the threads.
+ */
+size_t
+tbucket_available(const tbucket_t *tb)
+{
+	long tokens;
+
+	tbucket_check(tb);
+
+	tokens = ATOMIC_GET(&tb->tokens);
+
+	return MAX(tokens, 0);
+}
+
+/**
+ * Collect the amount of tokens consumed since the last call.
+ */
+int64
+tbucket_consumed(tbucket_t *tb)
+{
+	long consumed;
+
+	tbucket_check(tb);
+
+	consumed = ATOMIC_GET(&tb->consumed);
+	ATOMIC_SUB(&tb->consumed, consumed);
+
+	return consumed;
+}
+
+/**
+ * Collect the amount of tokens consumed by a consumer since the last call.
+ */
+int64
+tbucket_share_consumed(tbucket_share_t *share)
+{
+	long consumed;
+
+	g_assert(share != NULL);
+
+	consumed = ATOMIC_GET(&share->consumed);
+	ATOMIC_SUB(&share->consumed, consumed);
+
+	return consumed;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
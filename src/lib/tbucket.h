@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock-free token bucket.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _tbucket_h_
+#define _tbucket_h_
+
+struct tbucket;
+typedef struct tbucket tbucket_t;
+
+/**
+ * The share of a token bucket consumer.
+ *
+ * It records the tokens granted to the consumer during the current period,
+ * to limit what a single consumer can get, and the tokens it consumed since
+ * they were last collected.  It must be zeroed before its first use, and
+ * a consumer must not be used concurrently by several threads.
+ */
+typedef struct tbucket_share {
+	uint gen;				/**< Period of last grant */
+	long granted;			/**< Tokens granted during that period */
+	long consumed;			/**< Tokens consumed, atomically updated */
+} tbucket_share_t;
+
+/*
+ * Public interface.
+ */
+
+tbucket_t *tbucket_make(size_t batch);
+void tbucket_free_null(tbucket_t **tb_ptr);
+void tbucket_refill(tbucket_t *tb, int64 tokens);
+size_t tbucket_grant(tbucket_t *tb, tbucket_share_t *share, size_t len);
+void tbucket_settle(tbucket_t *tb, tbucket_share_t *share,
+	size_t used, size_t granted);
+void tbucket_charge(tbucket_t *tb, tbucket_share_t *share, size_t used);
+size_t tbucket_available(const tbucket_t *tb);
+int64 tbucket_consumed(tbucket_t *tb);
+int64 tbucket_share_consumed(tbucket_share_t *share);
+
+#endif /* _tbucket_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -30,6 +30,9 @@
  * Periodically monitors file and invoke processing callback
  * should the file change.
  *
+ * Directories can also be monitored for changes made to their entries,
+ * when the kernel supports it.
+ *
  * @author Raphael Manfredi
  * @date 2004
  */
@@ -38,12 +41,21 @@
 
 #include "watcher.h"
 
+#ifdef HAS_INOTIFY
+#include <sys/inotify.h>
+#endif
+
 #include "atoms.h"
 #include "cq.h"
+#include "fd.h"
 #include "halloc.h"
 #include "hikset.h"
+#include "htable.h"
+#include "inputevt.h"
+#include "misc.h"
 #include "once.h"
 #include "path.h"
+#include "pslist.h"
 #include "walloc.h"
 
 #include "override.h"		/* Must be the last header included */
@@ -206,6 +218,497 @@ watcher_unregister_path(const file_path_t *fp)
 	HFREE_NULL(path);
 }
 
+/*
+ * Directory monitoring.
+ *
+ * When the kernel supports inotify, we can be notified of changes made to
+ * the entries of a directory, as they happen.  Monitoring is not recursive:
+ * each directory of interest must be registered, and callers are notified
+ * of new sub-directories so that they can register them in turn.
+ */
+
+#ifdef HAS_INOTIFY
+
+#define WATCHER_DIR_MASK	\
+	(IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#define WATCHER_READ_SIZE	(64 * 1024)	/**< Read buffer for events */
+
+/**
+ * A monitored directory.
+ */
+struct watched_dir {
+	const char *path;		/**< Directory being watched (atom) */
+	int wd;					/**< inotify watch descriptor */
+	watcher_dir_cb_t cb;	/**< Callback to invoke on change */
+	void *udata;			/**< User supplied data to hand-out to callback */
+};
+
+static hikset_t *watched_paths;	/**< path -> struct watched_dir */
+static htable_t *watched_wds;	/**< wd -> struct watched_dir */
+static int watcher_ifd = -1;	/**< inotify file descriptor */
+static uint watcher_ifd_id;		/**< I/O event ID for watcher_ifd */
+
+/**
+ * A file or directory moved away, waiting for its destination.
+ */
+struct watched_move {
+	uint32 cookie;			/**< Links the two halves of a rename */
+	char *path;				/**< Source path (halloc()'ed) */
+	struct watched_dir *wd;	/**< Directory from which it was moved */
+	bool is_dir;			/**< Whether a directory was moved */
+};
+
+/**
+ * Free a watched directory, once removed from the tables.
+ */
+static void
+watcher_dir_free(struct watched_dir *w)
+{
+	atom_str_free_null(&w->path);
+	WFREE(w);
+}
+
+/**
+ * Forget about a watched directory, which is no longer monitored by the
+ * kernel, either because it was removed or because we removed the watch.
+ */
+static void
+watcher_dir_forget(struct watched_dir *w)
+{
+	hikset_remove(watched_paths, w->path);
+	htable_remove(watched_wds, int_to_pointer(w->wd));
+	watcher_dir_free(w);
+}
+
+/**
+ * Stop monitoring all the directories below the given one, as they were
+ * moved away: inotify still reports events for them, but under the path
+ * they had before the move.
+ */
+static void
+watcher_dir_forget_below(const char *dir)
+{
+	hikset_iter_t *iter;
+	pslist_t *sl, *gone = NULL;
+	void *value;
+
+	iter = hikset_iter_new(watched_paths);
+
+	while (hikset_iter_next(iter, &value)) {
+		struct watched_dir *w = value;
+		const char *p = is_strprefix(w->path, dir);
+
+		if (p != NULL && (is_dir_separator(*p) || '\0' == *p))
+			gone = pslist_prepend(gone, w);
+	}
+
+	hikset_iter_release(&iter);
+
+	PSLIST_FOREACH(gone, sl) {
+		struct watched_dir *w = sl->data;
+
+		inotify_rm_watch(watcher_ifd, w->wd);
+		watcher_dir_forget(w);
+	}
+
+	pslist_free(gone);
+}
+
+/**
+ * Report a move for which we did not see the destination: the entry was
+ * moved outside the monitored directories, so it is gone for us.
+ */
+static void
+watcher_move_flush(struct watched_move *mv)
+{
+	if (NULL == mv->path)
+		return;
+
+	if (mv->is_dir) {
+		watcher_dir_forget_below(mv->path);
+		if (mv->wd != NULL)
+			(*mv->wd->cb)(WATCHER_DIR_REMOVED, mv->path, NULL, mv->wd->udata);
+	} else if (mv->wd != NULL) {
+		(*mv->wd->cb)(WATCHER_REMOVED, mv->path, NULL, mv->wd->udata);
+	}
+
+	HFREE_NULL(mv->path);
+	mv->wd = NULL;
+}
+
+/**
+ * Report overflow of the kernel event queue to all the callbacks.
+ */
+static void
+watcher_dir_overflow(void)
+{
+	hikset_iter_t *iter;
+	void *value;
+	watcher_dir_cb_t last_cb = NULL;
+	void *last_udata = NULL;
+
+	iter = hikset_iter_new(watched_paths);
+
+	while (hikset_iter_next(iter, &value)) {
+		struct watched_dir *w = value;
+
+		/* Avoid signalling the same party repeatedly */
+
+		if (w->cb == last_cb && w->udata == last_udata)
+			continue;
+
+		last_cb = w->cb;
+		last_udata = w->udata;
+		(*w->cb)(WATCHER_OVERFLOW, w->path, NULL, w->udata);
+	}
+
+	hikset_iter_release(&iter);
+}
+
+/**
+ * Process one inotify event.
+ *
+ * @param ev		the event read from the kernel
+ * @param mv		pending move we have not seen the destination of yet
+ */
+static void
+watcher_dir_event(const struct inotify_event *ev, struct watched_move *mv)
+{
+	struct watched_dir *w;
+	bool is_dir = booleanize(ev->mask & IN_ISDIR);
+	char *path;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		watcher_move_flush(mv);
+		watcher_dir_overflow();
+		return;
+	}
+
+	w = htable_lookup(watched_wds, int_to_pointer(ev->wd));
+
+	if (NULL == w)
+		return;		/* Watch removed since event was generated */
+
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+		/*
+		 * The directory itself is gone or was moved: the parent directory,
+		 * if monitored, will report that as well.  Only the removal of the
+		 * watch by the kernel tells us to forget about the directory.
+		 */
+
+		if (ev->mask & IN_IGNORED)
+			watcher_dir_forget(w);
+		return;
+	}
+
+	if (0 == ev->len || '\0' == ev->name[0])
+		return;
+
+	path = make_pathname(w->path, ev->name);
+
+	if (ev->mask & IN_MOVED_FROM) {
+		watcher_move_flush(mv);
+		mv->cookie = ev->cookie;
+		mv->path = path;		/* Ownership transferred */
+		mv->wd = w;
+		mv->is_dir = is_dir;
+		return;
+	}
+
+	if (ev->mask & IN_MOVED_TO) {
+		if (mv->path != NULL && mv->cookie == ev->cookie) {
+			if (is_dir) {
+				/*
+				 * Directory renamed: report it as a removal of the old
+				 * tree and a new tree to monitor.
+				 */
+
+				watcher_dir_forget_below(mv->path);
+				(*w->cb)(WATCHER_DIR_REMOVED, mv->path, NULL, w->udata);
+				(*w->cb)(WATCHER_DIR_ADDED, path, NULL, w->udata);
+			} else {
+				(*w->cb)(WATCHER_RENAMED, path, mv->path, w->udata);
+			}
+			HFREE_NULL(mv->path);
+			mv->wd = NULL;
+		} else {
+			watcher_move_flush(mv);
+			(*w->cb)(is_dir ? WATCHER_DIR_ADDED : WATCHER_ADDED,
+				path, NULL, w->udata);
+		}
+	} else {
+		watcher_move_flush(mv);
+
+		if (ev->mask & IN_CREATE) {
+			/* New files are reported when closed, after being written */
+			if (is_dir)
+				(*w->cb)(WATCHER_DIR_ADDED, path, NULL, w->udata);
+		} else if (ev->mask & IN_CLOSE_WRITE) {
+			(*w->cb)(WATCHER_CHANGED, path, NULL, w->udata);
+		} else if (ev->mask & IN_DELETE) {
+			(*w->cb)(is_dir ? WATCHER_DIR_REMOVED : WATCHER_REMOVED,
+				path, NULL, w->udata);
+		}
+	}
+
+	HFREE_NULL(path);
+}
+
+/**
+ * I/O callback invoked when inotify events are available.
+ */
+static void
+watcher_dir_readable(void *unused_data, int fd, inputevt_cond_t cond)
+{
+	struct watched_move mv;
+	char *buf;
+
+	(void) unused_data;
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION) {
+		s_warning("%s(): exception on inotify descriptor", G_STRFUNC);
+		return;
+	}
+
+	ZERO(&mv);
+	buf = halloc(WATCHER_READ_SIZE);
+
+	for (;;) {
+		ssize_t r = read(fd, buf, WATCHER_READ_SIZE);
+		ssize_t offset = 0;
+
+		if ((ssize_t) -1 == r) {
+			if (!is_temporary_error(errno))
+				s_warning("%s(): read() failed: %m", G_STRFUNC);
+			break;
+		}
+
+		if (0 == r)
+			break;
+
+		while (offset + (ssize_t) sizeof(struct inotify_event) <= r) {
+			const struct inotify_event *ev;
+
+			ev = ptr_add_offset(buf, offset);
+			offset += sizeof *ev + ev->len;
+
+			if (offset > r)
+				break;		/* Truncated, should not happen */
+
+			watcher_dir_event(ev, &mv);
+		}
+	}
+
+	/*
+	 * Both halves of a rename are generated atomically by the kernel, so if
+	 * we have not seen the destination by now, the entry was moved away.
+	 */
+
+	watcher_move_flush(&mv);
+	HFREE_NULL(buf);
+}
+
+/**
+ * Create the inotify descriptor, once.
+ *
+ * @return TRUE if we can monitor directories.
+ */
+static bool
+watcher_dir_setup(void)
+{
+	static bool done, ok;
+
+	if G_LIKELY(done)
+		return ok;
+
+	done = TRUE;
+	watcher_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (-1 == watcher_ifd) {
+		s_warning("%s(): cannot monitor directories: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	watched_paths = hikset_create(
+		offsetof(struct watched_dir, path), HASH_KEY_STRING, 0);
+	watched_wds = htable_create(HASH_KEY_SELF, 0);
+	watcher_ifd_id = inputevt_add(watcher_ifd, INPUT_EVENT_RX,
+		watcher_dir_readable, NULL);
+
+	return ok = TRUE;
+}
+
+/**
+ * Can we monitor directories for changes?
+ */
+bool
+watcher_dir_available(void)
+{
+	return watcher_dir_setup();
+}
+
+/**
+ * Register new directory to be monitored for changes.
+ *
+ * If the directory was already monitored, the previous callback is replaced.
+ *
+ * @param dir		the directory to monitor (string duplicated)
+ * @param cb		the callback to invoke when the directory changes
+ * @param udata		extra data to pass to the callback
+ *
+ * @return TRUE if directory is monitored, FALSE on error.
+ */
+bool
+watcher_register_dir(const char *dir, watcher_dir_cb_t cb, void *udata)
+{
+	struct watched_dir *w;
+	int wd;
+
+	g_assert(dir != NULL);
+	g_assert(cb != NULL);
+
+	if (!watcher_dir_setup())
+		return FALSE;
+
+	wd = inotify_add_watch(watcher_ifd, dir, WATCHER_DIR_MASK);
+
+	if (-1 == wd) {
+		if (ENOSPC == errno) {
+			s_warning("%s(): too many directories monitored, "
+				"check fs.inotify.max_user_watches", G_STRFUNC);
+		} else {
+			s_warning("%s(): cannot monitor \"%s\": %m", G_STRFUNC, dir);
+		}
+		return FALSE;
+	}
+
+	/*
+	 * The kernel returns the same watch descriptor when the same inode
+	 * is registered again, possibly through another path.
+	 */
+
+	w = htable_lookup(watched_wds, int_to_pointer(wd));
+	if (w != NULL)
+		watcher_dir_forget(w);
+
+	w = hikset_lookup(watched_paths, dir);
+	if (w != NULL) {
+		inotify_rm_watch(watcher_ifd, w->wd);
+		watcher_dir_forget(w);
+	}
+
+	WALLOC0(w);
+	w->path = atom_str_get(dir);
+	w->wd = wd;
+	w->cb = cb;
+	w->udata = udata;
+
+	hikset_insert_key(watched_paths, &w->path);
+	htable_insert(watched_wds, int_to_pointer(wd), w);
+
+	return TRUE;
+}
+
+/**
+ * Cancel monitoring of specified directory.
+ */
+void
+watcher_unregister_dir(const char *dir)
+{
+	struct watched_dir *w;
+
+	g_assert(dir != NULL);
+
+	if (NULL == watched_paths)
+		return;
+
+	w = hikset_lookup(watched_paths, dir);
+
+	if (w != NULL) {
+		inotify_rm_watch(watcher_ifd, w->wd);
+		watcher_dir_forget(w);
+	}
+}
+
+/**
+ * Free watched directory -- hash table iterator callback.
+ */
+static void
+free_watched_dir_kv(void *value, void *unused_udata)
+{
+	(void) unused_udata;
+	watcher_dir_free(value);
+}
+
+/**
+ * Stop monitoring all directories.
+ */
+static void
+watcher_dir_close(void)
+{
+	if (watcher_ifd != -1) {
+		inputevt_remove(&watcher_ifd_id);
+		fd_close(&watcher_ifd);
+		hikset_foreach(watched_paths, free_watched_dir_kv, NULL);
+		hikset_free_null(&watched_paths);
+		htable_free_null(&watched_wds);
+	}
+}
+
+#else	/* !HAS_INOTIFY */
+
+bool
+watcher_dir_available(void)
+{
+	return FALSE;
+}
+
+bool
+watcher_register_dir(const char *dir, watcher_dir_cb_t cb, void *udata)
+{
+	(void) dir;
+	(void) cb;
+	(void) udata;
+
+	return FALSE;
+}
+
+void
+watcher_unregister_dir(const char *dir)
+{
+	(void) dir;
+}
+
+static void
+watcher_dir_close(void)
+{
+	/* Nothing to do */
+}
+
+#endif	/* HAS_INOTIFY */
+
+/**
+ * @return the name of a directory event, for logging.
+ */
+const char *
+watcher_event_to_string(enum watcher_event ev)
+{
+	switch (ev) {
+	case WATCHER_ADDED:			return "added";
+	case WATCHER_CHANGED:		return "changed";
+	case WATCHER_REMOVED:		return "removed";
+	case WATCHER_RENAMED:		return "renamed";
+	case WATCHER_DIR_ADDED:		return "directory added";
+	case WATCHER_DIR_REMOVED:	return "directory removed";
+	case WATCHER_OVERFLOW:		return "overflow";
+	}
+
+	g_assert_not_reached();
+	return NULL;
+}
+
 /**
  * Configure the watcher layer, once.
  */
@@ -248,6 +751,7 @@ watcher_close(void)
 {
 	hikset_foreach(monitored, free_monitored_kv, NULL);
 	hikset_free_null(&monitored);
+	watcher_dir_close();
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -43,6 +43,30 @@
  */
 typedef void (*watcher_cb_t)(const char *filename, void *udata);
 
+/**
+ * Events reported on monitored directories.
+ */
+enum watcher_event {
+	WATCHER_ADDED,			/**< File moved into the directory */
+	WATCHER_CHANGED,		/**< File created or rewritten */
+	WATCHER_REMOVED,		/**< File deleted or moved away */
+	WATCHER_RENAMED,		/**< File renamed between monitored directories */
+	WATCHER_DIR_ADDED,		/**< Sub-directory created or moved in */
+	WATCHER_DIR_REMOVED,	/**< Directory deleted or moved away */
+	WATCHER_OVERFLOW		/**< Events were lost */
+};
+
+/**
+ * The callback invoked when a monitored directory changes.
+ *
+ * @param ev		the event
+ * @param path		full path of the affected entry
+ * @param old_path	previous path for WATCHER_RENAMED, NULL otherwise
+ * @param udata		user supplied data
+ */
+typedef void (*watcher_dir_cb_t)(enum watcher_event ev,
+	const char *path, const char *old_path, void *udata);
+
 /*
  * Public interface.
  */
@@ -55,6 +79,11 @@ void watcher_register_path(
 	const file_path_t *fp, watcher_cb_t cb, void *udata);
 void watcher_unregister_path(const file_path_t *fp);
 
+bool watcher_dir_available(void);
+bool watcher_register_dir(const char *dir, watcher_dir_cb_t cb, void *udata);
+void watcher_unregister_dir(const char *dir);
+const char *watcher_event_to_string(enum watcher_event ev);
+
 #endif /* _watcher_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
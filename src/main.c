@@ -73,6 +73,7 @@
 #include "core/http.h"
 #include "core/ignore.h"
 #include "core/inet.h"
+#include "core/iopool.h"
 #include "core/ipp_cache.h"
 #include "core/local_shell.h"
 #include "core/move.h"
@@ -100,11 +101,13 @@
 #include "core/uhc.h"
 #include "core/upload_stats.h"
 #include "core/urpc.h"
+#include "core/verify_combined.h"
 #include "core/verify_sha1.h"
 #include "core/verify_tth.h"
 #include "core/version.h"
 #include "core/vmsg.h"
 #include "core/whitelist.h"
+#include "core/zpool.h"
 
 #include "if/dht/dht.h"
 
@@ -150,6 +153,7 @@
 #include "lib/pow2.h"
 #include "lib/product.h"
 #include "lib/progname.h"
+#include "lib/qrt_kernel.h"
 #include "lib/random.h"
 #include "lib/setproctitle.h"
 #include "lib/sha1.h"
@@ -719,8 +723,10 @@ gtk_gnutella_exit(int exit_code)
 	DO(upload_stats_close);
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
+	DO(verify_combined_close);
 	DO(verify_tth_shutdown);
 	DO(download_close);
+	DO(iopool_close);	/* After downloads flushed their data */
 	DO(file_info_store_if_dirty);	/* In case downloads had buffered data */
 	DO(parq_close);
 	DO(pproxy_close);
@@ -954,6 +960,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(bogons_close);	/* Idem, since host_close() can touch the cache */
 	DO(tx_collect);		/* Prevent spurious leak notifications */
 	DO(rx_collect);		/* Idem */
+	DO(zpool_close);	/* After all RX and TX stacks are gone */
 	DO(hostiles_close);
 	DO(spam_close);
 	DO(gip_close);
@@ -981,7 +988,6 @@ gtk_gnutella_exit(int exit_code)
 	DO(tls_global_close);
 	DO(misc_close);
 	DO(mingw_close);
-	DO(verify_tth_close);
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -2473,6 +2479,7 @@ main(int argc, char **argv)
 	random_init();
 	vsort_init(isatty(STDERR_FILENO) ? 0 : 1);
 	pattern_init(isatty(STDERR_FILENO) ? 0 : dflt_pattern);
+	qrtk_init(isatty(STDERR_FILENO) ? 0 : 1);
 	htable_test();
 	wq_init();
 	inputevt_init(OPT(use_poll));
@@ -2548,6 +2555,7 @@ main(int argc, char **argv)
 	ghc_init();
 	gwc_init();
 	verify_sha1_init();
+	verify_combined_init();
 	verify_tth_init();
 	move_init();
 	ignore_init();
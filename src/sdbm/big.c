@@ -33,6 +33,7 @@
 #include "lib/pow2.h"
 #include "lib/stringify.h"
 #include "lib/unsigned.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -81,6 +82,8 @@ struct DBMBIG {
 	bit_field_t *bitcheck;	/* array of ``bitmaps'' entries, for checks */
 	buf_t *keybuf;			/* scratch buffer where keys are read */
 	buf_t *valbuf;			/* scratch buffer where values are read */
+	char *map;				/* read-only mapping of the .dat file */
+	size_t maplen;			/* length of the mapping */
 	long bitbno;			/* page number of the bitmap in bitbuf */
 	int fd;					/* data file descriptor */
 	long bitmaps;			/* amount of bitmaps allocated */
@@ -96,6 +99,7 @@ struct DBMBIG {
 	ulong bigwrite;			/* stats: amount of big data write syscalls */
 	ulong bigread_blk;		/* stats: amount of big data blocks read */
 	ulong bigwrite_blk;		/* stats: amount of big data blocks written */
+	ulong bigmapped;		/* stats: amount of reads served by mapping */
 	uint8 bitbuf_dirty;		/* whether bitbuf needs flushing to disk */
 };
 
@@ -112,6 +116,46 @@ OFF_DAT(unsigned long off)
 	return off * BIG_BLKSIZE;
 }
 
+/**
+ * Read from the .dat file, through the memory mapping when present and
+ * covering the requested range.
+ *
+ * @return amount of bytes read, -1 on error with errno set.
+ */
+static ssize_t
+big_pread(DBMBIG *dbg, void *p, size_t len, fileoffset_t off)
+{
+#ifdef HAS_MMAP
+	if (
+		dbg->map != NULL && off >= 0 &&
+		UNSIGNED(off) < dbg->maplen && dbg->maplen - UNSIGNED(off) >= len
+	) {
+		memcpy(p, dbg->map + off, len);
+		dbg->bigmapped++;
+		return len;
+	}
+#endif	/* HAS_MMAP */
+
+	return compat_pread(dbg->fd, p, len, off);
+}
+
+/**
+ * Discard the memory mapping of the .dat file, if any.
+ */
+static void
+big_unmap(DBMBIG *dbg)
+{
+#ifdef HAS_MMAP
+	if (dbg->map != NULL) {
+		vmm_munmap(dbg->map, dbg->maplen);
+		dbg->map = NULL;
+		dbg->maplen = 0;
+	}
+#else
+	(void) dbg;
+#endif	/* HAS_MMAP */
+}
+
 /**
  * Round size upwards to fit an entire amount of pages.
  */
@@ -169,6 +213,10 @@ log_bigstats(DBM *db)
 	g_info("sdbm: \"%s\" big blocks written = %lu (%lu system call%s)",
 		sdbm_name(db),
 		dbg->bigwrite_blk, dbg->bigwrite, plural(dbg->bigwrite));
+	if (dbg->bigmapped != 0) {
+		g_info("sdbm: \"%s\" big reads served by memory mapping = %lu",
+			sdbm_name(db), dbg->bigmapped);
+	}
 }
 
 /**
@@ -207,6 +255,7 @@ big_close(DBM *db)
 	if (-1 == dbg->fd)
 		return FALSE;
 
+	big_unmap(dbg);
 	fd_forget_and_close(&dbg->fd);
 	return TRUE;
 }
@@ -294,6 +343,7 @@ big_free(DBM *db)
 	HFREE_NULL(dbg->bitcheck);
 	buf_free_null(&dbg->keybuf);
 	buf_free_null(&dbg->valbuf);
+	big_unmap(dbg);
 	fd_forget_and_close(&dbg->fd);
 	dbg->magic = 0;
 	WFREE(dbg);
@@ -419,7 +469,7 @@ fetch_bitbuf(DBM *db, long num)
 			return FALSE;
 
 		dbg->bitread++;
-		got = compat_pread(dbg->fd, dbg->bitbuf, BIG_BLKSIZE, OFF_DAT(bno));
+		got = big_pread(dbg, dbg->bitbuf, BIG_BLKSIZE, OFF_DAT(bno));
 		if (got < 0) {
 			s_critical("sdbm: \"%s\": could not read bitmap block #%ld: %m",
 				sdbm_name(db), num);
@@ -822,7 +872,7 @@ big_fetch(DBM *db, const void *bvec, size_t len, buf_t *buf)
 		}
 
 		dbg->bigread++;
-		if (-1 == compat_pread(dbg->fd, q, toread, OFF_DAT(bno))) {
+		if (-1 == big_pread(dbg, q, toread, OFF_DAT(bno))) {
 			s_critical("sdbm: \"%s\": "
 				"could not read %zu bytes starting at data block #%u: %m",
 				sdbm_name(db), toread, bno);
@@ -1797,6 +1847,57 @@ big_open_lazy(DBM *db, bool force)
 	return -1;			/* File not opened, but file already exists */
 }
 
+/**
+ * Enable or disable read-only memory mapping of the .dat file.
+ *
+ * When there is no .dat file yet, nothing is mapped but the operation
+ * succeeds.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+big_set_mmap(DBM *db, bool on)
+{
+	DBMBIG *dbg = db->big;
+
+	if (NULL == dbg)
+		return 0;
+
+	sdbm_big_check(dbg);
+
+	big_unmap(dbg);
+
+	if (!on)
+		return 0;
+
+#ifdef HAS_MMAP
+	{
+		filestat_t buf;
+		void *p;
+
+		if (-1 == dbg->fd && -1 == big_open_lazy(db, TRUE))
+			return 0 == errno ? 0 : -1;		/* OK if no .dat file */
+
+		if (-1 == fstat(dbg->fd, &buf))
+			return -1;
+
+		if (0 == buf.st_size)
+			return 0;
+
+		p = vmm_mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, dbg->fd, 0);
+		if (MAP_FAILED == p)
+			return -1;
+
+		dbg->map = p;
+		dbg->maplen = buf.st_size;
+	}
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif	/* HAS_MMAP */
+}
+
 /**
  * Shrink .dat file on disk to remove needlessly allocated blocks.
  *
@@ -17,6 +17,7 @@
 #define bigval_put sdbm__bigval_put
 #define big_sync sdbm__big_sync
 #define big_close sdbm__big_close
+#define big_set_mmap sdbm__big_set_mmap
 #define big_reopen sdbm__big_reopen
 #define bigkey_free sdbm__bigkey_free
 #define bigval_free sdbm__bigval_free
@@ -42,6 +43,7 @@ bool big_sync(DBM *);
 bool big_shrink(DBM *);
 bool big_clear(DBM *);
 bool big_close(DBM *);
+int big_set_mmap(DBM *, bool);
 int big_reopen(DBM *);
 size_t big_check_end(DBM *, bool);
 bool bigkey_put(DBM *, char *, size_t, const char *, size_t);
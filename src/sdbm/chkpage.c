@@ -21,10 +21,10 @@
 #include "lib/override.h"		/* Must be the last header included */
 
 /**
- * Check page sanity.
+ * Check sanity of a page of ``len'' bytes.
  */
 bool
-sdbm_chkpage(const char *pag)
+sdbm_chkpage_len(const char *pag, size_t len)
 {
 	unsigned n;
 	unsigned off;
@@ -33,11 +33,12 @@ sdbm_chkpage(const char *pag)
 	/*
 	 * This static assertion makes sure that the leading bit of the shorts
 	 * used for storing offsets will always remain clear with the current
-	 * DBM page size, so that it can safely be used as a marker to flag
+	 * DBM page sizes, so that it can safely be used as a marker to flag
 	 * big keys/values.
 	 */
 
-	STATIC_ASSERT(DBM_PBLKSIZ < 0x8000);
+	STATIC_ASSERT(DBM_PBLKSIZ_MAX < 0x8000);
+	g_assert(len <= DBM_PBLKSIZ_MAX);
 
 	/*
 	 * number of entries should be something reasonable,
@@ -45,7 +46,7 @@ sdbm_chkpage(const char *pag)
 	 * this could be made more rigorous.
 	 */
 
-	if G_UNLIKELY((n = ino[0]) > INO_MAX)
+	if G_UNLIKELY((n = ino[0]) > INO_MAX_LEN(len))
 		return FALSE;
 
 	if G_UNLIKELY(n & 0x1)
@@ -53,7 +54,7 @@ sdbm_chkpage(const char *pag)
 
 	if (n > 0) {
 		unsigned ino_end = (n + 1) * sizeof(unsigned short);
-		off = DBM_PBLKSIZ;
+		off = len;
 		for (ino++; n > 0; ino += 2) {
 			unsigned short koff = poffset(ino[0]);
 			unsigned short voff = poffset(ino[1]);
@@ -68,4 +69,13 @@ sdbm_chkpage(const char *pag)
 	return TRUE;
 }
 
+/**
+ * Check sanity of a page of the default size.
+ */
+bool
+sdbm_chkpage(const char *pag)
+{
+	return sdbm_chkpage_len(pag, DBM_PBLKSIZ);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
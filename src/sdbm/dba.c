@@ -18,6 +18,7 @@ void bdump(int);
 static bool summary_only;
 static bool filled_only;
 static bool on_tty;
+static size_t pblksiz = DBM_PBLKSIZ;
 
 static void G_NORETURN
 usage(void)
@@ -88,7 +89,23 @@ main(int argc, char **argv)
 		if (-1 == fstat(pagf, &buf))
 			oops("cannot fstat opened %s", name);
 
-		npag = buf.st_size / DBM_PBLKSIZ;
+		{
+			ssize_t r = sdbm_pagfile_pagesize(pagf);
+			off_t base;
+
+			if (-1 == r)
+				oops("cannot determine page size of %s", name);
+			if (r != 0)
+				pblksiz = r;
+
+			base = DBM_PBLKSIZ == pblksiz ? 0 : pblksiz;
+			if ((off_t) -1 == lseek(pagf, base, SEEK_SET))
+				oops("cannot seek to first page of %s", name);
+			if (!summary_only && pblksiz != DBM_PBLKSIZ)
+				printf("page size: %zu bytes\n", pblksiz);
+
+			npag = (buf.st_size - base) / pblksiz;
+		}
 		sdump(pagf, npag);
 		free(name);
 
@@ -137,7 +154,7 @@ pagestat(char *pag,
 			printf("no entries.\n");
 	} else {
 		unsigned i;
-		unsigned off = DBM_PBLKSIZ;
+		unsigned off = pblksiz;
 
 		for (i = 1; i < n; i+= 2) {
 			unsigned short koff = offset(ino[i]);
@@ -155,9 +172,9 @@ pagestat(char *pag,
 		if (!summary_only) {
 			printf("%3d entr%-3s, %2d%% used, keys %3d, values %3d, free %3d%s",
 				n / 2, plural_y(n / 2),
-				((DBM_PBLKSIZ - pfree) * 100) / DBM_PBLKSIZ,
+				(int) (((pblksiz - pfree) * 100) / pblksiz),
 				keysize, valsize, pfree,
-				(DBM_PBLKSIZ - pfree) / (n/2) * (1+n/2) > DBM_PBLKSIZ ?
+				(pblksiz - pfree) / (n/2) * (1+n/2) > pblksiz ?
 					" (LOW)" : "");
 
 			if (lk != 0) printf(" (LKEY %d)", lk);
@@ -191,12 +208,12 @@ sdump(int pagf, long npag)
 	int e;
 	int bad = 0;
 	unsigned ksize = 0, vsize = 0;
-	char pag[DBM_PBLKSIZ];
+	char pag[DBM_PBLKSIZ_MAX];
 
-	while ((b = read(pagf, pag, DBM_PBLKSIZ)) > 0) {
+	while ((b = read(pagf, pag, pblksiz)) > 0) {
 		int lk, lv;
 		unsigned ks, vs;
-		bool is_bad = !sdbm_chkpage(pag);
+		bool is_bad = !sdbm_chkpage_len(pag, pblksiz);
 		bool is_empty = page_is_empty(pag);
 
 		if (summary_only && 0 == n % 1000) show_progress(n, npag);
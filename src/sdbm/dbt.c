@@ -56,6 +56,9 @@ static bool unlink_db;
 static bool all_keys;
 static bool large_keys, large_values, common_head_tail;
 static bool loose_delete;
+static bool two_queues;
+static bool mmapped;
+static size_t pagesize;
 static bool async_rebuild, async_rebuild_launched;
 static int async_thread = -1;
 
@@ -68,8 +71,8 @@ static void G_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-abdeiklprstvwyABCDEKSTUVX] [-R seed] [-c pages]\n"
-		"       dbname [count]\n"
+		"Usage: %s [-abdeiklprstvwyABCDEKMQSTUVX] [-R seed] [-c pages]\n"
+		"       [-P pagesize] dbname [count]\n"
 		"  -a : rebuild the database asynchronously whilst testing\n"
 		"  -b : rebuild the database\n"
 		"  -c : set LRU cache size\n"
@@ -92,6 +95,9 @@ usage(void)
 		"  -D : enable LRU cache write delay\n"
 		"  -E : empty existing database on write test\n"
 		"  -K : use large keys with common head/tail parts\n"
+		"  -M : memory-map database files when opened read-only\n"
+		"  -P : page size for new databases\n"
+		"  -Q : use the 2Q page replacement policy for the LRU cache\n"
 		"  -R : seed for repeatable random key sequence\n"
 		"  -S : shrink database before testing\n"
 		"  -T : make database handle thread-safe\n"
@@ -125,11 +131,15 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 	if (WR_EMPTY == (wflags & (WR_EMPTY|WR_DELETING)))
 		flags |= O_TRUNC;
 
-	db = sdbm_open(name, flags, 0777);
+	db = sdbm_open_paged(name, flags, 0777, pagesize);
 	if (NULL == db) {
 		oops("error opening database \"%s\" in %s mode",
 			name, writeable ? "writing" : "reading");
 	}
+	if (mmapped && sdbm_rdonly(db)) {
+		if (-1 == sdbm_set_mmap(db, TRUE))
+			oops("error memory-mapping \"%s\"", name);
+	}
 	if (thread_safe)
 		sdbm_thread_safe(db);
 	if (cache != 0) {
@@ -137,6 +147,11 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 			oops("error configuring LRU cache for \"%s\"", name);
 		}
 	}
+	if (two_queues) {
+		if (-1 == sdbm_set_cache_policy(db, SDBM_CACHE_2Q)) {
+			oops("error configuring 2Q cache policy for \"%s\"", name);
+		}
+	}
 	/* Volatile implies deferred writes, so do this first */
 	if (wflags & WR_VOLATILE) {
 		if (-1 == sdbm_set_volatile(db, TRUE)) {
@@ -659,7 +674,7 @@ main(int argc, char **argv)
 	const char *name;
 	long count;
 	long cache = 0;
-	const char options[] = "aAbBc:CdDeEiklKprR:sStTUvVwxXy";
+	const char options[] = "aAbBc:CdDeEiklKMpP:QrR:sStTUvVwxXy";
 
 	progstart(argc, argv);
 
@@ -710,9 +725,20 @@ main(int argc, char **argv)
 			lflag++;
 			thread_safe++;
 			break;
+		case 'M':			/* memory-map read-only database */
+			mmapped++;
+			break;
 		case 'p':			/* show test progress */
 			progress++;
 			break;
+		case 'P':			/* page size */
+			pagesize = atol(optarg);
+			if (!sdbm_pagesize_is_valid(pagesize))
+				usage();
+			break;
+		case 'Q':			/* use 2Q cache policy */
+			two_queues++;
+			break;
 		case 'r':			/* read test */
 			rflag++;
 			break;
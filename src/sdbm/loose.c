@@ -111,8 +111,8 @@ loose_deleted(struct sdbm_pair *pv, int pcnt, int n)
 		p->koff += removed;		/* Move towards end of page */
 		p->voff += removed;
 
-		g_assert(p->koff + p->klen <= DBM_PBLKSIZ);
-		g_assert(p->voff + p->vlen <= DBM_PBLKSIZ);
+		g_assert(p->koff + p->klen <= DBM_PBLKSIZ_MAX);
+		g_assert(p->voff + p->vlen <= DBM_PBLKSIZ_MAX);
 	}
 }
 
@@ -474,7 +474,7 @@ loose_iterate(DBM *db, struct loose_type *type, void *arg, int flags,
 
 	tm_now_exact(&last_check);
 
-	for (b = 0; OFF_PAG(b) <= pagtail; b++) {
+	for (b = 0; OFF_PAG(db, b) <= pagtail; b++) {
 		ulong mstamp;
 		const char *pag = lru_wire(db, b, &mstamp);
 
@@ -47,14 +47,26 @@ enum sdbm_lru_magic { SDBM_LRU_MAGIC = 0x6a6daa37 };
  * When the SDBM layer wires pages, they are put in the `wired' list and
  * can no longer be reclaimed, regardless of the configured amount of
  * cached pages, until they are un-wired.
+ *
+ * With the 2Q replacement policy, pages referenced for the first time are
+ * put in the `a1in' FIFO instead, and they are only moved to the `lru' list
+ * (the "Am" queue of 2Q) when they are referenced again shortly after having
+ * been evicted from `a1in', which we detect through the `ghosts' list that
+ * remembers the numbers of the pages recently evicted from `a1in'.  This
+ * protects the hot pages from sequential scans, which only cycle through
+ * the `a1in' FIFO.
  */
 struct lru_cache {
 	enum sdbm_lru_magic magic;	/* Magic number */
 	hevset_t *pagnum;			/* Associates page number to cached page */
+	hevset_t *ghostnum;			/* 2Q: page numbers held in `ghosts' */
 	elist_t lru;				/* LRU-ordered list of cached pages */
+	elist_t a1in;				/* 2Q: FIFO of pages referenced once */
+	elist_t ghosts;				/* 2Q: pages recently evicted from `a1in' */
 	elist_t wired;				/* Wired (non-removable) cached pages */
 	uint pages;					/* Configured amount of pages to cache */
 	uint8 write_deferred;		/* Whether writes should be deferred */
+	uint8 policy;				/* Replacement policy (sdbm_cache_policy) */
 	unsigned long rhits;		/* Stats: amount of cache hits on reads */
 	unsigned long rmisses;		/* Stats: amount of cache misses on reads */
 	unsigned long whits;		/* Stats: amount of cache hits on writes */
@@ -67,6 +79,9 @@ struct lru_cache {
 	unsigned long cp_mod_wired;	/* Stats: cached pages modified whilst wired */
 	unsigned long cp_dirtied;	/* Stats: cached pages marked dirty */
 	unsigned long cp_flushed;	/* Stats: cached pages flushed */
+	unsigned long evictions;	/* Stats: cached pages evicted */
+	unsigned long ghost_hits;	/* Stats: 2Q misses on evicted pages */
+	unsigned long scan_reads;	/* Stats: non-caching reads */
 };
 
 static inline void
@@ -96,6 +111,8 @@ struct lru_cpage {
 	uint wired:1;						/* Wired page, do not reuse */
 	uint was_cached:1;					/* Was in LRU list before being wired */
 	uint invalid:1;						/* Wired page was invalidated */
+	uint queue:1;						/* 2Q: page held in `a1in' FIFO */
+	uint scan:1;						/* Loaded by a non-caching read */
 	int wirecnt;						/* Amount of wiring done for page */
 	ulong mstamp;						/* Modification stamp (counter) */
 	long numpag;						/* Cache key: page number within DB */
@@ -105,7 +122,23 @@ struct lru_cpage {
 };
 
 #define LRU_EMBEDDED_OFFSET		offsetof(struct lru_cpage, page)
-#define LRU_CPAGE_LEN			(DBM_PBLKSIZ + LRU_EMBEDDED_OFFSET)
+#define LRU_CPAGE_LEN(db)		((db)->pblksiz + LRU_EMBEDDED_OFFSET)
+
+/**
+ * A "ghost" page for the 2Q policy: only the page number is remembered.
+ */
+struct lru_ghost {
+	long numpag;						/* Page number within DB */
+	link_t chain;						/* Chaining pointers for list */
+};
+
+/*
+ * Sizing of the 2Q queues, relative to the configured amount of pages:
+ * `a1in' is given 1/4 of the cache, and we remember the numbers of pages
+ * worth 1/2 of the cache in `ghosts', as recommended by the 2Q authors.
+ */
+#define LRU_2Q_KIN(c)			MAX(1, (c)->pages / 4)
+#define LRU_2Q_KOUT(c)			MAX(1, (c)->pages / 2)
 
 static inline void
 sdbm_lru_cpage_check(const struct lru_cpage * const c)
@@ -135,7 +168,7 @@ sdbm_lru_cpage_alloc(DBM *db)
 
 	sdbm_check(db);
 
-	cp = walloc(LRU_CPAGE_LEN);
+	cp = walloc(LRU_CPAGE_LEN(db));
 	ZERO(cp);
 	cp->magic = SDBM_LRU_CPAGE_MAGIC;
 	cp->db = db;
@@ -155,6 +188,8 @@ sdbm_lru_cpage_alloc(DBM *db)
 static void
 sdbm_lru_cpage_free(struct lru_cpage *cp)
 {
+	size_t len;
+
 	sdbm_lru_cpage_check(cp);
 
 	{
@@ -164,10 +199,11 @@ sdbm_lru_cpage_free(struct lru_cpage *cp)
 		sdbm_lru_check(db->cache);
 
 		db->cache->cp_freed++;
+		len = LRU_CPAGE_LEN(db);
 	}
 
 	ZERO(cp);
-	wfree(cp, LRU_CPAGE_LEN);
+	wfree(cp, len);
 }
 
 /**
@@ -203,6 +239,192 @@ sdbm_lru_cpage_get(const DBM *db, const char *pag, bool safe)
 	return deconstify_pointer(cp);
 }
 
+/**
+ * @return the list holding a non-wired cached page.
+ */
+static inline elist_t *
+lru_cpage_list(struct lru_cache *cache, const struct lru_cpage *cp)
+{
+	return cp->queue ? &cache->a1in : &cache->lru;
+}
+
+/**
+ * @return the amount of non-wired cached pages.
+ */
+static inline size_t
+lru_cached_count(const struct lru_cache *cache)
+{
+	return elist_count(&cache->lru) + elist_count(&cache->a1in);
+}
+
+/**
+ * Trim the 2Q ghost list to the specified length.
+ */
+static void
+lru_ghost_trim(struct lru_cache *cache, size_t max)
+{
+	while (elist_count(&cache->ghosts) > max) {
+		struct lru_ghost *g = elist_pop(&cache->ghosts);
+		bool found = hevset_remove(cache->ghostnum, &g->numpag);
+		g_assert(found);
+		WFREE(g);
+	}
+}
+
+/**
+ * Remember that page was evicted from the 2Q `a1in' FIFO.
+ */
+static void
+lru_ghost_record(struct lru_cache *cache, long num)
+{
+	struct lru_ghost *g;
+
+	if (hevset_contains(cache->ghostnum, &num))
+		return;
+
+	WALLOC0(g);
+	g->numpag = num;
+	elist_prepend(&cache->ghosts, g);
+	hevset_insert(cache->ghostnum, g);
+
+	lru_ghost_trim(cache, LRU_2Q_KOUT(cache));
+}
+
+/**
+ * Forget about a 2Q ghost page.
+ *
+ * @return TRUE if the page was known as a ghost.
+ */
+static bool
+lru_ghost_remove(struct lru_cache *cache, long num)
+{
+	struct lru_ghost *g = hevset_lookup(cache->ghostnum, &num);
+
+	if (NULL == g)
+		return FALSE;
+
+	elist_remove(&cache->ghosts, g);
+	hevset_remove(cache->ghostnum, &num);
+	WFREE(g);
+
+	return TRUE;
+}
+
+static void
+free_ghost(void *data, void *unused)
+{
+	struct lru_ghost *g = data;
+
+	(void) unused;
+
+	WFREE(g);
+}
+
+/**
+ * Insert a newly cached page in the proper list, according to the cache
+ * replacement policy.
+ *
+ * When the database is flagged with DBM_NOCACHE, the page is loaded as part
+ * of a scan and is put where it will be reclaimed first.
+ */
+static void
+lru_cpage_insert(DBM *db, struct lru_cpage *cp)
+{
+	struct lru_cache *cache = db->cache;
+
+	cp->queue = FALSE;
+	cp->scan = booleanize(db->flags & DBM_NOCACHE);
+
+	if (SDBM_CACHE_2Q == cache->policy) {
+		if (cp->scan) {
+			cp->queue = TRUE;
+			elist_append(&cache->a1in, cp);
+		} else if (lru_ghost_remove(cache, cp->numpag)) {
+			cache->ghost_hits++;
+			elist_prepend(&cache->lru, cp);
+		} else {
+			cp->queue = TRUE;
+			elist_prepend(&cache->a1in, cp);
+		}
+	} else if (cp->scan) {
+		elist_append(&cache->lru, cp);
+	} else {
+		elist_prepend(&cache->lru, cp);
+	}
+}
+
+/**
+ * Record an access to a cached page, which was not wired.
+ */
+static void
+lru_cpage_access(DBM *db, struct lru_cpage *cp)
+{
+	struct lru_cache *cache = db->cache;
+
+	if G_UNLIKELY(db->flags & DBM_NOCACHE)
+		return;			/* Scans do not change page ordering */
+
+	/*
+	 * With 2Q, a hit in the `a1in' FIFO does not move the page, unless it
+	 * had been loaded by a scan, which does not count as a reference.
+	 */
+
+	if (cp->queue && !cp->scan)
+		return;
+
+	cp->scan = FALSE;
+	elist_moveto_head(lru_cpage_list(cache, cp), cp);
+}
+
+/**
+ * Select the cached page to evict next.
+ *
+ * With 2Q, we reclaim from `a1in' when it holds more than its share of
+ * the cache, from the LRU list otherwise.
+ */
+static struct lru_cpage *
+lru_victim(const struct lru_cache *cache)
+{
+	size_t a1in = elist_count(&cache->a1in);
+
+	if (
+		a1in != 0 &&
+		(a1in > LRU_2Q_KIN(cache) || 0 == elist_count(&cache->lru))
+	)
+		return elist_tail(&cache->a1in);
+
+	return elist_tail(&cache->lru);
+}
+
+/**
+ * Remove evicted page from its list and from the cache.
+ *
+ * The page is not freed: this is up to the caller, which may want to reuse
+ * its entry.
+ */
+static void
+lru_evict(DBM *db, struct lru_cpage *cp)
+{
+	struct lru_cache *cache = db->cache;
+	bool found;
+
+	g_assert(!cp->dirty);
+	g_assert(!cp->wired);
+
+	elist_remove(lru_cpage_list(cache, cp), cp);
+	found = hevset_remove(cache->pagnum, &cp->numpag);
+	g_assert(found);
+
+	if (cp->queue && !cp->scan)
+		lru_ghost_record(cache, cp->numpag);
+
+	if (db->pagbno == cp->numpag)
+		db->pagbno = -1;
+
+	cp->queue = cp->scan = FALSE;
+	cache->evictions++;
+}
+
 /**
  * Setup allocated LRU page cache.
  */
@@ -210,20 +432,26 @@ static void
 setup_cache(struct lru_cache *cache, uint pages, bool wdelay)
 {
 	struct lru_cpage dummy;
+	struct lru_ghost gdummy;
 
 	cache->pagnum = hevset_create(offsetof(struct lru_cpage, numpag),
 		HASH_KEY_FIXED, sizeof(dummy.numpag));
+	cache->ghostnum = hevset_create(offsetof(struct lru_ghost, numpag),
+		HASH_KEY_FIXED, sizeof(gdummy.numpag));
 
 	/*
-	 * The same "chain" field is used for the two lists because a page
+	 * The same "chain" field is used for the three lists because a page
 	 * can only be inserted in one of these lists at a given time.
 	 */
 
 	elist_init(&cache->lru,   offsetof(struct lru_cpage, chain));
+	elist_init(&cache->a1in,  offsetof(struct lru_cpage, chain));
 	elist_init(&cache->wired, offsetof(struct lru_cpage, chain));
+	elist_init(&cache->ghosts, offsetof(struct lru_ghost, chain));
 
 	cache->pages = pages;
 	cache->write_deferred = wdelay;
+	cache->policy = SDBM_CACHE_LRU;
 }
 
 static void
@@ -242,7 +470,11 @@ free_cache(struct lru_cache *cache)
 {
 	hevset_foreach(cache->pagnum, free_cached_page, NULL);
 	hevset_free_null(&cache->pagnum);
+	hevset_foreach(cache->ghostnum, free_ghost, NULL);
+	hevset_free_null(&cache->ghostnum);
 	elist_discard(&cache->lru);
+	elist_discard(&cache->a1in);
+	elist_discard(&cache->ghosts);
 	elist_discard(&cache->wired);
 	cache->pages = 0;
 	cache->magic = 0;
@@ -287,8 +519,10 @@ log_lrustats(DBM *db)
 
 	sdbm_lru_check(cache);
 
-	s_info("sdbm: \"%s\" LRU cache size = %u page%s, %s writes, %s DB",
+	s_info("sdbm: \"%s\" LRU cache size = %u page%s, %s policy, "
+		"%s writes, %s DB",
 		sdbm_name(db), cache->pages, plural(cache->pages),
+		sdbm_cache_policy_to_string(cache->policy),
 		cache->write_deferred ? "deferred" : "synchronous",
 		db->is_volatile ? "volatile" : "persistent");
 	s_info("sdbm: \"%s\" LRU read cache hits = %.2f%% on %lu request%s",
@@ -306,6 +540,9 @@ log_lrustats(DBM *db)
 		sdbm_name(db), cache->cp_wired, cache->cp_mod_wired);
 	s_info("sdbm: \"%s\" LRU pages dirtied = %lu, flushed = %lu",
 		sdbm_name(db), cache->cp_dirtied, cache->cp_flushed);
+	s_info("sdbm: \"%s\" LRU pages evicted = %lu, ghost hits = %lu, "
+		"scan reads = %lu",
+		sdbm_name(db), cache->evictions, cache->ghost_hits, cache->scan_reads);
 }
 
 /**
@@ -409,6 +646,14 @@ flush_dirtypag(const DBM *db)
 			break;
 	}
 
+	if (0 == saved_errno) {
+		ELIST_FOREACH_DATA(&cache->a1in, cp) {
+			sdbm_lru_cpage_valid(cp, db);
+			if (!flush_cpage(cp, &amount, &saved_errno))
+				break;
+		}
+	}
+
 	if (saved_errno != 0) {
 		ELIST_FOREACH_DATA(&cache->wired, cp) {
 			sdbm_lru_cpage_valid(cp, db);
@@ -552,7 +797,9 @@ setcache(DBM *db, uint pages)
 	 * If we have less pages in the LRU cache that we can hold, we're done.
 	 */
 
-	if (elist_count(&cache->lru) <= pages)
+	lru_ghost_trim(cache, LRU_2Q_KOUT(cache));
+
+	if (lru_cached_count(cache) <= pages)
 		return 0;
 
 	/*
@@ -574,7 +821,7 @@ setcache(DBM *db, uint pages)
 			G_STRFUNC, db->pagbuf, db->pagbno);
 
 		if (!cp->wired)
-			elist_moveto_head(&cache->lru, cp);
+			elist_moveto_head(lru_cpage_list(cache, cp), cp);
 	}
 
 	/*
@@ -583,18 +830,21 @@ setcache(DBM *db, uint pages)
 	 * We flushed all the dirty pages earlier, so we can simply drop the
 	 * cached entries  We also know that db->pagbuf cannot point to any
 	 * of the dropped entries due to the precaution we took above to move
-	 * that entry at the head of the list.
+	 * that entry at the head of its list, unless the list only held that
+	 * page, in which case lru_evict() will reset db->pagbno.
 	 */
 
 	{
-		int excess = elist_count(&cache->lru) - pages;
+		int excess = lru_cached_count(cache) - pages;
 
 		g_assert(excess > 0);
 
 		while (excess-- != 0) {
-			struct lru_cpage *cp = elist_pop(&cache->lru);
-			bool found = hevset_remove(cache->pagnum, &cp->numpag);
-			g_assert(found);
+			struct lru_cpage *cp = lru_victim(cache);
+
+			if (db->pagbuf == cp->page)
+				db->pagbuf = NULL;
+			lru_evict(db, cp);
 			sdbm_lru_cpage_free(cp);
 		}
 	}
@@ -645,6 +895,90 @@ getwdelay(const DBM *db)
 	return cache != NULL && cache->write_deferred;
 }
 
+/**
+ * Set the page replacement policy.
+ *
+ * Switching back to plain LRU moves the pages held in the 2Q `a1in' FIFO at
+ * the tail of the LRU list, where they will be reclaimed first.
+ *
+ * @return -1 on error with errno set, 0 if OK.
+ */
+int
+setpolicy(DBM *db, enum sdbm_cache_policy policy)
+{
+	struct lru_cache *cache = db->cache;
+
+	if (policy != SDBM_CACHE_LRU && policy != SDBM_CACHE_2Q) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (NULL == cache) {
+		if (-1 == init_cache(db, LRU_PAGES, FALSE))
+			return -1;
+		cache = db->cache;
+	}
+
+	sdbm_lru_check(cache);
+	assert_sdbm_locked(db);
+
+	if (policy == cache->policy)
+		return 0;
+
+	if (SDBM_CACHE_LRU == policy) {
+		struct lru_cpage *cp;
+
+		ELIST_FOREACH_DATA(&cache->a1in, cp) {
+			cp->queue = FALSE;
+		}
+		elist_append_list(&cache->lru, &cache->a1in);
+		lru_ghost_trim(cache, 0);
+	}
+
+	cache->policy = policy;
+	return 0;
+}
+
+/**
+ * @return the page replacement policy.
+ */
+enum sdbm_cache_policy
+getpolicy(const DBM *db)
+{
+	const struct lru_cache *cache = db->cache;
+
+	return NULL == cache ? SDBM_CACHE_LRU : cache->policy;
+}
+
+/**
+ * Fill cache statistics.
+ */
+void
+lru_stats(const DBM *db, struct sdbm_cache_stats *stats)
+{
+	const struct lru_cache *cache = db->cache;
+
+	ZERO(stats);
+
+	if (NULL == cache)
+		return;
+
+	sdbm_lru_check(cache);
+
+	stats->policy     = cache->policy;
+	stats->pages      = cache->pages;
+	stats->cached     = lru_cached_count(cache);
+	stats->wired      = elist_count(&cache->wired);
+	stats->ghosts     = elist_count(&cache->ghosts);
+	stats->rhits      = cache->rhits;
+	stats->rmisses    = cache->rmisses;
+	stats->whits      = cache->whits;
+	stats->wmisses    = cache->wmisses;
+	stats->evictions  = cache->evictions;
+	stats->ghost_hits = cache->ghost_hits;
+	stats->scan_reads = cache->scan_reads;
+}
+
 /**
  * Close (i.e. free) the LRU page cache.
  *
@@ -739,7 +1073,7 @@ lru_wire(DBM *db, long num, ulong *mstamp)
 		cp->wired = TRUE;
 		cp->wirecnt = 1;
 		if (!allocated)
-			elist_remove(&cache->lru, cp);
+			elist_remove(lru_cpage_list(cache, cp), cp);
 		elist_append(&cache->wired, cp);
 	}
 
@@ -814,7 +1148,7 @@ lru_unwire(DBM *db, const char *pag)
 		goto freepage;
 
 	if (!cp->invalid && cp->was_cached) {
-		if (elist_count(&cache->lru) >= cache->pages) {
+		if (lru_cached_count(cache) >= cache->pages) {
 			struct lru_cpage *old;
 
 			/*
@@ -822,22 +1156,18 @@ lru_unwire(DBM *db, const char *pag)
 			 * to make room for the unwired page.
 			 */
 
-			old = elist_tail(&cache->lru);
+			old = lru_victim(cache);
 
 			sdbm_lru_cpage_valid(old, db);
 
 			if (old->dirty && writebuf(old)) {
-				if (db->pagbno == old->numpag)
-					db->pagbno = -1;
-				elist_remove(&cache->lru, old);
-				found = hevset_remove(cache->pagnum, &old->numpag);
-				g_assert(found);
+				lru_evict(db, old);
 				sdbm_lru_cpage_free(old);
 			}
 		}
-		if (elist_count(&cache->lru) < cache->pages) {
-			elist_prepend(&cache->lru, cp);
+		if (lru_cached_count(cache) < cache->pages) {
 			/* Page was in the "wired" list, so already in cache->pagnum */
+			elist_prepend(lru_cpage_list(cache, cp), cp);
 		} else {
 			goto freepage;
 		}
@@ -870,7 +1200,7 @@ freepage:
 
 	if (
 		0 == cache->pages &&
-		0 == elist_count(&cache->wired) + elist_count(&cache->lru)
+		0 == elist_count(&cache->wired) + lru_cached_count(cache)
 	) {
 		free_cache(cache);
 		db->cache = NULL;
@@ -935,27 +1265,26 @@ getcpage(DBM *db, long num)
 {
 	struct lru_cache *cache = db->cache;
 	struct lru_cpage *cp;
-	bool found;
 
 	g_assert(!hevset_contains(cache->pagnum, &num));
 	assert_sdbm_locked(db);
 
-	if (elist_count(&cache->lru) < cache->pages) {
+	if (lru_cached_count(cache) < cache->pages) {
 		/*
 		 * Has less pages than the configured maximum, allocate a new entry.
 		 */
 
 		cp = sdbm_lru_cpage_alloc(db);
-		elist_prepend(&cache->lru, cp);
 	} else {
 		bool had_ioerr = booleanize(db->flags & DBM_IOERR_W);
 
 		/*
-		 * We need to evict the least-recently used page from the cache to be
-		 * able to reuse its entry.
+		 * We need to evict the page selected by the replacement policy
+		 * (the least-recently used page with plain LRU) to be able to reuse
+		 * its entry.
 		 */
 
-		cp = elist_tail(&cache->lru);
+		cp = lru_victim(cache);
 
 		sdbm_lru_cpage_valid(cp, db);
 
@@ -970,7 +1299,7 @@ getcpage(DBM *db, long num)
 			 * be properly flushed later.
 			 */
 
-			ELIST_FOREACH_DATA(&cache->lru, cp) {
+			ELIST_FOREACH_DATA(&cache->a1in, cp) {
 				sdbm_lru_cpage_valid(cp, db);
 				if (!cp->dirty) {
 					slot_found = TRUE;	/* OK, reuse cache slot then */
@@ -978,6 +1307,16 @@ getcpage(DBM *db, long num)
 				}
 			}
 
+			if (!slot_found) {
+				ELIST_FOREACH_DATA(&cache->lru, cp) {
+					sdbm_lru_cpage_valid(cp, db);
+					if (!cp->dirty) {
+						slot_found = TRUE;
+						break;
+					}
+				}
+			}
+
 			if (slot_found) {
 				/*
 				 * Clear error condition if we had none prior to the flush
@@ -991,7 +1330,7 @@ getcpage(DBM *db, long num)
 					"reusing cache slot used by clean page #%ld",
 					sdbm_name(db), cp->numpag);
 			} else {
-				cp = elist_tail(&cache->lru);
+				cp = lru_victim(cache);
 				sdbm_lru_cpage_valid(cp, db);
 				s_warning("sdbm: \"%s\": cannot discard dirty page #%ld: %m",
 					sdbm_name(db), cp->numpag);
@@ -1000,35 +1339,30 @@ getcpage(DBM *db, long num)
 		}
 
 		/*
-		 * Move page at the beginning of the LRU list, since it is now the
-		 * most recently used page.
+		 * Evict the page, its entry being reused below.
 		 */
 
 		g_assert(!cp->dirty);
 		sdbm_lru_cpage_valid(cp, db);
 
-		elist_moveto_head(&cache->lru, cp);
-		found = hevset_remove(cache->pagnum, &cp->numpag);
-		g_assert(found);
-
-		if (db->pagbno == cp->numpag)
-			db->pagbno = -1;
-
+		lru_evict(db, cp);
 		cache->cp_reused++;
 	}
 
 	/*
-	 * Record that we are now caching the page.
+	 * Record that we are now caching the page, inserting it in the list
+	 * dictated by the replacement policy.
 	 */
 
 	cp->numpag = num;
 	hevset_insert(cache->pagnum, cp);
+	lru_cpage_insert(db, cp);
 
 	g_assert_log(hevset_count(cache->pagnum) ==
-		elist_count(&cache->lru) + elist_count(&cache->wired),
-		"%s(): set_count=%zu, lru_count=%zu, wired_count=%zu",
-		G_STRFUNC, hevset_count(cache->pagnum),
-		elist_count(&cache->lru), elist_count(&cache->wired));
+		lru_cached_count(cache) + elist_count(&cache->wired),
+		"%s(): set_count=%zu, lru_count=%zu, a1in_count=%zu, wired_count=%zu",
+		G_STRFUNC, hevset_count(cache->pagnum), elist_count(&cache->lru),
+		elist_count(&cache->a1in), elist_count(&cache->wired));
 
 	return cp;
 }
@@ -1098,7 +1432,7 @@ lru_discard_wired_page(struct lru_cpage *cp, long bno)
 		ATOMIC_INC(&cp->mstamp);
 		cp->dirty = FALSE;
 		cp->invalid = TRUE;
-		memset(cp->page, 0, DBM_PBLKSIZ);
+		memset(cp->page, 0, cp->db->pblksiz);
 
 		sdbm_lru_check(cp->db->cache);
 		cp->db->cache->cp_discarded++;
@@ -1119,6 +1453,7 @@ lru_discard(DBM *db, long bno)
 	assert_sdbm_locked(db);
 
 	elist_foreach_remove(&cache->lru, lru_discard_page, long_to_pointer(bno));
+	elist_foreach_remove(&cache->a1in, lru_discard_page, long_to_pointer(bno));
 
 	ELIST_FOREACH_DATA(&cache->wired, cp) {
 		sdbm_lru_cpage_valid(cp, db);
@@ -1166,7 +1501,7 @@ lru_invalidate(DBM *db, long bno)
 			cp->invalid = TRUE;
 		} else {
 			bool found;
-			elist_remove(&cache->lru, cp);
+			elist_remove(lru_cpage_list(cache, cp), cp);
 			found = hevset_remove(cache->pagnum, &bno);
 			g_assert(found);
 			sdbm_lru_cpage_free(cp);
@@ -1198,13 +1533,19 @@ lru_tail_offset(const DBM *db)
 			bno = MAX(bno, cp->numpag);
 	}
 
+	ELIST_FOREACH_DATA(&cache->a1in, cp) {
+		sdbm_lru_cpage_valid(cp, db);
+		if (cp->dirty)
+			bno = MAX(bno, cp->numpag);
+	}
+
 	ELIST_FOREACH_DATA(&cache->wired, cp) {
 		sdbm_lru_cpage_valid(cp, db);
 		if (cp->dirty)
 			bno = MAX(bno, cp->numpag);
 	}
 
-	return OFF_PAG(bno + 1);
+	return bno < 0 ? 0 : OFF_PAG(db, bno + 1);
 }
 
 /**
@@ -1234,7 +1575,7 @@ readbuf(DBM *db, long num, bool *loaded)
 		sdbm_lru_cpage_valid(cp, db);
 
 		if (!cp->wired)
-			elist_moveto_head(&cache->lru, cp);
+			lru_cpage_access(db, cp);
 		cached = TRUE;
 		cache->rhits++;
 	} else {
@@ -1246,6 +1587,9 @@ readbuf(DBM *db, long num, bool *loaded)
 		cache->rmisses++;
 	}
 
+	if G_UNLIKELY(db->flags & DBM_NOCACHE)
+		cache->scan_reads++;
+
 	db->pagbuf = cp->page;
 	if (loaded != NULL)
 		*loaded = cached;
@@ -1324,7 +1668,7 @@ cachepag(DBM *db, char *pag, long num)
 		 * Supersede cached page with new page created by makroom().
 		 */
 
-		memmove(cpag, pag, DBM_PBLKSIZ);
+		memmove(cpag, pag, db->pblksiz);
 
 		if (cache->write_deferred) {
 			cp->dirty = TRUE;
@@ -1337,7 +1681,7 @@ cachepag(DBM *db, char *pag, long num)
 		if (NULL == cp)
 			return FALSE;
 
-		memmove(cp->page, pag, DBM_PBLKSIZ);
+		memmove(cp->page, pag, db->pblksiz);
 		cp->dirty = TRUE;
 		return TRUE;
 	} else {
@@ -1355,10 +1699,10 @@ cachepag(DBM *db, char *pag, long num)
 static bool
 lru_chkpage(DBM *db, char *pag, long num)
 {
-	if G_UNLIKELY(!sdbm_chkpage(pag)) {
+	if G_UNLIKELY(!sdbm_chkpage_len(pag, db->pblksiz)) {
 		s_critical("sdbm: \"%s\": corrupted page #%ld, clearing",
 			sdbm_name(db), num);
-		memset(pag, 0, DBM_PBLKSIZ);
+		memset(pag, 0, db->pblksiz);
 		db->bad_pages++;
 		return FALSE;
 	}
@@ -1388,14 +1732,30 @@ readpag(DBM *db, char *pag, long num)
 	 */
 
 	db->pagread++;
-	got = compat_pread(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+
+	/*
+	 * When the .pag file is mapped (read-only databases), copy the page
+	 * from the mapping if it covers the page, saving a system call.
+	 */
+
+	if (db->pagmap != NULL) {
+		fileoffset_t off = OFF_PAG(db, num);
+
+		if (UNSIGNED(off) + db->pblksiz <= db->pagmaplen) {
+			memcpy(pag, db->pagmap + off, db->pblksiz);
+			db->pagmapped++;
+			goto loaded;
+		}
+	}
+
+	got = compat_pread(db->pagf, pag, db->pblksiz, OFF_PAG(db, num));
 	if G_UNLIKELY(got < 0) {
 		s_critical("sdbm: \"%s\": cannot read page #%ld: %m",
 			sdbm_name(db), num);
 		ioerr(db, FALSE);
 		return FALSE;
 	}
-	if G_UNLIKELY(got < DBM_PBLKSIZ) {
+	if G_UNLIKELY(UNSIGNED(got) < db->pblksiz) {
 		if (got > 0) {
 			s_critical("sdbm: \"%s\": partial read (%u bytes) of page #%ld",
 				sdbm_name(db), (unsigned) got, num);
@@ -1417,9 +1777,10 @@ readpag(DBM *db, char *pag, long num)
 				sdbm_name(db), num, n, plural(n));
 		}
 
-		memset(pag, 0, DBM_PBLKSIZ);
+		memset(pag, 0, db->pblksiz);
 	}
 
+loaded:
 	(void) lru_chkpage(db, pag, num);
 
 	debug(("pag read: %ld\n", num));
@@ -1453,9 +1814,9 @@ flushpag(DBM *db, char *pag, long num)
 	}
 
 	db->pagwrite++;
-	w = compat_pwrite(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+	w = compat_pwrite(db->pagf, pag, db->pblksiz, OFF_PAG(db, num));
 
-	if (w < 0 || w != DBM_PBLKSIZ) {
+	if (w < 0 || UNSIGNED(w) != db->pblksiz) {
 		if (w < 0) {
 			if G_UNLIKELY(db->flags & DBM_RDONLY)
 				errno = EPERM;		/* Instead of EBADF on linux */
@@ -17,6 +17,9 @@
 #define getcache sdbm__getcache
 #define setwdelay sdbm__setwdelay
 #define getwdelay sdbm__getwdelay
+#define setpolicy sdbm__setpolicy
+#define getpolicy sdbm__getpolicy
+#define lru_stats sdbm__lru_stats
 #define cachepag sdbm__cachepag
 #define readpag sdbm__readpag
 
@@ -32,6 +35,9 @@ int setcache(DBM *, uint);
 uint getcache(const DBM *);
 int setwdelay(DBM *, bool);
 bool getwdelay(const DBM *);
+int setpolicy(DBM *, enum sdbm_cache_policy);
+enum sdbm_cache_policy getpolicy(const DBM *);
+void lru_stats(const DBM *, struct sdbm_cache_stats *);
 bool cachepag(DBM *, char *, long);
 char *lru_cached_page(DBM *, long);
 void lru_discard(DBM *, long);
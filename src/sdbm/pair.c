@@ -206,7 +206,7 @@ pair_kv_invalid(const DBM *db, const char *pag, int i, const char *reason)
 			db->pagbno, db->pagbuf, reason);
 	}
 
-	if (i >= 1 && UNSIGNED(i) < MIN(n, (INO_MAX - 1))) {
+	if (i >= 1 && UNSIGNED(i) < MIN(n, (INO_MAX(db) - 1))) {
 		s_debug("sdbm: \"%s\": pair #%d: %skey-offset=%u, %sval-offset=%u",
 			sdbm_name(db), i,
 			is_big(ino[i+0]) ? "big" : "", poffset(ino[i+0]),
@@ -233,7 +233,7 @@ pair_count_check(const DBM *db, const char *pag)
 	sdbm_check(db);
 	g_assert(pag != NULL);
 
-	if G_UNLIKELY(n > INO_MAX || (n & 0x1)) {
+	if G_UNLIKELY(n > INO_MAX(db) || (n & 0x1)) {
 		pair_count_invalid(db, pag);
 		errno = EIO;
 		return FALSE;
@@ -243,9 +243,9 @@ pair_count_check(const DBM *db, const char *pag)
 }
 
 static inline bool
-pair_offset_is_valid(unsigned short off, unsigned short count)
+pair_offset_is_valid(const DBM *db, unsigned short off, unsigned short count)
 {
-	if G_UNLIKELY(off > DBM_PBLKSIZ)
+	if G_UNLIKELY(off > db->pblksiz)
 		return FALSE;
 
 	if G_UNLIKELY(off < (count + 1) * sizeof off)
@@ -268,7 +268,7 @@ pair_offset_check(const DBM *db, const char *pag, unsigned short off)
 	sdbm_check(db);
 	g_assert(pag != NULL);
 
-	if G_LIKELY(pair_offset_is_valid(off, INO(pag)[0]))
+	if G_LIKELY(pair_offset_is_valid(db, off, INO(pag)[0]))
 		return TRUE;
 
 	pair_offset_invalid(db, pag, off);
@@ -297,7 +297,7 @@ pair_key_index_check(const DBM *db, const char *pag, int i)
 	sdbm_check(db);
 	g_assert(pag != NULL);
 
-	if G_UNLIKELY(n > INO_MAX || (n & 0x1)) {
+	if G_UNLIKELY(n > INO_MAX(db) || (n & 0x1)) {
 		pair_count_invalid(db, pag);
 		errno = EIO;
 		return FALSE;
@@ -308,7 +308,7 @@ pair_key_index_check(const DBM *db, const char *pag, int i)
 
 	koff = poffset(ino[i]);
 
-	if G_UNLIKELY(!pair_offset_is_valid(koff, n)) {
+	if G_UNLIKELY(!pair_offset_is_valid(db, koff, n)) {
 		what = "key offset out of range";
 		goto bad_offset;
 	}
@@ -320,7 +320,7 @@ pair_key_index_check(const DBM *db, const char *pag, int i)
 		goto bad_offset;
 	}
 
-	if G_UNLIKELY(!pair_offset_is_valid(voff, n)) {
+	if G_UNLIKELY(!pair_offset_is_valid(db, voff, n)) {
 		what = "value offset out of range";
 		goto bad_offset;
 	}
@@ -354,7 +354,7 @@ fitpair(const DBM *db, const char *pag, size_t need)
 
 	g_return_val_unless(pair_count_check(db, pag), FALSE);
 
-	off = ((n = ino[0]) > 0) ? poffset(ino[n]) : DBM_PBLKSIZ;
+	off = ((n = ino[0]) > 0) ? poffset(ino[n]) : db->pblksiz;
 	nfree = off - (n + 1) * sizeof(short);
 	need += 2 * sizeof(unsigned short);
 
@@ -428,7 +428,7 @@ putpair_ext(const DBM *db, char *pag,
 	unsigned off;
 	unsigned short *ino = INO(pag);
 
-	off = ((n = ino[0]) > 0) ? poffset(ino[n]) : DBM_PBLKSIZ;
+	off = ((n = ino[0]) > 0) ? poffset(ino[n]) : db->pblksiz;
 
 	/*
 	 * enter the key first
@@ -468,7 +468,7 @@ putpair(DBM *db, char *pag, datum key, datum val)
 	 * won't fit in expanded form in the page, there's no question we have
 	 * to use a big value and/or big key.
 	 *
-	 * If it would fit however but the size of key+value is >= DBM_PAIRMAX/2
+	 * If it would fit however but the size of key+value is >= db->pairmax/2
 	 * and the value will waste less than half the .dat page then we force a
 	 * big value to be used.  The rationale is to avoid filling-up the page
 	 * and ending up having to split it later on for the next hashing conflict.
@@ -478,9 +478,9 @@ putpair(DBM *db, char *pag, datum key, datum val)
 	 */
 
 	if (
-		key.dsize <= DBM_PAIRMAX && DBM_PAIRMAX - key.dsize >= val.dsize &&
+		key.dsize <= db->pairmax && db->pairmax - key.dsize >= val.dsize &&
 		(
-			key.dsize + val.dsize < DBM_PAIRMAX / 2 ||
+			key.dsize + val.dsize < db->pairmax / 2 ||
 			val.dsize < DBM_BBLKSIZ / 2
 		)
 	) {
@@ -493,7 +493,7 @@ putpair(DBM *db, char *pag, datum key, datum val)
 		size_t vl;
 		bool largeval;
 
-		off = ((n = ino[0]) > 0) ? poffset(ino[n]) : DBM_PBLKSIZ;
+		off = ((n = ino[0]) > 0) ? poffset(ino[n]) : db->pblksiz;
 
 		/*
 		 * Avoid large keys if possible since comparisons involve extra I/Os.
@@ -507,7 +507,7 @@ putpair(DBM *db, char *pag, datum key, datum val)
 		 * Handle the key first.
 		 */
 
-		if (key.dsize > DBM_PAIRMAX || DBM_PAIRMAX - key.dsize < vl) {
+		if (key.dsize > db->pairmax || db->pairmax - key.dsize < vl) {
 			size_t kl = bigkey_length(key.dsize);
 			/* Large key (and could use a large value as well) */
 			off -= kl;
@@ -515,8 +515,8 @@ putpair(DBM *db, char *pag, datum key, datum val)
 			if (!bigkey_put(db, pag + off, kl, key.dptr, key.dsize))
 				return FALSE;
 			ino[n + 1] = off | BIG_FLAG;
-			largeval = val.dsize > DBM_PAIRMAX / 2 ||
-				val.dsize > DBM_PAIRMAX - bigkey_length(key.dsize);
+			largeval = val.dsize > db->pairmax / 2 ||
+				val.dsize > db->pairmax - bigkey_length(key.dsize);
 		} else {
 			/* Regular inlined key, only the value will be held in .dat */
 			off -= key.dsize;
@@ -696,7 +696,7 @@ getnkey(DBM *db, const char *pag, int num)
 
 	g_return_val_unless(pair_key_index_check(db, pag, i), nullitem);
 
-	off = (i > 1) ? poffset(ino[i - 1]) : DBM_PBLKSIZ;
+	off = (i > 1) ? poffset(ino[i - 1]) : db->pblksiz;
 
 	key.dptr = (char *) pag + poffset(ino[i]);
 	key.dsize = off - poffset(ino[i]);
@@ -724,7 +724,7 @@ static bool
 delipair_big(DBM *db, char *pag, int i)
 {
 	unsigned short *ino = INO(pag);
-	unsigned end = (i > 1) ? poffset(ino[i - 1]) : DBM_PBLKSIZ;
+	unsigned end = (i > 1) ? poffset(ino[i - 1]) : db->pblksiz;
 	unsigned koff = poffset(ino[i]);
 	unsigned voff = poffset(ino[i+1]);
 	bool status = TRUE;
@@ -780,7 +780,7 @@ delipair(DBM *db, char *pag, int i, bool free_bigdata)
 
 	if (i < n - 1) {
 		int m;
-		char *dst = pag + (i == 1 ? DBM_PBLKSIZ : poffset(ino[i - 1]));
+		char *dst = pag + (i == 1 ? db->pblksiz : poffset(ino[i - 1]));
 		char *src = pag + poffset(ino[i + 1]);
 		int   zoo = dst - src;
 
@@ -876,7 +876,7 @@ static int
 seepair(DBM *db, const char *pag, unsigned n, const char *key, size_t siz)
 {
 	unsigned i;
-	size_t off = DBM_PBLKSIZ;
+	size_t off = db->pblksiz;
 	const unsigned short *ino = INO(pag);
 #if 1
 	/* Slightly optimized version */
@@ -973,7 +973,7 @@ chkipair(DBM *db, char *pag, int i)
 
 #ifdef BIGDATA
 	{
-		unsigned end = (i > 1) ? poffset(ino[i - 1]) : DBM_PBLKSIZ;
+		unsigned end = (i > 1) ? poffset(ino[i - 1]) : db->pblksiz;
 		unsigned k = ino[i];
 		unsigned v = ino[i+1];
 		unsigned koff = poffset(k);
@@ -1025,14 +1025,14 @@ void
 splpage(DBM *db, char *pag, char *pagzero, char *pagone, long int sbit)
 {
 	int n;
-	int off = DBM_PBLKSIZ;
+	int off = db->pblksiz;
 	const unsigned short *ino = INO(pag);
 	int removed = 0, dropped = 0;
 
 	MODIFY(db, pagzero);		/* `pagone' does not exist yet in the DB */
 
-	memset(pagzero, 0, DBM_PBLKSIZ);
-	memset(pagone, 0, DBM_PBLKSIZ);
+	memset(pagzero, 0, db->pblksiz);
+	memset(pagone, 0, db->pblksiz);
 
 	g_return_unless(pair_count_check(db, pag));
 
@@ -1124,7 +1124,7 @@ readpairv(const DBM *db, const char *pag,
 	struct sdbm_pair *pv, int vcnt, bool hkeys)
 {
 	const unsigned short *ino = INO(pag);
-	int off = DBM_PBLKSIZ;
+	int off = db->pblksiz;
 	int i, n;
 
 	g_assert(pag != NULL);
@@ -1167,11 +1167,11 @@ sdbm_page_dump_log(logagent_t *la, const DBM *db, const char *pag, long num)
 	log_debug(la, "---- %s SDBM page #%lu for \"%s\" ----",
 		"Begin", num, sdbm_name(db));
 
-	if G_UNLIKELY((n = ino[0]) > INO_MAX || (n & 0x1)) {
+	if G_UNLIKELY((n = ino[0]) > INO_MAX(db) || (n & 0x1)) {
 		log_warning(la, "INVALID entry count: %u", n);
 	} else {
 		unsigned ino_end = (n + 1) * sizeof(unsigned short);
-		unsigned off = DBM_PBLKSIZ;
+		unsigned off = db->pblksiz;
 		unsigned p;
 
 		log_debug(la, "entry count: %u (%u pair%s)", n, n / 2, plural(n / 2));
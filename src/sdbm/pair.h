@@ -18,7 +18,8 @@
 #define readpairv sdbm__readpairv
 
 #define INO(p)		((unsigned short *) (p))
-#define INO_MAX		(DBM_PBLKSIZ / sizeof(unsigned short) - 1)
+#define INO_MAX_LEN(l)	((l) / sizeof(unsigned short) - 1)
+#define INO_MAX(db)		INO_MAX_LEN((db)->pblksiz)
 
 #define BIG_FLAG	(1 << 15)
 #define BIG_MASK	(BIG_FLAG - 1)
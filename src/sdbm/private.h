@@ -24,7 +24,7 @@ struct DBM {
 	struct DBMBIG *big;	/* big key/value data management */
 	char *datname;		/* file name for .dat (created only when needed) */
 #endif
-	char *pagbuf;		/* page file block buffer (size: DBM_PBLKSIZ) */
+	char *pagbuf;		/* page file block buffer (size: pblksiz) */
 	char *dirbuf;		/* directory file block buffer (size: DBM_DBLKSIZ) */
 #ifdef LRU
 	struct lru_cache *cache;	/* LRU page cache */
@@ -35,6 +35,11 @@ struct DBM {
 #endif
 	struct DBM *rdb;	/* if non-NULL, concurrent DB rebuild in progress */
 	fileoffset_t pagtail;	/* end of page file descriptor, for iterating */
+	fileoffset_t pagbase;	/* offset of page #0 in .pag (after header) */
+	char *pagmap;		/* read-only memory mapping of the .pag file */
+	size_t pagmaplen;	/* length of the .pag file mapping */
+	size_t pblksiz;		/* size of a page within ".pag" file */
+	size_t pairmax;		/* maximum size of a key/value pair in a page */
 	long maxbno;		/* size of dirfile in bits */
 	long curbit;		/* current bit number */
 	long hmask;			/* current hash mask */
@@ -51,6 +56,7 @@ struct DBM {
 	ulong pagfetch;		/* stats: amount of page fetch calls */
 	ulong pagread;		/* stats: amount of page read requests */
 	ulong pagbno_hit;	/* stats: amount of read avoided on pagbno */
+	ulong pagmapped;	/* stats: amount of page reads served by mapping */
 	ulong pagwrite;		/* stats: amount of page write requests */
 	ulong pagwforced;	/* stats: amount of forced page writes */
 	ulong dirfetch;		/* stats: amount of dir fetch calls */
@@ -148,10 +154,10 @@ sdbm_check(const DBM * const db)
 	g_assert(SDBM_MAGIC == db->magic);
 }
 
-static inline long
-OFF_PAG(unsigned long off)
+static inline fileoffset_t
+OFF_PAG(const DBM *db, unsigned long off)
 {
-	return off * DBM_PBLKSIZ;
+	return db->pagbase + (fileoffset_t) off * db->pblksiz;
 }
 
 static inline long
@@ -265,8 +265,8 @@ sdbm_rebuild_internal(DBM *db, bool async)
 	 * has been done and we are ready to replace the old descriptor.
 	 */
 
-	ndb = sdbm_prep(dirname, pagname, datname,
-		O_WRONLY | O_CREAT | O_EXCL, db->openmode);
+	ndb = sdbm_prep_paged(dirname, pagname, datname,
+		O_WRONLY | O_CREAT | O_EXCL, db->openmode, db->pblksiz);
 
 	if (NULL == ndb) {
 		error = errno;
@@ -21,6 +21,7 @@
 #include "lib/compat_misc.h"
 #include "lib/compat_pio.h"
 #include "lib/debug.h"
+#include "lib/endian.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
@@ -39,6 +40,21 @@
 
 #define SDBM_COUNT_PAGES	128	/* Amount of pages read by sdbm_count() */
 
+/*
+ * Header of .pag files using a non-default page size.
+ *
+ * The header occupies the first page of the file, and page #0 follows it.
+ * It starts with 0xffff, an impossible entry count for a regular page, so
+ * that legacy headerless files (which always use DBM_PBLKSIZ pages) can be
+ * told apart.  The page size is then stored as a big-endian 32-bit value.
+ */
+#define SDBM_PAGHDR_MAGIC		"\377\377SDBM"
+#define SDBM_PAGHDR_MAGIC_LEN	(sizeof SDBM_PAGHDR_MAGIC - 1)
+#define SDBM_PAGHDR_VERSION		1
+#define SDBM_PAGHDR_VERS_OFF	6	/* Offset of version byte */
+#define SDBM_PAGHDR_SIZE_OFF	8	/* Offset of page size (BE32) */
+#define SDBM_PAGHDR_LEN			12	/* Meaningful header length */
+
 const datum nullitem = {0, 0};
 
 /*
@@ -52,13 +68,13 @@ static bool makroom(DBM *, long, size_t);
 static void validpage(DBM *, long);
 
 static inline int
-bad(const datum item)
+bad(const DBM *db, const datum item)
 {
 #ifdef BIGDATA
 	return NULL == item.dptr ||
-		(item.dsize > DBM_PAIRMAX && bigkey_length(item.dsize) > DBM_PAIRMAX);
+		(item.dsize > db->pairmax && bigkey_length(item.dsize) > db->pairmax);
 #else
-	return NULL == item.dptr || item.dsize > DBM_PAIRMAX;
+	return NULL == item.dptr || item.dsize > db->pairmax;
 #endif
 }
 
@@ -83,11 +99,17 @@ static const long masks[] = {
  * Can the key/value pair of the given size fit, and how much room do we
  * need for it in the page?
  *
+ * @param pairmax		maximum pair size in the pages of the database
+ * @param key_size		size of the key
+ * @param value_size	size of the value
+ * @param needed		if non-NULL, written with the page space needed
+ *
  * @return FALSE if it will not fit, TRUE if it fits with the required
  * page size filled in ``needed'', if not NULL.
  */
 static bool
-sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
+sdbm_storage_needs(size_t pairmax,
+	size_t key_size, size_t value_size, size_t *needed)
 {
 #ifdef BIGDATA
 	/*
@@ -95,7 +117,7 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 	 *
 	 * Instead of just checking:
 	 *
-	 *		key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size
+	 *		key_size <= pairmax && pairmax - key_size >= value_size
 	 *
 	 * which would only indicate whether the expanded key and value can
 	 * fit in the page we look at whether the sum of key + value sizes is
@@ -108,9 +130,9 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 	 */
 
 	if (
-		key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size &&
+		key_size <= pairmax && pairmax - key_size >= value_size &&
 		(
-			key_size + value_size < DBM_PAIRMAX / 2 ||
+			key_size + value_size < pairmax / 2 ||
 			value_size < DBM_BBLKSIZ / 2
 		)
 	) {
@@ -130,10 +152,10 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 
 		vl = bigval_length(value_size);
 
-		if (vl >= DBM_PAIRMAX)		/* Cannot store by indirection anyway */
+		if (vl >= pairmax)		/* Cannot store by indirection anyway */
 			return FALSE;
 
-		if (key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= vl) {
+		if (key_size <= pairmax && pairmax - key_size >= vl) {
 			/* Will expand the key but store the value in the .dat file */
 			if (needed != NULL)
 				*needed = key_size + vl;
@@ -148,22 +170,25 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 
 		if (needed != NULL)
 			*needed = kl + vl;
-		return kl <= DBM_PAIRMAX && DBM_PAIRMAX - kl >= vl;
+		return kl <= pairmax && pairmax - kl >= vl;
 	}
 #else	/* !BIGDATA */
 	if (needed != NULL)
 		*needed = key_size + value_size;
-	return key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size;
+	return key_size <= pairmax && pairmax - key_size >= value_size;
 #endif
 }
 
 /**
  * Will a key/value pair of given size fit in the database?
+ *
+ * This is computed for the default page size, which is conservative for
+ * databases created with larger pages.
  */
 bool
 sdbm_is_storable(size_t key_size, size_t value_size)
 {
-	return sdbm_storage_needs(key_size, value_size, NULL);
+	return sdbm_storage_needs(DBM_PAIRMAX, key_size, value_size, NULL);
 }
 
 /**
@@ -177,6 +202,23 @@ sdbm_is_storable(size_t key_size, size_t value_size)
  */
 DBM *
 sdbm_open(const char *file, int flags, int mode)
+{
+	return sdbm_open_paged(file, flags, mode, 0);
+}
+
+/**
+ * Open database with specified flags and mode (like open() arguments),
+ * using the given page size if the database is created.
+ *
+ * @param file		the basename to use for deriving .pag, .dir and .dat names
+ * @param flags		open() flags
+ * @param mode		open() mode
+ * @param pagesize	size of .pag pages for new databases, 0 for the default
+ *
+ * @return the created database, or NULL on error with errno set.
+ */
+DBM *
+sdbm_open_paged(const char *file, int flags, int mode, size_t pagesize)
 {
 	DBM *db = NULL;
 	char *dirname = NULL;
@@ -206,7 +248,7 @@ sdbm_open(const char *file, int flags, int mode)
 	}
 #endif
 
-	db = sdbm_prep(dirname, pagname, datname, flags, mode);
+	db = sdbm_prep_paged(dirname, pagname, datname, flags, mode, pagesize);
 
 	/* FALL THROUGH */
 
@@ -314,6 +356,174 @@ sdbm_name(const DBM *db)
 	return db->name;
 }
 
+/**
+ * Is the page size valid for a .pag file?
+ */
+bool
+sdbm_pagesize_is_valid(size_t pagesize)
+{
+	return pagesize >= DBM_PBLKSIZ && pagesize <= DBM_PBLKSIZ_MAX &&
+		IS_POWER_OF_2(pagesize);
+}
+
+/**
+ * @return the size of the pages in the .pag file.
+ */
+size_t
+sdbm_pagesize(const DBM *db)
+{
+	sdbm_check(db);
+
+	return db->pblksiz;
+}
+
+/**
+ * Write the header at the start of an empty .pag file.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+static bool
+sdbm_pag_write_header(DBM *db)
+{
+	char *hdr;
+	ssize_t w;
+
+	g_assert(db->pblksiz != DBM_PBLKSIZ);
+	g_assert(db->pagbase == (fileoffset_t) db->pblksiz);
+
+	hdr = walloc0(db->pblksiz);
+	memcpy(hdr, SDBM_PAGHDR_MAGIC, SDBM_PAGHDR_MAGIC_LEN);
+	hdr[SDBM_PAGHDR_VERS_OFF] = SDBM_PAGHDR_VERSION;
+	poke_be32(&hdr[SDBM_PAGHDR_SIZE_OFF], db->pblksiz);
+	w = compat_pwrite(db->pagf, hdr, db->pblksiz, 0);
+	wfree(hdr, db->pblksiz);
+
+	if G_UNLIKELY(w != (ssize_t) db->pblksiz) {
+		if (w >= 0)
+			errno = EIO;		/* Partial write */
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Determine the page size used by a .pag file, from its header.
+ *
+ * Page #0 starts right after the header, whose length is the page size,
+ * unless the file has no header: it then uses DBM_PBLKSIZ pages starting
+ * at offset 0.
+ *
+ * @param fd		the opened .pag file
+ *
+ * @return the page size, 0 if the file is empty, -1 on error with errno set.
+ */
+ssize_t
+sdbm_pagfile_pagesize(int fd)
+{
+	filestat_t pstat;
+	char hdr[SDBM_PAGHDR_LEN];
+	ssize_t r;
+	size_t pagesize;
+
+	if G_UNLIKELY(-1 == fstat(fd, &pstat))
+		return -1;
+
+	if (0 == pstat.st_size)
+		return 0;
+
+	r = compat_pread(fd, hdr, sizeof hdr, 0);
+	if G_UNLIKELY(-1 == r)
+		return -1;
+
+	if (
+		r != sizeof hdr ||
+		0 != memcmp(hdr, SDBM_PAGHDR_MAGIC, SDBM_PAGHDR_MAGIC_LEN)
+	)
+		return DBM_PBLKSIZ;		/* No header, pages of the default size */
+
+	pagesize = peek_be32(&hdr[SDBM_PAGHDR_SIZE_OFF]);
+
+	if G_UNLIKELY(
+		hdr[SDBM_PAGHDR_VERS_OFF] != SDBM_PAGHDR_VERSION ||
+		!sdbm_pagesize_is_valid(pagesize) ||
+		DBM_PBLKSIZ == pagesize
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return pagesize;
+}
+
+/**
+ * Determine the page size of the opened .pag file, writing a header when
+ * a new database is created with a non-default page size.
+ *
+ * @param db		the database being opened
+ * @param pagesize	requested page size for new databases (0 = default)
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+static bool
+sdbm_pag_setup(DBM *db, size_t pagesize)
+{
+	ssize_t filepage;
+	bool created;
+
+	if (0 == pagesize)
+		pagesize = DBM_PBLKSIZ;
+
+	if G_UNLIKELY(!sdbm_pagesize_is_valid(pagesize)) {
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	filepage = sdbm_pagfile_pagesize(db->pagf);
+
+	if G_UNLIKELY(-1 == filepage) {
+		if (EINVAL == errno)
+			s_warning("sdbm: \"%s\": invalid .pag header", db->pagname);
+		return FALSE;
+	}
+
+	/*
+	 * On a new database, use the requested page size unless we cannot
+	 * write the header, in which case the default is used since there
+	 * is no data anyway.
+	 */
+
+	created = 0 == filepage && !(db->flags & DBM_RDONLY);
+	if (created)
+		filepage = pagesize;
+
+	db->pblksiz = 0 == filepage ? DBM_PBLKSIZ : UNSIGNED(filepage);
+	db->pagbase = DBM_PBLKSIZ == db->pblksiz ? 0 : db->pblksiz;
+	db->pairmax = db->pblksiz - DBM_PAIROVH;
+
+	if (created && db->pagbase != 0)
+		return sdbm_pag_write_header(db);
+
+	return TRUE;
+}
+
+/**
+ * Discard the memory mapping of the .pag file, if any.
+ */
+static void
+sdbm_pag_unmap(DBM *db)
+{
+#ifdef HAS_MMAP
+	if (db->pagmap != NULL) {
+		vmm_munmap(db->pagmap, db->pagmaplen);
+		db->pagmap = NULL;
+		db->pagmaplen = 0;
+	}
+#else
+	(void) db;
+#endif	/* HAS_MMAP */
+}
+
 /**
  * Open database with specified files, flags and mode (like open() arguments).
  *
@@ -331,6 +541,31 @@ sdbm_name(const DBM *db)
 DBM *
 sdbm_prep(const char *dirname, const char *pagname,
 	const char *datname, int flags, int mode)
+{
+	return sdbm_prep_paged(dirname, pagname, datname, flags, mode, 0);
+}
+
+/**
+ * Open database with specified files, flags and mode (like open() arguments),
+ * using the given page size if the database is created.
+ *
+ * The page size of an existing database is the one it was created with,
+ * regardless of the `pagesize' argument.  Databases using the default page
+ * size have no header in their .pag file and remain compatible with older
+ * versions of this library.
+ *
+ * @param dirname	the file to use for .dir
+ * @param pagname	the file to use for .pag
+ * @param datname	if not-NULL, the file to use for .dat (big keys/values)
+ * @param flags		open() flags
+ * @param mode		open() mode
+ * @param pagesize	page size for new databases (0 = DBM_PBLKSIZ)
+ *
+ * @return the created database, or NULL on error with errno set.
+ */
+DBM *
+sdbm_prep_paged(const char *dirname, const char *pagname,
+	const char *datname, int flags, int mode, size_t pagesize)
 {
 	DBM *db;
 	filestat_t dstat;
@@ -343,18 +578,6 @@ sdbm_prep(const char *dirname, const char *pagname,
 		goto error;
 	}
 
-	/*
-	 * If configured to use the LRU cache, then db->pagbuf will point to
-	 * pages allocated in the cache, so it need not be allocated separately.
-	 */
-
-#ifndef LRU
-	if ((db->pagbuf = walloc(DBM_PBLKSIZ)) == NULL) {
-		errno = ENOMEM;
-		goto error;
-	}
-#endif
-
 	/*
 	 * adjust user flags so that WRONLY becomes RDWR,
 	 * as required by this package. Also set our internal
@@ -371,7 +594,11 @@ sdbm_prep(const char *dirname, const char *pagname,
 	 * If we fail anywhere, undo everything, return NULL.
 	 */
 
-	if ((db->pagf = file_open(pagname, flags, mode)) > -1) {
+	if (
+		(db->pagf = file_open(pagname, flags, mode)) > -1 &&
+		(db->pagname = h_strdup(pagname)) != NULL &&
+		sdbm_pag_setup(db, pagesize)
+	) {
 		if ((db->dirf = file_open(dirname, flags, mode)) > -1) {
 
 			/*
@@ -405,6 +632,18 @@ error:
 
 success:
 
+	/*
+	 * If configured to use the LRU cache, then db->pagbuf will point to
+	 * pages allocated in the cache, so it need not be allocated separately.
+	 */
+
+#ifndef LRU
+	if ((db->pagbuf = walloc(db->pblksiz)) == NULL) {
+		errno = ENOMEM;
+		goto error;
+	}
+#endif
+
 #ifdef BIGDATA
 	if (datname != NULL) {
 		db->datname = h_strdup(datname);
@@ -426,7 +665,6 @@ success:
 #endif
 
 	db->dirname = h_strdup(dirname);
-	db->pagname = h_strdup(pagname);
 	db->openflags = flags;
 	db->openmode = mode;
 
@@ -730,6 +968,10 @@ log_sdbmstats(DBM *db)
 	s_info("sdbm: \"%s\" inplace value writes = %.2f%% on %lu occurence%s",
 		sdbm_name(db), db->repl_inplace * 100.0 / MAX(db->repl_stores, 1),
 		db->repl_stores, plural(db->repl_stores));
+	if (db->pagmapped != 0) {
+		s_info("sdbm: \"%s\" page reads served by memory mapping = %lu "
+			"(%zu-byte pages)", sdbm_name(db), db->pagmapped, db->pblksiz);
+	}
 }
 
 static void
@@ -927,9 +1169,11 @@ sdbm_close_internal(DBM *db, bool clearfiles, bool destroy)
 	if (is_valid_fd(db->pagf))
 		lru_close(db);
 #else
-	WFREE_NULL(db->pagbuf, DBM_PBLKSIZ);
+	WFREE_NULL(db->pagbuf, db->pblksiz);
 #endif	/* LRU */
 
+	sdbm_pag_unmap(db);
+
 	WFREE_NULL(db->dirbuf, DBM_DBLKSIZ);
 	fd_forget_and_close(&db->dirf);
 	fd_forget_and_close(&db->pagf);
@@ -1101,7 +1345,7 @@ sdbm_close(DBM *db)
 datum
 sdbm_fetch(DBM *db, datum key)
 {
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return nullitem;
 	}
@@ -1134,7 +1378,7 @@ null:
 int
 sdbm_exists(DBM *db, datum key)
 {
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1167,7 +1411,7 @@ sdbm_delete(DBM *db, datum key)
 {
 	int status = -1;
 
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1249,7 +1493,7 @@ storepair(DBM *db, datum key, datum val, int flags, bool *existed)
 	if G_UNLIKELY(0 == val.dsize) {
 		val.dptr = "";
 	}
-	if G_UNLIKELY(db == NULL || bad(key) || bad(val)) {
+	if G_UNLIKELY(db == NULL || bad(db, key) || bad(db, val)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1270,7 +1514,7 @@ storepair(DBM *db, datum key, datum val, int flags, bool *existed)
 	 * is the pair too big (or too small) for this database ?
 	 */
 
-	if G_UNLIKELY(!sdbm_storage_needs(key.dsize, val.dsize, &need)) {
+	if G_UNLIKELY(!sdbm_storage_needs(db->pairmax, key.dsize, val.dsize, &need)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1422,16 +1666,14 @@ sdbm_replace(DBM *db, datum key, datum val, bool *existed)
 }
 
 /*
- * makroom - make room by splitting the overfull page
+ * makroom_buf - make room by splitting the overfull page
  * this routine will attempt to make room for DBM_SPLTMAX times before
- * giving up.
+ * giving up.  The `twin' and `cur' buffers are scratch pages.
  */
 static bool
-makroom(DBM *db, long int hash, size_t need)
+makroom_buf(DBM *db, long int hash, size_t need, char *twin, char *cur)
 {
 	long newp;
-	char twin[DBM_PBLKSIZ];
-	char cur[DBM_PBLKSIZ];
 	char *pag = db->pagbuf;
 	long curbno;
 	char *New = (char *) twin;
@@ -1448,7 +1690,7 @@ makroom(DBM *db, long int hash, size_t need)
 		 * operation and restore the database to a consistent disk image.
 		 */
 
-		memcpy(cur, pag, DBM_PBLKSIZ);
+		memcpy(cur, pag, db->pblksiz);
 		curbno = db->pagbno;
 
 		/*
@@ -1481,7 +1723,7 @@ makroom(DBM *db, long int hash, size_t need)
 
 #ifdef DOSISH		/* DOS-behaviour -- filesystem holes not supported */
 		{
-			static const char zer[DBM_PBLKSIZ];
+			static const char zer[DBM_PBLKSIZ_MAX];
 			long oldtail;
 
 			/*
@@ -1490,12 +1732,12 @@ makroom(DBM *db, long int hash, size_t need)
 			 */
 
 			oldtail = lseek(db->pagf, 0L, SEEK_END);
-			while (OFF_PAG(newp) > oldtail) {
+			while (OFF_PAG(db, newp) > oldtail) {
 				if (lseek(db->pagf, 0L, SEEK_END) < 0 ||
-				    write(db->pagf, zer, DBM_PBLKSIZ) < 0) {
+				    write(db->pagf, zer, db->pblksiz) < 0) {
 					return FALSE;
 				}
-				oldtail += DBM_PBLKSIZ;
+				oldtail += db->pblksiz;
 			}
 		}
 #endif	/* DOSISH */
@@ -1509,7 +1751,7 @@ makroom(DBM *db, long int hash, size_t need)
 
 #ifdef LRU
 			if G_UNLIKELY(!force_flush_pagbuf(db, !db->is_volatile)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1526,7 +1768,7 @@ makroom(DBM *db, long int hash, size_t need)
 					/* Restore page address of the page we tried to split */
 					if (!readbuf(db, curbno, NULL))
 						g_assert_not_reached();
-					memcpy(db->pagbuf, cur, DBM_PBLKSIZ);	/* Undo split */
+					memcpy(db->pagbuf, cur, db->pblksiz);	/* Undo split */
 					db->pagbno = curbno;
 					db->spl_errors++;
 					goto aborted;
@@ -1537,7 +1779,7 @@ makroom(DBM *db, long int hash, size_t need)
 			pag = db->pagbuf;		/* Must refresh pointer to current page */
 #else
 			if G_UNLIKELY(!flush_pagbuf(db)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1550,7 +1792,7 @@ makroom(DBM *db, long int hash, size_t need)
 			 */
 
 			db->pagbno = newp;
-			memcpy(pag, New, DBM_PBLKSIZ);
+			memcpy(pag, New, db->pblksiz);
 		}
 #ifdef LRU
 		else if (db->is_volatile) {
@@ -1567,7 +1809,7 @@ makroom(DBM *db, long int hash, size_t need)
 			 */
 
 			if G_UNLIKELY(!cachepag(db, New, newp)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1575,12 +1817,12 @@ makroom(DBM *db, long int hash, size_t need)
 #endif	/* LRU */
 		else if G_UNLIKELY((
 			db->pagwrite++,
-			compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0)
+			compat_pwrite(db->pagf, New, db->pblksiz, OFF_PAG(db, newp)) < 0)
 		) {
 			s_warning("sdbm: \"%s\": cannot flush new page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
-			memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+			memcpy(pag, cur, db->pblksiz);	/* Undo split */
 			db->spl_errors++;
 			goto aborted;
 		}
@@ -1693,7 +1935,7 @@ restore:
 #endif
 
 		db->pagbno = curbno;
-		memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+		memcpy(pag, cur, db->pblksiz);	/* Undo split */
 
 #ifdef LRU
 		if (!force_flush_pagbuf(db, !db->is_volatile))
@@ -1724,8 +1966,8 @@ restore:
 		g_assert(db->pagbno != newp);
 		lru_invalidate(db, newp);	/* We're about to commit a newer version */
 #endif
-		memset(New, 0, DBM_PBLKSIZ);
-		if (compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0) {
+		memset(New, 0, db->pblksiz);
+		if (compat_pwrite(db->pagf, New, db->pblksiz, OFF_PAG(db, newp)) < 0) {
 			s_critical("sdbm: \"%s\": cannot zero-back new split page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
@@ -1733,7 +1975,7 @@ restore:
 			db->spl_corrupt++;
 		}
 
-		memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+		memcpy(pag, cur, db->pblksiz);	/* Undo split */
 	}
 
 	/* FALL THROUGH */
@@ -1743,6 +1985,31 @@ aborted:
 	return FALSE;
 }
 
+/*
+ * makroom - make room by splitting the overfull page, using scratch pages
+ * on the stack for the default page size and allocated otherwise to avoid
+ * large stack frames.
+ */
+static bool
+makroom(DBM *db, long int hash, size_t need)
+{
+	char *scratch;
+	bool ok;
+
+	if G_LIKELY(DBM_PBLKSIZ == db->pblksiz) {
+		char twin[DBM_PBLKSIZ];
+		char cur[DBM_PBLKSIZ];
+
+		return makroom_buf(db, hash, need, twin, cur);
+	}
+
+	scratch = walloc(2 * db->pblksiz);
+	ok = makroom_buf(db, hash, need, scratch, scratch + db->pblksiz);
+	wfree(scratch, 2 * db->pblksiz);
+
+	return ok;
+}
+
 static datum
 iteration_done(DBM *db, bool completed)
 {
@@ -1917,7 +2184,7 @@ sdbm_firstkey(DBM *db)
 	 * Start at page 0, skipping any page we can't read.
 	 */
 
-	for (db->blkptr = 0; OFF_PAG(db->blkptr) <= db->pagtail; db->blkptr++) {
+	for (db->blkptr = 0; OFF_PAG(db, db->blkptr) <= db->pagtail; db->blkptr++) {
 		db->keyptr = 0;
 		if (fetch_pagbuf(db, db->blkptr)) {
 			if (db->flags & DBM_KEYCHECK)
@@ -2281,7 +2548,7 @@ getnext(DBM *db)
 		db->keyptr = 0;
 		db->blkptr++;
 
-		if G_UNLIKELY(OFF_PAG(db->blkptr) > db->pagtail)
+		if G_UNLIKELY(OFF_PAG(db, db->blkptr) > db->pagtail)
 			break;
 		else if G_UNLIKELY(!fetch_pagbuf(db, db->blkptr))
 			goto next_page;		/* Skip faulty page */
@@ -2454,6 +2721,7 @@ no_entry:
  *
  * DBM_F_SAFE		activate keycheck during iteration
  * DBM_F_SKIP		skip unreadable keys/values (could happen on big entries)
+ * DBM_F_NOCACHE	do not let the traversal evict pages from the LRU cache
  *
  * @param db		the database on which we're iterating
  * @param flags		operating flags, see above
@@ -2473,6 +2741,9 @@ sdbm_foreach(DBM *db, int flags, sdbm_cb_t cb, void *arg)
 
 	sdbm_synchronize(db);
 
+	if (flags & DBM_F_NOCACHE)
+		db->flags |= DBM_NOCACHE;
+
 	for (
 		key = (flags & DBM_F_SAFE) ? sdbm_firstkey_safe(db) : sdbm_firstkey(db);
 		key.dptr != NULL;
@@ -2487,6 +2758,7 @@ sdbm_foreach(DBM *db, int flags, sdbm_cb_t cb, void *arg)
 		}
 	}
 
+	db->flags &= ~DBM_NOCACHE;
 	sdbm_unsynchronize(db);
 
 	return count;
@@ -2500,6 +2772,7 @@ sdbm_foreach(DBM *db, int flags, sdbm_cb_t cb, void *arg)
  *
  * DBM_F_SAFE		activate keycheck during iteration
  * DBM_F_SKIP		skip unreadable keys/values (could happen on big entries)
+ * DBM_F_NOCACHE	do not let the traversal evict pages from the LRU cache
  *
  * @param db		the database on which we're iterating
  * @param flags		operating flags, see above
@@ -2520,6 +2793,9 @@ sdbm_foreach_remove(DBM *db, int flags, sdbm_cbr_t cb, void *arg)
 
 	sdbm_synchronize(db);
 
+	if (flags & DBM_F_NOCACHE)
+		db->flags |= DBM_NOCACHE;
+
 	for (
 		key = (flags & DBM_F_SAFE) ? sdbm_firstkey_safe(db) : sdbm_firstkey(db);
 		key.dptr != NULL;
@@ -2540,6 +2816,7 @@ sdbm_foreach_remove(DBM *db, int flags, sdbm_cbr_t cb, void *arg)
 		}
 	}
 
+	db->flags &= ~DBM_NOCACHE;
 	sdbm_unsynchronize(db);
 
 	return count;
@@ -2657,12 +2934,12 @@ sdbm_count(const DBM *db)
 	}
 #endif
 
-	if (-1 == seek_to_filepos(db->pagf, 0)) {
+	if (-1 == seek_to_filepos(db->pagf, db->pagbase)) {
 		count = (ssize_t) -1;
 		goto done;
 	}
 
-	len = SDBM_COUNT_PAGES * DBM_PBLKSIZ;
+	len = SDBM_COUNT_PAGES * db->pblksiz;
 	buf = vmm_alloc(len);
 	compat_fadvise_sequential(db->pagf, 0, 0);
 
@@ -2679,11 +2956,11 @@ sdbm_count(const DBM *db)
 			goto abort;
 		}
 
-		n = r / DBM_PBLKSIZ;		/* Amount of pages fully read */
+		n = r / db->pblksiz;		/* Amount of pages fully read */
 		finished = n != SDBM_COUNT_PAGES;
 
-		for (pag = buf; n != 0; n--, pag = ptr_add_offset(pag, DBM_PBLKSIZ)) {
-			if (sdbm_chkpage(pag))
+		for (pag = buf; n != 0; n--, pag = ptr_add_offset(pag, db->pblksiz)) {
+			if (sdbm_chkpage_len(pag, db->pblksiz))
 				count += paircount(pag);
 		}
 
@@ -2740,7 +3017,7 @@ sdbm_shrink(DBM *db)
 
 	paglen = buf.st_size;
 
-	while ((offset = OFF_PAG(bno)) < paglen) {
+	while ((offset = OFF_PAG(db, bno)) < paglen) {
 		unsigned short count;
 		int r;
 
@@ -2779,7 +3056,7 @@ sdbm_shrink(DBM *db)
 		bno++;
 	}
 
-	offset = OFF_PAG(truncate_bno);
+	offset = OFF_PAG(db, truncate_bno);
 
 	if (offset < paglen) {
 		if (-1 == ftruncate(db->pagf, offset))
@@ -3175,6 +3452,8 @@ sdbm_clear(DBM *db)
 	db->delta = 0;
 	if G_UNLIKELY(-1 == ftruncate(db->pagf, 0))
 		goto error;
+	if G_UNLIKELY(db->pagbase != 0 && !sdbm_pag_write_header(db))
+		goto error;
 	db->pagbno = -1;
 	db->pagtail = 0L;
 	if G_UNLIKELY(-1 == ftruncate(db->dirf, 0))
@@ -3270,6 +3549,90 @@ sdbm_get_wdelay(const DBM *db)
 	sdbm_return(db, delayed);
 }
 
+/**
+ * @return the page replacement policy of the LRU cache.
+ */
+enum sdbm_cache_policy
+sdbm_get_cache_policy(const DBM *db)
+{
+	enum sdbm_cache_policy policy;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef LRU
+	policy = getpolicy(db);
+#else
+	policy = SDBM_CACHE_LRU;
+#endif
+
+	sdbm_return(db, policy);
+}
+
+/**
+ * Set the page replacement policy of the LRU cache.
+ */
+int
+sdbm_set_cache_policy(DBM *db, enum sdbm_cache_policy policy)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef LRU
+	result = setpolicy(db, policy);
+#else
+	(void) policy;
+	errno = ENOTSUP;
+	result = -1;
+#endif
+
+	sdbm_return(db, result);
+}
+
+/**
+ * @return the name of the page replacement policy.
+ */
+const char *
+sdbm_cache_policy_to_string(enum sdbm_cache_policy policy)
+{
+	switch (policy) {
+	case SDBM_CACHE_LRU:	return "LRU";
+	case SDBM_CACHE_2Q:		return "2Q";
+	}
+
+	return "unknown";
+}
+
+/**
+ * Fetch LRU cache statistics.
+ *
+ * @return TRUE if the database has a page cache, FALSE otherwise.
+ */
+bool
+sdbm_cache_stats(const DBM *db, struct sdbm_cache_stats *stats)
+{
+	bool result;
+
+	sdbm_check(db);
+	g_assert(stats != NULL);
+
+	sdbm_synchronize(db);
+
+#ifdef LRU
+	lru_stats(db, stats);
+	result = db->cache != NULL;
+#else
+	ZERO(stats);
+	result = FALSE;
+#endif
+
+	sdbm_return(db, result);
+}
+
 /**
  * Turn LRU write delays on or off.
  */
@@ -3293,6 +3656,88 @@ sdbm_set_wdelay(DBM *db, bool on)
 	sdbm_return(db, result);
 }
 
+/**
+ * Turn read-only memory mapping of the .pag and .dat files on or off.
+ *
+ * Once mapped, page and big data reads are served by copying from the
+ * mapping instead of issuing pread() system calls.  This is only allowed on
+ * read-only databases since the mapping does not follow updates: parts of
+ * the files beyond the mapped length are still read through the descriptor.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+sdbm_set_mmap(DBM *db, bool on)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+	if G_UNLIKELY(!(db->flags & DBM_RDONLY)) {
+		errno = EPERM;
+		goto error;
+	}
+
+	sdbm_pag_unmap(db);
+
+	if (on) {
+#ifdef HAS_MMAP
+		filestat_t buf;
+
+		if G_UNLIKELY(-1 == fstat(db->pagf, &buf))
+			goto error;
+
+		if G_UNLIKELY(UNSIGNED(buf.st_size) > MAX_INT_VAL(size_t)) {
+			errno = EFBIG;
+			goto error;
+		}
+
+		if (buf.st_size > 0) {
+			void *p = vmm_mmap(NULL, buf.st_size,
+				PROT_READ, MAP_PRIVATE, db->pagf, 0);
+
+			if G_UNLIKELY(MAP_FAILED == p)
+				goto error;
+
+			db->pagmap = p;
+			db->pagmaplen = buf.st_size;
+		}
+#else
+		errno = ENOTSUP;
+		goto error;
+#endif	/* HAS_MMAP */
+	}
+
+#ifdef BIGDATA
+	if G_UNLIKELY(-1 == big_set_mmap(db, on)) {
+		sdbm_pag_unmap(db);
+		goto error;
+	}
+#endif
+
+	result = 0;
+
+done:
+	sdbm_return(db, result);
+
+error:
+	result = -1;
+	goto done;
+}
+
+/**
+ * @return whether the .pag file is memory-mapped.
+ */
+bool
+sdbm_is_mmapped(const DBM *db)
+{
+	sdbm_check(db);
+
+	return db->pagmap != NULL;
+}
+
 /**
  * @return whether database was flagged as "volatile".
  */
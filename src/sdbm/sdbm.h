@@ -9,9 +9,11 @@
 #define _sdbm_h_
 
 #define DBM_DBLKSIZ 4096		/* size of a page within ".dir" files */
-#define DBM_PBLKSIZ 1024		/* size of a page within ".pag" files */
+#define DBM_PBLKSIZ 1024		/* default size of a page within ".pag" files */
+#define DBM_PBLKSIZ_MAX 16384	/* maximum size of a page within ".pag" files */
 #define DBM_BBLKSIZ 1024		/* size of a page within ".dat" files */
 #define DBM_PAIRMAX 1008		/* arbitrary on DBM_PBLKSIZ-N */
+#define DBM_PAIROVH	(DBM_PBLKSIZ - DBM_PAIRMAX)	/* page space not for pairs */
 #define DBM_SPLTMAX	10			/* maximum allowed splits for an insertion */
 #define DBM_DIRFEXT	".dir"
 #define DBM_PAGFEXT	".pag"
@@ -25,6 +27,7 @@ typedef struct DBM DBM;
 #define DBM_KEYCHECK	(1 << 3)	/* safe mode during iteration */
 #define DBM_ITERATING	(1 << 4)	/* within an iteration */
 #define DBM_BROKEN		(1 << 5)	/* broken database, do not use */
+#define DBM_NOCACHE		(1 << 6)	/* page reads must not pollute cache */
 
 typedef struct {
 	char *dptr;
@@ -44,12 +47,39 @@ extern const datum nullitem;
  */
 #define DBM_F_SAFE		(1 << 1)	/* activate keycheck during iteration */
 #define DBM_F_SKIP		(1 << 2)	/* skip unreadable keys/values */
+#define DBM_F_NOCACHE	(1 << 4)	/* scan: do not promote pages in cache */
 
 /*
  * flags to sdbm_loose_foreach*() routines.
  */
 #define DBM_F_ALLKEYS	(1 << 3)	/* ensure we iterate on all keys */
 
+/*
+ * page cache replacement policies, for sdbm_set_cache_policy()
+ */
+enum sdbm_cache_policy {
+	SDBM_CACHE_LRU = 0,			/* plain LRU (default) */
+	SDBM_CACHE_2Q				/* scan-resistant 2Q */
+};
+
+/*
+ * page cache statistics, filled by sdbm_cache_stats()
+ */
+struct sdbm_cache_stats {
+	enum sdbm_cache_policy policy;	/* replacement policy */
+	size_t pages;					/* configured amount of pages */
+	size_t cached;					/* pages currently cached */
+	size_t wired;					/* pages currently wired */
+	size_t ghosts;					/* 2Q: remembered evicted page numbers */
+	unsigned long rhits;			/* cache hits on reads */
+	unsigned long rmisses;			/* cache misses on reads */
+	unsigned long whits;			/* cache hits on writes */
+	unsigned long wmisses;			/* cache misses on writes */
+	unsigned long evictions;		/* pages evicted to make room */
+	unsigned long ghost_hits;		/* 2Q: misses on recently evicted pages */
+	unsigned long scan_reads;		/* non-caching reads from iterations */
+};
+
 typedef void (*sdbm_cb_t)(const datum key, const datum value, void *arg);
 typedef bool (*sdbm_cbr_t)(const datum key, const datum value, void *arg);
 
@@ -57,6 +87,7 @@ typedef bool (*sdbm_cbr_t)(const datum key, const datum value, void *arg);
  * ndbm interface
  */
 DBM *sdbm_open(const char *, int, int);
+DBM *sdbm_open_paged(const char *, int, int, size_t);
 void sdbm_close(DBM *);
 datum sdbm_fetch(DBM *, datum);
 int sdbm_delete(DBM *, datum);
@@ -74,6 +105,12 @@ int sdbm_exists(DBM *, datum);
  * other
  */
 DBM *sdbm_prep(const char *, const char *, const char *, int, int);
+DBM *sdbm_prep_paged(const char *, const char *, const char *, int, int,
+	size_t);
+bool sdbm_pagesize_is_valid(size_t) G_CONST;
+size_t sdbm_pagesize(const DBM *) G_PURE;
+int sdbm_set_mmap(DBM *db, bool on);
+bool sdbm_is_mmapped(const DBM *) G_PURE;
 long sdbm_hash(const char *, size_t) G_PURE;
 bool sdbm_rdonly(const DBM *);
 bool sdbm_error(const DBM *);
@@ -89,6 +126,10 @@ int sdbm_set_cache(DBM *db, long pages);
 long sdbm_get_cache(const DBM *) G_PURE;
 int sdbm_set_wdelay(DBM *db, bool on);
 bool sdbm_get_wdelay(const DBM *) G_PURE;
+int sdbm_set_cache_policy(DBM *db, enum sdbm_cache_policy policy);
+enum sdbm_cache_policy sdbm_get_cache_policy(const DBM *) G_PURE;
+const char *sdbm_cache_policy_to_string(enum sdbm_cache_policy) G_CONST;
+bool sdbm_cache_stats(const DBM *db, struct sdbm_cache_stats *stats);
 int sdbm_set_volatile(DBM *db, bool yes);
 bool sdbm_is_volatile(const DBM *) G_PURE;
 bool sdbm_shrink(DBM *db);
@@ -121,6 +162,8 @@ int sdbm_refcnt(const DBM *db);
  * These are not documented.
  */
 bool sdbm_chkpage(const char *);
+bool sdbm_chkpage_len(const char *, size_t);
+ssize_t sdbm_pagfile_pagesize(int fd);
 void sdbm_warn_if_not_separate(const DBM *db, const char *caller);
 
 /*
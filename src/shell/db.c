@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "db" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/dbmw.h"
+#include "lib/misc.h"			/* For short_size() */
+#include "lib/str.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+struct shell_db_ctx {
+	struct gnutella_shell *sh;
+	str_t *s;
+};
+
+static void
+shell_db_cache_line(void *data, void *udata)
+{
+	const dbmw_t *dw = data;
+	struct shell_db_ctx *ctx = udata;
+	struct sdbm_cache_stats cs;
+	unsigned long raccesses;
+	str_t *s = ctx->s;
+
+	if (!dbmw_map_cache_stats(dw, &cs))
+		return;			/* Not an SDBM back-end */
+
+	raccesses = cs.rhits + cs.rmisses;
+
+	str_printf(s, "%-3s ", sdbm_cache_policy_to_string(cs.policy));
+	str_catf(s, "%5zu %6zu %5zu %6zu ", cs.pages, cs.cached, cs.wired,
+		cs.ghosts);
+	str_catf(s, "%6.2f%% %9lu ", cs.rhits * 100.0 / MAX(raccesses, 1),
+		raccesses);
+	str_catf(s, "%8lu %7lu %8lu ", cs.evictions, cs.ghost_hits, cs.scan_reads);
+	str_catf(s, "\"%s\"\n", dbmw_name(dw));
+
+	shell_write(ctx->sh, str_2c(s));
+}
+
+static enum shell_reply
+shell_exec_db_cache(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	struct shell_db_ctx ctx;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	ctx.sh = sh;
+	ctx.s = str_new(80);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh,
+		"Pol Pages Cached Wired Ghosts  R-hits     Reads "
+		"Evictions G-hits    Scans Name\n");
+
+	dbmw_foreach_instance(shell_db_cache_line, &ctx);
+
+	str_destroy_null(&ctx.s);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+static void
+shell_db_sync_line(void *data, void *udata)
+{
+	const dbmw_t *dw = data;
+	struct shell_db_ctx *ctx = udata;
+	struct dbmw_sync_stats ss;
+	str_t *s = ctx->s;
+
+	if (!dbmw_sync_stats(dw, &ss))
+		return;			/* Never synced */
+
+	str_printf(s, "%7s %9s %8s %9s ",
+		uint64_to_string(ss.syncs), uint64_to_string2(ss.values),
+		uint64_to_string3(ss.pages), short_size(ss.bytes, FALSE));
+	str_catf(s, "%8.3f %8.3f ",
+		ss.time_us / 1000.0 / MAX(ss.syncs, 1), ss.last_us / 1000.0);
+	str_catf(s, "\"%s\"\n", dbmw_name(dw));
+
+	shell_write(ctx->sh, str_2c(s));
+}
+
+static enum shell_reply
+shell_exec_db_sync(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	struct shell_db_ctx ctx;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	ctx.sh = sh;
+	ctx.s = str_new(80);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh,
+		"  Syncs    Values    Pages   Written   Avg-ms  Last-ms Name\n");
+
+	dbmw_foreach_instance(shell_db_sync_line, &ctx);
+
+	str_destroy_null(&ctx.s);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+/**
+ * Handles the db command.
+ */
+enum shell_reply
+shell_exec_db(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_db_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(cache);
+	CMD(sync);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_db(void)
+{
+	return "Database monitoring interface";
+}
+
+const char *
+shell_help_db(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "cache")) {
+			return "db cache\n"
+				"show page cache statistics for each SDBM-backed store:\n"
+				"replacement policy, configured and cached pages, wired pages,\n"
+				"2Q ghost entries, read hit ratio, evictions, ghost hits\n"
+				"and non-caching reads done by scans\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "sync")) {
+			return "db sync\n"
+				"show write-back statistics for each store: amount of syncs,\n"
+				"dirty values flushed, pages and bytes written to disk,\n"
+				"average and last sync duration in milliseconds\n";
+		}
+	} else {
+		return "db cache\n"
+			"db sync\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -57,6 +57,8 @@ print_node_info(struct gnutella_shell *sh, const gnutella_node_t *n)
 	char vendor_escaped[50];
 	char uptime_buf[8];
 	char contime_buf[8];
+	char level_buf[4];
+	char ratio_buf[8];
 
 	g_return_if_fail(sh);
 	g_return_if_fail(n);
@@ -82,13 +84,24 @@ print_node_info(struct gnutella_shell *sh, const gnutella_node_t *n)
 	clamp_strcpy(ARYLEN(uptime_buf), up > 0 ? compact_time(up) : "?");
 	clamp_strcpy(ARYLEN(contime_buf), con > 0 ? compact_time(con) : "?");
 
+	if (NODE_TX_COMPRESSED(n)) {
+		str_bprintf(ARYLEN(level_buf), "%d", n->tx_zlevel);
+		str_bprintf(ARYLEN(ratio_buf), "%d%%",
+			(int) (100 * NODE_TX_COMPRESSION_RATIO(n)));
+	} else {
+		clamp_strcpy(ARYLEN(level_buf), "-");
+		clamp_strcpy(ARYLEN(ratio_buf), "-");
+	}
+
 	str_bprintf(ARYLEN(buf),
-		"%-21.45s %s %2.2s %6.6s %6.6s %.56s",
+		"%-21.45s %s %2.2s %6.6s %6.6s %1.1s %5.5s %.56s",
 		node_gnet_addr(n),
 		node_flags_to_string(&flags),
 		iso3166_country_cc(n->country),
 		contime_buf,
 		uptime_buf,
+		level_buf,
+		ratio_buf,
 		vendor_escaped);
 
 	shell_write(sh, buf);
@@ -111,7 +124,7 @@ shell_exec_nodes(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	shell_write(sh,
 	  "100~ \n"
-	  "Node                  Flags       CC Since  Uptime User-Agent\n");
+	  "Node                  Flags       CC Since  Uptime Z Ratio User-Agent\n");
 
 	PSLIST_FOREACH(node_all_nodes(), sl) {
 		const gnutella_node_t *n = sl->data;